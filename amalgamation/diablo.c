@@ -13,71 +13,8166 @@
  * See the License for the specific language governing permissions and
  * limitations under the License.
  */
+/*** Start of inlined file: dispatch.h ***/
+#include <stdatomic.h>
+/*** Start of inlined file: diablo.h ***/
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+// Backends
+//
+// Every operation has one implementation ('kernel') per backend it supports.
+// The best backend for the current machine is chosen on first use, and every
+// later call goes straight to its kernels. You only need the functions below if
+// you want to know which one was picked, or to force a different one (for
+// example, to test or benchmark every kernel on the same machine).
+
+typedef enum {
+  // Portable 64-bit word tricks; available everywhere.
+  DIABLO_BACKEND_SWAR = 0,
+  // x86 and x86-64 with SSE2.
+  DIABLO_BACKEND_SSE2 = 1,
+  // x86-64 with AVX2, detected at runtime.
+  DIABLO_BACKEND_AVX2 = 2,
+  // ARM with NEON.
+  DIABLO_BACKEND_NEON = 3,
+  // x86-64 with AVX-512BW, detected at runtime.
+  DIABLO_BACKEND_AVX512BW = 4,
+  // x86 and x86-64 with SSSE3, detected at runtime. Operations which don't
+  // need byte shuffles use the SSE2 kernels here.
+  DIABLO_BACKEND_SSSE3 = 5
+} diablo_backend;
+
+// The backend currently in use. Chooses one if this hasn't happened yet.
+diablo_backend diablo_get_backend(void);
+
+// Whether this build contains the given backend, and the current machine can
+// run it.
+bool diablo_backend_supported(diablo_backend const backend);
+
+// Use the given backend for all subsequent calls. Returns false, and changes
+// nothing, if the backend isn't supported.
+//
+// Calls already in progress on other threads finish on whichever backend they
+// started with.
+bool diablo_set_backend(diablo_backend const backend);
+
+// Undo any forcing, choose the best backend for this machine again, and return
+// it.
+diablo_backend diablo_reset_backend(void);
+
+// A short, human-readable name for the given backend.
+char const* diablo_backend_name(diablo_backend const backend);
+
+// Threads
+//
+// Operations whose names end in _parallel split long inputs between several
+// threads, using a pool which is started on first use, then kept for later
+// calls. If two calls want the pool at once, or the platform has no C11
+// threads, the work happens on the calling thread instead.
+
+// How many threads, including the calling one, the parallel operations use. By
+// default, this is one per online CPU.
+size_t diablo_get_threads(void);
+
+// Set how many threads the parallel operations use, including the calling one.
+// 0 goes back to the default. At most 64 are ever used.
+void diablo_set_threads(size_t const threads);
+
+// How long, in bytes, an input must be before the parallel operations use more
+// than one thread. By default, this is 4 MiB.
+size_t diablo_get_parallel_threshold(void);
+
+// Set how long an input must be before the parallel operations use more than
+// one thread.
+void diablo_set_parallel_threshold(size_t const bytes);
+
+// Statistics
+//
+// Builds made with the 'stats' meson option (or, for the amalgamation, with
+// DIABLO_STATS defined to 1) count every call to every operation on a range:
+// everything from "Counting" onwards, bar the functions which only work out
+// lengths. Each thread counts on its own, so this costs a few increments per
+// call, and nothing is shared until you ask for totals. Other builds count
+// nothing, and don't have the functions below.
+
+// What a build with statistics has counted for one operation, across every
+// thread, since the start or the last diablo_reset_stats.
+typedef struct {
+  uint64_t calls;
+  // The total length, in bytes, of the input. For operations on two ranges,
+  // this is the shorter one; for diablo_count_eq_batch, it's every slice
+  // together; rank and select queries have none.
+  uint64_t bytes;
+  // Calls made while each backend was active, indexed by diablo_backend.
+  uint64_t backends[DIABLO_BACKEND_SSSE3 + 1];
+  // Calls by input length: lengths[0] counts those of 0 bytes, and lengths[k]
+  // those of at least 2^(k - 1) bytes, but fewer than 2^k.
+  uint64_t lengths[65];
+} diablo_stats;
+
+// How many operations are counted. They are numbered from 0.
+size_t diablo_stats_functions(void);
+
+// The name of the given operation's function, such as "diablo_count_eq", or
+// NULL if there's no such operation.
+char const* diablo_stats_name(size_t const function);
+
+// Write the given operation's counts to out. Returns false, and writes
+// nothing, if there's no such operation.
+//
+// Calls on other threads at the same time may or may not be included.
+bool diablo_get_stats(size_t const function, diablo_stats* const out);
+
+// Start counting again from zero, for every operation.
+void diablo_reset_stats(void);
+
+// Counting
+
+// Count the bytes in the range equal to the given one.
+size_t diablo_count_eq(uint8_t const* const src,
+                       size_t const off,
+                       size_t const len,
+                       uint8_t const byte);
+
+// As diablo_count_eq, but splits the range between threads if it's long
+// enough. See "Threads" above.
+size_t diablo_count_eq_parallel(uint8_t const* const src,
+                                size_t const off,
+                                size_t const len,
+                                uint8_t const byte);
+
+// Count the bytes in the range equal to each of needles_len needles, in one
+// pass, writing the count for needles[i] to counts[i]. Up to eight needles
+// take the same time as one; beyond that, every eight need another pass.
+void diablo_count_eq_multi(uint8_t const* const src,
+                           size_t const off,
+                           size_t const len,
+                           uint8_t const* const needles,
+                           size_t const needles_len,
+                           size_t* const counts);
+
+// A range of bytes: len of them, starting at src[off].
+typedef struct {
+  uint8_t const* src;
+  size_t off;
+  size_t len;
+} diablo_slice;
+
+// Count the bytes equal to the given one in each of slices_len slices, writing
+// the count for slices[i] to counts[i]. This is much faster than calling
+// diablo_count_eq on each slice when they're short.
+void diablo_count_eq_batch(diablo_slice const* const slices,
+                           size_t const slices_len,
+                           uint8_t const byte,
+                           size_t* const counts);
+
+// Count the bytes in the range which are members of the given set. The set is
+// 32 bytes long, and is a bitmap: a byte b is a member exactly when bit (b % 8)
+// of set[b / 8] is 1.
+size_t diablo_count_in_set(uint8_t const* const src,
+                           size_t const off,
+                           size_t const len,
+                           uint8_t const* const set);
+
+// Count the 1 bits in the range.
+size_t diablo_popcount(uint8_t const* const src,
+                       size_t const off,
+                       size_t const len);
+
+// Count every byte value in the range, adding the counts to hist, which must
+// have 256 entries: hist[b] goes up by the number of bytes equal to b. Zero it
+// first for a fresh histogram; leave it as-is to accumulate over several
+// ranges.
+void diablo_byte_histogram(uint8_t const* const src,
+                           size_t const off,
+                           size_t const len,
+                           size_t* const hist);
+
+// Searching
+//
+// Positions are relative to the start of the range: 0 is src[off].
+
+// The position of the first byte in the range equal to the given one, or len if
+// there isn't one.
+size_t diablo_find_first_eq(uint8_t const* const src,
+                            size_t const off,
+                            size_t const len,
+                            uint8_t const byte);
+
+// The position of the last byte in the range equal to the given one, or len if
+// there isn't one.
+size_t diablo_find_last_eq(uint8_t const* const src,
+                           size_t const off,
+                           size_t const len,
+                           uint8_t const byte);
+
+// Write the positions of the bytes in the range equal to the given one into
+// out, in order, stopping once out_len have been written. Returns how many were
+// written.
+//
+// If that is out_len, there may be more. To continue, call again on the part of
+// the range after the last position written, and add that part's start to
+// what you get back.
+size_t diablo_find_all_eq(uint8_t const* const src,
+                          size_t const off,
+                          size_t const len,
+                          uint8_t const byte,
+                          size_t* const out,
+                          size_t const out_len);
+
+// Comparing
+
+// The position of the first byte at which the len bytes starting at a[a_off]
+// differ from the len bytes starting at b[b_off], or len if they're the same.
+// This is also the length of their longest common prefix.
+size_t diablo_mismatch(uint8_t const* const a,
+                       size_t const a_off,
+                       uint8_t const* const b,
+                       size_t const b_off,
+                       size_t const len);
+
+// Compare the a_len bytes starting at a[a_off] with the b_len bytes starting at
+// b[b_off] lexicographically, as unsigned bytes, in the manner of memcmp. A
+// range which is a prefix of the other is the lesser. Returns a negative
+// number, zero or a positive number, as the first range is less than, equal to
+// or greater than the second.
+int diablo_compare(uint8_t const* const a,
+                   size_t const a_off,
+                   size_t const a_len,
+                   uint8_t const* const b,
+                   size_t const b_off,
+                   size_t const b_len);
+
+// Hashing
+//
+// These compute XXH3 (from xxHash 0.8), in its 64-bit form with a seed: a
+// fast, well-distributed hash, suitable for hash tables, but not for anything
+// where someone might choose inputs to collide on purpose. Results are the same
+// on every machine and backend, and the same as XXH3_64bits_withSeed from
+// xxHash itself.
+
+// The hash of the range with the given seed.
+uint64_t diablo_hash64(uint8_t const* const src,
+                       size_t const off,
+                       size_t const len,
+                       uint64_t const seed);
+
+// A hash of input that arrives in chunks. Treat the fields as private.
+typedef struct {
+  uint64_t acc[8];
+  uint64_t seed;
+  uint64_t len;
+  size_t buffered;
+  size_t stripes;
+  uint8_t secret[192];
+  uint8_t buffer[256];
+} diablo_hash64_state;
+
+// Start hashing afresh with the given seed.
+void diablo_hash64_init(diablo_hash64_state* const state, uint64_t const seed);
+
+// Add the range to what the state has hashed so far. However the input is
+// split into ranges, the result is the same.
+void diablo_hash64_update(diablo_hash64_state* const state,
+                          uint8_t const* const src,
+                          size_t const off,
+                          size_t const len);
+
+// The hash of everything added to the state since it was started: the same as
+// diablo_hash64 of all of it, with the same seed. This doesn't change the state,
+// so you can keep adding to it afterwards.
+uint64_t diablo_hash64_finish(diablo_hash64_state const* const state);
+
+// Indexing
+//
+// Bitmaps have one bit per byte of the range: bit (i % 64) of out[i / 64] is
+// for the byte at position i, relative to src[off]. out must have room for
+// (len + 63) / 64 words; bits past the end of the range are 0.
+
+// Write a bitmap of the bytes in the range which are members of the given set
+// to out. The set is as for diablo_count_in_set.
+void diablo_structural_bitmap(uint8_t const* const src,
+                              size_t const off,
+                              size_t const len,
+                              uint8_t const* const set,
+                              uint64_t* const out);
+
+// As diablo_structural_bitmap, but leaving out members of the set which are
+// between a pair of quote bytes. Quote bytes themselves are never left out,
+// and a doubled quote inside quotes (as CSV uses for escaping) closes then
+// reopens them, so it changes nothing.
+//
+// in_quotes says whether the range starts inside quotes; the return value says
+// whether it ends inside them. To index input in chunks, pass each chunk's
+// return value to the next one.
+bool diablo_structural_bitmap_quoted(uint8_t const* const src,
+                                     size_t const off,
+                                     size_t const len,
+                                     uint8_t const* const set,
+                                     uint8_t const quote,
+                                     bool const in_quotes,
+                                     uint64_t* const out);
+
+// Rank and select
+//
+// These answer queries about an array of len bits, where bit i is bit (i % 64)
+// of bits[i / 64], as for the bitmaps above. The bits past the end of the last
+// word don't matter. Positions count from 0.
+
+// A rank/select directory over an array of bits. It points to the bits and to
+// the storage given to diablo_rank_select_init, neither of which may change or
+// go away while it's in use. Treat the fields as private.
+typedef struct {
+  uint64_t const* bits;
+  size_t len;
+  size_t ones;
+  uint64_t* directory;
+} diablo_rank_select;
+
+// How many words of storage diablo_rank_select_init needs for an array of len
+// bits. This is about a quarter of the array's own size.
+size_t diablo_rank_select_size(size_t const len);
+
+// Build a directory over the array of len bits, using directory for storage,
+// which must have room for diablo_rank_select_size(len) words. This takes one
+// pass over the array.
+void diablo_rank_select_init(diablo_rank_select* const rs,
+                             uint64_t const* const bits,
+                             size_t const len,
+                             uint64_t* const directory);
+
+// The number of 1 bits before position pos. Any pos of len or more gives the
+// number in the whole array. This takes constant time.
+size_t diablo_rank1(diablo_rank_select const* const rs, size_t const pos);
+
+// As diablo_rank1, but counting 0 bits.
+size_t diablo_rank0(diablo_rank_select const* const rs, size_t const pos);
+
+// The position of 1 bit number n (counting from 0), or len if the array has n
+// or fewer. This takes constant time, plus a binary search over the stretch of
+// the array holding the nearest few thousand 1 bits.
+size_t diablo_select1(diablo_rank_select const* const rs, size_t const n);
+
+// As diablo_select1, but for 0 bits.
+size_t diablo_select0(diablo_rank_select const* const rs, size_t const n);
+
+// Translating
+//
+// These write len bytes starting at dst[dst_off], one for each byte of the
+// range starting at src[src_off]. To work in place, pass the same buffer and
+// offset for both; otherwise, the two must not overlap.
+
+// Replace every byte b of the range with table[b]. The table must have 256
+// entries.
+void diablo_translate(uint8_t const* const src,
+                      size_t const src_off,
+                      uint8_t* const dst,
+                      size_t const dst_off,
+                      size_t const len,
+                      uint8_t const* const table);
+
+// Add delta (wrapping around) to every byte of the range from lo to hi
+// inclusive, and leave the others alone. If lo > hi, no byte changes. For
+// example, lo = 'A', hi = 'Z' and delta = 32 make ASCII lower case. This is
+// much faster than diablo_translate with the equivalent table.
+void diablo_translate_range(uint8_t const* const src,
+                            size_t const src_off,
+                            uint8_t* const dst,
+                            size_t const dst_off,
+                            size_t const len,
+                            uint8_t const lo,
+                            uint8_t const hi,
+                            uint8_t const delta);
+
+// Replace every byte of the range equal to from with to, and leave the others
+// alone.
+void diablo_replace_eq(uint8_t const* const src,
+                       size_t const src_off,
+                       uint8_t* const dst,
+                       size_t const dst_off,
+                       size_t const len,
+                       uint8_t const from,
+                       uint8_t const to);
+
+// ASCII
+
+// Whether every byte in the range is ASCII; that is, below 0x80.
+bool diablo_is_ascii(uint8_t const* const src,
+                     size_t const off,
+                     size_t const len);
+
+// The position, relative to src[off], of the first byte in the range which
+// isn't ASCII, or len if they all are.
+size_t diablo_find_first_non_ascii(uint8_t const* const src,
+                                   size_t const off,
+                                   size_t const len);
+
+// Base16
+
+// Encode the range as lowercase hex, two digits per byte, high nibble first,
+// writing 2 * len bytes to dst starting at dst[dst_off].
+void diablo_encode_base16(uint8_t const* const src,
+                          size_t const off,
+                          size_t const len,
+                          uint8_t* const dst,
+                          size_t const dst_off);
+
+// Decode the range as hex, in either case, writing len / 2 bytes to dst
+// starting at dst[dst_off].
+//
+// Returns len if every character was a hex digit and len is even. Otherwise,
+// returns the position, relative to src[off], of the first character that
+// isn't a hex digit, or len - 1 for the odd one out at the end; only the
+// result / 2 bytes before the pair it's in have been written.
+size_t diablo_decode_base16(uint8_t const* const src,
+                            size_t const off,
+                            size_t const len,
+                            uint8_t* const dst,
+                            size_t const dst_off);
+
+// Base64
+
+// Which characters stand for 62 and 63: '+' and '/' for the standard alphabet
+// of RFC 4648, or '-' and '_' for the URL and filename safe one.
+typedef enum {
+  DIABLO_BASE64_STANDARD = 0,
+  DIABLO_BASE64_URL = 1
+} diablo_base64_alphabet;
+
+// How many characters diablo_encode_base64 makes from len bytes.
+size_t diablo_base64_encoded_length(size_t const len, bool const pad);
+
+// Encode the range as base64 in the given alphabet, writing to dst starting at
+// dst[dst_off]. If pad is set, a partial group at the end is padded with '='
+// to four characters. Returns the number of characters written, as given by
+// diablo_base64_encoded_length.
+size_t diablo_encode_base64(uint8_t const* const src,
+                            size_t const off,
+                            size_t const len,
+                            uint8_t* const dst,
+                            size_t const dst_off,
+                            diablo_base64_alphabet const alphabet,
+                            bool const pad);
+
+// How many bytes diablo_decode_base64 makes from the range, if it's valid.
+size_t diablo_base64_decoded_length(uint8_t const* const src,
+                                    size_t const off,
+                                    size_t const len);
+
+// Decode the range as base64 in the given alphabet, writing to dst starting at
+// dst[dst_off]; dst needs room for diablo_base64_decoded_length(src, off, len)
+// bytes. Padding is optional, but if there is any, it must make the length a
+// multiple of 4. The unused bits of the last character must be zero.
+//
+// Returns len if the range was valid. Otherwise, returns the position,
+// relative to src[off], of the first character that is invalid, either by not
+// being in the alphabet or by where it is; only the (result / 4) * 3 bytes
+// before its group of four have been written.
+size_t diablo_decode_base64(uint8_t const* const src,
+                            size_t const off,
+                            size_t const len,
+                            uint8_t* const dst,
+                            size_t const dst_off,
+                            diablo_base64_alphabet const alphabet);
+
+// UTF-8
+
+// Where validation of a stream of UTF-8 got to: the part of a sequence that
+// started in an earlier chunk, but didn't finish there. Treat the fields as
+// private. A zero-initialized state starts a fresh stream.
+typedef struct {
+  uint8_t remaining;
+  uint8_t lo;
+  uint8_t hi;
+} diablo_utf8_state;
+
+// Check that the range is valid UTF-8, continuing from the given state, which
+// is updated. Overlong encodings, surrogates and anything past U+10FFFF are all
+// invalid.
+//
+// Returns len if no errors were found; a sequence which is cut off at the end
+// of the range is not an error yet, but is kept in the state for the next
+// chunk. Otherwise, returns the position, relative to src[off], of the first
+// byte that can't be part of valid UTF-8, and the state should be discarded.
+size_t diablo_validate_utf8(uint8_t const* const src,
+                            size_t const off,
+                            size_t const len,
+                            diablo_utf8_state* const state);
+
+// Whether the stream the state belongs to could end here: false when it's in
+// the middle of a sequence.
+bool diablo_utf8_state_complete(diablo_utf8_state const* const state);
+
+// Count the code points in the range, assuming it's valid UTF-8. More
+// precisely, this counts the bytes which aren't continuation bytes.
+size_t diablo_count_utf8_codepoints(uint8_t const* const src,
+                                    size_t const off,
+                                    size_t const len);
+
+// The position, relative to src[off], of the first byte of code point n
+// (counting from 0) in the range, or len if the range has n or fewer code
+// points. As with diablo_count_utf8_codepoints, the range is assumed to be
+// valid UTF-8.
+size_t diablo_utf8_offset_of_nth(uint8_t const* const src,
+                                 size_t const off,
+                                 size_t const len,
+                                 size_t const n);
+
+// UTF-16
+
+// Transcode the range of UTF-16LE code units to UTF-8, writing to dst starting
+// at dst[dst_off]. dst must have room for at least
+// diablo_utf8_length_from_utf16le(src, off, len) bytes past that point;
+// nothing is written beyond what the output needs.
+//
+// Returns len if the range was valid UTF-16. Otherwise, returns the position,
+// relative to src[off], of the first unpaired surrogate; everything before it
+// has been transcoded. Either way, *written is set to the number of bytes
+// written.
+size_t diablo_utf16le_to_utf8(uint16_t const* const src,
+                              size_t const off,
+                              size_t const len,
+                              uint8_t* const dst,
+                              size_t const dst_off,
+                              size_t* const written);
+
+// Transcode the range of UTF-8 bytes to UTF-16LE, writing to dst starting at
+// dst[dst_off]. dst must have room for at least
+// diablo_utf16le_length_from_utf8(src, off, len) code units past that point;
+// nothing is written beyond what the output needs.
+//
+// Returns len if the range was valid UTF-8, in the same sense as
+// diablo_validate_utf8. Otherwise, returns the position, relative to src[off],
+// of the start of the first invalid sequence, including one cut off by the end
+// of the range; everything before it has been transcoded. Either way,
+// *written is set to the number of code units written.
+size_t diablo_utf8_to_utf16le(uint8_t const* const src,
+                              size_t const off,
+                              size_t const len,
+                              uint16_t* const dst,
+                              size_t const dst_off,
+                              size_t* const written);
+
+// The number of bytes diablo_utf16le_to_utf8 will write for the range. This is
+// exact if the range is valid UTF-16, and never too small otherwise.
+size_t diablo_utf8_length_from_utf16le(uint16_t const* const src,
+                                       size_t const off,
+                                       size_t const len);
+
+// The number of code units diablo_utf8_to_utf16le will write for the range.
+// This is exact if the range is valid UTF-8, and never too small otherwise.
+size_t diablo_utf16le_length_from_utf8(uint8_t const* const src,
+                                       size_t const off,
+                                       size_t const len);
+
+// Short inputs
+//
+// Calling into the library costs a function call and a look at the active
+// backend, which can be most of the work for a handful of bytes. The functions
+// below are static inline versions of some operations, for callers that can
+// inline C (including GHC's capi calling convention): ranges of at most
+// DIABLO_INLINE_LEN bytes are handled in place, a word at a time, and longer
+// ones call the library as usual. Each gives the same results as the function
+// it's named after.
+//
+// Calls handled in place don't go through the library, so statistics don't
+// count them.
+
+#define DIABLO_INLINE_LEN 32
+
+// Helpers for the functions below; not part of the API.
+
+static inline uint64_t diablo_inline_load (uint8_t const* const src) {
+  uint64_t word;
+  __builtin_memcpy(&word, src, sizeof(uint64_t));
+  return word;
+}
+
+// As eq_flags in the library: the high bit of every byte of word equal to
+// the corresponding byte of matches, and nothing else.
+static inline uint64_t diablo_inline_eq_flags (uint64_t const word,
+                                               uint64_t const matches) {
+  uint64_t const mask = 0x7F7F7F7F7F7F7F7FULL;
+  uint64_t const input = word ^ matches;
+  uint64_t const tmp = (input & mask) + mask;
+  return ~(tmp | input | mask);
+}
+
+// The index, in memory order, of the first byte of a word with any bit of
+// flags set. flags must not be zero.
+static inline size_t diablo_inline_first (uint64_t const flags) {
+#if (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+  return (size_t)__builtin_clzll(flags) / 8;
+#else
+  return (size_t)__builtin_ctzll(flags) / 8;
+#endif
+}
+
+// As diablo_inline_first, but for the last such byte.
+static inline size_t diablo_inline_last (uint64_t const flags) {
+#if (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+  return 7 - ((size_t)__builtin_ctzll(flags) / 8);
+#else
+  return 7 - ((size_t)__builtin_clzll(flags) / 8);
+#endif
+}
+
+// Clear every bit of the first n bytes, in memory order, for 0 < n < 8.
+static inline uint64_t diablo_inline_skip (uint64_t const flags,
+                                           size_t const n) {
+#if (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+  return flags & (~0ULL >> (8 * n));
+#else
+  return flags & (~0ULL << (8 * n));
+#endif
+}
+
+// As diablo_count_eq.
+static inline size_t diablo_count_eq_inline (uint8_t const* const src,
+                                             size_t const off,
+                                             size_t const len,
+                                             uint8_t const byte) {
+  if (len > DIABLO_INLINE_LEN) {
+    return diablo_count_eq(src, off, len, byte);
+  }
+  uint8_t const* const ptr = &(src[off]);
+  size_t total = 0;
+  if (len < 8) {
+    for (size_t i = 0; i < len; i++) {
+      total += (ptr[i] == byte);
+    }
+    return total;
+  }
+  uint64_t const matches = byte * 0x0101010101010101ULL;
+  size_t i = 0;
+  for (; i + 8 <= len; i += 8) {
+    uint64_t const flags =
+      diablo_inline_eq_flags(diablo_inline_load(&(ptr[i])), matches);
+    total += ((flags >> 7) * 0x0101010101010101ULL) >> 56;
+  }
+  if (i < len) {
+    // The last word overlaps bytes we've already counted, so skip those.
+    uint64_t const flags = diablo_inline_skip(
+      diablo_inline_eq_flags(diablo_inline_load(&(ptr[len - 8])), matches),
+      8 - (len - i));
+    total += ((flags >> 7) * 0x0101010101010101ULL) >> 56;
+  }
+  return total;
+}
+
+// As diablo_find_first_eq.
+static inline size_t diablo_find_first_eq_inline (uint8_t const* const src,
+                                                  size_t const off,
+                                                  size_t const len,
+                                                  uint8_t const byte) {
+  if (len > DIABLO_INLINE_LEN) {
+    return diablo_find_first_eq(src, off, len, byte);
+  }
+  uint8_t const* const ptr = &(src[off]);
+  if (len < 8) {
+    for (size_t i = 0; i < len; i++) {
+      if (ptr[i] == byte) {
+        return i;
+      }
+    }
+    return len;
+  }
+  uint64_t const matches = byte * 0x0101010101010101ULL;
+  // The last word may overlap the one before it, but nothing in the overlap
+  // matched, so its first match is still the first in the range.
+  for (size_t i = 0; i < len; i += 8) {
+    size_t const pos = (i + 8 <= len) ? i : (len - 8);
+    uint64_t const flags =
+      diablo_inline_eq_flags(diablo_inline_load(&(ptr[pos])), matches);
+    if (flags != 0) {
+      return pos + diablo_inline_first(flags);
+    }
+  }
+  return len;
+}
+
+// As diablo_find_last_eq.
+static inline size_t diablo_find_last_eq_inline (uint8_t const* const src,
+                                                 size_t const off,
+                                                 size_t const len,
+                                                 uint8_t const byte) {
+  if (len > DIABLO_INLINE_LEN) {
+    return diablo_find_last_eq(src, off, len, byte);
+  }
+  uint8_t const* const ptr = &(src[off]);
+  if (len < 8) {
+    for (size_t i = len; i > 0; i--) {
+      if (ptr[i - 1] == byte) {
+        return i - 1;
+      }
+    }
+    return len;
+  }
+  uint64_t const matches = byte * 0x0101010101010101ULL;
+  // As above, but from the end, with the first word overlapping instead.
+  for (size_t i = len; i > 0; i -= (i >= 8) ? 8 : i) {
+    size_t const pos = (i >= 8) ? (i - 8) : 0;
+    uint64_t const flags =
+      diablo_inline_eq_flags(diablo_inline_load(&(ptr[pos])), matches);
+    if (flags != 0) {
+      return pos + diablo_inline_last(flags);
+    }
+  }
+  return len;
+}
+
+// As diablo_find_first_non_ascii.
+static inline size_t diablo_find_first_non_ascii_inline (uint8_t const* const src,
+                                                         size_t const off,
+                                                         size_t const len) {
+  if (len > DIABLO_INLINE_LEN) {
+    return diablo_find_first_non_ascii(src, off, len);
+  }
+  uint8_t const* const ptr = &(src[off]);
+  if (len < 8) {
+    for (size_t i = 0; i < len; i++) {
+      if (ptr[i] >= 0x80) {
+        return i;
+      }
+    }
+    return len;
+  }
+  for (size_t i = 0; i < len; i += 8) {
+    size_t const pos = (i + 8 <= len) ? i : (len - 8);
+    uint64_t const flags =
+      diablo_inline_load(&(ptr[pos])) & 0x8080808080808080ULL;
+    if (flags != 0) {
+      return pos + diablo_inline_first(flags);
+    }
+  }
+  return len;
+}
+
+// As diablo_is_ascii.
+static inline bool diablo_is_ascii_inline (uint8_t const* const src,
+                                           size_t const off,
+                                           size_t const len) {
+  if (len > DIABLO_INLINE_LEN) {
+    return diablo_is_ascii(src, off, len);
+  }
+  uint8_t const* const ptr = &(src[off]);
+  if (len < 8) {
+    uint8_t seen = 0;
+    for (size_t i = 0; i < len; i++) {
+      seen |= ptr[i];
+    }
+    return seen < 0x80;
+  }
+  uint64_t seen = diablo_inline_load(&(ptr[len - 8]));
+  for (size_t i = 0; i + 8 <= len; i += 8) {
+    seen |= diablo_inline_load(&(ptr[i]));
+  }
+  return (seen & 0x8080808080808080ULL) == 0;
+}
+
+// As diablo_mismatch.
+static inline size_t diablo_mismatch_inline (uint8_t const* const a,
+                                             size_t const a_off,
+                                             uint8_t const* const b,
+                                             size_t const b_off,
+                                             size_t const len) {
+  if (len > DIABLO_INLINE_LEN) {
+    return diablo_mismatch(a, a_off, b, b_off, len);
+  }
+  uint8_t const* const a_ptr = &(a[a_off]);
+  uint8_t const* const b_ptr = &(b[b_off]);
+  if (len < 8) {
+    for (size_t i = 0; i < len; i++) {
+      if (a_ptr[i] != b_ptr[i]) {
+        return i;
+      }
+    }
+    return len;
+  }
+  for (size_t i = 0; i < len; i += 8) {
+    size_t const pos = (i + 8 <= len) ? i : (len - 8);
+    uint64_t const diff =
+      diablo_inline_load(&(a_ptr[pos])) ^ diablo_inline_load(&(b_ptr[pos]));
+    if (diff != 0) {
+      return pos + diablo_inline_first(diff);
+    }
+  }
+  return len;
+}
+
+// As diablo_compare.
+static inline int diablo_compare_inline (uint8_t const* const a,
+                                         size_t const a_off,
+                                         size_t const a_len,
+                                         uint8_t const* const b,
+                                         size_t const b_off,
+                                         size_t const b_len) {
+  size_t const len = (a_len < b_len) ? a_len : b_len;
+  if (len > DIABLO_INLINE_LEN) {
+    return diablo_compare(a, a_off, a_len, b, b_off, b_len);
+  }
+  size_t const pos = diablo_mismatch_inline(a, a_off, b, b_off, len);
+  if (pos < len) {
+    return (a[a_off + pos] < b[b_off + pos]) ? -1 : 1;
+  }
+  return (a_len > b_len) - (a_len < b_len);
+}
+/*** End of inlined file: diablo.h ***/
+
+
+// Internal dispatch machinery. Every exported operation keeps a table of its
+// kernels, indexed by diablo_backend, and calls through the entry for the
+// active backend. The active backend is chosen once, on first use, and cached.
+
+// Symbols shared between our translation units, but not part of the API.
+#if (_WIN32 || __CYGWIN__)
+#define DIABLO_INTERNAL
+#else
+#define DIABLO_INTERNAL __attribute__((visibility("hidden")))
+#endif
+
+// Which backends this build contains. SWAR is always available; everything
+// else depends on what the compiler is targeting.
+//
+// With DIABLO_FIXED_ISA set to 1 (the 'fixed_isa' meson option), we only
+// build what the target lets the compiler assume (for example, from -march),
+// and there's no runtime detection: the best of those backends is the only
+// one, and every operation calls its kernel directly.
+#if (DIABLO_FIXED_ISA)
+#if (__SSE2__)
+#define DIABLO_HAS_SSE2 1
+#endif
+#if (__SSSE3__)
+#define DIABLO_HAS_SSSE3 1
+#endif
+#if (__x86_64__ && __AVX2__)
+#define DIABLO_HAS_AVX2 1
+#endif
+#if (__x86_64__ && __AVX512BW__)
+#define DIABLO_HAS_AVX512BW 1
+#endif
+#if (__ARM_NEON)
+#define DIABLO_HAS_NEON 1
+#endif
+
+#if (DIABLO_HAS_AVX512BW)
+#define DIABLO_FIXED_BACKEND DIABLO_BACKEND_AVX512BW
+#elif (DIABLO_HAS_AVX2)
+#define DIABLO_FIXED_BACKEND DIABLO_BACKEND_AVX2
+#elif (DIABLO_HAS_SSSE3)
+#define DIABLO_FIXED_BACKEND DIABLO_BACKEND_SSSE3
+#elif (DIABLO_HAS_SSE2)
+#define DIABLO_FIXED_BACKEND DIABLO_BACKEND_SSE2
+#elif (DIABLO_HAS_NEON)
+#define DIABLO_FIXED_BACKEND DIABLO_BACKEND_NEON
+#else
+#define DIABLO_FIXED_BACKEND DIABLO_BACKEND_SWAR
+#endif
+#elif (__SSE2__)
+#define DIABLO_HAS_SSE2 1
+// SSSE3 is detected at runtime.
+#define DIABLO_HAS_SSSE3 1
+// 32-bit x86 cannot have AVX, so we only bother on x86-64, where we detect it
+// at runtime.
+#if (__x86_64__)
+#define DIABLO_HAS_AVX2 1
+#define DIABLO_HAS_AVX512BW 1
+#endif
+#elif (__ARM_NEON)
+#define DIABLO_HAS_NEON 1
+#endif
+
+// One more than the largest diablo_backend value; kernel tables are this big.
+#define DIABLO_BACKEND_COUNT 6
+
+// Every backend this build contains needs an entry in every kernel table. If an
+// operation has nothing specific to a backend, use the best kernel that
+// backend can run.
+
+// The active backend, or -1 if none has been chosen yet.
+DIABLO_INTERNAL extern _Atomic int diablo_active_backend;
+
+// Choose the best backend this machine supports, unless one has already been
+// chosen (or forced), and return whichever is active.
+DIABLO_INTERNAL diablo_backend diablo_resolve_backend(void);
+
+// Get the active backend. This is a single relaxed load once resolved, and a
+// constant with a fixed ISA, which lets the compiler fold away the kernel
+// tables.
+#if (DIABLO_FIXED_ISA)
+static inline diablo_backend active_backend (void) {
+  return DIABLO_FIXED_BACKEND;
+}
+#else
+static inline diablo_backend active_backend (void) {
+  int const backend = atomic_load_explicit(&diablo_active_backend,
+                                           memory_order_relaxed);
+  if (__builtin_expect(backend < 0, 0)) {
+    return diablo_resolve_backend();
+  }
+  return (diablo_backend)backend;
+}
+#endif
+/*** End of inlined file: dispatch.h ***/
+
+
+_Atomic int diablo_active_backend = -1;
+
+// The best backend the current machine can run. Ask this at most once per
+// resolution: on x86-64, it has to query the CPU.
+static diablo_backend best_backend (void) {
+#if (DIABLO_FIXED_ISA)
+  return DIABLO_FIXED_BACKEND;
+#else
+#if (DIABLO_HAS_AVX512BW)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512bw")) {
+    return DIABLO_BACKEND_AVX512BW;
+  }
+#endif
+#if (DIABLO_HAS_AVX2)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    return DIABLO_BACKEND_AVX2;
+  }
+#endif
+#if (DIABLO_HAS_SSSE3)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("ssse3")) {
+    return DIABLO_BACKEND_SSSE3;
+  }
+#endif
+#if (DIABLO_HAS_SSE2)
+  return DIABLO_BACKEND_SSE2;
+#elif (DIABLO_HAS_NEON)
+  return DIABLO_BACKEND_NEON;
+#else
+  return DIABLO_BACKEND_SWAR;
+#endif
+#endif
+}
+
+diablo_backend diablo_resolve_backend (void) {
+  int expected = -1;
+  int const best = (int)best_backend();
+  // If someone beat us to it, whether by resolving or forcing, theirs wins.
+  if (atomic_compare_exchange_strong(&diablo_active_backend, &expected, best)) {
+    return (diablo_backend)best;
+  }
+  return (diablo_backend)expected;
+}
+
+diablo_backend diablo_get_backend (void) {
+  return active_backend();
+}
+
+bool diablo_backend_supported (diablo_backend const backend) {
+#if (DIABLO_FIXED_ISA)
+  return backend == DIABLO_FIXED_BACKEND;
+#else
+  switch (backend) {
+    case DIABLO_BACKEND_SWAR:
+      return true;
+#if (DIABLO_HAS_SSE2)
+    case DIABLO_BACKEND_SSE2:
+      return true;
+#endif
+#if (DIABLO_HAS_SSSE3)
+    case DIABLO_BACKEND_SSSE3:
+      __builtin_cpu_init();
+      return __builtin_cpu_supports("ssse3");
+#endif
+#if (DIABLO_HAS_AVX2)
+    case DIABLO_BACKEND_AVX2:
+      __builtin_cpu_init();
+      return __builtin_cpu_supports("avx2");
+#endif
+#if (DIABLO_HAS_NEON)
+    case DIABLO_BACKEND_NEON:
+      return true;
+#endif
+#if (DIABLO_HAS_AVX512BW)
+    case DIABLO_BACKEND_AVX512BW:
+      __builtin_cpu_init();
+      return __builtin_cpu_supports("avx512bw");
+#endif
+    default:
+      return false;
+  }
+#endif
+}
+
+bool diablo_set_backend (diablo_backend const backend) {
+  if (!diablo_backend_supported(backend)) {
+    return false;
+  }
+  atomic_store(&diablo_active_backend, (int)backend);
+  return true;
+}
+
+diablo_backend diablo_reset_backend (void) {
+  atomic_store(&diablo_active_backend, -1);
+  return diablo_resolve_backend();
+}
+
+char const* diablo_backend_name (diablo_backend const backend) {
+  switch (backend) {
+    case DIABLO_BACKEND_SWAR:
+      return "swar";
+    case DIABLO_BACKEND_SSE2:
+      return "sse2";
+    case DIABLO_BACKEND_AVX2:
+      return "avx2";
+    case DIABLO_BACKEND_NEON:
+      return "neon";
+    case DIABLO_BACKEND_AVX512BW:
+      return "avx512bw";
+    case DIABLO_BACKEND_SSSE3:
+      return "ssse3";
+    default:
+      return "unknown";
+  }
+}
+
+#include <stdatomic.h>
+#include <stdint.h>
+/*** Start of inlined file: pool.h ***/
+#include <stdbool.h>
+#include <stddef.h>
+
+// Internal thread pool for the parallel operations.
+//
+// We use C11 threads, so that we need nothing outside the C standard library.
+// Not every libc has them (macOS doesn't, for instance); there, the pool never
+// runs anything, and the parallel operations run on the calling thread.
+#if (defined(__has_include) && !defined(__STDC_NO_THREADS__))
+#if (__has_include(<threads.h>))
+#define DIABLO_HAS_THREADS 1
+#endif
+#endif
+
+// The most threads, including the calling one, that the pool will use.
+#define DIABLO_MAX_THREADS 64
+
+// How many threads, including the calling one, the parallel operations should
+// use, and how long (in bytes) an input has to be for them to bother.
+DIABLO_INTERNAL size_t diablo_pool_threads(void);
+DIABLO_INTERNAL size_t diablo_pool_threshold(void);
+
+// Run task(arg, i) for every i below tasks, spread over up to threads threads,
+// one of which is the calling thread. Workers are started on first use, and
+// reused afterwards.
+//
+// Returns false, having run nothing, if the pool can't help: because there are
+// no threads on this platform, or because another call is using it. Callers
+// should then do the work themselves.
+DIABLO_INTERNAL bool diablo_pool_run(size_t const threads,
+                                     size_t const tasks,
+                                     void (*const task)(void* const, size_t const),
+                                     void* const arg);
+/*** End of inlined file: pool.h ***/
+
+
+#if (DIABLO_HAS_THREADS)
+#include <threads.h>
+#endif
+
+#if (__unix__ || __APPLE__)
+#include <unistd.h>
+#endif
+
+// Below this many bytes, the parallel operations stay on the calling thread by
+// default. Waking the pool costs a few microseconds, which is about what a
+// single core needs for this much.
+#define DEFAULT_THRESHOLD (((size_t)4) << 20)
+
+// 0 means 'one per online CPU'.
+static atomic_size_t configured_threads = 0;
+static atomic_size_t configured_threshold = DEFAULT_THRESHOLD;
+
+static size_t online_cpus (void) {
+#if (defined(_SC_NPROCESSORS_ONLN))
+  long const online = sysconf(_SC_NPROCESSORS_ONLN);
+  if (online > 0) {
+    return (size_t)online;
+  }
+#endif
+  return 1;
+}
+
+size_t diablo_pool_threads (void) {
+#if (DIABLO_HAS_THREADS)
+  size_t threads = atomic_load_explicit(&configured_threads,
+                                        memory_order_relaxed);
+  if (threads == 0) {
+    threads = online_cpus();
+  }
+  return (threads < DIABLO_MAX_THREADS) ? threads : DIABLO_MAX_THREADS;
+#else
+  return 1;
+#endif
+}
+
+size_t diablo_pool_threshold (void) {
+  return atomic_load_explicit(&configured_threshold, memory_order_relaxed);
+}
+
+size_t diablo_get_threads (void) {
+  return diablo_pool_threads();
+}
+
+void diablo_set_threads (size_t const threads) {
+  atomic_store_explicit(&configured_threads, threads, memory_order_relaxed);
+}
+
+size_t diablo_get_parallel_threshold (void) {
+  return diablo_pool_threshold();
+}
+
+void diablo_set_parallel_threshold (size_t const bytes) {
+  atomic_store_explicit(&configured_threshold, bytes, memory_order_relaxed);
+}
+
+#if (DIABLO_HAS_THREADS)
+// One call to diablo_pool_run at a time owns the pool, by holding pool_busy.
+// Everything else is guarded by pool_lock.
+//
+// Posting a job bumps generation and wakes every worker. Workers whose id is
+// below job.helpers take tasks from job.next until there are none left, then
+// check out by decrementing job.active; the caller takes tasks too, then waits
+// for job.active to reach zero before returning. Thus, nobody can be looking
+// at a job once its call has returned.
+
+typedef struct {
+  void (*task) (void* const, size_t const);
+  void* arg;
+  size_t tasks;
+  size_t helpers;
+  atomic_size_t next;
+  size_t active;
+} pool_job;
+
+static once_flag pool_once = ONCE_FLAG_INIT;
+static bool pool_ready = false;
+static mtx_t pool_busy;
+static mtx_t pool_lock;
+static cnd_t work_ready;
+static cnd_t work_done;
+static thrd_t workers[DIABLO_MAX_THREADS - 1];
+// The generation each worker was started in, so it waits for the next one.
+static unsigned long worker_start[DIABLO_MAX_THREADS - 1];
+static size_t worker_count = 0;
+static unsigned long generation = 0;
+static bool shutting_down = false;
+static pool_job job;
+
+static void pool_init (void) {
+  pool_ready = (mtx_init(&pool_busy, mtx_plain) == thrd_success) &&
+               (mtx_init(&pool_lock, mtx_plain) == thrd_success) &&
+               (cnd_init(&work_ready) == thrd_success) &&
+               (cnd_init(&work_done) == thrd_success);
+}
+
+static void run_tasks (void) {
+  size_t i = atomic_fetch_add(&job.next, 1);
+  while (i < job.tasks) {
+    job.task(job.arg, i);
+    i = atomic_fetch_add(&job.next, 1);
+  }
+}
+
+static int worker_main (void* const arg) {
+  size_t const id = (size_t)(uintptr_t)arg;
+  mtx_lock(&pool_lock);
+  unsigned long seen = worker_start[id];
+  for (;;) {
+    while (generation == seen && !shutting_down) {
+      cnd_wait(&work_ready, &pool_lock);
+    }
+    if (shutting_down) {
+      break;
+    }
+    seen = generation;
+    if (id >= job.helpers) {
+      continue;
+    }
+    mtx_unlock(&pool_lock);
+    run_tasks();
+    mtx_lock(&pool_lock);
+    job.active--;
+    if (job.active == 0) {
+      cnd_signal(&work_done);
+    }
+  }
+  mtx_unlock(&pool_lock);
+  return 0;
+}
+
+// Stop and join the workers when we're unloaded, rather than leaving them
+// waiting on a condition variable which is about to disappear.
+__attribute__((destructor))
+static void pool_shutdown (void) {
+  if (worker_count == 0) {
+    return;
+  }
+  mtx_lock(&pool_lock);
+  shutting_down = true;
+  cnd_broadcast(&work_ready);
+  mtx_unlock(&pool_lock);
+  for (size_t i = 0; i < worker_count; i++) {
+    thrd_join(workers[i], NULL);
+  }
+  worker_count = 0;
+}
+#endif
+
+bool diablo_pool_run (size_t const threads,
+                      size_t const tasks,
+                      void (*const task)(void* const, size_t const),
+                      void* const arg) {
+#if (DIABLO_HAS_THREADS)
+  if (threads <= 1 || tasks <= 1) {
+    return false;
+  }
+  call_once(&pool_once, pool_init);
+  if (!pool_ready || mtx_trylock(&pool_busy) != thrd_success) {
+    return false;
+  }
+  size_t helpers = (threads < DIABLO_MAX_THREADS) ? threads - 1 : DIABLO_MAX_THREADS - 1;
+  if (helpers > tasks - 1) {
+    helpers = tasks - 1;
+  }
+  mtx_lock(&pool_lock);
+  // Start any workers we don't have yet. If we can't, make do.
+  while (worker_count < helpers) {
+    worker_start[worker_count] = generation;
+    if (thrd_create(&workers[worker_count], worker_main,
+                    (void*)(uintptr_t)worker_count) != thrd_success) {
+      break;
+    }
+    worker_count++;
+  }
+  if (helpers > worker_count) {
+    helpers = worker_count;
+  }
+  if (helpers == 0) {
+    mtx_unlock(&pool_lock);
+    mtx_unlock(&pool_busy);
+    return false;
+  }
+  job.task = task;
+  job.arg = arg;
+  job.tasks = tasks;
+  job.helpers = helpers;
+  atomic_store(&job.next, 0);
+  job.active = helpers;
+  generation++;
+  cnd_broadcast(&work_ready);
+  mtx_unlock(&pool_lock);
+  run_tasks();
+  mtx_lock(&pool_lock);
+  while (job.active != 0) {
+    cnd_wait(&work_done, &pool_lock);
+  }
+  mtx_unlock(&pool_lock);
+  mtx_unlock(&pool_busy);
+  return true;
+#else
+  (void)threads;
+  (void)tasks;
+  (void)task;
+  (void)arg;
+  return false;
+#endif
+}
+
+/*** Start of inlined file: stats.h ***/
+#include <stddef.h>
+
+// Internal statistics machinery. Every operation on a range starts by calling
+// STATS_RECORD with its entry below and the number of bytes it was given. In
+// builds with DIABLO_STATS set to 1 (the 'stats' meson option), this counts
+// the call for the calling thread; otherwise, it's nothing at all, and its
+// arguments are never evaluated.
+
+// Every operation we count, in the order diablo_stats_name gives them.
+typedef enum {
+  STATS_COUNT_EQ,
+  STATS_COUNT_EQ_PARALLEL,
+  STATS_COUNT_EQ_MULTI,
+  STATS_COUNT_EQ_BATCH,
+  STATS_COUNT_IN_SET,
+  STATS_BYTE_HISTOGRAM,
+  STATS_POPCOUNT,
+  STATS_FIND_FIRST_EQ,
+  STATS_FIND_LAST_EQ,
+  STATS_FIND_ALL_EQ,
+  STATS_MISMATCH,
+  STATS_COMPARE,
+  STATS_HASH64,
+  STATS_HASH64_UPDATE,
+  STATS_STRUCTURAL_BITMAP,
+  STATS_STRUCTURAL_BITMAP_QUOTED,
+  STATS_RANK_SELECT_INIT,
+  STATS_RANK1,
+  STATS_RANK0,
+  STATS_SELECT1,
+  STATS_SELECT0,
+  STATS_TRANSLATE,
+  STATS_TRANSLATE_RANGE,
+  STATS_REPLACE_EQ,
+  STATS_IS_ASCII,
+  STATS_FIND_FIRST_NON_ASCII,
+  STATS_ENCODE_BASE16,
+  STATS_DECODE_BASE16,
+  STATS_ENCODE_BASE64,
+  STATS_DECODE_BASE64,
+  STATS_VALIDATE_UTF8,
+  STATS_COUNT_UTF8_CODEPOINTS,
+  STATS_UTF8_OFFSET_OF_NTH,
+  STATS_UTF16LE_TO_UTF8,
+  STATS_UTF8_TO_UTF16LE,
+  STATS_UTF8_LENGTH_FROM_UTF16LE,
+  STATS_UTF16LE_LENGTH_FROM_UTF8,
+  // One more than the last; not an operation.
+  STATS_FUNCTIONS
+} stats_function;
+
+#if (DIABLO_STATS)
+// Count a call to the given operation on the calling thread, along with the
+// active backend.
+DIABLO_INTERNAL void diablo_stats_record(stats_function const function,
+                                         size_t const bytes);
+
+#define STATS_RECORD(function, bytes) diablo_stats_record((function), (bytes))
+#else
+#define STATS_RECORD(function, bytes) ((void)0)
+#endif
+/*** End of inlined file: stats.h ***/
+
+
+#if (DIABLO_STATS)
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#if (DIABLO_HAS_THREADS)
+#include <threads.h>
+#endif
+
+// Every thread counts into a block of its own, so that only that thread ever
+// writes to it. Other threads do read it, to add up the totals, so the
+// counters are atomics; but a relaxed load, add and relaxed store is all an
+// increment needs, which compiles to the same code as for a plain integer.
+//
+// Blocks are never freed. When a thread exits, it gives up its block, and the
+// next thread to need one takes it over, counts and all; without C11 threads,
+// we can't tell when a thread exits, so every thread keeps its own. Resetting
+// doesn't touch the blocks either: it remembers the totals so far, to be taken
+// off everything read afterwards.
+
+_Static_assert(DIABLO_BACKEND_COUNT == DIABLO_BACKEND_SSSE3 + 1,
+               "diablo_stats has room for every backend");
+
+// Lengths go by bit width: bucket 0 is for 0, and bucket k is for lengths
+// from 2^(k - 1) up to, but not including, 2^k.
+#define LENGTH_BUCKETS 65
+
+typedef struct {
+  atomic_uint_least64_t bytes;
+  atomic_uint_least64_t backends[DIABLO_BACKEND_COUNT];
+  atomic_uint_least64_t lengths[LENGTH_BUCKETS];
+} stats_counters;
+
+typedef struct stats_block {
+  stats_counters counters[STATS_FUNCTIONS];
+  struct stats_block* next;
+  atomic_bool in_use;
+} stats_block;
+
+static char const* const stats_names[STATS_FUNCTIONS] = {
+  [STATS_COUNT_EQ] = "diablo_count_eq",
+  [STATS_COUNT_EQ_PARALLEL] = "diablo_count_eq_parallel",
+  [STATS_COUNT_EQ_MULTI] = "diablo_count_eq_multi",
+  [STATS_COUNT_EQ_BATCH] = "diablo_count_eq_batch",
+  [STATS_COUNT_IN_SET] = "diablo_count_in_set",
+  [STATS_BYTE_HISTOGRAM] = "diablo_byte_histogram",
+  [STATS_POPCOUNT] = "diablo_popcount",
+  [STATS_FIND_FIRST_EQ] = "diablo_find_first_eq",
+  [STATS_FIND_LAST_EQ] = "diablo_find_last_eq",
+  [STATS_FIND_ALL_EQ] = "diablo_find_all_eq",
+  [STATS_MISMATCH] = "diablo_mismatch",
+  [STATS_COMPARE] = "diablo_compare",
+  [STATS_HASH64] = "diablo_hash64",
+  [STATS_HASH64_UPDATE] = "diablo_hash64_update",
+  [STATS_STRUCTURAL_BITMAP] = "diablo_structural_bitmap",
+  [STATS_STRUCTURAL_BITMAP_QUOTED] = "diablo_structural_bitmap_quoted",
+  [STATS_RANK_SELECT_INIT] = "diablo_rank_select_init",
+  [STATS_RANK1] = "diablo_rank1",
+  [STATS_RANK0] = "diablo_rank0",
+  [STATS_SELECT1] = "diablo_select1",
+  [STATS_SELECT0] = "diablo_select0",
+  [STATS_TRANSLATE] = "diablo_translate",
+  [STATS_TRANSLATE_RANGE] = "diablo_translate_range",
+  [STATS_REPLACE_EQ] = "diablo_replace_eq",
+  [STATS_IS_ASCII] = "diablo_is_ascii",
+  [STATS_FIND_FIRST_NON_ASCII] = "diablo_find_first_non_ascii",
+  [STATS_ENCODE_BASE16] = "diablo_encode_base16",
+  [STATS_DECODE_BASE16] = "diablo_decode_base16",
+  [STATS_ENCODE_BASE64] = "diablo_encode_base64",
+  [STATS_DECODE_BASE64] = "diablo_decode_base64",
+  [STATS_VALIDATE_UTF8] = "diablo_validate_utf8",
+  [STATS_COUNT_UTF8_CODEPOINTS] = "diablo_count_utf8_codepoints",
+  [STATS_UTF8_OFFSET_OF_NTH] = "diablo_utf8_offset_of_nth",
+  [STATS_UTF16LE_TO_UTF8] = "diablo_utf16le_to_utf8",
+  [STATS_UTF8_TO_UTF16LE] = "diablo_utf8_to_utf16le",
+  [STATS_UTF8_LENGTH_FROM_UTF16LE] = "diablo_utf8_length_from_utf16le",
+  [STATS_UTF16LE_LENGTH_FROM_UTF8] = "diablo_utf16le_length_from_utf8"
+};
+
+static _Atomic(stats_block*) stats_blocks = NULL;
+static _Thread_local stats_block* own_block = NULL;
+static stats_counters baseline[STATS_FUNCTIONS];
+
+#if (DIABLO_HAS_THREADS)
+static once_flag exit_once = ONCE_FLAG_INIT;
+static bool exit_ready = false;
+static tss_t exit_key;
+
+static void give_up_block (void* const block) {
+  atomic_store_explicit(&((stats_block*)block)->in_use, false,
+                        memory_order_release);
+}
+
+static void exit_init (void) {
+  exit_ready = (tss_create(&exit_key, give_up_block) == thrd_success);
+}
+#endif
+
+// Take over a block some exited thread gave up, or make a new one.
+static stats_block* acquire_block (void) {
+  stats_block* block = atomic_load_explicit(&stats_blocks, memory_order_acquire);
+  for (; block != NULL; block = block->next) {
+    bool expected = false;
+    if (atomic_compare_exchange_strong_explicit(&block->in_use, &expected, true,
+                                                memory_order_acquire,
+                                                memory_order_relaxed)) {
+      return block;
+    }
+  }
+  // Zero bits are zero counts.
+  block = calloc(1, sizeof(stats_block));
+  if (block == NULL) {
+    return NULL;
+  }
+  atomic_init(&block->in_use, true);
+  block->next = atomic_load_explicit(&stats_blocks, memory_order_relaxed);
+  while (!atomic_compare_exchange_weak_explicit(&stats_blocks, &block->next, block,
+                                                memory_order_release,
+                                                memory_order_relaxed)) {
+  }
+  return block;
+}
+
+static inline void bump (atomic_uint_least64_t* const counter,
+                         uint64_t const by) {
+  uint64_t const old = atomic_load_explicit(counter, memory_order_relaxed);
+  atomic_store_explicit(counter, old + by, memory_order_relaxed);
+}
+
+// The first count on each thread takes this path, to get it a block.
+__attribute__((noinline))
+static stats_block* first_block (void) {
+  stats_block* const block = acquire_block();
+  // If we're out of memory, this thread's calls just don't get counted.
+  if (block == NULL) {
+    return NULL;
+  }
+  own_block = block;
+#if (DIABLO_HAS_THREADS)
+  call_once(&exit_once, exit_init);
+  if (exit_ready) {
+    tss_set(exit_key, block);
+  }
+#endif
+  return block;
+}
+
+void diablo_stats_record (stats_function const function,
+                          size_t const bytes) {
+  stats_block* block = own_block;
+  if (__builtin_expect(block == NULL, 0)) {
+    block = first_block();
+    if (block == NULL) {
+      return;
+    }
+  }
+  stats_counters* const counters = &(block->counters[function]);
+  size_t const bucket = (bytes == 0) ? 0 : (64 - __builtin_clzll(bytes));
+  bump(&counters->bytes, bytes);
+  bump(&counters->backends[active_backend()], 1);
+  bump(&counters->lengths[bucket], 1);
+}
+
+// Add the counters to out, which has no call count of its own yet.
+static void add_counters (diablo_stats* const out,
+                          stats_counters const* const counters) {
+  out->bytes += atomic_load_explicit(&counters->bytes, memory_order_relaxed);
+  for (size_t i = 0; i < DIABLO_BACKEND_COUNT; i++) {
+    out->backends[i] += atomic_load_explicit(&counters->backends[i],
+                                             memory_order_relaxed);
+  }
+  for (size_t i = 0; i < LENGTH_BUCKETS; i++) {
+    out->lengths[i] += atomic_load_explicit(&counters->lengths[i],
+                                            memory_order_relaxed);
+  }
+}
+
+// Everything every thread has counted for the function, since the start.
+static void stats_since_start (stats_function const function,
+                               diablo_stats* const out) {
+  *out = (diablo_stats){ 0 };
+  stats_block const* block = atomic_load_explicit(&stats_blocks,
+                                                  memory_order_acquire);
+  for (; block != NULL; block = block->next) {
+    add_counters(out, &(block->counters[function]));
+  }
+}
+
+size_t diablo_stats_functions (void) {
+  return STATS_FUNCTIONS;
+}
+
+char const* diablo_stats_name (size_t const function) {
+  return (function < STATS_FUNCTIONS) ? stats_names[function] : NULL;
+}
+
+bool diablo_get_stats (size_t const function, diablo_stats* const out) {
+  if (function >= STATS_FUNCTIONS) {
+    return false;
+  }
+  stats_since_start((stats_function)function, out);
+  diablo_stats reset = { 0 };
+  add_counters(&reset, &baseline[function]);
+  out->bytes -= reset.bytes;
+  out->calls = 0;
+  for (size_t i = 0; i < DIABLO_BACKEND_COUNT; i++) {
+    out->backends[i] -= reset.backends[i];
+    out->calls += out->backends[i];
+  }
+  for (size_t i = 0; i < LENGTH_BUCKETS; i++) {
+    out->lengths[i] -= reset.lengths[i];
+  }
+  return true;
+}
+
+void diablo_reset_stats (void) {
+  for (size_t function = 0; function < STATS_FUNCTIONS; function++) {
+    diablo_stats totals;
+    stats_since_start((stats_function)function, &totals);
+    stats_counters* const counters = &baseline[function];
+    atomic_store_explicit(&counters->bytes, totals.bytes, memory_order_relaxed);
+    for (size_t i = 0; i < DIABLO_BACKEND_COUNT; i++) {
+      atomic_store_explicit(&counters->backends[i], totals.backends[i],
+                            memory_order_relaxed);
+    }
+    for (size_t i = 0; i < LENGTH_BUCKETS; i++) {
+      atomic_store_explicit(&counters->lengths[i], totals.lengths[i],
+                            memory_order_relaxed);
+    }
+  }
+}
+#endif
+
+#include <stdatomic.h>
+#include <stddef.h>
+/*** Start of inlined file: common.h ***/
+#include <stdint.h>
+#include <stdlib.h>
+
+// Small helpers shared between operations.
+
+// Fill every 8-byte 'lane' with the same value.
+static inline uint64_t broadcast (uint8_t const byte) {
+  return byte * 0x0101010101010101ULL;
+}
+
+// The lowest n bits set, for 0 <= n <= 64.
+static inline uint64_t low_mask (size_t const n) {
+  return (n >= 64) ? ~0ULL : ((1ULL << n) - 1);
+}
+
+// The index of the nth (from 0) lowest set bit of word, which must have more
+// than n bits set. We halve the search window by popcount until at most a byte
+// is left, then clear bits one at a time.
+static inline size_t select_bit (uint64_t word, size_t n) {
+  size_t pos = 0;
+  for (size_t width = 32; width >= 8; width /= 2) {
+    size_t const below = __builtin_popcountll(word & low_mask(width));
+    if (n >= below) {
+      n -= below;
+      word >>= width;
+      pos += width;
+    }
+  }
+  for (; n > 0; n--) {
+    word &= (word - 1);
+  }
+  return pos + __builtin_ctzll(word);
+}
+
+// Each bit becomes the XOR of itself and every bit below it. Given a mask of
+// quote positions, this marks every position from an opening quote up to (but
+// not including) its closing quote.
+static inline uint64_t prefix_xor (uint64_t x) {
+  x ^= x << 1;
+  x ^= x << 2;
+  x ^= x << 4;
+  x ^= x << 8;
+  x ^= x << 16;
+  x ^= x << 32;
+  return x;
+}
+
+// SWAR byte matching
+//
+// These work on 64-bit words loaded directly from memory, and so care about
+// byte order: 'first' and 'last' refer to memory order.
+
+// Set the high bit of every byte of word which equals the corresponding byte of
+// matches, and clear every other bit. Unlike the usual 'has zero byte' trick,
+// this has no false positives.
+static inline uint64_t eq_flags (uint64_t const word, uint64_t const matches) {
+  uint64_t const mask = 0x7F7F7F7F7F7F7F7FULL;
+  uint64_t const input = word ^ matches;
+  uint64_t const tmp = (input & mask) + mask;
+  return ~(tmp | input | mask);
+}
+
+// The index of the first byte whose flag is set. flags must not be zero.
+static inline size_t first_flagged (uint64_t const flags) {
+#if (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+  return __builtin_clzll(flags) / 8;
+#else
+  return __builtin_ctzll(flags) / 8;
+#endif
+}
+
+// The index of the last byte whose flag is set. flags must not be zero.
+static inline size_t last_flagged (uint64_t const flags) {
+#if (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+  return 7 - (__builtin_ctzll(flags) / 8);
+#else
+  return 7 - (__builtin_clzll(flags) / 8);
+#endif
+}
+
+// Clear the flag of the first flagged byte. flags must not be zero.
+static inline uint64_t clear_first_flagged (uint64_t const flags) {
+#if (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+  return flags & ~(0x8000000000000000ULL >> __builtin_clzll(flags));
+#else
+  return flags & (flags - 1);
+#endif
+}
+
+// How many bytes have their flag set.
+static inline size_t count_flagged (uint64_t const flags) {
+  return ((flags >> 7) * 0x0101010101010101ULL) >> 56;
+}
+
+// Clear the flags of the first n bytes, for 0 <= n <= 8.
+static inline uint64_t clear_first_bytes (uint64_t const flags, size_t const n) {
+#if (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+  return flags & low_mask(64 - (8 * n));
+#else
+  return flags & ~low_mask(8 * n);
+#endif
+}
+
+#if (DIABLO_HAS_NEON)
+#include <arm_neon.h>
+
+// NEON has no movemask. Instead, a shifting narrow turns a comparison result
+// into a 64-bit mask with four bits per lane, in lane order.
+static inline uint64_t nibble_mask (uint8x16_t const cmp) {
+  uint8x8_t const narrowed = vshrn_n_u16(vreinterpretq_u16_u8(cmp), 4);
+  return vget_lane_u64(vreinterpret_u64_u8(narrowed), 0);
+}
+
+// One bit per lane, in lane order, like SSE2's movemask. We take one bit of
+// each nibble of nibble_mask, then squeeze out the gaps.
+static inline uint64_t movemask_neon (uint8x16_t const cmp) {
+  uint64_t x = nibble_mask(cmp) & 0x1111111111111111ULL;
+  x = (x | (x >> 3)) & 0x0303030303030303ULL;
+  x = (x | (x >> 6)) & 0x000F000F000F000FULL;
+  x = (x | (x >> 12)) & 0x000000FF000000FFULL;
+  x = (x | (x >> 24)) & 0x000000000000FFFFULL;
+  return x;
+}
+
+// Whether any bit of the vector is set.
+static inline bool any_set (uint8x16_t const v) {
+  uint8x8_t const folded = vorr_u8(vget_low_u8(v), vget_high_u8(v));
+  return vget_lane_u64(vreinterpret_u64_u8(folded), 0) != 0;
+}
+
+// A 16-entry table lookup, giving 0x00 for indices past the end. AArch64 does
+// this in one instruction; 32-bit ARM needs two 8-byte halves.
+static inline uint8x16_t lookup16 (uint8x16_t const table,
+                                   uint8x16_t const indices) {
+#if (__aarch64__)
+  return vqtbl1q_u8(table, indices);
+#else
+  uint8x8x2_t const halves = {{ vget_low_u8(table), vget_high_u8(table) }};
+  return vcombine_u8(vtbl2_u8(halves, vget_low_u8(indices)),
+                     vtbl2_u8(halves, vget_high_u8(indices)));
+#endif
+}
+#endif
+/*** End of inlined file: common.h ***/
+
+
+static inline size_t count_eq_rest (uint8_t const* const src,
+                                    size_t const len,
+                                    uint8_t const byte) {
+  size_t count = 0;
+  uint8_t const* ptr = (uint8_t const*)src;
+  for (size_t i = 0; i < len; i++) {
+    if ((*ptr) == byte) {
+      count++;
+    }
+    ptr++;
+  }
+  return count;
+}
+
+// SWAR implementation, used as the fallback everywhere.
+//
+// We use the method described in "Bit Twiddling Hacks".
+// Source: https://graphics.stanford.edu/~seander/bithacks.html#ZeroInWord
+
+// Load a 64-bit word, then set every byte which matches to 0x80, while setting
+// the others to 0x00.
+static inline uint64_t load_and_set (uint64_t const* const big_ptr,
+                                     size_t const i,
+                                     uint64_t const matches,
+                                     uint64_t const mask) {
+  uint64_t const input = big_ptr[i] ^ matches;
+  uint64_t const tmp = (input & mask) + mask;
+  return (~(tmp | input | mask) >> i);
+}
+
+static inline size_t count_eq_swar (uint8_t const* const src,
+                                    size_t const off,
+                                    size_t const len,
+                                    uint8_t const byte) {
+  size_t count = 0;
+  size_t const big_strides = len / 64;
+  size_t const small_strides = len % 64;
+  uint8_t const* ptr = (uint8_t const*)&(src[off]);
+  if (big_strides != 0) {
+    uint64_t const matches = broadcast(byte);
+    uint64_t const mask = broadcast(0x7F);
+    for (size_t i = 0; i < big_strides; i++) {
+      uint64_t const* const big_ptr = (uint64_t const* const)ptr;
+      uint64_t result = 0;
+      // Manual 8x loop unroll
+      result |= load_and_set(big_ptr, 0, matches, mask);
+      result |= load_and_set(big_ptr, 1, matches, mask);
+      result |= load_and_set(big_ptr, 2, matches, mask);
+      result |= load_and_set(big_ptr, 3, matches, mask);
+      result |= load_and_set(big_ptr, 4, matches, mask);
+      result |= load_and_set(big_ptr, 5, matches, mask);
+      result |= load_and_set(big_ptr, 6, matches, mask);
+      result |= load_and_set(big_ptr, 7, matches, mask);
+      count += __builtin_popcountll(result);
+      ptr += 64;
+    }
+  }
+  count += count_eq_rest(ptr, small_strides, byte);
+  return count;
+}
+
+// Batched counting
+//
+// Most slices in a batch are short, so count_eq_rest would do most of the work
+// for them. Instead, below SHORT_SLICE bytes, we finish each slice with a
+// vector (or word) which overlaps the one before it, masking out the lanes
+// we've already counted. Longer slices use the usual kernels.
+#define SHORT_SLICE 256
+
+// Slices of at least 8 bytes go a word at a time.
+static inline size_t count_eq_short_swar (uint8_t const* const ptr,
+                                          size_t const len,
+                                          uint8_t const byte) {
+  if (len < 8) {
+    return count_eq_rest(ptr, len, byte);
+  }
+  uint64_t const matches = broadcast(byte);
+  size_t count = 0;
+  size_t i = 0;
+  for (; i + 8 <= len; i += 8) {
+    count += count_flagged(eq_flags(*((uint64_t const*)(ptr + i)), matches));
+  }
+  if (i < len) {
+    uint64_t const flags = eq_flags(*((uint64_t const*)(ptr + len - 8)), matches);
+    count += count_flagged(clear_first_bytes(flags, i + 8 - len));
+  }
+  return count;
+}
+
+#if (DIABLO_HAS_SSE2 || DIABLO_HAS_NEON)
+// Loading a vector from tail_lanes + 32 - n gives 0x00 in the first n lanes,
+// and 0xFF in the rest, for 0 <= n <= 32.
+static uint8_t const tail_lanes[64] = {
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF
+};
+#endif
+
+#if (DIABLO_HAS_SSE2)
+#include <emmintrin.h>
+
+static inline size_t count_eq_sse (uint8_t const* const src,
+                                   size_t const off,
+                                   size_t const len,
+                                   uint8_t const byte) {
+  size_t count = 0;
+  size_t const big_strides = len / 64;
+  size_t const small_strides = len % 64;
+  uint8_t const* ptr = (uint8_t const*)&(src[off]);
+  if (big_strides != 0) {
+    __m128i const matches = _mm_set1_epi8(byte);
+    __m128i counts = _mm_setzero_si128();
+    for (size_t i = 0; i < big_strides; i++) {
+      __m128i const* big_ptr = (__m128i const*)ptr;
+      // Load and compare. This leaves 0xFF in a matching lane, and 0x00
+      // otherwise.
+      //
+      // This is a manual 4x unroll.
+      __m128i const results[4] = {
+        _mm_cmpeq_epi8(matches, _mm_loadu_si128(big_ptr)),
+        _mm_cmpeq_epi8(matches, _mm_loadu_si128(big_ptr + 1)),
+        _mm_cmpeq_epi8(matches, _mm_loadu_si128(big_ptr + 2)),
+        _mm_cmpeq_epi8(matches, _mm_loadu_si128(big_ptr + 3))
+      };
+      // Since 0xFF is -1, we can get a lane-by-lane match count (except
+      // negative) by adding.
+      __m128i const summed = _mm_add_epi8(_mm_add_epi8(results[0], results[1]),
+                                          _mm_add_epi8(results[2], results[3]));
+      // Negating that, then taking the sum of absolute differences with 0x00
+      // in each lane, we get two 64-bit counts, which we accumulate.
+      __m128i const zero = _mm_setzero_si128();
+      counts = _mm_add_epi64(counts,
+                             _mm_sad_epu8(_mm_sub_epi8(zero, summed), zero));
+      ptr += 64;
+    }
+    // Evacuate results and sum.
+    uint64_t results[2];
+    _mm_storeu_si128((__m128i*)results, counts);
+    count += (results[0] + results[1]);
+  }
+  count += count_eq_rest(ptr, small_strides, byte);
+  return count;
+}
+// Each lane counts at most one match per vector, and short slices have fewer
+// than 256 vectors, so we can count in bytes and only reduce at the end.
+static inline size_t count_eq_short_sse (uint8_t const* const ptr,
+                                         size_t const len,
+                                         uint8_t const byte) {
+  if (len < 16) {
+    return count_eq_short_swar(ptr, len, byte);
+  }
+  __m128i const matches = _mm_set1_epi8(byte);
+  __m128i const zero = _mm_setzero_si128();
+  __m128i counts = zero;
+  size_t i = 0;
+  for (; i + 16 <= len; i += 16) {
+    counts = _mm_sub_epi8(counts,
+                          _mm_cmpeq_epi8(matches, _mm_loadu_si128((__m128i const*)(ptr + i))));
+  }
+  if (i < len) {
+    __m128i const fresh =
+      _mm_loadu_si128((__m128i const*)(tail_lanes + 32 - (i + 16 - len)));
+    __m128i const result =
+      _mm_cmpeq_epi8(matches, _mm_loadu_si128((__m128i const*)(ptr + len - 16)));
+    counts = _mm_sub_epi8(counts, _mm_and_si128(result, fresh));
+  }
+  uint64_t results[2];
+  _mm_storeu_si128((__m128i*)results, _mm_sad_epu8(counts, zero));
+  return results[0] + results[1];
+}
+#endif
+
+#if (DIABLO_HAS_AVX2)
+#include <immintrin.h>
+
+__attribute__((target("avx2")))
+static inline size_t count_eq_avx (uint8_t const* const src,
+                                   size_t const off,
+                                   size_t const len,
+                                   uint8_t const byte) {
+  size_t count = 0;
+  size_t const big_strides = len / 64;
+  size_t const small_strides = len % 64;
+  uint8_t const* ptr = (uint8_t const*)&(src[off]);
+  if (big_strides != 0) {
+    __m256i const matches = _mm256_set1_epi8(byte);
+    __m256i counts = _mm256_setzero_si256();
+    for (size_t i = 0; i < big_strides; i++) {
+      __m256i const* big_ptr = (__m256i const*)ptr;
+      // Load and compare. This leaves 0xFF in a matching lane, and 0x00
+      // otherwise.
+      //
+      // This is a manual 2x unroll.
+      __m256i const results[2] = {
+        _mm256_cmpeq_epi8(matches, _mm256_loadu_si256(big_ptr)),
+        _mm256_cmpeq_epi8(matches, _mm256_loadu_si256(big_ptr + 1))
+      };
+      // Since 0xFF is -1, we can get a line-by-lane match count (except
+      // negative), by adding.
+      __m256i const summed = _mm256_add_epi8(results[0], results[1]);
+      // Negating that, then taking the sum of absolute differences with 0x00
+      // in each lane, we get four 64-bit counts, which we accumulate.
+      __m256i const zero = _mm256_setzero_si256();
+      counts = _mm256_add_epi64(counts,
+                                _mm256_sad_epu8(_mm256_sub_epi8(zero, summed), zero));
+      ptr += 64;
+    }
+    // Evacuate results and sum.
+    count += _mm256_extract_epi64(counts, 0) +
+             _mm256_extract_epi64(counts, 1) +
+             _mm256_extract_epi64(counts, 2) +
+             _mm256_extract_epi64(counts, 3);
+  }
+  count += count_eq_rest(ptr, small_strides, byte);
+  return count;
+}
+__attribute__((target("avx2")))
+static inline size_t count_eq_short_avx (uint8_t const* const ptr,
+                                         size_t const len,
+                                         uint8_t const byte) {
+  if (len < 32) {
+    return count_eq_short_sse(ptr, len, byte);
+  }
+  __m256i const matches = _mm256_set1_epi8(byte);
+  __m256i const zero = _mm256_setzero_si256();
+  __m256i counts = zero;
+  size_t i = 0;
+  for (; i + 32 <= len; i += 32) {
+    counts = _mm256_sub_epi8(counts,
+                             _mm256_cmpeq_epi8(matches, _mm256_loadu_si256((__m256i const*)(ptr + i))));
+  }
+  if (i < len) {
+    __m256i const fresh =
+      _mm256_loadu_si256((__m256i const*)(tail_lanes + 32 - (i + 32 - len)));
+    __m256i const result =
+      _mm256_cmpeq_epi8(matches, _mm256_loadu_si256((__m256i const*)(ptr + len - 32)));
+    counts = _mm256_sub_epi8(counts, _mm256_and_si256(result, fresh));
+  }
+  __m256i const summed = _mm256_sad_epu8(counts, zero);
+  return _mm256_extract_epi64(summed, 0) +
+         _mm256_extract_epi64(summed, 1) +
+         _mm256_extract_epi64(summed, 2) +
+         _mm256_extract_epi64(summed, 3);
+}
+#endif
+
+#if (DIABLO_HAS_AVX512BW)
+// AVX-512BW compares straight into a mask register, which we popcount. Masked
+// loads never fault on the lanes they leave out, so we handle the ragged head
+// (up to the next 64-byte boundary) and tail with them, and never go scalar.
+__attribute__((target("avx512bw,popcnt")))
+static inline size_t count_eq_avx512 (uint8_t const* const src,
+                                      size_t const off,
+                                      size_t const len,
+                                      uint8_t const byte) {
+  size_t count = 0;
+  size_t remaining = len;
+  uint8_t const* ptr = (uint8_t const*)&(src[off]);
+  __m512i const matches = _mm512_set1_epi8(byte);
+  // Head: everything up to the next 64-byte boundary, or the whole input if
+  // it's shorter than that.
+  size_t head = (64 - ((uintptr_t)ptr % 64)) % 64;
+  if (head > remaining) {
+    head = remaining;
+  }
+  if (head != 0) {
+    __mmask64 const mask = low_mask(head);
+    __m512i const input = _mm512_maskz_loadu_epi8(mask, ptr);
+    count += _mm_popcnt_u64(_mm512_mask_cmpeq_epi8_mask(mask, matches, input));
+    ptr += head;
+    remaining -= head;
+  }
+  // Body, with aligned loads. This is a manual 4x unroll.
+  size_t const big_strides = remaining / 256;
+  for (size_t i = 0; i < big_strides; i++) {
+    __m512i const* big_ptr = (__m512i const*)ptr;
+    count += _mm_popcnt_u64(_mm512_cmpeq_epi8_mask(matches, _mm512_load_si512(big_ptr)));
+    count += _mm_popcnt_u64(_mm512_cmpeq_epi8_mask(matches, _mm512_load_si512(big_ptr + 1)));
+    count += _mm_popcnt_u64(_mm512_cmpeq_epi8_mask(matches, _mm512_load_si512(big_ptr + 2)));
+    count += _mm_popcnt_u64(_mm512_cmpeq_epi8_mask(matches, _mm512_load_si512(big_ptr + 3)));
+    ptr += 256;
+  }
+  remaining %= 256;
+  while (remaining >= 64) {
+    __m512i const input = _mm512_load_si512((__m512i const*)ptr);
+    count += _mm_popcnt_u64(_mm512_cmpeq_epi8_mask(matches, input));
+    ptr += 64;
+    remaining -= 64;
+  }
+  // Tail.
+  if (remaining != 0) {
+    __mmask64 const mask = low_mask(remaining);
+    __m512i const input = _mm512_maskz_loadu_epi8(mask, ptr);
+    count += _mm_popcnt_u64(_mm512_mask_cmpeq_epi8_mask(mask, matches, input));
+  }
+  return count;
+}
+#endif
+
+#if (DIABLO_HAS_NEON)
+#include <arm_neon.h>
+
+static inline size_t count_eq_neon (uint8_t const* const src,
+                                    size_t const off,
+                                    size_t const len,
+                                    uint8_t const byte) {
+  size_t count = 0;
+  size_t const big_strides = len / 64;
+  size_t const small_strides = len % 64;
+  uint8_t const* ptr = (uint8_t const*)&(src[off]);
+  if (big_strides != 0) {
+    uint8x16_t const matches = vdupq_n_u8(byte);
+    uint64x2_t counts = vdupq_n_u64(0);
+    for (size_t i = 0; i < big_strides; i++) {
+      // Load and compare, then reinterpret as signed. This puts 0xFF in a
+      // matching lane (thus, -1), and 0x00 in a non-matching lane (thus, 0).
+      //
+      // This is a manual 4x unroll.
+      int8x16_t const results[4] = {
+        vreinterpretq_s8_u8(vceqq_u8(matches, vld1q_u8(ptr))),
+        vreinterpretq_s8_u8(vceqq_u8(matches, vld1q_u8(ptr + 16))),
+        vreinterpretq_s8_u8(vceqq_u8(matches, vld1q_u8(ptr + 32))),
+        vreinterpretq_s8_u8(vceqq_u8(matches, vld1q_u8(ptr + 48)))
+      };
+      // Add everything to get between 0 and -4 in each lane, then take the
+      // absolute value and reinterpret as signed.
+      uint8x16_t const summed =
+        vreinterpretq_u8_s8(vabsq_s8(vaddq_s8(vaddq_s8(results[0], results[1]),
+                                              vaddq_s8(results[2], results[3]))));
+      // Horizontally sum and accumulate.
+      counts = vaddq_u64(counts, vpaddlq_u32(vpaddlq_u16(vpaddlq_u8(summed))));
+      ptr += 64;
+    }
+    // Evacuate and sum.
+    count += (vgetq_lane_u64(counts, 0) + vgetq_lane_u64(counts, 1));
+  }
+  count += count_eq_rest(ptr, small_strides, byte);
+  return count;
+}
+static inline size_t count_eq_short_neon (uint8_t const* const ptr,
+                                          size_t const len,
+                                          uint8_t const byte) {
+  if (len < 16) {
+    return count_eq_short_swar(ptr, len, byte);
+  }
+  uint8x16_t const matches = vdupq_n_u8(byte);
+  uint8x16_t counts = vdupq_n_u8(0);
+  size_t i = 0;
+  for (; i + 16 <= len; i += 16) {
+    counts = vsubq_u8(counts, vceqq_u8(matches, vld1q_u8(ptr + i)));
+  }
+  if (i < len) {
+    uint8x16_t const fresh = vld1q_u8(tail_lanes + 32 - (i + 16 - len));
+    counts = vsubq_u8(counts,
+                      vandq_u8(vceqq_u8(matches, vld1q_u8(ptr + len - 16)), fresh));
+  }
+  uint64x2_t const summed = vpaddlq_u32(vpaddlq_u16(vpaddlq_u8(counts)));
+  return vgetq_lane_u64(summed, 0) + vgetq_lane_u64(summed, 1);
+}
+#endif
+
+typedef size_t (*count_eq_kernel) (uint8_t const* const,
+                                   size_t const,
+                                   size_t const,
+                                   uint8_t const);
+
+static count_eq_kernel const count_eq_kernels[DIABLO_BACKEND_COUNT] = {
+  [DIABLO_BACKEND_SWAR] = count_eq_swar,
+#if (DIABLO_HAS_SSE2)
+  [DIABLO_BACKEND_SSE2] = count_eq_sse,
+#endif
+#if (DIABLO_HAS_SSSE3)
+  [DIABLO_BACKEND_SSSE3] = count_eq_sse,
+#endif
+#if (DIABLO_HAS_AVX2)
+  [DIABLO_BACKEND_AVX2] = count_eq_avx,
+#endif
+#if (DIABLO_HAS_NEON)
+  [DIABLO_BACKEND_NEON] = count_eq_neon,
+#endif
+#if (DIABLO_HAS_AVX512BW)
+  [DIABLO_BACKEND_AVX512BW] = count_eq_avx512,
+#endif
+};
+
+static inline void count_eq_batch_swar (diablo_slice const* const slices,
+                                        size_t const slices_len,
+                                        uint8_t const byte,
+                                        size_t* const counts) {
+  for (size_t i = 0; i < slices_len; i++) {
+    size_t const len = slices[i].len;
+    counts[i] = (len < SHORT_SLICE) ?
+                count_eq_short_swar(&(slices[i].src[slices[i].off]), len, byte) :
+                count_eq_swar(slices[i].src, slices[i].off, len, byte);
+  }
+}
+
+#if (DIABLO_HAS_SSE2)
+static inline void count_eq_batch_sse (diablo_slice const* const slices,
+                                       size_t const slices_len,
+                                       uint8_t const byte,
+                                       size_t* const counts) {
+  for (size_t i = 0; i < slices_len; i++) {
+    size_t const len = slices[i].len;
+    counts[i] = (len < SHORT_SLICE) ?
+                count_eq_short_sse(&(slices[i].src[slices[i].off]), len, byte) :
+                count_eq_sse(slices[i].src, slices[i].off, len, byte);
+  }
+}
+#endif
+
+#if (DIABLO_HAS_AVX2)
+__attribute__((target("avx2")))
+static inline void count_eq_batch_avx (diablo_slice const* const slices,
+                                       size_t const slices_len,
+                                       uint8_t const byte,
+                                       size_t* const counts) {
+  for (size_t i = 0; i < slices_len; i++) {
+    size_t const len = slices[i].len;
+    counts[i] = (len < SHORT_SLICE) ?
+                count_eq_short_avx(&(slices[i].src[slices[i].off]), len, byte) :
+                count_eq_avx(slices[i].src, slices[i].off, len, byte);
+  }
+}
+#endif
+
+#if (DIABLO_HAS_AVX512BW)
+// count_eq_avx512 is never scalar, so it does short slices as well.
+__attribute__((target("avx512bw,popcnt")))
+static inline void count_eq_batch_avx512 (diablo_slice const* const slices,
+                                          size_t const slices_len,
+                                          uint8_t const byte,
+                                          size_t* const counts) {
+  for (size_t i = 0; i < slices_len; i++) {
+    counts[i] = count_eq_avx512(slices[i].src, slices[i].off, slices[i].len, byte);
+  }
+}
+#endif
+
+#if (DIABLO_HAS_NEON)
+static inline void count_eq_batch_neon (diablo_slice const* const slices,
+                                        size_t const slices_len,
+                                        uint8_t const byte,
+                                        size_t* const counts) {
+  for (size_t i = 0; i < slices_len; i++) {
+    size_t const len = slices[i].len;
+    counts[i] = (len < SHORT_SLICE) ?
+                count_eq_short_neon(&(slices[i].src[slices[i].off]), len, byte) :
+                count_eq_neon(slices[i].src, slices[i].off, len, byte);
+  }
+}
+#endif
+
+typedef void (*count_eq_batch_kernel) (diablo_slice const* const,
+                                       size_t const,
+                                       uint8_t const,
+                                       size_t* const);
+
+static count_eq_batch_kernel const count_eq_batch_kernels[DIABLO_BACKEND_COUNT] = {
+  [DIABLO_BACKEND_SWAR] = count_eq_batch_swar,
+#if (DIABLO_HAS_SSE2)
+  [DIABLO_BACKEND_SSE2] = count_eq_batch_sse,
+#endif
+#if (DIABLO_HAS_SSSE3)
+  [DIABLO_BACKEND_SSSE3] = count_eq_batch_sse,
+#endif
+#if (DIABLO_HAS_AVX2)
+  [DIABLO_BACKEND_AVX2] = count_eq_batch_avx,
+#endif
+#if (DIABLO_HAS_NEON)
+  [DIABLO_BACKEND_NEON] = count_eq_batch_neon,
+#endif
+#if (DIABLO_HAS_AVX512BW)
+  [DIABLO_BACKEND_AVX512BW] = count_eq_batch_avx512,
+#endif
+};
+
+// Parallel counting
+//
+// We split the range into chunks which start on cache line boundaries (except
+// the first), so no two threads ever touch the same line, and give each thread
+// several, to even out any that finish early.
+#define CHUNKS_PER_THREAD 4
+
+// No chunk is smaller than this, so that short inputs with a low threshold
+// don't get split into pieces too small to be worth handing out.
+#define MIN_CHUNK 4096
+
+typedef struct {
+  count_eq_kernel kernel;
+  uint8_t const* src;
+  size_t off;
+  size_t len;
+  // The first chunk ends at lead + chunk; each one after it is chunk long.
+  size_t lead;
+  size_t chunk;
+  uint8_t byte;
+  atomic_size_t count;
+} count_eq_job;
+
+static void count_eq_task (void* const arg, size_t const i) {
+  count_eq_job* const job = (count_eq_job*)arg;
+  size_t const start = (i == 0) ? 0 : job->lead + (i * job->chunk);
+  size_t end = job->lead + ((i + 1) * job->chunk);
+  if (end > job->len) {
+    end = job->len;
+  }
+  size_t const count = job->kernel(job->src, job->off + start, end - start,
+                                   job->byte);
+  atomic_fetch_add_explicit(&job->count, count, memory_order_relaxed);
+}
+
+// The number of bytes in every slice together, for the statistics.
+static inline size_t slices_total (diablo_slice const* const slices,
+                                   size_t const slices_len) {
+  size_t total = 0;
+  for (size_t i = 0; i < slices_len; i++) {
+    total += slices[i].len;
+  }
+  return total;
+}
+
+size_t diablo_count_eq (uint8_t const* const src,
+                        size_t const off,
+                        size_t const len,
+                        uint8_t const byte) {
+  STATS_RECORD(STATS_COUNT_EQ, len);
+  return count_eq_kernels[active_backend()](src, off, len, byte);
+}
+
+void diablo_count_eq_batch (diablo_slice const* const slices,
+                            size_t const slices_len,
+                            uint8_t const byte,
+                            size_t* const counts) {
+  STATS_RECORD(STATS_COUNT_EQ_BATCH, slices_total(slices, slices_len));
+  count_eq_batch_kernels[active_backend()](slices, slices_len, byte, counts);
+}
+
+size_t diablo_count_eq_parallel (uint8_t const* const src,
+                                 size_t const off,
+                                 size_t const len,
+                                 uint8_t const byte) {
+  STATS_RECORD(STATS_COUNT_EQ_PARALLEL, len);
+  count_eq_kernel const kernel = count_eq_kernels[active_backend()];
+  size_t const threads = diablo_pool_threads();
+  if (threads <= 1 || len < diablo_pool_threshold()) {
+    return kernel(src, off, len, byte);
+  }
+  size_t const lead = (64 - ((uintptr_t)&(src[off]) % 64)) % 64;
+  size_t chunk = len / (threads * CHUNKS_PER_THREAD);
+  chunk = (chunk < MIN_CHUNK) ? MIN_CHUNK : ((chunk + 63) / 64) * 64;
+  if (len <= lead + chunk) {
+    return kernel(src, off, len, byte);
+  }
+  count_eq_job job = {
+    .kernel = kernel,
+    .src = src,
+    .off = off,
+    .len = len,
+    .lead = lead,
+    .chunk = chunk,
+    .byte = byte
+  };
+  atomic_init(&job.count, 0);
+  size_t const tasks = (len - lead + chunk - 1) / chunk;
+  if (!diablo_pool_run(threads, tasks, count_eq_task, &job)) {
+    return kernel(src, off, len, byte);
+  }
+  return atomic_load(&job.count);
+}
+
+#include <stddef.h>
+
+// Each kernel counts up to MULTI_NEEDLES needles in one pass. They work like
+// the count_eq kernels, loading each 64-byte block once, then comparing it
+// against every needle in turn, with a separate accumulator for each. Counts
+// are added to whatever is in counts already.
+#define MULTI_NEEDLES 8
+
+static inline void count_eq_multi_rest (uint8_t const* const ptr,
+                                        size_t const len,
+                                        uint8_t const* const needles,
+                                        size_t const needles_len,
+                                        size_t* const counts) {
+  for (size_t i = 0; i < len; i++) {
+    for (size_t j = 0; j < needles_len; j++) {
+      if (ptr[i] == needles[j]) {
+        counts[j]++;
+      }
+    }
+  }
+}
+
+// SWAR implementation, used as the fallback everywhere.
+//
+// As in count_eq_swar, we flag matches in each of eight words, shifting each
+// word's flags to a different bit, then popcount the lot.
+static inline void count_eq_multi_swar (uint8_t const* const src,
+                                        size_t const off,
+                                        size_t const len,
+                                        uint8_t const* const needles,
+                                        size_t const needles_len,
+                                        size_t* const counts) {
+  size_t const big_strides = len / 64;
+  size_t const small_strides = len % 64;
+  uint8_t const* ptr = (uint8_t const*)&(src[off]);
+  uint64_t matches[MULTI_NEEDLES];
+  for (size_t j = 0; j < needles_len; j++) {
+    matches[j] = broadcast(needles[j]);
+  }
+  for (size_t i = 0; i < big_strides; i++) {
+    uint64_t const* const big_ptr = (uint64_t const* const)ptr;
+    uint64_t inputs[8];
+    for (size_t k = 0; k < 8; k++) {
+      inputs[k] = big_ptr[k];
+    }
+    for (size_t j = 0; j < needles_len; j++) {
+      uint64_t result = 0;
+      for (size_t k = 0; k < 8; k++) {
+        result |= eq_flags(inputs[k], matches[j]) >> k;
+      }
+      counts[j] += __builtin_popcountll(result);
+    }
+    ptr += 64;
+  }
+  count_eq_multi_rest(ptr, small_strides, needles, needles_len, counts);
+}
+
+#if (DIABLO_HAS_SSE2)
+#include <emmintrin.h>
+
+static inline void count_eq_multi_sse (uint8_t const* const src,
+                                       size_t const off,
+                                       size_t const len,
+                                       uint8_t const* const needles,
+                                       size_t const needles_len,
+                                       size_t* const counts) {
+  size_t const big_strides = len / 64;
+  size_t const small_strides = len % 64;
+  uint8_t const* ptr = (uint8_t const*)&(src[off]);
+  if (big_strides != 0) {
+    __m128i const zero = _mm_setzero_si128();
+    __m128i matches[MULTI_NEEDLES];
+    __m128i totals[MULTI_NEEDLES];
+    for (size_t j = 0; j < needles_len; j++) {
+      matches[j] = _mm_set1_epi8(needles[j]);
+      totals[j] = zero;
+    }
+    for (size_t i = 0; i < big_strides; i++) {
+      __m128i const* big_ptr = (__m128i const*)ptr;
+      __m128i const inputs[4] = {
+        _mm_loadu_si128(big_ptr),
+        _mm_loadu_si128(big_ptr + 1),
+        _mm_loadu_si128(big_ptr + 2),
+        _mm_loadu_si128(big_ptr + 3)
+      };
+      // The same add, negate and SAD as count_eq_sse, once per needle.
+      for (size_t j = 0; j < needles_len; j++) {
+        __m128i const summed =
+          _mm_add_epi8(_mm_add_epi8(_mm_cmpeq_epi8(matches[j], inputs[0]),
+                                    _mm_cmpeq_epi8(matches[j], inputs[1])),
+                       _mm_add_epi8(_mm_cmpeq_epi8(matches[j], inputs[2]),
+                                    _mm_cmpeq_epi8(matches[j], inputs[3])));
+        totals[j] = _mm_add_epi64(totals[j],
+                                  _mm_sad_epu8(_mm_sub_epi8(zero, summed), zero));
+      }
+      ptr += 64;
+    }
+    // Evacuate results and sum.
+    for (size_t j = 0; j < needles_len; j++) {
+      uint64_t results[2];
+      _mm_storeu_si128((__m128i*)results, totals[j]);
+      counts[j] += (results[0] + results[1]);
+    }
+  }
+  count_eq_multi_rest(ptr, small_strides, needles, needles_len, counts);
+}
+#endif
+
+#if (DIABLO_HAS_AVX2)
+#include <immintrin.h>
+
+__attribute__((target("avx2")))
+static inline void count_eq_multi_avx (uint8_t const* const src,
+                                       size_t const off,
+                                       size_t const len,
+                                       uint8_t const* const needles,
+                                       size_t const needles_len,
+                                       size_t* const counts) {
+  size_t const big_strides = len / 64;
+  size_t const small_strides = len % 64;
+  uint8_t const* ptr = (uint8_t const*)&(src[off]);
+  if (big_strides != 0) {
+    __m256i const zero = _mm256_setzero_si256();
+    __m256i matches[MULTI_NEEDLES];
+    __m256i totals[MULTI_NEEDLES];
+    for (size_t j = 0; j < needles_len; j++) {
+      matches[j] = _mm256_set1_epi8(needles[j]);
+      totals[j] = zero;
+    }
+    for (size_t i = 0; i < big_strides; i++) {
+      __m256i const* big_ptr = (__m256i const*)ptr;
+      __m256i const inputs[2] = {
+        _mm256_loadu_si256(big_ptr),
+        _mm256_loadu_si256(big_ptr + 1)
+      };
+      // The same add, negate and SAD as count_eq_avx, once per needle.
+      for (size_t j = 0; j < needles_len; j++) {
+        __m256i const summed =
+          _mm256_add_epi8(_mm256_cmpeq_epi8(matches[j], inputs[0]),
+                          _mm256_cmpeq_epi8(matches[j], inputs[1]));
+        totals[j] = _mm256_add_epi64(totals[j],
+                                     _mm256_sad_epu8(_mm256_sub_epi8(zero, summed), zero));
+      }
+      ptr += 64;
+    }
+    // Evacuate results and sum.
+    for (size_t j = 0; j < needles_len; j++) {
+      counts[j] += _mm256_extract_epi64(totals[j], 0) +
+                   _mm256_extract_epi64(totals[j], 1) +
+                   _mm256_extract_epi64(totals[j], 2) +
+                   _mm256_extract_epi64(totals[j], 3);
+    }
+  }
+  count_eq_multi_rest(ptr, small_strides, needles, needles_len, counts);
+}
+#endif
+
+#if (DIABLO_HAS_AVX512BW)
+// As count_eq_avx512, this popcounts comparison masks, and uses masked loads
+// for the ragged ends.
+__attribute__((target("avx512bw,popcnt")))
+static inline void count_eq_multi_avx512 (uint8_t const* const src,
+                                          size_t const off,
+                                          size_t const len,
+                                          uint8_t const* const needles,
+                                          size_t const needles_len,
+                                          size_t* const counts) {
+  uint8_t const* const ptr = (uint8_t const*)&(src[off]);
+  __m512i matches[MULTI_NEEDLES];
+  for (size_t j = 0; j < needles_len; j++) {
+    matches[j] = _mm512_set1_epi8(needles[j]);
+  }
+  size_t i = 0;
+  for (; i + 64 <= len; i += 64) {
+    __m512i const input = _mm512_loadu_si512((void const*)(ptr + i));
+    for (size_t j = 0; j < needles_len; j++) {
+      counts[j] += _mm_popcnt_u64(_mm512_cmpeq_epi8_mask(matches[j], input));
+    }
+  }
+  if (i < len) {
+    __mmask64 const mask = low_mask(len - i);
+    __m512i const input = _mm512_maskz_loadu_epi8(mask, ptr + i);
+    for (size_t j = 0; j < needles_len; j++) {
+      counts[j] += _mm_popcnt_u64(_mm512_mask_cmpeq_epi8_mask(mask, matches[j], input));
+    }
+  }
+}
+#endif
+
+#if (DIABLO_HAS_NEON)
+static inline void count_eq_multi_neon (uint8_t const* const src,
+                                        size_t const off,
+                                        size_t const len,
+                                        uint8_t const* const needles,
+                                        size_t const needles_len,
+                                        size_t* const counts) {
+  size_t const big_strides = len / 64;
+  size_t const small_strides = len % 64;
+  uint8_t const* ptr = (uint8_t const*)&(src[off]);
+  if (big_strides != 0) {
+    uint8x16_t matches[MULTI_NEEDLES];
+    uint64x2_t totals[MULTI_NEEDLES];
+    for (size_t j = 0; j < needles_len; j++) {
+      matches[j] = vdupq_n_u8(needles[j]);
+      totals[j] = vdupq_n_u64(0);
+    }
+    for (size_t i = 0; i < big_strides; i++) {
+      uint8x16_t const inputs[4] = {
+        vld1q_u8(ptr),
+        vld1q_u8(ptr + 16),
+        vld1q_u8(ptr + 32),
+        vld1q_u8(ptr + 48)
+      };
+      // The same add, absolute value and horizontal sum as count_eq_neon, once
+      // per needle.
+      for (size_t j = 0; j < needles_len; j++) {
+        int8x16_t const summed =
+          vaddq_s8(vaddq_s8(vreinterpretq_s8_u8(vceqq_u8(matches[j], inputs[0])),
+                            vreinterpretq_s8_u8(vceqq_u8(matches[j], inputs[1]))),
+                   vaddq_s8(vreinterpretq_s8_u8(vceqq_u8(matches[j], inputs[2])),
+                            vreinterpretq_s8_u8(vceqq_u8(matches[j], inputs[3]))));
+        uint8x16_t const absolute = vreinterpretq_u8_s8(vabsq_s8(summed));
+        totals[j] = vaddq_u64(totals[j],
+                              vpaddlq_u32(vpaddlq_u16(vpaddlq_u8(absolute))));
+      }
+      ptr += 64;
+    }
+    // Evacuate and sum.
+    for (size_t j = 0; j < needles_len; j++) {
+      counts[j] += (vgetq_lane_u64(totals[j], 0) + vgetq_lane_u64(totals[j], 1));
+    }
+  }
+  count_eq_multi_rest(ptr, small_strides, needles, needles_len, counts);
+}
+#endif
+
+typedef void (*count_eq_multi_kernel) (uint8_t const* const,
+                                       size_t const,
+                                       size_t const,
+                                       uint8_t const* const,
+                                       size_t const,
+                                       size_t* const);
+
+static count_eq_multi_kernel const count_eq_multi_kernels[DIABLO_BACKEND_COUNT] = {
+  [DIABLO_BACKEND_SWAR] = count_eq_multi_swar,
+#if (DIABLO_HAS_SSE2)
+  [DIABLO_BACKEND_SSE2] = count_eq_multi_sse,
+#endif
+#if (DIABLO_HAS_SSSE3)
+  [DIABLO_BACKEND_SSSE3] = count_eq_multi_sse,
+#endif
+#if (DIABLO_HAS_AVX2)
+  [DIABLO_BACKEND_AVX2] = count_eq_multi_avx,
+#endif
+#if (DIABLO_HAS_NEON)
+  [DIABLO_BACKEND_NEON] = count_eq_multi_neon,
+#endif
+#if (DIABLO_HAS_AVX512BW)
+  [DIABLO_BACKEND_AVX512BW] = count_eq_multi_avx512,
+#endif
+};
+
+void diablo_count_eq_multi (uint8_t const* const src,
+                            size_t const off,
+                            size_t const len,
+                            uint8_t const* const needles,
+                            size_t const needles_len,
+                            size_t* const counts) {
+  STATS_RECORD(STATS_COUNT_EQ_MULTI, len);
+  count_eq_multi_kernel const kernel = count_eq_multi_kernels[active_backend()];
+  for (size_t j = 0; j < needles_len; j++) {
+    counts[j] = 0;
+  }
+  // More needles than one pass can take need several passes.
+  for (size_t j = 0; j < needles_len; j += MULTI_NEEDLES) {
+    size_t const group = (needles_len - j < MULTI_NEEDLES) ? needles_len - j : MULTI_NEEDLES;
+    kernel(src, off, len, needles + j, group, counts + j);
+  }
+}
+
+#include <stddef.h>
+/*** Start of inlined file: truffle.h ***/
+#include <stdint.h>
+
+// Classifying bytes against a set, given as a 32-byte bitmap: a byte b is a
+// member exactly when bit (b % 8) of set[b / 8] is 1.
+
+// Whether the byte is in the set.
+static inline uint8_t in_set (uint8_t const* const set, uint8_t const byte) {
+  return (set[byte >> 3] >> (byte & 7)) & 1;
+}
+
+// SIMD classification uses nibble shuffles, as in Hyperscan's
+// 'truffle'. For a byte with high nibble h and low nibble l, bit (h % 8) of
+// lows[l] (if h < 8) or highs[l] (if h >= 8) says whether it's in the set. A
+// 16-entry shuffle on l finds the right row; another, on h, finds the bit.
+//
+// Both tables are 8x8 bit-matrix transposes of halves of the set, which we
+// compute with the method from "Hacker's Delight", section 7-3.
+
+// Transpose the 8x8 bit matrix whose row i is byte i (least significant first).
+static inline uint64_t transpose8 (uint64_t x) {
+  uint64_t t;
+  t = (x ^ (x >> 7)) & 0x00AA00AA00AA00AAULL;
+  x = x ^ t ^ (t << 7);
+  t = (x ^ (x >> 14)) & 0x0000CCCC0000CCCCULL;
+  x = x ^ t ^ (t << 14);
+  t = (x ^ (x >> 28)) & 0x00000000F0F0F0F0ULL;
+  x = x ^ t ^ (t << 28);
+  return x;
+}
+
+static inline void truffle_tables (uint8_t const* const set,
+                                   uint8_t lows[16],
+                                   uint8_t highs[16]) {
+  // Low nibbles 0-7 live in the even bytes of the set, 8-15 in the odd ones.
+  for (size_t half = 0; half < 2; half++) {
+    uint64_t low_rows = 0;
+    uint64_t high_rows = 0;
+    for (size_t h = 0; h < 8; h++) {
+      low_rows |= ((uint64_t)set[(2 * h) + half]) << (8 * h);
+      high_rows |= ((uint64_t)set[16 + (2 * h) + half]) << (8 * h);
+    }
+    low_rows = transpose8(low_rows);
+    high_rows = transpose8(high_rows);
+    for (size_t l = 0; l < 8; l++) {
+      lows[(8 * half) + l] = (uint8_t)(low_rows >> (8 * l));
+      highs[(8 * half) + l] = (uint8_t)(high_rows >> (8 * l));
+    }
+  }
+}
+
+#if (DIABLO_HAS_SSSE3)
+#include <tmmintrin.h>
+
+// 0xFF in the lanes whose bytes are in the set, 0x00 otherwise.
+__attribute__((target("ssse3")))
+static inline __m128i classify_ssse3 (__m128i const input,
+                                      __m128i const lows,
+                                      __m128i const highs) {
+  __m128i const bits = _mm_setr_epi8(1, 2, 4, 8, 16, 32, 64, -128,
+                                     1, 2, 4, 8, 16, 32, 64, -128);
+  // Shuffles give 0x00 wherever the index has its top bit set, so each table
+  // only answers for its own half of the bytes.
+  __m128i const rows = _mm_or_si128(_mm_shuffle_epi8(lows, input),
+                                    _mm_shuffle_epi8(highs,
+                                                     _mm_xor_si128(input,
+                                                                   _mm_set1_epi8(-128))));
+  __m128i const high_nibbles = _mm_and_si128(_mm_srli_epi16(input, 4),
+                                             _mm_set1_epi8(0x0F));
+  __m128i const wanted = _mm_shuffle_epi8(bits, high_nibbles);
+  return _mm_cmpeq_epi8(_mm_and_si128(rows, wanted), wanted);
+}
+#endif
+
+#if (DIABLO_HAS_AVX2)
+#include <immintrin.h>
+
+__attribute__((target("avx2")))
+static inline __m256i classify_avx2 (__m256i const input,
+                                     __m256i const lows,
+                                     __m256i const highs) {
+  __m256i const bits = _mm256_setr_epi8(1, 2, 4, 8, 16, 32, 64, -128,
+                                        1, 2, 4, 8, 16, 32, 64, -128,
+                                        1, 2, 4, 8, 16, 32, 64, -128,
+                                        1, 2, 4, 8, 16, 32, 64, -128);
+  __m256i const rows = _mm256_or_si256(_mm256_shuffle_epi8(lows, input),
+                                       _mm256_shuffle_epi8(highs,
+                                                           _mm256_xor_si256(input,
+                                                                            _mm256_set1_epi8(-128))));
+  __m256i const high_nibbles = _mm256_and_si256(_mm256_srli_epi16(input, 4),
+                                                _mm256_set1_epi8(0x0F));
+  __m256i const wanted = _mm256_shuffle_epi8(bits, high_nibbles);
+  return _mm256_cmpeq_epi8(_mm256_and_si256(rows, wanted), wanted);
+}
+#endif
+
+#if (DIABLO_HAS_AVX512BW)
+// Lanes whose bytes are in the set, as a mask.
+__attribute__((target("avx512bw")))
+static inline __mmask64 classify_avx512 (__m512i const input,
+                                         __m512i const lows,
+                                         __m512i const highs) {
+  __m512i const bits = _mm512_broadcast_i32x4(_mm_setr_epi8(1, 2, 4, 8, 16, 32, 64, -128,
+                                                            1, 2, 4, 8, 16, 32, 64, -128));
+  __m512i const rows = _mm512_or_si512(_mm512_shuffle_epi8(lows, input),
+                                       _mm512_shuffle_epi8(highs,
+                                                           _mm512_xor_si512(input,
+                                                                            _mm512_set1_epi8(-128))));
+  __m512i const high_nibbles = _mm512_and_si512(_mm512_srli_epi16(input, 4),
+                                                _mm512_set1_epi8(0x0F));
+  return _mm512_test_epi8_mask(rows, _mm512_shuffle_epi8(bits, high_nibbles));
+}
+#endif
+
+#if (DIABLO_HAS_NEON)
+// 0xFF in the lanes whose bytes are in the set, 0x00 otherwise.
+static inline uint8x16_t classify_neon (uint8x16_t const input,
+                                        uint8x16_t const lows,
+                                        uint8x16_t const highs) {
+  static uint8_t const bit_table[16] = {1, 2, 4, 8, 16, 32, 64, 128,
+                                        1, 2, 4, 8, 16, 32, 64, 128};
+  // Unlike SSSE3, NEON lookups don't ignore high bits, so we mask down to the
+  // low nibble, and pick the table with the top bit of each byte.
+  uint8x16_t const low_nibbles = vandq_u8(input, vdupq_n_u8(0x0F));
+  uint8x16_t const is_high =
+    vreinterpretq_u8_s8(vshrq_n_s8(vreinterpretq_s8_u8(input), 7));
+  uint8x16_t const rows = vbslq_u8(is_high,
+                                   lookup16(highs, low_nibbles),
+                                   lookup16(lows, low_nibbles));
+  uint8x16_t const wanted = lookup16(vld1q_u8(bit_table), vshrq_n_u8(input, 4));
+  return vtstq_u8(rows, wanted);
+}
+#endif
+/*** End of inlined file: truffle.h ***/
+
+
+static inline size_t count_in_set_rest (uint8_t const* const src,
+                                        size_t const len,
+                                        uint8_t const* const set) {
+  size_t count = 0;
+  uint8_t const* ptr = (uint8_t const*)src;
+  for (size_t i = 0; i < len; i++) {
+    count += in_set(set, *ptr);
+    ptr++;
+  }
+  return count;
+}
+
+// SWAR implementation, used as the fallback everywhere.
+//
+// This isn't really SWAR: there's no word-level trick for testing against an
+// arbitrary set, so this is a per-byte bitmap lookup, unrolled eight times over
+// each loaded word. The only gain over the plain loop is fewer loads and loop
+// iterations.
+static inline size_t count_in_set_swar (uint8_t const* const src,
+                                        size_t const off,
+                                        size_t const len,
+                                        uint8_t const* const set) {
+  size_t count = 0;
+  size_t const big_strides = len / 8;
+  size_t const small_strides = len % 8;
+  uint8_t const* ptr = (uint8_t const*)&(src[off]);
+  for (size_t i = 0; i < big_strides; i++) {
+    uint64_t const input = *((uint64_t const*)ptr);
+    // Manual 8x loop unroll
+    count += in_set(set, (uint8_t)input);
+    count += in_set(set, (uint8_t)(input >> 8));
+    count += in_set(set, (uint8_t)(input >> 16));
+    count += in_set(set, (uint8_t)(input >> 24));
+    count += in_set(set, (uint8_t)(input >> 32));
+    count += in_set(set, (uint8_t)(input >> 40));
+    count += in_set(set, (uint8_t)(input >> 48));
+    count += in_set(set, (uint8_t)(input >> 56));
+    ptr += 8;
+  }
+  count += count_in_set_rest(ptr, small_strides, set);
+  return count;
+}
+
+// The SIMD kernels classify bytes with the nibble shuffles in truffle.h.
+
+#if (DIABLO_HAS_SSSE3)
+#include <tmmintrin.h>
+
+__attribute__((target("ssse3")))
+static inline size_t count_in_set_ssse3 (uint8_t const* const src,
+                                         size_t const off,
+                                         size_t const len,
+                                         uint8_t const* const set) {
+  size_t count = 0;
+  size_t const big_strides = len / 64;
+  size_t const small_strides = len % 64;
+  uint8_t const* ptr = (uint8_t const*)&(src[off]);
+  if (big_strides != 0) {
+    uint8_t tables[2][16];
+    truffle_tables(set, tables[0], tables[1]);
+    __m128i const lows = _mm_loadu_si128((__m128i const*)tables[0]);
+    __m128i const highs = _mm_loadu_si128((__m128i const*)tables[1]);
+    __m128i const zero = _mm_setzero_si128();
+    __m128i counts = zero;
+    for (size_t i = 0; i < big_strides; i++) {
+      __m128i const* big_ptr = (__m128i const*)ptr;
+      // This is a manual 4x unroll.
+      __m128i const results[4] = {
+        classify_ssse3(_mm_loadu_si128(big_ptr), lows, highs),
+        classify_ssse3(_mm_loadu_si128(big_ptr + 1), lows, highs),
+        classify_ssse3(_mm_loadu_si128(big_ptr + 2), lows, highs),
+        classify_ssse3(_mm_loadu_si128(big_ptr + 3), lows, highs)
+      };
+      // As in count_eq_sse: add the -1s, negate, then sum with SAD.
+      __m128i const summed = _mm_add_epi8(_mm_add_epi8(results[0], results[1]),
+                                          _mm_add_epi8(results[2], results[3]));
+      counts = _mm_add_epi64(counts,
+                             _mm_sad_epu8(_mm_sub_epi8(zero, summed), zero));
+      ptr += 64;
+    }
+    // Evacuate results and sum.
+    uint64_t results[2];
+    _mm_storeu_si128((__m128i*)results, counts);
+    count += (results[0] + results[1]);
+  }
+  count += count_in_set_rest(ptr, small_strides, set);
+  return count;
+}
+#endif
+
+#if (DIABLO_HAS_AVX2)
+#include <immintrin.h>
+
+__attribute__((target("avx2")))
+static inline size_t count_in_set_avx (uint8_t const* const src,
+                                       size_t const off,
+                                       size_t const len,
+                                       uint8_t const* const set) {
+  size_t count = 0;
+  size_t const big_strides = len / 64;
+  size_t const small_strides = len % 64;
+  uint8_t const* ptr = (uint8_t const*)&(src[off]);
+  if (big_strides != 0) {
+    uint8_t tables[2][16];
+    truffle_tables(set, tables[0], tables[1]);
+    // Shuffles work within 128-bit lanes, so both lanes get the same tables.
+    __m256i const lows =
+      _mm256_broadcastsi128_si256(_mm_loadu_si128((__m128i const*)tables[0]));
+    __m256i const highs =
+      _mm256_broadcastsi128_si256(_mm_loadu_si128((__m128i const*)tables[1]));
+    __m256i const zero = _mm256_setzero_si256();
+    __m256i counts = zero;
+    for (size_t i = 0; i < big_strides; i++) {
+      __m256i const* big_ptr = (__m256i const*)ptr;
+      // This is a manual 2x unroll.
+      __m256i const results[2] = {
+        classify_avx2(_mm256_loadu_si256(big_ptr), lows, highs),
+        classify_avx2(_mm256_loadu_si256(big_ptr + 1), lows, highs)
+      };
+      // As in count_eq_avx: add the -1s, negate, then sum with SAD.
+      __m256i const summed = _mm256_add_epi8(results[0], results[1]);
+      counts = _mm256_add_epi64(counts,
+                                _mm256_sad_epu8(_mm256_sub_epi8(zero, summed), zero));
+      ptr += 64;
+    }
+    // Evacuate results and sum.
+    count += _mm256_extract_epi64(counts, 0) +
+             _mm256_extract_epi64(counts, 1) +
+             _mm256_extract_epi64(counts, 2) +
+             _mm256_extract_epi64(counts, 3);
+  }
+  count += count_in_set_rest(ptr, small_strides, set);
+  return count;
+}
+#endif
+
+#if (DIABLO_HAS_AVX512BW)
+// As count_eq_avx512, masked loads handle the head and tail.
+__attribute__((target("avx512bw,popcnt")))
+static inline size_t count_in_set_avx512 (uint8_t const* const src,
+                                          size_t const off,
+                                          size_t const len,
+                                          uint8_t const* const set) {
+  size_t count = 0;
+  size_t remaining = len;
+  uint8_t const* ptr = (uint8_t const*)&(src[off]);
+  uint8_t tables[2][16];
+  truffle_tables(set, tables[0], tables[1]);
+  __m512i const lows =
+    _mm512_broadcast_i32x4(_mm_loadu_si128((__m128i const*)tables[0]));
+  __m512i const highs =
+    _mm512_broadcast_i32x4(_mm_loadu_si128((__m128i const*)tables[1]));
+  size_t head = (64 - ((uintptr_t)ptr % 64)) % 64;
+  if (head > remaining) {
+    head = remaining;
+  }
+  if (head != 0) {
+    __mmask64 const mask = low_mask(head);
+    __m512i const input = _mm512_maskz_loadu_epi8(mask, ptr);
+    count += _mm_popcnt_u64(mask & classify_avx512(input, lows, highs));
+    ptr += head;
+    remaining -= head;
+  }
+  while (remaining >= 64) {
+    __m512i const input = _mm512_load_si512((__m512i const*)ptr);
+    count += _mm_popcnt_u64(classify_avx512(input, lows, highs));
+    ptr += 64;
+    remaining -= 64;
+  }
+  if (remaining != 0) {
+    __mmask64 const mask = low_mask(remaining);
+    __m512i const input = _mm512_maskz_loadu_epi8(mask, ptr);
+    count += _mm_popcnt_u64(mask & classify_avx512(input, lows, highs));
+  }
+  return count;
+}
+#endif
+
+#if (DIABLO_HAS_NEON)
+static inline size_t count_in_set_neon (uint8_t const* const src,
+                                        size_t const off,
+                                        size_t const len,
+                                        uint8_t const* const set) {
+  size_t count = 0;
+  size_t const big_strides = len / 64;
+  size_t const small_strides = len % 64;
+  uint8_t const* ptr = (uint8_t const*)&(src[off]);
+  if (big_strides != 0) {
+    uint8_t tables[2][16];
+    truffle_tables(set, tables[0], tables[1]);
+    uint8x16_t const lows = vld1q_u8(tables[0]);
+    uint8x16_t const highs = vld1q_u8(tables[1]);
+    uint64x2_t counts = vdupq_n_u64(0);
+    for (size_t i = 0; i < big_strides; i++) {
+      // This is a manual 4x unroll.
+      int8x16_t const results[4] = {
+        vreinterpretq_s8_u8(classify_neon(vld1q_u8(ptr), lows, highs)),
+        vreinterpretq_s8_u8(classify_neon(vld1q_u8(ptr + 16), lows, highs)),
+        vreinterpretq_s8_u8(classify_neon(vld1q_u8(ptr + 32), lows, highs)),
+        vreinterpretq_s8_u8(classify_neon(vld1q_u8(ptr + 48), lows, highs))
+      };
+      // As in count_eq_neon.
+      uint8x16_t const summed =
+        vreinterpretq_u8_s8(vabsq_s8(vaddq_s8(vaddq_s8(results[0], results[1]),
+                                              vaddq_s8(results[2], results[3]))));
+      counts = vaddq_u64(counts, vpaddlq_u32(vpaddlq_u16(vpaddlq_u8(summed))));
+      ptr += 64;
+    }
+    count += (vgetq_lane_u64(counts, 0) + vgetq_lane_u64(counts, 1));
+  }
+  count += count_in_set_rest(ptr, small_strides, set);
+  return count;
+}
+#endif
+
+typedef size_t (*count_in_set_kernel) (uint8_t const* const,
+                                       size_t const,
+                                       size_t const,
+                                       uint8_t const* const);
+
+// SSE2 has no byte shuffles, so it uses the SWAR kernel.
+static count_in_set_kernel const count_in_set_kernels[DIABLO_BACKEND_COUNT] = {
+  [DIABLO_BACKEND_SWAR] = count_in_set_swar,
+#if (DIABLO_HAS_SSE2)
+  [DIABLO_BACKEND_SSE2] = count_in_set_swar,
+#endif
+#if (DIABLO_HAS_SSSE3)
+  [DIABLO_BACKEND_SSSE3] = count_in_set_ssse3,
+#endif
+#if (DIABLO_HAS_AVX2)
+  [DIABLO_BACKEND_AVX2] = count_in_set_avx,
+#endif
+#if (DIABLO_HAS_NEON)
+  [DIABLO_BACKEND_NEON] = count_in_set_neon,
+#endif
+#if (DIABLO_HAS_AVX512BW)
+  [DIABLO_BACKEND_AVX512BW] = count_in_set_avx512,
+#endif
+};
+
+size_t diablo_count_in_set (uint8_t const* const src,
+                            size_t const off,
+                            size_t const len,
+                            uint8_t const* const set) {
+  STATS_RECORD(STATS_COUNT_IN_SET, len);
+  return count_in_set_kernels[active_backend()](src, off, len, set);
+}
+
+#include <stddef.h>
+#include <string.h>
+
+// Histograms don't benefit from our SIMD backends: every byte is a scattered
+// increment, and none of the instruction sets we target can do those faster
+// than the scalar approach below. Thus, there is one implementation, and no
+// dispatch.
+//
+// The naive loop (hist[byte]++) stalls whenever nearby bytes are equal, as each
+// increment has to wait for the previous one's store. We avoid this by spreading
+// consecutive bytes over several sub-histograms, which we sum at the end.
+
+// How many sub-histograms we use.
+#define SUB_HISTOGRAMS 4
+
+// How many bytes we count before flushing the sub-histograms. This keeps their
+// 32-bit counters from overflowing.
+#define FLUSH_INTERVAL (((size_t)1) << 31)
+
+// Below this length, setting up and flushing the sub-histograms costs more than
+// it saves.
+#define NAIVE_THRESHOLD 256
+
+static inline void histogram_rest (uint8_t const* const src,
+                                   size_t const len,
+                                   size_t* const hist) {
+  for (size_t i = 0; i < len; i++) {
+    hist[src[i]]++;
+  }
+}
+
+static inline void histogram_chunk (uint8_t const* const src,
+                                    size_t const len,
+                                    size_t* const hist) {
+  uint32_t counts[SUB_HISTOGRAMS][256];
+  memset(counts, 0, sizeof(counts));
+  size_t const big_strides = len / 8;
+  size_t const small_strides = len % 8;
+  uint8_t const* ptr = src;
+  for (size_t i = 0; i < big_strides; i++) {
+    uint64_t const input = *((uint64_t const*)ptr);
+    // Manual 8x loop unroll
+    counts[0][(uint8_t)input]++;
+    counts[1][(uint8_t)(input >> 8)]++;
+    counts[2][(uint8_t)(input >> 16)]++;
+    counts[3][(uint8_t)(input >> 24)]++;
+    counts[0][(uint8_t)(input >> 32)]++;
+    counts[1][(uint8_t)(input >> 40)]++;
+    counts[2][(uint8_t)(input >> 48)]++;
+    counts[3][(uint8_t)(input >> 56)]++;
+    ptr += 8;
+  }
+  for (size_t i = 0; i < small_strides; i++) {
+    counts[0][ptr[i]]++;
+  }
+  for (size_t byte = 0; byte < 256; byte++) {
+    hist[byte] += (size_t)counts[0][byte] + counts[1][byte] +
+                  counts[2][byte] + counts[3][byte];
+  }
+}
+
+void diablo_byte_histogram (uint8_t const* const src,
+                            size_t const off,
+                            size_t const len,
+                            size_t* const hist) {
+  STATS_RECORD(STATS_BYTE_HISTOGRAM, len);
+  uint8_t const* ptr = (uint8_t const*)&(src[off]);
+  if (len < NAIVE_THRESHOLD) {
+    histogram_rest(ptr, len, hist);
+    return;
+  }
+  size_t remaining = len;
+  while (remaining != 0) {
+    size_t const chunk = (remaining < FLUSH_INTERVAL) ? remaining : FLUSH_INTERVAL;
+    histogram_chunk(ptr, chunk, hist);
+    ptr += chunk;
+    remaining -= chunk;
+  }
+}
+
+#include <stddef.h>
+
+// All positions are relative to the start of the range (that is, to off). The
+// find_first and find_last kernels return len if there is no match.
+//
+// The SIMD kernels compare 64 bytes at a time, as the count_eq kernels do, and
+// only work out where the match is once they know there is one. Inputs at
+// least one vector long finish with a vector that overlaps what we've already
+// seen, rather than a scalar loop.
+
+static inline size_t find_first_eq_rest (uint8_t const* const ptr,
+                                         size_t const len,
+                                         uint8_t const byte) {
+  for (size_t i = 0; i < len; i++) {
+    if (ptr[i] == byte) {
+      return i;
+    }
+  }
+  return len;
+}
+
+static inline size_t find_last_eq_rest (uint8_t const* const ptr,
+                                        size_t const len,
+                                        uint8_t const byte) {
+  for (size_t i = len; i > 0; i--) {
+    if (ptr[i - 1] == byte) {
+      return i - 1;
+    }
+  }
+  return len;
+}
+
+// Write out the positions of matches in [start, len), continuing from written.
+static inline size_t find_all_eq_rest (uint8_t const* const ptr,
+                                       size_t const start,
+                                       size_t const len,
+                                       uint8_t const byte,
+                                       size_t* const out,
+                                       size_t const out_len,
+                                       size_t written) {
+  for (size_t i = start; i < len && written < out_len; i++) {
+    if (ptr[i] == byte) {
+      out[written] = i;
+      written++;
+    }
+  }
+  return written;
+}
+
+// Write out base + (i >> shift) for every set bit i of mask, lowest first,
+// continuing from written, and stopping if out fills up.
+static inline size_t emit_positions (uint64_t mask,
+                                     unsigned const shift,
+                                     size_t const base,
+                                     size_t* const out,
+                                     size_t const out_len,
+                                     size_t written) {
+  while (mask != 0 && written < out_len) {
+    out[written] = base + (((size_t)__builtin_ctzll(mask)) >> shift);
+    written++;
+    mask &= (mask - 1);
+  }
+  return written;
+}
+
+// SWAR implementation, used as the fallback everywhere.
+
+static inline size_t find_first_eq_swar (uint8_t const* const src,
+                                         size_t const off,
+                                         size_t const len,
+                                         uint8_t const byte) {
+  uint8_t const* const ptr = (uint8_t const*)&(src[off]);
+  uint64_t const matches = broadcast(byte);
+  size_t i = 0;
+  for (; i + 8 <= len; i += 8) {
+    uint64_t const flags = eq_flags(*((uint64_t const*)(ptr + i)), matches);
+    if (flags != 0) {
+      return i + first_flagged(flags);
+    }
+  }
+  size_t const found = find_first_eq_rest(ptr + i, len - i, byte);
+  return (found == len - i) ? len : i + found;
+}
+
+static inline size_t find_last_eq_swar (uint8_t const* const src,
+                                        size_t const off,
+                                        size_t const len,
+                                        uint8_t const byte) {
+  uint8_t const* const ptr = (uint8_t const*)&(src[off]);
+  uint64_t const matches = broadcast(byte);
+  size_t i = len;
+  for (; i >= 8; i -= 8) {
+    uint64_t const flags = eq_flags(*((uint64_t const*)(ptr + i - 8)), matches);
+    if (flags != 0) {
+      return i - 8 + last_flagged(flags);
+    }
+  }
+  size_t const found = find_last_eq_rest(ptr, i, byte);
+  return (found == i) ? len : found;
+}
+
+static inline size_t find_all_eq_swar (uint8_t const* const src,
+                                       size_t const off,
+                                       size_t const len,
+                                       uint8_t const byte,
+                                       size_t* const out,
+                                       size_t const out_len) {
+  uint8_t const* const ptr = (uint8_t const*)&(src[off]);
+  uint64_t const matches = broadcast(byte);
+  size_t written = 0;
+  size_t i = 0;
+  for (; i + 8 <= len; i += 8) {
+    uint64_t flags = eq_flags(*((uint64_t const*)(ptr + i)), matches);
+    while (flags != 0) {
+      if (written == out_len) {
+        return written;
+      }
+      out[written] = i + first_flagged(flags);
+      written++;
+      flags = clear_first_flagged(flags);
+    }
+  }
+  return find_all_eq_rest(ptr, i, len, byte, out, out_len, written);
+}
+
+#if (DIABLO_HAS_SSE2)
+#include <emmintrin.h>
+
+// One bit per byte, in order.
+static inline uint64_t movemask_sse (__m128i const cmp) {
+  return (uint64_t)(uint32_t)_mm_movemask_epi8(cmp);
+}
+
+// Compare 64 bytes, giving one bit per byte, in order.
+static inline uint64_t eq_mask64_sse (uint8_t const* const ptr,
+                                      __m128i const matches) {
+  __m128i const* big_ptr = (__m128i const*)ptr;
+  return movemask_sse(_mm_cmpeq_epi8(matches, _mm_loadu_si128(big_ptr))) |
+         (movemask_sse(_mm_cmpeq_epi8(matches, _mm_loadu_si128(big_ptr + 1))) << 16) |
+         (movemask_sse(_mm_cmpeq_epi8(matches, _mm_loadu_si128(big_ptr + 2))) << 32) |
+         (movemask_sse(_mm_cmpeq_epi8(matches, _mm_loadu_si128(big_ptr + 3))) << 48);
+}
+
+// Whether any of 64 bytes match.
+static inline bool any_eq64_sse (uint8_t const* const ptr,
+                                 __m128i const matches) {
+  __m128i const* big_ptr = (__m128i const*)ptr;
+  __m128i const any =
+    _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(matches, _mm_loadu_si128(big_ptr)),
+                              _mm_cmpeq_epi8(matches, _mm_loadu_si128(big_ptr + 1))),
+                 _mm_or_si128(_mm_cmpeq_epi8(matches, _mm_loadu_si128(big_ptr + 2)),
+                              _mm_cmpeq_epi8(matches, _mm_loadu_si128(big_ptr + 3))));
+  return _mm_movemask_epi8(any) != 0;
+}
+
+static inline uint64_t eq_mask16_sse (uint8_t const* const ptr,
+                                      __m128i const matches) {
+  return movemask_sse(_mm_cmpeq_epi8(matches,
+                                     _mm_loadu_si128((__m128i const*)ptr)));
+}
+
+static inline size_t find_first_eq_sse (uint8_t const* const src,
+                                        size_t const off,
+                                        size_t const len,
+                                        uint8_t const byte) {
+  uint8_t const* const ptr = (uint8_t const*)&(src[off]);
+  if (len < 16) {
+    return find_first_eq_rest(ptr, len, byte);
+  }
+  __m128i const matches = _mm_set1_epi8(byte);
+  size_t i = 0;
+  for (; i + 64 <= len; i += 64) {
+    if (any_eq64_sse(ptr + i, matches)) {
+      return i + __builtin_ctzll(eq_mask64_sse(ptr + i, matches));
+    }
+  }
+  for (; i + 16 <= len; i += 16) {
+    uint64_t const mask = eq_mask16_sse(ptr + i, matches);
+    if (mask != 0) {
+      return i + __builtin_ctzll(mask);
+    }
+  }
+  if (i < len) {
+    // Everything before i has already been ruled out.
+    uint64_t const mask = eq_mask16_sse(ptr + len - 16, matches);
+    if (mask != 0) {
+      return len - 16 + __builtin_ctzll(mask);
+    }
+  }
+  return len;
+}
+
+static inline size_t find_last_eq_sse (uint8_t const* const src,
+                                       size_t const off,
+                                       size_t const len,
+                                       uint8_t const byte) {
+  uint8_t const* const ptr = (uint8_t const*)&(src[off]);
+  if (len < 16) {
+    return find_last_eq_rest(ptr, len, byte);
+  }
+  __m128i const matches = _mm_set1_epi8(byte);
+  size_t i = len;
+  for (; i >= 64; i -= 64) {
+    if (any_eq64_sse(ptr + i - 64, matches)) {
+      return i - 1 - __builtin_clzll(eq_mask64_sse(ptr + i - 64, matches));
+    }
+  }
+  for (; i >= 16; i -= 16) {
+    uint64_t const mask = eq_mask16_sse(ptr + i - 16, matches);
+    if (mask != 0) {
+      return i - 16 + 63 - __builtin_clzll(mask);
+    }
+  }
+  if (i > 0) {
+    // Everything from i on has already been ruled out.
+    uint64_t const mask = eq_mask16_sse(ptr, matches);
+    if (mask != 0) {
+      return 63 - __builtin_clzll(mask);
+    }
+  }
+  return len;
+}
+
+static inline size_t find_all_eq_sse (uint8_t const* const src,
+                                      size_t const off,
+                                      size_t const len,
+                                      uint8_t const byte,
+                                      size_t* const out,
+                                      size_t const out_len) {
+  uint8_t const* const ptr = (uint8_t const*)&(src[off]);
+  if (len < 16) {
+    return find_all_eq_rest(ptr, 0, len, byte, out, out_len, 0);
+  }
+  __m128i const matches = _mm_set1_epi8(byte);
+  size_t written = 0;
+  size_t i = 0;
+  for (; i + 64 <= len && written < out_len; i += 64) {
+    if (any_eq64_sse(ptr + i, matches)) {
+      written = emit_positions(eq_mask64_sse(ptr + i, matches), 0, i, out,
+                               out_len, written);
+    }
+  }
+  for (; i + 16 <= len && written < out_len; i += 16) {
+    written = emit_positions(eq_mask16_sse(ptr + i, matches), 0, i, out,
+                             out_len, written);
+  }
+  if (i < len && written < out_len) {
+    // Drop the lanes we've already seen.
+    uint64_t const mask = eq_mask16_sse(ptr + len - 16, matches) >> (i - (len - 16));
+    written = emit_positions(mask, 0, i, out, out_len, written);
+  }
+  return written;
+}
+#endif
+
+#if (DIABLO_HAS_AVX2)
+#include <immintrin.h>
+
+__attribute__((target("avx2")))
+static inline uint64_t eq_mask32_avx (uint8_t const* const ptr,
+                                      __m256i const matches) {
+  __m256i const input = _mm256_loadu_si256((__m256i const*)ptr);
+  return (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(matches, input));
+}
+
+__attribute__((target("avx2")))
+static inline bool any_eq64_avx (uint8_t const* const ptr,
+                                 __m256i const matches) {
+  __m256i const* big_ptr = (__m256i const*)ptr;
+  __m256i const any =
+    _mm256_or_si256(_mm256_cmpeq_epi8(matches, _mm256_loadu_si256(big_ptr)),
+                    _mm256_cmpeq_epi8(matches, _mm256_loadu_si256(big_ptr + 1)));
+  return !_mm256_testz_si256(any, any);
+}
+
+__attribute__((target("avx2")))
+static inline uint64_t eq_mask64_avx (uint8_t const* const ptr,
+                                      __m256i const matches) {
+  return eq_mask32_avx(ptr, matches) | (eq_mask32_avx(ptr + 32, matches) << 32);
+}
+
+__attribute__((target("avx2")))
+static inline size_t find_first_eq_avx (uint8_t const* const src,
+                                        size_t const off,
+                                        size_t const len,
+                                        uint8_t const byte) {
+  uint8_t const* const ptr = (uint8_t const*)&(src[off]);
+  if (len < 32) {
+    return find_first_eq_rest(ptr, len, byte);
+  }
+  __m256i const matches = _mm256_set1_epi8(byte);
+  size_t i = 0;
+  for (; i + 64 <= len; i += 64) {
+    if (any_eq64_avx(ptr + i, matches)) {
+      return i + __builtin_ctzll(eq_mask64_avx(ptr + i, matches));
+    }
+  }
+  if (i + 32 <= len) {
+    uint64_t const mask = eq_mask32_avx(ptr + i, matches);
+    if (mask != 0) {
+      return i + __builtin_ctzll(mask);
+    }
+    i += 32;
+  }
+  if (i < len) {
+    uint64_t const mask = eq_mask32_avx(ptr + len - 32, matches);
+    if (mask != 0) {
+      return len - 32 + __builtin_ctzll(mask);
+    }
+  }
+  return len;
+}
+
+__attribute__((target("avx2")))
+static inline size_t find_last_eq_avx (uint8_t const* const src,
+                                       size_t const off,
+                                       size_t const len,
+                                       uint8_t const byte) {
+  uint8_t const* const ptr = (uint8_t const*)&(src[off]);
+  if (len < 32) {
+    return find_last_eq_rest(ptr, len, byte);
+  }
+  __m256i const matches = _mm256_set1_epi8(byte);
+  size_t i = len;
+  for (; i >= 64; i -= 64) {
+    if (any_eq64_avx(ptr + i - 64, matches)) {
+      return i - 1 - __builtin_clzll(eq_mask64_avx(ptr + i - 64, matches));
+    }
+  }
+  if (i >= 32) {
+    uint64_t const mask = eq_mask32_avx(ptr + i - 32, matches);
+    if (mask != 0) {
+      return i - 32 + 63 - __builtin_clzll(mask);
+    }
+    i -= 32;
+  }
+  if (i > 0) {
+    uint64_t const mask = eq_mask32_avx(ptr, matches);
+    if (mask != 0) {
+      return 63 - __builtin_clzll(mask);
+    }
+  }
+  return len;
+}
+
+__attribute__((target("avx2")))
+static inline size_t find_all_eq_avx (uint8_t const* const src,
+                                      size_t const off,
+                                      size_t const len,
+                                      uint8_t const byte,
+                                      size_t* const out,
+                                      size_t const out_len) {
+  uint8_t const* const ptr = (uint8_t const*)&(src[off]);
+  if (len < 32) {
+    return find_all_eq_rest(ptr, 0, len, byte, out, out_len, 0);
+  }
+  __m256i const matches = _mm256_set1_epi8(byte);
+  size_t written = 0;
+  size_t i = 0;
+  for (; i + 64 <= len && written < out_len; i += 64) {
+    if (any_eq64_avx(ptr + i, matches)) {
+      written = emit_positions(eq_mask64_avx(ptr + i, matches), 0, i, out,
+                               out_len, written);
+    }
+  }
+  if (i + 32 <= len && written < out_len) {
+    written = emit_positions(eq_mask32_avx(ptr + i, matches), 0, i, out,
+                             out_len, written);
+    i += 32;
+  }
+  if (i < len && written < out_len) {
+    uint64_t const mask = eq_mask32_avx(ptr + len - 32, matches) >> (i - (len - 32));
+    written = emit_positions(mask, 0, i, out, out_len, written);
+  }
+  return written;
+}
+#endif
+
+#if (DIABLO_HAS_AVX512BW)
+// Masked loads cover the ragged ends, so there is nothing scalar here.
+
+__attribute__((target("avx512bw")))
+static inline uint64_t eq_mask_avx512 (uint8_t const* const ptr,
+                                       size_t const len,
+                                       __m512i const matches) {
+  if (len >= 64) {
+    return _mm512_cmpeq_epi8_mask(matches, _mm512_loadu_si512((void const*)ptr));
+  }
+  __mmask64 const mask = low_mask(len);
+  return _mm512_mask_cmpeq_epi8_mask(mask, matches,
+                                     _mm512_maskz_loadu_epi8(mask, ptr));
+}
+
+__attribute__((target("avx512bw")))
+static inline size_t find_first_eq_avx512 (uint8_t const* const src,
+                                           size_t const off,
+                                           size_t const len,
+                                           uint8_t const byte) {
+  uint8_t const* const ptr = (uint8_t const*)&(src[off]);
+  __m512i const matches = _mm512_set1_epi8(byte);
+  for (size_t i = 0; i < len; i += 64) {
+    uint64_t const mask = eq_mask_avx512(ptr + i, len - i, matches);
+    if (mask != 0) {
+      return i + __builtin_ctzll(mask);
+    }
+  }
+  return len;
+}
+
+__attribute__((target("avx512bw")))
+static inline size_t find_last_eq_avx512 (uint8_t const* const src,
+                                          size_t const off,
+                                          size_t const len,
+                                          uint8_t const byte) {
+  uint8_t const* const ptr = (uint8_t const*)&(src[off]);
+  __m512i const matches = _mm512_set1_epi8(byte);
+  size_t i = len;
+  for (; i >= 64; i -= 64) {
+    uint64_t const mask = eq_mask_avx512(ptr + i - 64, 64, matches);
+    if (mask != 0) {
+      return i - 1 - __builtin_clzll(mask);
+    }
+  }
+  if (i > 0) {
+    uint64_t const mask = eq_mask_avx512(ptr, i, matches);
+    if (mask != 0) {
+      return 63 - __builtin_clzll(mask);
+    }
+  }
+  return len;
+}
+
+__attribute__((target("avx512bw")))
+static inline size_t find_all_eq_avx512 (uint8_t const* const src,
+                                         size_t const off,
+                                         size_t const len,
+                                         uint8_t const byte,
+                                         size_t* const out,
+                                         size_t const out_len) {
+  uint8_t const* const ptr = (uint8_t const*)&(src[off]);
+  __m512i const matches = _mm512_set1_epi8(byte);
+  size_t written = 0;
+  for (size_t i = 0; i < len && written < out_len; i += 64) {
+    written = emit_positions(eq_mask_avx512(ptr + i, len - i, matches), 0, i,
+                             out, out_len, written);
+  }
+  return written;
+}
+#endif
+
+#if (DIABLO_HAS_NEON)
+// Masks here have four bits per byte; see nibble_mask.
+
+static inline uint64_t eq_mask16_neon (uint8_t const* const ptr,
+                                       uint8x16_t const matches) {
+  return nibble_mask(vceqq_u8(matches, vld1q_u8(ptr)));
+}
+
+static inline bool any_eq64_neon (uint8_t const* const ptr,
+                                  uint8x16_t const matches) {
+  uint8x16_t const any =
+    vorrq_u8(vorrq_u8(vceqq_u8(matches, vld1q_u8(ptr)),
+                      vceqq_u8(matches, vld1q_u8(ptr + 16))),
+             vorrq_u8(vceqq_u8(matches, vld1q_u8(ptr + 32)),
+                      vceqq_u8(matches, vld1q_u8(ptr + 48))));
+  return nibble_mask(any) != 0;
+}
+
+static inline size_t find_first_eq_neon (uint8_t const* const src,
+                                         size_t const off,
+                                         size_t const len,
+                                         uint8_t const byte) {
+  uint8_t const* const ptr = (uint8_t const*)&(src[off]);
+  if (len < 16) {
+    return find_first_eq_rest(ptr, len, byte);
+  }
+  uint8x16_t const matches = vdupq_n_u8(byte);
+  size_t i = 0;
+  for (; i + 64 <= len; i += 64) {
+    if (any_eq64_neon(ptr + i, matches)) {
+      break;
+    }
+  }
+  for (; i + 16 <= len; i += 16) {
+    uint64_t const mask = eq_mask16_neon(ptr + i, matches);
+    if (mask != 0) {
+      return i + (__builtin_ctzll(mask) / 4);
+    }
+  }
+  if (i < len) {
+    uint64_t const mask = eq_mask16_neon(ptr + len - 16, matches);
+    if (mask != 0) {
+      return len - 16 + (__builtin_ctzll(mask) / 4);
+    }
+  }
+  return len;
+}
+
+static inline size_t find_last_eq_neon (uint8_t const* const src,
+                                        size_t const off,
+                                        size_t const len,
+                                        uint8_t const byte) {
+  uint8_t const* const ptr = (uint8_t const*)&(src[off]);
+  if (len < 16) {
+    return find_last_eq_rest(ptr, len, byte);
+  }
+  uint8x16_t const matches = vdupq_n_u8(byte);
+  size_t i = len;
+  for (; i >= 64; i -= 64) {
+    if (any_eq64_neon(ptr + i - 64, matches)) {
+      break;
+    }
+  }
+  for (; i >= 16; i -= 16) {
+    uint64_t const mask = eq_mask16_neon(ptr + i - 16, matches);
+    if (mask != 0) {
+      return i - 16 + ((63 - __builtin_clzll(mask)) / 4);
+    }
+  }
+  if (i > 0) {
+    uint64_t const mask = eq_mask16_neon(ptr, matches);
+    if (mask != 0) {
+      return (63 - __builtin_clzll(mask)) / 4;
+    }
+  }
+  return len;
+}
+
+static inline size_t find_all_eq_neon (uint8_t const* const src,
+                                       size_t const off,
+                                       size_t const len,
+                                       uint8_t const byte,
+                                       size_t* const out,
+                                       size_t const out_len) {
+  uint8_t const* const ptr = (uint8_t const*)&(src[off]);
+  if (len < 16) {
+    return find_all_eq_rest(ptr, 0, len, byte, out, out_len, 0);
+  }
+  // One bit per byte is enough for emitting positions.
+  uint64_t const lanes = 0x8888888888888888ULL;
+  uint8x16_t const matches = vdupq_n_u8(byte);
+  size_t written = 0;
+  size_t i = 0;
+  for (; i + 64 <= len && written < out_len; i += 64) {
+    if (any_eq64_neon(ptr + i, matches)) {
+      for (size_t j = 0; j < 64; j += 16) {
+        written = emit_positions(eq_mask16_neon(ptr + i + j, matches) & lanes,
+                                 2, i + j, out, out_len, written);
+      }
+    }
+  }
+  for (; i + 16 <= len && written < out_len; i += 16) {
+    written = emit_positions(eq_mask16_neon(ptr + i, matches) & lanes, 2, i,
+                             out, out_len, written);
+  }
+  if (i < len && written < out_len) {
+    uint64_t const mask =
+      (eq_mask16_neon(ptr + len - 16, matches) & lanes) >> (4 * (i - (len - 16)));
+    written = emit_positions(mask, 2, i, out, out_len, written);
+  }
+  return written;
+}
+#endif
+
+typedef size_t (*find_eq_kernel) (uint8_t const* const,
+                                  size_t const,
+                                  size_t const,
+                                  uint8_t const);
+
+typedef size_t (*find_all_eq_kernel) (uint8_t const* const,
+                                      size_t const,
+                                      size_t const,
+                                      uint8_t const,
+                                      size_t* const,
+                                      size_t const);
+
+static find_eq_kernel const find_first_eq_kernels[DIABLO_BACKEND_COUNT] = {
+  [DIABLO_BACKEND_SWAR] = find_first_eq_swar,
+#if (DIABLO_HAS_SSE2)
+  [DIABLO_BACKEND_SSE2] = find_first_eq_sse,
+#endif
+#if (DIABLO_HAS_SSSE3)
+  [DIABLO_BACKEND_SSSE3] = find_first_eq_sse,
+#endif
+#if (DIABLO_HAS_AVX2)
+  [DIABLO_BACKEND_AVX2] = find_first_eq_avx,
+#endif
+#if (DIABLO_HAS_NEON)
+  [DIABLO_BACKEND_NEON] = find_first_eq_neon,
+#endif
+#if (DIABLO_HAS_AVX512BW)
+  [DIABLO_BACKEND_AVX512BW] = find_first_eq_avx512,
+#endif
+};
+
+static find_eq_kernel const find_last_eq_kernels[DIABLO_BACKEND_COUNT] = {
+  [DIABLO_BACKEND_SWAR] = find_last_eq_swar,
+#if (DIABLO_HAS_SSE2)
+  [DIABLO_BACKEND_SSE2] = find_last_eq_sse,
+#endif
+#if (DIABLO_HAS_SSSE3)
+  [DIABLO_BACKEND_SSSE3] = find_last_eq_sse,
+#endif
+#if (DIABLO_HAS_AVX2)
+  [DIABLO_BACKEND_AVX2] = find_last_eq_avx,
+#endif
+#if (DIABLO_HAS_NEON)
+  [DIABLO_BACKEND_NEON] = find_last_eq_neon,
+#endif
+#if (DIABLO_HAS_AVX512BW)
+  [DIABLO_BACKEND_AVX512BW] = find_last_eq_avx512,
+#endif
+};
+
+static find_all_eq_kernel const find_all_eq_kernels[DIABLO_BACKEND_COUNT] = {
+  [DIABLO_BACKEND_SWAR] = find_all_eq_swar,
+#if (DIABLO_HAS_SSE2)
+  [DIABLO_BACKEND_SSE2] = find_all_eq_sse,
+#endif
+#if (DIABLO_HAS_SSSE3)
+  [DIABLO_BACKEND_SSSE3] = find_all_eq_sse,
+#endif
+#if (DIABLO_HAS_AVX2)
+  [DIABLO_BACKEND_AVX2] = find_all_eq_avx,
+#endif
+#if (DIABLO_HAS_NEON)
+  [DIABLO_BACKEND_NEON] = find_all_eq_neon,
+#endif
+#if (DIABLO_HAS_AVX512BW)
+  [DIABLO_BACKEND_AVX512BW] = find_all_eq_avx512,
+#endif
+};
+
+size_t diablo_find_first_eq (uint8_t const* const src,
+                             size_t const off,
+                             size_t const len,
+                             uint8_t const byte) {
+  STATS_RECORD(STATS_FIND_FIRST_EQ, len);
+  return find_first_eq_kernels[active_backend()](src, off, len, byte);
+}
+
+size_t diablo_find_last_eq (uint8_t const* const src,
+                            size_t const off,
+                            size_t const len,
+                            uint8_t const byte) {
+  STATS_RECORD(STATS_FIND_LAST_EQ, len);
+  return find_last_eq_kernels[active_backend()](src, off, len, byte);
+}
+
+size_t diablo_find_all_eq (uint8_t const* const src,
+                           size_t const off,
+                           size_t const len,
+                           uint8_t const byte,
+                           size_t* const out,
+                           size_t const out_len) {
+  STATS_RECORD(STATS_FIND_ALL_EQ, len);
+  return find_all_eq_kernels[active_backend()](src, off, len, byte, out, out_len);
+}
+
+#include <stddef.h>
+
+// Every kernel returns the position of the first byte at which the two ranges
+// differ, or len if they don't.
+//
+// Nothing here loops a byte at a time. Inputs shorter than a vector are covered
+// by two overlapping loads of the largest size that fits, going down to words,
+// then half-words, then single bytes. Longer ones end with a vector which
+// overlaps the one before it.
+
+// The first differing byte of two 4-byte words, given their XOR, which must not
+// be zero.
+static inline size_t first_differing32 (uint32_t const diff) {
+#if (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+  return __builtin_clz(diff) / 8;
+#else
+  return __builtin_ctz(diff) / 8;
+#endif
+}
+
+// Fewer than 8 bytes.
+static inline size_t mismatch_tiny (uint8_t const* const a,
+                                    uint8_t const* const b,
+                                    size_t const len) {
+  if (len >= 4) {
+    uint32_t const first = *((uint32_t const*)a) ^ *((uint32_t const*)b);
+    if (first != 0) {
+      return first_differing32(first);
+    }
+    uint32_t const last = *((uint32_t const*)(a + len - 4)) ^
+                          *((uint32_t const*)(b + len - 4));
+    return (last != 0) ? len - 4 + first_differing32(last) : len;
+  }
+  if (len >= 1 && a[0] != b[0]) {
+    return 0;
+  }
+  if (len >= 2 && a[1] != b[1]) {
+    return 1;
+  }
+  if (len == 3 && a[2] != b[2]) {
+    return 2;
+  }
+  return len;
+}
+
+// Fewer than 16 bytes.
+static inline size_t mismatch_small (uint8_t const* const a,
+                                     uint8_t const* const b,
+                                     size_t const len) {
+  if (len < 8) {
+    return mismatch_tiny(a, b, len);
+  }
+  uint64_t const first = *((uint64_t const*)a) ^ *((uint64_t const*)b);
+  if (first != 0) {
+    return first_flagged(first);
+  }
+  uint64_t const last = *((uint64_t const*)(a + len - 8)) ^
+                        *((uint64_t const*)(b + len - 8));
+  return (last != 0) ? len - 8 + first_flagged(last) : len;
+}
+
+// SWAR implementation, used as the fallback everywhere.
+//
+// XORing words leaves a nonzero byte wherever they differ, so first_flagged
+// finds the first one.
+static inline size_t mismatch_swar (uint8_t const* const a,
+                                    size_t const a_off,
+                                    uint8_t const* const b,
+                                    size_t const b_off,
+                                    size_t const len) {
+  uint8_t const* const a_ptr = (uint8_t const*)&(a[a_off]);
+  uint8_t const* const b_ptr = (uint8_t const*)&(b[b_off]);
+  if (len < 16) {
+    return mismatch_small(a_ptr, b_ptr, len);
+  }
+  size_t i = 0;
+  for (; i + 8 <= len; i += 8) {
+    uint64_t const diff = *((uint64_t const*)(a_ptr + i)) ^
+                          *((uint64_t const*)(b_ptr + i));
+    if (diff != 0) {
+      return i + first_flagged(diff);
+    }
+  }
+  if (i < len) {
+    uint64_t const diff = *((uint64_t const*)(a_ptr + len - 8)) ^
+                          *((uint64_t const*)(b_ptr + len - 8));
+    if (diff != 0) {
+      return len - 8 + first_flagged(diff);
+    }
+  }
+  return len;
+}
+
+#if (DIABLO_HAS_SSE2)
+#include <emmintrin.h>
+
+// One bit per differing byte, in order.
+static inline uint32_t differ_mask16_sse (uint8_t const* const a,
+                                          uint8_t const* const b) {
+  __m128i const eq = _mm_cmpeq_epi8(_mm_loadu_si128((__m128i const*)a),
+                                    _mm_loadu_si128((__m128i const*)b));
+  return ((uint32_t)_mm_movemask_epi8(eq)) ^ 0xFFFF;
+}
+
+// Whether 64 bytes are all the same.
+static inline bool same64_sse (uint8_t const* const a,
+                               uint8_t const* const b) {
+  __m128i const* a_big = (__m128i const*)a;
+  __m128i const* b_big = (__m128i const*)b;
+  __m128i const all =
+    _mm_and_si128(_mm_and_si128(_mm_cmpeq_epi8(_mm_loadu_si128(a_big), _mm_loadu_si128(b_big)),
+                                _mm_cmpeq_epi8(_mm_loadu_si128(a_big + 1), _mm_loadu_si128(b_big + 1))),
+                  _mm_and_si128(_mm_cmpeq_epi8(_mm_loadu_si128(a_big + 2), _mm_loadu_si128(b_big + 2)),
+                                _mm_cmpeq_epi8(_mm_loadu_si128(a_big + 3), _mm_loadu_si128(b_big + 3))));
+  return _mm_movemask_epi8(all) == 0xFFFF;
+}
+
+static inline size_t mismatch_sse (uint8_t const* const a,
+                                   size_t const a_off,
+                                   uint8_t const* const b,
+                                   size_t const b_off,
+                                   size_t const len) {
+  uint8_t const* const a_ptr = (uint8_t const*)&(a[a_off]);
+  uint8_t const* const b_ptr = (uint8_t const*)&(b[b_off]);
+  if (len < 16) {
+    return mismatch_small(a_ptr, b_ptr, len);
+  }
+  size_t i = 0;
+  // Skip 64 bytes at a time while they're the same.
+  while (i + 64 <= len && same64_sse(a_ptr + i, b_ptr + i)) {
+    i += 64;
+  }
+  for (; i + 16 <= len; i += 16) {
+    uint32_t const mask = differ_mask16_sse(a_ptr + i, b_ptr + i);
+    if (mask != 0) {
+      return i + __builtin_ctz(mask);
+    }
+  }
+  if (i < len) {
+    uint32_t const mask = differ_mask16_sse(a_ptr + len - 16, b_ptr + len - 16);
+    if (mask != 0) {
+      return len - 16 + __builtin_ctz(mask);
+    }
+  }
+  return len;
+}
+#endif
+
+#if (DIABLO_HAS_AVX2)
+#include <immintrin.h>
+
+__attribute__((target("avx2")))
+static inline uint32_t differ_mask32_avx (uint8_t const* const a,
+                                          uint8_t const* const b) {
+  __m256i const eq = _mm256_cmpeq_epi8(_mm256_loadu_si256((__m256i const*)a),
+                                       _mm256_loadu_si256((__m256i const*)b));
+  return ~((uint32_t)_mm256_movemask_epi8(eq));
+}
+
+__attribute__((target("avx2")))
+static inline bool same64_avx (uint8_t const* const a,
+                               uint8_t const* const b) {
+  __m256i const* a_big = (__m256i const*)a;
+  __m256i const* b_big = (__m256i const*)b;
+  __m256i const all =
+    _mm256_and_si256(_mm256_cmpeq_epi8(_mm256_loadu_si256(a_big), _mm256_loadu_si256(b_big)),
+                     _mm256_cmpeq_epi8(_mm256_loadu_si256(a_big + 1), _mm256_loadu_si256(b_big + 1)));
+  return ((uint32_t)_mm256_movemask_epi8(all)) == 0xFFFFFFFF;
+}
+
+__attribute__((target("avx2")))
+static inline size_t mismatch_avx (uint8_t const* const a,
+                                   size_t const a_off,
+                                   uint8_t const* const b,
+                                   size_t const b_off,
+                                   size_t const len) {
+  // Shorter inputs do better with 16-byte vectors.
+  if (len < 32) {
+    return mismatch_sse(a, a_off, b, b_off, len);
+  }
+  uint8_t const* const a_ptr = (uint8_t const*)&(a[a_off]);
+  uint8_t const* const b_ptr = (uint8_t const*)&(b[b_off]);
+  size_t i = 0;
+  while (i + 64 <= len && same64_avx(a_ptr + i, b_ptr + i)) {
+    i += 64;
+  }
+  for (; i + 32 <= len; i += 32) {
+    uint32_t const mask = differ_mask32_avx(a_ptr + i, b_ptr + i);
+    if (mask != 0) {
+      return i + __builtin_ctz(mask);
+    }
+  }
+  if (i < len) {
+    uint32_t const mask = differ_mask32_avx(a_ptr + len - 32, b_ptr + len - 32);
+    if (mask != 0) {
+      return len - 32 + __builtin_ctz(mask);
+    }
+  }
+  return len;
+}
+#endif
+
+#if (DIABLO_HAS_AVX512BW)
+// Masked loads cover the ragged end, so there is nothing scalar here.
+__attribute__((target("avx512bw")))
+static inline size_t mismatch_avx512 (uint8_t const* const a,
+                                      size_t const a_off,
+                                      uint8_t const* const b,
+                                      size_t const b_off,
+                                      size_t const len) {
+  uint8_t const* const a_ptr = (uint8_t const*)&(a[a_off]);
+  uint8_t const* const b_ptr = (uint8_t const*)&(b[b_off]);
+  size_t i = 0;
+  for (; i + 64 <= len; i += 64) {
+    uint64_t const mask =
+      _mm512_cmpneq_epi8_mask(_mm512_loadu_si512((void const*)(a_ptr + i)),
+                              _mm512_loadu_si512((void const*)(b_ptr + i)));
+    if (mask != 0) {
+      return i + __builtin_ctzll(mask);
+    }
+  }
+  if (i < len) {
+    __mmask64 const valid = low_mask(len - i);
+    uint64_t const mask =
+      _mm512_mask_cmpneq_epi8_mask(valid,
+                                   _mm512_maskz_loadu_epi8(valid, a_ptr + i),
+                                   _mm512_maskz_loadu_epi8(valid, b_ptr + i));
+    if (mask != 0) {
+      return i + __builtin_ctzll(mask);
+    }
+  }
+  return len;
+}
+#endif
+
+#if (DIABLO_HAS_NEON)
+// Masks here have four bits per byte; see nibble_mask.
+static inline uint64_t differ_mask16_neon (uint8_t const* const a,
+                                           uint8_t const* const b) {
+  return ~nibble_mask(vceqq_u8(vld1q_u8(a), vld1q_u8(b)));
+}
+
+static inline bool same64_neon (uint8_t const* const a,
+                                uint8_t const* const b) {
+  uint8x16_t const all =
+    vandq_u8(vandq_u8(vceqq_u8(vld1q_u8(a), vld1q_u8(b)),
+                      vceqq_u8(vld1q_u8(a + 16), vld1q_u8(b + 16))),
+             vandq_u8(vceqq_u8(vld1q_u8(a + 32), vld1q_u8(b + 32)),
+                      vceqq_u8(vld1q_u8(a + 48), vld1q_u8(b + 48))));
+  return ~nibble_mask(all) == 0;
+}
+
+static inline size_t mismatch_neon (uint8_t const* const a,
+                                    size_t const a_off,
+                                    uint8_t const* const b,
+                                    size_t const b_off,
+                                    size_t const len) {
+  uint8_t const* const a_ptr = (uint8_t const*)&(a[a_off]);
+  uint8_t const* const b_ptr = (uint8_t const*)&(b[b_off]);
+  if (len < 16) {
+    return mismatch_small(a_ptr, b_ptr, len);
+  }
+  size_t i = 0;
+  while (i + 64 <= len && same64_neon(a_ptr + i, b_ptr + i)) {
+    i += 64;
+  }
+  for (; i + 16 <= len; i += 16) {
+    uint64_t const mask = differ_mask16_neon(a_ptr + i, b_ptr + i);
+    if (mask != 0) {
+      return i + (__builtin_ctzll(mask) >> 2);
+    }
+  }
+  if (i < len) {
+    uint64_t const mask = differ_mask16_neon(a_ptr + len - 16, b_ptr + len - 16);
+    if (mask != 0) {
+      return len - 16 + (__builtin_ctzll(mask) >> 2);
+    }
+  }
+  return len;
+}
+#endif
+
+typedef size_t (*mismatch_kernel) (uint8_t const* const,
+                                   size_t const,
+                                   uint8_t const* const,
+                                   size_t const,
+                                   size_t const);
+
+static mismatch_kernel const mismatch_kernels[DIABLO_BACKEND_COUNT] = {
+  [DIABLO_BACKEND_SWAR] = mismatch_swar,
+#if (DIABLO_HAS_SSE2)
+  [DIABLO_BACKEND_SSE2] = mismatch_sse,
+#endif
+#if (DIABLO_HAS_SSSE3)
+  [DIABLO_BACKEND_SSSE3] = mismatch_sse,
+#endif
+#if (DIABLO_HAS_AVX2)
+  [DIABLO_BACKEND_AVX2] = mismatch_avx,
+#endif
+#if (DIABLO_HAS_NEON)
+  [DIABLO_BACKEND_NEON] = mismatch_neon,
+#endif
+#if (DIABLO_HAS_AVX512BW)
+  [DIABLO_BACKEND_AVX512BW] = mismatch_avx512,
+#endif
+};
+
+size_t diablo_mismatch (uint8_t const* const a,
+                        size_t const a_off,
+                        uint8_t const* const b,
+                        size_t const b_off,
+                        size_t const len) {
+  STATS_RECORD(STATS_MISMATCH, len);
+  return mismatch_kernels[active_backend()](a, a_off, b, b_off, len);
+}
+
+int diablo_compare (uint8_t const* const a,
+                    size_t const a_off,
+                    size_t const a_len,
+                    uint8_t const* const b,
+                    size_t const b_off,
+                    size_t const b_len) {
+  size_t const len = (a_len < b_len) ? a_len : b_len;
+  STATS_RECORD(STATS_COMPARE, len);
+  size_t const i = mismatch_kernels[active_backend()](a, a_off, b, b_off, len);
+  if (i < len) {
+    return (a[a_off + i] < b[b_off + i]) ? -1 : 1;
+  }
+  if (a_len == b_len) {
+    return 0;
+  }
+  return (a_len < b_len) ? -1 : 1;
+}
+
+#include <stddef.h>
+#include <string.h>
+
+// The hash is XXH3 (from xxHash 0.8), in its 64-bit form with a seed: for the
+// same bytes and seed, we give the same result as XXH3_64bits_withSeed. It
+// reads all input as little-endian words, so this holds on every machine.
+//
+// Inputs of up to HASH_MIDSIZE_MAX bytes are mixed 16 bytes at a time, with
+// 64 by 64-bit multiplies folded down to 64 bits; this is scalar everywhere.
+// Longer ones go through eight 64-bit accumulators in 64-byte stripes, each
+// lane taking a 32 by 32-bit multiply per stripe, which vectorizes directly;
+// the kernels do this part. After every HASH_STRIPES_PER_BLOCK stripes, the
+// accumulators are scrambled.
+//
+// Every stripe is mixed with its own part of a 192-byte secret. Seeding adds
+// the seed to every other word of the default secret, and takes it from the
+// rest.
+
+#define HASH_SECRET_SIZE 192
+#define HASH_STRIPE 64
+#define HASH_STRIPES_PER_BLOCK ((HASH_SECRET_SIZE - HASH_STRIPE) / 8)
+#define HASH_MIDSIZE_MAX 240
+#define HASH_BUFFER_SIZE 256
+// Where in the secret the scramble, the last stripe and the final merge get
+// their keys.
+#define HASH_SCRAMBLE_KEY (HASH_SECRET_SIZE - HASH_STRIPE)
+#define HASH_LAST_STRIPE_KEY (HASH_SECRET_SIZE - HASH_STRIPE - 7)
+#define HASH_MERGE_KEY 11
+
+_Static_assert(sizeof(((diablo_hash64_state*)NULL)->secret) == HASH_SECRET_SIZE,
+               "diablo_hash64_state has room for the secret");
+_Static_assert(sizeof(((diablo_hash64_state*)NULL)->buffer) == HASH_BUFFER_SIZE,
+               "diablo_hash64_state has room for the buffer");
+
+static uint8_t const hash_default_secret[HASH_SECRET_SIZE] = {
+  0xb8, 0xfe, 0x6c, 0x39, 0x23, 0xa4, 0x4b, 0xbe, 0x7c, 0x01, 0x81, 0x2c,
+  0xf7, 0x21, 0xad, 0x1c, 0xde, 0xd4, 0x6d, 0xe9, 0x83, 0x90, 0x97, 0xdb,
+  0x72, 0x40, 0xa4, 0xa4, 0xb7, 0xb3, 0x67, 0x1f, 0xcb, 0x79, 0xe6, 0x4e,
+  0xcc, 0xc0, 0xe5, 0x78, 0x82, 0x5a, 0xd0, 0x7d, 0xcc, 0xff, 0x72, 0x21,
+  0xb8, 0x08, 0x46, 0x74, 0xf7, 0x43, 0x24, 0x8e, 0xe0, 0x35, 0x90, 0xe6,
+  0x81, 0x3a, 0x26, 0x4c, 0x3c, 0x28, 0x52, 0xbb, 0x91, 0xc3, 0x00, 0xcb,
+  0x88, 0xd0, 0x65, 0x8b, 0x1b, 0x53, 0x2e, 0xa3, 0x71, 0x64, 0x48, 0x97,
+  0xa2, 0x0d, 0xf9, 0x4e, 0x38, 0x19, 0xef, 0x46, 0xa9, 0xde, 0xac, 0xd8,
+  0xa8, 0xfa, 0x76, 0x3f, 0xe3, 0x9c, 0x34, 0x3f, 0xf9, 0xdc, 0xbb, 0xc7,
+  0xc7, 0x0b, 0x4f, 0x1d, 0x8a, 0x51, 0xe0, 0x4b, 0xcd, 0xb4, 0x59, 0x31,
+  0xc8, 0x9f, 0x7e, 0xc9, 0xd9, 0x78, 0x73, 0x64, 0xea, 0xc5, 0xac, 0x83,
+  0x34, 0xd3, 0xeb, 0xc3, 0xc5, 0x81, 0xa0, 0xff, 0xfa, 0x13, 0x63, 0xeb,
+  0x17, 0x0d, 0xdd, 0x51, 0xb7, 0xf0, 0xda, 0x49, 0xd3, 0x16, 0x55, 0x26,
+  0x29, 0xd4, 0x68, 0x9e, 0x2b, 0x16, 0xbe, 0x58, 0x7d, 0x47, 0xa1, 0xfc,
+  0x8f, 0xf8, 0xb8, 0xd1, 0x7a, 0xd0, 0x31, 0xce, 0x45, 0xcb, 0x3a, 0x8f,
+  0x95, 0x16, 0x04, 0x28, 0xaf, 0xd7, 0xfb, 0xca, 0xbb, 0x4b, 0x40, 0x7e
+};
+
+#define HASH_PRIME32_1 0x9E3779B1U
+#define HASH_PRIME32_2 0x85EBCA77U
+#define HASH_PRIME32_3 0xC2B2AE3DU
+#define HASH_PRIME64_1 0x9E3779B185EBCA87ULL
+#define HASH_PRIME64_2 0xC2B2AE3D27D4EB4FULL
+#define HASH_PRIME64_3 0x165667B19E3779F9ULL
+#define HASH_PRIME64_4 0x85EBCA77C2B2AE63ULL
+#define HASH_PRIME64_5 0x27D4EB2F165667C5ULL
+#define HASH_PRIME_MX1 0x165667919E3779F9ULL
+#define HASH_PRIME_MX2 0x9FB21C651E98DF25ULL
+
+static inline uint64_t hash_read64 (uint8_t const* const src) {
+  uint64_t word;
+  memcpy(&word, src, sizeof(uint64_t));
+#if (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+  return __builtin_bswap64(word);
+#else
+  return word;
+#endif
+}
+
+static inline uint32_t hash_read32 (uint8_t const* const src) {
+  uint32_t word;
+  memcpy(&word, src, sizeof(uint32_t));
+#if (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+  return __builtin_bswap32(word);
+#else
+  return word;
+#endif
+}
+
+static inline void hash_write64 (uint8_t* const dst, uint64_t const word) {
+#if (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+  uint64_t const swapped = __builtin_bswap64(word);
+#else
+  uint64_t const swapped = word;
+#endif
+  memcpy(dst, &swapped, sizeof(uint64_t));
+}
+
+static inline uint64_t hash_rotl (uint64_t const x, unsigned const r) {
+  return (x << r) | (x >> (64 - r));
+}
+
+// The full 128-bit product of a and b, with its halves XORed together. 32-bit
+// targets don't have 128-bit integers, so they build it from 32-bit pieces.
+static inline uint64_t hash_mul_fold (uint64_t const a, uint64_t const b) {
+#if (__SIZEOF_INT128__)
+  __extension__ typedef unsigned __int128 hash_u128;
+  hash_u128 const product = (hash_u128)a * b;
+  return (uint64_t)product ^ (uint64_t)(product >> 64);
+#else
+  uint64_t const lo_lo = (a & 0xFFFFFFFF) * (b & 0xFFFFFFFF);
+  uint64_t const hi_lo = (a >> 32) * (b & 0xFFFFFFFF);
+  uint64_t const lo_hi = (a & 0xFFFFFFFF) * (b >> 32);
+  uint64_t const hi_hi = (a >> 32) * (b >> 32);
+  uint64_t const cross = (lo_lo >> 32) + (hi_lo & 0xFFFFFFFF) + lo_hi;
+  uint64_t const upper = (hi_lo >> 32) + (cross >> 32) + hi_hi;
+  uint64_t const lower = (cross << 32) | (lo_lo & 0xFFFFFFFF);
+  return lower ^ upper;
+#endif
+}
+
+static inline uint64_t hash_avalanche (uint64_t h) {
+  h ^= h >> 37;
+  h *= HASH_PRIME_MX1;
+  return h ^ (h >> 32);
+}
+
+// The finish from XXH64, used by the shortest inputs.
+static inline uint64_t hash_avalanche_xxh64 (uint64_t h) {
+  h ^= h >> 33;
+  h *= HASH_PRIME64_2;
+  h ^= h >> 29;
+  h *= HASH_PRIME64_3;
+  return h ^ (h >> 32);
+}
+
+static inline uint64_t hash_mix16 (uint8_t const* const src,
+                                   uint8_t const* const secret,
+                                   uint64_t const seed) {
+  return hash_mul_fold(hash_read64(src) ^ (hash_read64(secret) + seed),
+                       hash_read64(src + 8) ^ (hash_read64(secret + 8) - seed));
+}
+
+// At most HASH_MIDSIZE_MAX bytes, with the default secret.
+static uint64_t hash_short (uint8_t const* const src,
+                            size_t const len,
+                            uint64_t const seed) {
+  uint8_t const* const secret = hash_default_secret;
+  if (len == 0) {
+    return hash_avalanche_xxh64(seed ^ hash_read64(secret + 56) ^
+                                hash_read64(secret + 64));
+  }
+  if (len <= 3) {
+    uint32_t const combined = ((uint32_t)src[0] << 16) |
+                              ((uint32_t)src[len >> 1] << 24) |
+                              (uint32_t)src[len - 1] |
+                              ((uint32_t)len << 8);
+    uint64_t const flip = (hash_read32(secret) ^ hash_read32(secret + 4)) + seed;
+    return hash_avalanche_xxh64(combined ^ flip);
+  }
+  if (len <= 8) {
+    uint64_t const mixed_seed =
+      seed ^ ((uint64_t)__builtin_bswap32((uint32_t)seed) << 32);
+    uint64_t const flip =
+      (hash_read64(secret + 8) ^ hash_read64(secret + 16)) - mixed_seed;
+    uint64_t const input = hash_read32(src + len - 4) +
+                           ((uint64_t)hash_read32(src) << 32);
+    uint64_t h = input ^ flip;
+    h ^= hash_rotl(h, 49) ^ hash_rotl(h, 24);
+    h *= HASH_PRIME_MX2;
+    h ^= (h >> 35) + len;
+    h *= HASH_PRIME_MX2;
+    return h ^ (h >> 28);
+  }
+  if (len <= 16) {
+    uint64_t const lo = hash_read64(src) ^
+      ((hash_read64(secret + 24) ^ hash_read64(secret + 32)) + seed);
+    uint64_t const hi = hash_read64(src + len - 8) ^
+      ((hash_read64(secret + 40) ^ hash_read64(secret + 48)) - seed);
+    return hash_avalanche(len + __builtin_bswap64(lo) + hi +
+                          hash_mul_fold(lo, hi));
+  }
+  uint64_t acc = len * HASH_PRIME64_1;
+  if (len <= 128) {
+    // Pairs of 16 bytes from each end, working inwards.
+    for (size_t i = (len - 1) / 32 + 1; i > 0; i--) {
+      size_t const k = i - 1;
+      acc += hash_mix16(src + (16 * k), secret + (32 * k), seed);
+      acc += hash_mix16(src + len - (16 * (k + 1)), secret + (32 * k) + 16, seed);
+    }
+    return hash_avalanche(acc);
+  }
+  for (size_t i = 0; i < 8; i++) {
+    acc += hash_mix16(src + (16 * i), secret + (16 * i), seed);
+  }
+  acc = hash_avalanche(acc);
+  uint64_t end = hash_mix16(src + len - 16, secret + 136 - 17, seed);
+  for (size_t i = 8; i < len / 16; i++) {
+    end += hash_mix16(src + (16 * i), secret + (16 * (i - 8)) + 3, seed);
+  }
+  return hash_avalanche(acc + end);
+}
+
+// Every kernel mixes the given number of stripes into the accumulators,
+// keying each with the next part of the secret, and scrambling after the last
+// stripe of every block. done is how many stripes of the current block came
+// before src; the kernel returns the same for after them.
+
+static inline void hash_stripe_swar (uint64_t* const acc,
+                                     uint8_t const* const src,
+                                     uint8_t const* const key) {
+  for (size_t i = 0; i < 8; i++) {
+    uint64_t const data = hash_read64(src + (8 * i));
+    uint64_t const keyed = data ^ hash_read64(key + (8 * i));
+    acc[i ^ 1] += data;
+    acc[i] += (keyed & 0xFFFFFFFF) * (keyed >> 32);
+  }
+}
+
+static inline void hash_scramble_swar (uint64_t* const acc,
+                                       uint8_t const* const key) {
+  for (size_t i = 0; i < 8; i++) {
+    uint64_t lane = acc[i];
+    lane ^= lane >> 47;
+    lane ^= hash_read64(key + (8 * i));
+    acc[i] = lane * HASH_PRIME32_1;
+  }
+}
+
+static size_t hash_stripes_swar (uint64_t* const acc,
+                                 uint8_t const* const src,
+                                 size_t const stripes,
+                                 size_t done,
+                                 uint8_t const* const secret) {
+  for (size_t i = 0; i < stripes; i++) {
+    hash_stripe_swar(acc, src + (HASH_STRIPE * i), secret + (8 * done));
+    if (++done == HASH_STRIPES_PER_BLOCK) {
+      hash_scramble_swar(acc, secret + HASH_SCRAMBLE_KEY);
+      done = 0;
+    }
+  }
+  return done;
+}
+
+#if (DIABLO_HAS_SSE2)
+#include <emmintrin.h>
+
+// Every 64-bit lane of a vector multiplies its two halves. The same goes for
+// AVX2 and AVX-512BW; 32 by 32-bit multiplies are all any of them have for
+// 64-bit lanes.
+static size_t hash_stripes_sse (uint64_t* const acc,
+                                uint8_t const* const src,
+                                size_t const stripes,
+                                size_t done,
+                                uint8_t const* const secret) {
+  __m128i lanes[4];
+  for (size_t j = 0; j < 4; j++) {
+    lanes[j] = _mm_loadu_si128((__m128i const*)(acc + (2 * j)));
+  }
+  __m128i const prime = _mm_set1_epi32((int)HASH_PRIME32_1);
+  for (size_t i = 0; i < stripes; i++) {
+    uint8_t const* const stripe = src + (HASH_STRIPE * i);
+    uint8_t const* const key = secret + (8 * done);
+    for (size_t j = 0; j < 4; j++) {
+      __m128i const data = _mm_loadu_si128((__m128i const*)(stripe + (16 * j)));
+      __m128i const keyed =
+        _mm_xor_si128(data, _mm_loadu_si128((__m128i const*)(key + (16 * j))));
+      // Each lane's high half, moved down, multiplied by its low half.
+      __m128i const product =
+        _mm_mul_epu32(keyed, _mm_shuffle_epi32(keyed, _MM_SHUFFLE(0, 3, 0, 1)));
+      // Each lane's data goes to its neighbour.
+      __m128i const swapped = _mm_shuffle_epi32(data, _MM_SHUFFLE(1, 0, 3, 2));
+      lanes[j] = _mm_add_epi64(lanes[j], _mm_add_epi64(product, swapped));
+    }
+    if (++done == HASH_STRIPES_PER_BLOCK) {
+      uint8_t const* const scramble = secret + HASH_SCRAMBLE_KEY;
+      for (size_t j = 0; j < 4; j++) {
+        __m128i lane = _mm_xor_si128(lanes[j], _mm_srli_epi64(lanes[j], 47));
+        lane = _mm_xor_si128(lane,
+                             _mm_loadu_si128((__m128i const*)(scramble + (16 * j))));
+        // A 64 by 32-bit multiply, from two 32 by 32-bit ones.
+        __m128i const lo = _mm_mul_epu32(lane, prime);
+        __m128i const hi = _mm_mul_epu32(_mm_srli_epi64(lane, 32), prime);
+        lanes[j] = _mm_add_epi64(lo, _mm_slli_epi64(hi, 32));
+      }
+      done = 0;
+    }
+  }
+  for (size_t j = 0; j < 4; j++) {
+    _mm_storeu_si128((__m128i*)(acc + (2 * j)), lanes[j]);
+  }
+  return done;
+}
+#endif
+
+#if (DIABLO_HAS_AVX2)
+#include <immintrin.h>
+
+__attribute__((target("avx2")))
+static size_t hash_stripes_avx (uint64_t* const acc,
+                                uint8_t const* const src,
+                                size_t const stripes,
+                                size_t done,
+                                uint8_t const* const secret) {
+  __m256i lanes[2] = {
+    _mm256_loadu_si256((__m256i const*)acc),
+    _mm256_loadu_si256((__m256i const*)(acc + 4))
+  };
+  __m256i const prime = _mm256_set1_epi32((int)HASH_PRIME32_1);
+  for (size_t i = 0; i < stripes; i++) {
+    uint8_t const* const stripe = src + (HASH_STRIPE * i);
+    uint8_t const* const key = secret + (8 * done);
+    for (size_t j = 0; j < 2; j++) {
+      __m256i const data = _mm256_loadu_si256((__m256i const*)(stripe + (32 * j)));
+      __m256i const keyed =
+        _mm256_xor_si256(data, _mm256_loadu_si256((__m256i const*)(key + (32 * j))));
+      __m256i const product =
+        _mm256_mul_epu32(keyed, _mm256_shuffle_epi32(keyed, _MM_SHUFFLE(0, 3, 0, 1)));
+      // Neighbouring lanes are always in the same 128-bit half.
+      __m256i const swapped = _mm256_shuffle_epi32(data, _MM_SHUFFLE(1, 0, 3, 2));
+      lanes[j] = _mm256_add_epi64(lanes[j], _mm256_add_epi64(product, swapped));
+    }
+    if (++done == HASH_STRIPES_PER_BLOCK) {
+      uint8_t const* const scramble = secret + HASH_SCRAMBLE_KEY;
+      for (size_t j = 0; j < 2; j++) {
+        __m256i lane = _mm256_xor_si256(lanes[j], _mm256_srli_epi64(lanes[j], 47));
+        lane = _mm256_xor_si256(lane,
+                                _mm256_loadu_si256((__m256i const*)(scramble + (32 * j))));
+        __m256i const lo = _mm256_mul_epu32(lane, prime);
+        __m256i const hi = _mm256_mul_epu32(_mm256_srli_epi64(lane, 32), prime);
+        lanes[j] = _mm256_add_epi64(lo, _mm256_slli_epi64(hi, 32));
+      }
+      done = 0;
+    }
+  }
+  _mm256_storeu_si256((__m256i*)acc, lanes[0]);
+  _mm256_storeu_si256((__m256i*)(acc + 4), lanes[1]);
+  return done;
+}
+#endif
+
+#if (DIABLO_HAS_AVX512BW)
+#include <immintrin.h>
+
+// A whole stripe is one vector.
+__attribute__((target("avx512bw")))
+static size_t hash_stripes_avx512 (uint64_t* const acc,
+                                   uint8_t const* const src,
+                                   size_t const stripes,
+                                   size_t done,
+                                   uint8_t const* const secret) {
+  __m512i lanes = _mm512_loadu_si512(acc);
+  __m512i const prime = _mm512_set1_epi32((int)HASH_PRIME32_1);
+  for (size_t i = 0; i < stripes; i++) {
+    __m512i const data = _mm512_loadu_si512(src + (HASH_STRIPE * i));
+    __m512i const keyed =
+      _mm512_xor_si512(data, _mm512_loadu_si512(secret + (8 * done)));
+    __m512i const product =
+      _mm512_mul_epu32(keyed,
+                       _mm512_shuffle_epi32(keyed, (_MM_PERM_ENUM)_MM_SHUFFLE(0, 3, 0, 1)));
+    __m512i const swapped =
+      _mm512_shuffle_epi32(data, (_MM_PERM_ENUM)_MM_SHUFFLE(1, 0, 3, 2));
+    lanes = _mm512_add_epi64(lanes, _mm512_add_epi64(product, swapped));
+    if (++done == HASH_STRIPES_PER_BLOCK) {
+      __m512i lane = _mm512_xor_si512(lanes, _mm512_srli_epi64(lanes, 47));
+      lane = _mm512_xor_si512(lane,
+                              _mm512_loadu_si512(secret + HASH_SCRAMBLE_KEY));
+      __m512i const lo = _mm512_mul_epu32(lane, prime);
+      __m512i const hi = _mm512_mul_epu32(_mm512_srli_epi64(lane, 32), prime);
+      lanes = _mm512_add_epi64(lo, _mm512_slli_epi64(hi, 32));
+      done = 0;
+    }
+  }
+  _mm512_storeu_si512(acc, lanes);
+  return done;
+}
+#endif
+
+#if (DIABLO_HAS_NEON)
+#include <arm_neon.h>
+
+// Loading bytes and reinterpreting gives little-endian lanes, whatever the
+// machine's byte order.
+static size_t hash_stripes_neon (uint64_t* const acc,
+                                 uint8_t const* const src,
+                                 size_t const stripes,
+                                 size_t done,
+                                 uint8_t const* const secret) {
+  uint64x2_t lanes[4];
+  for (size_t j = 0; j < 4; j++) {
+    lanes[j] = vld1q_u64(acc + (2 * j));
+  }
+  for (size_t i = 0; i < stripes; i++) {
+    uint8_t const* const stripe = src + (HASH_STRIPE * i);
+    uint8_t const* const key = secret + (8 * done);
+    for (size_t j = 0; j < 4; j++) {
+      uint64x2_t const data = vreinterpretq_u64_u8(vld1q_u8(stripe + (16 * j)));
+      uint64x2_t const keyed =
+        veorq_u64(data, vreinterpretq_u64_u8(vld1q_u8(key + (16 * j))));
+      uint64x2_t const product = vmull_u32(vmovn_u64(keyed),
+                                           vshrn_n_u64(keyed, 32));
+      uint64x2_t const swapped = vextq_u64(data, data, 1);
+      lanes[j] = vaddq_u64(lanes[j], vaddq_u64(product, swapped));
+    }
+    if (++done == HASH_STRIPES_PER_BLOCK) {
+      uint8_t const* const scramble = secret + HASH_SCRAMBLE_KEY;
+      for (size_t j = 0; j < 4; j++) {
+        uint64x2_t lane = veorq_u64(lanes[j], vshrq_n_u64(lanes[j], 47));
+        lane = veorq_u64(lane,
+                         vreinterpretq_u64_u8(vld1q_u8(scramble + (16 * j))));
+        uint64x2_t const lo = vmull_n_u32(vmovn_u64(lane), HASH_PRIME32_1);
+        uint64x2_t const hi = vmull_n_u32(vshrn_n_u64(lane, 32), HASH_PRIME32_1);
+        lanes[j] = vaddq_u64(lo, vshlq_n_u64(hi, 32));
+      }
+      done = 0;
+    }
+  }
+  for (size_t j = 0; j < 4; j++) {
+    vst1q_u64(acc + (2 * j), lanes[j]);
+  }
+  return done;
+}
+#endif
+
+typedef size_t (*hash_kernel) (uint64_t* const,
+                               uint8_t const* const,
+                               size_t const,
+                               size_t,
+                               uint8_t const* const);
+
+static hash_kernel const hash_kernels[DIABLO_BACKEND_COUNT] = {
+  [DIABLO_BACKEND_SWAR] = hash_stripes_swar,
+#if (DIABLO_HAS_SSE2)
+  [DIABLO_BACKEND_SSE2] = hash_stripes_sse,
+#endif
+#if (DIABLO_HAS_SSSE3)
+  [DIABLO_BACKEND_SSSE3] = hash_stripes_sse,
+#endif
+#if (DIABLO_HAS_AVX2)
+  [DIABLO_BACKEND_AVX2] = hash_stripes_avx,
+#endif
+#if (DIABLO_HAS_NEON)
+  [DIABLO_BACKEND_NEON] = hash_stripes_neon,
+#endif
+#if (DIABLO_HAS_AVX512BW)
+  [DIABLO_BACKEND_AVX512BW] = hash_stripes_avx512,
+#endif
+};
+
+static void hash_init_acc (uint64_t* const acc) {
+  acc[0] = HASH_PRIME32_3;
+  acc[1] = HASH_PRIME64_1;
+  acc[2] = HASH_PRIME64_2;
+  acc[3] = HASH_PRIME64_3;
+  acc[4] = HASH_PRIME64_4;
+  acc[5] = HASH_PRIME32_2;
+  acc[6] = HASH_PRIME64_5;
+  acc[7] = HASH_PRIME32_1;
+}
+
+static void hash_init_secret (uint8_t* const secret, uint64_t const seed) {
+  for (size_t i = 0; i < HASH_SECRET_SIZE; i += 16) {
+    hash_write64(secret + i, hash_read64(hash_default_secret + i) + seed);
+    hash_write64(secret + i + 8, hash_read64(hash_default_secret + i + 8) - seed);
+  }
+}
+
+// Mix in the last 64 bytes of the input, which may overlap stripes already
+// mixed, and bring everything down to one word.
+static uint64_t hash_finish_long (uint64_t* const acc,
+                                  uint8_t const* const last_stripe,
+                                  uint8_t const* const secret,
+                                  uint64_t const len) {
+  hash_stripe_swar(acc, last_stripe, secret + HASH_LAST_STRIPE_KEY);
+  uint64_t result = len * HASH_PRIME64_1;
+  for (size_t i = 0; i < 4; i++) {
+    uint8_t const* const key = secret + HASH_MERGE_KEY + (16 * i);
+    result += hash_mul_fold(acc[2 * i] ^ hash_read64(key),
+                            acc[(2 * i) + 1] ^ hash_read64(key + 8));
+  }
+  return hash_avalanche(result);
+}
+
+uint64_t diablo_hash64 (uint8_t const* const src,
+                        size_t const off,
+                        size_t const len,
+                        uint64_t const seed) {
+  STATS_RECORD(STATS_HASH64, len);
+  uint8_t const* const ptr = &(src[off]);
+  if (len <= HASH_MIDSIZE_MAX) {
+    return hash_short(ptr, len, seed);
+  }
+  uint8_t seeded[HASH_SECRET_SIZE];
+  uint8_t const* secret = hash_default_secret;
+  if (seed != 0) {
+    hash_init_secret(seeded, seed);
+    secret = seeded;
+  }
+  uint64_t acc[8];
+  hash_init_acc(acc);
+  // Every whole stripe bar the last byte; the last stripe is done apart.
+  hash_kernels[active_backend()](acc, ptr, (len - 1) / HASH_STRIPE, 0, secret);
+  return hash_finish_long(acc, ptr + len - HASH_STRIPE, secret, len);
+}
+
+void diablo_hash64_init (diablo_hash64_state* const state,
+                         uint64_t const seed) {
+  hash_init_acc(state->acc);
+  hash_init_secret(state->secret, seed);
+  state->seed = seed;
+  state->len = 0;
+  state->buffered = 0;
+  state->stripes = 0;
+}
+
+// The buffer always keeps at least one byte back, so that however the input
+// is split, we mix exactly the stripes diablo_hash64 would before its last
+// one. Whenever we mix straight from the input, we copy its last stripe to
+// the end of the buffer, for diablo_hash64_finish to use if it needs to.
+void diablo_hash64_update (diablo_hash64_state* const state,
+                           uint8_t const* const src,
+                           size_t const off,
+                           size_t const len) {
+  STATS_RECORD(STATS_HASH64_UPDATE, len);
+  uint8_t const* ptr = &(src[off]);
+  size_t remaining = len;
+  state->len += len;
+  if (remaining <= HASH_BUFFER_SIZE - state->buffered) {
+    // memcpy with a null pointer is undefined, even for no bytes.
+    if (remaining != 0) {
+      memcpy(state->buffer + state->buffered, ptr, remaining);
+    }
+    state->buffered += remaining;
+    return;
+  }
+  hash_kernel const kernel = hash_kernels[active_backend()];
+  if (state->buffered != 0) {
+    size_t const fill = HASH_BUFFER_SIZE - state->buffered;
+    memcpy(state->buffer + state->buffered, ptr, fill);
+    ptr += fill;
+    remaining -= fill;
+    state->stripes = kernel(state->acc, state->buffer,
+                            HASH_BUFFER_SIZE / HASH_STRIPE, state->stripes,
+                            state->secret);
+    state->buffered = 0;
+  }
+  if (remaining > HASH_BUFFER_SIZE) {
+    size_t const stripes = (remaining - 1) / HASH_STRIPE;
+    state->stripes = kernel(state->acc, ptr, stripes, state->stripes,
+                            state->secret);
+    ptr += stripes * HASH_STRIPE;
+    remaining -= stripes * HASH_STRIPE;
+    memcpy(state->buffer + HASH_BUFFER_SIZE - HASH_STRIPE, ptr - HASH_STRIPE,
+           HASH_STRIPE);
+  }
+  memcpy(state->buffer, ptr, remaining);
+  state->buffered = remaining;
+}
+
+uint64_t diablo_hash64_finish (diablo_hash64_state const* const state) {
+  // Short enough that the buffer has all of it.
+  if (state->len <= HASH_MIDSIZE_MAX) {
+    return hash_short(state->buffer, state->buffered, state->seed);
+  }
+  uint64_t acc[8];
+  memcpy(acc, state->acc, sizeof(acc));
+  size_t const buffered = state->buffered;
+  if (buffered >= HASH_STRIPE) {
+    hash_kernels[active_backend()](acc, state->buffer,
+                                   (buffered - 1) / HASH_STRIPE,
+                                   state->stripes, state->secret);
+    return hash_finish_long(acc, state->buffer + buffered - HASH_STRIPE,
+                            state->secret, state->len);
+  }
+  // The last stripe starts in the input we've already mixed.
+  uint8_t last_stripe[HASH_STRIPE];
+  size_t const before = HASH_STRIPE - buffered;
+  memcpy(last_stripe, state->buffer + HASH_BUFFER_SIZE - before, before);
+  memcpy(last_stripe + before, state->buffer, buffered);
+  return hash_finish_long(acc, last_stripe, state->secret, state->len);
+}
+
+#include <stddef.h>
+
+// Every kernel works a 64-byte block at a time, building a mask of the bytes in
+// the set (and, if quoted, another of the quotes) with one bit per byte, in
+// order. Each block's mask is one word of output. The final, partial block is
+// built a byte at a time, except on AVX-512BW, where masked loads handle it.
+//
+// Quoted regions are found by prefix XOR over the quote mask: every bit from an
+// opening quote up to its closing quote ends up set. We carry whether we're
+// still inside quotes from one block to the next, and out of the kernel.
+
+// Turn a block's masks into output, updating whether we're in quotes.
+static inline uint64_t mask_quoted (uint64_t const matches,
+                                    uint64_t const quotes,
+                                    bool* const in_quotes) {
+  uint64_t const inside = prefix_xor(quotes) ^ (*in_quotes ? ~0ULL : 0ULL);
+  *in_quotes = (inside >> 63) != 0;
+  // Quotes themselves are never masked out.
+  return matches & ~(inside & ~quotes);
+}
+
+// The masks for len bytes, with len at most 64.
+static inline uint64_t structural_bitmap_rest (uint8_t const* const ptr,
+                                               size_t const len,
+                                               uint8_t const* const set,
+                                               bool const quoted,
+                                               uint8_t const quote,
+                                               bool* const in_quotes) {
+  uint64_t matches = 0;
+  uint64_t quotes = 0;
+  for (size_t i = 0; i < len; i++) {
+    matches |= ((uint64_t)in_set(set, ptr[i])) << i;
+    quotes |= ((uint64_t)(ptr[i] == quote)) << i;
+  }
+  return quoted ? mask_quoted(matches, quotes, in_quotes) : matches;
+}
+
+// SWAR implementation, used as the fallback everywhere.
+//
+// As with count_in_set_swar, there's no word-level trick for arbitrary sets, so
+// this goes a byte at a time. Quotes use eq_flags, which puts each byte's flag
+// in its top bit; gathering those into consecutive bits is a multiply.
+static inline uint64_t gather_flags (uint64_t const flags) {
+#if (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+  uint64_t const bits = __builtin_bswap64(flags) >> 7;
+#else
+  uint64_t const bits = flags >> 7;
+#endif
+  return (bits * 0x0102040810204080ULL) >> 56;
+}
+
+static inline bool structural_bitmap_swar (uint8_t const* const src,
+                                           size_t const off,
+                                           size_t const len,
+                                           uint8_t const* const set,
+                                           bool const quoted,
+                                           uint8_t const quote,
+                                           bool in_quotes,
+                                           uint64_t* const out) {
+  size_t const big_strides = len / 64;
+  uint8_t const* ptr = (uint8_t const*)&(src[off]);
+  uint64_t const quote_matches = broadcast(quote);
+  for (size_t i = 0; i < big_strides; i++) {
+    uint64_t matches = 0;
+    for (size_t j = 0; j < 64; j++) {
+      matches |= ((uint64_t)in_set(set, ptr[j])) << j;
+    }
+    if (quoted) {
+      uint64_t const* const big_ptr = (uint64_t const*)ptr;
+      uint64_t quotes = 0;
+      for (size_t k = 0; k < 8; k++) {
+        quotes |= gather_flags(eq_flags(big_ptr[k], quote_matches)) << (8 * k);
+      }
+      matches = mask_quoted(matches, quotes, &in_quotes);
+    }
+    out[i] = matches;
+    ptr += 64;
+  }
+  if (len % 64 != 0) {
+    out[big_strides] = structural_bitmap_rest(ptr, len % 64, set, quoted, quote,
+                                              &in_quotes);
+  }
+  return in_quotes;
+}
+
+#if (DIABLO_HAS_SSSE3)
+#include <tmmintrin.h>
+
+// One bit per byte, in order.
+static inline uint64_t movemask_ssse3 (__m128i const cmp) {
+  return (uint64_t)(uint32_t)_mm_movemask_epi8(cmp);
+}
+
+__attribute__((target("ssse3")))
+static inline bool structural_bitmap_ssse3 (uint8_t const* const src,
+                                            size_t const off,
+                                            size_t const len,
+                                            uint8_t const* const set,
+                                            bool const quoted,
+                                            uint8_t const quote,
+                                            bool in_quotes,
+                                            uint64_t* const out) {
+  size_t const big_strides = len / 64;
+  uint8_t const* ptr = (uint8_t const*)&(src[off]);
+  uint8_t tables[2][16];
+  truffle_tables(set, tables[0], tables[1]);
+  __m128i const lows = _mm_loadu_si128((__m128i const*)tables[0]);
+  __m128i const highs = _mm_loadu_si128((__m128i const*)tables[1]);
+  __m128i const quote_matches = _mm_set1_epi8(quote);
+  for (size_t i = 0; i < big_strides; i++) {
+    __m128i const* big_ptr = (__m128i const*)ptr;
+    // This is a manual 4x unroll.
+    __m128i const inputs[4] = {
+      _mm_loadu_si128(big_ptr),
+      _mm_loadu_si128(big_ptr + 1),
+      _mm_loadu_si128(big_ptr + 2),
+      _mm_loadu_si128(big_ptr + 3)
+    };
+    uint64_t matches = movemask_ssse3(classify_ssse3(inputs[0], lows, highs)) |
+                       (movemask_ssse3(classify_ssse3(inputs[1], lows, highs)) << 16) |
+                       (movemask_ssse3(classify_ssse3(inputs[2], lows, highs)) << 32) |
+                       (movemask_ssse3(classify_ssse3(inputs[3], lows, highs)) << 48);
+    if (quoted) {
+      uint64_t const quotes =
+        movemask_ssse3(_mm_cmpeq_epi8(quote_matches, inputs[0])) |
+        (movemask_ssse3(_mm_cmpeq_epi8(quote_matches, inputs[1])) << 16) |
+        (movemask_ssse3(_mm_cmpeq_epi8(quote_matches, inputs[2])) << 32) |
+        (movemask_ssse3(_mm_cmpeq_epi8(quote_matches, inputs[3])) << 48);
+      matches = mask_quoted(matches, quotes, &in_quotes);
+    }
+    out[i] = matches;
+    ptr += 64;
+  }
+  if (len % 64 != 0) {
+    out[big_strides] = structural_bitmap_rest(ptr, len % 64, set, quoted, quote,
+                                              &in_quotes);
+  }
+  return in_quotes;
+}
+#endif
+
+#if (DIABLO_HAS_AVX2)
+#include <immintrin.h>
+
+__attribute__((target("avx2")))
+static inline uint64_t movemask_avx2 (__m256i const cmp) {
+  return (uint64_t)(uint32_t)_mm256_movemask_epi8(cmp);
+}
+
+__attribute__((target("avx2")))
+static inline bool structural_bitmap_avx (uint8_t const* const src,
+                                          size_t const off,
+                                          size_t const len,
+                                          uint8_t const* const set,
+                                          bool const quoted,
+                                          uint8_t const quote,
+                                          bool in_quotes,
+                                          uint64_t* const out) {
+  size_t const big_strides = len / 64;
+  uint8_t const* ptr = (uint8_t const*)&(src[off]);
+  uint8_t tables[2][16];
+  truffle_tables(set, tables[0], tables[1]);
+  // Shuffles work within 128-bit lanes, so both lanes get the same tables.
+  __m256i const lows =
+    _mm256_broadcastsi128_si256(_mm_loadu_si128((__m128i const*)tables[0]));
+  __m256i const highs =
+    _mm256_broadcastsi128_si256(_mm_loadu_si128((__m128i const*)tables[1]));
+  __m256i const quote_matches = _mm256_set1_epi8(quote);
+  for (size_t i = 0; i < big_strides; i++) {
+    __m256i const* big_ptr = (__m256i const*)ptr;
+    // This is a manual 2x unroll.
+    __m256i const inputs[2] = {
+      _mm256_loadu_si256(big_ptr),
+      _mm256_loadu_si256(big_ptr + 1)
+    };
+    uint64_t matches = movemask_avx2(classify_avx2(inputs[0], lows, highs)) |
+                       (movemask_avx2(classify_avx2(inputs[1], lows, highs)) << 32);
+    if (quoted) {
+      uint64_t const quotes =
+        movemask_avx2(_mm256_cmpeq_epi8(quote_matches, inputs[0])) |
+        (movemask_avx2(_mm256_cmpeq_epi8(quote_matches, inputs[1])) << 32);
+      matches = mask_quoted(matches, quotes, &in_quotes);
+    }
+    out[i] = matches;
+    ptr += 64;
+  }
+  if (len % 64 != 0) {
+    out[big_strides] = structural_bitmap_rest(ptr, len % 64, set, quoted, quote,
+                                              &in_quotes);
+  }
+  return in_quotes;
+}
+#endif
+
+#if (DIABLO_HAS_AVX512BW)
+// Comparisons give us the masks directly, and masked loads cover the tail.
+__attribute__((target("avx512bw")))
+static inline bool structural_bitmap_avx512 (uint8_t const* const src,
+                                             size_t const off,
+                                             size_t const len,
+                                             uint8_t const* const set,
+                                             bool const quoted,
+                                             uint8_t const quote,
+                                             bool in_quotes,
+                                             uint64_t* const out) {
+  uint8_t const* const ptr = (uint8_t const*)&(src[off]);
+  uint8_t tables[2][16];
+  truffle_tables(set, tables[0], tables[1]);
+  __m512i const lows =
+    _mm512_broadcast_i32x4(_mm_loadu_si128((__m128i const*)tables[0]));
+  __m512i const highs =
+    _mm512_broadcast_i32x4(_mm_loadu_si128((__m128i const*)tables[1]));
+  __m512i const quote_matches = _mm512_set1_epi8(quote);
+  for (size_t i = 0; i < len; i += 64) {
+    __mmask64 const mask = low_mask(len - i);
+    __m512i const input = (len - i >= 64) ?
+                          _mm512_loadu_si512((void const*)(ptr + i)) :
+                          _mm512_maskz_loadu_epi8(mask, ptr + i);
+    uint64_t matches = mask & classify_avx512(input, lows, highs);
+    if (quoted) {
+      uint64_t const quotes = _mm512_mask_cmpeq_epi8_mask(mask, quote_matches,
+                                                          input);
+      matches = mask_quoted(matches, quotes, &in_quotes);
+    }
+    out[i / 64] = matches;
+  }
+  return in_quotes;
+}
+#endif
+
+#if (DIABLO_HAS_NEON)
+static inline bool structural_bitmap_neon (uint8_t const* const src,
+                                           size_t const off,
+                                           size_t const len,
+                                           uint8_t const* const set,
+                                           bool const quoted,
+                                           uint8_t const quote,
+                                           bool in_quotes,
+                                           uint64_t* const out) {
+  size_t const big_strides = len / 64;
+  uint8_t const* ptr = (uint8_t const*)&(src[off]);
+  uint8_t tables[2][16];
+  truffle_tables(set, tables[0], tables[1]);
+  uint8x16_t const lows = vld1q_u8(tables[0]);
+  uint8x16_t const highs = vld1q_u8(tables[1]);
+  uint8x16_t const quote_matches = vdupq_n_u8(quote);
+  for (size_t i = 0; i < big_strides; i++) {
+    // This is a manual 4x unroll.
+    uint8x16_t const inputs[4] = {
+      vld1q_u8(ptr),
+      vld1q_u8(ptr + 16),
+      vld1q_u8(ptr + 32),
+      vld1q_u8(ptr + 48)
+    };
+    uint64_t matches = movemask_neon(classify_neon(inputs[0], lows, highs)) |
+                       (movemask_neon(classify_neon(inputs[1], lows, highs)) << 16) |
+                       (movemask_neon(classify_neon(inputs[2], lows, highs)) << 32) |
+                       (movemask_neon(classify_neon(inputs[3], lows, highs)) << 48);
+    if (quoted) {
+      uint64_t const quotes =
+        movemask_neon(vceqq_u8(quote_matches, inputs[0])) |
+        (movemask_neon(vceqq_u8(quote_matches, inputs[1])) << 16) |
+        (movemask_neon(vceqq_u8(quote_matches, inputs[2])) << 32) |
+        (movemask_neon(vceqq_u8(quote_matches, inputs[3])) << 48);
+      matches = mask_quoted(matches, quotes, &in_quotes);
+    }
+    out[i] = matches;
+    ptr += 64;
+  }
+  if (len % 64 != 0) {
+    out[big_strides] = structural_bitmap_rest(ptr, len % 64, set, quoted, quote,
+                                              &in_quotes);
+  }
+  return in_quotes;
+}
+#endif
+
+typedef bool (*structural_bitmap_kernel) (uint8_t const* const,
+                                          size_t const,
+                                          size_t const,
+                                          uint8_t const* const,
+                                          bool const,
+                                          uint8_t const,
+                                          bool,
+                                          uint64_t* const);
+
+// Classification needs byte shuffles, so SSE2 uses the SWAR kernel, as it does
+// for count_in_set.
+static structural_bitmap_kernel const structural_bitmap_kernels[DIABLO_BACKEND_COUNT] = {
+  [DIABLO_BACKEND_SWAR] = structural_bitmap_swar,
+#if (DIABLO_HAS_SSE2)
+  [DIABLO_BACKEND_SSE2] = structural_bitmap_swar,
+#endif
+#if (DIABLO_HAS_SSSE3)
+  [DIABLO_BACKEND_SSSE3] = structural_bitmap_ssse3,
+#endif
+#if (DIABLO_HAS_AVX2)
+  [DIABLO_BACKEND_AVX2] = structural_bitmap_avx,
+#endif
+#if (DIABLO_HAS_NEON)
+  [DIABLO_BACKEND_NEON] = structural_bitmap_neon,
+#endif
+#if (DIABLO_HAS_AVX512BW)
+  [DIABLO_BACKEND_AVX512BW] = structural_bitmap_avx512,
+#endif
+};
+
+void diablo_structural_bitmap (uint8_t const* const src,
+                               size_t const off,
+                               size_t const len,
+                               uint8_t const* const set,
+                               uint64_t* const out) {
+  STATS_RECORD(STATS_STRUCTURAL_BITMAP, len);
+  structural_bitmap_kernels[active_backend()](src, off, len, set, false, 0,
+                                              false, out);
+}
+
+bool diablo_structural_bitmap_quoted (uint8_t const* const src,
+                                      size_t const off,
+                                      size_t const len,
+                                      uint8_t const* const set,
+                                      uint8_t const quote,
+                                      bool const in_quotes,
+                                      uint64_t* const out) {
+  STATS_RECORD(STATS_STRUCTURAL_BITMAP_QUOTED, len);
+  return structural_bitmap_kernels[active_backend()](src, off, len, set, true,
+                                                     quote, in_quotes, out);
+}
+
+#include <stddef.h>
+
+// Every kernel here counts the 1 bits of a 64-byte block at a time. For the
+// bulk popcount, the counts get summed; for building a rank/select directory,
+// we need one count per 64-bit word, which is what a sum of absolute
+// differences against zero gives us anyway.
+//
+// The directory follows "rank9", from Sebastiano Vigna, "Broadword
+// Implementation of Rank/Select Queries". For every superblock of 512 bits, we
+// keep two words next to each other: the number of 1 bits before the
+// superblock, then seven 9-bit fields, where field k - 1 is the number of 1
+// bits in the superblock's first k words. A rank is then one cache line of
+// directory, one word of the bit array, and a popcount.
+//
+// Selects first go to a sample: for every SELECT_SAMPLE 1 (or 0) bits, we
+// record which superblock that bit is in. Between two samples, we binary search
+// the superblocks, then scan the fields, then finish with select_bit.
+#define SELECT_SAMPLE 4096
+
+// Source: Wojciech Muła, "Faster population counts using AVX2 instructions".
+// Every x86 kernel but SSE2's splits each byte into nibbles, and looks their
+// counts up with a shuffle.
+
+static inline size_t popcount_rest (uint8_t const* const ptr,
+                                    size_t const len) {
+  size_t count = 0;
+  for (size_t i = 0; i < len; i++) {
+    count += __builtin_popcount(ptr[i]);
+  }
+  return count;
+}
+
+// Fill in a superblock's pair of directory words, given the number of 1 bits
+// before it and the counts of its eight words. Returns the number of 1 bits up
+// to the end of it.
+static inline uint64_t store_superblock (uint64_t* const entry,
+                                         uint64_t const before,
+                                         uint64_t const* const counts) {
+  uint64_t fields = 0;
+  uint64_t running = 0;
+  for (size_t k = 1; k < 8; k++) {
+    running += counts[k - 1];
+    fields |= running << (9 * (k - 1));
+  }
+  entry[0] = before;
+  entry[1] = fields;
+  return before + running + counts[7];
+}
+
+// SWAR implementation, used as the fallback everywhere.
+//
+// As count_eq_swar does with its flags, we popcount whole words.
+static inline size_t popcount_swar (uint8_t const* const src,
+                                    size_t const off,
+                                    size_t const len) {
+  uint8_t const* const ptr = (uint8_t const*)&(src[off]);
+  size_t count = 0;
+  size_t i = 0;
+  for (; i + 32 <= len; i += 32) {
+    uint64_t const* const big_ptr = (uint64_t const*)(ptr + i);
+    // Manual 4x loop unroll
+    count += __builtin_popcountll(big_ptr[0]) + __builtin_popcountll(big_ptr[1]) +
+             __builtin_popcountll(big_ptr[2]) + __builtin_popcountll(big_ptr[3]);
+  }
+  for (; i + 8 <= len; i += 8) {
+    count += __builtin_popcountll(*((uint64_t const*)(ptr + i)));
+  }
+  return count + popcount_rest(ptr + i, len - i);
+}
+
+static inline uint64_t rank_directory_swar (uint64_t const* const bits,
+                                            size_t const superblocks,
+                                            uint64_t* const directory) {
+  uint64_t ones = 0;
+  for (size_t s = 0; s < superblocks; s++) {
+    uint64_t counts[8];
+    for (size_t k = 0; k < 8; k++) {
+      counts[k] = __builtin_popcountll(bits[(8 * s) + k]);
+    }
+    ones = store_superblock(directory + (2 * s), ones, counts);
+  }
+  return ones;
+}
+
+#if (DIABLO_HAS_SSE2)
+#include <emmintrin.h>
+
+// Without a shuffle, we count bits within each byte the same way the
+// scalar fallback in "Bit Twiddling Hacks" does within a word. Shifting 16-bit
+// lanes drags bits across bytes, but the masks throw those away.
+static inline __m128i byte_counts_sse (__m128i const input) {
+  __m128i const pairs =
+    _mm_sub_epi8(input, _mm_and_si128(_mm_srli_epi16(input, 1), _mm_set1_epi8(0x55)));
+  __m128i const quads =
+    _mm_add_epi8(_mm_and_si128(pairs, _mm_set1_epi8(0x33)),
+                 _mm_and_si128(_mm_srli_epi16(pairs, 2), _mm_set1_epi8(0x33)));
+  return _mm_and_si128(_mm_add_epi8(quads, _mm_srli_epi16(quads, 4)),
+                       _mm_set1_epi8(0x0F));
+}
+
+static inline size_t popcount_sse (uint8_t const* const src,
+                                   size_t const off,
+                                   size_t const len) {
+  uint8_t const* const ptr = (uint8_t const*)&(src[off]);
+  __m128i const zero = _mm_setzero_si128();
+  __m128i counts = zero;
+  size_t i = 0;
+  for (; i + 64 <= len; i += 64) {
+    __m128i const* big_ptr = (__m128i const*)(ptr + i);
+    // No byte can reach more than 32, so we sum four vectors' worth before
+    // widening.
+    __m128i const summed =
+      _mm_add_epi8(_mm_add_epi8(byte_counts_sse(_mm_loadu_si128(big_ptr)),
+                                byte_counts_sse(_mm_loadu_si128(big_ptr + 1))),
+                   _mm_add_epi8(byte_counts_sse(_mm_loadu_si128(big_ptr + 2)),
+                                byte_counts_sse(_mm_loadu_si128(big_ptr + 3))));
+    counts = _mm_add_epi64(counts, _mm_sad_epu8(summed, zero));
+  }
+  uint64_t results[2];
+  _mm_storeu_si128((__m128i*)results, counts);
+  return results[0] + results[1] + popcount_swar(ptr, i, len - i);
+}
+
+static inline uint64_t rank_directory_sse (uint64_t const* const bits,
+                                           size_t const superblocks,
+                                           uint64_t* const directory) {
+  __m128i const zero = _mm_setzero_si128();
+  uint64_t ones = 0;
+  for (size_t s = 0; s < superblocks; s++) {
+    __m128i const* big_ptr = (__m128i const*)(bits + (8 * s));
+    uint64_t counts[8];
+    for (size_t k = 0; k < 4; k++) {
+      __m128i const input = _mm_loadu_si128(big_ptr + k);
+      _mm_storeu_si128((__m128i*)(counts + (2 * k)),
+                       _mm_sad_epu8(byte_counts_sse(input), zero));
+    }
+    ones = store_superblock(directory + (2 * s), ones, counts);
+  }
+  return ones;
+}
+#endif
+
+#if (DIABLO_HAS_SSSE3)
+#include <tmmintrin.h>
+
+__attribute__((target("ssse3")))
+static inline __m128i byte_counts_ssse3 (__m128i const input) {
+  __m128i const table = _mm_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3,
+                                      1, 2, 2, 3, 2, 3, 3, 4);
+  __m128i const nibble = _mm_set1_epi8(0x0F);
+  return _mm_add_epi8(_mm_shuffle_epi8(table, _mm_and_si128(input, nibble)),
+                      _mm_shuffle_epi8(table,
+                                       _mm_and_si128(_mm_srli_epi16(input, 4), nibble)));
+}
+
+__attribute__((target("ssse3")))
+static inline size_t popcount_ssse3 (uint8_t const* const src,
+                                     size_t const off,
+                                     size_t const len) {
+  uint8_t const* const ptr = (uint8_t const*)&(src[off]);
+  __m128i const zero = _mm_setzero_si128();
+  __m128i counts = zero;
+  size_t i = 0;
+  for (; i + 64 <= len; i += 64) {
+    __m128i const* big_ptr = (__m128i const*)(ptr + i);
+    __m128i const summed =
+      _mm_add_epi8(_mm_add_epi8(byte_counts_ssse3(_mm_loadu_si128(big_ptr)),
+                                byte_counts_ssse3(_mm_loadu_si128(big_ptr + 1))),
+                   _mm_add_epi8(byte_counts_ssse3(_mm_loadu_si128(big_ptr + 2)),
+                                byte_counts_ssse3(_mm_loadu_si128(big_ptr + 3))));
+    counts = _mm_add_epi64(counts, _mm_sad_epu8(summed, zero));
+  }
+  uint64_t results[2];
+  _mm_storeu_si128((__m128i*)results, counts);
+  return results[0] + results[1] + popcount_swar(ptr, i, len - i);
+}
+
+__attribute__((target("ssse3")))
+static inline uint64_t rank_directory_ssse3 (uint64_t const* const bits,
+                                             size_t const superblocks,
+                                             uint64_t* const directory) {
+  __m128i const zero = _mm_setzero_si128();
+  uint64_t ones = 0;
+  for (size_t s = 0; s < superblocks; s++) {
+    __m128i const* big_ptr = (__m128i const*)(bits + (8 * s));
+    uint64_t counts[8];
+    for (size_t k = 0; k < 4; k++) {
+      __m128i const input = _mm_loadu_si128(big_ptr + k);
+      _mm_storeu_si128((__m128i*)(counts + (2 * k)),
+                       _mm_sad_epu8(byte_counts_ssse3(input), zero));
+    }
+    ones = store_superblock(directory + (2 * s), ones, counts);
+  }
+  return ones;
+}
+#endif
+
+#if (DIABLO_HAS_AVX2)
+#include <immintrin.h>
+
+__attribute__((target("avx2")))
+static inline __m256i byte_counts_avx (__m256i const input) {
+  __m256i const table = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3,
+                                         1, 2, 2, 3, 2, 3, 3, 4,
+                                         0, 1, 1, 2, 1, 2, 2, 3,
+                                         1, 2, 2, 3, 2, 3, 3, 4);
+  __m256i const nibble = _mm256_set1_epi8(0x0F);
+  return _mm256_add_epi8(_mm256_shuffle_epi8(table, _mm256_and_si256(input, nibble)),
+                         _mm256_shuffle_epi8(table,
+                                             _mm256_and_si256(_mm256_srli_epi16(input, 4),
+                                                              nibble)));
+}
+
+// The tail goes a word at a time, so we want the popcount instruction there.
+__attribute__((target("avx2,popcnt")))
+static inline size_t popcount_avx (uint8_t const* const src,
+                                   size_t const off,
+                                   size_t const len) {
+  uint8_t const* const ptr = (uint8_t const*)&(src[off]);
+  __m256i const zero = _mm256_setzero_si256();
+  __m256i counts = zero;
+  size_t i = 0;
+  for (; i + 64 <= len; i += 64) {
+    __m256i const* big_ptr = (__m256i const*)(ptr + i);
+    __m256i const summed =
+      _mm256_add_epi8(byte_counts_avx(_mm256_loadu_si256(big_ptr)),
+                      byte_counts_avx(_mm256_loadu_si256(big_ptr + 1)));
+    counts = _mm256_add_epi64(counts, _mm256_sad_epu8(summed, zero));
+  }
+  size_t const count = _mm256_extract_epi64(counts, 0) +
+                       _mm256_extract_epi64(counts, 1) +
+                       _mm256_extract_epi64(counts, 2) +
+                       _mm256_extract_epi64(counts, 3);
+  return count + popcount_swar(ptr, i, len - i);
+}
+
+__attribute__((target("avx2")))
+static inline uint64_t rank_directory_avx (uint64_t const* const bits,
+                                           size_t const superblocks,
+                                           uint64_t* const directory) {
+  __m256i const zero = _mm256_setzero_si256();
+  uint64_t ones = 0;
+  for (size_t s = 0; s < superblocks; s++) {
+    __m256i const* big_ptr = (__m256i const*)(bits + (8 * s));
+    uint64_t counts[8];
+    _mm256_storeu_si256((__m256i*)counts,
+                        _mm256_sad_epu8(byte_counts_avx(_mm256_loadu_si256(big_ptr)), zero));
+    _mm256_storeu_si256((__m256i*)(counts + 4),
+                        _mm256_sad_epu8(byte_counts_avx(_mm256_loadu_si256(big_ptr + 1)), zero));
+    ones = store_superblock(directory + (2 * s), ones, counts);
+  }
+  return ones;
+}
+#endif
+
+#if (DIABLO_HAS_AVX512BW)
+// A whole superblock fits in one vector, and masked loads cover the ragged end
+// of the bulk popcount.
+__attribute__((target("avx512bw")))
+static inline __m512i byte_counts_avx512 (__m512i const input) {
+  __m512i const table = _mm512_broadcast_i32x4(_mm_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3,
+                                                             1, 2, 2, 3, 2, 3, 3, 4));
+  __m512i const nibble = _mm512_set1_epi8(0x0F);
+  return _mm512_add_epi8(_mm512_shuffle_epi8(table, _mm512_and_si512(input, nibble)),
+                         _mm512_shuffle_epi8(table,
+                                             _mm512_and_si512(_mm512_srli_epi16(input, 4),
+                                                              nibble)));
+}
+
+__attribute__((target("avx512bw")))
+static inline size_t popcount_avx512 (uint8_t const* const src,
+                                      size_t const off,
+                                      size_t const len) {
+  uint8_t const* const ptr = (uint8_t const*)&(src[off]);
+  __m512i const zero = _mm512_setzero_si512();
+  __m512i counts = zero;
+  size_t i = 0;
+  for (; i + 256 <= len; i += 256) {
+    __m512i const* big_ptr = (__m512i const*)(ptr + i);
+    // This is a manual 4x unroll.
+    __m512i const summed =
+      _mm512_add_epi8(_mm512_add_epi8(byte_counts_avx512(_mm512_loadu_si512(big_ptr)),
+                                      byte_counts_avx512(_mm512_loadu_si512(big_ptr + 1))),
+                      _mm512_add_epi8(byte_counts_avx512(_mm512_loadu_si512(big_ptr + 2)),
+                                      byte_counts_avx512(_mm512_loadu_si512(big_ptr + 3))));
+    counts = _mm512_add_epi64(counts, _mm512_sad_epu8(summed, zero));
+  }
+  for (; i < len; i += 64) {
+    __mmask64 const mask = low_mask(len - i);
+    __m512i const input = _mm512_maskz_loadu_epi8(mask, ptr + i);
+    counts = _mm512_add_epi64(counts, _mm512_sad_epu8(byte_counts_avx512(input), zero));
+  }
+  return _mm512_reduce_add_epi64(counts);
+}
+
+__attribute__((target("avx512bw")))
+static inline uint64_t rank_directory_avx512 (uint64_t const* const bits,
+                                              size_t const superblocks,
+                                              uint64_t* const directory) {
+  __m512i const zero = _mm512_setzero_si512();
+  uint64_t ones = 0;
+  for (size_t s = 0; s < superblocks; s++) {
+    __m512i const input = _mm512_loadu_si512((void const*)(bits + (8 * s)));
+    uint64_t counts[8];
+    _mm512_storeu_si512((void*)counts, _mm512_sad_epu8(byte_counts_avx512(input), zero));
+    ones = store_superblock(directory + (2 * s), ones, counts);
+  }
+  return ones;
+}
+#endif
+
+#if (DIABLO_HAS_NEON)
+// NEON counts the bits of every byte in one instruction; pairwise widening
+// adds take those to one count per 64-bit lane.
+static inline uint64x2_t word_counts_neon (uint8x16_t const input) {
+  return vpaddlq_u32(vpaddlq_u16(vpaddlq_u8(vcntq_u8(input))));
+}
+
+static inline size_t popcount_neon (uint8_t const* const src,
+                                    size_t const off,
+                                    size_t const len) {
+  uint8_t const* const ptr = (uint8_t const*)&(src[off]);
+  uint64x2_t counts = vdupq_n_u64(0);
+  size_t i = 0;
+  for (; i + 64 <= len; i += 64) {
+    uint8x16_t const summed =
+      vaddq_u8(vaddq_u8(vcntq_u8(vld1q_u8(ptr + i)), vcntq_u8(vld1q_u8(ptr + i + 16))),
+               vaddq_u8(vcntq_u8(vld1q_u8(ptr + i + 32)), vcntq_u8(vld1q_u8(ptr + i + 48))));
+    counts = vpadalq_u32(counts, vpaddlq_u16(vpaddlq_u8(summed)));
+  }
+  return vgetq_lane_u64(counts, 0) + vgetq_lane_u64(counts, 1) +
+         popcount_swar(ptr, i, len - i);
+}
+
+static inline uint64_t rank_directory_neon (uint64_t const* const bits,
+                                            size_t const superblocks,
+                                            uint64_t* const directory) {
+  uint64_t ones = 0;
+  for (size_t s = 0; s < superblocks; s++) {
+    uint8_t const* const ptr = (uint8_t const*)(bits + (8 * s));
+    uint64_t counts[8];
+    for (size_t k = 0; k < 4; k++) {
+      vst1q_u64(counts + (2 * k), word_counts_neon(vld1q_u8(ptr + (16 * k))));
+    }
+    ones = store_superblock(directory + (2 * s), ones, counts);
+  }
+  return ones;
+}
+#endif
+
+typedef size_t (*popcount_kernel) (uint8_t const* const,
+                                   size_t const,
+                                   size_t const);
+
+static popcount_kernel const popcount_kernels[DIABLO_BACKEND_COUNT] = {
+  [DIABLO_BACKEND_SWAR] = popcount_swar,
+#if (DIABLO_HAS_SSE2)
+  [DIABLO_BACKEND_SSE2] = popcount_sse,
+#endif
+#if (DIABLO_HAS_SSSE3)
+  [DIABLO_BACKEND_SSSE3] = popcount_ssse3,
+#endif
+#if (DIABLO_HAS_AVX2)
+  [DIABLO_BACKEND_AVX2] = popcount_avx,
+#endif
+#if (DIABLO_HAS_NEON)
+  [DIABLO_BACKEND_NEON] = popcount_neon,
+#endif
+#if (DIABLO_HAS_AVX512BW)
+  [DIABLO_BACKEND_AVX512BW] = popcount_avx512,
+#endif
+};
+
+typedef uint64_t (*rank_directory_kernel) (uint64_t const* const,
+                                           size_t const,
+                                           uint64_t* const);
+
+static rank_directory_kernel const rank_directory_kernels[DIABLO_BACKEND_COUNT] = {
+  [DIABLO_BACKEND_SWAR] = rank_directory_swar,
+#if (DIABLO_HAS_SSE2)
+  [DIABLO_BACKEND_SSE2] = rank_directory_sse,
+#endif
+#if (DIABLO_HAS_SSSE3)
+  [DIABLO_BACKEND_SSSE3] = rank_directory_ssse3,
+#endif
+#if (DIABLO_HAS_AVX2)
+  [DIABLO_BACKEND_AVX2] = rank_directory_avx,
+#endif
+#if (DIABLO_HAS_NEON)
+  [DIABLO_BACKEND_NEON] = rank_directory_neon,
+#endif
+#if (DIABLO_HAS_AVX512BW)
+  [DIABLO_BACKEND_AVX512BW] = rank_directory_avx512,
+#endif
+};
+
+size_t diablo_popcount (uint8_t const* const src,
+                        size_t const off,
+                        size_t const len) {
+  STATS_RECORD(STATS_POPCOUNT, len);
+  return popcount_kernels[active_backend()](src, off, len);
+}
+
+// Queries
+//
+// These are a handful of loads each, so they don't go through the kernel
+// tables.
+
+// How many superblocks have directory entries: every whole one, plus one more
+// for whatever is left, even if that's nothing.
+static inline size_t superblock_entries (size_t const len) {
+  return (len / 512) + 1;
+}
+
+static inline size_t sample_count (size_t const n) {
+  return (n + SELECT_SAMPLE - 1) / SELECT_SAMPLE;
+}
+
+// The number of 1 bits in the first k words of the superblock whose fields are
+// given, for 0 <= k < 8.
+static inline uint64_t superblock_field (uint64_t const fields, size_t const k) {
+  return (k == 0) ? 0 : ((fields >> (9 * (k - 1))) & 0x1FF);
+}
+
+size_t diablo_rank_select_size (size_t const len) {
+  // There can't be more samples than this between the 1s and the 0s together,
+  // however they're split.
+  return (2 * superblock_entries(len)) + (len / SELECT_SAMPLE) + 2;
+}
+
+void diablo_rank_select_init (diablo_rank_select* const rs,
+                              uint64_t const* const bits,
+                              size_t const len,
+                              uint64_t* const directory) {
+  STATS_RECORD(STATS_RANK_SELECT_INIT, (len + 7) / 8);
+  size_t const whole = len / 512;
+  uint64_t ones = rank_directory_kernels[active_backend()](bits, whole, directory);
+  // What's left is at most seven whole words and a partial one, whose bits
+  // past the end we mustn't count.
+  uint64_t counts[8] = { 0 };
+  for (size_t i = 8 * whole; i < (len + 63) / 64; i++) {
+    uint64_t const word = bits[i];
+    size_t const used = len - (64 * i);
+    counts[i % 8] = __builtin_popcountll(word & low_mask(used));
+  }
+  ones = store_superblock(directory + (2 * whole), ones, counts);
+  rs->bits = bits;
+  rs->len = len;
+  rs->ones = ones;
+  rs->directory = directory;
+  // Sample j of the 1s is the superblock holding 1 bit j * SELECT_SAMPLE, and
+  // likewise for the 0s, whose samples come straight after.
+  uint64_t* const samples1 = directory + (2 * superblock_entries(len));
+  uint64_t* const samples0 = samples1 + sample_count(ones);
+  size_t next1 = 0;
+  size_t next0 = 0;
+  for (size_t s = 0; s <= whole; s++) {
+    uint64_t const end1 = (s < whole) ? directory[2 * (s + 1)] : ones;
+    uint64_t const end0 = ((s < whole) ? (512 * (s + 1)) : len) - end1;
+    for (; next1 * SELECT_SAMPLE < end1; next1++) {
+      samples1[next1] = s;
+    }
+    for (; next0 * SELECT_SAMPLE < end0; next0++) {
+      samples0[next0] = s;
+    }
+  }
+}
+
+static inline size_t rank1_of (diablo_rank_select const* const rs,
+                                size_t const pos) {
+  if (pos >= rs->len) {
+    return rs->ones;
+  }
+  uint64_t const* const entry = rs->directory + (2 * (pos / 512));
+  size_t rank = entry[0] + superblock_field(entry[1], (pos / 64) % 8);
+  if (pos % 64 != 0) {
+    rank += __builtin_popcountll(rs->bits[pos / 64] & low_mask(pos % 64));
+  }
+  return rank;
+}
+
+size_t diablo_rank1 (diablo_rank_select const* const rs, size_t const pos) {
+  STATS_RECORD(STATS_RANK1, 0);
+  return rank1_of(rs, pos);
+}
+
+size_t diablo_rank0 (diablo_rank_select const* const rs, size_t const pos) {
+  STATS_RECORD(STATS_RANK0, 0);
+  size_t const end = (pos >= rs->len) ? rs->len : pos;
+  return end - rank1_of(rs, end);
+}
+
+// Selecting 0s is selecting 1s in the complement, which the counts give us
+// just as easily. Bits past the end of the array count as 0s here, but they
+// all come after the last real one, so we never stop on them.
+static inline size_t select_bit_of (diablo_rank_select const* const rs,
+                                    size_t const n,
+                                    bool const ones) {
+  uint64_t const* const directory = rs->directory;
+  size_t const total = ones ? rs->ones : (rs->len - rs->ones);
+  if (n >= total) {
+    return rs->len;
+  }
+  size_t const entries = superblock_entries(rs->len);
+  uint64_t const* samples = directory + (2 * entries);
+  if (!ones) {
+    samples += sample_count(rs->ones);
+  }
+  // The superblock we want is the last one with at most n bits before it. Once
+  // there are only a few cache lines of entries left, stepping through them in
+  // order beats jumping around.
+  size_t const j = n / SELECT_SAMPLE;
+  size_t lo = samples[j];
+  size_t hi = (j + 1 < sample_count(total)) ? samples[j + 1] : (entries - 1);
+  while (hi - lo > 16) {
+    size_t const mid = lo + ((hi - lo + 1) / 2);
+    uint64_t const before = ones ? directory[2 * mid] : ((512 * mid) - directory[2 * mid]);
+    if (before <= n) {
+      lo = mid;
+    }
+    else {
+      hi = mid - 1;
+    }
+  }
+  for (; lo < hi; lo++) {
+    size_t const next = lo + 1;
+    uint64_t const before = ones ? directory[2 * next] : ((512 * next) - directory[2 * next]);
+    if (before > n) {
+      break;
+    }
+  }
+  uint64_t const fields = directory[(2 * lo) + 1];
+  size_t rest = n - (ones ? directory[2 * lo] : ((512 * lo) - directory[2 * lo]));
+  // Then the word, likewise.
+  size_t k = 1;
+  for (; k < 8; k++) {
+    uint64_t const field = superblock_field(fields, k);
+    if ((ones ? field : ((64 * k) - field)) > rest) {
+      break;
+    }
+  }
+  k--;
+  uint64_t const field = superblock_field(fields, k);
+  rest -= ones ? field : ((64 * k) - field);
+  size_t const w = (8 * lo) + k;
+  uint64_t const word = ones ? rs->bits[w] : ~(rs->bits[w]);
+  return (64 * w) + select_bit(word, rest);
+}
+
+size_t diablo_select1 (diablo_rank_select const* const rs, size_t const n) {
+  STATS_RECORD(STATS_SELECT1, 0);
+  return select_bit_of(rs, n, true);
+}
+
+size_t diablo_select0 (diablo_rank_select const* const rs, size_t const n) {
+  STATS_RECORD(STATS_SELECT0, 0);
+  return select_bit_of(rs, n, false);
+}
+
+#include <stddef.h>
+
+// Every kernel here may be asked to work in place, with dst the same as src.
+// Thus, the ragged end can't be done by translating an overlapping last
+// vector after the rest, as that would translate some bytes twice. Instead, we
+// translate the last vector first, while its input is still untouched, but
+// only store it once everything else is done. The bytes it shares with the
+// vector before it get the same value written twice.
+
+// Scalar
+//
+// There is no way to look up eight different table entries in a word, so this
+// is also what the general translation does below AVX2.
+
+static inline void translate_rest (uint8_t const* const src,
+                                   size_t const src_off,
+                                   uint8_t* const dst,
+                                   size_t const dst_off,
+                                   size_t const len,
+                                   uint8_t const* const table) {
+  uint8_t const* const in = (uint8_t const*)&(src[src_off]);
+  uint8_t* const out = &(dst[dst_off]);
+  for (size_t i = 0; i < len; i++) {
+    out[i] = table[in[i]];
+  }
+}
+
+static inline void translate_range_rest (uint8_t const* const in,
+                                         uint8_t* const out,
+                                         size_t const len,
+                                         uint8_t const lo,
+                                         uint8_t const width,
+                                         uint8_t const delta) {
+  for (size_t i = 0; i < len; i++) {
+    uint8_t const byte = in[i];
+    out[i] = ((uint8_t)(byte - lo) <= width) ? (uint8_t)(byte + delta) : byte;
+  }
+}
+
+static inline void replace_eq_rest (uint8_t const* const in,
+                                    uint8_t* const out,
+                                    size_t const len,
+                                    uint8_t const from,
+                                    uint8_t const to) {
+  for (size_t i = 0; i < len; i++) {
+    out[i] = (in[i] == from) ? to : in[i];
+  }
+}
+
+// SWAR implementation, used as the fallback everywhere.
+//
+// Byte-wise addition and subtraction are the usual trick of doing the low
+// seven bits of each byte with an ordinary add, then fixing up the high bits
+// with XOR, so nothing carries into the next byte. Source: "Hacker's Delight",
+// section 2-18.
+
+#define HIGH_BITS 0x8080808080808080ULL
+
+static inline uint64_t add_bytes (uint64_t const x, uint64_t const y) {
+  return ((x & ~HIGH_BITS) + (y & ~HIGH_BITS)) ^ ((x ^ y) & HIGH_BITS);
+}
+
+static inline uint64_t sub_bytes (uint64_t const x, uint64_t const y) {
+  return ((x | HIGH_BITS) - (y & ~HIGH_BITS)) ^ ((x ^ ~y) & HIGH_BITS);
+}
+
+// Every byte of x which is at most the corresponding byte of y becomes 0xFF;
+// every other byte becomes 0x00. We check whether y - x borrows out of each
+// byte.
+static inline uint64_t le_bytes (uint64_t const x, uint64_t const y) {
+  uint64_t const diff = sub_bytes(y, x);
+  uint64_t const borrows = ((~y & x) | (~(y ^ x) & diff)) & HIGH_BITS;
+  return ((~borrows & HIGH_BITS) >> 7) * 0xFF;
+}
+
+// Bytes in [lo, lo + width] are the ones for which byte - lo, wrapping, is at
+// most width.
+static inline uint64_t translate_range_word (uint64_t const word,
+                                             uint64_t const los,
+                                             uint64_t const widths,
+                                             uint64_t const deltas) {
+  uint64_t const in_range = le_bytes(sub_bytes(word, los), widths);
+  return add_bytes(word, deltas & in_range);
+}
+
+static inline uint64_t replace_eq_word (uint64_t const word,
+                                       uint64_t const froms,
+                                       uint64_t const flips) {
+  uint64_t const matched = (eq_flags(word, froms) >> 7) * 0xFF;
+  return word ^ (flips & matched);
+}
+
+static inline void translate_range_swar (uint8_t const* const src,
+                                         size_t const src_off,
+                                         uint8_t* const dst,
+                                         size_t const dst_off,
+                                         size_t const len,
+                                         uint8_t const lo,
+                                         uint8_t const width,
+                                         uint8_t const delta) {
+  uint8_t const* const in = (uint8_t const*)&(src[src_off]);
+  uint8_t* const out = &(dst[dst_off]);
+  if (len < 8) {
+    translate_range_rest(in, out, len, lo, width, delta);
+    return;
+  }
+  uint64_t const los = broadcast(lo);
+  uint64_t const widths = broadcast(width);
+  uint64_t const deltas = broadcast(delta);
+  uint64_t const last = translate_range_word(*((uint64_t const*)(in + len - 8)),
+                                             los, widths, deltas);
+  for (size_t i = 0; i + 8 <= len; i += 8) {
+    *((uint64_t*)(out + i)) = translate_range_word(*((uint64_t const*)(in + i)),
+                                                   los, widths, deltas);
+  }
+  *((uint64_t*)(out + len - 8)) = last;
+}
+
+// A matching byte XORed with (from ^ to) becomes to.
+static inline void replace_eq_swar (uint8_t const* const src,
+                                    size_t const src_off,
+                                    uint8_t* const dst,
+                                    size_t const dst_off,
+                                    size_t const len,
+                                    uint8_t const from,
+                                    uint8_t const to) {
+  uint8_t const* const in = (uint8_t const*)&(src[src_off]);
+  uint8_t* const out = &(dst[dst_off]);
+  if (len < 8) {
+    replace_eq_rest(in, out, len, from, to);
+    return;
+  }
+  uint64_t const froms = broadcast(from);
+  uint64_t const flips = broadcast(from ^ to);
+  uint64_t const last = replace_eq_word(*((uint64_t const*)(in + len - 8)),
+                                        froms, flips);
+  for (size_t i = 0; i + 8 <= len; i += 8) {
+    *((uint64_t*)(out + i)) = replace_eq_word(*((uint64_t const*)(in + i)),
+                                              froms, flips);
+  }
+  *((uint64_t*)(out + len - 8)) = last;
+}
+
+#if (DIABLO_HAS_SSE2)
+#include <emmintrin.h>
+
+// There is no unsigned byte comparison, but x <= y exactly when min(x, y) is
+// x.
+static inline __m128i translate_range_sse_vec (__m128i const input,
+                                               __m128i const los,
+                                               __m128i const widths,
+                                               __m128i const deltas) {
+  __m128i const shifted = _mm_sub_epi8(input, los);
+  __m128i const in_range = _mm_cmpeq_epi8(_mm_min_epu8(shifted, widths), shifted);
+  return _mm_add_epi8(input, _mm_and_si128(deltas, in_range));
+}
+
+static inline __m128i replace_eq_sse_vec (__m128i const input,
+                                          __m128i const froms,
+                                          __m128i const flips) {
+  __m128i const matched = _mm_cmpeq_epi8(input, froms);
+  return _mm_xor_si128(input, _mm_and_si128(flips, matched));
+}
+
+static inline void translate_range_sse (uint8_t const* const src,
+                                        size_t const src_off,
+                                        uint8_t* const dst,
+                                        size_t const dst_off,
+                                        size_t const len,
+                                        uint8_t const lo,
+                                        uint8_t const width,
+                                        uint8_t const delta) {
+  if (len < 16) {
+    translate_range_swar(src, src_off, dst, dst_off, len, lo, width, delta);
+    return;
+  }
+  uint8_t const* const in = (uint8_t const*)&(src[src_off]);
+  uint8_t* const out = &(dst[dst_off]);
+  __m128i const los = _mm_set1_epi8(lo);
+  __m128i const widths = _mm_set1_epi8(width);
+  __m128i const deltas = _mm_set1_epi8(delta);
+  __m128i const last =
+    translate_range_sse_vec(_mm_loadu_si128((__m128i const*)(in + len - 16)),
+                            los, widths, deltas);
+  for (size_t i = 0; i + 16 <= len; i += 16) {
+    __m128i const input = _mm_loadu_si128((__m128i const*)(in + i));
+    _mm_storeu_si128((__m128i*)(out + i),
+                     translate_range_sse_vec(input, los, widths, deltas));
+  }
+  _mm_storeu_si128((__m128i*)(out + len - 16), last);
+}
+
+static inline void replace_eq_sse (uint8_t const* const src,
+                                   size_t const src_off,
+                                   uint8_t* const dst,
+                                   size_t const dst_off,
+                                   size_t const len,
+                                   uint8_t const from,
+                                   uint8_t const to) {
+  if (len < 16) {
+    replace_eq_swar(src, src_off, dst, dst_off, len, from, to);
+    return;
+  }
+  uint8_t const* const in = (uint8_t const*)&(src[src_off]);
+  uint8_t* const out = &(dst[dst_off]);
+  __m128i const froms = _mm_set1_epi8(from);
+  __m128i const flips = _mm_set1_epi8(from ^ to);
+  __m128i const last =
+    replace_eq_sse_vec(_mm_loadu_si128((__m128i const*)(in + len - 16)),
+                       froms, flips);
+  for (size_t i = 0; i + 16 <= len; i += 16) {
+    __m128i const input = _mm_loadu_si128((__m128i const*)(in + i));
+    _mm_storeu_si128((__m128i*)(out + i),
+                     replace_eq_sse_vec(input, froms, flips));
+  }
+  _mm_storeu_si128((__m128i*)(out + len - 16), last);
+}
+#endif
+
+#if (DIABLO_HAS_AVX2)
+#include <immintrin.h>
+
+// For the general translation, we split the table into sixteen 16-byte rows,
+// one per high nibble, and look up in all of them with vpshufb, which gives 0
+// for indices with the high bit set. This is the method of Wojciech Mula,
+// described in "SIMD-ized lookup in a 256-entry table".
+// Source: http://0x80.pl/notesen/2018-10-18-simd-byte-lookup.html
+//
+// Take inputs below 0x80 first. Subtracting 16 * i from one puts it in 0 to
+// 0x7F, where pshufb uses its low nibble, exactly when i is at most its high
+// nibble; for larger i, it goes negative, and pshufb gives 0. Thus, if row i
+// is stored XORed with row i - 1, XORing the lookups for every i gives the
+// entry we want, as everything below it cancels out. Inputs from 0x80 up work
+// the same way with the top half of the table once we flip their high bit, so
+// we do both halves, then pick per byte.
+//
+// That is sixteen shuffles per vector, and most x86 cores can only do one per
+// cycle, so with 16-byte vectors this is no faster than a byte at a time. Thus,
+// we only do it from AVX2 up.
+typedef struct {
+  uint8_t low[8][16];
+  uint8_t high[8][16];
+} translate_rows;
+
+static inline void make_translate_rows (uint8_t const* const table,
+                                        translate_rows* const rows) {
+  for (size_t j = 0; j < 16; j++) {
+    rows->low[0][j] = table[j];
+    rows->high[0][j] = table[128 + j];
+  }
+  for (size_t i = 1; i < 8; i++) {
+    for (size_t j = 0; j < 16; j++) {
+      rows->low[i][j] = table[(16 * i) + j] ^ table[(16 * (i - 1)) + j];
+      rows->high[i][j] = table[128 + (16 * i) + j] ^ table[128 + (16 * (i - 1)) + j];
+    }
+  }
+}
+
+// vpshufb only looks within each 128-bit half, so every row goes in both.
+__attribute__((target("avx2")))
+static inline __m256i translate_avx_vec (__m256i const input,
+                                         __m256i const* const low,
+                                         __m256i const* const high) {
+  __m256i const step = _mm256_set1_epi8(16);
+  __m256i low_indices = input;
+  __m256i high_indices = _mm256_xor_si256(input, _mm256_set1_epi8((char)0x80));
+  __m256i low_result = _mm256_setzero_si256();
+  __m256i high_result = _mm256_setzero_si256();
+  for (int i = 0; i < 8; i++) {
+    low_result = _mm256_xor_si256(low_result, _mm256_shuffle_epi8(low[i], low_indices));
+    high_result = _mm256_xor_si256(high_result, _mm256_shuffle_epi8(high[i], high_indices));
+    low_indices = _mm256_sub_epi8(low_indices, step);
+    high_indices = _mm256_sub_epi8(high_indices, step);
+  }
+  return _mm256_blendv_epi8(low_result, high_result, input);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i translate_range_avx_vec (__m256i const input,
+                                               __m256i const los,
+                                               __m256i const widths,
+                                               __m256i const deltas) {
+  __m256i const shifted = _mm256_sub_epi8(input, los);
+  __m256i const in_range = _mm256_cmpeq_epi8(_mm256_min_epu8(shifted, widths), shifted);
+  return _mm256_add_epi8(input, _mm256_and_si256(deltas, in_range));
+}
+
+__attribute__((target("avx2")))
+static inline __m256i replace_eq_avx_vec (__m256i const input,
+                                          __m256i const froms,
+                                          __m256i const flips) {
+  __m256i const matched = _mm256_cmpeq_epi8(input, froms);
+  return _mm256_xor_si256(input, _mm256_and_si256(flips, matched));
+}
+
+__attribute__((target("avx2")))
+static inline void translate_avx (uint8_t const* const src,
+                                  size_t const src_off,
+                                  uint8_t* const dst,
+                                  size_t const dst_off,
+                                  size_t const len,
+                                  uint8_t const* const table) {
+  if (len < 32) {
+    translate_rest(src, src_off, dst, dst_off, len, table);
+    return;
+  }
+  uint8_t const* const in = (uint8_t const*)&(src[src_off]);
+  uint8_t* const out = &(dst[dst_off]);
+  translate_rows rows;
+  make_translate_rows(table, &rows);
+  __m256i low[8];
+  __m256i high[8];
+  for (size_t i = 0; i < 8; i++) {
+    low[i] = _mm256_broadcastsi128_si256(_mm_loadu_si128((__m128i const*)rows.low[i]));
+    high[i] = _mm256_broadcastsi128_si256(_mm_loadu_si128((__m128i const*)rows.high[i]));
+  }
+  __m256i const last =
+    translate_avx_vec(_mm256_loadu_si256((__m256i const*)(in + len - 32)), low, high);
+  for (size_t i = 0; i + 32 <= len; i += 32) {
+    __m256i const input = _mm256_loadu_si256((__m256i const*)(in + i));
+    _mm256_storeu_si256((__m256i*)(out + i), translate_avx_vec(input, low, high));
+  }
+  _mm256_storeu_si256((__m256i*)(out + len - 32), last);
+}
+
+__attribute__((target("avx2")))
+static inline void translate_range_avx (uint8_t const* const src,
+                                        size_t const src_off,
+                                        uint8_t* const dst,
+                                        size_t const dst_off,
+                                        size_t const len,
+                                        uint8_t const lo,
+                                        uint8_t const width,
+                                        uint8_t const delta) {
+  if (len < 32) {
+    translate_range_sse(src, src_off, dst, dst_off, len, lo, width, delta);
+    return;
+  }
+  uint8_t const* const in = (uint8_t const*)&(src[src_off]);
+  uint8_t* const out = &(dst[dst_off]);
+  __m256i const los = _mm256_set1_epi8(lo);
+  __m256i const widths = _mm256_set1_epi8(width);
+  __m256i const deltas = _mm256_set1_epi8(delta);
+  __m256i const last =
+    translate_range_avx_vec(_mm256_loadu_si256((__m256i const*)(in + len - 32)),
+                            los, widths, deltas);
+  for (size_t i = 0; i + 32 <= len; i += 32) {
+    __m256i const input = _mm256_loadu_si256((__m256i const*)(in + i));
+    _mm256_storeu_si256((__m256i*)(out + i),
+                        translate_range_avx_vec(input, los, widths, deltas));
+  }
+  _mm256_storeu_si256((__m256i*)(out + len - 32), last);
+}
+
+__attribute__((target("avx2")))
+static inline void replace_eq_avx (uint8_t const* const src,
+                                   size_t const src_off,
+                                   uint8_t* const dst,
+                                   size_t const dst_off,
+                                   size_t const len,
+                                   uint8_t const from,
+                                   uint8_t const to) {
+  if (len < 32) {
+    replace_eq_sse(src, src_off, dst, dst_off, len, from, to);
+    return;
+  }
+  uint8_t const* const in = (uint8_t const*)&(src[src_off]);
+  uint8_t* const out = &(dst[dst_off]);
+  __m256i const froms = _mm256_set1_epi8(from);
+  __m256i const flips = _mm256_set1_epi8(from ^ to);
+  __m256i const last =
+    replace_eq_avx_vec(_mm256_loadu_si256((__m256i const*)(in + len - 32)),
+                       froms, flips);
+  for (size_t i = 0; i + 32 <= len; i += 32) {
+    __m256i const input = _mm256_loadu_si256((__m256i const*)(in + i));
+    _mm256_storeu_si256((__m256i*)(out + i),
+                        replace_eq_avx_vec(input, froms, flips));
+  }
+  _mm256_storeu_si256((__m256i*)(out + len - 32), last);
+}
+#endif
+
+#if (DIABLO_HAS_AVX512BW)
+// Masked loads and stores cover the ragged end, so nothing is written twice
+// here. Without VBMI there is no full-width byte permute, so the general
+// translation works like translate_avx_vec, with every row in all four 128-bit
+// lanes.
+__attribute__((target("avx512bw")))
+static inline __m512i translate_avx512_vec (__m512i const input,
+                                            __m512i const* const low,
+                                            __m512i const* const high) {
+  __m512i const step = _mm512_set1_epi8(16);
+  __m512i low_indices = input;
+  __m512i high_indices = _mm512_xor_si512(input, _mm512_set1_epi8((char)0x80));
+  __m512i low_result = _mm512_setzero_si512();
+  __m512i high_result = _mm512_setzero_si512();
+  for (int i = 0; i < 8; i++) {
+    low_result = _mm512_xor_si512(low_result, _mm512_shuffle_epi8(low[i], low_indices));
+    high_result = _mm512_xor_si512(high_result, _mm512_shuffle_epi8(high[i], high_indices));
+    low_indices = _mm512_sub_epi8(low_indices, step);
+    high_indices = _mm512_sub_epi8(high_indices, step);
+  }
+  return _mm512_mask_blend_epi8(_mm512_movepi8_mask(input), low_result, high_result);
+}
+
+__attribute__((target("avx512bw")))
+static inline void translate_avx512 (uint8_t const* const src,
+                                     size_t const src_off,
+                                     uint8_t* const dst,
+                                     size_t const dst_off,
+                                     size_t const len,
+                                     uint8_t const* const table) {
+  uint8_t const* const in = (uint8_t const*)&(src[src_off]);
+  uint8_t* const out = &(dst[dst_off]);
+  translate_rows rows;
+  make_translate_rows(table, &rows);
+  __m512i low[8];
+  __m512i high[8];
+  for (size_t i = 0; i < 8; i++) {
+    low[i] = _mm512_broadcast_i32x4(_mm_loadu_si128((__m128i const*)rows.low[i]));
+    high[i] = _mm512_broadcast_i32x4(_mm_loadu_si128((__m128i const*)rows.high[i]));
+  }
+  size_t i = 0;
+  for (; i + 64 <= len; i += 64) {
+    __m512i const input = _mm512_loadu_si512((void const*)(in + i));
+    _mm512_storeu_si512((void*)(out + i), translate_avx512_vec(input, low, high));
+  }
+  if (i < len) {
+    __mmask64 const mask = low_mask(len - i);
+    __m512i const input = _mm512_maskz_loadu_epi8(mask, in + i);
+    _mm512_mask_storeu_epi8(out + i, mask, translate_avx512_vec(input, low, high));
+  }
+}
+
+__attribute__((target("avx512bw")))
+static inline __m512i translate_range_avx512_vec (__m512i const input,
+                                                  __m512i const los,
+                                                  __m512i const widths,
+                                                  __m512i const deltas) {
+  __mmask64 const in_range = _mm512_cmple_epu8_mask(_mm512_sub_epi8(input, los), widths);
+  return _mm512_mask_add_epi8(input, in_range, input, deltas);
+}
+
+__attribute__((target("avx512bw")))
+static inline void translate_range_avx512 (uint8_t const* const src,
+                                           size_t const src_off,
+                                           uint8_t* const dst,
+                                           size_t const dst_off,
+                                           size_t const len,
+                                           uint8_t const lo,
+                                           uint8_t const width,
+                                           uint8_t const delta) {
+  uint8_t const* const in = (uint8_t const*)&(src[src_off]);
+  uint8_t* const out = &(dst[dst_off]);
+  __m512i const los = _mm512_set1_epi8(lo);
+  __m512i const widths = _mm512_set1_epi8(width);
+  __m512i const deltas = _mm512_set1_epi8(delta);
+  size_t i = 0;
+  for (; i + 64 <= len; i += 64) {
+    __m512i const input = _mm512_loadu_si512((void const*)(in + i));
+    _mm512_storeu_si512((void*)(out + i),
+                        translate_range_avx512_vec(input, los, widths, deltas));
+  }
+  if (i < len) {
+    __mmask64 const mask = low_mask(len - i);
+    __m512i const input = _mm512_maskz_loadu_epi8(mask, in + i);
+    _mm512_mask_storeu_epi8(out + i, mask,
+                            translate_range_avx512_vec(input, los, widths, deltas));
+  }
+}
+
+__attribute__((target("avx512bw")))
+static inline void replace_eq_avx512 (uint8_t const* const src,
+                                      size_t const src_off,
+                                      uint8_t* const dst,
+                                      size_t const dst_off,
+                                      size_t const len,
+                                      uint8_t const from,
+                                      uint8_t const to) {
+  uint8_t const* const in = (uint8_t const*)&(src[src_off]);
+  uint8_t* const out = &(dst[dst_off]);
+  __m512i const froms = _mm512_set1_epi8(from);
+  __m512i const tos = _mm512_set1_epi8(to);
+  size_t i = 0;
+  for (; i + 64 <= len; i += 64) {
+    __m512i const input = _mm512_loadu_si512((void const*)(in + i));
+    __mmask64 const matched = _mm512_cmpeq_epi8_mask(input, froms);
+    _mm512_storeu_si512((void*)(out + i), _mm512_mask_mov_epi8(input, matched, tos));
+  }
+  if (i < len) {
+    __mmask64 const mask = low_mask(len - i);
+    __m512i const input = _mm512_maskz_loadu_epi8(mask, in + i);
+    __mmask64 const matched = _mm512_cmpeq_epi8_mask(input, froms);
+    _mm512_mask_storeu_epi8(out + i, mask, _mm512_mask_mov_epi8(input, matched, tos));
+  }
+}
+#endif
+
+#if (DIABLO_HAS_NEON)
+// On AArch64, tbl and tbx look up 64 bytes at a time, giving 0 or leaving the
+// lane alone respectively for indices past the end, so we can cover the table
+// in four quarters. 32-bit ARM has to go row by row, relying on lookup16 to
+// give 0 for everything outside the row.
+static inline uint8x16_t translate_neon_vec (uint8x16_t const input,
+                                             uint8_t const* const table) {
+#if (__aarch64__)
+  uint8x16_t result = vqtbl4q_u8(vld1q_u8_x4(table), input);
+  result = vqtbx4q_u8(result, vld1q_u8_x4(table + 64), vsubq_u8(input, vdupq_n_u8(64)));
+  result = vqtbx4q_u8(result, vld1q_u8_x4(table + 128), vsubq_u8(input, vdupq_n_u8(128)));
+  return vqtbx4q_u8(result, vld1q_u8_x4(table + 192), vsubq_u8(input, vdupq_n_u8(192)));
+#else
+  uint8x16_t result = vdupq_n_u8(0);
+  for (int i = 0; i < 16; i++) {
+    uint8x16_t const indices = vsubq_u8(input, vdupq_n_u8((uint8_t)(i << 4)));
+    result = vorrq_u8(result, lookup16(vld1q_u8(table + (16 * i)), indices));
+  }
+  return result;
+#endif
+}
+
+static inline uint8x16_t translate_range_neon_vec (uint8x16_t const input,
+                                                   uint8x16_t const los,
+                                                   uint8x16_t const widths,
+                                                   uint8x16_t const deltas) {
+  uint8x16_t const in_range = vcleq_u8(vsubq_u8(input, los), widths);
+  return vaddq_u8(input, vandq_u8(deltas, in_range));
+}
+
+static inline uint8x16_t replace_eq_neon_vec (uint8x16_t const input,
+                                              uint8x16_t const froms,
+                                              uint8x16_t const tos) {
+  return vbslq_u8(vceqq_u8(input, froms), tos, input);
+}
+
+static inline void translate_neon (uint8_t const* const src,
+                                   size_t const src_off,
+                                   uint8_t* const dst,
+                                   size_t const dst_off,
+                                   size_t const len,
+                                   uint8_t const* const table) {
+  if (len < 16) {
+    translate_rest(src, src_off, dst, dst_off, len, table);
+    return;
+  }
+  uint8_t const* const in = (uint8_t const*)&(src[src_off]);
+  uint8_t* const out = &(dst[dst_off]);
+  uint8x16_t const last = translate_neon_vec(vld1q_u8(in + len - 16), table);
+  for (size_t i = 0; i + 16 <= len; i += 16) {
+    vst1q_u8(out + i, translate_neon_vec(vld1q_u8(in + i), table));
+  }
+  vst1q_u8(out + len - 16, last);
+}
+
+static inline void translate_range_neon (uint8_t const* const src,
+                                         size_t const src_off,
+                                         uint8_t* const dst,
+                                         size_t const dst_off,
+                                         size_t const len,
+                                         uint8_t const lo,
+                                         uint8_t const width,
+                                         uint8_t const delta) {
+  if (len < 16) {
+    translate_range_swar(src, src_off, dst, dst_off, len, lo, width, delta);
+    return;
+  }
+  uint8_t const* const in = (uint8_t const*)&(src[src_off]);
+  uint8_t* const out = &(dst[dst_off]);
+  uint8x16_t const los = vdupq_n_u8(lo);
+  uint8x16_t const widths = vdupq_n_u8(width);
+  uint8x16_t const deltas = vdupq_n_u8(delta);
+  uint8x16_t const last =
+    translate_range_neon_vec(vld1q_u8(in + len - 16), los, widths, deltas);
+  for (size_t i = 0; i + 16 <= len; i += 16) {
+    vst1q_u8(out + i,
+             translate_range_neon_vec(vld1q_u8(in + i), los, widths, deltas));
+  }
+  vst1q_u8(out + len - 16, last);
+}
+
+static inline void replace_eq_neon (uint8_t const* const src,
+                                    size_t const src_off,
+                                    uint8_t* const dst,
+                                    size_t const dst_off,
+                                    size_t const len,
+                                    uint8_t const from,
+                                    uint8_t const to) {
+  if (len < 16) {
+    replace_eq_swar(src, src_off, dst, dst_off, len, from, to);
+    return;
+  }
+  uint8_t const* const in = (uint8_t const*)&(src[src_off]);
+  uint8_t* const out = &(dst[dst_off]);
+  uint8x16_t const froms = vdupq_n_u8(from);
+  uint8x16_t const tos = vdupq_n_u8(to);
+  uint8x16_t const last = replace_eq_neon_vec(vld1q_u8(in + len - 16), froms, tos);
+  for (size_t i = 0; i + 16 <= len; i += 16) {
+    vst1q_u8(out + i, replace_eq_neon_vec(vld1q_u8(in + i), froms, tos));
+  }
+  vst1q_u8(out + len - 16, last);
+}
+#endif
+
+typedef void (*translate_kernel) (uint8_t const* const,
+                                  size_t const,
+                                  uint8_t* const,
+                                  size_t const,
+                                  size_t const,
+                                  uint8_t const* const);
+
+static translate_kernel const translate_kernels[DIABLO_BACKEND_COUNT] = {
+  [DIABLO_BACKEND_SWAR] = translate_rest,
+#if (DIABLO_HAS_SSE2)
+  [DIABLO_BACKEND_SSE2] = translate_rest,
+#endif
+#if (DIABLO_HAS_SSSE3)
+  [DIABLO_BACKEND_SSSE3] = translate_rest,
+#endif
+#if (DIABLO_HAS_AVX2)
+  [DIABLO_BACKEND_AVX2] = translate_avx,
+#endif
+#if (DIABLO_HAS_NEON)
+  [DIABLO_BACKEND_NEON] = translate_neon,
+#endif
+#if (DIABLO_HAS_AVX512BW)
+  [DIABLO_BACKEND_AVX512BW] = translate_avx512,
+#endif
+};
+
+typedef void (*translate_range_kernel) (uint8_t const* const,
+                                        size_t const,
+                                        uint8_t* const,
+                                        size_t const,
+                                        size_t const,
+                                        uint8_t const,
+                                        uint8_t const,
+                                        uint8_t const);
+
+static translate_range_kernel const translate_range_kernels[DIABLO_BACKEND_COUNT] = {
+  [DIABLO_BACKEND_SWAR] = translate_range_swar,
+#if (DIABLO_HAS_SSE2)
+  [DIABLO_BACKEND_SSE2] = translate_range_sse,
+#endif
+#if (DIABLO_HAS_SSSE3)
+  [DIABLO_BACKEND_SSSE3] = translate_range_sse,
+#endif
+#if (DIABLO_HAS_AVX2)
+  [DIABLO_BACKEND_AVX2] = translate_range_avx,
+#endif
+#if (DIABLO_HAS_NEON)
+  [DIABLO_BACKEND_NEON] = translate_range_neon,
+#endif
+#if (DIABLO_HAS_AVX512BW)
+  [DIABLO_BACKEND_AVX512BW] = translate_range_avx512,
+#endif
+};
+
+typedef void (*replace_eq_kernel) (uint8_t const* const,
+                                   size_t const,
+                                   uint8_t* const,
+                                   size_t const,
+                                   size_t const,
+                                   uint8_t const,
+                                   uint8_t const);
+
+static replace_eq_kernel const replace_eq_kernels[DIABLO_BACKEND_COUNT] = {
+  [DIABLO_BACKEND_SWAR] = replace_eq_swar,
+#if (DIABLO_HAS_SSE2)
+  [DIABLO_BACKEND_SSE2] = replace_eq_sse,
+#endif
+#if (DIABLO_HAS_SSSE3)
+  [DIABLO_BACKEND_SSSE3] = replace_eq_sse,
+#endif
+#if (DIABLO_HAS_AVX2)
+  [DIABLO_BACKEND_AVX2] = replace_eq_avx,
+#endif
+#if (DIABLO_HAS_NEON)
+  [DIABLO_BACKEND_NEON] = replace_eq_neon,
+#endif
+#if (DIABLO_HAS_AVX512BW)
+  [DIABLO_BACKEND_AVX512BW] = replace_eq_avx512,
+#endif
+};
+
+void diablo_translate (uint8_t const* const src,
+                       size_t const src_off,
+                       uint8_t* const dst,
+                       size_t const dst_off,
+                       size_t const len,
+                       uint8_t const* const table) {
+  STATS_RECORD(STATS_TRANSLATE, len);
+  translate_kernels[active_backend()](src, src_off, dst, dst_off, len, table);
+}
+
+void diablo_translate_range (uint8_t const* const src,
+                             size_t const src_off,
+                             uint8_t* const dst,
+                             size_t const dst_off,
+                             size_t const len,
+                             uint8_t const lo,
+                             uint8_t const hi,
+                             uint8_t const delta) {
+  STATS_RECORD(STATS_TRANSLATE_RANGE, len);
+  // An empty range changes nothing, which is the same as adding 0 to
+  // everything.
+  uint8_t const width = (lo <= hi) ? (uint8_t)(hi - lo) : 0xFF;
+  uint8_t const shift = (lo <= hi) ? delta : 0;
+  translate_range_kernels[active_backend()](src, src_off, dst, dst_off, len,
+                                            lo, width, shift);
+}
+
+void diablo_replace_eq (uint8_t const* const src,
+                        size_t const src_off,
+                        uint8_t* const dst,
+                        size_t const dst_off,
+                        size_t const len,
+                        uint8_t const from,
+                        uint8_t const to) {
+  STATS_RECORD(STATS_REPLACE_EQ, len);
+  replace_eq_kernels[active_backend()](src, src_off, dst, dst_off, len, from, to);
+}
+
+#include <stddef.h>
+
+// A byte is ASCII exactly when its high bit is clear, so a block of bytes is
+// all ASCII exactly when the OR of all of them is. Every kernel ORs together
+// 64 bytes at a time, and stops at the first block with a high bit set to work
+// out where it is. As in find-eq.c, inputs at least a vector (or word) long
+// finish with one that overlaps what we've already seen, and kernels return
+// len if every byte is ASCII.
+
+static inline size_t find_first_non_ascii_rest (uint8_t const* const ptr,
+                                                size_t const len) {
+  for (size_t i = 0; i < len; i++) {
+    if (ptr[i] >= 0x80) {
+      return i;
+    }
+  }
+  return len;
+}
+
+// SWAR implementation, used as the fallback everywhere.
+//
+// We mask with 0x80 in every byte, as count_eq_swar does once it has flagged
+// its matches; here, the input's own high bits are the flags.
+static inline size_t find_first_non_ascii_swar (uint8_t const* const src,
+                                                size_t const off,
+                                                size_t const len) {
+  uint8_t const* const ptr = (uint8_t const*)&(src[off]);
+  uint64_t const high_bits = broadcast(0x80);
+  size_t i = 0;
+  for (; i + 64 <= len; i += 64) {
+    uint64_t const* const big_ptr = (uint64_t const*)(ptr + i);
+    uint64_t const any = big_ptr[0] | big_ptr[1] | big_ptr[2] | big_ptr[3] |
+                         big_ptr[4] | big_ptr[5] | big_ptr[6] | big_ptr[7];
+    if ((any & high_bits) != 0) {
+      break;
+    }
+  }
+  for (; i + 8 <= len; i += 8) {
+    uint64_t const flags = *((uint64_t const*)(ptr + i)) & high_bits;
+    if (flags != 0) {
+      return i + first_flagged(flags);
+    }
+  }
+  if (i < len) {
+    if (len < 8) {
+      return find_first_non_ascii_rest(ptr, len);
+    }
+    uint64_t const flags = *((uint64_t const*)(ptr + len - 8)) & high_bits;
+    if (flags != 0) {
+      return len - 8 + first_flagged(flags);
+    }
+  }
+  return len;
+}
+
+#if (DIABLO_HAS_SSE2)
+#include <emmintrin.h>
+
+// movemask collects exactly the high bits, so there is nothing to compare.
+static inline bool any_high64_sse (uint8_t const* const ptr) {
+  __m128i const* big_ptr = (__m128i const*)ptr;
+  __m128i const any =
+    _mm_or_si128(_mm_or_si128(_mm_loadu_si128(big_ptr), _mm_loadu_si128(big_ptr + 1)),
+                 _mm_or_si128(_mm_loadu_si128(big_ptr + 2), _mm_loadu_si128(big_ptr + 3)));
+  return _mm_movemask_epi8(any) != 0;
+}
+
+static inline uint32_t high_mask16_sse (uint8_t const* const ptr) {
+  return (uint32_t)_mm_movemask_epi8(_mm_loadu_si128((__m128i const*)ptr));
+}
+
+static inline size_t find_first_non_ascii_sse (uint8_t const* const src,
+                                               size_t const off,
+                                               size_t const len) {
+  if (len < 16) {
+    return find_first_non_ascii_swar(src, off, len);
+  }
+  uint8_t const* const ptr = (uint8_t const*)&(src[off]);
+  size_t i = 0;
+  for (; i + 64 <= len; i += 64) {
+    if (any_high64_sse(ptr + i)) {
+      break;
+    }
+  }
+  for (; i + 16 <= len; i += 16) {
+    uint32_t const mask = high_mask16_sse(ptr + i);
+    if (mask != 0) {
+      return i + __builtin_ctz(mask);
+    }
+  }
+  if (i < len) {
+    uint32_t const mask = high_mask16_sse(ptr + len - 16);
+    if (mask != 0) {
+      return len - 16 + __builtin_ctz(mask);
+    }
+  }
+  return len;
+}
+#endif
+
+#if (DIABLO_HAS_AVX2)
+#include <immintrin.h>
+
+__attribute__((target("avx2")))
+static inline uint32_t high_mask32_avx (uint8_t const* const ptr) {
+  return (uint32_t)_mm256_movemask_epi8(_mm256_loadu_si256((__m256i const*)ptr));
+}
+
+__attribute__((target("avx2")))
+static inline bool any_high64_avx (uint8_t const* const ptr) {
+  __m256i const* big_ptr = (__m256i const*)ptr;
+  __m256i const any = _mm256_or_si256(_mm256_loadu_si256(big_ptr),
+                                      _mm256_loadu_si256(big_ptr + 1));
+  return _mm256_movemask_epi8(any) != 0;
+}
+
+__attribute__((target("avx2")))
+static inline size_t find_first_non_ascii_avx (uint8_t const* const src,
+                                               size_t const off,
+                                               size_t const len) {
+  if (len < 32) {
+    return find_first_non_ascii_sse(src, off, len);
+  }
+  uint8_t const* const ptr = (uint8_t const*)&(src[off]);
+  size_t i = 0;
+  for (; i + 64 <= len; i += 64) {
+    if (any_high64_avx(ptr + i)) {
+      break;
+    }
+  }
+  for (; i + 32 <= len; i += 32) {
+    uint32_t const mask = high_mask32_avx(ptr + i);
+    if (mask != 0) {
+      return i + __builtin_ctz(mask);
+    }
+  }
+  if (i < len) {
+    uint32_t const mask = high_mask32_avx(ptr + len - 32);
+    if (mask != 0) {
+      return len - 32 + __builtin_ctz(mask);
+    }
+  }
+  return len;
+}
+#endif
+
+#if (DIABLO_HAS_AVX512BW)
+// One 64-byte vector is a whole block, and its high bits are a mask already.
+// Masked loads cover the ragged end.
+__attribute__((target("avx512bw")))
+static inline size_t find_first_non_ascii_avx512 (uint8_t const* const src,
+                                                  size_t const off,
+                                                  size_t const len) {
+  uint8_t const* const ptr = (uint8_t const*)&(src[off]);
+  size_t i = 0;
+  for (; i + 64 <= len; i += 64) {
+    uint64_t const mask =
+      _mm512_movepi8_mask(_mm512_loadu_si512((void const*)(ptr + i)));
+    if (mask != 0) {
+      return i + __builtin_ctzll(mask);
+    }
+  }
+  if (i < len) {
+    uint64_t const mask =
+      _mm512_movepi8_mask(_mm512_maskz_loadu_epi8(low_mask(len - i), ptr + i));
+    if (mask != 0) {
+      return i + __builtin_ctzll(mask);
+    }
+  }
+  return len;
+}
+#endif
+
+#if (DIABLO_HAS_NEON)
+// Reinterpreted as signed, a byte with its high bit set is negative, so a
+// signed shift right by 7 makes it 0xFF, and everything else 0x00.
+static inline uint64_t high_mask16_neon (uint8_t const* const ptr) {
+  int8x16_t const input = vreinterpretq_s8_u8(vld1q_u8(ptr));
+  return nibble_mask(vreinterpretq_u8_s8(vshrq_n_s8(input, 7)));
+}
+
+static inline bool any_high64_neon (uint8_t const* const ptr) {
+  uint8x16_t const any = vorrq_u8(vorrq_u8(vld1q_u8(ptr), vld1q_u8(ptr + 16)),
+                                  vorrq_u8(vld1q_u8(ptr + 32), vld1q_u8(ptr + 48)));
+  return any_set(vandq_u8(any, vdupq_n_u8(0x80)));
+}
+
+static inline size_t find_first_non_ascii_neon (uint8_t const* const src,
+                                                size_t const off,
+                                                size_t const len) {
+  if (len < 16) {
+    return find_first_non_ascii_swar(src, off, len);
+  }
+  uint8_t const* const ptr = (uint8_t const*)&(src[off]);
+  size_t i = 0;
+  for (; i + 64 <= len; i += 64) {
+    if (any_high64_neon(ptr + i)) {
+      break;
+    }
+  }
+  for (; i + 16 <= len; i += 16) {
+    uint64_t const mask = high_mask16_neon(ptr + i);
+    if (mask != 0) {
+      return i + (__builtin_ctzll(mask) / 4);
+    }
+  }
+  if (i < len) {
+    uint64_t const mask = high_mask16_neon(ptr + len - 16);
+    if (mask != 0) {
+      return len - 16 + (__builtin_ctzll(mask) / 4);
+    }
+  }
+  return len;
+}
+#endif
+
+typedef size_t (*find_first_non_ascii_kernel) (uint8_t const* const,
+                                               size_t const,
+                                               size_t const);
+
+static find_first_non_ascii_kernel const find_first_non_ascii_kernels[DIABLO_BACKEND_COUNT] = {
+  [DIABLO_BACKEND_SWAR] = find_first_non_ascii_swar,
+#if (DIABLO_HAS_SSE2)
+  [DIABLO_BACKEND_SSE2] = find_first_non_ascii_sse,
+#endif
+#if (DIABLO_HAS_SSSE3)
+  [DIABLO_BACKEND_SSSE3] = find_first_non_ascii_sse,
+#endif
+#if (DIABLO_HAS_AVX2)
+  [DIABLO_BACKEND_AVX2] = find_first_non_ascii_avx,
+#endif
+#if (DIABLO_HAS_NEON)
+  [DIABLO_BACKEND_NEON] = find_first_non_ascii_neon,
+#endif
+#if (DIABLO_HAS_AVX512BW)
+  [DIABLO_BACKEND_AVX512BW] = find_first_non_ascii_avx512,
+#endif
+};
+
+size_t diablo_find_first_non_ascii (uint8_t const* const src,
+                                    size_t const off,
+                                    size_t const len) {
+  STATS_RECORD(STATS_FIND_FIRST_NON_ASCII, len);
+  return find_first_non_ascii_kernels[active_backend()](src, off, len);
+}
+
+// Finding the first non-ASCII byte costs nothing over checking for one, as the
+// kernels only look closer once they've found a block with one.
+bool diablo_is_ascii (uint8_t const* const src,
+                      size_t const off,
+                      size_t const len) {
+  STATS_RECORD(STATS_IS_ASCII, len);
+  return find_first_non_ascii_kernels[active_backend()](src, off, len) == len;
+}
+
+#include <stddef.h>
+
+// Encoding splits each byte into its high and low nibble, in that order, and
+// turns each nibble n into a digit: '0' + n, plus another 39 to reach 'a' if n
+// is 10 or more. No table is needed for that, so every kernel does it with
+// arithmetic.
+//
+// Decoding does the reverse. Once we know a character is a hex digit, its low
+// nibble is its value if it's '0' to '9' (0x30 to 0x39), and 9 less than its
+// value if it's a letter (0x41 to 0x46 or 0x61 to 0x66), so we add 9 to the
+// letters, which are the digits with bit 6 set. A block with an invalid
+// character in it gets decoded again by decode_base16_rest, which finds it;
+// the kernels return its position, or len if there isn't one. As an odd
+// character at the end can't make a byte, it's invalid too.
+
+static inline void encode_base16_rest (uint8_t const* const in,
+                                       size_t const len,
+                                       uint8_t* const out) {
+  static char const digits[] = "0123456789abcdef";
+  for (size_t i = 0; i < len; i++) {
+    out[2 * i] = (uint8_t)digits[in[i] >> 4];
+    out[(2 * i) + 1] = (uint8_t)digits[in[i] & 0x0F];
+  }
+}
+
+static inline uint8_t base16_value (uint8_t const c) {
+  if (c >= '0' && c <= '9') {
+    return c - '0';
+  }
+  uint8_t const lower = c | 0x20;
+  if (lower >= 'a' && lower <= 'f') {
+    return lower - 'a' + 10;
+  }
+  return 0xFF;
+}
+
+static inline size_t decode_base16_rest (uint8_t const* const in,
+                                         size_t const len,
+                                         uint8_t* const out) {
+  size_t i = 0;
+  for (; i + 2 <= len; i += 2) {
+    uint8_t const high = base16_value(in[i]);
+    if (high == 0xFF) {
+      return i;
+    }
+    uint8_t const low = base16_value(in[i + 1]);
+    if (low == 0xFF) {
+      return i + 1;
+    }
+    out[i / 2] = (uint8_t)((high << 4) | low);
+  }
+  return (i < len) ? i : len;
+}
+
+// SWAR implementation, used as the fallback everywhere.
+//
+// Encoding spreads four bytes out to one per 16-bit lane, then splits each
+// into nibbles, high nibble first in memory. Nothing in a word ever goes past
+// 0x85, so plain adds are safe.
+static inline uint64_t hex_digits_word (uint64_t const nibbles) {
+  uint64_t const letters = ((nibbles + broadcast(0x76)) & broadcast(0x80)) >> 7;
+  return nibbles + broadcast('0') + (letters * 39);
+}
+
+static inline void encode_base16_swar (uint8_t const* const src,
+                                       size_t const off,
+                                       size_t const len,
+                                       uint8_t* const dst,
+                                       size_t const dst_off) {
+  uint8_t const* const in = (uint8_t const*)&(src[off]);
+  uint8_t* const out = &(dst[dst_off]);
+  size_t i = 0;
+  for (; i + 4 <= len; i += 4) {
+    uint64_t spread = *((uint32_t const*)(in + i));
+    spread = (spread | (spread << 16)) & 0x0000FFFF0000FFFFULL;
+    spread = (spread | (spread << 8)) & 0x00FF00FF00FF00FFULL;
+#if (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+    uint64_t const nibbles = ((spread << 4) & 0x0F000F000F000F00ULL) |
+                             (spread & 0x000F000F000F000FULL);
+#else
+    uint64_t const nibbles = ((spread >> 4) & 0x000F000F000F000FULL) |
+                             ((spread & 0x000F000F000F000FULL) << 8);
+#endif
+    *((uint64_t*)(out + (2 * i))) = hex_digits_word(nibbles);
+  }
+  encode_base16_rest(in + i, len - i, out + (2 * i));
+}
+
+// Every byte of x, which must all be ASCII, which is in [lo, hi] gets its high
+// bit set; every other byte gets it cleared. Source: "Hacker's Delight",
+// section 6-1.
+static inline uint64_t between_ascii (uint64_t const x,
+                                      uint8_t const lo,
+                                      uint8_t const hi) {
+  return (x + broadcast(0x80 - lo)) & ~(x + broadcast(0x7F - hi)) & broadcast(0x80);
+}
+
+// Eight digits make four bytes: we decode them to one value per byte, then
+// merge each pair into the low byte of its 16-bit lane, and squeeze the lanes
+// together.
+static inline size_t decode_base16_swar (uint8_t const* const src,
+                                         size_t const off,
+                                         size_t const len,
+                                         uint8_t* const dst,
+                                         size_t const dst_off) {
+  uint8_t const* const in = (uint8_t const*)&(src[off]);
+  uint8_t* const out = &(dst[dst_off]);
+  uint64_t const high_bits = broadcast(0x80);
+  size_t i = 0;
+  for (; i + 8 <= len; i += 8) {
+    uint64_t const word = *((uint64_t const*)(in + i));
+    uint64_t const valid = between_ascii(word & ~high_bits, '0', '9') |
+                           between_ascii((word & ~high_bits) | broadcast(0x20), 'a', 'f');
+    if (((valid & ~word) & high_bits) != high_bits) {
+      size_t const pos = decode_base16_rest(in + i, 8, out + (i / 2));
+      return i + pos;
+    }
+    uint64_t const values = (word & broadcast(0x0F)) + (((word >> 6) & broadcast(0x01)) * 9);
+#if (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+    uint64_t merged = (values | (values >> 4)) & 0x00FF00FF00FF00FFULL;
+#else
+    uint64_t merged = ((values << 4) | (values >> 8)) & 0x00FF00FF00FF00FFULL;
+#endif
+    merged = (merged | (merged >> 8)) & 0x0000FFFF0000FFFFULL;
+    merged = (merged | (merged >> 16)) & 0x00000000FFFFFFFFULL;
+    *((uint32_t*)(out + (i / 2))) = (uint32_t)merged;
+  }
+  size_t const pos = decode_base16_rest(in + i, len - i, out + (i / 2));
+  return i + pos;
+}
+
+#if (DIABLO_HAS_SSE2)
+#include <emmintrin.h>
+
+static inline __m128i hex_digits_sse (__m128i const nibbles) {
+  __m128i const letters = _mm_and_si128(_mm_cmpgt_epi8(nibbles, _mm_set1_epi8(9)),
+                                        _mm_set1_epi8(39));
+  return _mm_add_epi8(_mm_add_epi8(nibbles, _mm_set1_epi8('0')), letters);
+}
+
+static inline void encode_base16_sse (uint8_t const* const src,
+                                      size_t const off,
+                                      size_t const len,
+                                      uint8_t* const dst,
+                                      size_t const dst_off) {
+  uint8_t const* const in = (uint8_t const*)&(src[off]);
+  uint8_t* const out = &(dst[dst_off]);
+  __m128i const low_nibbles = _mm_set1_epi8(0x0F);
+  size_t i = 0;
+  for (; i + 16 <= len; i += 16) {
+    __m128i const input = _mm_loadu_si128((__m128i const*)(in + i));
+    __m128i const highs = _mm_and_si128(_mm_srli_epi16(input, 4), low_nibbles);
+    __m128i const lows = _mm_and_si128(input, low_nibbles);
+    _mm_storeu_si128((__m128i*)(out + (2 * i)),
+                     hex_digits_sse(_mm_unpacklo_epi8(highs, lows)));
+    _mm_storeu_si128((__m128i*)(out + (2 * i) + 16),
+                     hex_digits_sse(_mm_unpackhi_epi8(highs, lows)));
+  }
+  encode_base16_swar(in, i, len - i, out, 2 * i);
+}
+
+// Signed comparisons are fine for the ranges, as anything past 0x7F is
+// negative, and so below all of them.
+static inline __m128i hex_valid_sse (__m128i const input) {
+  __m128i const digits = _mm_and_si128(_mm_cmpgt_epi8(input, _mm_set1_epi8('0' - 1)),
+                                       _mm_cmpgt_epi8(_mm_set1_epi8('9' + 1), input));
+  __m128i const lower = _mm_or_si128(input, _mm_set1_epi8(0x20));
+  __m128i const letters = _mm_and_si128(_mm_cmpgt_epi8(lower, _mm_set1_epi8('a' - 1)),
+                                        _mm_cmpgt_epi8(_mm_set1_epi8('f' + 1), lower));
+  return _mm_or_si128(digits, letters);
+}
+
+// Each 16-bit lane holds a pair of values, high nibble in its low byte.
+static inline __m128i hex_pairs_sse (__m128i const input) {
+  __m128i const values = _mm_add_epi8(_mm_and_si128(input, _mm_set1_epi8(0x0F)),
+                                      _mm_and_si128(_mm_cmpgt_epi8(input, _mm_set1_epi8(0x40)),
+                                                    _mm_set1_epi8(9)));
+  return _mm_and_si128(_mm_or_si128(_mm_slli_epi16(values, 4), _mm_srli_epi16(values, 8)),
+                       _mm_set1_epi16(0x00FF));
+}
+
+static inline size_t decode_base16_sse (uint8_t const* const src,
+                                        size_t const off,
+                                        size_t const len,
+                                        uint8_t* const dst,
+                                        size_t const dst_off) {
+  uint8_t const* const in = (uint8_t const*)&(src[off]);
+  uint8_t* const out = &(dst[dst_off]);
+  size_t i = 0;
+  for (; i + 32 <= len; i += 32) {
+    __m128i const first = _mm_loadu_si128((__m128i const*)(in + i));
+    __m128i const second = _mm_loadu_si128((__m128i const*)(in + i + 16));
+    __m128i const valid = _mm_and_si128(hex_valid_sse(first), hex_valid_sse(second));
+    if (_mm_movemask_epi8(valid) != 0xFFFF) {
+      size_t const pos = decode_base16_rest(in + i, 32, out + (i / 2));
+      return i + pos;
+    }
+    _mm_storeu_si128((__m128i*)(out + (i / 2)),
+                     _mm_packus_epi16(hex_pairs_sse(first), hex_pairs_sse(second)));
+  }
+  size_t const pos = decode_base16_swar(in, i, len - i, out, i / 2);
+  return i + pos;
+}
+#endif
+
+#if (DIABLO_HAS_AVX2)
+#include <immintrin.h>
+
+__attribute__((target("avx2")))
+static inline __m256i hex_digits_avx (__m256i const nibbles) {
+  __m256i const letters = _mm256_and_si256(_mm256_cmpgt_epi8(nibbles, _mm256_set1_epi8(9)),
+                                           _mm256_set1_epi8(39));
+  return _mm256_add_epi8(_mm256_add_epi8(nibbles, _mm256_set1_epi8('0')), letters);
+}
+
+// The unpacks work within 128-bit halves, so the halves of their results need
+// swapping round before we store them.
+__attribute__((target("avx2")))
+static inline void encode_base16_avx (uint8_t const* const src,
+                                      size_t const off,
+                                      size_t const len,
+                                      uint8_t* const dst,
+                                      size_t const dst_off) {
+  uint8_t const* const in = (uint8_t const*)&(src[off]);
+  uint8_t* const out = &(dst[dst_off]);
+  __m256i const low_nibbles = _mm256_set1_epi8(0x0F);
+  size_t i = 0;
+  for (; i + 32 <= len; i += 32) {
+    __m256i const input = _mm256_loadu_si256((__m256i const*)(in + i));
+    __m256i const highs = _mm256_and_si256(_mm256_srli_epi16(input, 4), low_nibbles);
+    __m256i const lows = _mm256_and_si256(input, low_nibbles);
+    __m256i const first = hex_digits_avx(_mm256_unpacklo_epi8(highs, lows));
+    __m256i const second = hex_digits_avx(_mm256_unpackhi_epi8(highs, lows));
+    _mm256_storeu_si256((__m256i*)(out + (2 * i)),
+                        _mm256_permute2x128_si256(first, second, 0x20));
+    _mm256_storeu_si256((__m256i*)(out + (2 * i) + 32),
+                        _mm256_permute2x128_si256(first, second, 0x31));
+  }
+  encode_base16_sse(in, i, len - i, out, 2 * i);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i hex_valid_avx (__m256i const input) {
+  __m256i const digits = _mm256_and_si256(_mm256_cmpgt_epi8(input, _mm256_set1_epi8('0' - 1)),
+                                          _mm256_cmpgt_epi8(_mm256_set1_epi8('9' + 1), input));
+  __m256i const lower = _mm256_or_si256(input, _mm256_set1_epi8(0x20));
+  __m256i const letters = _mm256_and_si256(_mm256_cmpgt_epi8(lower, _mm256_set1_epi8('a' - 1)),
+                                           _mm256_cmpgt_epi8(_mm256_set1_epi8('f' + 1), lower));
+  return _mm256_or_si256(digits, letters);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i hex_pairs_avx (__m256i const input) {
+  __m256i const values = _mm256_add_epi8(_mm256_and_si256(input, _mm256_set1_epi8(0x0F)),
+                                         _mm256_and_si256(_mm256_cmpgt_epi8(input, _mm256_set1_epi8(0x40)),
+                                                          _mm256_set1_epi8(9)));
+  return _mm256_and_si256(_mm256_or_si256(_mm256_slli_epi16(values, 4), _mm256_srli_epi16(values, 8)),
+                          _mm256_set1_epi16(0x00FF));
+}
+
+__attribute__((target("avx2")))
+static inline size_t decode_base16_avx (uint8_t const* const src,
+                                        size_t const off,
+                                        size_t const len,
+                                        uint8_t* const dst,
+                                        size_t const dst_off) {
+  uint8_t const* const in = (uint8_t const*)&(src[off]);
+  uint8_t* const out = &(dst[dst_off]);
+  size_t i = 0;
+  for (; i + 64 <= len; i += 64) {
+    __m256i const first = _mm256_loadu_si256((__m256i const*)(in + i));
+    __m256i const second = _mm256_loadu_si256((__m256i const*)(in + i + 32));
+    __m256i const valid = _mm256_and_si256(hex_valid_avx(first), hex_valid_avx(second));
+    if (((uint32_t)_mm256_movemask_epi8(valid)) != 0xFFFFFFFF) {
+      size_t const pos = decode_base16_rest(in + i, 64, out + (i / 2));
+      return i + pos;
+    }
+    __m256i const packed = _mm256_packus_epi16(hex_pairs_avx(first), hex_pairs_avx(second));
+    _mm256_storeu_si256((__m256i*)(out + (i / 2)),
+                        _mm256_permute4x64_epi64(packed, 0xD8));
+  }
+  size_t const pos = decode_base16_sse(in, i, len - i, out, i / 2);
+  return i + pos;
+}
+#endif
+
+#if (DIABLO_HAS_NEON)
+// NEON can look the digits up directly, and its structured loads and stores
+// separate and interleave high and low nibbles for us.
+static inline void encode_base16_neon (uint8_t const* const src,
+                                       size_t const off,
+                                       size_t const len,
+                                       uint8_t* const dst,
+                                       size_t const dst_off) {
+  uint8_t const* const in = (uint8_t const*)&(src[off]);
+  uint8_t* const out = &(dst[dst_off]);
+  uint8x16_t const digits = vld1q_u8((uint8_t const*)"0123456789abcdef");
+  size_t i = 0;
+  for (; i + 16 <= len; i += 16) {
+    uint8x16_t const input = vld1q_u8(in + i);
+    uint8x16x2_t const encoded = {{ lookup16(digits, vshrq_n_u8(input, 4)),
+                                    lookup16(digits, vandq_u8(input, vdupq_n_u8(0x0F))) }};
+    vst2q_u8(out + (2 * i), encoded);
+  }
+  encode_base16_swar(in, i, len - i, out, 2 * i);
+}
+
+static inline uint8x16_t hex_valid_neon (uint8x16_t const input) {
+  uint8x16_t const digits = vandq_u8(vcgeq_u8(input, vdupq_n_u8('0')),
+                                     vcleq_u8(input, vdupq_n_u8('9')));
+  uint8x16_t const lower = vorrq_u8(input, vdupq_n_u8(0x20));
+  uint8x16_t const letters = vandq_u8(vcgeq_u8(lower, vdupq_n_u8('a')),
+                                      vcleq_u8(lower, vdupq_n_u8('f')));
+  return vorrq_u8(digits, letters);
+}
+
+static inline uint8x16_t hex_values_neon (uint8x16_t const input) {
+  return vaddq_u8(vandq_u8(input, vdupq_n_u8(0x0F)),
+                  vandq_u8(vcgtq_u8(input, vdupq_n_u8(0x40)), vdupq_n_u8(9)));
+}
+
+static inline size_t decode_base16_neon (uint8_t const* const src,
+                                         size_t const off,
+                                         size_t const len,
+                                         uint8_t* const dst,
+                                         size_t const dst_off) {
+  uint8_t const* const in = (uint8_t const*)&(src[off]);
+  uint8_t* const out = &(dst[dst_off]);
+  size_t i = 0;
+  for (; i + 32 <= len; i += 32) {
+    uint8x16x2_t const input = vld2q_u8(in + i);
+    uint8x16_t const valid = vandq_u8(hex_valid_neon(input.val[0]),
+                                      hex_valid_neon(input.val[1]));
+    if (any_set(vmvnq_u8(valid))) {
+      size_t const pos = decode_base16_rest(in + i, 32, out + (i / 2));
+      return i + pos;
+    }
+    vst1q_u8(out + (i / 2), vorrq_u8(vshlq_n_u8(hex_values_neon(input.val[0]), 4),
+                                     hex_values_neon(input.val[1])));
+  }
+  size_t const pos = decode_base16_swar(in, i, len - i, out, i / 2);
+  return i + pos;
+}
+#endif
+
+typedef void (*encode_base16_kernel) (uint8_t const* const,
+                                      size_t const,
+                                      size_t const,
+                                      uint8_t* const,
+                                      size_t const);
+
+static encode_base16_kernel const encode_base16_kernels[DIABLO_BACKEND_COUNT] = {
+  [DIABLO_BACKEND_SWAR] = encode_base16_swar,
+#if (DIABLO_HAS_SSE2)
+  [DIABLO_BACKEND_SSE2] = encode_base16_sse,
+#endif
+#if (DIABLO_HAS_SSSE3)
+  [DIABLO_BACKEND_SSSE3] = encode_base16_sse,
+#endif
+#if (DIABLO_HAS_AVX2)
+  [DIABLO_BACKEND_AVX2] = encode_base16_avx,
+#endif
+#if (DIABLO_HAS_NEON)
+  [DIABLO_BACKEND_NEON] = encode_base16_neon,
+#endif
+#if (DIABLO_HAS_AVX512BW)
+  [DIABLO_BACKEND_AVX512BW] = encode_base16_avx,
+#endif
+};
+
+typedef size_t (*decode_base16_kernel) (uint8_t const* const,
+                                        size_t const,
+                                        size_t const,
+                                        uint8_t* const,
+                                        size_t const);
+
+static decode_base16_kernel const decode_base16_kernels[DIABLO_BACKEND_COUNT] = {
+  [DIABLO_BACKEND_SWAR] = decode_base16_swar,
+#if (DIABLO_HAS_SSE2)
+  [DIABLO_BACKEND_SSE2] = decode_base16_sse,
+#endif
+#if (DIABLO_HAS_SSSE3)
+  [DIABLO_BACKEND_SSSE3] = decode_base16_sse,
+#endif
+#if (DIABLO_HAS_AVX2)
+  [DIABLO_BACKEND_AVX2] = decode_base16_avx,
+#endif
+#if (DIABLO_HAS_NEON)
+  [DIABLO_BACKEND_NEON] = decode_base16_neon,
+#endif
+#if (DIABLO_HAS_AVX512BW)
+  [DIABLO_BACKEND_AVX512BW] = decode_base16_avx,
+#endif
+};
+
+void diablo_encode_base16 (uint8_t const* const src,
+                           size_t const off,
+                           size_t const len,
+                           uint8_t* const dst,
+                           size_t const dst_off) {
+  STATS_RECORD(STATS_ENCODE_BASE16, len);
+  encode_base16_kernels[active_backend()](src, off, len, dst, dst_off);
+}
+
+size_t diablo_decode_base16 (uint8_t const* const src,
+                             size_t const off,
+                             size_t const len,
+                             uint8_t* const dst,
+                             size_t const dst_off) {
+  STATS_RECORD(STATS_DECODE_BASE16, len);
+  return decode_base16_kernels[active_backend()](src, off, len, dst, dst_off);
+}
+
+#include <stddef.h>
+
+// Kernels only deal with whole groups: three bytes to four characters when
+// encoding, and the reverse when decoding. The partial group at the end, and
+// any padding, are handled in the top-level functions.
+//
+// The two alphabets differ only in the characters for 62 and 63, so the SIMD
+// kernels work out everything else arithmetically, and only look those two
+// up. Decoding kernels check a block at a time; a block with an invalid
+// character in it gets decoded again by decode_base64_rest, which finds it.
+
+static uint8_t const base64_chars[2][64] = {
+  { 'A', 'B', 'C', 'D', 'E', 'F', 'G', 'H', 'I', 'J', 'K', 'L', 'M', 'N', 'O', 'P',
+    'Q', 'R', 'S', 'T', 'U', 'V', 'W', 'X', 'Y', 'Z', 'a', 'b', 'c', 'd', 'e', 'f',
+    'g', 'h', 'i', 'j', 'k', 'l', 'm', 'n', 'o', 'p', 'q', 'r', 's', 't', 'u', 'v',
+    'w', 'x', 'y', 'z', '0', '1', '2', '3', '4', '5', '6', '7', '8', '9', '+', '/' },
+  { 'A', 'B', 'C', 'D', 'E', 'F', 'G', 'H', 'I', 'J', 'K', 'L', 'M', 'N', 'O', 'P',
+    'Q', 'R', 'S', 'T', 'U', 'V', 'W', 'X', 'Y', 'Z', 'a', 'b', 'c', 'd', 'e', 'f',
+    'g', 'h', 'i', 'j', 'k', 'l', 'm', 'n', 'o', 'p', 'q', 'r', 's', 't', 'u', 'v',
+    'w', 'x', 'y', 'z', '0', '1', '2', '3', '4', '5', '6', '7', '8', '9', '-', '_' },
+};
+
+// The value of each character, or 0xFF if it isn't in the alphabet.
+static uint8_t const base64_values[2][256] = {
+  // Standard
+  {
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x3E, 0xFF, 0xFF, 0xFF, 0x3F,
+    0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3A, 0x3B, 0x3C, 0x3D, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0A, 0x0B, 0x0C, 0x0D, 0x0E,
+    0x0F, 0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17, 0x18, 0x19, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0x1A, 0x1B, 0x1C, 0x1D, 0x1E, 0x1F, 0x20, 0x21, 0x22, 0x23, 0x24, 0x25, 0x26, 0x27, 0x28,
+    0x29, 0x2A, 0x2B, 0x2C, 0x2D, 0x2E, 0x2F, 0x30, 0x31, 0x32, 0x33, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+  },
+  // URL-safe
+  {
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x3E, 0xFF, 0xFF,
+    0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3A, 0x3B, 0x3C, 0x3D, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0A, 0x0B, 0x0C, 0x0D, 0x0E,
+    0x0F, 0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17, 0x18, 0x19, 0xFF, 0xFF, 0xFF, 0xFF, 0x3F,
+    0xFF, 0x1A, 0x1B, 0x1C, 0x1D, 0x1E, 0x1F, 0x20, 0x21, 0x22, 0x23, 0x24, 0x25, 0x26, 0x27, 0x28,
+    0x29, 0x2A, 0x2B, 0x2C, 0x2D, 0x2E, 0x2F, 0x30, 0x31, 0x32, 0x33, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+  },
+};
+
+// Scalar
+//
+// Spreading bits out to 6-bit indices and mapping them to characters in a
+// word costs more than looking eight characters up, so this is also the SWAR
+// and SSE2 kernel. Everything faster needs a byte shuffle.
+
+static inline void encode_base64_rest (uint8_t const* const src,
+                                       size_t const off,
+                                       size_t const len,
+                                       uint8_t* const dst,
+                                       size_t const dst_off,
+                                       diablo_base64_alphabet const alphabet) {
+  uint8_t const* const in = (uint8_t const*)&(src[off]);
+  uint8_t* const out = &(dst[dst_off]);
+  uint8_t const* const chars = base64_chars[alphabet];
+  for (size_t i = 0, o = 0; i + 3 <= len; i += 3, o += 4) {
+    uint32_t const group = ((uint32_t)in[i] << 16) | ((uint32_t)in[i + 1] << 8) | in[i + 2];
+    out[o] = chars[group >> 18];
+    out[o + 1] = chars[(group >> 12) & 0x3F];
+    out[o + 2] = chars[(group >> 6) & 0x3F];
+    out[o + 3] = chars[group & 0x3F];
+  }
+}
+
+static inline size_t decode_base64_rest (uint8_t const* const src,
+                                         size_t const off,
+                                         size_t const len,
+                                         uint8_t* const dst,
+                                         size_t const dst_off,
+                                         diablo_base64_alphabet const alphabet) {
+  uint8_t const* const in = (uint8_t const*)&(src[off]);
+  uint8_t* const out = &(dst[dst_off]);
+  uint8_t const* const values = base64_values[alphabet];
+  for (size_t i = 0, o = 0; i + 4 <= len; i += 4, o += 3) {
+    uint32_t const a = values[in[i]];
+    uint32_t const b = values[in[i + 1]];
+    uint32_t const c = values[in[i + 2]];
+    uint32_t const d = values[in[i + 3]];
+    if (((a | b | c | d) & 0x80) != 0) {
+      return i + ((a & 0x80) ? 0 : (b & 0x80) ? 1 : (c & 0x80) ? 2 : 3);
+    }
+    uint32_t const group = (a << 18) | (b << 12) | (c << 6) | d;
+    out[o] = (uint8_t)(group >> 16);
+    out[o + 1] = (uint8_t)(group >> 8);
+    out[o + 2] = (uint8_t)group;
+  }
+  return len;
+}
+
+#if (DIABLO_HAS_SSSE3)
+#include <tmmintrin.h>
+
+// Source: Wojciech Muła, "Base64 encoding with SIMD instructions", the
+// multiply-based unpacking and the single-shuffle lookup.
+//
+// The shuffle puts bytes 1, 0, 2 and 1 of each group into each 32-bit lane, so
+// that the four 6-bit fields can be moved into place with two multiplies. Then
+// each index gets reduced to which of the ranges A-Z, a-z, 0-9, 62 or 63 it's
+// in, and we look up what to add to get there.
+__attribute__((target("ssse3")))
+static inline __m128i base64_indices_ssse3 (__m128i const input) {
+  __m128i const spread = _mm_shuffle_epi8(input, _mm_setr_epi8(1, 0, 2, 1, 4, 3, 5, 4,
+                                                               7, 6, 8, 7, 10, 9, 11, 10));
+  __m128i const ac = _mm_mulhi_epu16(_mm_and_si128(spread, _mm_set1_epi32(0x0FC0FC00)),
+                                     _mm_set1_epi32(0x04000040));
+  __m128i const bd = _mm_mullo_epi16(_mm_and_si128(spread, _mm_set1_epi32(0x003F03F0)),
+                                     _mm_set1_epi32(0x01000010));
+  return _mm_or_si128(ac, bd);
+}
+
+__attribute__((target("ssse3")))
+static inline __m128i base64_chars_ssse3 (__m128i const indices,
+                                          __m128i const shifts) {
+  __m128i const reduced = _mm_or_si128(_mm_subs_epu8(indices, _mm_set1_epi8(51)),
+                                       _mm_and_si128(_mm_cmpgt_epi8(_mm_set1_epi8(26), indices),
+                                                     _mm_set1_epi8(13)));
+  return _mm_add_epi8(indices, _mm_shuffle_epi8(shifts, reduced));
+}
+
+__attribute__((target("ssse3")))
+static inline __m128i base64_shifts_ssse3 (diablo_base64_alphabet const alphabet) {
+  uint8_t const* const chars = base64_chars[alphabet];
+  return _mm_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                       '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                       (char)(chars[62] - 62), (char)(chars[63] - 63), 'A', 0, 0);
+}
+
+__attribute__((target("ssse3")))
+static inline void encode_base64_ssse3 (uint8_t const* const src,
+                                        size_t const off,
+                                        size_t const len,
+                                        uint8_t* const dst,
+                                        size_t const dst_off,
+                                        diablo_base64_alphabet const alphabet) {
+  uint8_t const* const in = (uint8_t const*)&(src[off]);
+  uint8_t* const out = &(dst[dst_off]);
+  __m128i const shifts = base64_shifts_ssse3(alphabet);
+  size_t i = 0;
+  size_t o = 0;
+  // Each load reads 16 bytes, but only uses 12.
+  for (; i + 16 <= len; i += 12, o += 16) {
+    __m128i const input = _mm_loadu_si128((__m128i const*)(in + i));
+    _mm_storeu_si128((__m128i*)(out + o),
+                     base64_chars_ssse3(base64_indices_ssse3(input), shifts));
+  }
+  encode_base64_rest(in, i, len - i, out, o, alphabet);
+}
+
+// Rather than a shuffle for each alphabet, we classify characters by
+// comparison, which the two alphabets can share, and add each class's offset
+// to get its value. Signed comparisons are fine, as anything past 0x7F is
+// below every range. Invalid characters belong to no class.
+__attribute__((target("ssse3")))
+static inline __m128i base64_values_ssse3 (__m128i const input,
+                                           __m128i const char62,
+                                           __m128i const char63,
+                                           __m128i* const valid) {
+  __m128i const upper = _mm_and_si128(_mm_cmpgt_epi8(input, _mm_set1_epi8('A' - 1)),
+                                      _mm_cmpgt_epi8(_mm_set1_epi8('Z' + 1), input));
+  __m128i const lower = _mm_and_si128(_mm_cmpgt_epi8(input, _mm_set1_epi8('a' - 1)),
+                                      _mm_cmpgt_epi8(_mm_set1_epi8('z' + 1), input));
+  __m128i const digit = _mm_and_si128(_mm_cmpgt_epi8(input, _mm_set1_epi8('0' - 1)),
+                                      _mm_cmpgt_epi8(_mm_set1_epi8('9' + 1), input));
+  __m128i const is62 = _mm_cmpeq_epi8(input, char62);
+  __m128i const is63 = _mm_cmpeq_epi8(input, char63);
+  *valid = _mm_or_si128(_mm_or_si128(_mm_or_si128(upper, lower), digit),
+                        _mm_or_si128(is62, is63));
+  __m128i const offsets =
+    _mm_or_si128(_mm_or_si128(_mm_and_si128(upper, _mm_set1_epi8(-'A')),
+                              _mm_and_si128(lower, _mm_set1_epi8(26 - 'a'))),
+                 _mm_or_si128(_mm_and_si128(digit, _mm_set1_epi8(52 - '0')),
+                              _mm_or_si128(_mm_and_si128(is62, _mm_sub_epi8(_mm_set1_epi8(62), char62)),
+                                           _mm_and_si128(is63, _mm_sub_epi8(_mm_set1_epi8(63), char63)))));
+  return _mm_add_epi8(input, offsets);
+}
+
+// Packing the values back together is the reverse of base64_indices_ssse3:
+// two multiply-adds put each group's 24 bits into its 32-bit lane, and a
+// shuffle gathers their bytes, most significant first.
+__attribute__((target("ssse3")))
+static inline __m128i base64_pack_ssse3 (__m128i const values) {
+  __m128i const pairs = _mm_maddubs_epi16(values, _mm_set1_epi32(0x01400140));
+  __m128i const groups = _mm_madd_epi16(pairs, _mm_set1_epi32(0x00011000));
+  return _mm_shuffle_epi8(groups, _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8,
+                                                14, 13, 12, -1, -1, -1, -1));
+}
+
+__attribute__((target("ssse3")))
+static inline size_t decode_base64_ssse3 (uint8_t const* const src,
+                                          size_t const off,
+                                          size_t const len,
+                                          uint8_t* const dst,
+                                          size_t const dst_off,
+                                          diablo_base64_alphabet const alphabet) {
+  uint8_t const* const in = (uint8_t const*)&(src[off]);
+  uint8_t* const out = &(dst[dst_off]);
+  __m128i const char62 = _mm_set1_epi8((char)base64_chars[alphabet][62]);
+  __m128i const char63 = _mm_set1_epi8((char)base64_chars[alphabet][63]);
+  size_t i = 0;
+  size_t o = 0;
+  for (; i + 16 <= len; i += 16, o += 12) {
+    __m128i valid;
+    __m128i const values = base64_values_ssse3(_mm_loadu_si128((__m128i const*)(in + i)),
+                                               char62, char63, &valid);
+    if (_mm_movemask_epi8(valid) != 0xFFFF) {
+      return i + decode_base64_rest(in, i, 16, out, o, alphabet);
+    }
+    __m128i const packed = base64_pack_ssse3(values);
+    _mm_storel_epi64((__m128i*)(out + o), packed);
+    *((uint32_t*)(out + o + 8)) = (uint32_t)_mm_cvtsi128_si32(_mm_srli_si128(packed, 8));
+  }
+  return i + decode_base64_rest(in, i, len - i, out, o, alphabet);
+}
+#endif
+
+#if (DIABLO_HAS_AVX2)
+#include <immintrin.h>
+
+// As the SSSE3 kernels, with a group of twelve bytes in each 128-bit half.
+__attribute__((target("avx2")))
+static inline __m256i base64_indices_avx (__m256i const input) {
+  __m256i const spread = _mm256_shuffle_epi8(input, _mm256_setr_epi8(1, 0, 2, 1, 4, 3, 5, 4,
+                                                                     7, 6, 8, 7, 10, 9, 11, 10,
+                                                                     1, 0, 2, 1, 4, 3, 5, 4,
+                                                                     7, 6, 8, 7, 10, 9, 11, 10));
+  __m256i const ac = _mm256_mulhi_epu16(_mm256_and_si256(spread, _mm256_set1_epi32(0x0FC0FC00)),
+                                        _mm256_set1_epi32(0x04000040));
+  __m256i const bd = _mm256_mullo_epi16(_mm256_and_si256(spread, _mm256_set1_epi32(0x003F03F0)),
+                                        _mm256_set1_epi32(0x01000010));
+  return _mm256_or_si256(ac, bd);
+}
+
+__attribute__((target("avx2")))
+static inline void encode_base64_avx (uint8_t const* const src,
+                                      size_t const off,
+                                      size_t const len,
+                                      uint8_t* const dst,
+                                      size_t const dst_off,
+                                      diablo_base64_alphabet const alphabet) {
+  uint8_t const* const in = (uint8_t const*)&(src[off]);
+  uint8_t* const out = &(dst[dst_off]);
+  __m256i const shifts = _mm256_broadcastsi128_si256(base64_shifts_ssse3(alphabet));
+  size_t i = 0;
+  size_t o = 0;
+  for (; i + 28 <= len; i += 24, o += 32) {
+    __m256i const input =
+      _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((__m128i const*)(in + i))),
+                              _mm_loadu_si128((__m128i const*)(in + i + 12)), 1);
+    __m256i const indices = base64_indices_avx(input);
+    __m256i const reduced =
+      _mm256_or_si256(_mm256_subs_epu8(indices, _mm256_set1_epi8(51)),
+                      _mm256_and_si256(_mm256_cmpgt_epi8(_mm256_set1_epi8(26), indices),
+                                       _mm256_set1_epi8(13)));
+    _mm256_storeu_si256((__m256i*)(out + o),
+                        _mm256_add_epi8(indices, _mm256_shuffle_epi8(shifts, reduced)));
+  }
+  encode_base64_ssse3(in, i, len - i, out, o, alphabet);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i base64_values_avx (__m256i const input,
+                                         __m256i const char62,
+                                         __m256i const char63,
+                                         __m256i* const valid) {
+  __m256i const upper = _mm256_and_si256(_mm256_cmpgt_epi8(input, _mm256_set1_epi8('A' - 1)),
+                                         _mm256_cmpgt_epi8(_mm256_set1_epi8('Z' + 1), input));
+  __m256i const lower = _mm256_and_si256(_mm256_cmpgt_epi8(input, _mm256_set1_epi8('a' - 1)),
+                                         _mm256_cmpgt_epi8(_mm256_set1_epi8('z' + 1), input));
+  __m256i const digit = _mm256_and_si256(_mm256_cmpgt_epi8(input, _mm256_set1_epi8('0' - 1)),
+                                         _mm256_cmpgt_epi8(_mm256_set1_epi8('9' + 1), input));
+  __m256i const is62 = _mm256_cmpeq_epi8(input, char62);
+  __m256i const is63 = _mm256_cmpeq_epi8(input, char63);
+  *valid = _mm256_or_si256(_mm256_or_si256(_mm256_or_si256(upper, lower), digit),
+                           _mm256_or_si256(is62, is63));
+  __m256i const offsets =
+    _mm256_or_si256(_mm256_or_si256(_mm256_and_si256(upper, _mm256_set1_epi8(-'A')),
+                                    _mm256_and_si256(lower, _mm256_set1_epi8(26 - 'a'))),
+                    _mm256_or_si256(_mm256_and_si256(digit, _mm256_set1_epi8(52 - '0')),
+                                    _mm256_or_si256(_mm256_and_si256(is62, _mm256_sub_epi8(_mm256_set1_epi8(62), char62)),
+                                                    _mm256_and_si256(is63, _mm256_sub_epi8(_mm256_set1_epi8(63), char63)))));
+  return _mm256_add_epi8(input, offsets);
+}
+
+// After packing, each half has twelve bytes at its start; a permute brings
+// them together.
+__attribute__((target("avx2")))
+static inline size_t decode_base64_avx (uint8_t const* const src,
+                                        size_t const off,
+                                        size_t const len,
+                                        uint8_t* const dst,
+                                        size_t const dst_off,
+                                        diablo_base64_alphabet const alphabet) {
+  uint8_t const* const in = (uint8_t const*)&(src[off]);
+  uint8_t* const out = &(dst[dst_off]);
+  __m256i const char62 = _mm256_set1_epi8((char)base64_chars[alphabet][62]);
+  __m256i const char63 = _mm256_set1_epi8((char)base64_chars[alphabet][63]);
+  __m256i const gather = _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 3, 7);
+  size_t i = 0;
+  size_t o = 0;
+  for (; i + 32 <= len; i += 32, o += 24) {
+    __m256i valid;
+    __m256i const values = base64_values_avx(_mm256_loadu_si256((__m256i const*)(in + i)),
+                                             char62, char63, &valid);
+    if (((uint32_t)_mm256_movemask_epi8(valid)) != 0xFFFFFFFF) {
+      return i + decode_base64_rest(in, i, 32, out, o, alphabet);
+    }
+    __m256i const pairs = _mm256_maddubs_epi16(values, _mm256_set1_epi32(0x01400140));
+    __m256i const groups = _mm256_madd_epi16(pairs, _mm256_set1_epi32(0x00011000));
+    __m256i const packed =
+      _mm256_permutevar8x32_epi32(_mm256_shuffle_epi8(groups,
+                                                      _mm256_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8,
+                                                                       14, 13, 12, -1, -1, -1, -1,
+                                                                       2, 1, 0, 6, 5, 4, 10, 9, 8,
+                                                                       14, 13, 12, -1, -1, -1, -1)),
+                                  gather);
+    _mm_storeu_si128((__m128i*)(out + o), _mm256_castsi256_si128(packed));
+    _mm_storel_epi64((__m128i*)(out + o + 16), _mm256_extracti128_si256(packed, 1));
+  }
+  return i + decode_base64_ssse3(in, i, len - i, out, o, alphabet);
+}
+#endif
+
+#if (DIABLO_HAS_NEON)
+// The structured loads and stores split groups into separate vectors of their
+// first, second and third bytes (or first to fourth characters), and put them
+// back together, so only shifts are needed in between. Characters come from
+// the same reduction and lookup as encode_base64_ssse3.
+static inline void encode_base64_neon (uint8_t const* const src,
+                                       size_t const off,
+                                       size_t const len,
+                                       uint8_t* const dst,
+                                       size_t const dst_off,
+                                       diablo_base64_alphabet const alphabet) {
+  uint8_t const* const in = (uint8_t const*)&(src[off]);
+  uint8_t* const out = &(dst[dst_off]);
+  uint8_t const shift_bytes[16] = {
+    'a' - 26, (uint8_t)('0' - 52), (uint8_t)('0' - 52), (uint8_t)('0' - 52),
+    (uint8_t)('0' - 52), (uint8_t)('0' - 52), (uint8_t)('0' - 52), (uint8_t)('0' - 52),
+    (uint8_t)('0' - 52), (uint8_t)('0' - 52), (uint8_t)('0' - 52),
+    (uint8_t)(base64_chars[alphabet][62] - 62), (uint8_t)(base64_chars[alphabet][63] - 63),
+    'A', 0, 0
+  };
+  uint8x16_t const shifts = vld1q_u8(shift_bytes);
+  uint8x16_t const six_bits = vdupq_n_u8(0x3F);
+  size_t i = 0;
+  size_t o = 0;
+  for (; i + 48 <= len; i += 48, o += 64) {
+    uint8x16x3_t const input = vld3q_u8(in + i);
+    uint8x16x4_t indices = {{
+      vshrq_n_u8(input.val[0], 2),
+      vandq_u8(vorrq_u8(vshlq_n_u8(input.val[0], 4), vshrq_n_u8(input.val[1], 4)), six_bits),
+      vandq_u8(vorrq_u8(vshlq_n_u8(input.val[1], 2), vshrq_n_u8(input.val[2], 6)), six_bits),
+      vandq_u8(input.val[2], six_bits)
+    }};
+    for (size_t k = 0; k < 4; k++) {
+      uint8x16_t const reduced =
+        vorrq_u8(vqsubq_u8(indices.val[k], vdupq_n_u8(51)),
+                 vandq_u8(vcltq_u8(indices.val[k], vdupq_n_u8(26)), vdupq_n_u8(13)));
+      indices.val[k] = vaddq_u8(indices.val[k], lookup16(shifts, reduced));
+    }
+    vst4q_u8(out + o, indices);
+  }
+  encode_base64_rest(in, i, len - i, out, o, alphabet);
+}
+
+static inline uint8x16_t base64_values_neon (uint8x16_t const input,
+                                             uint8x16_t const char62,
+                                             uint8x16_t const char63,
+                                             uint8x16_t* const valid) {
+  uint8x16_t const upper = vandq_u8(vcgeq_u8(input, vdupq_n_u8('A')),
+                                    vcleq_u8(input, vdupq_n_u8('Z')));
+  uint8x16_t const lower = vandq_u8(vcgeq_u8(input, vdupq_n_u8('a')),
+                                    vcleq_u8(input, vdupq_n_u8('z')));
+  uint8x16_t const digit = vandq_u8(vcgeq_u8(input, vdupq_n_u8('0')),
+                                    vcleq_u8(input, vdupq_n_u8('9')));
+  uint8x16_t const is62 = vceqq_u8(input, char62);
+  uint8x16_t const is63 = vceqq_u8(input, char63);
+  *valid = vandq_u8(*valid, vorrq_u8(vorrq_u8(vorrq_u8(upper, lower), digit),
+                                     vorrq_u8(is62, is63)));
+  uint8x16_t const offsets =
+    vorrq_u8(vorrq_u8(vandq_u8(upper, vdupq_n_u8((uint8_t)-'A')),
+                      vandq_u8(lower, vdupq_n_u8((uint8_t)(26 - 'a')))),
+             vorrq_u8(vandq_u8(digit, vdupq_n_u8((uint8_t)(52 - '0'))),
+                      vorrq_u8(vandq_u8(is62, vsubq_u8(vdupq_n_u8(62), char62)),
+                               vandq_u8(is63, vsubq_u8(vdupq_n_u8(63), char63)))));
+  return vaddq_u8(input, offsets);
+}
+
+static inline size_t decode_base64_neon (uint8_t const* const src,
+                                         size_t const off,
+                                         size_t const len,
+                                         uint8_t* const dst,
+                                         size_t const dst_off,
+                                         diablo_base64_alphabet const alphabet) {
+  uint8_t const* const in = (uint8_t const*)&(src[off]);
+  uint8_t* const out = &(dst[dst_off]);
+  uint8x16_t const char62 = vdupq_n_u8(base64_chars[alphabet][62]);
+  uint8x16_t const char63 = vdupq_n_u8(base64_chars[alphabet][63]);
+  size_t i = 0;
+  size_t o = 0;
+  for (; i + 64 <= len; i += 64, o += 48) {
+    uint8x16x4_t const input = vld4q_u8(in + i);
+    uint8x16_t valid = vdupq_n_u8(0xFF);
+    uint8x16_t const a = base64_values_neon(input.val[0], char62, char63, &valid);
+    uint8x16_t const b = base64_values_neon(input.val[1], char62, char63, &valid);
+    uint8x16_t const c = base64_values_neon(input.val[2], char62, char63, &valid);
+    uint8x16_t const d = base64_values_neon(input.val[3], char62, char63, &valid);
+    if (any_set(vmvnq_u8(valid))) {
+      return i + decode_base64_rest(in, i, 64, out, o, alphabet);
+    }
+    uint8x16x3_t const output = {{
+      vorrq_u8(vshlq_n_u8(a, 2), vshrq_n_u8(b, 4)),
+      vorrq_u8(vshlq_n_u8(b, 4), vshrq_n_u8(c, 2)),
+      vorrq_u8(vshlq_n_u8(c, 6), d)
+    }};
+    vst3q_u8(out + o, output);
+  }
+  return i + decode_base64_rest(in, i, len - i, out, o, alphabet);
+}
+#endif
+
+typedef void (*encode_base64_kernel) (uint8_t const* const,
+                                      size_t const,
+                                      size_t const,
+                                      uint8_t* const,
+                                      size_t const,
+                                      diablo_base64_alphabet const);
+
+static encode_base64_kernel const encode_base64_kernels[DIABLO_BACKEND_COUNT] = {
+  [DIABLO_BACKEND_SWAR] = encode_base64_rest,
+#if (DIABLO_HAS_SSE2)
+  [DIABLO_BACKEND_SSE2] = encode_base64_rest,
+#endif
+#if (DIABLO_HAS_SSSE3)
+  [DIABLO_BACKEND_SSSE3] = encode_base64_ssse3,
+#endif
+#if (DIABLO_HAS_AVX2)
+  [DIABLO_BACKEND_AVX2] = encode_base64_avx,
+#endif
+#if (DIABLO_HAS_NEON)
+  [DIABLO_BACKEND_NEON] = encode_base64_neon,
+#endif
+#if (DIABLO_HAS_AVX512BW)
+  [DIABLO_BACKEND_AVX512BW] = encode_base64_avx,
+#endif
+};
+
+typedef size_t (*decode_base64_kernel) (uint8_t const* const,
+                                        size_t const,
+                                        size_t const,
+                                        uint8_t* const,
+                                        size_t const,
+                                        diablo_base64_alphabet const);
+
+static decode_base64_kernel const decode_base64_kernels[DIABLO_BACKEND_COUNT] = {
+  [DIABLO_BACKEND_SWAR] = decode_base64_rest,
+#if (DIABLO_HAS_SSE2)
+  [DIABLO_BACKEND_SSE2] = decode_base64_rest,
+#endif
+#if (DIABLO_HAS_SSSE3)
+  [DIABLO_BACKEND_SSSE3] = decode_base64_ssse3,
+#endif
+#if (DIABLO_HAS_AVX2)
+  [DIABLO_BACKEND_AVX2] = decode_base64_avx,
+#endif
+#if (DIABLO_HAS_NEON)
+  [DIABLO_BACKEND_NEON] = decode_base64_neon,
+#endif
+#if (DIABLO_HAS_AVX512BW)
+  [DIABLO_BACKEND_AVX512BW] = decode_base64_avx,
+#endif
+};
+
+size_t diablo_base64_encoded_length (size_t const len,
+                                     bool const pad) {
+  size_t const groups = len / 3;
+  size_t const extra = len % 3;
+  if (extra == 0) {
+    return 4 * groups;
+  }
+  return (4 * groups) + (pad ? 4 : extra + 1);
+}
+
+size_t diablo_encode_base64 (uint8_t const* const src,
+                             size_t const off,
+                             size_t const len,
+                             uint8_t* const dst,
+                             size_t const dst_off,
+                             diablo_base64_alphabet const alphabet,
+                             bool const pad) {
+  STATS_RECORD(STATS_ENCODE_BASE64, len);
+  size_t const whole = len - (len % 3);
+  encode_base64_kernels[active_backend()](src, off, whole, dst, dst_off, alphabet);
+  uint8_t const* const in = (uint8_t const*)&(src[off + whole]);
+  uint8_t* out = &(dst[dst_off + ((whole / 3) * 4)]);
+  uint8_t const* const chars = base64_chars[alphabet];
+  if (len % 3 == 1) {
+    *out++ = chars[in[0] >> 2];
+    *out++ = chars[(in[0] & 0x03) << 4];
+    if (pad) {
+      *out++ = '=';
+      *out++ = '=';
+    }
+  } else if (len % 3 == 2) {
+    *out++ = chars[in[0] >> 2];
+    *out++ = chars[((in[0] & 0x03) << 4) | (in[1] >> 4)];
+    *out++ = chars[(in[1] & 0x0F) << 2];
+    if (pad) {
+      *out++ = '=';
+    }
+  }
+  return diablo_base64_encoded_length(len, pad);
+}
+
+// Padding is only padding if it makes the length a multiple of 4.
+static inline size_t unpadded_length (uint8_t const* const in,
+                                      size_t const len) {
+  if (len == 0 || len % 4 != 0 || in[len - 1] != '=') {
+    return len;
+  }
+  return (in[len - 2] == '=') ? len - 2 : len - 1;
+}
+
+size_t diablo_base64_decoded_length (uint8_t const* const src,
+                                     size_t const off,
+                                     size_t const len) {
+  size_t const body = unpadded_length((uint8_t const*)&(src[off]), len);
+  return ((body / 4) * 3) + ((body % 4 == 0) ? 0 : (body % 4) - 1);
+}
+
+// The characters of a partial group must make whole bytes, with nothing left
+// over: one character can't, and the bits past the last byte must be zero, so
+// that each input has only one encoding.
+size_t diablo_decode_base64 (uint8_t const* const src,
+                             size_t const off,
+                             size_t const len,
+                             uint8_t* const dst,
+                             size_t const dst_off,
+                             diablo_base64_alphabet const alphabet) {
+  STATS_RECORD(STATS_DECODE_BASE64, len);
+  uint8_t const* const in = (uint8_t const*)&(src[off]);
+  size_t const body = unpadded_length(in, len);
+  size_t const whole = body - (body % 4);
+  size_t const pos = decode_base64_kernels[active_backend()](src, off, whole,
+                                                             dst, dst_off, alphabet);
+  if (pos != whole) {
+    return pos;
+  }
+  uint8_t const* const values = base64_values[alphabet];
+  for (size_t i = whole; i < body; i++) {
+    if (values[in[i]] == 0xFF) {
+      return i;
+    }
+  }
+  uint8_t* const out = &(dst[dst_off + ((whole / 4) * 3)]);
+  switch (body - whole) {
+    case 1:
+      return whole;
+    case 2: {
+      uint8_t const a = values[in[whole]];
+      uint8_t const b = values[in[whole + 1]];
+      if ((b & 0x0F) != 0) {
+        return whole + 1;
+      }
+      out[0] = (uint8_t)((a << 2) | (b >> 4));
+      break;
+    }
+    case 3: {
+      uint8_t const a = values[in[whole]];
+      uint8_t const b = values[in[whole + 1]];
+      uint8_t const c = values[in[whole + 2]];
+      if ((c & 0x03) != 0) {
+        return whole + 2;
+      }
+      out[0] = (uint8_t)((a << 2) | (b >> 4));
+      out[1] = (uint8_t)((b << 4) | (c >> 2));
+      break;
+    }
+    default:
+      break;
+  }
+  return len;
+}
+
 #include <stddef.h>
+#include <string.h>
 
-/*** Start of inlined file: diablo.h ***/
-#pragma once
-#include <stdint.h>
-#include <stdlib.h>
+// Every kernel starts on a character boundary, with a fresh state, and returns
+// either the position of the first invalid byte, or len. Whatever sequence is
+// still incomplete at the end is left in the state.
 
-// Counting
+static inline bool is_continuation (uint8_t const byte) {
+  return (byte & 0xC0) == 0x80;
+}
 
-// Count the bytes in the range equal to the given one.
-size_t diablo_count_eq(uint8_t const* const src,
-                       size_t const off,
-                       size_t const len,
-                       uint8_t const byte);
+// A byte-at-a-time DFA, following table 3-7 of the Unicode Standard. This also
+// pins down the exact position of any error the SIMD kernels find.
+static inline size_t validate_utf8_rest (uint8_t const* const ptr,
+                                         size_t const start,
+                                         size_t const len,
+                                         diablo_utf8_state* const state) {
+  uint8_t remaining = state->remaining;
+  uint8_t lo = state->lo;
+  uint8_t hi = state->hi;
+  size_t i = start;
+  for (; i < len; i++) {
+    uint8_t const byte = ptr[i];
+    if (remaining != 0) {
+      if (byte < lo || byte > hi) {
+        break;
+      }
+      remaining--;
+      lo = 0x80;
+      hi = 0xBF;
+      continue;
+    }
+    lo = 0x80;
+    hi = 0xBF;
+    if (byte < 0x80) {
+      continue;
+    } else if (byte >= 0xC2 && byte <= 0xDF) {
+      remaining = 1;
+    } else if (byte == 0xE0) {
+      remaining = 2;
+      lo = 0xA0;
+    } else if (byte == 0xED) {
+      // Surrogates are not allowed.
+      remaining = 2;
+      hi = 0x9F;
+    } else if (byte >= 0xE1 && byte <= 0xEF) {
+      remaining = 2;
+    } else if (byte == 0xF0) {
+      remaining = 3;
+      lo = 0x90;
+    } else if (byte >= 0xF1 && byte <= 0xF3) {
+      remaining = 3;
+    } else if (byte == 0xF4) {
+      // Nothing past U+10FFFF.
+      remaining = 3;
+      hi = 0x8F;
+    } else {
+      break;
+    }
+  }
+  state->remaining = remaining;
+  state->lo = lo;
+  state->hi = hi;
+  return i;
+}
 
-/*** End of inlined file: diablo.h ***/
+// Restart the DFA at the last character boundary at or before pos, given that
+// everything before pos is valid, apart from possibly an incomplete sequence at
+// the end.
+static inline size_t validate_utf8_from (uint8_t const* const ptr,
+                                         size_t const pos,
+                                         size_t const len,
+                                         diablo_utf8_state* const state) {
+  size_t start = pos;
+  // At most three continuation bytes, then their lead byte.
+  for (size_t i = 0; i < 3 && start > 0 && is_continuation(ptr[start - 1]); i++) {
+    start--;
+  }
+  if (start > 0 && ptr[start - 1] >= 0xC0) {
+    start--;
+  }
+  state->remaining = 0;
+  return validate_utf8_rest(ptr, start, len, state);
+}
 
+// SWAR implementation, used as the fallback everywhere.
+//
+// Between sequences, we skip eight bytes at a time while they're all ASCII, and
+// run the DFA a word at a time otherwise.
+static inline size_t validate_utf8_swar (uint8_t const* const src,
+                                         size_t const off,
+                                         size_t const len,
+                                         diablo_utf8_state* const state) {
+  uint8_t const* const ptr = (uint8_t const*)&(src[off]);
+  uint64_t const high_bits = broadcast(0x80);
+  size_t i = 0;
+  while (i < len) {
+    if (state->remaining == 0) {
+      while (i + 8 <= len && (*((uint64_t const*)(ptr + i)) & high_bits) == 0) {
+        i += 8;
+      }
+    }
+    size_t const stop = (i + 8 <= len) ? i + 8 : len;
+    size_t const result = validate_utf8_rest(ptr, i, stop, state);
+    if (result != stop) {
+      return result;
+    }
+    i = stop;
+  }
+  return len;
+}
 
-static inline size_t count_eq_rest (uint8_t const* const src,
-                                    size_t const len,
-                                    uint8_t const byte) {
+// The SIMD kernels use the lookup algorithm from "Validating UTF-8 In Less
+// Than One Instruction Per Byte" (Keiser and Lemire, 2021). Each byte is
+// checked against the byte before it, using three 16-entry lookups (on the
+// high and low nibble of the previous byte, and the high nibble of this one),
+// whose results are ANDed: any bit left over is an error. A separate check
+// makes sure the third and fourth bytes of longer sequences are continuations.
+//
+// Blocks which are entirely ASCII only need checking for an incomplete
+// sequence at the end of the block before.
+//
+// Whatever is left over after the last full block is copied into a zeroed
+// 64-byte buffer, and goes through the same step, following on from the last
+// full block. The zeros after it are ASCII, so this also catches a sequence
+// left incomplete at the end. If any block fails, we hand over to the DFA from
+// the start of that block: it finds exactly where the error is, or that the
+// input just ends mid-sequence, which is fine if more is coming.
+
+#if (DIABLO_HAS_SSSE3 || DIABLO_HAS_NEON)
+#define TOO_SHORT (1 << 0)
+#define TOO_LONG (1 << 1)
+#define OVERLONG_3 (1 << 2)
+#define TOO_LARGE (1 << 3)
+#define SURROGATE (1 << 4)
+#define OVERLONG_2 (1 << 5)
+#define TOO_LARGE_1000 (1 << 6)
+#define OVERLONG_4 (1 << 6)
+#define TWO_CONTS (1 << 7)
+#define CARRY (TOO_SHORT | TOO_LONG | TWO_CONTS)
+
+// Indexed by the high nibble of the previous byte.
+static uint8_t const prev_high_table[16] = {
+  // 0_______ (ASCII)
+  TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG,
+  TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG,
+  // 10______ (continuation)
+  TWO_CONTS, TWO_CONTS, TWO_CONTS, TWO_CONTS,
+  // 1100____ (two-byte lead)
+  TOO_SHORT | OVERLONG_2,
+  // 1101____ (two-byte lead)
+  TOO_SHORT,
+  // 1110____ (three-byte lead)
+  TOO_SHORT | OVERLONG_3 | SURROGATE,
+  // 1111____ (four-byte lead)
+  TOO_SHORT | TOO_LARGE | TOO_LARGE_1000 | OVERLONG_4
+};
+
+// Indexed by the low nibble of the previous byte.
+static uint8_t const prev_low_table[16] = {
+  // ____0000
+  CARRY | OVERLONG_3 | OVERLONG_2 | OVERLONG_4,
+  // ____0001
+  CARRY | OVERLONG_2,
+  // ____001_
+  CARRY,
+  CARRY,
+  // ____0100
+  CARRY | TOO_LARGE,
+  // ____0101
+  CARRY | TOO_LARGE | TOO_LARGE_1000,
+  // ____011_
+  CARRY | TOO_LARGE | TOO_LARGE_1000,
+  CARRY | TOO_LARGE | TOO_LARGE_1000,
+  // ____1___
+  CARRY | TOO_LARGE | TOO_LARGE_1000,
+  CARRY | TOO_LARGE | TOO_LARGE_1000,
+  CARRY | TOO_LARGE | TOO_LARGE_1000,
+  CARRY | TOO_LARGE | TOO_LARGE_1000,
+  CARRY | TOO_LARGE | TOO_LARGE_1000,
+  // ____1101
+  CARRY | TOO_LARGE | TOO_LARGE_1000 | SURROGATE,
+  CARRY | TOO_LARGE | TOO_LARGE_1000,
+  CARRY | TOO_LARGE | TOO_LARGE_1000
+};
+
+// Indexed by the high nibble of the current byte.
+static uint8_t const cur_high_table[16] = {
+  // 0_______ (ASCII)
+  TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT,
+  TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT,
+  // 1000____
+  TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE_1000 | OVERLONG_4,
+  // 1001____
+  TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE,
+  // 101_____
+  TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE,
+  TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE,
+  // 11______ (lead)
+  TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT
+};
+
+// The largest values the last three bytes of a block can have without being
+// the start of an incomplete sequence.
+static uint8_t const incomplete_table[16] = {
+  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xEF, 0xDF, 0xBF
+};
+#endif
+
+#if (DIABLO_HAS_SSSE3)
+#include <tmmintrin.h>
+
+typedef struct {
+  __m128i prev_high;
+  __m128i prev_low;
+  __m128i cur_high;
+  __m128i incomplete;
+} utf8_tables_ssse3;
+
+// Nonzero lanes mark errors in input, given the 16 bytes before it.
+__attribute__((target("ssse3")))
+static inline __m128i check_utf8_ssse3 (__m128i const input,
+                                        __m128i const prev_input,
+                                        utf8_tables_ssse3 const* const tables) {
+  __m128i const nibble = _mm_set1_epi8(0x0F);
+  __m128i const prev1 = _mm_alignr_epi8(input, prev_input, 15);
+  __m128i const special =
+    _mm_and_si128(_mm_and_si128(_mm_shuffle_epi8(tables->prev_high,
+                                                 _mm_and_si128(_mm_srli_epi16(prev1, 4), nibble)),
+                                _mm_shuffle_epi8(tables->prev_low,
+                                                 _mm_and_si128(prev1, nibble))),
+                  _mm_shuffle_epi8(tables->cur_high,
+                                   _mm_and_si128(_mm_srli_epi16(input, 4), nibble)));
+  // Only bytes at least 0xE0 two back, or 0xF0 three back, end up with their
+  // top bit set.
+  __m128i const prev2 = _mm_alignr_epi8(input, prev_input, 14);
+  __m128i const prev3 = _mm_alignr_epi8(input, prev_input, 13);
+  __m128i const must_23 =
+    _mm_or_si128(_mm_subs_epu8(prev2, _mm_set1_epi8(0xE0 - 0x80)),
+                 _mm_subs_epu8(prev3, _mm_set1_epi8(0xF0 - 0x80)));
+  return _mm_xor_si128(_mm_and_si128(must_23, _mm_set1_epi8(-128)), special);
+}
+
+// Check a 64-byte block, following on from the block before it. Returns false
+// if anything is wrong.
+__attribute__((target("ssse3")))
+static inline bool check_utf8_block_ssse3 (uint8_t const* const block,
+                                           __m128i* const prev_input,
+                                           __m128i* const prev_incomplete,
+                                           utf8_tables_ssse3 const* const tables) {
+  __m128i const* big_ptr = (__m128i const*)block;
+  __m128i const inputs[4] = {
+    _mm_loadu_si128(big_ptr),
+    _mm_loadu_si128(big_ptr + 1),
+    _mm_loadu_si128(big_ptr + 2),
+    _mm_loadu_si128(big_ptr + 3)
+  };
+  __m128i const any = _mm_or_si128(_mm_or_si128(inputs[0], inputs[1]),
+                                   _mm_or_si128(inputs[2], inputs[3]));
+  __m128i error = *prev_incomplete;
+  if (_mm_movemask_epi8(any) != 0) {
+    error = _mm_or_si128(_mm_or_si128(check_utf8_ssse3(inputs[0], *prev_input, tables),
+                                      check_utf8_ssse3(inputs[1], inputs[0], tables)),
+                         _mm_or_si128(check_utf8_ssse3(inputs[2], inputs[1], tables),
+                                      check_utf8_ssse3(inputs[3], inputs[2], tables)));
+    *prev_incomplete = _mm_subs_epu8(inputs[3], tables->incomplete);
+  }
+  *prev_input = inputs[3];
+  return _mm_movemask_epi8(_mm_cmpeq_epi8(error, _mm_setzero_si128())) == 0xFFFF;
+}
+
+__attribute__((target("ssse3")))
+static inline size_t validate_utf8_ssse3 (uint8_t const* const src,
+                                          size_t const off,
+                                          size_t const len,
+                                          diablo_utf8_state* const state) {
+  uint8_t const* const ptr = (uint8_t const*)&(src[off]);
+  utf8_tables_ssse3 const tables = {
+    _mm_loadu_si128((__m128i const*)prev_high_table),
+    _mm_loadu_si128((__m128i const*)prev_low_table),
+    _mm_loadu_si128((__m128i const*)cur_high_table),
+    _mm_loadu_si128((__m128i const*)incomplete_table)
+  };
+  __m128i prev_input = _mm_setzero_si128();
+  __m128i prev_incomplete = _mm_setzero_si128();
+  size_t i = 0;
+  for (; i + 64 <= len; i += 64) {
+    if (!check_utf8_block_ssse3(ptr + i, &prev_input, &prev_incomplete, &tables)) {
+      return validate_utf8_from(ptr, i, len, state);
+    }
+  }
+  uint8_t tail[64] = {0};
+  // memcpy with a null pointer is undefined, even for no bytes.
+  if (i < len) {
+    memcpy(tail, ptr + i, len - i);
+  }
+  if (check_utf8_block_ssse3(tail, &prev_input, &prev_incomplete, &tables)) {
+    return len;
+  }
+  return validate_utf8_from(ptr, i, len, state);
+}
+#endif
+
+#if (DIABLO_HAS_AVX2)
+#include <immintrin.h>
+
+typedef struct {
+  __m256i prev_high;
+  __m256i prev_low;
+  __m256i cur_high;
+  __m256i incomplete;
+} utf8_tables_avx2;
+
+// The 32 bytes of input shifted back by n (at most 16), with the end of
+// prev_input shifted in.
+#define PREV_AVX2(input, prev_input, n) \
+  _mm256_alignr_epi8((input), \
+                     _mm256_permute2x128_si256((prev_input), (input), 0x21), \
+                     16 - (n))
+
+__attribute__((target("avx2")))
+static inline __m256i check_utf8_avx2 (__m256i const input,
+                                       __m256i const prev_input,
+                                       utf8_tables_avx2 const* const tables) {
+  __m256i const nibble = _mm256_set1_epi8(0x0F);
+  __m256i const prev1 = PREV_AVX2(input, prev_input, 1);
+  __m256i const special =
+    _mm256_and_si256(_mm256_and_si256(_mm256_shuffle_epi8(tables->prev_high,
+                                                          _mm256_and_si256(_mm256_srli_epi16(prev1, 4), nibble)),
+                                      _mm256_shuffle_epi8(tables->prev_low,
+                                                          _mm256_and_si256(prev1, nibble))),
+                     _mm256_shuffle_epi8(tables->cur_high,
+                                         _mm256_and_si256(_mm256_srli_epi16(input, 4), nibble)));
+  __m256i const prev2 = PREV_AVX2(input, prev_input, 2);
+  __m256i const prev3 = PREV_AVX2(input, prev_input, 3);
+  __m256i const must_23 =
+    _mm256_or_si256(_mm256_subs_epu8(prev2, _mm256_set1_epi8(0xE0 - 0x80)),
+                    _mm256_subs_epu8(prev3, _mm256_set1_epi8(0xF0 - 0x80)));
+  return _mm256_xor_si256(_mm256_and_si256(must_23, _mm256_set1_epi8(-128)), special);
+}
+
+// Check a 64-byte block, following on from the block before it. Returns false
+// if anything is wrong.
+__attribute__((target("avx2")))
+static inline bool check_utf8_block_avx2 (uint8_t const* const block,
+                                          __m256i* const prev_input,
+                                          __m256i* const prev_incomplete,
+                                          utf8_tables_avx2 const* const tables) {
+  __m256i const* big_ptr = (__m256i const*)block;
+  __m256i const inputs[2] = {
+    _mm256_loadu_si256(big_ptr),
+    _mm256_loadu_si256(big_ptr + 1)
+  };
+  __m256i error = *prev_incomplete;
+  if (_mm256_movemask_epi8(_mm256_or_si256(inputs[0], inputs[1])) != 0) {
+    error = _mm256_or_si256(check_utf8_avx2(inputs[0], *prev_input, tables),
+                            check_utf8_avx2(inputs[1], inputs[0], tables));
+    *prev_incomplete = _mm256_subs_epu8(inputs[1], tables->incomplete);
+  }
+  *prev_input = inputs[1];
+  return _mm256_testz_si256(error, error);
+}
+
+__attribute__((target("avx2")))
+static inline size_t validate_utf8_avx (uint8_t const* const src,
+                                        size_t const off,
+                                        size_t const len,
+                                        diablo_utf8_state* const state) {
+  uint8_t const* const ptr = (uint8_t const*)&(src[off]);
+  // Shuffles work within 128-bit lanes, so both lanes get the same tables. The
+  // incomplete check only cares about the end of the upper lane.
+  utf8_tables_avx2 const tables = {
+    _mm256_broadcastsi128_si256(_mm_loadu_si128((__m128i const*)prev_high_table)),
+    _mm256_broadcastsi128_si256(_mm_loadu_si128((__m128i const*)prev_low_table)),
+    _mm256_broadcastsi128_si256(_mm_loadu_si128((__m128i const*)cur_high_table)),
+    _mm256_inserti128_si256(_mm256_set1_epi8(-1),
+                            _mm_loadu_si128((__m128i const*)incomplete_table), 1)
+  };
+  __m256i prev_input = _mm256_setzero_si256();
+  __m256i prev_incomplete = _mm256_setzero_si256();
+  size_t i = 0;
+  for (; i + 64 <= len; i += 64) {
+    if (!check_utf8_block_avx2(ptr + i, &prev_input, &prev_incomplete, &tables)) {
+      return validate_utf8_from(ptr, i, len, state);
+    }
+  }
+  uint8_t tail[64] = {0};
+  // memcpy with a null pointer is undefined, even for no bytes.
+  if (i < len) {
+    memcpy(tail, ptr + i, len - i);
+  }
+  if (check_utf8_block_avx2(tail, &prev_input, &prev_incomplete, &tables)) {
+    return len;
+  }
+  return validate_utf8_from(ptr, i, len, state);
+}
+#endif
+
+#if (DIABLO_HAS_NEON)
+typedef struct {
+  uint8x16_t prev_high;
+  uint8x16_t prev_low;
+  uint8x16_t cur_high;
+  uint8x16_t incomplete;
+} utf8_tables_neon;
+
+static inline uint8x16_t check_utf8_neon (uint8x16_t const input,
+                                          uint8x16_t const prev_input,
+                                          utf8_tables_neon const* const tables) {
+  uint8x16_t const prev1 = vextq_u8(prev_input, input, 15);
+  uint8x16_t const special =
+    vandq_u8(vandq_u8(lookup16(tables->prev_high, vshrq_n_u8(prev1, 4)),
+                      lookup16(tables->prev_low, vandq_u8(prev1, vdupq_n_u8(0x0F)))),
+             lookup16(tables->cur_high, vshrq_n_u8(input, 4)));
+  uint8x16_t const prev2 = vextq_u8(prev_input, input, 14);
+  uint8x16_t const prev3 = vextq_u8(prev_input, input, 13);
+  uint8x16_t const must_23 = vorrq_u8(vqsubq_u8(prev2, vdupq_n_u8(0xE0 - 0x80)),
+                                      vqsubq_u8(prev3, vdupq_n_u8(0xF0 - 0x80)));
+  return veorq_u8(vandq_u8(must_23, vdupq_n_u8(0x80)), special);
+}
+
+// Check a 64-byte block, following on from the block before it. Returns false
+// if anything is wrong.
+static inline bool check_utf8_block_neon (uint8_t const* const block,
+                                          uint8x16_t* const prev_input,
+                                          uint8x16_t* const prev_incomplete,
+                                          utf8_tables_neon const* const tables) {
+  uint8x16_t const inputs[4] = {
+    vld1q_u8(block),
+    vld1q_u8(block + 16),
+    vld1q_u8(block + 32),
+    vld1q_u8(block + 48)
+  };
+  uint8x16_t const any = vorrq_u8(vorrq_u8(inputs[0], inputs[1]),
+                                  vorrq_u8(inputs[2], inputs[3]));
+  uint8x16_t error = *prev_incomplete;
+  if (any_set(vandq_u8(any, vdupq_n_u8(0x80)))) {
+    error = vorrq_u8(vorrq_u8(check_utf8_neon(inputs[0], *prev_input, tables),
+                              check_utf8_neon(inputs[1], inputs[0], tables)),
+                     vorrq_u8(check_utf8_neon(inputs[2], inputs[1], tables),
+                              check_utf8_neon(inputs[3], inputs[2], tables)));
+    *prev_incomplete = vqsubq_u8(inputs[3], tables->incomplete);
+  }
+  *prev_input = inputs[3];
+  return !any_set(error);
+}
+
+static inline size_t validate_utf8_neon (uint8_t const* const src,
+                                         size_t const off,
+                                         size_t const len,
+                                         diablo_utf8_state* const state) {
+  uint8_t const* const ptr = (uint8_t const*)&(src[off]);
+  utf8_tables_neon const tables = {
+    vld1q_u8(prev_high_table),
+    vld1q_u8(prev_low_table),
+    vld1q_u8(cur_high_table),
+    vld1q_u8(incomplete_table)
+  };
+  uint8x16_t prev_input = vdupq_n_u8(0);
+  uint8x16_t prev_incomplete = vdupq_n_u8(0);
+  size_t i = 0;
+  for (; i + 64 <= len; i += 64) {
+    if (!check_utf8_block_neon(ptr + i, &prev_input, &prev_incomplete, &tables)) {
+      return validate_utf8_from(ptr, i, len, state);
+    }
+  }
+  uint8_t tail[64] = {0};
+  // memcpy with a null pointer is undefined, even for no bytes.
+  if (i < len) {
+    memcpy(tail, ptr + i, len - i);
+  }
+  if (check_utf8_block_neon(tail, &prev_input, &prev_incomplete, &tables)) {
+    return len;
+  }
+  return validate_utf8_from(ptr, i, len, state);
+}
+#endif
+
+typedef size_t (*validate_utf8_kernel) (uint8_t const* const,
+                                        size_t const,
+                                        size_t const,
+                                        diablo_utf8_state* const);
+
+// SSE2 has no byte shuffles, so it uses the SWAR kernel. AVX-512BW machines all
+// have AVX2, whose kernel we use there.
+static validate_utf8_kernel const validate_utf8_kernels[DIABLO_BACKEND_COUNT] = {
+  [DIABLO_BACKEND_SWAR] = validate_utf8_swar,
+#if (DIABLO_HAS_SSE2)
+  [DIABLO_BACKEND_SSE2] = validate_utf8_swar,
+#endif
+#if (DIABLO_HAS_SSSE3)
+  [DIABLO_BACKEND_SSSE3] = validate_utf8_ssse3,
+#endif
+#if (DIABLO_HAS_AVX2)
+  [DIABLO_BACKEND_AVX2] = validate_utf8_avx,
+#endif
+#if (DIABLO_HAS_NEON)
+  [DIABLO_BACKEND_NEON] = validate_utf8_neon,
+#endif
+#if (DIABLO_HAS_AVX512BW)
+  [DIABLO_BACKEND_AVX512BW] = validate_utf8_avx,
+#endif
+};
+
+size_t diablo_validate_utf8 (uint8_t const* const src,
+                             size_t const off,
+                             size_t const len,
+                             diablo_utf8_state* const state) {
+  STATS_RECORD(STATS_VALIDATE_UTF8, len);
+  uint8_t const* const ptr = (uint8_t const*)&(src[off]);
+  // Finish off whatever the last chunk left incomplete.
+  size_t start = 0;
+  if (state->remaining != 0) {
+    start = (state->remaining < len) ? state->remaining : len;
+    size_t const result = validate_utf8_rest(ptr, 0, start, state);
+    if (result != start || state->remaining != 0) {
+      return result;
+    }
+  }
+  size_t const result = validate_utf8_kernels[active_backend()](src,
+                                                                off + start,
+                                                                len - start,
+                                                                state);
+  return start + result;
+}
+
+bool diablo_utf8_state_complete (diablo_utf8_state const* const state) {
+  return state->remaining == 0;
+}
+
+#include <stddef.h>
+
+// Every code point starts with exactly one byte which isn't a continuation
+// (10xxxxxx) byte, so both operations here come down to finding those. As
+// signed bytes, continuation bytes are exactly those at most -65 (0xBF), so a
+// single signed comparison finds the rest.
+//
+// The offset kernels skip whole blocks by popcounting them, and only look for
+// the position once they know it's in the block in front of them.
+
+static inline bool is_leading (uint8_t const byte) {
+  return (byte & 0xC0) != 0x80;
+}
+
+static inline size_t count_utf8_codepoints_rest (uint8_t const* const ptr,
+                                                 size_t const len) {
   size_t count = 0;
-  uint8_t const* ptr = (uint8_t const*)src;
   for (size_t i = 0; i < len; i++) {
-    if ((*ptr) == byte) {
+    if (is_leading(ptr[i])) {
       count++;
     }
-    ptr++;
   }
   return count;
 }
 
-#if (__SSE2__)
+// The position in [start, len) of leading byte n, counting from start, or len.
+static inline size_t utf8_offset_of_nth_rest (uint8_t const* const ptr,
+                                              size_t const start,
+                                              size_t const len,
+                                              size_t n) {
+  for (size_t i = start; i < len; i++) {
+    if (is_leading(ptr[i])) {
+      if (n == 0) {
+        return i;
+      }
+      n--;
+    }
+  }
+  return len;
+}
+
+// SWAR implementation, used as the fallback everywhere.
+//
+// A continuation byte has its top bit set, and the bit below it clear. Shifting
+// the word left by one lines each byte's second bit up with its top bit, so we
+// can flag all of them at once.
+static inline uint64_t continuation_flags (uint64_t const word) {
+  return word & ~(word << 1) & broadcast(0x80);
+}
+
+static inline size_t count_utf8_codepoints_swar (uint8_t const* const src,
+                                                 size_t const off,
+                                                 size_t const len) {
+  size_t count = 0;
+  size_t const big_strides = len / 64;
+  size_t const small_strides = len % 64;
+  uint8_t const* ptr = (uint8_t const*)&(src[off]);
+  for (size_t i = 0; i < big_strides; i++) {
+    uint64_t const* const big_ptr = (uint64_t const* const)ptr;
+    uint64_t result = 0;
+    // Manual 8x loop unroll. Each word's flags go in a different bit of each
+    // byte, so the popcount sees all of them.
+    result |= continuation_flags(big_ptr[0]);
+    result |= continuation_flags(big_ptr[1]) >> 1;
+    result |= continuation_flags(big_ptr[2]) >> 2;
+    result |= continuation_flags(big_ptr[3]) >> 3;
+    result |= continuation_flags(big_ptr[4]) >> 4;
+    result |= continuation_flags(big_ptr[5]) >> 5;
+    result |= continuation_flags(big_ptr[6]) >> 6;
+    result |= continuation_flags(big_ptr[7]) >> 7;
+    count += 64 - __builtin_popcountll(result);
+    ptr += 64;
+  }
+  count += count_utf8_codepoints_rest(ptr, small_strides);
+  return count;
+}
+
+static inline size_t utf8_offset_of_nth_swar (uint8_t const* const src,
+                                              size_t const off,
+                                              size_t const len,
+                                              size_t n) {
+  uint8_t const* const ptr = (uint8_t const*)&(src[off]);
+  size_t i = 0;
+  for (; i + 8 <= len; i += 8) {
+    size_t const leading =
+      8 - __builtin_popcountll(continuation_flags(*((uint64_t const*)(ptr + i))));
+    if (n < leading) {
+      break;
+    }
+    n -= leading;
+  }
+  return utf8_offset_of_nth_rest(ptr, i, len, n);
+}
+
+#if (DIABLO_HAS_SSE2)
 #include <emmintrin.h>
 
-static inline size_t count_eq_sse (uint8_t const* const src,
-                                   size_t const off,
-                                   size_t const len,
-                                   uint8_t const byte) {
+// 0xFF in the lanes holding leading bytes, 0x00 otherwise.
+static inline __m128i leading_sse (__m128i const* const ptr) {
+  return _mm_cmpgt_epi8(_mm_loadu_si128(ptr), _mm_set1_epi8(-65));
+}
+
+// One bit per leading byte of 64, in order.
+static inline uint64_t leading_mask64_sse (uint8_t const* const ptr) {
+  __m128i const* big_ptr = (__m128i const*)ptr;
+  return ((uint64_t)(uint32_t)_mm_movemask_epi8(leading_sse(big_ptr))) |
+         (((uint64_t)(uint32_t)_mm_movemask_epi8(leading_sse(big_ptr + 1))) << 16) |
+         (((uint64_t)(uint32_t)_mm_movemask_epi8(leading_sse(big_ptr + 2))) << 32) |
+         (((uint64_t)(uint32_t)_mm_movemask_epi8(leading_sse(big_ptr + 3))) << 48);
+}
+
+static inline size_t count_utf8_codepoints_sse (uint8_t const* const src,
+                                                size_t const off,
+                                                size_t const len) {
   size_t count = 0;
   size_t const big_strides = len / 64;
   size_t const small_strides = len % 64;
   uint8_t const* ptr = (uint8_t const*)&(src[off]);
   if (big_strides != 0) {
-    __m128i const matches = _mm_set1_epi8(byte);
     __m128i counts = _mm_setzero_si128();
+    __m128i const zero = _mm_setzero_si128();
     for (size_t i = 0; i < big_strides; i++) {
       __m128i const* big_ptr = (__m128i const*)ptr;
-      // Load and compare. This leaves 0xFF in a matching lane, and 0x00
-      // otherwise.
-      //
-      // This is a manual 4x unroll.
-      __m128i const results[4] = {
-        _mm_cmpeq_epi8(matches, _mm_loadu_si128(big_ptr)),
-        _mm_cmpeq_epi8(matches, _mm_loadu_si128(big_ptr + 1)),
-        _mm_cmpeq_epi8(matches, _mm_loadu_si128(big_ptr + 2)),
-        _mm_cmpeq_epi8(matches, _mm_loadu_si128(big_ptr + 3))
-      };
-      // Since 0xFF is -1, we can get a lane-by-lane match count (except
-      // negative) by adding.
-      __m128i const summed = _mm_add_epi8(_mm_add_epi8(results[0], results[1]),
-                                          _mm_add_epi8(results[2], results[3]));
-      // By taking the sum of absolute differences with 0x00 in each lane, we
-      // get two 64-bit counts, which we accumulate.
-      counts = _mm_add_epi64(counts, _mm_sad_epu8(summed, _mm_setzero_si128()));
+      // This is a manual 4x unroll. As in count_eq_sse, we add the -1s, negate,
+      // and sum absolute differences.
+      __m128i const summed =
+        _mm_add_epi8(_mm_add_epi8(leading_sse(big_ptr), leading_sse(big_ptr + 1)),
+                     _mm_add_epi8(leading_sse(big_ptr + 2), leading_sse(big_ptr + 3)));
+      counts = _mm_add_epi64(counts,
+                             _mm_sad_epu8(_mm_sub_epi8(zero, summed), zero));
       ptr += 64;
     }
     // Evacuate results and sum.
@@ -85,50 +8180,61 @@ static inline size_t count_eq_sse (uint8_t const* const src,
     _mm_storeu_si128((__m128i*)results, counts);
     count += (results[0] + results[1]);
   }
-  count += count_eq_rest(ptr, small_strides, byte);
+  count += count_utf8_codepoints_rest(ptr, small_strides);
   return count;
 }
 
-#if (__i386__)
-// Pure SSE implementation, as 32-bit x86 _cannot_ have AVX.
-size_t diablo_count_eq (uint8_t const* const src,
-                        size_t const off,
-                        size_t const len,
-                        uint8_t const byte) {
-  return count_eq_sse(src, off, len, byte);
+static inline size_t utf8_offset_of_nth_sse (uint8_t const* const src,
+                                             size_t const off,
+                                             size_t const len,
+                                             size_t n) {
+  uint8_t const* const ptr = (uint8_t const*)&(src[off]);
+  size_t i = 0;
+  for (; i + 64 <= len; i += 64) {
+    uint64_t const mask = leading_mask64_sse(ptr + i);
+    size_t const leading = __builtin_popcountll(mask);
+    if (n < leading) {
+      return i + select_bit(mask, n);
+    }
+    n -= leading;
+  }
+  return utf8_offset_of_nth_rest(ptr, i, len, n);
 }
-#else
-// Mixed AVX/SSE with runtime detection.
+#endif
+
+#if (DIABLO_HAS_AVX2)
 #include <immintrin.h>
 
 __attribute__((target("avx2")))
-static inline size_t count_eq_avx (uint8_t const* const src,
-                                   size_t const off,
-                                   size_t const len,
-                                   uint8_t const byte) {
+static inline __m256i leading_avx (__m256i const* const ptr) {
+  return _mm256_cmpgt_epi8(_mm256_loadu_si256(ptr), _mm256_set1_epi8(-65));
+}
+
+__attribute__((target("avx2")))
+static inline uint64_t leading_mask64_avx (uint8_t const* const ptr) {
+  __m256i const* big_ptr = (__m256i const*)ptr;
+  return ((uint64_t)(uint32_t)_mm256_movemask_epi8(leading_avx(big_ptr))) |
+         (((uint64_t)(uint32_t)_mm256_movemask_epi8(leading_avx(big_ptr + 1))) << 32);
+}
+
+__attribute__((target("avx2")))
+static inline size_t count_utf8_codepoints_avx (uint8_t const* const src,
+                                                size_t const off,
+                                                size_t const len) {
   size_t count = 0;
   size_t const big_strides = len / 64;
   size_t const small_strides = len % 64;
   uint8_t const* ptr = (uint8_t const*)&(src[off]);
   if (big_strides != 0) {
-    __m256i const matches = _mm256_set1_epi8(byte);
     __m256i counts = _mm256_setzero_si256();
+    __m256i const zero = _mm256_setzero_si256();
     for (size_t i = 0; i < big_strides; i++) {
-      __m256i const* big_ptr = (__m256i const*)ptr;
-      // Load and compare. This leaves 0xFF in a matching lane, and 0x00
-      // otherwise.
-      //
+      __m256i const* big_ptr = (__m256i const*)ptr;
       // This is a manual 2x unroll.
-      __m256i const results[2] = {
-        _mm256_cmpeq_epi8(matches, _mm256_loadu_si256(big_ptr)),
-        _mm256_cmpeq_epi8(matches, _mm256_loadu_si256(big_ptr + 1))
-      };
-      // Since 0xFF is -1, we can get a line-by-lane match count (except
-      // negative), by adding.
-      __m256i const summed = _mm256_add_epi8(results[0], results[1]);
-      // By taking the sum of absolute differences with 0x00 in each lane, we
-      // get four 64-bit counts, which we accumulate.
-      counts = _mm256_add_epi64(counts, _mm256_sad_epu8(summed, _mm256_setzero_si256()));
+      __m256i const summed = _mm256_add_epi8(leading_avx(big_ptr),
+                                             leading_avx(big_ptr + 1));
+      counts = _mm256_add_epi64(counts,
+                                _mm256_sad_epu8(_mm256_sub_epi8(zero, summed), zero));
       ptr += 64;
     }
     // Evacuate results and sum.
@@ -137,115 +8243,1005 @@ static inline size_t count_eq_avx (uint8_t const* const src,
              _mm256_extract_epi64(counts, 2) +
              _mm256_extract_epi64(counts, 3);
   }
-  count += count_eq_rest(ptr, small_strides, byte);
+  count += count_utf8_codepoints_rest(ptr, small_strides);
   return count;
 }
 
-size_t diablo_count_eq (uint8_t const* const src,
-                        size_t const off,
-                        size_t const len,
-                        uint8_t const byte) {
-  __builtin_cpu_init();
-  if (__builtin_cpu_supports("avx2")) {
-    return count_eq_avx(src, off, len, byte);
+__attribute__((target("avx2")))
+static inline size_t utf8_offset_of_nth_avx (uint8_t const* const src,
+                                             size_t const off,
+                                             size_t const len,
+                                             size_t n) {
+  uint8_t const* const ptr = (uint8_t const*)&(src[off]);
+  size_t i = 0;
+  for (; i + 64 <= len; i += 64) {
+    uint64_t const mask = leading_mask64_avx(ptr + i);
+    size_t const leading = __builtin_popcountll(mask);
+    if (n < leading) {
+      return i + select_bit(mask, n);
+    }
+    n -= leading;
+  }
+  return utf8_offset_of_nth_rest(ptr, i, len, n);
+}
+#endif
+
+#if (DIABLO_HAS_AVX512BW)
+// Masked loads cover the ragged end, so there is nothing scalar here.
+
+__attribute__((target("avx512bw")))
+static inline uint64_t leading_mask_avx512 (uint8_t const* const ptr,
+                                            size_t const len) {
+  __m512i const threshold = _mm512_set1_epi8(-65);
+  if (len >= 64) {
+    return _mm512_cmpgt_epi8_mask(_mm512_loadu_si512((void const*)ptr), threshold);
+  }
+  __mmask64 const mask = low_mask(len);
+  return _mm512_mask_cmpgt_epi8_mask(mask, _mm512_maskz_loadu_epi8(mask, ptr),
+                                     threshold);
+}
+
+__attribute__((target("avx512bw,popcnt")))
+static inline size_t count_utf8_codepoints_avx512 (uint8_t const* const src,
+                                                   size_t const off,
+                                                   size_t const len) {
+  uint8_t const* const ptr = (uint8_t const*)&(src[off]);
+  size_t count = 0;
+  for (size_t i = 0; i < len; i += 64) {
+    count += _mm_popcnt_u64(leading_mask_avx512(ptr + i, len - i));
   }
-  return count_eq_sse(src, off, len, byte);
+  return count;
 }
 
+__attribute__((target("avx512bw,popcnt")))
+static inline size_t utf8_offset_of_nth_avx512 (uint8_t const* const src,
+                                                size_t const off,
+                                                size_t const len,
+                                                size_t n) {
+  uint8_t const* const ptr = (uint8_t const*)&(src[off]);
+  for (size_t i = 0; i < len; i += 64) {
+    uint64_t const mask = leading_mask_avx512(ptr + i, len - i);
+    size_t const leading = _mm_popcnt_u64(mask);
+    if (n < leading) {
+      return i + select_bit(mask, n);
+    }
+    n -= leading;
+  }
+  return len;
+}
 #endif
-#elif (__ARM_NEON)
-// NEON implementation.
 
-#include <arm_neon.h>
+#if (DIABLO_HAS_NEON)
+// 0xFF (thus, -1) in the lanes holding leading bytes, 0x00 otherwise.
+static inline int8x16_t leading_neon (uint8_t const* const ptr) {
+  return vreinterpretq_s8_u8(vcgtq_s8(vreinterpretq_s8_u8(vld1q_u8(ptr)),
+                                      vdupq_n_s8(-65)));
+}
 
-size_t diablo_count_eq (uint8_t const* const src,
-                        size_t const off,
-                        size_t const len,
-                        uint8_t const byte) {
+static inline size_t count_utf8_codepoints_neon (uint8_t const* const src,
+                                                 size_t const off,
+                                                 size_t const len) {
   size_t count = 0;
   size_t const big_strides = len / 64;
   size_t const small_strides = len % 64;
   uint8_t const* ptr = (uint8_t const*)&(src[off]);
   if (big_strides != 0) {
-    uint8x16_t const matches = vdupq_n_u8(byte);
     uint64x2_t counts = vdupq_n_u64(0);
     for (size_t i = 0; i < big_strides; i++) {
-      // Load and compare, then reinterpret as signed. This puts 0xFF in a
-      // matching lane (thus, -1), and 0x00 in a non-matching lane (thus, 0).
-      //
-      // This is a manual 4x unroll.
-      int8x16_t const results[4] = {
-        vreinterpretq_s8_u8(vceqq_u8(matches, vld1q_u8(ptr))),
-        vreinterpretq_s8_u8(vceqq_u8(matches, vld1q_u8(ptr + 16))),
-        vreinterpretq_s8_u8(vceqq_u8(matches, vld1q_u8(ptr + 32))),
-        vreinterpretq_s8_u8(vceqq_u8(matches, vld1q_u8(ptr + 48)))
-      };
-      // Add everything to get between 0 and -4 in each lane, then take the
-      // absolute value and reinterpret as signed.
+      // This is a manual 4x unroll. As in count_eq_neon, we add the -1s, take
+      // the absolute value, and sum horizontally.
       uint8x16_t const summed =
-        vreinterpretq_u8_s8(vabsq_s8(vaddq_s8(vaddq_s8(results[0], results[1]),
-                                              vaddq_s8(results[2], results[3]))));
-      // Horizontally sum and accumulate.
+        vreinterpretq_u8_s8(vabsq_s8(vaddq_s8(vaddq_s8(leading_neon(ptr),
+                                                       leading_neon(ptr + 16)),
+                                              vaddq_s8(leading_neon(ptr + 32),
+                                                       leading_neon(ptr + 48)))));
       counts = vaddq_u64(counts, vpaddlq_u32(vpaddlq_u16(vpaddlq_u8(summed))));
       ptr += 64;
     }
     // Evacuate and sum.
     count += (vgetq_lane_u64(counts, 0) + vgetq_lane_u64(counts, 1));
   }
-  count += count_eq_rest(ptr, small_strides, byte);
+  count += count_utf8_codepoints_rest(ptr, small_strides);
   return count;
 }
-#else
-// Fallback implementation
+
+// Masks here have one bit per byte, at the bottom of each nibble; see
+// nibble_mask.
+static inline size_t utf8_offset_of_nth_neon (uint8_t const* const src,
+                                              size_t const off,
+                                              size_t const len,
+                                              size_t n) {
+  uint8_t const* const ptr = (uint8_t const*)&(src[off]);
+  size_t i = 0;
+  for (; i + 16 <= len; i += 16) {
+    uint64_t const mask =
+      nibble_mask(vreinterpretq_u8_s8(leading_neon(ptr + i))) & 0x1111111111111111ULL;
+    size_t const leading = __builtin_popcountll(mask);
+    if (n < leading) {
+      return i + (select_bit(mask, n) >> 2);
+    }
+    n -= leading;
+  }
+  return utf8_offset_of_nth_rest(ptr, i, len, n);
+}
+#endif
+
+typedef size_t (*count_utf8_codepoints_kernel) (uint8_t const* const,
+                                                size_t const,
+                                                size_t const);
+
+typedef size_t (*utf8_offset_of_nth_kernel) (uint8_t const* const,
+                                             size_t const,
+                                             size_t const,
+                                             size_t);
+
+static count_utf8_codepoints_kernel const count_utf8_codepoints_kernels[DIABLO_BACKEND_COUNT] = {
+  [DIABLO_BACKEND_SWAR] = count_utf8_codepoints_swar,
+#if (DIABLO_HAS_SSE2)
+  [DIABLO_BACKEND_SSE2] = count_utf8_codepoints_sse,
+#endif
+#if (DIABLO_HAS_SSSE3)
+  [DIABLO_BACKEND_SSSE3] = count_utf8_codepoints_sse,
+#endif
+#if (DIABLO_HAS_AVX2)
+  [DIABLO_BACKEND_AVX2] = count_utf8_codepoints_avx,
+#endif
+#if (DIABLO_HAS_NEON)
+  [DIABLO_BACKEND_NEON] = count_utf8_codepoints_neon,
+#endif
+#if (DIABLO_HAS_AVX512BW)
+  [DIABLO_BACKEND_AVX512BW] = count_utf8_codepoints_avx512,
+#endif
+};
+
+static utf8_offset_of_nth_kernel const utf8_offset_of_nth_kernels[DIABLO_BACKEND_COUNT] = {
+  [DIABLO_BACKEND_SWAR] = utf8_offset_of_nth_swar,
+#if (DIABLO_HAS_SSE2)
+  [DIABLO_BACKEND_SSE2] = utf8_offset_of_nth_sse,
+#endif
+#if (DIABLO_HAS_SSSE3)
+  [DIABLO_BACKEND_SSSE3] = utf8_offset_of_nth_sse,
+#endif
+#if (DIABLO_HAS_AVX2)
+  [DIABLO_BACKEND_AVX2] = utf8_offset_of_nth_avx,
+#endif
+#if (DIABLO_HAS_NEON)
+  [DIABLO_BACKEND_NEON] = utf8_offset_of_nth_neon,
+#endif
+#if (DIABLO_HAS_AVX512BW)
+  [DIABLO_BACKEND_AVX512BW] = utf8_offset_of_nth_avx512,
+#endif
+};
+
+size_t diablo_count_utf8_codepoints (uint8_t const* const src,
+                                     size_t const off,
+                                     size_t const len) {
+  STATS_RECORD(STATS_COUNT_UTF8_CODEPOINTS, len);
+  return count_utf8_codepoints_kernels[active_backend()](src, off, len);
+}
+
+size_t diablo_utf8_offset_of_nth (uint8_t const* const src,
+                                  size_t const off,
+                                  size_t const len,
+                                  size_t const n) {
+  STATS_RECORD(STATS_UTF8_OFFSET_OF_NTH, len);
+  return utf8_offset_of_nth_kernels[active_backend()](src, off, len, n);
+}
+
+#include <stddef.h>
+
+// Transcoding kernels return len if the whole input was valid. Otherwise, they
+// return the position of the start of the first invalid sequence: an unpaired
+// surrogate for UTF-16, or a sequence which is malformed, overlong, a
+// surrogate, past U+10FFFF or cut off by the end of the input for UTF-8.
+// Everything before that has been transcoded, and *written says how much
+// output it made.
 //
-// We use the method described in "Bit Twiddling Hacks".
-// Source: https://graphics.stanford.edu/~seander/bithacks.html#ZeroInWord
+// The SIMD kernels take a block at a time. If the block is all ASCII, or all
+// two-byte sequences (which covers most text in Latin-based, Greek, Cyrillic,
+// Armenian, Hebrew and Arabic scripts), we transcode it with a handful of
+// vector operations. Otherwise, we transcode from the start of the block to
+// (at least) its end a code point at a time, then try again from wherever that
+// left us. Nothing is written past the end of the output.
+//
+// UTF-16 code units are little-endian in memory. The SIMD kernels load and
+// store them as bytes and reinterpret, which gives little-endian lanes
+// whatever the machine's byte order; the scalar code swaps if it has to.
 
-// Load a 64-bit word, then set every byte which matches to 0x80, while setting
-// the others to 0x00.
-static inline uint64_t load_and_set (uint64_t const* const big_ptr,
-                                     size_t const i,
-                                     uint64_t const matches,
-                                     uint64_t const mask) {
-  uint64_t const input = big_ptr[i] ^ matches;
-  uint64_t const tmp = (input & mask) + mask;
-  return (~(tmp | input | mask) >> i);
+static inline uint16_t swap_le16 (uint16_t const unit) {
+#if (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+  return __builtin_bswap16(unit);
+#else
+  return unit;
+#endif
 }
 
-// Fill every 8-byte 'lane' with the same value.
-static inline uint64_t broadcast(uint8_t const byte) {
-  return byte * 0x0101010101010101ULL;
+// Transcode from in[*i] until *i reaches stop, or the end of the input,
+// writing to out[*o]. A surrogate pair may take *i one past stop. Returns
+// false, with *i at the offending unit, on an unpaired surrogate.
+static inline bool utf16le_to_utf8_run (uint16_t const* const in,
+                                        size_t const len,
+                                        size_t const stop,
+                                        uint8_t* const out,
+                                        size_t* const i,
+                                        size_t* const o) {
+  size_t pos = *i;
+  size_t written = *o;
+  bool ok = true;
+  while (pos < stop) {
+    uint32_t const unit = swap_le16(in[pos]);
+    if (unit < 0x80) {
+      out[written] = (uint8_t)unit;
+      written++;
+      pos++;
+    } else if (unit < 0x800) {
+      out[written] = (uint8_t)(0xC0 | (unit >> 6));
+      out[written + 1] = (uint8_t)(0x80 | (unit & 0x3F));
+      written += 2;
+      pos++;
+    } else if (unit < 0xD800 || unit >= 0xE000) {
+      out[written] = (uint8_t)(0xE0 | (unit >> 12));
+      out[written + 1] = (uint8_t)(0x80 | ((unit >> 6) & 0x3F));
+      out[written + 2] = (uint8_t)(0x80 | (unit & 0x3F));
+      written += 3;
+      pos++;
+    } else {
+      // A high surrogate, followed by a low one.
+      uint32_t const next = (pos + 1 < len) ? swap_le16(in[pos + 1]) : 0;
+      if (unit >= 0xDC00 || next < 0xDC00 || next >= 0xE000) {
+        ok = false;
+        break;
+      }
+      uint32_t const cp = 0x10000 + ((unit - 0xD800) << 10) + (next - 0xDC00);
+      out[written] = (uint8_t)(0xF0 | (cp >> 18));
+      out[written + 1] = (uint8_t)(0x80 | ((cp >> 12) & 0x3F));
+      out[written + 2] = (uint8_t)(0x80 | ((cp >> 6) & 0x3F));
+      out[written + 3] = (uint8_t)(0x80 | (cp & 0x3F));
+      written += 4;
+      pos += 2;
+    }
+  }
+  *i = pos;
+  *o = written;
+  return ok;
 }
 
-size_t diablo_count_eq (uint8_t const* const src,
-                        size_t const off,
-                        size_t const len,
-                        uint8_t const byte) {
+// Decode the sequence starting at in[pos] into *cp, returning its length, or 0
+// if it's invalid. The limits on the second byte rule out overlongs, surrogates
+// and anything past U+10FFFF, as in validate-utf8.c.
+static inline size_t decode_utf8 (uint8_t const* const in,
+                                  size_t const len,
+                                  size_t const pos,
+                                  uint32_t* const cp) {
+  uint8_t const lead = in[pos];
+  size_t need;
+  uint32_t value;
+  uint8_t lo = 0x80;
+  uint8_t hi = 0xBF;
+  if (lead < 0x80) {
+    *cp = lead;
+    return 1;
+  } else if (lead < 0xC2) {
+    return 0;
+  } else if (lead < 0xE0) {
+    need = 1;
+    value = lead & 0x1F;
+  } else if (lead < 0xF0) {
+    need = 2;
+    value = lead & 0x0F;
+    lo = (lead == 0xE0) ? 0xA0 : 0x80;
+    hi = (lead == 0xED) ? 0x9F : 0xBF;
+  } else if (lead < 0xF5) {
+    need = 3;
+    value = lead & 0x07;
+    lo = (lead == 0xF0) ? 0x90 : 0x80;
+    hi = (lead == 0xF4) ? 0x8F : 0xBF;
+  } else {
+    return 0;
+  }
+  if (len - pos <= need) {
+    return 0;
+  }
+  uint8_t const second = in[pos + 1];
+  if (second < lo || second > hi) {
+    return 0;
+  }
+  value = (value << 6) | (second & 0x3F);
+  for (size_t k = 2; k <= need; k++) {
+    uint8_t const next = in[pos + k];
+    if ((next & 0xC0) != 0x80) {
+      return 0;
+    }
+    value = (value << 6) | (next & 0x3F);
+  }
+  *cp = value;
+  return need + 1;
+}
+
+// As utf16le_to_utf8_run, the other way. A sequence may take *i up to three
+// past stop.
+static inline bool utf8_to_utf16le_run (uint8_t const* const in,
+                                        size_t const len,
+                                        size_t const stop,
+                                        uint16_t* const out,
+                                        size_t* const i,
+                                        size_t* const o) {
+  size_t pos = *i;
+  size_t written = *o;
+  bool ok = true;
+  while (pos < stop) {
+    uint32_t cp;
+    size_t const taken = decode_utf8(in, len, pos, &cp);
+    if (taken == 0) {
+      ok = false;
+      break;
+    }
+    if (cp < 0x10000) {
+      out[written] = swap_le16((uint16_t)cp);
+      written++;
+    } else {
+      out[written] = swap_le16((uint16_t)(0xD800 | ((cp - 0x10000) >> 10)));
+      out[written + 1] = swap_le16((uint16_t)(0xDC00 | (cp & 0x3FF)));
+      written += 2;
+    }
+    pos += taken;
+  }
+  *i = pos;
+  *o = written;
+  return ok;
+}
+
+// Each unit below 0x80 takes 1 byte of UTF-8, each one below 0x800 takes 2, and
+// everything else takes 3, except surrogates: a pair makes 4 bytes between
+// them, so we count 2 each. An unpaired surrogate is an error, so it never
+// makes any output, and counting it can only overestimate.
+static inline size_t utf8_length_from_utf16le_rest (uint16_t const* const ptr,
+                                                    size_t const len) {
   size_t count = 0;
-  size_t const big_strides = len / 64;
-  size_t const small_strides = len % 64;
-  uint8_t const* ptr = (uint8_t const*)&(src[off]);
-  if (big_strides != 0) {
-    uint64_t const matches = broadcast(byte);
-    uint64_t const mask = broadcast(0x7F);
-    for (size_t i = 0; i < big_strides; i++) {
-      uint64_t const* const big_ptr = (uint64_t const* const)ptr;
-      uint64_t result = 0;
-      // Manual 8x loop unroll
-      result |= load_and_set(big_ptr, 0, matches, mask);
-      result |= load_and_set(big_ptr, 1, matches, mask);
-      result |= load_and_set(big_ptr, 2, matches, mask);
-      result |= load_and_set(big_ptr, 3, matches, mask);
-      result |= load_and_set(big_ptr, 4, matches, mask);
-      result |= load_and_set(big_ptr, 5, matches, mask);
-      result |= load_and_set(big_ptr, 6, matches, mask);
-      result |= load_and_set(big_ptr, 7, matches, mask);
-      count += __builtin_popcountll(result);
-      ptr += 64;
+  for (size_t i = 0; i < len; i++) {
+    uint16_t const unit = swap_le16(ptr[i]);
+    if (unit < 0x80) {
+      count += 1;
+    } else if (unit < 0x800 || (unit >= 0xD800 && unit < 0xE000)) {
+      count += 2;
+    } else {
+      count += 3;
     }
   }
-  count += count_eq_rest(ptr, small_strides, byte);
   return count;
 }
+
+// Every sequence starts with one byte which isn't a continuation byte, and
+// makes one unit, except for four-byte ones, which make two.
+static inline size_t utf16le_length_from_utf8_rest (uint8_t const* const ptr,
+                                                    size_t const len) {
+  size_t count = 0;
+  for (size_t i = 0; i < len; i++) {
+    count += ((ptr[i] & 0xC0) != 0x80) + (ptr[i] >= 0xF0);
+  }
+  return count;
+}
+
+// SWAR implementation, used as the fallback everywhere.
+//
+// Only the ASCII check is done a word at a time. A unit is ASCII when all but
+// the low seven bits of both its bytes are clear; which bits those are in a
+// word depends on the machine's byte order.
+
+#if (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+#define NON_ASCII_UNITS 0x80FF80FF80FF80FFULL
+#else
+#define NON_ASCII_UNITS 0xFF80FF80FF80FF80ULL
+#endif
+
+static inline size_t utf16le_to_utf8_swar (uint16_t const* const src,
+                                           size_t const off,
+                                           size_t const len,
+                                           uint8_t* const dst,
+                                           size_t const dst_off,
+                                           size_t* const written) {
+  uint16_t const* const in = (uint16_t const*)&(src[off]);
+  uint8_t* const out = &(dst[dst_off]);
+  size_t i = 0;
+  size_t o = 0;
+  while (i + 4 <= len) {
+    if ((*((uint64_t const*)(in + i)) & NON_ASCII_UNITS) == 0) {
+      for (size_t k = 0; k < 4; k++) {
+        out[o + k] = (uint8_t)swap_le16(in[i + k]);
+      }
+      i += 4;
+      o += 4;
+    } else if (!utf16le_to_utf8_run(in, len, i + 4, out, &i, &o)) {
+      *written = o;
+      return i;
+    }
+  }
+  bool const ok = utf16le_to_utf8_run(in, len, len, out, &i, &o);
+  *written = o;
+  return ok ? len : i;
+}
+
+static inline size_t utf8_to_utf16le_swar (uint8_t const* const src,
+                                           size_t const off,
+                                           size_t const len,
+                                           uint16_t* const dst,
+                                           size_t const dst_off,
+                                           size_t* const written) {
+  uint8_t const* const in = (uint8_t const*)&(src[off]);
+  uint16_t* const out = &(dst[dst_off]);
+  uint64_t const high_bits = broadcast(0x80);
+  size_t i = 0;
+  size_t o = 0;
+  while (i + 8 <= len) {
+    if ((*((uint64_t const*)(in + i)) & high_bits) == 0) {
+      for (size_t k = 0; k < 8; k++) {
+        out[o + k] = swap_le16(in[i + k]);
+      }
+      i += 8;
+      o += 8;
+    } else if (!utf8_to_utf16le_run(in, len, i + 8, out, &i, &o)) {
+      *written = o;
+      return i;
+    }
+  }
+  bool const ok = utf8_to_utf16le_run(in, len, len, out, &i, &o);
+  *written = o;
+  return ok ? len : i;
+}
+
+static inline size_t utf8_length_from_utf16le_swar (uint16_t const* const src,
+                                                    size_t const off,
+                                                    size_t const len) {
+  uint16_t const* const ptr = (uint16_t const*)&(src[off]);
+  size_t count = 0;
+  size_t i = 0;
+  for (; i + 4 <= len; i += 4) {
+    if ((*((uint64_t const*)(ptr + i)) & NON_ASCII_UNITS) == 0) {
+      count += 4;
+    } else {
+      count += utf8_length_from_utf16le_rest(ptr + i, 4);
+    }
+  }
+  return count + utf8_length_from_utf16le_rest(ptr + i, len - i);
+}
+
+// A continuation byte is flagged as in continuation_flags in
+// utf8-codepoints.c; a four-byte lead is one whose top four bits are all set.
+static inline size_t utf16le_length_from_utf8_swar (uint8_t const* const src,
+                                                    size_t const off,
+                                                    size_t const len) {
+  uint8_t const* const ptr = (uint8_t const*)&(src[off]);
+  uint64_t const high_bits = broadcast(0x80);
+  size_t count = 0;
+  size_t i = 0;
+  for (; i + 8 <= len; i += 8) {
+    uint64_t const word = *((uint64_t const*)(ptr + i));
+    uint64_t const continuations = word & ~(word << 1) & high_bits;
+    uint64_t const four_byte = word & (word << 1) & (word << 2) & (word << 3) & high_bits;
+    count += 8 - __builtin_popcountll(continuations) + __builtin_popcountll(four_byte);
+  }
+  return count + utf16le_length_from_utf8_rest(ptr + i, len - i);
+}
+
+#if (DIABLO_HAS_SSE2)
+#include <emmintrin.h>
+
+static inline size_t utf16le_to_utf8_sse (uint16_t const* const src,
+                                          size_t const off,
+                                          size_t const len,
+                                          uint8_t* const dst,
+                                          size_t const dst_off,
+                                          size_t* const written) {
+  uint16_t const* const in = (uint16_t const*)&(src[off]);
+  uint8_t* const out = &(dst[dst_off]);
+  __m128i const zero = _mm_setzero_si128();
+  size_t i = 0;
+  size_t o = 0;
+  while (i + 8 <= len) {
+    __m128i const units = _mm_loadu_si128((__m128i const*)(in + i));
+    __m128i const ascii = _mm_cmpeq_epi16(_mm_and_si128(units, _mm_set1_epi16((short)0xFF80)), zero);
+    __m128i const below_800 = _mm_cmpeq_epi16(_mm_and_si128(units, _mm_set1_epi16((short)0xF800)), zero);
+    if (_mm_movemask_epi8(ascii) == 0xFFFF) {
+      _mm_storel_epi64((__m128i*)(out + o), _mm_packus_epi16(units, units));
+      i += 8;
+      o += 8;
+    } else if (_mm_movemask_epi8(_mm_andnot_si128(ascii, below_800)) == 0xFFFF) {
+      // Each unit becomes 110xxxxx 10xxxxxx, which is one 16-bit lane once
+      // the continuation byte goes in the high half.
+      __m128i const leads = _mm_or_si128(_mm_srli_epi16(units, 6), _mm_set1_epi16(0xC0));
+      __m128i const conts = _mm_or_si128(_mm_and_si128(units, _mm_set1_epi16(0x3F)),
+                                         _mm_set1_epi16(0x80));
+      _mm_storeu_si128((__m128i*)(out + o), _mm_or_si128(leads, _mm_slli_epi16(conts, 8)));
+      i += 8;
+      o += 16;
+    } else if (!utf16le_to_utf8_run(in, len, i + 8, out, &i, &o)) {
+      *written = o;
+      return i;
+    }
+  }
+  bool const ok = utf16le_to_utf8_run(in, len, len, out, &i, &o);
+  *written = o;
+  return ok ? len : i;
+}
+
+// Eight two-byte sequences in a row are eight 16-bit lanes whose low byte is
+// 110xxxxx, whose high byte is 10xxxxxx, and whose lead isn't the overlong
+// 0xC0 or 0xC1.
+static inline size_t utf8_to_utf16le_sse (uint8_t const* const src,
+                                          size_t const off,
+                                          size_t const len,
+                                          uint16_t* const dst,
+                                          size_t const dst_off,
+                                          size_t* const written) {
+  uint8_t const* const in = (uint8_t const*)&(src[off]);
+  uint16_t* const out = &(dst[dst_off]);
+  __m128i const zero = _mm_setzero_si128();
+  size_t i = 0;
+  size_t o = 0;
+  while (i + 16 <= len) {
+    __m128i const bytes = _mm_loadu_si128((__m128i const*)(in + i));
+    __m128i const shape = _mm_cmpeq_epi16(_mm_and_si128(bytes, _mm_set1_epi16((short)0xC0E0)),
+                                          _mm_set1_epi16((short)0x80C0));
+    __m128i const overlong = _mm_cmpeq_epi16(_mm_and_si128(bytes, _mm_set1_epi16(0x1E)), zero);
+    if (_mm_movemask_epi8(bytes) == 0) {
+      _mm_storeu_si128((__m128i*)(out + o), _mm_unpacklo_epi8(bytes, zero));
+      _mm_storeu_si128((__m128i*)(out + o + 8), _mm_unpackhi_epi8(bytes, zero));
+      i += 16;
+      o += 16;
+    } else if (_mm_movemask_epi8(_mm_andnot_si128(overlong, shape)) == 0xFFFF) {
+      __m128i const high = _mm_slli_epi16(_mm_and_si128(bytes, _mm_set1_epi16(0x1F)), 6);
+      __m128i const low = _mm_and_si128(_mm_srli_epi16(bytes, 8), _mm_set1_epi16(0x3F));
+      _mm_storeu_si128((__m128i*)(out + o), _mm_or_si128(high, low));
+      i += 16;
+      o += 8;
+    } else if (!utf8_to_utf16le_run(in, len, i + 16, out, &i, &o)) {
+      *written = o;
+      return i;
+    }
+  }
+  bool const ok = utf8_to_utf16le_run(in, len, len, out, &i, &o);
+  *written = o;
+  return ok ? len : i;
+}
+
+// With every comparison giving 0 or -1, a unit's length is 3 plus whether it's
+// below 0x800, whether it's ASCII, and whether it's a surrogate. We negate the
+// sum, which fits in the low byte of each lane, and add it up with SAD.
+static inline size_t utf8_length_from_utf16le_sse (uint16_t const* const src,
+                                                   size_t const off,
+                                                   size_t const len) {
+  uint16_t const* const ptr = (uint16_t const*)&(src[off]);
+  __m128i const zero = _mm_setzero_si128();
+  __m128i total = zero;
+  size_t i = 0;
+  for (; i + 8 <= len; i += 8) {
+    __m128i const units = _mm_loadu_si128((__m128i const*)(ptr + i));
+    __m128i const top = _mm_and_si128(units, _mm_set1_epi16((short)0xF800));
+    __m128i const summed =
+      _mm_add_epi16(_mm_add_epi16(_mm_cmpeq_epi16(_mm_and_si128(units, _mm_set1_epi16((short)0xFF80)), zero),
+                                  _mm_cmpeq_epi16(top, zero)),
+                    _mm_cmpeq_epi16(top, _mm_set1_epi16((short)0xD800)));
+    total = _mm_add_epi64(total, _mm_sad_epu8(_mm_sub_epi16(zero, summed), zero));
+  }
+  uint64_t results[2];
+  _mm_storeu_si128((__m128i*)results, total);
+  return (3 * i) - (results[0] + results[1]) +
+         utf8_length_from_utf16le_rest(ptr + i, len - i);
+}
+
+// As in utf8-codepoints.c, non-continuation bytes are those above -65 as
+// signed bytes. Four-byte leads are those at least 0xF0, which we check with
+// an unsigned max.
+static inline size_t utf16le_length_from_utf8_sse (uint8_t const* const src,
+                                                   size_t const off,
+                                                   size_t const len) {
+  uint8_t const* const ptr = (uint8_t const*)&(src[off]);
+  __m128i const zero = _mm_setzero_si128();
+  __m128i const threshold = _mm_set1_epi8(-65);
+  __m128i const four_byte = _mm_set1_epi8((char)0xF0);
+  __m128i total = zero;
+  size_t i = 0;
+  for (; i + 16 <= len; i += 16) {
+    __m128i const bytes = _mm_loadu_si128((__m128i const*)(ptr + i));
+    __m128i const summed =
+      _mm_add_epi8(_mm_cmpgt_epi8(bytes, threshold),
+                   _mm_cmpeq_epi8(_mm_max_epu8(bytes, four_byte), bytes));
+    total = _mm_add_epi64(total, _mm_sad_epu8(_mm_sub_epi8(zero, summed), zero));
+  }
+  uint64_t results[2];
+  _mm_storeu_si128((__m128i*)results, total);
+  return results[0] + results[1] + utf16le_length_from_utf8_rest(ptr + i, len - i);
+}
+#endif
+
+#if (DIABLO_HAS_AVX2)
+#include <immintrin.h>
+
+// As utf16le_to_utf8_sse, with blocks of 16 units. packus works within 128-bit
+// halves, so the ASCII case needs its results gathered into the low half.
+__attribute__((target("avx2")))
+static inline size_t utf16le_to_utf8_avx (uint16_t const* const src,
+                                          size_t const off,
+                                          size_t const len,
+                                          uint8_t* const dst,
+                                          size_t const dst_off,
+                                          size_t* const written) {
+  uint16_t const* const in = (uint16_t const*)&(src[off]);
+  uint8_t* const out = &(dst[dst_off]);
+  __m256i const zero = _mm256_setzero_si256();
+  size_t i = 0;
+  size_t o = 0;
+  while (i + 16 <= len) {
+    __m256i const units = _mm256_loadu_si256((__m256i const*)(in + i));
+    __m256i const ascii = _mm256_cmpeq_epi16(_mm256_and_si256(units, _mm256_set1_epi16((short)0xFF80)), zero);
+    __m256i const below_800 = _mm256_cmpeq_epi16(_mm256_and_si256(units, _mm256_set1_epi16((short)0xF800)), zero);
+    if (((uint32_t)_mm256_movemask_epi8(ascii)) == 0xFFFFFFFF) {
+      __m256i const packed = _mm256_permute4x64_epi64(_mm256_packus_epi16(units, units), 0x08);
+      _mm_storeu_si128((__m128i*)(out + o), _mm256_castsi256_si128(packed));
+      i += 16;
+      o += 16;
+    } else if (((uint32_t)_mm256_movemask_epi8(_mm256_andnot_si256(ascii, below_800))) == 0xFFFFFFFF) {
+      __m256i const leads = _mm256_or_si256(_mm256_srli_epi16(units, 6), _mm256_set1_epi16(0xC0));
+      __m256i const conts = _mm256_or_si256(_mm256_and_si256(units, _mm256_set1_epi16(0x3F)),
+                                            _mm256_set1_epi16(0x80));
+      _mm256_storeu_si256((__m256i*)(out + o), _mm256_or_si256(leads, _mm256_slli_epi16(conts, 8)));
+      i += 16;
+      o += 32;
+    } else {
+      if (!utf16le_to_utf8_run(in, len, i + 16, out, &i, &o)) {
+        *written = o;
+        return i;
+      }
+    }
+  }
+  bool const ok = utf16le_to_utf8_run(in, len, len, out, &i, &o);
+  *written = o;
+  return ok ? len : i;
+}
+
+__attribute__((target("avx2")))
+static inline size_t utf8_to_utf16le_avx (uint8_t const* const src,
+                                          size_t const off,
+                                          size_t const len,
+                                          uint16_t* const dst,
+                                          size_t const dst_off,
+                                          size_t* const written) {
+  uint8_t const* const in = (uint8_t const*)&(src[off]);
+  uint16_t* const out = &(dst[dst_off]);
+  __m256i const zero = _mm256_setzero_si256();
+  size_t i = 0;
+  size_t o = 0;
+  while (i + 32 <= len) {
+    __m256i const bytes = _mm256_loadu_si256((__m256i const*)(in + i));
+    __m256i const shape = _mm256_cmpeq_epi16(_mm256_and_si256(bytes, _mm256_set1_epi16((short)0xC0E0)),
+                                             _mm256_set1_epi16((short)0x80C0));
+    __m256i const overlong = _mm256_cmpeq_epi16(_mm256_and_si256(bytes, _mm256_set1_epi16(0x1E)), zero);
+    if (_mm256_movemask_epi8(bytes) == 0) {
+      _mm256_storeu_si256((__m256i*)(out + o),
+                          _mm256_cvtepu8_epi16(_mm256_castsi256_si128(bytes)));
+      _mm256_storeu_si256((__m256i*)(out + o + 16),
+                          _mm256_cvtepu8_epi16(_mm256_extracti128_si256(bytes, 1)));
+      i += 32;
+      o += 32;
+    } else if (((uint32_t)_mm256_movemask_epi8(_mm256_andnot_si256(overlong, shape))) == 0xFFFFFFFF) {
+      __m256i const high = _mm256_slli_epi16(_mm256_and_si256(bytes, _mm256_set1_epi16(0x1F)), 6);
+      __m256i const low = _mm256_and_si256(_mm256_srli_epi16(bytes, 8), _mm256_set1_epi16(0x3F));
+      _mm256_storeu_si256((__m256i*)(out + o), _mm256_or_si256(high, low));
+      i += 32;
+      o += 16;
+    } else {
+      if (!utf8_to_utf16le_run(in, len, i + 32, out, &i, &o)) {
+        *written = o;
+        return i;
+      }
+    }
+  }
+  bool const ok = utf8_to_utf16le_run(in, len, len, out, &i, &o);
+  *written = o;
+  return ok ? len : i;
+}
+
+__attribute__((target("avx2")))
+static inline size_t utf8_length_from_utf16le_avx (uint16_t const* const src,
+                                                   size_t const off,
+                                                   size_t const len) {
+  uint16_t const* const ptr = (uint16_t const*)&(src[off]);
+  __m256i const zero = _mm256_setzero_si256();
+  __m256i total = zero;
+  size_t i = 0;
+  for (; i + 16 <= len; i += 16) {
+    __m256i const units = _mm256_loadu_si256((__m256i const*)(ptr + i));
+    __m256i const top = _mm256_and_si256(units, _mm256_set1_epi16((short)0xF800));
+    __m256i const summed =
+      _mm256_add_epi16(_mm256_add_epi16(_mm256_cmpeq_epi16(_mm256_and_si256(units, _mm256_set1_epi16((short)0xFF80)), zero),
+                                        _mm256_cmpeq_epi16(top, zero)),
+                       _mm256_cmpeq_epi16(top, _mm256_set1_epi16((short)0xD800)));
+    total = _mm256_add_epi64(total, _mm256_sad_epu8(_mm256_sub_epi16(zero, summed), zero));
+  }
+  size_t const negated = _mm256_extract_epi64(total, 0) + _mm256_extract_epi64(total, 1) +
+                         _mm256_extract_epi64(total, 2) + _mm256_extract_epi64(total, 3);
+  return (3 * i) - negated + utf8_length_from_utf16le_rest(ptr + i, len - i);
+}
+
+__attribute__((target("avx2")))
+static inline size_t utf16le_length_from_utf8_avx (uint8_t const* const src,
+                                                   size_t const off,
+                                                   size_t const len) {
+  uint8_t const* const ptr = (uint8_t const*)&(src[off]);
+  __m256i const zero = _mm256_setzero_si256();
+  __m256i const threshold = _mm256_set1_epi8(-65);
+  __m256i const four_byte = _mm256_set1_epi8((char)0xF0);
+  __m256i total = zero;
+  size_t i = 0;
+  for (; i + 32 <= len; i += 32) {
+    __m256i const bytes = _mm256_loadu_si256((__m256i const*)(ptr + i));
+    __m256i const summed =
+      _mm256_add_epi8(_mm256_cmpgt_epi8(bytes, threshold),
+                      _mm256_cmpeq_epi8(_mm256_max_epu8(bytes, four_byte), bytes));
+    total = _mm256_add_epi64(total, _mm256_sad_epu8(_mm256_sub_epi8(zero, summed), zero));
+  }
+  return _mm256_extract_epi64(total, 0) + _mm256_extract_epi64(total, 1) +
+         _mm256_extract_epi64(total, 2) + _mm256_extract_epi64(total, 3) +
+         utf16le_length_from_utf8_rest(ptr + i, len - i);
+}
+#endif
+
+#if (DIABLO_HAS_NEON)
+static inline uint16x8_t load_units_neon (uint16_t const* const ptr) {
+  return vreinterpretq_u16_u8(vld1q_u8((uint8_t const*)ptr));
+}
+
+static inline void store_units_neon (uint16_t* const ptr,
+                                     uint16x8_t const units) {
+  vst1q_u8((uint8_t*)ptr, vreinterpretq_u8_u16(units));
+}
+
+static inline size_t utf16le_to_utf8_neon (uint16_t const* const src,
+                                           size_t const off,
+                                           size_t const len,
+                                           uint8_t* const dst,
+                                           size_t const dst_off,
+                                           size_t* const written) {
+  uint16_t const* const in = (uint16_t const*)&(src[off]);
+  uint8_t* const out = &(dst[dst_off]);
+  size_t i = 0;
+  size_t o = 0;
+  while (i + 8 <= len) {
+    uint16x8_t const units = load_units_neon(in + i);
+    uint16x8_t const non_ascii = vandq_u16(units, vdupq_n_u16(0xFF80));
+    uint16x8_t const two_byte = vandq_u16(vtstq_u16(units, vdupq_n_u16(0xFF80)),
+                                          vceqq_u16(vandq_u16(units, vdupq_n_u16(0xF800)),
+                                                    vdupq_n_u16(0)));
+    if (!any_set(vreinterpretq_u8_u16(non_ascii))) {
+      vst1_u8(out + o, vmovn_u16(units));
+      i += 8;
+      o += 8;
+    } else if (!any_set(vreinterpretq_u8_u16(vmvnq_u16(two_byte)))) {
+      uint16x8_t const leads = vorrq_u16(vshrq_n_u16(units, 6), vdupq_n_u16(0xC0));
+      uint16x8_t const conts = vorrq_u16(vandq_u16(units, vdupq_n_u16(0x3F)),
+                                         vdupq_n_u16(0x80));
+      vst1q_u8(out + o, vreinterpretq_u8_u16(vorrq_u16(leads, vshlq_n_u16(conts, 8))));
+      i += 8;
+      o += 16;
+    } else if (!utf16le_to_utf8_run(in, len, i + 8, out, &i, &o)) {
+      *written = o;
+      return i;
+    }
+  }
+  bool const ok = utf16le_to_utf8_run(in, len, len, out, &i, &o);
+  *written = o;
+  return ok ? len : i;
+}
+
+static inline size_t utf8_to_utf16le_neon (uint8_t const* const src,
+                                           size_t const off,
+                                           size_t const len,
+                                           uint16_t* const dst,
+                                           size_t const dst_off,
+                                           size_t* const written) {
+  uint8_t const* const in = (uint8_t const*)&(src[off]);
+  uint16_t* const out = &(dst[dst_off]);
+  size_t i = 0;
+  size_t o = 0;
+  while (i + 16 <= len) {
+    uint8x16_t const bytes = vld1q_u8(in + i);
+    uint16x8_t const pairs = vreinterpretq_u16_u8(bytes);
+    uint16x8_t const two_byte =
+      vandq_u16(vceqq_u16(vandq_u16(pairs, vdupq_n_u16(0xC0E0)), vdupq_n_u16(0x80C0)),
+                vtstq_u16(pairs, vdupq_n_u16(0x1E)));
+    if (!any_set(vandq_u8(bytes, vdupq_n_u8(0x80)))) {
+      store_units_neon(out + o, vmovl_u8(vget_low_u8(bytes)));
+      store_units_neon(out + o + 8, vmovl_u8(vget_high_u8(bytes)));
+      i += 16;
+      o += 16;
+    } else if (!any_set(vreinterpretq_u8_u16(vmvnq_u16(two_byte)))) {
+      uint16x8_t const high = vshlq_n_u16(vandq_u16(pairs, vdupq_n_u16(0x1F)), 6);
+      uint16x8_t const low = vandq_u16(vshrq_n_u16(pairs, 8), vdupq_n_u16(0x3F));
+      store_units_neon(out + o, vorrq_u16(high, low));
+      i += 16;
+      o += 8;
+    } else if (!utf8_to_utf16le_run(in, len, i + 16, out, &i, &o)) {
+      *written = o;
+      return i;
+    }
+  }
+  bool const ok = utf8_to_utf16le_run(in, len, len, out, &i, &o);
+  *written = o;
+  return ok ? len : i;
+}
+
+// The same sum as utf8_length_from_utf16le_sse, added up with pairwise adds.
+static inline size_t utf8_length_from_utf16le_neon (uint16_t const* const src,
+                                                    size_t const off,
+                                                    size_t const len) {
+  uint16_t const* const ptr = (uint16_t const*)&(src[off]);
+  uint64x2_t total = vdupq_n_u64(0);
+  size_t i = 0;
+  for (; i + 8 <= len; i += 8) {
+    uint16x8_t const units = load_units_neon(ptr + i);
+    uint16x8_t const top = vandq_u16(units, vdupq_n_u16(0xF800));
+    uint16x8_t const summed =
+      vaddq_u16(vaddq_u16(vceqq_u16(vandq_u16(units, vdupq_n_u16(0xFF80)), vdupq_n_u16(0)),
+                          vceqq_u16(top, vdupq_n_u16(0))),
+                vceqq_u16(top, vdupq_n_u16(0xD800)));
+    uint16x8_t const negated = vsubq_u16(vdupq_n_u16(0), summed);
+    total = vaddq_u64(total, vpaddlq_u32(vpaddlq_u16(negated)));
+  }
+  size_t const negated = vgetq_lane_u64(total, 0) + vgetq_lane_u64(total, 1);
+  return (3 * i) - negated + utf8_length_from_utf16le_rest(ptr + i, len - i);
+}
+
+static inline size_t utf16le_length_from_utf8_neon (uint8_t const* const src,
+                                                    size_t const off,
+                                                    size_t const len) {
+  uint8_t const* const ptr = (uint8_t const*)&(src[off]);
+  uint64x2_t total = vdupq_n_u64(0);
+  size_t i = 0;
+  for (; i + 16 <= len; i += 16) {
+    uint8x16_t const bytes = vld1q_u8(ptr + i);
+    int8x16_t const summed =
+      vaddq_s8(vreinterpretq_s8_u8(vcgtq_s8(vreinterpretq_s8_u8(bytes), vdupq_n_s8(-65))),
+               vreinterpretq_s8_u8(vcgeq_u8(bytes, vdupq_n_u8(0xF0))));
+    uint8x16_t const absolute = vreinterpretq_u8_s8(vabsq_s8(summed));
+    total = vaddq_u64(total, vpaddlq_u32(vpaddlq_u16(vpaddlq_u8(absolute))));
+  }
+  return vgetq_lane_u64(total, 0) + vgetq_lane_u64(total, 1) +
+         utf16le_length_from_utf8_rest(ptr + i, len - i);
+}
+#endif
+
+typedef size_t (*utf16le_to_utf8_kernel) (uint16_t const* const,
+                                          size_t const,
+                                          size_t const,
+                                          uint8_t* const,
+                                          size_t const,
+                                          size_t* const);
+
+// The AVX2 kernels do for AVX-512BW: two-byte and ASCII blocks are already
+// limited by stores at that width.
+static utf16le_to_utf8_kernel const utf16le_to_utf8_kernels[DIABLO_BACKEND_COUNT] = {
+  [DIABLO_BACKEND_SWAR] = utf16le_to_utf8_swar,
+#if (DIABLO_HAS_SSE2)
+  [DIABLO_BACKEND_SSE2] = utf16le_to_utf8_sse,
 #endif
+#if (DIABLO_HAS_SSSE3)
+  [DIABLO_BACKEND_SSSE3] = utf16le_to_utf8_sse,
+#endif
+#if (DIABLO_HAS_AVX2)
+  [DIABLO_BACKEND_AVX2] = utf16le_to_utf8_avx,
+#endif
+#if (DIABLO_HAS_NEON)
+  [DIABLO_BACKEND_NEON] = utf16le_to_utf8_neon,
+#endif
+#if (DIABLO_HAS_AVX512BW)
+  [DIABLO_BACKEND_AVX512BW] = utf16le_to_utf8_avx,
+#endif
+};
+
+typedef size_t (*utf8_to_utf16le_kernel) (uint8_t const* const,
+                                          size_t const,
+                                          size_t const,
+                                          uint16_t* const,
+                                          size_t const,
+                                          size_t* const);
+
+static utf8_to_utf16le_kernel const utf8_to_utf16le_kernels[DIABLO_BACKEND_COUNT] = {
+  [DIABLO_BACKEND_SWAR] = utf8_to_utf16le_swar,
+#if (DIABLO_HAS_SSE2)
+  [DIABLO_BACKEND_SSE2] = utf8_to_utf16le_sse,
+#endif
+#if (DIABLO_HAS_SSSE3)
+  [DIABLO_BACKEND_SSSE3] = utf8_to_utf16le_sse,
+#endif
+#if (DIABLO_HAS_AVX2)
+  [DIABLO_BACKEND_AVX2] = utf8_to_utf16le_avx,
+#endif
+#if (DIABLO_HAS_NEON)
+  [DIABLO_BACKEND_NEON] = utf8_to_utf16le_neon,
+#endif
+#if (DIABLO_HAS_AVX512BW)
+  [DIABLO_BACKEND_AVX512BW] = utf8_to_utf16le_avx,
+#endif
+};
+
+typedef size_t (*utf8_length_from_utf16le_kernel) (uint16_t const* const,
+                                                   size_t const,
+                                                   size_t const);
+
+static utf8_length_from_utf16le_kernel const utf8_length_from_utf16le_kernels[DIABLO_BACKEND_COUNT] = {
+  [DIABLO_BACKEND_SWAR] = utf8_length_from_utf16le_swar,
+#if (DIABLO_HAS_SSE2)
+  [DIABLO_BACKEND_SSE2] = utf8_length_from_utf16le_sse,
+#endif
+#if (DIABLO_HAS_SSSE3)
+  [DIABLO_BACKEND_SSSE3] = utf8_length_from_utf16le_sse,
+#endif
+#if (DIABLO_HAS_AVX2)
+  [DIABLO_BACKEND_AVX2] = utf8_length_from_utf16le_avx,
+#endif
+#if (DIABLO_HAS_NEON)
+  [DIABLO_BACKEND_NEON] = utf8_length_from_utf16le_neon,
+#endif
+#if (DIABLO_HAS_AVX512BW)
+  [DIABLO_BACKEND_AVX512BW] = utf8_length_from_utf16le_avx,
+#endif
+};
+
+typedef size_t (*utf16le_length_from_utf8_kernel) (uint8_t const* const,
+                                                   size_t const,
+                                                   size_t const);
+
+static utf16le_length_from_utf8_kernel const utf16le_length_from_utf8_kernels[DIABLO_BACKEND_COUNT] = {
+  [DIABLO_BACKEND_SWAR] = utf16le_length_from_utf8_swar,
+#if (DIABLO_HAS_SSE2)
+  [DIABLO_BACKEND_SSE2] = utf16le_length_from_utf8_sse,
+#endif
+#if (DIABLO_HAS_SSSE3)
+  [DIABLO_BACKEND_SSSE3] = utf16le_length_from_utf8_sse,
+#endif
+#if (DIABLO_HAS_AVX2)
+  [DIABLO_BACKEND_AVX2] = utf16le_length_from_utf8_avx,
+#endif
+#if (DIABLO_HAS_NEON)
+  [DIABLO_BACKEND_NEON] = utf16le_length_from_utf8_neon,
+#endif
+#if (DIABLO_HAS_AVX512BW)
+  [DIABLO_BACKEND_AVX512BW] = utf16le_length_from_utf8_avx,
+#endif
+};
+
+size_t diablo_utf16le_to_utf8 (uint16_t const* const src,
+                               size_t const off,
+                               size_t const len,
+                               uint8_t* const dst,
+                               size_t const dst_off,
+                               size_t* const written) {
+  STATS_RECORD(STATS_UTF16LE_TO_UTF8, 2 * len);
+  return utf16le_to_utf8_kernels[active_backend()](src, off, len,
+                                                   dst, dst_off, written);
+}
+
+size_t diablo_utf8_to_utf16le (uint8_t const* const src,
+                               size_t const off,
+                               size_t const len,
+                               uint16_t* const dst,
+                               size_t const dst_off,
+                               size_t* const written) {
+  STATS_RECORD(STATS_UTF8_TO_UTF16LE, len);
+  return utf8_to_utf16le_kernels[active_backend()](src, off, len,
+                                                   dst, dst_off, written);
+}
+
+size_t diablo_utf8_length_from_utf16le (uint16_t const* const src,
+                                        size_t const off,
+                                        size_t const len) {
+  STATS_RECORD(STATS_UTF8_LENGTH_FROM_UTF16LE, 2 * len);
+  return utf8_length_from_utf16le_kernels[active_backend()](src, off, len);
+}
 
+size_t diablo_utf16le_length_from_utf8 (uint8_t const* const src,
+                                        size_t const off,
+                                        size_t const len) {
+  STATS_RECORD(STATS_UTF16LE_LENGTH_FROM_UTF8, len);
+  return utf16le_length_from_utf8_kernels[active_backend()](src, off, len);
+}
@@ -0,0 +1,295 @@
+/*
+ * Copyright 2021 Koz Ross <koz.ross@retro-freedom.nz>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "../include/diablo.h"
+
+// Native benchmark for diablo_count_eq.
+//
+// Sweeps input length, starting misalignment and match density, running every
+// backend this machine supports, plus the naive loop in count-eq-baseline.c.
+// The naive loop is also what every backend uses for its tail, so short
+// lengths measure that as well.
+//
+// Results go to stdout as CSV, one row per measurement, with a header:
+//
+// impl,len,misalign,density,iters,ns_per_call,gb_per_s,cycles_per_byte
+//
+// Timing is the fastest of several samples, each at least --min-time
+// milliseconds long. On x86, cycles come from __rdtsc, which counts reference
+// cycles at a fixed rate (usually the base clock), not core cycles: with turbo
+// or frequency scaling, cycles_per_byte won't match what the core actually
+// spent. Elsewhere, they are computed from --ghz, and are 'nan' if that isn't
+// given.
+//
+// Before timing anything for a given length, misalignment and density, every
+// backend's answer is checked against the baseline; on a mismatch, we report it
+// on stderr and exit with a failure.
+//
+// Options:
+//
+// --max-len N   Largest length to measure, in bytes (default 64 MiB).
+// --min-time N  Minimum length of each sample, in milliseconds (default 1).
+// --ghz F       Clock speed to use for cycles/byte where we can't read the
+//               timestamp counter.
+// --help        Print a usage summary and exit.
+
+#if (__x86_64__ || __i386__)
+#include <x86intrin.h>
+#define HAVE_TSC 1
+#endif
+
+size_t count_eq_baseline(uint8_t const* const src,
+                         size_t const off,
+                         size_t const len,
+                         uint8_t const byte);
+
+// What we count.
+#define NEEDLE 0x0A
+
+// How many samples we take of each measurement.
+#define SAMPLES 5
+
+#define USAGE \
+  "usage: %s [--help] [--max-len BYTES] [--min-time MS] [--ghz GHZ]\n"
+
+static size_t const small_lens[] = {0,  1,  2,  3,  4,  7,  8,  15,
+                                    16, 31, 32, 33, 48, 63, 64, 65};
+
+static size_t const misaligns[] = {0, 1, 7, 33};
+
+// Matches per 256 bytes.
+static unsigned const densities[] = {0, 1, 64, 128, 256};
+
+static diablo_backend const backends[] = {
+    DIABLO_BACKEND_SWAR, DIABLO_BACKEND_SSE2, DIABLO_BACKEND_AVX2,
+    DIABLO_BACKEND_NEON, DIABLO_BACKEND_AVX512BW, DIABLO_BACKEND_SSSE3};
+
+// Keeps results alive, so the calls can't be optimized away.
+static size_t volatile sink;
+
+// xorshift64*, so runs are reproducible.
+static uint64_t next_random(uint64_t* const state) {
+  *state ^= *state >> 12;
+  *state ^= *state << 25;
+  *state ^= *state >> 27;
+  return *state * 0x2545F4914F6CDD1DULL;
+}
+
+// Fill the buffer so that, on average, density out of every 256 bytes are the
+// needle.
+static void fill(uint8_t* const buf, size_t const len, unsigned const density) {
+  uint64_t state = 0x9E3779B97F4A7C15ULL;
+  for (size_t i = 0; i < len; i++) {
+    uint64_t const r = next_random(&state);
+    if ((r & 0xFF) < density) {
+      buf[i] = NEEDLE;
+    } else {
+      uint8_t const other = (uint8_t)(r >> 8);
+      buf[i] = (other == NEEDLE) ? (uint8_t)(NEEDLE + 1) : other;
+    }
+  }
+}
+
+static double now_ns(void) {
+  struct timespec ts;
+  timespec_get(&ts, TIME_UTC);
+  return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+static uint64_t now_cycles(void) {
+#if (HAVE_TSC)
+  return __rdtsc();
+#else
+  return 0;
+#endif
+}
+
+typedef struct {
+  double ns;
+  double cycles;
+} timing;
+
+// Time iters calls; a NULL kernel means the library's diablo_count_eq.
+static timing run(size_t (*const kernel)(uint8_t const* const,
+                                         size_t const,
+                                         size_t const,
+                                         uint8_t const),
+                  uint8_t const* const buf,
+                  size_t const off,
+                  size_t const len,
+                  size_t const iters) {
+  size_t acc = 0;
+  double const start_ns = now_ns();
+  uint64_t const start_cycles = now_cycles();
+  if (kernel == NULL) {
+    for (size_t i = 0; i < iters; i++) {
+      acc += diablo_count_eq(buf, off, len, NEEDLE);
+    }
+  } else {
+    for (size_t i = 0; i < iters; i++) {
+      acc += kernel(buf, off, len, NEEDLE);
+    }
+  }
+  uint64_t const end_cycles = now_cycles();
+  double const end_ns = now_ns();
+  sink = acc;
+  timing const result = {end_ns - start_ns,
+                         (double)(end_cycles - start_cycles)};
+  return result;
+}
+
+static void measure(char const* const name,
+                    size_t (*const kernel)(uint8_t const* const,
+                                           size_t const,
+                                           size_t const,
+                                           uint8_t const),
+                    uint8_t const* const buf,
+                    size_t const misalign,
+                    size_t const len,
+                    unsigned const density,
+                    double const min_ns,
+                    double const ghz) {
+  // Find an iteration count that takes at least min_ns.
+  size_t iters = 1;
+  for (;;) {
+    timing const t = run(kernel, buf, misalign, len, iters);
+    if (t.ns >= min_ns) {
+      break;
+    }
+    iters *= 2;
+  }
+  timing best = run(kernel, buf, misalign, len, iters);
+  for (size_t i = 1; i < SAMPLES; i++) {
+    timing const t = run(kernel, buf, misalign, len, iters);
+    if (t.ns < best.ns) {
+      best = t;
+    }
+  }
+  double const ns_per_call = best.ns / (double)iters;
+  double const gb_per_s = (len == 0) ? 0.0 : (double)len / ns_per_call;
+  double cycles_per_byte = NAN;
+  if (len != 0) {
+#if (HAVE_TSC)
+    (void)ghz;
+    cycles_per_byte = best.cycles / ((double)iters * (double)len);
+#else
+    if (ghz > 0.0) {
+      cycles_per_byte = (ns_per_call * ghz) / (double)len;
+    }
+#endif
+  }
+  printf("%s,%zu,%zu,%u,%zu,%.3f,%.3f,%.4f\n", name, len, misalign, density,
+         iters, ns_per_call, gb_per_s, cycles_per_byte);
+  fflush(stdout);
+}
+
+// Check that every backend this machine supports agrees with the baseline,
+// so we never report a time for a wrong answer. Leaves the backend unchanged.
+static bool verify(uint8_t const* const buf,
+                   size_t const misalign,
+                   size_t const len,
+                   unsigned const density) {
+  diablo_backend const chosen = diablo_get_backend();
+  size_t const expected = count_eq_baseline(buf, misalign, len, NEEDLE);
+  bool ok = true;
+  for (size_t b = 0; b < sizeof(backends) / sizeof(diablo_backend); b++) {
+    if (diablo_set_backend(backends[b])) {
+      size_t const actual = diablo_count_eq(buf, misalign, len, NEEDLE);
+      if (actual != expected) {
+        fprintf(stderr,
+                "%s: counted %zu, expected %zu (len %zu, misalign %zu, "
+                "density %u)\n",
+                diablo_backend_name(backends[b]), actual, expected, len,
+                misalign, density);
+        ok = false;
+      }
+    }
+  }
+  diablo_set_backend(chosen);
+  return ok;
+}
+
+int main(int argc, char** argv) {
+  size_t max_len = 64 * 1024 * 1024;
+  double min_ms = 1.0;
+  double ghz = 0.0;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--help") == 0) {
+      printf(USAGE, argv[0]);
+      return EXIT_SUCCESS;
+    } else if (i + 1 < argc && strcmp(argv[i], "--max-len") == 0) {
+      max_len = (size_t)strtoull(argv[++i], NULL, 10);
+    } else if (i + 1 < argc && strcmp(argv[i], "--min-time") == 0) {
+      min_ms = strtod(argv[++i], NULL);
+    } else if (i + 1 < argc && strcmp(argv[i], "--ghz") == 0) {
+      ghz = strtod(argv[++i], NULL);
+    } else {
+      fprintf(stderr, USAGE, argv[0]);
+      return EXIT_FAILURE;
+    }
+  }
+  // Room for the largest length, the largest misalignment, and aligning the
+  // start of the buffer to a cache line ourselves.
+  size_t const max_misalign = misaligns[sizeof(misaligns) / sizeof(size_t) - 1];
+  uint8_t* const raw = malloc(max_len + max_misalign + 64);
+  if (raw == NULL) {
+    fprintf(stderr, "could not allocate %zu bytes\n", max_len);
+    return EXIT_FAILURE;
+  }
+  uint8_t* const buf = raw + ((64 - ((uintptr_t)raw % 64)) % 64);
+  diablo_backend const chosen = diablo_get_backend();
+  printf("impl,len,misalign,density,iters,ns_per_call,gb_per_s,"
+         "cycles_per_byte\n");
+  for (size_t d = 0; d < sizeof(densities) / sizeof(unsigned); d++) {
+    fill(buf, max_len + max_misalign, densities[d]);
+    // Every small length, then powers of two up to the maximum.
+    size_t len_index = 0;
+    size_t len = small_lens[0];
+    while (len <= max_len) {
+      for (size_t m = 0; m < sizeof(misaligns) / sizeof(size_t); m++) {
+        if (!verify(buf, misaligns[m], len, densities[d])) {
+          free(raw);
+          return EXIT_FAILURE;
+        }
+        measure("baseline", count_eq_baseline, buf, misaligns[m], len,
+                densities[d], min_ms * 1e6, ghz);
+        for (size_t b = 0; b < sizeof(backends) / sizeof(diablo_backend);
+             b++) {
+          if (diablo_set_backend(backends[b])) {
+            measure(diablo_backend_name(backends[b]), NULL, buf, misaligns[m],
+                    len, densities[d], min_ms * 1e6, ghz);
+          }
+        }
+      }
+      len_index++;
+      if (len_index < sizeof(small_lens) / sizeof(size_t)) {
+        len = small_lens[len_index];
+      } else if (len < 128) {
+        len = 128;
+      } else if (len > max_len / 2) {
+        break;
+      } else {
+        len *= 2;
+      }
+    }
+  }
+  diablo_set_backend(chosen);
+  free(raw);
+  return EXIT_SUCCESS;
+}
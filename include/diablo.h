@@ -14,9 +14,118 @@
  * limitations under the License.
  */
 #pragma once
+#include <stdbool.h>
 #include <stdint.h>
 #include <stdlib.h>
 
+// Backends
+//
+// Every operation has one implementation ('kernel') per backend it supports.
+// The best backend for the current machine is chosen on first use, and every
+// later call goes straight to its kernels. You only need the functions below if
+// you want to know which one was picked, or to force a different one (for
+// example, to test or benchmark every kernel on the same machine).
+
+typedef enum {
+  // Portable 64-bit word tricks; available everywhere.
+  DIABLO_BACKEND_SWAR = 0,
+  // x86 and x86-64 with SSE2.
+  DIABLO_BACKEND_SSE2 = 1,
+  // x86-64 with AVX2, detected at runtime.
+  DIABLO_BACKEND_AVX2 = 2,
+  // ARM with NEON.
+  DIABLO_BACKEND_NEON = 3,
+  // x86-64 with AVX-512BW, detected at runtime.
+  DIABLO_BACKEND_AVX512BW = 4,
+  // x86 and x86-64 with SSSE3, detected at runtime. Operations which don't
+  // need byte shuffles use the SSE2 kernels here.
+  DIABLO_BACKEND_SSSE3 = 5
+} diablo_backend;
+
+// The backend currently in use. Chooses one if this hasn't happened yet.
+diablo_backend diablo_get_backend(void);
+
+// Whether this build contains the given backend, and the current machine can
+// run it.
+bool diablo_backend_supported(diablo_backend const backend);
+
+// Use the given backend for all subsequent calls. Returns false, and changes
+// nothing, if the backend isn't supported.
+//
+// Calls already in progress on other threads finish on whichever backend they
+// started with.
+bool diablo_set_backend(diablo_backend const backend);
+
+// Undo any forcing, choose the best backend for this machine again, and return
+// it.
+diablo_backend diablo_reset_backend(void);
+
+// A short, human-readable name for the given backend.
+char const* diablo_backend_name(diablo_backend const backend);
+
+// Threads
+//
+// Operations whose names end in _parallel split long inputs between several
+// threads, using a pool which is started on first use, then kept for later
+// calls. If two calls want the pool at once, or the platform has no C11
+// threads, the work happens on the calling thread instead.
+
+// How many threads, including the calling one, the parallel operations use. By
+// default, this is one per online CPU.
+size_t diablo_get_threads(void);
+
+// Set how many threads the parallel operations use, including the calling one.
+// 0 goes back to the default. At most 64 are ever used.
+void diablo_set_threads(size_t const threads);
+
+// How long, in bytes, an input must be before the parallel operations use more
+// than one thread. By default, this is 4 MiB.
+size_t diablo_get_parallel_threshold(void);
+
+// Set how long an input must be before the parallel operations use more than
+// one thread.
+void diablo_set_parallel_threshold(size_t const bytes);
+
+// Statistics
+//
+// Builds made with the 'stats' meson option (or, for the amalgamation, with
+// DIABLO_STATS defined to 1) count every call to every operation on a range:
+// everything from "Counting" onwards, bar the functions which only work out
+// lengths. Each thread counts on its own, so this costs a few increments per
+// call, and nothing is shared until you ask for totals. Other builds count
+// nothing, and don't have the functions below.
+
+// What a build with statistics has counted for one operation, across every
+// thread, since the start or the last diablo_reset_stats.
+typedef struct {
+  uint64_t calls;
+  // The total length, in bytes, of the input. For operations on two ranges,
+  // this is the shorter one; for diablo_count_eq_batch, it's every slice
+  // together; rank and select queries have none.
+  uint64_t bytes;
+  // Calls made while each backend was active, indexed by diablo_backend.
+  uint64_t backends[DIABLO_BACKEND_SSSE3 + 1];
+  // Calls by input length: lengths[0] counts those of 0 bytes, and lengths[k]
+  // those of at least 2^(k - 1) bytes, but fewer than 2^k.
+  uint64_t lengths[65];
+} diablo_stats;
+
+// How many operations are counted. They are numbered from 0.
+size_t diablo_stats_functions(void);
+
+// The name of the given operation's function, such as "diablo_count_eq", or
+// NULL if there's no such operation.
+char const* diablo_stats_name(size_t const function);
+
+// Write the given operation's counts to out. Returns false, and writes
+// nothing, if there's no such operation.
+//
+// Calls on other threads at the same time may or may not be included.
+bool diablo_get_stats(size_t const function, diablo_stats* const out);
+
+// Start counting again from zero, for every operation.
+void diablo_reset_stats(void);
+
 // Counting
 
 // Count the bytes in the range equal to the given one.
@@ -24,3 +133,687 @@ size_t diablo_count_eq(uint8_t const* const src,
                        size_t const off,
                        size_t const len,
                        uint8_t const byte);
+
+// As diablo_count_eq, but splits the range between threads if it's long
+// enough. See "Threads" above.
+size_t diablo_count_eq_parallel(uint8_t const* const src,
+                                size_t const off,
+                                size_t const len,
+                                uint8_t const byte);
+
+// Count the bytes in the range equal to each of needles_len needles, in one
+// pass, writing the count for needles[i] to counts[i]. Up to eight needles
+// take the same time as one; beyond that, every eight need another pass.
+void diablo_count_eq_multi(uint8_t const* const src,
+                           size_t const off,
+                           size_t const len,
+                           uint8_t const* const needles,
+                           size_t const needles_len,
+                           size_t* const counts);
+
+// A range of bytes: len of them, starting at src[off].
+typedef struct {
+  uint8_t const* src;
+  size_t off;
+  size_t len;
+} diablo_slice;
+
+// Count the bytes equal to the given one in each of slices_len slices, writing
+// the count for slices[i] to counts[i]. This is much faster than calling
+// diablo_count_eq on each slice when they're short.
+void diablo_count_eq_batch(diablo_slice const* const slices,
+                           size_t const slices_len,
+                           uint8_t const byte,
+                           size_t* const counts);
+
+// Count the bytes in the range which are members of the given set. The set is
+// 32 bytes long, and is a bitmap: a byte b is a member exactly when bit (b % 8)
+// of set[b / 8] is 1.
+size_t diablo_count_in_set(uint8_t const* const src,
+                           size_t const off,
+                           size_t const len,
+                           uint8_t const* const set);
+
+// Count the 1 bits in the range.
+size_t diablo_popcount(uint8_t const* const src,
+                       size_t const off,
+                       size_t const len);
+
+// Count every byte value in the range, adding the counts to hist, which must
+// have 256 entries: hist[b] goes up by the number of bytes equal to b. Zero it
+// first for a fresh histogram; leave it as-is to accumulate over several
+// ranges.
+void diablo_byte_histogram(uint8_t const* const src,
+                           size_t const off,
+                           size_t const len,
+                           size_t* const hist);
+
+// Searching
+//
+// Positions are relative to the start of the range: 0 is src[off].
+
+// The position of the first byte in the range equal to the given one, or len if
+// there isn't one.
+size_t diablo_find_first_eq(uint8_t const* const src,
+                            size_t const off,
+                            size_t const len,
+                            uint8_t const byte);
+
+// The position of the last byte in the range equal to the given one, or len if
+// there isn't one.
+size_t diablo_find_last_eq(uint8_t const* const src,
+                           size_t const off,
+                           size_t const len,
+                           uint8_t const byte);
+
+// Write the positions of the bytes in the range equal to the given one into
+// out, in order, stopping once out_len have been written. Returns how many were
+// written.
+//
+// If that is out_len, there may be more. To continue, call again on the part of
+// the range after the last position written, and add that part's start to
+// what you get back.
+size_t diablo_find_all_eq(uint8_t const* const src,
+                          size_t const off,
+                          size_t const len,
+                          uint8_t const byte,
+                          size_t* const out,
+                          size_t const out_len);
+
+// Comparing
+
+// The position of the first byte at which the len bytes starting at a[a_off]
+// differ from the len bytes starting at b[b_off], or len if they're the same.
+// This is also the length of their longest common prefix.
+size_t diablo_mismatch(uint8_t const* const a,
+                       size_t const a_off,
+                       uint8_t const* const b,
+                       size_t const b_off,
+                       size_t const len);
+
+// Compare the a_len bytes starting at a[a_off] with the b_len bytes starting at
+// b[b_off] lexicographically, as unsigned bytes, in the manner of memcmp. A
+// range which is a prefix of the other is the lesser. Returns a negative
+// number, zero or a positive number, as the first range is less than, equal to
+// or greater than the second.
+int diablo_compare(uint8_t const* const a,
+                   size_t const a_off,
+                   size_t const a_len,
+                   uint8_t const* const b,
+                   size_t const b_off,
+                   size_t const b_len);
+
+// Hashing
+//
+// These compute XXH3 (from xxHash 0.8), in its 64-bit form with a seed: a
+// fast, well-distributed hash, suitable for hash tables, but not for anything
+// where someone might choose inputs to collide on purpose. Results are the same
+// on every machine and backend, and the same as XXH3_64bits_withSeed from
+// xxHash itself.
+
+// The hash of the range with the given seed.
+uint64_t diablo_hash64(uint8_t const* const src,
+                       size_t const off,
+                       size_t const len,
+                       uint64_t const seed);
+
+// A hash of input that arrives in chunks. Treat the fields as private.
+typedef struct {
+  uint64_t acc[8];
+  uint64_t seed;
+  uint64_t len;
+  size_t buffered;
+  size_t stripes;
+  uint8_t secret[192];
+  uint8_t buffer[256];
+} diablo_hash64_state;
+
+// Start hashing afresh with the given seed.
+void diablo_hash64_init(diablo_hash64_state* const state, uint64_t const seed);
+
+// Add the range to what the state has hashed so far. However the input is
+// split into ranges, the result is the same.
+void diablo_hash64_update(diablo_hash64_state* const state,
+                          uint8_t const* const src,
+                          size_t const off,
+                          size_t const len);
+
+// The hash of everything added to the state since it was started: the same as
+// diablo_hash64 of all of it, with the same seed. This doesn't change the state,
+// so you can keep adding to it afterwards.
+uint64_t diablo_hash64_finish(diablo_hash64_state const* const state);
+
+// Indexing
+//
+// Bitmaps have one bit per byte of the range: bit (i % 64) of out[i / 64] is
+// for the byte at position i, relative to src[off]. out must have room for
+// (len + 63) / 64 words; bits past the end of the range are 0.
+
+// Write a bitmap of the bytes in the range which are members of the given set
+// to out. The set is as for diablo_count_in_set.
+void diablo_structural_bitmap(uint8_t const* const src,
+                              size_t const off,
+                              size_t const len,
+                              uint8_t const* const set,
+                              uint64_t* const out);
+
+// As diablo_structural_bitmap, but leaving out members of the set which are
+// between a pair of quote bytes. Quote bytes themselves are never left out,
+// and a doubled quote inside quotes (as CSV uses for escaping) closes then
+// reopens them, so it changes nothing.
+//
+// in_quotes says whether the range starts inside quotes; the return value says
+// whether it ends inside them. To index input in chunks, pass each chunk's
+// return value to the next one.
+bool diablo_structural_bitmap_quoted(uint8_t const* const src,
+                                     size_t const off,
+                                     size_t const len,
+                                     uint8_t const* const set,
+                                     uint8_t const quote,
+                                     bool const in_quotes,
+                                     uint64_t* const out);
+
+// Rank and select
+//
+// These answer queries about an array of len bits, where bit i is bit (i % 64)
+// of bits[i / 64], as for the bitmaps above. The bits past the end of the last
+// word don't matter. Positions count from 0.
+
+// A rank/select directory over an array of bits. It points to the bits and to
+// the storage given to diablo_rank_select_init, neither of which may change or
+// go away while it's in use. Treat the fields as private.
+typedef struct {
+  uint64_t const* bits;
+  size_t len;
+  size_t ones;
+  uint64_t* directory;
+} diablo_rank_select;
+
+// How many words of storage diablo_rank_select_init needs for an array of len
+// bits. This is about a quarter of the array's own size.
+size_t diablo_rank_select_size(size_t const len);
+
+// Build a directory over the array of len bits, using directory for storage,
+// which must have room for diablo_rank_select_size(len) words. This takes one
+// pass over the array.
+void diablo_rank_select_init(diablo_rank_select* const rs,
+                             uint64_t const* const bits,
+                             size_t const len,
+                             uint64_t* const directory);
+
+// The number of 1 bits before position pos. Any pos of len or more gives the
+// number in the whole array. This takes constant time.
+size_t diablo_rank1(diablo_rank_select const* const rs, size_t const pos);
+
+// As diablo_rank1, but counting 0 bits.
+size_t diablo_rank0(diablo_rank_select const* const rs, size_t const pos);
+
+// The position of 1 bit number n (counting from 0), or len if the array has n
+// or fewer. This takes constant time, plus a binary search over the stretch of
+// the array holding the nearest few thousand 1 bits.
+size_t diablo_select1(diablo_rank_select const* const rs, size_t const n);
+
+// As diablo_select1, but for 0 bits.
+size_t diablo_select0(diablo_rank_select const* const rs, size_t const n);
+
+// Translating
+//
+// These write len bytes starting at dst[dst_off], one for each byte of the
+// range starting at src[src_off]. To work in place, pass the same buffer and
+// offset for both; otherwise, the two must not overlap.
+
+// Replace every byte b of the range with table[b]. The table must have 256
+// entries.
+void diablo_translate(uint8_t const* const src,
+                      size_t const src_off,
+                      uint8_t* const dst,
+                      size_t const dst_off,
+                      size_t const len,
+                      uint8_t const* const table);
+
+// Add delta (wrapping around) to every byte of the range from lo to hi
+// inclusive, and leave the others alone. If lo > hi, no byte changes. For
+// example, lo = 'A', hi = 'Z' and delta = 32 make ASCII lower case. This is
+// much faster than diablo_translate with the equivalent table.
+void diablo_translate_range(uint8_t const* const src,
+                            size_t const src_off,
+                            uint8_t* const dst,
+                            size_t const dst_off,
+                            size_t const len,
+                            uint8_t const lo,
+                            uint8_t const hi,
+                            uint8_t const delta);
+
+// Replace every byte of the range equal to from with to, and leave the others
+// alone.
+void diablo_replace_eq(uint8_t const* const src,
+                       size_t const src_off,
+                       uint8_t* const dst,
+                       size_t const dst_off,
+                       size_t const len,
+                       uint8_t const from,
+                       uint8_t const to);
+
+// ASCII
+
+// Whether every byte in the range is ASCII; that is, below 0x80.
+bool diablo_is_ascii(uint8_t const* const src,
+                     size_t const off,
+                     size_t const len);
+
+// The position, relative to src[off], of the first byte in the range which
+// isn't ASCII, or len if they all are.
+size_t diablo_find_first_non_ascii(uint8_t const* const src,
+                                   size_t const off,
+                                   size_t const len);
+
+// Base16
+
+// Encode the range as lowercase hex, two digits per byte, high nibble first,
+// writing 2 * len bytes to dst starting at dst[dst_off].
+void diablo_encode_base16(uint8_t const* const src,
+                          size_t const off,
+                          size_t const len,
+                          uint8_t* const dst,
+                          size_t const dst_off);
+
+// Decode the range as hex, in either case, writing len / 2 bytes to dst
+// starting at dst[dst_off].
+//
+// Returns len if every character was a hex digit and len is even. Otherwise,
+// returns the position, relative to src[off], of the first character that
+// isn't a hex digit, or len - 1 for the odd one out at the end; only the
+// result / 2 bytes before the pair it's in have been written.
+size_t diablo_decode_base16(uint8_t const* const src,
+                            size_t const off,
+                            size_t const len,
+                            uint8_t* const dst,
+                            size_t const dst_off);
+
+// Base64
+
+// Which characters stand for 62 and 63: '+' and '/' for the standard alphabet
+// of RFC 4648, or '-' and '_' for the URL and filename safe one.
+typedef enum {
+  DIABLO_BASE64_STANDARD = 0,
+  DIABLO_BASE64_URL = 1
+} diablo_base64_alphabet;
+
+// How many characters diablo_encode_base64 makes from len bytes.
+size_t diablo_base64_encoded_length(size_t const len, bool const pad);
+
+// Encode the range as base64 in the given alphabet, writing to dst starting at
+// dst[dst_off]. If pad is set, a partial group at the end is padded with '='
+// to four characters. Returns the number of characters written, as given by
+// diablo_base64_encoded_length.
+size_t diablo_encode_base64(uint8_t const* const src,
+                            size_t const off,
+                            size_t const len,
+                            uint8_t* const dst,
+                            size_t const dst_off,
+                            diablo_base64_alphabet const alphabet,
+                            bool const pad);
+
+// How many bytes diablo_decode_base64 makes from the range, if it's valid.
+size_t diablo_base64_decoded_length(uint8_t const* const src,
+                                    size_t const off,
+                                    size_t const len);
+
+// Decode the range as base64 in the given alphabet, writing to dst starting at
+// dst[dst_off]; dst needs room for diablo_base64_decoded_length(src, off, len)
+// bytes. Padding is optional, but if there is any, it must make the length a
+// multiple of 4. The unused bits of the last character must be zero.
+//
+// Returns len if the range was valid. Otherwise, returns the position,
+// relative to src[off], of the first character that is invalid, either by not
+// being in the alphabet or by where it is; only the (result / 4) * 3 bytes
+// before its group of four have been written.
+size_t diablo_decode_base64(uint8_t const* const src,
+                            size_t const off,
+                            size_t const len,
+                            uint8_t* const dst,
+                            size_t const dst_off,
+                            diablo_base64_alphabet const alphabet);
+
+// UTF-8
+
+// Where validation of a stream of UTF-8 got to: the part of a sequence that
+// started in an earlier chunk, but didn't finish there. Treat the fields as
+// private. A zero-initialized state starts a fresh stream.
+typedef struct {
+  uint8_t remaining;
+  uint8_t lo;
+  uint8_t hi;
+} diablo_utf8_state;
+
+// Check that the range is valid UTF-8, continuing from the given state, which
+// is updated. Overlong encodings, surrogates and anything past U+10FFFF are all
+// invalid.
+//
+// Returns len if no errors were found; a sequence which is cut off at the end
+// of the range is not an error yet, but is kept in the state for the next
+// chunk. Otherwise, returns the position, relative to src[off], of the first
+// byte that can't be part of valid UTF-8, and the state should be discarded.
+size_t diablo_validate_utf8(uint8_t const* const src,
+                            size_t const off,
+                            size_t const len,
+                            diablo_utf8_state* const state);
+
+// Whether the stream the state belongs to could end here: false when it's in
+// the middle of a sequence.
+bool diablo_utf8_state_complete(diablo_utf8_state const* const state);
+
+// Count the code points in the range, assuming it's valid UTF-8. More
+// precisely, this counts the bytes which aren't continuation bytes.
+size_t diablo_count_utf8_codepoints(uint8_t const* const src,
+                                    size_t const off,
+                                    size_t const len);
+
+// The position, relative to src[off], of the first byte of code point n
+// (counting from 0) in the range, or len if the range has n or fewer code
+// points. As with diablo_count_utf8_codepoints, the range is assumed to be
+// valid UTF-8.
+size_t diablo_utf8_offset_of_nth(uint8_t const* const src,
+                                 size_t const off,
+                                 size_t const len,
+                                 size_t const n);
+
+// UTF-16
+
+// Transcode the range of UTF-16LE code units to UTF-8, writing to dst starting
+// at dst[dst_off]. dst must have room for at least
+// diablo_utf8_length_from_utf16le(src, off, len) bytes past that point;
+// nothing is written beyond what the output needs.
+//
+// Returns len if the range was valid UTF-16. Otherwise, returns the position,
+// relative to src[off], of the first unpaired surrogate; everything before it
+// has been transcoded. Either way, *written is set to the number of bytes
+// written.
+size_t diablo_utf16le_to_utf8(uint16_t const* const src,
+                              size_t const off,
+                              size_t const len,
+                              uint8_t* const dst,
+                              size_t const dst_off,
+                              size_t* const written);
+
+// Transcode the range of UTF-8 bytes to UTF-16LE, writing to dst starting at
+// dst[dst_off]. dst must have room for at least
+// diablo_utf16le_length_from_utf8(src, off, len) code units past that point;
+// nothing is written beyond what the output needs.
+//
+// Returns len if the range was valid UTF-8, in the same sense as
+// diablo_validate_utf8. Otherwise, returns the position, relative to src[off],
+// of the start of the first invalid sequence, including one cut off by the end
+// of the range; everything before it has been transcoded. Either way,
+// *written is set to the number of code units written.
+size_t diablo_utf8_to_utf16le(uint8_t const* const src,
+                              size_t const off,
+                              size_t const len,
+                              uint16_t* const dst,
+                              size_t const dst_off,
+                              size_t* const written);
+
+// The number of bytes diablo_utf16le_to_utf8 will write for the range. This is
+// exact if the range is valid UTF-16, and never too small otherwise.
+size_t diablo_utf8_length_from_utf16le(uint16_t const* const src,
+                                       size_t const off,
+                                       size_t const len);
+
+// The number of code units diablo_utf8_to_utf16le will write for the range.
+// This is exact if the range is valid UTF-8, and never too small otherwise.
+size_t diablo_utf16le_length_from_utf8(uint8_t const* const src,
+                                       size_t const off,
+                                       size_t const len);
+
+// Short inputs
+//
+// Calling into the library costs a function call and a look at the active
+// backend, which can be most of the work for a handful of bytes. The functions
+// below are static inline versions of some operations, for callers that can
+// inline C (including GHC's capi calling convention): ranges of at most
+// DIABLO_INLINE_LEN bytes are handled in place, a word at a time, and longer
+// ones call the library as usual. Each gives the same results as the function
+// it's named after.
+//
+// Calls handled in place don't go through the library, so statistics don't
+// count them.
+
+#define DIABLO_INLINE_LEN 32
+
+// Helpers for the functions below; not part of the API.
+
+static inline uint64_t diablo_inline_load (uint8_t const* const src) {
+  uint64_t word;
+  __builtin_memcpy(&word, src, sizeof(uint64_t));
+  return word;
+}
+
+// As eq_flags in the library: the high bit of every byte of word equal to
+// the corresponding byte of matches, and nothing else.
+static inline uint64_t diablo_inline_eq_flags (uint64_t const word,
+                                               uint64_t const matches) {
+  uint64_t const mask = 0x7F7F7F7F7F7F7F7FULL;
+  uint64_t const input = word ^ matches;
+  uint64_t const tmp = (input & mask) + mask;
+  return ~(tmp | input | mask);
+}
+
+// The index, in memory order, of the first byte of a word with any bit of
+// flags set. flags must not be zero.
+static inline size_t diablo_inline_first (uint64_t const flags) {
+#if (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+  return (size_t)__builtin_clzll(flags) / 8;
+#else
+  return (size_t)__builtin_ctzll(flags) / 8;
+#endif
+}
+
+// As diablo_inline_first, but for the last such byte.
+static inline size_t diablo_inline_last (uint64_t const flags) {
+#if (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+  return 7 - ((size_t)__builtin_ctzll(flags) / 8);
+#else
+  return 7 - ((size_t)__builtin_clzll(flags) / 8);
+#endif
+}
+
+// Clear every bit of the first n bytes, in memory order, for 0 < n < 8.
+static inline uint64_t diablo_inline_skip (uint64_t const flags,
+                                           size_t const n) {
+#if (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+  return flags & (~0ULL >> (8 * n));
+#else
+  return flags & (~0ULL << (8 * n));
+#endif
+}
+
+// As diablo_count_eq.
+static inline size_t diablo_count_eq_inline (uint8_t const* const src,
+                                             size_t const off,
+                                             size_t const len,
+                                             uint8_t const byte) {
+  if (len > DIABLO_INLINE_LEN) {
+    return diablo_count_eq(src, off, len, byte);
+  }
+  uint8_t const* const ptr = &(src[off]);
+  size_t total = 0;
+  if (len < 8) {
+    for (size_t i = 0; i < len; i++) {
+      total += (ptr[i] == byte);
+    }
+    return total;
+  }
+  uint64_t const matches = byte * 0x0101010101010101ULL;
+  size_t i = 0;
+  for (; i + 8 <= len; i += 8) {
+    uint64_t const flags =
+      diablo_inline_eq_flags(diablo_inline_load(&(ptr[i])), matches);
+    total += ((flags >> 7) * 0x0101010101010101ULL) >> 56;
+  }
+  if (i < len) {
+    // The last word overlaps bytes we've already counted, so skip those.
+    uint64_t const flags = diablo_inline_skip(
+      diablo_inline_eq_flags(diablo_inline_load(&(ptr[len - 8])), matches),
+      8 - (len - i));
+    total += ((flags >> 7) * 0x0101010101010101ULL) >> 56;
+  }
+  return total;
+}
+
+// As diablo_find_first_eq.
+static inline size_t diablo_find_first_eq_inline (uint8_t const* const src,
+                                                  size_t const off,
+                                                  size_t const len,
+                                                  uint8_t const byte) {
+  if (len > DIABLO_INLINE_LEN) {
+    return diablo_find_first_eq(src, off, len, byte);
+  }
+  uint8_t const* const ptr = &(src[off]);
+  if (len < 8) {
+    for (size_t i = 0; i < len; i++) {
+      if (ptr[i] == byte) {
+        return i;
+      }
+    }
+    return len;
+  }
+  uint64_t const matches = byte * 0x0101010101010101ULL;
+  // The last word may overlap the one before it, but nothing in the overlap
+  // matched, so its first match is still the first in the range.
+  for (size_t i = 0; i < len; i += 8) {
+    size_t const pos = (i + 8 <= len) ? i : (len - 8);
+    uint64_t const flags =
+      diablo_inline_eq_flags(diablo_inline_load(&(ptr[pos])), matches);
+    if (flags != 0) {
+      return pos + diablo_inline_first(flags);
+    }
+  }
+  return len;
+}
+
+// As diablo_find_last_eq.
+static inline size_t diablo_find_last_eq_inline (uint8_t const* const src,
+                                                 size_t const off,
+                                                 size_t const len,
+                                                 uint8_t const byte) {
+  if (len > DIABLO_INLINE_LEN) {
+    return diablo_find_last_eq(src, off, len, byte);
+  }
+  uint8_t const* const ptr = &(src[off]);
+  if (len < 8) {
+    for (size_t i = len; i > 0; i--) {
+      if (ptr[i - 1] == byte) {
+        return i - 1;
+      }
+    }
+    return len;
+  }
+  uint64_t const matches = byte * 0x0101010101010101ULL;
+  // As above, but from the end, with the first word overlapping instead.
+  for (size_t i = len; i > 0; i -= (i >= 8) ? 8 : i) {
+    size_t const pos = (i >= 8) ? (i - 8) : 0;
+    uint64_t const flags =
+      diablo_inline_eq_flags(diablo_inline_load(&(ptr[pos])), matches);
+    if (flags != 0) {
+      return pos + diablo_inline_last(flags);
+    }
+  }
+  return len;
+}
+
+// As diablo_find_first_non_ascii.
+static inline size_t diablo_find_first_non_ascii_inline (uint8_t const* const src,
+                                                         size_t const off,
+                                                         size_t const len) {
+  if (len > DIABLO_INLINE_LEN) {
+    return diablo_find_first_non_ascii(src, off, len);
+  }
+  uint8_t const* const ptr = &(src[off]);
+  if (len < 8) {
+    for (size_t i = 0; i < len; i++) {
+      if (ptr[i] >= 0x80) {
+        return i;
+      }
+    }
+    return len;
+  }
+  for (size_t i = 0; i < len; i += 8) {
+    size_t const pos = (i + 8 <= len) ? i : (len - 8);
+    uint64_t const flags =
+      diablo_inline_load(&(ptr[pos])) & 0x8080808080808080ULL;
+    if (flags != 0) {
+      return pos + diablo_inline_first(flags);
+    }
+  }
+  return len;
+}
+
+// As diablo_is_ascii.
+static inline bool diablo_is_ascii_inline (uint8_t const* const src,
+                                           size_t const off,
+                                           size_t const len) {
+  if (len > DIABLO_INLINE_LEN) {
+    return diablo_is_ascii(src, off, len);
+  }
+  uint8_t const* const ptr = &(src[off]);
+  if (len < 8) {
+    uint8_t seen = 0;
+    for (size_t i = 0; i < len; i++) {
+      seen |= ptr[i];
+    }
+    return seen < 0x80;
+  }
+  uint64_t seen = diablo_inline_load(&(ptr[len - 8]));
+  for (size_t i = 0; i + 8 <= len; i += 8) {
+    seen |= diablo_inline_load(&(ptr[i]));
+  }
+  return (seen & 0x8080808080808080ULL) == 0;
+}
+
+// As diablo_mismatch.
+static inline size_t diablo_mismatch_inline (uint8_t const* const a,
+                                             size_t const a_off,
+                                             uint8_t const* const b,
+                                             size_t const b_off,
+                                             size_t const len) {
+  if (len > DIABLO_INLINE_LEN) {
+    return diablo_mismatch(a, a_off, b, b_off, len);
+  }
+  uint8_t const* const a_ptr = &(a[a_off]);
+  uint8_t const* const b_ptr = &(b[b_off]);
+  if (len < 8) {
+    for (size_t i = 0; i < len; i++) {
+      if (a_ptr[i] != b_ptr[i]) {
+        return i;
+      }
+    }
+    return len;
+  }
+  for (size_t i = 0; i < len; i += 8) {
+    size_t const pos = (i + 8 <= len) ? i : (len - 8);
+    uint64_t const diff =
+      diablo_inline_load(&(a_ptr[pos])) ^ diablo_inline_load(&(b_ptr[pos]));
+    if (diff != 0) {
+      return pos + diablo_inline_first(diff);
+    }
+  }
+  return len;
+}
+
+// As diablo_compare.
+static inline int diablo_compare_inline (uint8_t const* const a,
+                                         size_t const a_off,
+                                         size_t const a_len,
+                                         uint8_t const* const b,
+                                         size_t const b_off,
+                                         size_t const b_len) {
+  size_t const len = (a_len < b_len) ? a_len : b_len;
+  if (len > DIABLO_INLINE_LEN) {
+    return diablo_compare(a, a_off, a_len, b, b_off, b_len);
+  }
+  size_t const pos = diablo_mismatch_inline(a, a_off, b, b_off, len);
+  if (pos < len) {
+    return (a[a_off + pos] < b[b_off + pos]) ? -1 : 1;
+  }
+  return (a_len > b_len) - (a_len < b_len);
+}
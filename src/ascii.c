@@ -0,0 +1,272 @@
+/*
+ * Copyright 2021 Koz Ross <koz.ross@retro-freedom.nz>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <stddef.h>
+#include "common.h"
+#include "dispatch.h"
+#include "stats.h"
+
+// A byte is ASCII exactly when its high bit is clear, so a block of bytes is
+// all ASCII exactly when the OR of all of them is. Every kernel ORs together
+// 64 bytes at a time, and stops at the first block with a high bit set to work
+// out where it is. As in find-eq.c, inputs at least a vector (or word) long
+// finish with one that overlaps what we've already seen, and kernels return
+// len if every byte is ASCII.
+
+static inline size_t find_first_non_ascii_rest (uint8_t const* const ptr,
+                                                size_t const len) {
+  for (size_t i = 0; i < len; i++) {
+    if (ptr[i] >= 0x80) {
+      return i;
+    }
+  }
+  return len;
+}
+
+// SWAR implementation, used as the fallback everywhere.
+//
+// We mask with 0x80 in every byte, as count_eq_swar does once it has flagged
+// its matches; here, the input's own high bits are the flags.
+static inline size_t find_first_non_ascii_swar (uint8_t const* const src,
+                                                size_t const off,
+                                                size_t const len) {
+  uint8_t const* const ptr = (uint8_t const*)&(src[off]);
+  uint64_t const high_bits = broadcast(0x80);
+  size_t i = 0;
+  for (; i + 64 <= len; i += 64) {
+    uint64_t const* const big_ptr = (uint64_t const*)(ptr + i);
+    uint64_t const any = big_ptr[0] | big_ptr[1] | big_ptr[2] | big_ptr[3] |
+                         big_ptr[4] | big_ptr[5] | big_ptr[6] | big_ptr[7];
+    if ((any & high_bits) != 0) {
+      break;
+    }
+  }
+  for (; i + 8 <= len; i += 8) {
+    uint64_t const flags = *((uint64_t const*)(ptr + i)) & high_bits;
+    if (flags != 0) {
+      return i + first_flagged(flags);
+    }
+  }
+  if (i < len) {
+    if (len < 8) {
+      return find_first_non_ascii_rest(ptr, len);
+    }
+    uint64_t const flags = *((uint64_t const*)(ptr + len - 8)) & high_bits;
+    if (flags != 0) {
+      return len - 8 + first_flagged(flags);
+    }
+  }
+  return len;
+}
+
+#if (DIABLO_HAS_SSE2)
+#include <emmintrin.h>
+
+// movemask collects exactly the high bits, so there is nothing to compare.
+static inline bool any_high64_sse (uint8_t const* const ptr) {
+  __m128i const* big_ptr = (__m128i const*)ptr;
+  __m128i const any =
+    _mm_or_si128(_mm_or_si128(_mm_loadu_si128(big_ptr), _mm_loadu_si128(big_ptr + 1)),
+                 _mm_or_si128(_mm_loadu_si128(big_ptr + 2), _mm_loadu_si128(big_ptr + 3)));
+  return _mm_movemask_epi8(any) != 0;
+}
+
+static inline uint32_t high_mask16_sse (uint8_t const* const ptr) {
+  return (uint32_t)_mm_movemask_epi8(_mm_loadu_si128((__m128i const*)ptr));
+}
+
+static inline size_t find_first_non_ascii_sse (uint8_t const* const src,
+                                               size_t const off,
+                                               size_t const len) {
+  if (len < 16) {
+    return find_first_non_ascii_swar(src, off, len);
+  }
+  uint8_t const* const ptr = (uint8_t const*)&(src[off]);
+  size_t i = 0;
+  for (; i + 64 <= len; i += 64) {
+    if (any_high64_sse(ptr + i)) {
+      break;
+    }
+  }
+  for (; i + 16 <= len; i += 16) {
+    uint32_t const mask = high_mask16_sse(ptr + i);
+    if (mask != 0) {
+      return i + __builtin_ctz(mask);
+    }
+  }
+  if (i < len) {
+    uint32_t const mask = high_mask16_sse(ptr + len - 16);
+    if (mask != 0) {
+      return len - 16 + __builtin_ctz(mask);
+    }
+  }
+  return len;
+}
+#endif
+
+#if (DIABLO_HAS_AVX2)
+#include <immintrin.h>
+
+__attribute__((target("avx2")))
+static inline uint32_t high_mask32_avx (uint8_t const* const ptr) {
+  return (uint32_t)_mm256_movemask_epi8(_mm256_loadu_si256((__m256i const*)ptr));
+}
+
+__attribute__((target("avx2")))
+static inline bool any_high64_avx (uint8_t const* const ptr) {
+  __m256i const* big_ptr = (__m256i const*)ptr;
+  __m256i const any = _mm256_or_si256(_mm256_loadu_si256(big_ptr),
+                                      _mm256_loadu_si256(big_ptr + 1));
+  return _mm256_movemask_epi8(any) != 0;
+}
+
+__attribute__((target("avx2")))
+static inline size_t find_first_non_ascii_avx (uint8_t const* const src,
+                                               size_t const off,
+                                               size_t const len) {
+  if (len < 32) {
+    return find_first_non_ascii_sse(src, off, len);
+  }
+  uint8_t const* const ptr = (uint8_t const*)&(src[off]);
+  size_t i = 0;
+  for (; i + 64 <= len; i += 64) {
+    if (any_high64_avx(ptr + i)) {
+      break;
+    }
+  }
+  for (; i + 32 <= len; i += 32) {
+    uint32_t const mask = high_mask32_avx(ptr + i);
+    if (mask != 0) {
+      return i + __builtin_ctz(mask);
+    }
+  }
+  if (i < len) {
+    uint32_t const mask = high_mask32_avx(ptr + len - 32);
+    if (mask != 0) {
+      return len - 32 + __builtin_ctz(mask);
+    }
+  }
+  return len;
+}
+#endif
+
+#if (DIABLO_HAS_AVX512BW)
+// One 64-byte vector is a whole block, and its high bits are a mask already.
+// Masked loads cover the ragged end.
+__attribute__((target("avx512bw")))
+static inline size_t find_first_non_ascii_avx512 (uint8_t const* const src,
+                                                  size_t const off,
+                                                  size_t const len) {
+  uint8_t const* const ptr = (uint8_t const*)&(src[off]);
+  size_t i = 0;
+  for (; i + 64 <= len; i += 64) {
+    uint64_t const mask =
+      _mm512_movepi8_mask(_mm512_loadu_si512((void const*)(ptr + i)));
+    if (mask != 0) {
+      return i + __builtin_ctzll(mask);
+    }
+  }
+  if (i < len) {
+    uint64_t const mask =
+      _mm512_movepi8_mask(_mm512_maskz_loadu_epi8(low_mask(len - i), ptr + i));
+    if (mask != 0) {
+      return i + __builtin_ctzll(mask);
+    }
+  }
+  return len;
+}
+#endif
+
+#if (DIABLO_HAS_NEON)
+// Reinterpreted as signed, a byte with its high bit set is negative, so a
+// signed shift right by 7 makes it 0xFF, and everything else 0x00.
+static inline uint64_t high_mask16_neon (uint8_t const* const ptr) {
+  int8x16_t const input = vreinterpretq_s8_u8(vld1q_u8(ptr));
+  return nibble_mask(vreinterpretq_u8_s8(vshrq_n_s8(input, 7)));
+}
+
+static inline bool any_high64_neon (uint8_t const* const ptr) {
+  uint8x16_t const any = vorrq_u8(vorrq_u8(vld1q_u8(ptr), vld1q_u8(ptr + 16)),
+                                  vorrq_u8(vld1q_u8(ptr + 32), vld1q_u8(ptr + 48)));
+  return any_set(vandq_u8(any, vdupq_n_u8(0x80)));
+}
+
+static inline size_t find_first_non_ascii_neon (uint8_t const* const src,
+                                                size_t const off,
+                                                size_t const len) {
+  if (len < 16) {
+    return find_first_non_ascii_swar(src, off, len);
+  }
+  uint8_t const* const ptr = (uint8_t const*)&(src[off]);
+  size_t i = 0;
+  for (; i + 64 <= len; i += 64) {
+    if (any_high64_neon(ptr + i)) {
+      break;
+    }
+  }
+  for (; i + 16 <= len; i += 16) {
+    uint64_t const mask = high_mask16_neon(ptr + i);
+    if (mask != 0) {
+      return i + (__builtin_ctzll(mask) / 4);
+    }
+  }
+  if (i < len) {
+    uint64_t const mask = high_mask16_neon(ptr + len - 16);
+    if (mask != 0) {
+      return len - 16 + (__builtin_ctzll(mask) / 4);
+    }
+  }
+  return len;
+}
+#endif
+
+typedef size_t (*find_first_non_ascii_kernel) (uint8_t const* const,
+                                               size_t const,
+                                               size_t const);
+
+static find_first_non_ascii_kernel const find_first_non_ascii_kernels[DIABLO_BACKEND_COUNT] = {
+  [DIABLO_BACKEND_SWAR] = find_first_non_ascii_swar,
+#if (DIABLO_HAS_SSE2)
+  [DIABLO_BACKEND_SSE2] = find_first_non_ascii_sse,
+#endif
+#if (DIABLO_HAS_SSSE3)
+  [DIABLO_BACKEND_SSSE3] = find_first_non_ascii_sse,
+#endif
+#if (DIABLO_HAS_AVX2)
+  [DIABLO_BACKEND_AVX2] = find_first_non_ascii_avx,
+#endif
+#if (DIABLO_HAS_NEON)
+  [DIABLO_BACKEND_NEON] = find_first_non_ascii_neon,
+#endif
+#if (DIABLO_HAS_AVX512BW)
+  [DIABLO_BACKEND_AVX512BW] = find_first_non_ascii_avx512,
+#endif
+};
+
+size_t diablo_find_first_non_ascii (uint8_t const* const src,
+                                    size_t const off,
+                                    size_t const len) {
+  STATS_RECORD(STATS_FIND_FIRST_NON_ASCII, len);
+  return find_first_non_ascii_kernels[active_backend()](src, off, len);
+}
+
+// Finding the first non-ASCII byte costs nothing over checking for one, as the
+// kernels only look closer once they've found a block with one.
+bool diablo_is_ascii (uint8_t const* const src,
+                      size_t const off,
+                      size_t const len) {
+  STATS_RECORD(STATS_IS_ASCII, len);
+  return find_first_non_ascii_kernels[active_backend()](src, off, len) == len;
+}
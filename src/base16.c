@@ -0,0 +1,430 @@
+/*
+ * Copyright 2021 Koz Ross <koz.ross@retro-freedom.nz>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <stddef.h>
+#include "common.h"
+#include "dispatch.h"
+#include "stats.h"
+
+// Encoding splits each byte into its high and low nibble, in that order, and
+// turns each nibble n into a digit: '0' + n, plus another 39 to reach 'a' if n
+// is 10 or more. No table is needed for that, so every kernel does it with
+// arithmetic.
+//
+// Decoding does the reverse. Once we know a character is a hex digit, its low
+// nibble is its value if it's '0' to '9' (0x30 to 0x39), and 9 less than its
+// value if it's a letter (0x41 to 0x46 or 0x61 to 0x66), so we add 9 to the
+// letters, which are the digits with bit 6 set. A block with an invalid
+// character in it gets decoded again by decode_base16_rest, which finds it;
+// the kernels return its position, or len if there isn't one. As an odd
+// character at the end can't make a byte, it's invalid too.
+
+static inline void encode_base16_rest (uint8_t const* const in,
+                                       size_t const len,
+                                       uint8_t* const out) {
+  static char const digits[] = "0123456789abcdef";
+  for (size_t i = 0; i < len; i++) {
+    out[2 * i] = (uint8_t)digits[in[i] >> 4];
+    out[(2 * i) + 1] = (uint8_t)digits[in[i] & 0x0F];
+  }
+}
+
+static inline uint8_t base16_value (uint8_t const c) {
+  if (c >= '0' && c <= '9') {
+    return c - '0';
+  }
+  uint8_t const lower = c | 0x20;
+  if (lower >= 'a' && lower <= 'f') {
+    return lower - 'a' + 10;
+  }
+  return 0xFF;
+}
+
+static inline size_t decode_base16_rest (uint8_t const* const in,
+                                         size_t const len,
+                                         uint8_t* const out) {
+  size_t i = 0;
+  for (; i + 2 <= len; i += 2) {
+    uint8_t const high = base16_value(in[i]);
+    if (high == 0xFF) {
+      return i;
+    }
+    uint8_t const low = base16_value(in[i + 1]);
+    if (low == 0xFF) {
+      return i + 1;
+    }
+    out[i / 2] = (uint8_t)((high << 4) | low);
+  }
+  return (i < len) ? i : len;
+}
+
+// SWAR implementation, used as the fallback everywhere.
+//
+// Encoding spreads four bytes out to one per 16-bit lane, then splits each
+// into nibbles, high nibble first in memory. Nothing in a word ever goes past
+// 0x85, so plain adds are safe.
+static inline uint64_t hex_digits_word (uint64_t const nibbles) {
+  uint64_t const letters = ((nibbles + broadcast(0x76)) & broadcast(0x80)) >> 7;
+  return nibbles + broadcast('0') + (letters * 39);
+}
+
+static inline void encode_base16_swar (uint8_t const* const src,
+                                       size_t const off,
+                                       size_t const len,
+                                       uint8_t* const dst,
+                                       size_t const dst_off) {
+  uint8_t const* const in = (uint8_t const*)&(src[off]);
+  uint8_t* const out = &(dst[dst_off]);
+  size_t i = 0;
+  for (; i + 4 <= len; i += 4) {
+    uint64_t spread = *((uint32_t const*)(in + i));
+    spread = (spread | (spread << 16)) & 0x0000FFFF0000FFFFULL;
+    spread = (spread | (spread << 8)) & 0x00FF00FF00FF00FFULL;
+#if (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+    uint64_t const nibbles = ((spread << 4) & 0x0F000F000F000F00ULL) |
+                             (spread & 0x000F000F000F000FULL);
+#else
+    uint64_t const nibbles = ((spread >> 4) & 0x000F000F000F000FULL) |
+                             ((spread & 0x000F000F000F000FULL) << 8);
+#endif
+    *((uint64_t*)(out + (2 * i))) = hex_digits_word(nibbles);
+  }
+  encode_base16_rest(in + i, len - i, out + (2 * i));
+}
+
+// Every byte of x, which must all be ASCII, which is in [lo, hi] gets its high
+// bit set; every other byte gets it cleared. Source: "Hacker's Delight",
+// section 6-1.
+static inline uint64_t between_ascii (uint64_t const x,
+                                      uint8_t const lo,
+                                      uint8_t const hi) {
+  return (x + broadcast(0x80 - lo)) & ~(x + broadcast(0x7F - hi)) & broadcast(0x80);
+}
+
+// Eight digits make four bytes: we decode them to one value per byte, then
+// merge each pair into the low byte of its 16-bit lane, and squeeze the lanes
+// together.
+static inline size_t decode_base16_swar (uint8_t const* const src,
+                                         size_t const off,
+                                         size_t const len,
+                                         uint8_t* const dst,
+                                         size_t const dst_off) {
+  uint8_t const* const in = (uint8_t const*)&(src[off]);
+  uint8_t* const out = &(dst[dst_off]);
+  uint64_t const high_bits = broadcast(0x80);
+  size_t i = 0;
+  for (; i + 8 <= len; i += 8) {
+    uint64_t const word = *((uint64_t const*)(in + i));
+    uint64_t const valid = between_ascii(word & ~high_bits, '0', '9') |
+                           between_ascii((word & ~high_bits) | broadcast(0x20), 'a', 'f');
+    if (((valid & ~word) & high_bits) != high_bits) {
+      size_t const pos = decode_base16_rest(in + i, 8, out + (i / 2));
+      return i + pos;
+    }
+    uint64_t const values = (word & broadcast(0x0F)) + (((word >> 6) & broadcast(0x01)) * 9);
+#if (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+    uint64_t merged = (values | (values >> 4)) & 0x00FF00FF00FF00FFULL;
+#else
+    uint64_t merged = ((values << 4) | (values >> 8)) & 0x00FF00FF00FF00FFULL;
+#endif
+    merged = (merged | (merged >> 8)) & 0x0000FFFF0000FFFFULL;
+    merged = (merged | (merged >> 16)) & 0x00000000FFFFFFFFULL;
+    *((uint32_t*)(out + (i / 2))) = (uint32_t)merged;
+  }
+  size_t const pos = decode_base16_rest(in + i, len - i, out + (i / 2));
+  return i + pos;
+}
+
+#if (DIABLO_HAS_SSE2)
+#include <emmintrin.h>
+
+static inline __m128i hex_digits_sse (__m128i const nibbles) {
+  __m128i const letters = _mm_and_si128(_mm_cmpgt_epi8(nibbles, _mm_set1_epi8(9)),
+                                        _mm_set1_epi8(39));
+  return _mm_add_epi8(_mm_add_epi8(nibbles, _mm_set1_epi8('0')), letters);
+}
+
+static inline void encode_base16_sse (uint8_t const* const src,
+                                      size_t const off,
+                                      size_t const len,
+                                      uint8_t* const dst,
+                                      size_t const dst_off) {
+  uint8_t const* const in = (uint8_t const*)&(src[off]);
+  uint8_t* const out = &(dst[dst_off]);
+  __m128i const low_nibbles = _mm_set1_epi8(0x0F);
+  size_t i = 0;
+  for (; i + 16 <= len; i += 16) {
+    __m128i const input = _mm_loadu_si128((__m128i const*)(in + i));
+    __m128i const highs = _mm_and_si128(_mm_srli_epi16(input, 4), low_nibbles);
+    __m128i const lows = _mm_and_si128(input, low_nibbles);
+    _mm_storeu_si128((__m128i*)(out + (2 * i)),
+                     hex_digits_sse(_mm_unpacklo_epi8(highs, lows)));
+    _mm_storeu_si128((__m128i*)(out + (2 * i) + 16),
+                     hex_digits_sse(_mm_unpackhi_epi8(highs, lows)));
+  }
+  encode_base16_swar(in, i, len - i, out, 2 * i);
+}
+
+// Signed comparisons are fine for the ranges, as anything past 0x7F is
+// negative, and so below all of them.
+static inline __m128i hex_valid_sse (__m128i const input) {
+  __m128i const digits = _mm_and_si128(_mm_cmpgt_epi8(input, _mm_set1_epi8('0' - 1)),
+                                       _mm_cmpgt_epi8(_mm_set1_epi8('9' + 1), input));
+  __m128i const lower = _mm_or_si128(input, _mm_set1_epi8(0x20));
+  __m128i const letters = _mm_and_si128(_mm_cmpgt_epi8(lower, _mm_set1_epi8('a' - 1)),
+                                        _mm_cmpgt_epi8(_mm_set1_epi8('f' + 1), lower));
+  return _mm_or_si128(digits, letters);
+}
+
+// Each 16-bit lane holds a pair of values, high nibble in its low byte.
+static inline __m128i hex_pairs_sse (__m128i const input) {
+  __m128i const values = _mm_add_epi8(_mm_and_si128(input, _mm_set1_epi8(0x0F)),
+                                      _mm_and_si128(_mm_cmpgt_epi8(input, _mm_set1_epi8(0x40)),
+                                                    _mm_set1_epi8(9)));
+  return _mm_and_si128(_mm_or_si128(_mm_slli_epi16(values, 4), _mm_srli_epi16(values, 8)),
+                       _mm_set1_epi16(0x00FF));
+}
+
+static inline size_t decode_base16_sse (uint8_t const* const src,
+                                        size_t const off,
+                                        size_t const len,
+                                        uint8_t* const dst,
+                                        size_t const dst_off) {
+  uint8_t const* const in = (uint8_t const*)&(src[off]);
+  uint8_t* const out = &(dst[dst_off]);
+  size_t i = 0;
+  for (; i + 32 <= len; i += 32) {
+    __m128i const first = _mm_loadu_si128((__m128i const*)(in + i));
+    __m128i const second = _mm_loadu_si128((__m128i const*)(in + i + 16));
+    __m128i const valid = _mm_and_si128(hex_valid_sse(first), hex_valid_sse(second));
+    if (_mm_movemask_epi8(valid) != 0xFFFF) {
+      size_t const pos = decode_base16_rest(in + i, 32, out + (i / 2));
+      return i + pos;
+    }
+    _mm_storeu_si128((__m128i*)(out + (i / 2)),
+                     _mm_packus_epi16(hex_pairs_sse(first), hex_pairs_sse(second)));
+  }
+  size_t const pos = decode_base16_swar(in, i, len - i, out, i / 2);
+  return i + pos;
+}
+#endif
+
+#if (DIABLO_HAS_AVX2)
+#include <immintrin.h>
+
+__attribute__((target("avx2")))
+static inline __m256i hex_digits_avx (__m256i const nibbles) {
+  __m256i const letters = _mm256_and_si256(_mm256_cmpgt_epi8(nibbles, _mm256_set1_epi8(9)),
+                                           _mm256_set1_epi8(39));
+  return _mm256_add_epi8(_mm256_add_epi8(nibbles, _mm256_set1_epi8('0')), letters);
+}
+
+// The unpacks work within 128-bit halves, so the halves of their results need
+// swapping round before we store them.
+__attribute__((target("avx2")))
+static inline void encode_base16_avx (uint8_t const* const src,
+                                      size_t const off,
+                                      size_t const len,
+                                      uint8_t* const dst,
+                                      size_t const dst_off) {
+  uint8_t const* const in = (uint8_t const*)&(src[off]);
+  uint8_t* const out = &(dst[dst_off]);
+  __m256i const low_nibbles = _mm256_set1_epi8(0x0F);
+  size_t i = 0;
+  for (; i + 32 <= len; i += 32) {
+    __m256i const input = _mm256_loadu_si256((__m256i const*)(in + i));
+    __m256i const highs = _mm256_and_si256(_mm256_srli_epi16(input, 4), low_nibbles);
+    __m256i const lows = _mm256_and_si256(input, low_nibbles);
+    __m256i const first = hex_digits_avx(_mm256_unpacklo_epi8(highs, lows));
+    __m256i const second = hex_digits_avx(_mm256_unpackhi_epi8(highs, lows));
+    _mm256_storeu_si256((__m256i*)(out + (2 * i)),
+                        _mm256_permute2x128_si256(first, second, 0x20));
+    _mm256_storeu_si256((__m256i*)(out + (2 * i) + 32),
+                        _mm256_permute2x128_si256(first, second, 0x31));
+  }
+  encode_base16_sse(in, i, len - i, out, 2 * i);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i hex_valid_avx (__m256i const input) {
+  __m256i const digits = _mm256_and_si256(_mm256_cmpgt_epi8(input, _mm256_set1_epi8('0' - 1)),
+                                          _mm256_cmpgt_epi8(_mm256_set1_epi8('9' + 1), input));
+  __m256i const lower = _mm256_or_si256(input, _mm256_set1_epi8(0x20));
+  __m256i const letters = _mm256_and_si256(_mm256_cmpgt_epi8(lower, _mm256_set1_epi8('a' - 1)),
+                                           _mm256_cmpgt_epi8(_mm256_set1_epi8('f' + 1), lower));
+  return _mm256_or_si256(digits, letters);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i hex_pairs_avx (__m256i const input) {
+  __m256i const values = _mm256_add_epi8(_mm256_and_si256(input, _mm256_set1_epi8(0x0F)),
+                                         _mm256_and_si256(_mm256_cmpgt_epi8(input, _mm256_set1_epi8(0x40)),
+                                                          _mm256_set1_epi8(9)));
+  return _mm256_and_si256(_mm256_or_si256(_mm256_slli_epi16(values, 4), _mm256_srli_epi16(values, 8)),
+                          _mm256_set1_epi16(0x00FF));
+}
+
+__attribute__((target("avx2")))
+static inline size_t decode_base16_avx (uint8_t const* const src,
+                                        size_t const off,
+                                        size_t const len,
+                                        uint8_t* const dst,
+                                        size_t const dst_off) {
+  uint8_t const* const in = (uint8_t const*)&(src[off]);
+  uint8_t* const out = &(dst[dst_off]);
+  size_t i = 0;
+  for (; i + 64 <= len; i += 64) {
+    __m256i const first = _mm256_loadu_si256((__m256i const*)(in + i));
+    __m256i const second = _mm256_loadu_si256((__m256i const*)(in + i + 32));
+    __m256i const valid = _mm256_and_si256(hex_valid_avx(first), hex_valid_avx(second));
+    if (((uint32_t)_mm256_movemask_epi8(valid)) != 0xFFFFFFFF) {
+      size_t const pos = decode_base16_rest(in + i, 64, out + (i / 2));
+      return i + pos;
+    }
+    __m256i const packed = _mm256_packus_epi16(hex_pairs_avx(first), hex_pairs_avx(second));
+    _mm256_storeu_si256((__m256i*)(out + (i / 2)),
+                        _mm256_permute4x64_epi64(packed, 0xD8));
+  }
+  size_t const pos = decode_base16_sse(in, i, len - i, out, i / 2);
+  return i + pos;
+}
+#endif
+
+#if (DIABLO_HAS_NEON)
+// NEON can look the digits up directly, and its structured loads and stores
+// separate and interleave high and low nibbles for us.
+static inline void encode_base16_neon (uint8_t const* const src,
+                                       size_t const off,
+                                       size_t const len,
+                                       uint8_t* const dst,
+                                       size_t const dst_off) {
+  uint8_t const* const in = (uint8_t const*)&(src[off]);
+  uint8_t* const out = &(dst[dst_off]);
+  uint8x16_t const digits = vld1q_u8((uint8_t const*)"0123456789abcdef");
+  size_t i = 0;
+  for (; i + 16 <= len; i += 16) {
+    uint8x16_t const input = vld1q_u8(in + i);
+    uint8x16x2_t const encoded = {{ lookup16(digits, vshrq_n_u8(input, 4)),
+                                    lookup16(digits, vandq_u8(input, vdupq_n_u8(0x0F))) }};
+    vst2q_u8(out + (2 * i), encoded);
+  }
+  encode_base16_swar(in, i, len - i, out, 2 * i);
+}
+
+static inline uint8x16_t hex_valid_neon (uint8x16_t const input) {
+  uint8x16_t const digits = vandq_u8(vcgeq_u8(input, vdupq_n_u8('0')),
+                                     vcleq_u8(input, vdupq_n_u8('9')));
+  uint8x16_t const lower = vorrq_u8(input, vdupq_n_u8(0x20));
+  uint8x16_t const letters = vandq_u8(vcgeq_u8(lower, vdupq_n_u8('a')),
+                                      vcleq_u8(lower, vdupq_n_u8('f')));
+  return vorrq_u8(digits, letters);
+}
+
+static inline uint8x16_t hex_values_neon (uint8x16_t const input) {
+  return vaddq_u8(vandq_u8(input, vdupq_n_u8(0x0F)),
+                  vandq_u8(vcgtq_u8(input, vdupq_n_u8(0x40)), vdupq_n_u8(9)));
+}
+
+static inline size_t decode_base16_neon (uint8_t const* const src,
+                                         size_t const off,
+                                         size_t const len,
+                                         uint8_t* const dst,
+                                         size_t const dst_off) {
+  uint8_t const* const in = (uint8_t const*)&(src[off]);
+  uint8_t* const out = &(dst[dst_off]);
+  size_t i = 0;
+  for (; i + 32 <= len; i += 32) {
+    uint8x16x2_t const input = vld2q_u8(in + i);
+    uint8x16_t const valid = vandq_u8(hex_valid_neon(input.val[0]),
+                                      hex_valid_neon(input.val[1]));
+    if (any_set(vmvnq_u8(valid))) {
+      size_t const pos = decode_base16_rest(in + i, 32, out + (i / 2));
+      return i + pos;
+    }
+    vst1q_u8(out + (i / 2), vorrq_u8(vshlq_n_u8(hex_values_neon(input.val[0]), 4),
+                                     hex_values_neon(input.val[1])));
+  }
+  size_t const pos = decode_base16_swar(in, i, len - i, out, i / 2);
+  return i + pos;
+}
+#endif
+
+typedef void (*encode_base16_kernel) (uint8_t const* const,
+                                      size_t const,
+                                      size_t const,
+                                      uint8_t* const,
+                                      size_t const);
+
+static encode_base16_kernel const encode_base16_kernels[DIABLO_BACKEND_COUNT] = {
+  [DIABLO_BACKEND_SWAR] = encode_base16_swar,
+#if (DIABLO_HAS_SSE2)
+  [DIABLO_BACKEND_SSE2] = encode_base16_sse,
+#endif
+#if (DIABLO_HAS_SSSE3)
+  [DIABLO_BACKEND_SSSE3] = encode_base16_sse,
+#endif
+#if (DIABLO_HAS_AVX2)
+  [DIABLO_BACKEND_AVX2] = encode_base16_avx,
+#endif
+#if (DIABLO_HAS_NEON)
+  [DIABLO_BACKEND_NEON] = encode_base16_neon,
+#endif
+#if (DIABLO_HAS_AVX512BW)
+  [DIABLO_BACKEND_AVX512BW] = encode_base16_avx,
+#endif
+};
+
+typedef size_t (*decode_base16_kernel) (uint8_t const* const,
+                                        size_t const,
+                                        size_t const,
+                                        uint8_t* const,
+                                        size_t const);
+
+static decode_base16_kernel const decode_base16_kernels[DIABLO_BACKEND_COUNT] = {
+  [DIABLO_BACKEND_SWAR] = decode_base16_swar,
+#if (DIABLO_HAS_SSE2)
+  [DIABLO_BACKEND_SSE2] = decode_base16_sse,
+#endif
+#if (DIABLO_HAS_SSSE3)
+  [DIABLO_BACKEND_SSSE3] = decode_base16_sse,
+#endif
+#if (DIABLO_HAS_AVX2)
+  [DIABLO_BACKEND_AVX2] = decode_base16_avx,
+#endif
+#if (DIABLO_HAS_NEON)
+  [DIABLO_BACKEND_NEON] = decode_base16_neon,
+#endif
+#if (DIABLO_HAS_AVX512BW)
+  [DIABLO_BACKEND_AVX512BW] = decode_base16_avx,
+#endif
+};
+
+void diablo_encode_base16 (uint8_t const* const src,
+                           size_t const off,
+                           size_t const len,
+                           uint8_t* const dst,
+                           size_t const dst_off) {
+  STATS_RECORD(STATS_ENCODE_BASE16, len);
+  encode_base16_kernels[active_backend()](src, off, len, dst, dst_off);
+}
+
+size_t diablo_decode_base16 (uint8_t const* const src,
+                             size_t const off,
+                             size_t const len,
+                             uint8_t* const dst,
+                             size_t const dst_off) {
+  STATS_RECORD(STATS_DECODE_BASE16, len);
+  return decode_base16_kernels[active_backend()](src, off, len, dst, dst_off);
+}
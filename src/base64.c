@@ -0,0 +1,625 @@
+/*
+ * Copyright 2021 Koz Ross <koz.ross@retro-freedom.nz>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <stddef.h>
+#include "common.h"
+#include "dispatch.h"
+#include "stats.h"
+
+// Kernels only deal with whole groups: three bytes to four characters when
+// encoding, and the reverse when decoding. The partial group at the end, and
+// any padding, are handled in the top-level functions.
+//
+// The two alphabets differ only in the characters for 62 and 63, so the SIMD
+// kernels work out everything else arithmetically, and only look those two
+// up. Decoding kernels check a block at a time; a block with an invalid
+// character in it gets decoded again by decode_base64_rest, which finds it.
+
+static uint8_t const base64_chars[2][64] = {
+  { 'A', 'B', 'C', 'D', 'E', 'F', 'G', 'H', 'I', 'J', 'K', 'L', 'M', 'N', 'O', 'P',
+    'Q', 'R', 'S', 'T', 'U', 'V', 'W', 'X', 'Y', 'Z', 'a', 'b', 'c', 'd', 'e', 'f',
+    'g', 'h', 'i', 'j', 'k', 'l', 'm', 'n', 'o', 'p', 'q', 'r', 's', 't', 'u', 'v',
+    'w', 'x', 'y', 'z', '0', '1', '2', '3', '4', '5', '6', '7', '8', '9', '+', '/' },
+  { 'A', 'B', 'C', 'D', 'E', 'F', 'G', 'H', 'I', 'J', 'K', 'L', 'M', 'N', 'O', 'P',
+    'Q', 'R', 'S', 'T', 'U', 'V', 'W', 'X', 'Y', 'Z', 'a', 'b', 'c', 'd', 'e', 'f',
+    'g', 'h', 'i', 'j', 'k', 'l', 'm', 'n', 'o', 'p', 'q', 'r', 's', 't', 'u', 'v',
+    'w', 'x', 'y', 'z', '0', '1', '2', '3', '4', '5', '6', '7', '8', '9', '-', '_' },
+};
+
+// The value of each character, or 0xFF if it isn't in the alphabet.
+static uint8_t const base64_values[2][256] = {
+  // Standard
+  {
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x3E, 0xFF, 0xFF, 0xFF, 0x3F,
+    0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3A, 0x3B, 0x3C, 0x3D, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0A, 0x0B, 0x0C, 0x0D, 0x0E,
+    0x0F, 0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17, 0x18, 0x19, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0x1A, 0x1B, 0x1C, 0x1D, 0x1E, 0x1F, 0x20, 0x21, 0x22, 0x23, 0x24, 0x25, 0x26, 0x27, 0x28,
+    0x29, 0x2A, 0x2B, 0x2C, 0x2D, 0x2E, 0x2F, 0x30, 0x31, 0x32, 0x33, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+  },
+  // URL-safe
+  {
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x3E, 0xFF, 0xFF,
+    0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3A, 0x3B, 0x3C, 0x3D, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0A, 0x0B, 0x0C, 0x0D, 0x0E,
+    0x0F, 0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17, 0x18, 0x19, 0xFF, 0xFF, 0xFF, 0xFF, 0x3F,
+    0xFF, 0x1A, 0x1B, 0x1C, 0x1D, 0x1E, 0x1F, 0x20, 0x21, 0x22, 0x23, 0x24, 0x25, 0x26, 0x27, 0x28,
+    0x29, 0x2A, 0x2B, 0x2C, 0x2D, 0x2E, 0x2F, 0x30, 0x31, 0x32, 0x33, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+  },
+};
+
+// Scalar
+//
+// Spreading bits out to 6-bit indices and mapping them to characters in a
+// word costs more than looking eight characters up, so this is also the SWAR
+// and SSE2 kernel. Everything faster needs a byte shuffle.
+
+static inline void encode_base64_rest (uint8_t const* const src,
+                                       size_t const off,
+                                       size_t const len,
+                                       uint8_t* const dst,
+                                       size_t const dst_off,
+                                       diablo_base64_alphabet const alphabet) {
+  uint8_t const* const in = (uint8_t const*)&(src[off]);
+  uint8_t* const out = &(dst[dst_off]);
+  uint8_t const* const chars = base64_chars[alphabet];
+  for (size_t i = 0, o = 0; i + 3 <= len; i += 3, o += 4) {
+    uint32_t const group = ((uint32_t)in[i] << 16) | ((uint32_t)in[i + 1] << 8) | in[i + 2];
+    out[o] = chars[group >> 18];
+    out[o + 1] = chars[(group >> 12) & 0x3F];
+    out[o + 2] = chars[(group >> 6) & 0x3F];
+    out[o + 3] = chars[group & 0x3F];
+  }
+}
+
+static inline size_t decode_base64_rest (uint8_t const* const src,
+                                         size_t const off,
+                                         size_t const len,
+                                         uint8_t* const dst,
+                                         size_t const dst_off,
+                                         diablo_base64_alphabet const alphabet) {
+  uint8_t const* const in = (uint8_t const*)&(src[off]);
+  uint8_t* const out = &(dst[dst_off]);
+  uint8_t const* const values = base64_values[alphabet];
+  for (size_t i = 0, o = 0; i + 4 <= len; i += 4, o += 3) {
+    uint32_t const a = values[in[i]];
+    uint32_t const b = values[in[i + 1]];
+    uint32_t const c = values[in[i + 2]];
+    uint32_t const d = values[in[i + 3]];
+    if (((a | b | c | d) & 0x80) != 0) {
+      return i + ((a & 0x80) ? 0 : (b & 0x80) ? 1 : (c & 0x80) ? 2 : 3);
+    }
+    uint32_t const group = (a << 18) | (b << 12) | (c << 6) | d;
+    out[o] = (uint8_t)(group >> 16);
+    out[o + 1] = (uint8_t)(group >> 8);
+    out[o + 2] = (uint8_t)group;
+  }
+  return len;
+}
+
+#if (DIABLO_HAS_SSSE3)
+#include <tmmintrin.h>
+
+// Source: Wojciech Muła, "Base64 encoding with SIMD instructions", the
+// multiply-based unpacking and the single-shuffle lookup.
+//
+// The shuffle puts bytes 1, 0, 2 and 1 of each group into each 32-bit lane, so
+// that the four 6-bit fields can be moved into place with two multiplies. Then
+// each index gets reduced to which of the ranges A-Z, a-z, 0-9, 62 or 63 it's
+// in, and we look up what to add to get there.
+__attribute__((target("ssse3")))
+static inline __m128i base64_indices_ssse3 (__m128i const input) {
+  __m128i const spread = _mm_shuffle_epi8(input, _mm_setr_epi8(1, 0, 2, 1, 4, 3, 5, 4,
+                                                               7, 6, 8, 7, 10, 9, 11, 10));
+  __m128i const ac = _mm_mulhi_epu16(_mm_and_si128(spread, _mm_set1_epi32(0x0FC0FC00)),
+                                     _mm_set1_epi32(0x04000040));
+  __m128i const bd = _mm_mullo_epi16(_mm_and_si128(spread, _mm_set1_epi32(0x003F03F0)),
+                                     _mm_set1_epi32(0x01000010));
+  return _mm_or_si128(ac, bd);
+}
+
+__attribute__((target("ssse3")))
+static inline __m128i base64_chars_ssse3 (__m128i const indices,
+                                          __m128i const shifts) {
+  __m128i const reduced = _mm_or_si128(_mm_subs_epu8(indices, _mm_set1_epi8(51)),
+                                       _mm_and_si128(_mm_cmpgt_epi8(_mm_set1_epi8(26), indices),
+                                                     _mm_set1_epi8(13)));
+  return _mm_add_epi8(indices, _mm_shuffle_epi8(shifts, reduced));
+}
+
+__attribute__((target("ssse3")))
+static inline __m128i base64_shifts_ssse3 (diablo_base64_alphabet const alphabet) {
+  uint8_t const* const chars = base64_chars[alphabet];
+  return _mm_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                       '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                       (char)(chars[62] - 62), (char)(chars[63] - 63), 'A', 0, 0);
+}
+
+__attribute__((target("ssse3")))
+static inline void encode_base64_ssse3 (uint8_t const* const src,
+                                        size_t const off,
+                                        size_t const len,
+                                        uint8_t* const dst,
+                                        size_t const dst_off,
+                                        diablo_base64_alphabet const alphabet) {
+  uint8_t const* const in = (uint8_t const*)&(src[off]);
+  uint8_t* const out = &(dst[dst_off]);
+  __m128i const shifts = base64_shifts_ssse3(alphabet);
+  size_t i = 0;
+  size_t o = 0;
+  // Each load reads 16 bytes, but only uses 12.
+  for (; i + 16 <= len; i += 12, o += 16) {
+    __m128i const input = _mm_loadu_si128((__m128i const*)(in + i));
+    _mm_storeu_si128((__m128i*)(out + o),
+                     base64_chars_ssse3(base64_indices_ssse3(input), shifts));
+  }
+  encode_base64_rest(in, i, len - i, out, o, alphabet);
+}
+
+// Rather than a shuffle for each alphabet, we classify characters by
+// comparison, which the two alphabets can share, and add each class's offset
+// to get its value. Signed comparisons are fine, as anything past 0x7F is
+// below every range. Invalid characters belong to no class.
+__attribute__((target("ssse3")))
+static inline __m128i base64_values_ssse3 (__m128i const input,
+                                           __m128i const char62,
+                                           __m128i const char63,
+                                           __m128i* const valid) {
+  __m128i const upper = _mm_and_si128(_mm_cmpgt_epi8(input, _mm_set1_epi8('A' - 1)),
+                                      _mm_cmpgt_epi8(_mm_set1_epi8('Z' + 1), input));
+  __m128i const lower = _mm_and_si128(_mm_cmpgt_epi8(input, _mm_set1_epi8('a' - 1)),
+                                      _mm_cmpgt_epi8(_mm_set1_epi8('z' + 1), input));
+  __m128i const digit = _mm_and_si128(_mm_cmpgt_epi8(input, _mm_set1_epi8('0' - 1)),
+                                      _mm_cmpgt_epi8(_mm_set1_epi8('9' + 1), input));
+  __m128i const is62 = _mm_cmpeq_epi8(input, char62);
+  __m128i const is63 = _mm_cmpeq_epi8(input, char63);
+  *valid = _mm_or_si128(_mm_or_si128(_mm_or_si128(upper, lower), digit),
+                        _mm_or_si128(is62, is63));
+  __m128i const offsets =
+    _mm_or_si128(_mm_or_si128(_mm_and_si128(upper, _mm_set1_epi8(-'A')),
+                              _mm_and_si128(lower, _mm_set1_epi8(26 - 'a'))),
+                 _mm_or_si128(_mm_and_si128(digit, _mm_set1_epi8(52 - '0')),
+                              _mm_or_si128(_mm_and_si128(is62, _mm_sub_epi8(_mm_set1_epi8(62), char62)),
+                                           _mm_and_si128(is63, _mm_sub_epi8(_mm_set1_epi8(63), char63)))));
+  return _mm_add_epi8(input, offsets);
+}
+
+// Packing the values back together is the reverse of base64_indices_ssse3:
+// two multiply-adds put each group's 24 bits into its 32-bit lane, and a
+// shuffle gathers their bytes, most significant first.
+__attribute__((target("ssse3")))
+static inline __m128i base64_pack_ssse3 (__m128i const values) {
+  __m128i const pairs = _mm_maddubs_epi16(values, _mm_set1_epi32(0x01400140));
+  __m128i const groups = _mm_madd_epi16(pairs, _mm_set1_epi32(0x00011000));
+  return _mm_shuffle_epi8(groups, _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8,
+                                                14, 13, 12, -1, -1, -1, -1));
+}
+
+__attribute__((target("ssse3")))
+static inline size_t decode_base64_ssse3 (uint8_t const* const src,
+                                          size_t const off,
+                                          size_t const len,
+                                          uint8_t* const dst,
+                                          size_t const dst_off,
+                                          diablo_base64_alphabet const alphabet) {
+  uint8_t const* const in = (uint8_t const*)&(src[off]);
+  uint8_t* const out = &(dst[dst_off]);
+  __m128i const char62 = _mm_set1_epi8((char)base64_chars[alphabet][62]);
+  __m128i const char63 = _mm_set1_epi8((char)base64_chars[alphabet][63]);
+  size_t i = 0;
+  size_t o = 0;
+  for (; i + 16 <= len; i += 16, o += 12) {
+    __m128i valid;
+    __m128i const values = base64_values_ssse3(_mm_loadu_si128((__m128i const*)(in + i)),
+                                               char62, char63, &valid);
+    if (_mm_movemask_epi8(valid) != 0xFFFF) {
+      return i + decode_base64_rest(in, i, 16, out, o, alphabet);
+    }
+    __m128i const packed = base64_pack_ssse3(values);
+    _mm_storel_epi64((__m128i*)(out + o), packed);
+    *((uint32_t*)(out + o + 8)) = (uint32_t)_mm_cvtsi128_si32(_mm_srli_si128(packed, 8));
+  }
+  return i + decode_base64_rest(in, i, len - i, out, o, alphabet);
+}
+#endif
+
+#if (DIABLO_HAS_AVX2)
+#include <immintrin.h>
+
+// As the SSSE3 kernels, with a group of twelve bytes in each 128-bit half.
+__attribute__((target("avx2")))
+static inline __m256i base64_indices_avx (__m256i const input) {
+  __m256i const spread = _mm256_shuffle_epi8(input, _mm256_setr_epi8(1, 0, 2, 1, 4, 3, 5, 4,
+                                                                     7, 6, 8, 7, 10, 9, 11, 10,
+                                                                     1, 0, 2, 1, 4, 3, 5, 4,
+                                                                     7, 6, 8, 7, 10, 9, 11, 10));
+  __m256i const ac = _mm256_mulhi_epu16(_mm256_and_si256(spread, _mm256_set1_epi32(0x0FC0FC00)),
+                                        _mm256_set1_epi32(0x04000040));
+  __m256i const bd = _mm256_mullo_epi16(_mm256_and_si256(spread, _mm256_set1_epi32(0x003F03F0)),
+                                        _mm256_set1_epi32(0x01000010));
+  return _mm256_or_si256(ac, bd);
+}
+
+__attribute__((target("avx2")))
+static inline void encode_base64_avx (uint8_t const* const src,
+                                      size_t const off,
+                                      size_t const len,
+                                      uint8_t* const dst,
+                                      size_t const dst_off,
+                                      diablo_base64_alphabet const alphabet) {
+  uint8_t const* const in = (uint8_t const*)&(src[off]);
+  uint8_t* const out = &(dst[dst_off]);
+  __m256i const shifts = _mm256_broadcastsi128_si256(base64_shifts_ssse3(alphabet));
+  size_t i = 0;
+  size_t o = 0;
+  for (; i + 28 <= len; i += 24, o += 32) {
+    __m256i const input =
+      _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((__m128i const*)(in + i))),
+                              _mm_loadu_si128((__m128i const*)(in + i + 12)), 1);
+    __m256i const indices = base64_indices_avx(input);
+    __m256i const reduced =
+      _mm256_or_si256(_mm256_subs_epu8(indices, _mm256_set1_epi8(51)),
+                      _mm256_and_si256(_mm256_cmpgt_epi8(_mm256_set1_epi8(26), indices),
+                                       _mm256_set1_epi8(13)));
+    _mm256_storeu_si256((__m256i*)(out + o),
+                        _mm256_add_epi8(indices, _mm256_shuffle_epi8(shifts, reduced)));
+  }
+  encode_base64_ssse3(in, i, len - i, out, o, alphabet);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i base64_values_avx (__m256i const input,
+                                         __m256i const char62,
+                                         __m256i const char63,
+                                         __m256i* const valid) {
+  __m256i const upper = _mm256_and_si256(_mm256_cmpgt_epi8(input, _mm256_set1_epi8('A' - 1)),
+                                         _mm256_cmpgt_epi8(_mm256_set1_epi8('Z' + 1), input));
+  __m256i const lower = _mm256_and_si256(_mm256_cmpgt_epi8(input, _mm256_set1_epi8('a' - 1)),
+                                         _mm256_cmpgt_epi8(_mm256_set1_epi8('z' + 1), input));
+  __m256i const digit = _mm256_and_si256(_mm256_cmpgt_epi8(input, _mm256_set1_epi8('0' - 1)),
+                                         _mm256_cmpgt_epi8(_mm256_set1_epi8('9' + 1), input));
+  __m256i const is62 = _mm256_cmpeq_epi8(input, char62);
+  __m256i const is63 = _mm256_cmpeq_epi8(input, char63);
+  *valid = _mm256_or_si256(_mm256_or_si256(_mm256_or_si256(upper, lower), digit),
+                           _mm256_or_si256(is62, is63));
+  __m256i const offsets =
+    _mm256_or_si256(_mm256_or_si256(_mm256_and_si256(upper, _mm256_set1_epi8(-'A')),
+                                    _mm256_and_si256(lower, _mm256_set1_epi8(26 - 'a'))),
+                    _mm256_or_si256(_mm256_and_si256(digit, _mm256_set1_epi8(52 - '0')),
+                                    _mm256_or_si256(_mm256_and_si256(is62, _mm256_sub_epi8(_mm256_set1_epi8(62), char62)),
+                                                    _mm256_and_si256(is63, _mm256_sub_epi8(_mm256_set1_epi8(63), char63)))));
+  return _mm256_add_epi8(input, offsets);
+}
+
+// After packing, each half has twelve bytes at its start; a permute brings
+// them together.
+__attribute__((target("avx2")))
+static inline size_t decode_base64_avx (uint8_t const* const src,
+                                        size_t const off,
+                                        size_t const len,
+                                        uint8_t* const dst,
+                                        size_t const dst_off,
+                                        diablo_base64_alphabet const alphabet) {
+  uint8_t const* const in = (uint8_t const*)&(src[off]);
+  uint8_t* const out = &(dst[dst_off]);
+  __m256i const char62 = _mm256_set1_epi8((char)base64_chars[alphabet][62]);
+  __m256i const char63 = _mm256_set1_epi8((char)base64_chars[alphabet][63]);
+  __m256i const gather = _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 3, 7);
+  size_t i = 0;
+  size_t o = 0;
+  for (; i + 32 <= len; i += 32, o += 24) {
+    __m256i valid;
+    __m256i const values = base64_values_avx(_mm256_loadu_si256((__m256i const*)(in + i)),
+                                             char62, char63, &valid);
+    if (((uint32_t)_mm256_movemask_epi8(valid)) != 0xFFFFFFFF) {
+      return i + decode_base64_rest(in, i, 32, out, o, alphabet);
+    }
+    __m256i const pairs = _mm256_maddubs_epi16(values, _mm256_set1_epi32(0x01400140));
+    __m256i const groups = _mm256_madd_epi16(pairs, _mm256_set1_epi32(0x00011000));
+    __m256i const packed =
+      _mm256_permutevar8x32_epi32(_mm256_shuffle_epi8(groups,
+                                                      _mm256_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8,
+                                                                       14, 13, 12, -1, -1, -1, -1,
+                                                                       2, 1, 0, 6, 5, 4, 10, 9, 8,
+                                                                       14, 13, 12, -1, -1, -1, -1)),
+                                  gather);
+    _mm_storeu_si128((__m128i*)(out + o), _mm256_castsi256_si128(packed));
+    _mm_storel_epi64((__m128i*)(out + o + 16), _mm256_extracti128_si256(packed, 1));
+  }
+  return i + decode_base64_ssse3(in, i, len - i, out, o, alphabet);
+}
+#endif
+
+#if (DIABLO_HAS_NEON)
+// The structured loads and stores split groups into separate vectors of their
+// first, second and third bytes (or first to fourth characters), and put them
+// back together, so only shifts are needed in between. Characters come from
+// the same reduction and lookup as encode_base64_ssse3.
+static inline void encode_base64_neon (uint8_t const* const src,
+                                       size_t const off,
+                                       size_t const len,
+                                       uint8_t* const dst,
+                                       size_t const dst_off,
+                                       diablo_base64_alphabet const alphabet) {
+  uint8_t const* const in = (uint8_t const*)&(src[off]);
+  uint8_t* const out = &(dst[dst_off]);
+  uint8_t const shift_bytes[16] = {
+    'a' - 26, (uint8_t)('0' - 52), (uint8_t)('0' - 52), (uint8_t)('0' - 52),
+    (uint8_t)('0' - 52), (uint8_t)('0' - 52), (uint8_t)('0' - 52), (uint8_t)('0' - 52),
+    (uint8_t)('0' - 52), (uint8_t)('0' - 52), (uint8_t)('0' - 52),
+    (uint8_t)(base64_chars[alphabet][62] - 62), (uint8_t)(base64_chars[alphabet][63] - 63),
+    'A', 0, 0
+  };
+  uint8x16_t const shifts = vld1q_u8(shift_bytes);
+  uint8x16_t const six_bits = vdupq_n_u8(0x3F);
+  size_t i = 0;
+  size_t o = 0;
+  for (; i + 48 <= len; i += 48, o += 64) {
+    uint8x16x3_t const input = vld3q_u8(in + i);
+    uint8x16x4_t indices = {{
+      vshrq_n_u8(input.val[0], 2),
+      vandq_u8(vorrq_u8(vshlq_n_u8(input.val[0], 4), vshrq_n_u8(input.val[1], 4)), six_bits),
+      vandq_u8(vorrq_u8(vshlq_n_u8(input.val[1], 2), vshrq_n_u8(input.val[2], 6)), six_bits),
+      vandq_u8(input.val[2], six_bits)
+    }};
+    for (size_t k = 0; k < 4; k++) {
+      uint8x16_t const reduced =
+        vorrq_u8(vqsubq_u8(indices.val[k], vdupq_n_u8(51)),
+                 vandq_u8(vcltq_u8(indices.val[k], vdupq_n_u8(26)), vdupq_n_u8(13)));
+      indices.val[k] = vaddq_u8(indices.val[k], lookup16(shifts, reduced));
+    }
+    vst4q_u8(out + o, indices);
+  }
+  encode_base64_rest(in, i, len - i, out, o, alphabet);
+}
+
+static inline uint8x16_t base64_values_neon (uint8x16_t const input,
+                                             uint8x16_t const char62,
+                                             uint8x16_t const char63,
+                                             uint8x16_t* const valid) {
+  uint8x16_t const upper = vandq_u8(vcgeq_u8(input, vdupq_n_u8('A')),
+                                    vcleq_u8(input, vdupq_n_u8('Z')));
+  uint8x16_t const lower = vandq_u8(vcgeq_u8(input, vdupq_n_u8('a')),
+                                    vcleq_u8(input, vdupq_n_u8('z')));
+  uint8x16_t const digit = vandq_u8(vcgeq_u8(input, vdupq_n_u8('0')),
+                                    vcleq_u8(input, vdupq_n_u8('9')));
+  uint8x16_t const is62 = vceqq_u8(input, char62);
+  uint8x16_t const is63 = vceqq_u8(input, char63);
+  *valid = vandq_u8(*valid, vorrq_u8(vorrq_u8(vorrq_u8(upper, lower), digit),
+                                     vorrq_u8(is62, is63)));
+  uint8x16_t const offsets =
+    vorrq_u8(vorrq_u8(vandq_u8(upper, vdupq_n_u8((uint8_t)-'A')),
+                      vandq_u8(lower, vdupq_n_u8((uint8_t)(26 - 'a')))),
+             vorrq_u8(vandq_u8(digit, vdupq_n_u8((uint8_t)(52 - '0'))),
+                      vorrq_u8(vandq_u8(is62, vsubq_u8(vdupq_n_u8(62), char62)),
+                               vandq_u8(is63, vsubq_u8(vdupq_n_u8(63), char63)))));
+  return vaddq_u8(input, offsets);
+}
+
+static inline size_t decode_base64_neon (uint8_t const* const src,
+                                         size_t const off,
+                                         size_t const len,
+                                         uint8_t* const dst,
+                                         size_t const dst_off,
+                                         diablo_base64_alphabet const alphabet) {
+  uint8_t const* const in = (uint8_t const*)&(src[off]);
+  uint8_t* const out = &(dst[dst_off]);
+  uint8x16_t const char62 = vdupq_n_u8(base64_chars[alphabet][62]);
+  uint8x16_t const char63 = vdupq_n_u8(base64_chars[alphabet][63]);
+  size_t i = 0;
+  size_t o = 0;
+  for (; i + 64 <= len; i += 64, o += 48) {
+    uint8x16x4_t const input = vld4q_u8(in + i);
+    uint8x16_t valid = vdupq_n_u8(0xFF);
+    uint8x16_t const a = base64_values_neon(input.val[0], char62, char63, &valid);
+    uint8x16_t const b = base64_values_neon(input.val[1], char62, char63, &valid);
+    uint8x16_t const c = base64_values_neon(input.val[2], char62, char63, &valid);
+    uint8x16_t const d = base64_values_neon(input.val[3], char62, char63, &valid);
+    if (any_set(vmvnq_u8(valid))) {
+      return i + decode_base64_rest(in, i, 64, out, o, alphabet);
+    }
+    uint8x16x3_t const output = {{
+      vorrq_u8(vshlq_n_u8(a, 2), vshrq_n_u8(b, 4)),
+      vorrq_u8(vshlq_n_u8(b, 4), vshrq_n_u8(c, 2)),
+      vorrq_u8(vshlq_n_u8(c, 6), d)
+    }};
+    vst3q_u8(out + o, output);
+  }
+  return i + decode_base64_rest(in, i, len - i, out, o, alphabet);
+}
+#endif
+
+typedef void (*encode_base64_kernel) (uint8_t const* const,
+                                      size_t const,
+                                      size_t const,
+                                      uint8_t* const,
+                                      size_t const,
+                                      diablo_base64_alphabet const);
+
+static encode_base64_kernel const encode_base64_kernels[DIABLO_BACKEND_COUNT] = {
+  [DIABLO_BACKEND_SWAR] = encode_base64_rest,
+#if (DIABLO_HAS_SSE2)
+  [DIABLO_BACKEND_SSE2] = encode_base64_rest,
+#endif
+#if (DIABLO_HAS_SSSE3)
+  [DIABLO_BACKEND_SSSE3] = encode_base64_ssse3,
+#endif
+#if (DIABLO_HAS_AVX2)
+  [DIABLO_BACKEND_AVX2] = encode_base64_avx,
+#endif
+#if (DIABLO_HAS_NEON)
+  [DIABLO_BACKEND_NEON] = encode_base64_neon,
+#endif
+#if (DIABLO_HAS_AVX512BW)
+  [DIABLO_BACKEND_AVX512BW] = encode_base64_avx,
+#endif
+};
+
+typedef size_t (*decode_base64_kernel) (uint8_t const* const,
+                                        size_t const,
+                                        size_t const,
+                                        uint8_t* const,
+                                        size_t const,
+                                        diablo_base64_alphabet const);
+
+static decode_base64_kernel const decode_base64_kernels[DIABLO_BACKEND_COUNT] = {
+  [DIABLO_BACKEND_SWAR] = decode_base64_rest,
+#if (DIABLO_HAS_SSE2)
+  [DIABLO_BACKEND_SSE2] = decode_base64_rest,
+#endif
+#if (DIABLO_HAS_SSSE3)
+  [DIABLO_BACKEND_SSSE3] = decode_base64_ssse3,
+#endif
+#if (DIABLO_HAS_AVX2)
+  [DIABLO_BACKEND_AVX2] = decode_base64_avx,
+#endif
+#if (DIABLO_HAS_NEON)
+  [DIABLO_BACKEND_NEON] = decode_base64_neon,
+#endif
+#if (DIABLO_HAS_AVX512BW)
+  [DIABLO_BACKEND_AVX512BW] = decode_base64_avx,
+#endif
+};
+
+size_t diablo_base64_encoded_length (size_t const len,
+                                     bool const pad) {
+  size_t const groups = len / 3;
+  size_t const extra = len % 3;
+  if (extra == 0) {
+    return 4 * groups;
+  }
+  return (4 * groups) + (pad ? 4 : extra + 1);
+}
+
+size_t diablo_encode_base64 (uint8_t const* const src,
+                             size_t const off,
+                             size_t const len,
+                             uint8_t* const dst,
+                             size_t const dst_off,
+                             diablo_base64_alphabet const alphabet,
+                             bool const pad) {
+  STATS_RECORD(STATS_ENCODE_BASE64, len);
+  size_t const whole = len - (len % 3);
+  encode_base64_kernels[active_backend()](src, off, whole, dst, dst_off, alphabet);
+  uint8_t const* const in = (uint8_t const*)&(src[off + whole]);
+  uint8_t* out = &(dst[dst_off + ((whole / 3) * 4)]);
+  uint8_t const* const chars = base64_chars[alphabet];
+  if (len % 3 == 1) {
+    *out++ = chars[in[0] >> 2];
+    *out++ = chars[(in[0] & 0x03) << 4];
+    if (pad) {
+      *out++ = '=';
+      *out++ = '=';
+    }
+  } else if (len % 3 == 2) {
+    *out++ = chars[in[0] >> 2];
+    *out++ = chars[((in[0] & 0x03) << 4) | (in[1] >> 4)];
+    *out++ = chars[(in[1] & 0x0F) << 2];
+    if (pad) {
+      *out++ = '=';
+    }
+  }
+  return diablo_base64_encoded_length(len, pad);
+}
+
+// Padding is only padding if it makes the length a multiple of 4.
+static inline size_t unpadded_length (uint8_t const* const in,
+                                      size_t const len) {
+  if (len == 0 || len % 4 != 0 || in[len - 1] != '=') {
+    return len;
+  }
+  return (in[len - 2] == '=') ? len - 2 : len - 1;
+}
+
+size_t diablo_base64_decoded_length (uint8_t const* const src,
+                                     size_t const off,
+                                     size_t const len) {
+  size_t const body = unpadded_length((uint8_t const*)&(src[off]), len);
+  return ((body / 4) * 3) + ((body % 4 == 0) ? 0 : (body % 4) - 1);
+}
+
+// The characters of a partial group must make whole bytes, with nothing left
+// over: one character can't, and the bits past the last byte must be zero, so
+// that each input has only one encoding.
+size_t diablo_decode_base64 (uint8_t const* const src,
+                             size_t const off,
+                             size_t const len,
+                             uint8_t* const dst,
+                             size_t const dst_off,
+                             diablo_base64_alphabet const alphabet) {
+  STATS_RECORD(STATS_DECODE_BASE64, len);
+  uint8_t const* const in = (uint8_t const*)&(src[off]);
+  size_t const body = unpadded_length(in, len);
+  size_t const whole = body - (body % 4);
+  size_t const pos = decode_base64_kernels[active_backend()](src, off, whole,
+                                                             dst, dst_off, alphabet);
+  if (pos != whole) {
+    return pos;
+  }
+  uint8_t const* const values = base64_values[alphabet];
+  for (size_t i = whole; i < body; i++) {
+    if (values[in[i]] == 0xFF) {
+      return i;
+    }
+  }
+  uint8_t* const out = &(dst[dst_off + ((whole / 4) * 3)]);
+  switch (body - whole) {
+    case 1:
+      return whole;
+    case 2: {
+      uint8_t const a = values[in[whole]];
+      uint8_t const b = values[in[whole + 1]];
+      if ((b & 0x0F) != 0) {
+        return whole + 1;
+      }
+      out[0] = (uint8_t)((a << 2) | (b >> 4));
+      break;
+    }
+    case 3: {
+      uint8_t const a = values[in[whole]];
+      uint8_t const b = values[in[whole + 1]];
+      uint8_t const c = values[in[whole + 2]];
+      if ((c & 0x03) != 0) {
+        return whole + 2;
+      }
+      out[0] = (uint8_t)((a << 2) | (b >> 4));
+      out[1] = (uint8_t)((b << 4) | (c >> 2));
+      break;
+    }
+    default:
+      break;
+  }
+  return len;
+}
@@ -0,0 +1,96 @@
+/*
+ * Copyright 2021 Koz Ross <koz.ross@retro-freedom.nz>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <stddef.h>
+#include <string.h>
+#include "../include/diablo.h"
+#include "stats.h"
+
+// Histograms don't benefit from our SIMD backends: every byte is a scattered
+// increment, and none of the instruction sets we target can do those faster
+// than the scalar approach below. Thus, there is one implementation, and no
+// dispatch.
+//
+// The naive loop (hist[byte]++) stalls whenever nearby bytes are equal, as each
+// increment has to wait for the previous one's store. We avoid this by spreading
+// consecutive bytes over several sub-histograms, which we sum at the end.
+
+// How many sub-histograms we use.
+#define SUB_HISTOGRAMS 4
+
+// How many bytes we count before flushing the sub-histograms. This keeps their
+// 32-bit counters from overflowing.
+#define FLUSH_INTERVAL (((size_t)1) << 31)
+
+// Below this length, setting up and flushing the sub-histograms costs more than
+// it saves.
+#define NAIVE_THRESHOLD 256
+
+static inline void histogram_rest (uint8_t const* const src,
+                                   size_t const len,
+                                   size_t* const hist) {
+  for (size_t i = 0; i < len; i++) {
+    hist[src[i]]++;
+  }
+}
+
+static inline void histogram_chunk (uint8_t const* const src,
+                                    size_t const len,
+                                    size_t* const hist) {
+  uint32_t counts[SUB_HISTOGRAMS][256];
+  memset(counts, 0, sizeof(counts));
+  size_t const big_strides = len / 8;
+  size_t const small_strides = len % 8;
+  uint8_t const* ptr = src;
+  for (size_t i = 0; i < big_strides; i++) {
+    uint64_t const input = *((uint64_t const*)ptr);
+    // Manual 8x loop unroll
+    counts[0][(uint8_t)input]++;
+    counts[1][(uint8_t)(input >> 8)]++;
+    counts[2][(uint8_t)(input >> 16)]++;
+    counts[3][(uint8_t)(input >> 24)]++;
+    counts[0][(uint8_t)(input >> 32)]++;
+    counts[1][(uint8_t)(input >> 40)]++;
+    counts[2][(uint8_t)(input >> 48)]++;
+    counts[3][(uint8_t)(input >> 56)]++;
+    ptr += 8;
+  }
+  for (size_t i = 0; i < small_strides; i++) {
+    counts[0][ptr[i]]++;
+  }
+  for (size_t byte = 0; byte < 256; byte++) {
+    hist[byte] += (size_t)counts[0][byte] + counts[1][byte] +
+                  counts[2][byte] + counts[3][byte];
+  }
+}
+
+void diablo_byte_histogram (uint8_t const* const src,
+                            size_t const off,
+                            size_t const len,
+                            size_t* const hist) {
+  STATS_RECORD(STATS_BYTE_HISTOGRAM, len);
+  uint8_t const* ptr = (uint8_t const*)&(src[off]);
+  if (len < NAIVE_THRESHOLD) {
+    histogram_rest(ptr, len, hist);
+    return;
+  }
+  size_t remaining = len;
+  while (remaining != 0) {
+    size_t const chunk = (remaining < FLUSH_INTERVAL) ? remaining : FLUSH_INTERVAL;
+    histogram_chunk(ptr, chunk, hist);
+    ptr += chunk;
+    remaining -= chunk;
+  }
+}
@@ -0,0 +1,160 @@
+/*
+ * Copyright 2021 Koz Ross <koz.ross@retro-freedom.nz>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+#include <stdint.h>
+#include <stdlib.h>
+#include "dispatch.h"
+
+// Small helpers shared between operations.
+
+// Fill every 8-byte 'lane' with the same value.
+static inline uint64_t broadcast (uint8_t const byte) {
+  return byte * 0x0101010101010101ULL;
+}
+
+// The lowest n bits set, for 0 <= n <= 64.
+static inline uint64_t low_mask (size_t const n) {
+  return (n >= 64) ? ~0ULL : ((1ULL << n) - 1);
+}
+
+// The index of the nth (from 0) lowest set bit of word, which must have more
+// than n bits set. We halve the search window by popcount until at most a byte
+// is left, then clear bits one at a time.
+static inline size_t select_bit (uint64_t word, size_t n) {
+  size_t pos = 0;
+  for (size_t width = 32; width >= 8; width /= 2) {
+    size_t const below = __builtin_popcountll(word & low_mask(width));
+    if (n >= below) {
+      n -= below;
+      word >>= width;
+      pos += width;
+    }
+  }
+  for (; n > 0; n--) {
+    word &= (word - 1);
+  }
+  return pos + __builtin_ctzll(word);
+}
+
+// Each bit becomes the XOR of itself and every bit below it. Given a mask of
+// quote positions, this marks every position from an opening quote up to (but
+// not including) its closing quote.
+static inline uint64_t prefix_xor (uint64_t x) {
+  x ^= x << 1;
+  x ^= x << 2;
+  x ^= x << 4;
+  x ^= x << 8;
+  x ^= x << 16;
+  x ^= x << 32;
+  return x;
+}
+
+// SWAR byte matching
+//
+// These work on 64-bit words loaded directly from memory, and so care about
+// byte order: 'first' and 'last' refer to memory order.
+
+// Set the high bit of every byte of word which equals the corresponding byte of
+// matches, and clear every other bit. Unlike the usual 'has zero byte' trick,
+// this has no false positives.
+static inline uint64_t eq_flags (uint64_t const word, uint64_t const matches) {
+  uint64_t const mask = 0x7F7F7F7F7F7F7F7FULL;
+  uint64_t const input = word ^ matches;
+  uint64_t const tmp = (input & mask) + mask;
+  return ~(tmp | input | mask);
+}
+
+// The index of the first byte whose flag is set. flags must not be zero.
+static inline size_t first_flagged (uint64_t const flags) {
+#if (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+  return __builtin_clzll(flags) / 8;
+#else
+  return __builtin_ctzll(flags) / 8;
+#endif
+}
+
+// The index of the last byte whose flag is set. flags must not be zero.
+static inline size_t last_flagged (uint64_t const flags) {
+#if (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+  return 7 - (__builtin_ctzll(flags) / 8);
+#else
+  return 7 - (__builtin_clzll(flags) / 8);
+#endif
+}
+
+// Clear the flag of the first flagged byte. flags must not be zero.
+static inline uint64_t clear_first_flagged (uint64_t const flags) {
+#if (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+  return flags & ~(0x8000000000000000ULL >> __builtin_clzll(flags));
+#else
+  return flags & (flags - 1);
+#endif
+}
+
+// How many bytes have their flag set.
+static inline size_t count_flagged (uint64_t const flags) {
+  return ((flags >> 7) * 0x0101010101010101ULL) >> 56;
+}
+
+// Clear the flags of the first n bytes, for 0 <= n <= 8.
+static inline uint64_t clear_first_bytes (uint64_t const flags, size_t const n) {
+#if (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+  return flags & low_mask(64 - (8 * n));
+#else
+  return flags & ~low_mask(8 * n);
+#endif
+}
+
+#if (DIABLO_HAS_NEON)
+#include <arm_neon.h>
+
+// NEON has no movemask. Instead, a shifting narrow turns a comparison result
+// into a 64-bit mask with four bits per lane, in lane order.
+static inline uint64_t nibble_mask (uint8x16_t const cmp) {
+  uint8x8_t const narrowed = vshrn_n_u16(vreinterpretq_u16_u8(cmp), 4);
+  return vget_lane_u64(vreinterpret_u64_u8(narrowed), 0);
+}
+
+// One bit per lane, in lane order, like SSE2's movemask. We take one bit of
+// each nibble of nibble_mask, then squeeze out the gaps.
+static inline uint64_t movemask_neon (uint8x16_t const cmp) {
+  uint64_t x = nibble_mask(cmp) & 0x1111111111111111ULL;
+  x = (x | (x >> 3)) & 0x0303030303030303ULL;
+  x = (x | (x >> 6)) & 0x000F000F000F000FULL;
+  x = (x | (x >> 12)) & 0x000000FF000000FFULL;
+  x = (x | (x >> 24)) & 0x000000000000FFFFULL;
+  return x;
+}
+
+// Whether any bit of the vector is set.
+static inline bool any_set (uint8x16_t const v) {
+  uint8x8_t const folded = vorr_u8(vget_low_u8(v), vget_high_u8(v));
+  return vget_lane_u64(vreinterpret_u64_u8(folded), 0) != 0;
+}
+
+// A 16-entry table lookup, giving 0x00 for indices past the end. AArch64 does
+// this in one instruction; 32-bit ARM needs two 8-byte halves.
+static inline uint8x16_t lookup16 (uint8x16_t const table,
+                                   uint8x16_t const indices) {
+#if (__aarch64__)
+  return vqtbl1q_u8(table, indices);
+#else
+  uint8x8x2_t const halves = {{ vget_low_u8(table), vget_high_u8(table) }};
+  return vcombine_u8(vtbl2_u8(halves, vget_low_u8(indices)),
+                     vtbl2_u8(halves, vget_high_u8(indices)));
+#endif
+}
+#endif
@@ -0,0 +1,297 @@
+/*
+ * Copyright 2021 Koz Ross <koz.ross@retro-freedom.nz>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <stddef.h>
+#include "common.h"
+#include "dispatch.h"
+#include "stats.h"
+
+// Each kernel counts up to MULTI_NEEDLES needles in one pass. They work like
+// the count_eq kernels, loading each 64-byte block once, then comparing it
+// against every needle in turn, with a separate accumulator for each. Counts
+// are added to whatever is in counts already.
+#define MULTI_NEEDLES 8
+
+static inline void count_eq_multi_rest (uint8_t const* const ptr,
+                                        size_t const len,
+                                        uint8_t const* const needles,
+                                        size_t const needles_len,
+                                        size_t* const counts) {
+  for (size_t i = 0; i < len; i++) {
+    for (size_t j = 0; j < needles_len; j++) {
+      if (ptr[i] == needles[j]) {
+        counts[j]++;
+      }
+    }
+  }
+}
+
+// SWAR implementation, used as the fallback everywhere.
+//
+// As in count_eq_swar, we flag matches in each of eight words, shifting each
+// word's flags to a different bit, then popcount the lot.
+static inline void count_eq_multi_swar (uint8_t const* const src,
+                                        size_t const off,
+                                        size_t const len,
+                                        uint8_t const* const needles,
+                                        size_t const needles_len,
+                                        size_t* const counts) {
+  size_t const big_strides = len / 64;
+  size_t const small_strides = len % 64;
+  uint8_t const* ptr = (uint8_t const*)&(src[off]);
+  uint64_t matches[MULTI_NEEDLES];
+  for (size_t j = 0; j < needles_len; j++) {
+    matches[j] = broadcast(needles[j]);
+  }
+  for (size_t i = 0; i < big_strides; i++) {
+    uint64_t const* const big_ptr = (uint64_t const* const)ptr;
+    uint64_t inputs[8];
+    for (size_t k = 0; k < 8; k++) {
+      inputs[k] = big_ptr[k];
+    }
+    for (size_t j = 0; j < needles_len; j++) {
+      uint64_t result = 0;
+      for (size_t k = 0; k < 8; k++) {
+        result |= eq_flags(inputs[k], matches[j]) >> k;
+      }
+      counts[j] += __builtin_popcountll(result);
+    }
+    ptr += 64;
+  }
+  count_eq_multi_rest(ptr, small_strides, needles, needles_len, counts);
+}
+
+#if (DIABLO_HAS_SSE2)
+#include <emmintrin.h>
+
+static inline void count_eq_multi_sse (uint8_t const* const src,
+                                       size_t const off,
+                                       size_t const len,
+                                       uint8_t const* const needles,
+                                       size_t const needles_len,
+                                       size_t* const counts) {
+  size_t const big_strides = len / 64;
+  size_t const small_strides = len % 64;
+  uint8_t const* ptr = (uint8_t const*)&(src[off]);
+  if (big_strides != 0) {
+    __m128i const zero = _mm_setzero_si128();
+    __m128i matches[MULTI_NEEDLES];
+    __m128i totals[MULTI_NEEDLES];
+    for (size_t j = 0; j < needles_len; j++) {
+      matches[j] = _mm_set1_epi8(needles[j]);
+      totals[j] = zero;
+    }
+    for (size_t i = 0; i < big_strides; i++) {
+      __m128i const* big_ptr = (__m128i const*)ptr;
+      __m128i const inputs[4] = {
+        _mm_loadu_si128(big_ptr),
+        _mm_loadu_si128(big_ptr + 1),
+        _mm_loadu_si128(big_ptr + 2),
+        _mm_loadu_si128(big_ptr + 3)
+      };
+      // The same add, negate and SAD as count_eq_sse, once per needle.
+      for (size_t j = 0; j < needles_len; j++) {
+        __m128i const summed =
+          _mm_add_epi8(_mm_add_epi8(_mm_cmpeq_epi8(matches[j], inputs[0]),
+                                    _mm_cmpeq_epi8(matches[j], inputs[1])),
+                       _mm_add_epi8(_mm_cmpeq_epi8(matches[j], inputs[2]),
+                                    _mm_cmpeq_epi8(matches[j], inputs[3])));
+        totals[j] = _mm_add_epi64(totals[j],
+                                  _mm_sad_epu8(_mm_sub_epi8(zero, summed), zero));
+      }
+      ptr += 64;
+    }
+    // Evacuate results and sum.
+    for (size_t j = 0; j < needles_len; j++) {
+      uint64_t results[2];
+      _mm_storeu_si128((__m128i*)results, totals[j]);
+      counts[j] += (results[0] + results[1]);
+    }
+  }
+  count_eq_multi_rest(ptr, small_strides, needles, needles_len, counts);
+}
+#endif
+
+#if (DIABLO_HAS_AVX2)
+#include <immintrin.h>
+
+__attribute__((target("avx2")))
+static inline void count_eq_multi_avx (uint8_t const* const src,
+                                       size_t const off,
+                                       size_t const len,
+                                       uint8_t const* const needles,
+                                       size_t const needles_len,
+                                       size_t* const counts) {
+  size_t const big_strides = len / 64;
+  size_t const small_strides = len % 64;
+  uint8_t const* ptr = (uint8_t const*)&(src[off]);
+  if (big_strides != 0) {
+    __m256i const zero = _mm256_setzero_si256();
+    __m256i matches[MULTI_NEEDLES];
+    __m256i totals[MULTI_NEEDLES];
+    for (size_t j = 0; j < needles_len; j++) {
+      matches[j] = _mm256_set1_epi8(needles[j]);
+      totals[j] = zero;
+    }
+    for (size_t i = 0; i < big_strides; i++) {
+      __m256i const* big_ptr = (__m256i const*)ptr;
+      __m256i const inputs[2] = {
+        _mm256_loadu_si256(big_ptr),
+        _mm256_loadu_si256(big_ptr + 1)
+      };
+      // The same add, negate and SAD as count_eq_avx, once per needle.
+      for (size_t j = 0; j < needles_len; j++) {
+        __m256i const summed =
+          _mm256_add_epi8(_mm256_cmpeq_epi8(matches[j], inputs[0]),
+                          _mm256_cmpeq_epi8(matches[j], inputs[1]));
+        totals[j] = _mm256_add_epi64(totals[j],
+                                     _mm256_sad_epu8(_mm256_sub_epi8(zero, summed), zero));
+      }
+      ptr += 64;
+    }
+    // Evacuate results and sum.
+    for (size_t j = 0; j < needles_len; j++) {
+      counts[j] += _mm256_extract_epi64(totals[j], 0) +
+                   _mm256_extract_epi64(totals[j], 1) +
+                   _mm256_extract_epi64(totals[j], 2) +
+                   _mm256_extract_epi64(totals[j], 3);
+    }
+  }
+  count_eq_multi_rest(ptr, small_strides, needles, needles_len, counts);
+}
+#endif
+
+#if (DIABLO_HAS_AVX512BW)
+// As count_eq_avx512, this popcounts comparison masks, and uses masked loads
+// for the ragged ends.
+__attribute__((target("avx512bw,popcnt")))
+static inline void count_eq_multi_avx512 (uint8_t const* const src,
+                                          size_t const off,
+                                          size_t const len,
+                                          uint8_t const* const needles,
+                                          size_t const needles_len,
+                                          size_t* const counts) {
+  uint8_t const* const ptr = (uint8_t const*)&(src[off]);
+  __m512i matches[MULTI_NEEDLES];
+  for (size_t j = 0; j < needles_len; j++) {
+    matches[j] = _mm512_set1_epi8(needles[j]);
+  }
+  size_t i = 0;
+  for (; i + 64 <= len; i += 64) {
+    __m512i const input = _mm512_loadu_si512((void const*)(ptr + i));
+    for (size_t j = 0; j < needles_len; j++) {
+      counts[j] += _mm_popcnt_u64(_mm512_cmpeq_epi8_mask(matches[j], input));
+    }
+  }
+  if (i < len) {
+    __mmask64 const mask = low_mask(len - i);
+    __m512i const input = _mm512_maskz_loadu_epi8(mask, ptr + i);
+    for (size_t j = 0; j < needles_len; j++) {
+      counts[j] += _mm_popcnt_u64(_mm512_mask_cmpeq_epi8_mask(mask, matches[j], input));
+    }
+  }
+}
+#endif
+
+#if (DIABLO_HAS_NEON)
+static inline void count_eq_multi_neon (uint8_t const* const src,
+                                        size_t const off,
+                                        size_t const len,
+                                        uint8_t const* const needles,
+                                        size_t const needles_len,
+                                        size_t* const counts) {
+  size_t const big_strides = len / 64;
+  size_t const small_strides = len % 64;
+  uint8_t const* ptr = (uint8_t const*)&(src[off]);
+  if (big_strides != 0) {
+    uint8x16_t matches[MULTI_NEEDLES];
+    uint64x2_t totals[MULTI_NEEDLES];
+    for (size_t j = 0; j < needles_len; j++) {
+      matches[j] = vdupq_n_u8(needles[j]);
+      totals[j] = vdupq_n_u64(0);
+    }
+    for (size_t i = 0; i < big_strides; i++) {
+      uint8x16_t const inputs[4] = {
+        vld1q_u8(ptr),
+        vld1q_u8(ptr + 16),
+        vld1q_u8(ptr + 32),
+        vld1q_u8(ptr + 48)
+      };
+      // The same add, absolute value and horizontal sum as count_eq_neon, once
+      // per needle.
+      for (size_t j = 0; j < needles_len; j++) {
+        int8x16_t const summed =
+          vaddq_s8(vaddq_s8(vreinterpretq_s8_u8(vceqq_u8(matches[j], inputs[0])),
+                            vreinterpretq_s8_u8(vceqq_u8(matches[j], inputs[1]))),
+                   vaddq_s8(vreinterpretq_s8_u8(vceqq_u8(matches[j], inputs[2])),
+                            vreinterpretq_s8_u8(vceqq_u8(matches[j], inputs[3]))));
+        uint8x16_t const absolute = vreinterpretq_u8_s8(vabsq_s8(summed));
+        totals[j] = vaddq_u64(totals[j],
+                              vpaddlq_u32(vpaddlq_u16(vpaddlq_u8(absolute))));
+      }
+      ptr += 64;
+    }
+    // Evacuate and sum.
+    for (size_t j = 0; j < needles_len; j++) {
+      counts[j] += (vgetq_lane_u64(totals[j], 0) + vgetq_lane_u64(totals[j], 1));
+    }
+  }
+  count_eq_multi_rest(ptr, small_strides, needles, needles_len, counts);
+}
+#endif
+
+typedef void (*count_eq_multi_kernel) (uint8_t const* const,
+                                       size_t const,
+                                       size_t const,
+                                       uint8_t const* const,
+                                       size_t const,
+                                       size_t* const);
+
+static count_eq_multi_kernel const count_eq_multi_kernels[DIABLO_BACKEND_COUNT] = {
+  [DIABLO_BACKEND_SWAR] = count_eq_multi_swar,
+#if (DIABLO_HAS_SSE2)
+  [DIABLO_BACKEND_SSE2] = count_eq_multi_sse,
+#endif
+#if (DIABLO_HAS_SSSE3)
+  [DIABLO_BACKEND_SSSE3] = count_eq_multi_sse,
+#endif
+#if (DIABLO_HAS_AVX2)
+  [DIABLO_BACKEND_AVX2] = count_eq_multi_avx,
+#endif
+#if (DIABLO_HAS_NEON)
+  [DIABLO_BACKEND_NEON] = count_eq_multi_neon,
+#endif
+#if (DIABLO_HAS_AVX512BW)
+  [DIABLO_BACKEND_AVX512BW] = count_eq_multi_avx512,
+#endif
+};
+
+void diablo_count_eq_multi (uint8_t const* const src,
+                            size_t const off,
+                            size_t const len,
+                            uint8_t const* const needles,
+                            size_t const needles_len,
+                            size_t* const counts) {
+  STATS_RECORD(STATS_COUNT_EQ_MULTI, len);
+  count_eq_multi_kernel const kernel = count_eq_multi_kernels[active_backend()];
+  for (size_t j = 0; j < needles_len; j++) {
+    counts[j] = 0;
+  }
+  // More needles than one pass can take need several passes.
+  for (size_t j = 0; j < needles_len; j += MULTI_NEEDLES) {
+    size_t const group = (needles_len - j < MULTI_NEEDLES) ? needles_len - j : MULTI_NEEDLES;
+    kernel(src, off, len, needles + j, group, counts + j);
+  }
+}
@@ -13,8 +13,12 @@
  * See the License for the specific language governing permissions and
  * limitations under the License.
  */
+#include <stdatomic.h>
 #include <stddef.h>
-#include "../include/diablo.h"
+#include "common.h"
+#include "dispatch.h"
+#include "stats.h"
+#include "pool.h"
 
 static inline size_t count_eq_rest (uint8_t const* const src, 
                                     size_t const len,
@@ -30,7 +34,97 @@ static inline size_t count_eq_rest (uint8_t const* const src,
   return count;
 }
 
-#if (__SSE2__)
+// SWAR implementation, used as the fallback everywhere.
+//
+// We use the method described in "Bit Twiddling Hacks".
+// Source: https://graphics.stanford.edu/~seander/bithacks.html#ZeroInWord
+
+// Load a 64-bit word, then set every byte which matches to 0x80, while setting
+// the others to 0x00.
+static inline uint64_t load_and_set (uint64_t const* const big_ptr,
+                                     size_t const i,
+                                     uint64_t const matches,
+                                     uint64_t const mask) {
+  uint64_t const input = big_ptr[i] ^ matches;
+  uint64_t const tmp = (input & mask) + mask;
+  return (~(tmp | input | mask) >> i);
+}
+
+static inline size_t count_eq_swar (uint8_t const* const src,
+                                    size_t const off,
+                                    size_t const len,
+                                    uint8_t const byte) {
+  size_t count = 0;
+  size_t const big_strides = len / 64;
+  size_t const small_strides = len % 64;
+  uint8_t const* ptr = (uint8_t const*)&(src[off]);
+  if (big_strides != 0) {
+    uint64_t const matches = broadcast(byte);
+    uint64_t const mask = broadcast(0x7F);
+    for (size_t i = 0; i < big_strides; i++) {
+      uint64_t const* const big_ptr = (uint64_t const* const)ptr;
+      uint64_t result = 0;
+      // Manual 8x loop unroll
+      result |= load_and_set(big_ptr, 0, matches, mask);
+      result |= load_and_set(big_ptr, 1, matches, mask);
+      result |= load_and_set(big_ptr, 2, matches, mask);
+      result |= load_and_set(big_ptr, 3, matches, mask);
+      result |= load_and_set(big_ptr, 4, matches, mask);
+      result |= load_and_set(big_ptr, 5, matches, mask);
+      result |= load_and_set(big_ptr, 6, matches, mask);
+      result |= load_and_set(big_ptr, 7, matches, mask);
+      count += __builtin_popcountll(result);
+      ptr += 64;
+    }
+  }
+  count += count_eq_rest(ptr, small_strides, byte);
+  return count;
+}
+
+// Batched counting
+//
+// Most slices in a batch are short, so count_eq_rest would do most of the work
+// for them. Instead, below SHORT_SLICE bytes, we finish each slice with a
+// vector (or word) which overlaps the one before it, masking out the lanes
+// we've already counted. Longer slices use the usual kernels.
+#define SHORT_SLICE 256
+
+// Slices of at least 8 bytes go a word at a time.
+static inline size_t count_eq_short_swar (uint8_t const* const ptr,
+                                          size_t const len,
+                                          uint8_t const byte) {
+  if (len < 8) {
+    return count_eq_rest(ptr, len, byte);
+  }
+  uint64_t const matches = broadcast(byte);
+  size_t count = 0;
+  size_t i = 0;
+  for (; i + 8 <= len; i += 8) {
+    count += count_flagged(eq_flags(*((uint64_t const*)(ptr + i)), matches));
+  }
+  if (i < len) {
+    uint64_t const flags = eq_flags(*((uint64_t const*)(ptr + len - 8)), matches);
+    count += count_flagged(clear_first_bytes(flags, i + 8 - len));
+  }
+  return count;
+}
+
+#if (DIABLO_HAS_SSE2 || DIABLO_HAS_NEON)
+// Loading a vector from tail_lanes + 32 - n gives 0x00 in the first n lanes,
+// and 0xFF in the rest, for 0 <= n <= 32.
+static uint8_t const tail_lanes[64] = {
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF
+};
+#endif
+
+#if (DIABLO_HAS_SSE2)
 #include <emmintrin.h>
 
 static inline size_t count_eq_sse (uint8_t const* const src,
@@ -60,9 +154,11 @@ static inline size_t count_eq_sse (uint8_t const* const src,
       // negative) by adding.
       __m128i const summed = _mm_add_epi8(_mm_add_epi8(results[0], results[1]),
                                           _mm_add_epi8(results[2], results[3]));
-      // By taking the sum of absolute differences with 0x00 in each lane, we
-      // get two 64-bit counts, which we accumulate.
-      counts = _mm_add_epi64(counts, _mm_sad_epu8(summed, _mm_setzero_si128()));
+      // Negating that, then taking the sum of absolute differences with 0x00
+      // in each lane, we get two 64-bit counts, which we accumulate.
+      __m128i const zero = _mm_setzero_si128();
+      counts = _mm_add_epi64(counts,
+                             _mm_sad_epu8(_mm_sub_epi8(zero, summed), zero));
       ptr += 64;
     }
     // Evacuate results and sum.
@@ -73,17 +169,36 @@ static inline size_t count_eq_sse (uint8_t const* const src,
   count += count_eq_rest(ptr, small_strides, byte);
   return count;
 }
-
-#if (__i386__)
-// Pure SSE implementation, as 32-bit x86 _cannot_ have AVX.
-size_t diablo_count_eq (uint8_t const* const src,
-                        size_t const off,
-                        size_t const len,
-                        uint8_t const byte) {
-  return count_eq_sse(src, off, len, byte);
+// Each lane counts at most one match per vector, and short slices have fewer
+// than 256 vectors, so we can count in bytes and only reduce at the end.
+static inline size_t count_eq_short_sse (uint8_t const* const ptr,
+                                         size_t const len,
+                                         uint8_t const byte) {
+  if (len < 16) {
+    return count_eq_short_swar(ptr, len, byte);
+  }
+  __m128i const matches = _mm_set1_epi8(byte);
+  __m128i const zero = _mm_setzero_si128();
+  __m128i counts = zero;
+  size_t i = 0;
+  for (; i + 16 <= len; i += 16) {
+    counts = _mm_sub_epi8(counts,
+                          _mm_cmpeq_epi8(matches, _mm_loadu_si128((__m128i const*)(ptr + i))));
+  }
+  if (i < len) {
+    __m128i const fresh =
+      _mm_loadu_si128((__m128i const*)(tail_lanes + 32 - (i + 16 - len)));
+    __m128i const result =
+      _mm_cmpeq_epi8(matches, _mm_loadu_si128((__m128i const*)(ptr + len - 16)));
+    counts = _mm_sub_epi8(counts, _mm_and_si128(result, fresh));
+  }
+  uint64_t results[2];
+  _mm_storeu_si128((__m128i*)results, _mm_sad_epu8(counts, zero));
+  return results[0] + results[1];
 }
-#else
-// Mixed AVX/SSE with runtime detection.
+#endif
+
+#if (DIABLO_HAS_AVX2)
 #include <immintrin.h>
 
 __attribute__((target("avx2")))
@@ -111,9 +226,11 @@ static inline size_t count_eq_avx (uint8_t const* const src,
       // Since 0xFF is -1, we can get a line-by-lane match count (except
       // negative), by adding.
       __m256i const summed = _mm256_add_epi8(results[0], results[1]);
-      // By taking the sum of absolute differences with 0x00 in each lane, we
-      // get four 64-bit counts, which we accumulate.
-      counts = _mm256_add_epi64(counts, _mm256_sad_epu8(summed, _mm256_setzero_si256()));
+      // Negating that, then taking the sum of absolute differences with 0x00
+      // in each lane, we get four 64-bit counts, which we accumulate.
+      __m256i const zero = _mm256_setzero_si256();
+      counts = _mm256_add_epi64(counts,
+                                _mm256_sad_epu8(_mm256_sub_epi8(zero, summed), zero));
       ptr += 64;
     }
     // Evacuate results and sum.
@@ -125,28 +242,96 @@ static inline size_t count_eq_avx (uint8_t const* const src,
   count += count_eq_rest(ptr, small_strides, byte);
   return count;
 }
-
-size_t diablo_count_eq (uint8_t const* const src,
-                        size_t const off,
-                        size_t const len,
-                        uint8_t const byte) {
-  __builtin_cpu_init();
-  if (__builtin_cpu_supports("avx2")) {
-    return count_eq_avx(src, off, len, byte);
+__attribute__((target("avx2")))
+static inline size_t count_eq_short_avx (uint8_t const* const ptr,
+                                         size_t const len,
+                                         uint8_t const byte) {
+  if (len < 32) {
+    return count_eq_short_sse(ptr, len, byte);
+  }
+  __m256i const matches = _mm256_set1_epi8(byte);
+  __m256i const zero = _mm256_setzero_si256();
+  __m256i counts = zero;
+  size_t i = 0;
+  for (; i + 32 <= len; i += 32) {
+    counts = _mm256_sub_epi8(counts,
+                             _mm256_cmpeq_epi8(matches, _mm256_loadu_si256((__m256i const*)(ptr + i))));
   }
-  return count_eq_sse(src, off, len, byte);
+  if (i < len) {
+    __m256i const fresh =
+      _mm256_loadu_si256((__m256i const*)(tail_lanes + 32 - (i + 32 - len)));
+    __m256i const result =
+      _mm256_cmpeq_epi8(matches, _mm256_loadu_si256((__m256i const*)(ptr + len - 32)));
+    counts = _mm256_sub_epi8(counts, _mm256_and_si256(result, fresh));
+  }
+  __m256i const summed = _mm256_sad_epu8(counts, zero);
+  return _mm256_extract_epi64(summed, 0) +
+         _mm256_extract_epi64(summed, 1) +
+         _mm256_extract_epi64(summed, 2) +
+         _mm256_extract_epi64(summed, 3);
 }
+#endif
 
+#if (DIABLO_HAS_AVX512BW)
+// AVX-512BW compares straight into a mask register, which we popcount. Masked
+// loads never fault on the lanes they leave out, so we handle the ragged head
+// (up to the next 64-byte boundary) and tail with them, and never go scalar.
+__attribute__((target("avx512bw,popcnt")))
+static inline size_t count_eq_avx512 (uint8_t const* const src,
+                                      size_t const off,
+                                      size_t const len,
+                                      uint8_t const byte) {
+  size_t count = 0;
+  size_t remaining = len;
+  uint8_t const* ptr = (uint8_t const*)&(src[off]);
+  __m512i const matches = _mm512_set1_epi8(byte);
+  // Head: everything up to the next 64-byte boundary, or the whole input if
+  // it's shorter than that.
+  size_t head = (64 - ((uintptr_t)ptr % 64)) % 64;
+  if (head > remaining) {
+    head = remaining;
+  }
+  if (head != 0) {
+    __mmask64 const mask = low_mask(head);
+    __m512i const input = _mm512_maskz_loadu_epi8(mask, ptr);
+    count += _mm_popcnt_u64(_mm512_mask_cmpeq_epi8_mask(mask, matches, input));
+    ptr += head;
+    remaining -= head;
+  }
+  // Body, with aligned loads. This is a manual 4x unroll.
+  size_t const big_strides = remaining / 256;
+  for (size_t i = 0; i < big_strides; i++) {
+    __m512i const* big_ptr = (__m512i const*)ptr;
+    count += _mm_popcnt_u64(_mm512_cmpeq_epi8_mask(matches, _mm512_load_si512(big_ptr)));
+    count += _mm_popcnt_u64(_mm512_cmpeq_epi8_mask(matches, _mm512_load_si512(big_ptr + 1)));
+    count += _mm_popcnt_u64(_mm512_cmpeq_epi8_mask(matches, _mm512_load_si512(big_ptr + 2)));
+    count += _mm_popcnt_u64(_mm512_cmpeq_epi8_mask(matches, _mm512_load_si512(big_ptr + 3)));
+    ptr += 256;
+  }
+  remaining %= 256;
+  while (remaining >= 64) {
+    __m512i const input = _mm512_load_si512((__m512i const*)ptr);
+    count += _mm_popcnt_u64(_mm512_cmpeq_epi8_mask(matches, input));
+    ptr += 64;
+    remaining -= 64;
+  }
+  // Tail.
+  if (remaining != 0) {
+    __mmask64 const mask = low_mask(remaining);
+    __m512i const input = _mm512_maskz_loadu_epi8(mask, ptr);
+    count += _mm_popcnt_u64(_mm512_mask_cmpeq_epi8_mask(mask, matches, input));
+  }
+  return count;
+}
 #endif
-#elif (__ARM_NEON)
-// NEON implementation.
 
+#if (DIABLO_HAS_NEON)
 #include <arm_neon.h>
 
-size_t diablo_count_eq (uint8_t const* const src,
-                        size_t const off,
-                        size_t const len,
-                        uint8_t const byte) {
+static inline size_t count_eq_neon (uint8_t const* const src,
+                                    size_t const off,
+                                    size_t const len,
+                                    uint8_t const byte) {
   size_t count = 0;
   size_t const big_strides = len / 64;
   size_t const small_strides = len % 64;
@@ -180,57 +365,234 @@ size_t diablo_count_eq (uint8_t const* const src,
   count += count_eq_rest(ptr, small_strides, byte);
   return count;
 }
-#else
-// Fallback implementation
-//
-// We use the method described in "Bit Twiddling Hacks".
-// Source: https://graphics.stanford.edu/~seander/bithacks.html#ZeroInWord
+static inline size_t count_eq_short_neon (uint8_t const* const ptr,
+                                          size_t const len,
+                                          uint8_t const byte) {
+  if (len < 16) {
+    return count_eq_short_swar(ptr, len, byte);
+  }
+  uint8x16_t const matches = vdupq_n_u8(byte);
+  uint8x16_t counts = vdupq_n_u8(0);
+  size_t i = 0;
+  for (; i + 16 <= len; i += 16) {
+    counts = vsubq_u8(counts, vceqq_u8(matches, vld1q_u8(ptr + i)));
+  }
+  if (i < len) {
+    uint8x16_t const fresh = vld1q_u8(tail_lanes + 32 - (i + 16 - len));
+    counts = vsubq_u8(counts,
+                      vandq_u8(vceqq_u8(matches, vld1q_u8(ptr + len - 16)), fresh));
+  }
+  uint64x2_t const summed = vpaddlq_u32(vpaddlq_u16(vpaddlq_u8(counts)));
+  return vgetq_lane_u64(summed, 0) + vgetq_lane_u64(summed, 1);
+}
+#endif
 
-// Load a 64-bit word, then set every byte which matches to 0x80, while setting
-// the others to 0x00.
-static inline uint64_t load_and_set (uint64_t const* const big_ptr,
-                                     size_t const i,
-                                     uint64_t const matches,
-                                     uint64_t const mask) {
-  uint64_t const input = big_ptr[i] ^ matches;
-  uint64_t const tmp = (input & mask) + mask;
-  return (~(tmp | input | mask) >> i);
+typedef size_t (*count_eq_kernel) (uint8_t const* const,
+                                   size_t const,
+                                   size_t const,
+                                   uint8_t const);
+
+static count_eq_kernel const count_eq_kernels[DIABLO_BACKEND_COUNT] = {
+  [DIABLO_BACKEND_SWAR] = count_eq_swar,
+#if (DIABLO_HAS_SSE2)
+  [DIABLO_BACKEND_SSE2] = count_eq_sse,
+#endif
+#if (DIABLO_HAS_SSSE3)
+  [DIABLO_BACKEND_SSSE3] = count_eq_sse,
+#endif
+#if (DIABLO_HAS_AVX2)
+  [DIABLO_BACKEND_AVX2] = count_eq_avx,
+#endif
+#if (DIABLO_HAS_NEON)
+  [DIABLO_BACKEND_NEON] = count_eq_neon,
+#endif
+#if (DIABLO_HAS_AVX512BW)
+  [DIABLO_BACKEND_AVX512BW] = count_eq_avx512,
+#endif
+};
+
+static inline void count_eq_batch_swar (diablo_slice const* const slices,
+                                        size_t const slices_len,
+                                        uint8_t const byte,
+                                        size_t* const counts) {
+  for (size_t i = 0; i < slices_len; i++) {
+    size_t const len = slices[i].len;
+    counts[i] = (len < SHORT_SLICE) ?
+                count_eq_short_swar(&(slices[i].src[slices[i].off]), len, byte) :
+                count_eq_swar(slices[i].src, slices[i].off, len, byte);
+  }
+}
+
+#if (DIABLO_HAS_SSE2)
+static inline void count_eq_batch_sse (diablo_slice const* const slices,
+                                       size_t const slices_len,
+                                       uint8_t const byte,
+                                       size_t* const counts) {
+  for (size_t i = 0; i < slices_len; i++) {
+    size_t const len = slices[i].len;
+    counts[i] = (len < SHORT_SLICE) ?
+                count_eq_short_sse(&(slices[i].src[slices[i].off]), len, byte) :
+                count_eq_sse(slices[i].src, slices[i].off, len, byte);
+  }
+}
+#endif
+
+#if (DIABLO_HAS_AVX2)
+__attribute__((target("avx2")))
+static inline void count_eq_batch_avx (diablo_slice const* const slices,
+                                       size_t const slices_len,
+                                       uint8_t const byte,
+                                       size_t* const counts) {
+  for (size_t i = 0; i < slices_len; i++) {
+    size_t const len = slices[i].len;
+    counts[i] = (len < SHORT_SLICE) ?
+                count_eq_short_avx(&(slices[i].src[slices[i].off]), len, byte) :
+                count_eq_avx(slices[i].src, slices[i].off, len, byte);
+  }
+}
+#endif
+
+#if (DIABLO_HAS_AVX512BW)
+// count_eq_avx512 is never scalar, so it does short slices as well.
+__attribute__((target("avx512bw,popcnt")))
+static inline void count_eq_batch_avx512 (diablo_slice const* const slices,
+                                          size_t const slices_len,
+                                          uint8_t const byte,
+                                          size_t* const counts) {
+  for (size_t i = 0; i < slices_len; i++) {
+    counts[i] = count_eq_avx512(slices[i].src, slices[i].off, slices[i].len, byte);
+  }
 }
+#endif
+
+#if (DIABLO_HAS_NEON)
+static inline void count_eq_batch_neon (diablo_slice const* const slices,
+                                        size_t const slices_len,
+                                        uint8_t const byte,
+                                        size_t* const counts) {
+  for (size_t i = 0; i < slices_len; i++) {
+    size_t const len = slices[i].len;
+    counts[i] = (len < SHORT_SLICE) ?
+                count_eq_short_neon(&(slices[i].src[slices[i].off]), len, byte) :
+                count_eq_neon(slices[i].src, slices[i].off, len, byte);
+  }
+}
+#endif
+
+typedef void (*count_eq_batch_kernel) (diablo_slice const* const,
+                                       size_t const,
+                                       uint8_t const,
+                                       size_t* const);
 
+static count_eq_batch_kernel const count_eq_batch_kernels[DIABLO_BACKEND_COUNT] = {
+  [DIABLO_BACKEND_SWAR] = count_eq_batch_swar,
+#if (DIABLO_HAS_SSE2)
+  [DIABLO_BACKEND_SSE2] = count_eq_batch_sse,
+#endif
+#if (DIABLO_HAS_SSSE3)
+  [DIABLO_BACKEND_SSSE3] = count_eq_batch_sse,
+#endif
+#if (DIABLO_HAS_AVX2)
+  [DIABLO_BACKEND_AVX2] = count_eq_batch_avx,
+#endif
+#if (DIABLO_HAS_NEON)
+  [DIABLO_BACKEND_NEON] = count_eq_batch_neon,
+#endif
+#if (DIABLO_HAS_AVX512BW)
+  [DIABLO_BACKEND_AVX512BW] = count_eq_batch_avx512,
+#endif
+};
+
+// Parallel counting
+//
+// We split the range into chunks which start on cache line boundaries (except
+// the first), so no two threads ever touch the same line, and give each thread
+// several, to even out any that finish early.
+#define CHUNKS_PER_THREAD 4
+
+// No chunk is smaller than this, so that short inputs with a low threshold
+// don't get split into pieces too small to be worth handing out.
+#define MIN_CHUNK 4096
+
+typedef struct {
+  count_eq_kernel kernel;
+  uint8_t const* src;
+  size_t off;
+  size_t len;
+  // The first chunk ends at lead + chunk; each one after it is chunk long.
+  size_t lead;
+  size_t chunk;
+  uint8_t byte;
+  atomic_size_t count;
+} count_eq_job;
+
+static void count_eq_task (void* const arg, size_t const i) {
+  count_eq_job* const job = (count_eq_job*)arg;
+  size_t const start = (i == 0) ? 0 : job->lead + (i * job->chunk);
+  size_t end = job->lead + ((i + 1) * job->chunk);
+  if (end > job->len) {
+    end = job->len;
+  }
+  size_t const count = job->kernel(job->src, job->off + start, end - start,
+                                   job->byte);
+  atomic_fetch_add_explicit(&job->count, count, memory_order_relaxed);
+}
 
-// Fill every 8-byte 'lane' with the same value.
-static inline uint64_t broadcast(uint8_t const byte) {
-  return byte * 0x0101010101010101ULL;
+// The number of bytes in every slice together, for the statistics.
+static inline size_t slices_total (diablo_slice const* const slices,
+                                   size_t const slices_len) {
+  size_t total = 0;
+  for (size_t i = 0; i < slices_len; i++) {
+    total += slices[i].len;
+  }
+  return total;
 }
 
 size_t diablo_count_eq (uint8_t const* const src,
                         size_t const off,
                         size_t const len,
                         uint8_t const byte) {
-  size_t count = 0;
-  size_t const big_strides = len / 64;
-  size_t const small_strides = len % 64;
-  uint8_t const* ptr = (uint8_t const*)&(src[off]);
-  if (big_strides != 0) {
-    uint64_t const matches = broadcast(byte);
-    uint64_t const mask = broadcast(0x7F);
-    for (size_t i = 0; i < big_strides; i++) {
-      uint64_t const* const big_ptr = (uint64_t const* const)ptr;
-      uint64_t result = 0;
-      // Manual 8x loop unroll
-      result |= load_and_set(big_ptr, 0, matches, mask);
-      result |= load_and_set(big_ptr, 1, matches, mask);
-      result |= load_and_set(big_ptr, 2, matches, mask);
-      result |= load_and_set(big_ptr, 3, matches, mask);
-      result |= load_and_set(big_ptr, 4, matches, mask);
-      result |= load_and_set(big_ptr, 5, matches, mask);
-      result |= load_and_set(big_ptr, 6, matches, mask);
-      result |= load_and_set(big_ptr, 7, matches, mask);
-      count += __builtin_popcountll(result);
-      ptr += 64;
-    }
+  STATS_RECORD(STATS_COUNT_EQ, len);
+  return count_eq_kernels[active_backend()](src, off, len, byte);
+}
+
+void diablo_count_eq_batch (diablo_slice const* const slices,
+                            size_t const slices_len,
+                            uint8_t const byte,
+                            size_t* const counts) {
+  STATS_RECORD(STATS_COUNT_EQ_BATCH, slices_total(slices, slices_len));
+  count_eq_batch_kernels[active_backend()](slices, slices_len, byte, counts);
+}
+
+size_t diablo_count_eq_parallel (uint8_t const* const src,
+                                 size_t const off,
+                                 size_t const len,
+                                 uint8_t const byte) {
+  STATS_RECORD(STATS_COUNT_EQ_PARALLEL, len);
+  count_eq_kernel const kernel = count_eq_kernels[active_backend()];
+  size_t const threads = diablo_pool_threads();
+  if (threads <= 1 || len < diablo_pool_threshold()) {
+    return kernel(src, off, len, byte);
   }
-  count += count_eq_rest(ptr, small_strides, byte);
-  return count;
+  size_t const lead = (64 - ((uintptr_t)&(src[off]) % 64)) % 64;
+  size_t chunk = len / (threads * CHUNKS_PER_THREAD);
+  chunk = (chunk < MIN_CHUNK) ? MIN_CHUNK : ((chunk + 63) / 64) * 64;
+  if (len <= lead + chunk) {
+    return kernel(src, off, len, byte);
+  }
+  count_eq_job job = {
+    .kernel = kernel,
+    .src = src,
+    .off = off,
+    .len = len,
+    .lead = lead,
+    .chunk = chunk,
+    .byte = byte
+  };
+  atomic_init(&job.count, 0);
+  size_t const tasks = (len - lead + chunk - 1) / chunk;
+  if (!diablo_pool_run(threads, tasks, count_eq_task, &job)) {
+    return kernel(src, off, len, byte);
+  }
+  return atomic_load(&job.count);
 }
-#endif
@@ -0,0 +1,268 @@
+/*
+ * Copyright 2021 Koz Ross <koz.ross@retro-freedom.nz>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <stddef.h>
+#include "common.h"
+#include "dispatch.h"
+#include "stats.h"
+#include "truffle.h"
+
+static inline size_t count_in_set_rest (uint8_t const* const src,
+                                        size_t const len,
+                                        uint8_t const* const set) {
+  size_t count = 0;
+  uint8_t const* ptr = (uint8_t const*)src;
+  for (size_t i = 0; i < len; i++) {
+    count += in_set(set, *ptr);
+    ptr++;
+  }
+  return count;
+}
+
+// SWAR implementation, used as the fallback everywhere.
+//
+// This isn't really SWAR: there's no word-level trick for testing against an
+// arbitrary set, so this is a per-byte bitmap lookup, unrolled eight times over
+// each loaded word. The only gain over the plain loop is fewer loads and loop
+// iterations.
+static inline size_t count_in_set_swar (uint8_t const* const src,
+                                        size_t const off,
+                                        size_t const len,
+                                        uint8_t const* const set) {
+  size_t count = 0;
+  size_t const big_strides = len / 8;
+  size_t const small_strides = len % 8;
+  uint8_t const* ptr = (uint8_t const*)&(src[off]);
+  for (size_t i = 0; i < big_strides; i++) {
+    uint64_t const input = *((uint64_t const*)ptr);
+    // Manual 8x loop unroll
+    count += in_set(set, (uint8_t)input);
+    count += in_set(set, (uint8_t)(input >> 8));
+    count += in_set(set, (uint8_t)(input >> 16));
+    count += in_set(set, (uint8_t)(input >> 24));
+    count += in_set(set, (uint8_t)(input >> 32));
+    count += in_set(set, (uint8_t)(input >> 40));
+    count += in_set(set, (uint8_t)(input >> 48));
+    count += in_set(set, (uint8_t)(input >> 56));
+    ptr += 8;
+  }
+  count += count_in_set_rest(ptr, small_strides, set);
+  return count;
+}
+
+// The SIMD kernels classify bytes with the nibble shuffles in truffle.h.
+
+#if (DIABLO_HAS_SSSE3)
+#include <tmmintrin.h>
+
+__attribute__((target("ssse3")))
+static inline size_t count_in_set_ssse3 (uint8_t const* const src,
+                                         size_t const off,
+                                         size_t const len,
+                                         uint8_t const* const set) {
+  size_t count = 0;
+  size_t const big_strides = len / 64;
+  size_t const small_strides = len % 64;
+  uint8_t const* ptr = (uint8_t const*)&(src[off]);
+  if (big_strides != 0) {
+    uint8_t tables[2][16];
+    truffle_tables(set, tables[0], tables[1]);
+    __m128i const lows = _mm_loadu_si128((__m128i const*)tables[0]);
+    __m128i const highs = _mm_loadu_si128((__m128i const*)tables[1]);
+    __m128i const zero = _mm_setzero_si128();
+    __m128i counts = zero;
+    for (size_t i = 0; i < big_strides; i++) {
+      __m128i const* big_ptr = (__m128i const*)ptr;
+      // This is a manual 4x unroll.
+      __m128i const results[4] = {
+        classify_ssse3(_mm_loadu_si128(big_ptr), lows, highs),
+        classify_ssse3(_mm_loadu_si128(big_ptr + 1), lows, highs),
+        classify_ssse3(_mm_loadu_si128(big_ptr + 2), lows, highs),
+        classify_ssse3(_mm_loadu_si128(big_ptr + 3), lows, highs)
+      };
+      // As in count_eq_sse: add the -1s, negate, then sum with SAD.
+      __m128i const summed = _mm_add_epi8(_mm_add_epi8(results[0], results[1]),
+                                          _mm_add_epi8(results[2], results[3]));
+      counts = _mm_add_epi64(counts,
+                             _mm_sad_epu8(_mm_sub_epi8(zero, summed), zero));
+      ptr += 64;
+    }
+    // Evacuate results and sum.
+    uint64_t results[2];
+    _mm_storeu_si128((__m128i*)results, counts);
+    count += (results[0] + results[1]);
+  }
+  count += count_in_set_rest(ptr, small_strides, set);
+  return count;
+}
+#endif
+
+#if (DIABLO_HAS_AVX2)
+#include <immintrin.h>
+
+__attribute__((target("avx2")))
+static inline size_t count_in_set_avx (uint8_t const* const src,
+                                       size_t const off,
+                                       size_t const len,
+                                       uint8_t const* const set) {
+  size_t count = 0;
+  size_t const big_strides = len / 64;
+  size_t const small_strides = len % 64;
+  uint8_t const* ptr = (uint8_t const*)&(src[off]);
+  if (big_strides != 0) {
+    uint8_t tables[2][16];
+    truffle_tables(set, tables[0], tables[1]);
+    // Shuffles work within 128-bit lanes, so both lanes get the same tables.
+    __m256i const lows =
+      _mm256_broadcastsi128_si256(_mm_loadu_si128((__m128i const*)tables[0]));
+    __m256i const highs =
+      _mm256_broadcastsi128_si256(_mm_loadu_si128((__m128i const*)tables[1]));
+    __m256i const zero = _mm256_setzero_si256();
+    __m256i counts = zero;
+    for (size_t i = 0; i < big_strides; i++) {
+      __m256i const* big_ptr = (__m256i const*)ptr;
+      // This is a manual 2x unroll.
+      __m256i const results[2] = {
+        classify_avx2(_mm256_loadu_si256(big_ptr), lows, highs),
+        classify_avx2(_mm256_loadu_si256(big_ptr + 1), lows, highs)
+      };
+      // As in count_eq_avx: add the -1s, negate, then sum with SAD.
+      __m256i const summed = _mm256_add_epi8(results[0], results[1]);
+      counts = _mm256_add_epi64(counts,
+                                _mm256_sad_epu8(_mm256_sub_epi8(zero, summed), zero));
+      ptr += 64;
+    }
+    // Evacuate results and sum.
+    count += _mm256_extract_epi64(counts, 0) +
+             _mm256_extract_epi64(counts, 1) +
+             _mm256_extract_epi64(counts, 2) +
+             _mm256_extract_epi64(counts, 3);
+  }
+  count += count_in_set_rest(ptr, small_strides, set);
+  return count;
+}
+#endif
+
+#if (DIABLO_HAS_AVX512BW)
+// As count_eq_avx512, masked loads handle the head and tail.
+__attribute__((target("avx512bw,popcnt")))
+static inline size_t count_in_set_avx512 (uint8_t const* const src,
+                                          size_t const off,
+                                          size_t const len,
+                                          uint8_t const* const set) {
+  size_t count = 0;
+  size_t remaining = len;
+  uint8_t const* ptr = (uint8_t const*)&(src[off]);
+  uint8_t tables[2][16];
+  truffle_tables(set, tables[0], tables[1]);
+  __m512i const lows =
+    _mm512_broadcast_i32x4(_mm_loadu_si128((__m128i const*)tables[0]));
+  __m512i const highs =
+    _mm512_broadcast_i32x4(_mm_loadu_si128((__m128i const*)tables[1]));
+  size_t head = (64 - ((uintptr_t)ptr % 64)) % 64;
+  if (head > remaining) {
+    head = remaining;
+  }
+  if (head != 0) {
+    __mmask64 const mask = low_mask(head);
+    __m512i const input = _mm512_maskz_loadu_epi8(mask, ptr);
+    count += _mm_popcnt_u64(mask & classify_avx512(input, lows, highs));
+    ptr += head;
+    remaining -= head;
+  }
+  while (remaining >= 64) {
+    __m512i const input = _mm512_load_si512((__m512i const*)ptr);
+    count += _mm_popcnt_u64(classify_avx512(input, lows, highs));
+    ptr += 64;
+    remaining -= 64;
+  }
+  if (remaining != 0) {
+    __mmask64 const mask = low_mask(remaining);
+    __m512i const input = _mm512_maskz_loadu_epi8(mask, ptr);
+    count += _mm_popcnt_u64(mask & classify_avx512(input, lows, highs));
+  }
+  return count;
+}
+#endif
+
+#if (DIABLO_HAS_NEON)
+static inline size_t count_in_set_neon (uint8_t const* const src,
+                                        size_t const off,
+                                        size_t const len,
+                                        uint8_t const* const set) {
+  size_t count = 0;
+  size_t const big_strides = len / 64;
+  size_t const small_strides = len % 64;
+  uint8_t const* ptr = (uint8_t const*)&(src[off]);
+  if (big_strides != 0) {
+    uint8_t tables[2][16];
+    truffle_tables(set, tables[0], tables[1]);
+    uint8x16_t const lows = vld1q_u8(tables[0]);
+    uint8x16_t const highs = vld1q_u8(tables[1]);
+    uint64x2_t counts = vdupq_n_u64(0);
+    for (size_t i = 0; i < big_strides; i++) {
+      // This is a manual 4x unroll.
+      int8x16_t const results[4] = {
+        vreinterpretq_s8_u8(classify_neon(vld1q_u8(ptr), lows, highs)),
+        vreinterpretq_s8_u8(classify_neon(vld1q_u8(ptr + 16), lows, highs)),
+        vreinterpretq_s8_u8(classify_neon(vld1q_u8(ptr + 32), lows, highs)),
+        vreinterpretq_s8_u8(classify_neon(vld1q_u8(ptr + 48), lows, highs))
+      };
+      // As in count_eq_neon.
+      uint8x16_t const summed =
+        vreinterpretq_u8_s8(vabsq_s8(vaddq_s8(vaddq_s8(results[0], results[1]),
+                                              vaddq_s8(results[2], results[3]))));
+      counts = vaddq_u64(counts, vpaddlq_u32(vpaddlq_u16(vpaddlq_u8(summed))));
+      ptr += 64;
+    }
+    count += (vgetq_lane_u64(counts, 0) + vgetq_lane_u64(counts, 1));
+  }
+  count += count_in_set_rest(ptr, small_strides, set);
+  return count;
+}
+#endif
+
+typedef size_t (*count_in_set_kernel) (uint8_t const* const,
+                                       size_t const,
+                                       size_t const,
+                                       uint8_t const* const);
+
+// SSE2 has no byte shuffles, so it uses the SWAR kernel.
+static count_in_set_kernel const count_in_set_kernels[DIABLO_BACKEND_COUNT] = {
+  [DIABLO_BACKEND_SWAR] = count_in_set_swar,
+#if (DIABLO_HAS_SSE2)
+  [DIABLO_BACKEND_SSE2] = count_in_set_swar,
+#endif
+#if (DIABLO_HAS_SSSE3)
+  [DIABLO_BACKEND_SSSE3] = count_in_set_ssse3,
+#endif
+#if (DIABLO_HAS_AVX2)
+  [DIABLO_BACKEND_AVX2] = count_in_set_avx,
+#endif
+#if (DIABLO_HAS_NEON)
+  [DIABLO_BACKEND_NEON] = count_in_set_neon,
+#endif
+#if (DIABLO_HAS_AVX512BW)
+  [DIABLO_BACKEND_AVX512BW] = count_in_set_avx512,
+#endif
+};
+
+size_t diablo_count_in_set (uint8_t const* const src,
+                            size_t const off,
+                            size_t const len,
+                            uint8_t const* const set) {
+  STATS_RECORD(STATS_COUNT_IN_SET, len);
+  return count_in_set_kernels[active_backend()](src, off, len, set);
+}
@@ -0,0 +1,134 @@
+/*
+ * Copyright 2021 Koz Ross <koz.ross@retro-freedom.nz>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "dispatch.h"
+
+_Atomic int diablo_active_backend = -1;
+
+// The best backend the current machine can run. Ask this at most once per
+// resolution: on x86-64, it has to query the CPU.
+static diablo_backend best_backend (void) {
+#if (DIABLO_FIXED_ISA)
+  return DIABLO_FIXED_BACKEND;
+#else
+#if (DIABLO_HAS_AVX512BW)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512bw")) {
+    return DIABLO_BACKEND_AVX512BW;
+  }
+#endif
+#if (DIABLO_HAS_AVX2)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    return DIABLO_BACKEND_AVX2;
+  }
+#endif
+#if (DIABLO_HAS_SSSE3)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("ssse3")) {
+    return DIABLO_BACKEND_SSSE3;
+  }
+#endif
+#if (DIABLO_HAS_SSE2)
+  return DIABLO_BACKEND_SSE2;
+#elif (DIABLO_HAS_NEON)
+  return DIABLO_BACKEND_NEON;
+#else
+  return DIABLO_BACKEND_SWAR;
+#endif
+#endif
+}
+
+diablo_backend diablo_resolve_backend (void) {
+  int expected = -1;
+  int const best = (int)best_backend();
+  // If someone beat us to it, whether by resolving or forcing, theirs wins.
+  if (atomic_compare_exchange_strong(&diablo_active_backend, &expected, best)) {
+    return (diablo_backend)best;
+  }
+  return (diablo_backend)expected;
+}
+
+diablo_backend diablo_get_backend (void) {
+  return active_backend();
+}
+
+bool diablo_backend_supported (diablo_backend const backend) {
+#if (DIABLO_FIXED_ISA)
+  return backend == DIABLO_FIXED_BACKEND;
+#else
+  switch (backend) {
+    case DIABLO_BACKEND_SWAR:
+      return true;
+#if (DIABLO_HAS_SSE2)
+    case DIABLO_BACKEND_SSE2:
+      return true;
+#endif
+#if (DIABLO_HAS_SSSE3)
+    case DIABLO_BACKEND_SSSE3:
+      __builtin_cpu_init();
+      return __builtin_cpu_supports("ssse3");
+#endif
+#if (DIABLO_HAS_AVX2)
+    case DIABLO_BACKEND_AVX2:
+      __builtin_cpu_init();
+      return __builtin_cpu_supports("avx2");
+#endif
+#if (DIABLO_HAS_NEON)
+    case DIABLO_BACKEND_NEON:
+      return true;
+#endif
+#if (DIABLO_HAS_AVX512BW)
+    case DIABLO_BACKEND_AVX512BW:
+      __builtin_cpu_init();
+      return __builtin_cpu_supports("avx512bw");
+#endif
+    default:
+      return false;
+  }
+#endif
+}
+
+bool diablo_set_backend (diablo_backend const backend) {
+  if (!diablo_backend_supported(backend)) {
+    return false;
+  }
+  atomic_store(&diablo_active_backend, (int)backend);
+  return true;
+}
+
+diablo_backend diablo_reset_backend (void) {
+  atomic_store(&diablo_active_backend, -1);
+  return diablo_resolve_backend();
+}
+
+char const* diablo_backend_name (diablo_backend const backend) {
+  switch (backend) {
+    case DIABLO_BACKEND_SWAR:
+      return "swar";
+    case DIABLO_BACKEND_SSE2:
+      return "sse2";
+    case DIABLO_BACKEND_AVX2:
+      return "avx2";
+    case DIABLO_BACKEND_NEON:
+      return "neon";
+    case DIABLO_BACKEND_AVX512BW:
+      return "avx512bw";
+    case DIABLO_BACKEND_SSSE3:
+      return "ssse3";
+    default:
+      return "unknown";
+  }
+}
@@ -0,0 +1,112 @@
+/*
+ * Copyright 2021 Koz Ross <koz.ross@retro-freedom.nz>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+#include <stdatomic.h>
+#include "../include/diablo.h"
+
+// Internal dispatch machinery. Every exported operation keeps a table of its
+// kernels, indexed by diablo_backend, and calls through the entry for the
+// active backend. The active backend is chosen once, on first use, and cached.
+
+// Symbols shared between our translation units, but not part of the API.
+#if (_WIN32 || __CYGWIN__)
+#define DIABLO_INTERNAL
+#else
+#define DIABLO_INTERNAL __attribute__((visibility("hidden")))
+#endif
+
+// Which backends this build contains. SWAR is always available; everything
+// else depends on what the compiler is targeting.
+//
+// With DIABLO_FIXED_ISA set to 1 (the 'fixed_isa' meson option), we only
+// build what the target lets the compiler assume (for example, from -march),
+// and there's no runtime detection: the best of those backends is the only
+// one, and every operation calls its kernel directly.
+#if (DIABLO_FIXED_ISA)
+#if (__SSE2__)
+#define DIABLO_HAS_SSE2 1
+#endif
+#if (__SSSE3__)
+#define DIABLO_HAS_SSSE3 1
+#endif
+#if (__x86_64__ && __AVX2__)
+#define DIABLO_HAS_AVX2 1
+#endif
+#if (__x86_64__ && __AVX512BW__)
+#define DIABLO_HAS_AVX512BW 1
+#endif
+#if (__ARM_NEON)
+#define DIABLO_HAS_NEON 1
+#endif
+
+#if (DIABLO_HAS_AVX512BW)
+#define DIABLO_FIXED_BACKEND DIABLO_BACKEND_AVX512BW
+#elif (DIABLO_HAS_AVX2)
+#define DIABLO_FIXED_BACKEND DIABLO_BACKEND_AVX2
+#elif (DIABLO_HAS_SSSE3)
+#define DIABLO_FIXED_BACKEND DIABLO_BACKEND_SSSE3
+#elif (DIABLO_HAS_SSE2)
+#define DIABLO_FIXED_BACKEND DIABLO_BACKEND_SSE2
+#elif (DIABLO_HAS_NEON)
+#define DIABLO_FIXED_BACKEND DIABLO_BACKEND_NEON
+#else
+#define DIABLO_FIXED_BACKEND DIABLO_BACKEND_SWAR
+#endif
+#elif (__SSE2__)
+#define DIABLO_HAS_SSE2 1
+// SSSE3 is detected at runtime.
+#define DIABLO_HAS_SSSE3 1
+// 32-bit x86 cannot have AVX, so we only bother on x86-64, where we detect it
+// at runtime.
+#if (__x86_64__)
+#define DIABLO_HAS_AVX2 1
+#define DIABLO_HAS_AVX512BW 1
+#endif
+#elif (__ARM_NEON)
+#define DIABLO_HAS_NEON 1
+#endif
+
+// One more than the largest diablo_backend value; kernel tables are this big.
+#define DIABLO_BACKEND_COUNT 6
+
+// Every backend this build contains needs an entry in every kernel table. If an
+// operation has nothing specific to a backend, use the best kernel that
+// backend can run.
+
+// The active backend, or -1 if none has been chosen yet.
+DIABLO_INTERNAL extern _Atomic int diablo_active_backend;
+
+// Choose the best backend this machine supports, unless one has already been
+// chosen (or forced), and return whichever is active.
+DIABLO_INTERNAL diablo_backend diablo_resolve_backend(void);
+
+// Get the active backend. This is a single relaxed load once resolved, and a
+// constant with a fixed ISA, which lets the compiler fold away the kernel
+// tables.
+#if (DIABLO_FIXED_ISA)
+static inline diablo_backend active_backend (void) {
+  return DIABLO_FIXED_BACKEND;
+}
+#else
+static inline diablo_backend active_backend (void) {
+  int const backend = atomic_load_explicit(&diablo_active_backend,
+                                           memory_order_relaxed);
+  if (__builtin_expect(backend < 0, 0)) {
+    return diablo_resolve_backend();
+  }
+  return (diablo_backend)backend;
+}
+#endif
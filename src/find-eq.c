@@ -0,0 +1,676 @@
+/*
+ * Copyright 2021 Koz Ross <koz.ross@retro-freedom.nz>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <stddef.h>
+#include "common.h"
+#include "dispatch.h"
+#include "stats.h"
+
+// All positions are relative to the start of the range (that is, to off). The
+// find_first and find_last kernels return len if there is no match.
+//
+// The SIMD kernels compare 64 bytes at a time, as the count_eq kernels do, and
+// only work out where the match is once they know there is one. Inputs at
+// least one vector long finish with a vector that overlaps what we've already
+// seen, rather than a scalar loop.
+
+static inline size_t find_first_eq_rest (uint8_t const* const ptr,
+                                         size_t const len,
+                                         uint8_t const byte) {
+  for (size_t i = 0; i < len; i++) {
+    if (ptr[i] == byte) {
+      return i;
+    }
+  }
+  return len;
+}
+
+static inline size_t find_last_eq_rest (uint8_t const* const ptr,
+                                        size_t const len,
+                                        uint8_t const byte) {
+  for (size_t i = len; i > 0; i--) {
+    if (ptr[i - 1] == byte) {
+      return i - 1;
+    }
+  }
+  return len;
+}
+
+// Write out the positions of matches in [start, len), continuing from written.
+static inline size_t find_all_eq_rest (uint8_t const* const ptr,
+                                       size_t const start,
+                                       size_t const len,
+                                       uint8_t const byte,
+                                       size_t* const out,
+                                       size_t const out_len,
+                                       size_t written) {
+  for (size_t i = start; i < len && written < out_len; i++) {
+    if (ptr[i] == byte) {
+      out[written] = i;
+      written++;
+    }
+  }
+  return written;
+}
+
+// Write out base + (i >> shift) for every set bit i of mask, lowest first,
+// continuing from written, and stopping if out fills up.
+static inline size_t emit_positions (uint64_t mask,
+                                     unsigned const shift,
+                                     size_t const base,
+                                     size_t* const out,
+                                     size_t const out_len,
+                                     size_t written) {
+  while (mask != 0 && written < out_len) {
+    out[written] = base + (((size_t)__builtin_ctzll(mask)) >> shift);
+    written++;
+    mask &= (mask - 1);
+  }
+  return written;
+}
+
+// SWAR implementation, used as the fallback everywhere.
+
+static inline size_t find_first_eq_swar (uint8_t const* const src,
+                                         size_t const off,
+                                         size_t const len,
+                                         uint8_t const byte) {
+  uint8_t const* const ptr = (uint8_t const*)&(src[off]);
+  uint64_t const matches = broadcast(byte);
+  size_t i = 0;
+  for (; i + 8 <= len; i += 8) {
+    uint64_t const flags = eq_flags(*((uint64_t const*)(ptr + i)), matches);
+    if (flags != 0) {
+      return i + first_flagged(flags);
+    }
+  }
+  size_t const found = find_first_eq_rest(ptr + i, len - i, byte);
+  return (found == len - i) ? len : i + found;
+}
+
+static inline size_t find_last_eq_swar (uint8_t const* const src,
+                                        size_t const off,
+                                        size_t const len,
+                                        uint8_t const byte) {
+  uint8_t const* const ptr = (uint8_t const*)&(src[off]);
+  uint64_t const matches = broadcast(byte);
+  size_t i = len;
+  for (; i >= 8; i -= 8) {
+    uint64_t const flags = eq_flags(*((uint64_t const*)(ptr + i - 8)), matches);
+    if (flags != 0) {
+      return i - 8 + last_flagged(flags);
+    }
+  }
+  size_t const found = find_last_eq_rest(ptr, i, byte);
+  return (found == i) ? len : found;
+}
+
+static inline size_t find_all_eq_swar (uint8_t const* const src,
+                                       size_t const off,
+                                       size_t const len,
+                                       uint8_t const byte,
+                                       size_t* const out,
+                                       size_t const out_len) {
+  uint8_t const* const ptr = (uint8_t const*)&(src[off]);
+  uint64_t const matches = broadcast(byte);
+  size_t written = 0;
+  size_t i = 0;
+  for (; i + 8 <= len; i += 8) {
+    uint64_t flags = eq_flags(*((uint64_t const*)(ptr + i)), matches);
+    while (flags != 0) {
+      if (written == out_len) {
+        return written;
+      }
+      out[written] = i + first_flagged(flags);
+      written++;
+      flags = clear_first_flagged(flags);
+    }
+  }
+  return find_all_eq_rest(ptr, i, len, byte, out, out_len, written);
+}
+
+#if (DIABLO_HAS_SSE2)
+#include <emmintrin.h>
+
+// One bit per byte, in order.
+static inline uint64_t movemask_sse (__m128i const cmp) {
+  return (uint64_t)(uint32_t)_mm_movemask_epi8(cmp);
+}
+
+// Compare 64 bytes, giving one bit per byte, in order.
+static inline uint64_t eq_mask64_sse (uint8_t const* const ptr,
+                                      __m128i const matches) {
+  __m128i const* big_ptr = (__m128i const*)ptr;
+  return movemask_sse(_mm_cmpeq_epi8(matches, _mm_loadu_si128(big_ptr))) |
+         (movemask_sse(_mm_cmpeq_epi8(matches, _mm_loadu_si128(big_ptr + 1))) << 16) |
+         (movemask_sse(_mm_cmpeq_epi8(matches, _mm_loadu_si128(big_ptr + 2))) << 32) |
+         (movemask_sse(_mm_cmpeq_epi8(matches, _mm_loadu_si128(big_ptr + 3))) << 48);
+}
+
+// Whether any of 64 bytes match.
+static inline bool any_eq64_sse (uint8_t const* const ptr,
+                                 __m128i const matches) {
+  __m128i const* big_ptr = (__m128i const*)ptr;
+  __m128i const any =
+    _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(matches, _mm_loadu_si128(big_ptr)),
+                              _mm_cmpeq_epi8(matches, _mm_loadu_si128(big_ptr + 1))),
+                 _mm_or_si128(_mm_cmpeq_epi8(matches, _mm_loadu_si128(big_ptr + 2)),
+                              _mm_cmpeq_epi8(matches, _mm_loadu_si128(big_ptr + 3))));
+  return _mm_movemask_epi8(any) != 0;
+}
+
+static inline uint64_t eq_mask16_sse (uint8_t const* const ptr,
+                                      __m128i const matches) {
+  return movemask_sse(_mm_cmpeq_epi8(matches,
+                                     _mm_loadu_si128((__m128i const*)ptr)));
+}
+
+static inline size_t find_first_eq_sse (uint8_t const* const src,
+                                        size_t const off,
+                                        size_t const len,
+                                        uint8_t const byte) {
+  uint8_t const* const ptr = (uint8_t const*)&(src[off]);
+  if (len < 16) {
+    return find_first_eq_rest(ptr, len, byte);
+  }
+  __m128i const matches = _mm_set1_epi8(byte);
+  size_t i = 0;
+  for (; i + 64 <= len; i += 64) {
+    if (any_eq64_sse(ptr + i, matches)) {
+      return i + __builtin_ctzll(eq_mask64_sse(ptr + i, matches));
+    }
+  }
+  for (; i + 16 <= len; i += 16) {
+    uint64_t const mask = eq_mask16_sse(ptr + i, matches);
+    if (mask != 0) {
+      return i + __builtin_ctzll(mask);
+    }
+  }
+  if (i < len) {
+    // Everything before i has already been ruled out.
+    uint64_t const mask = eq_mask16_sse(ptr + len - 16, matches);
+    if (mask != 0) {
+      return len - 16 + __builtin_ctzll(mask);
+    }
+  }
+  return len;
+}
+
+static inline size_t find_last_eq_sse (uint8_t const* const src,
+                                       size_t const off,
+                                       size_t const len,
+                                       uint8_t const byte) {
+  uint8_t const* const ptr = (uint8_t const*)&(src[off]);
+  if (len < 16) {
+    return find_last_eq_rest(ptr, len, byte);
+  }
+  __m128i const matches = _mm_set1_epi8(byte);
+  size_t i = len;
+  for (; i >= 64; i -= 64) {
+    if (any_eq64_sse(ptr + i - 64, matches)) {
+      return i - 1 - __builtin_clzll(eq_mask64_sse(ptr + i - 64, matches));
+    }
+  }
+  for (; i >= 16; i -= 16) {
+    uint64_t const mask = eq_mask16_sse(ptr + i - 16, matches);
+    if (mask != 0) {
+      return i - 16 + 63 - __builtin_clzll(mask);
+    }
+  }
+  if (i > 0) {
+    // Everything from i on has already been ruled out.
+    uint64_t const mask = eq_mask16_sse(ptr, matches);
+    if (mask != 0) {
+      return 63 - __builtin_clzll(mask);
+    }
+  }
+  return len;
+}
+
+static inline size_t find_all_eq_sse (uint8_t const* const src,
+                                      size_t const off,
+                                      size_t const len,
+                                      uint8_t const byte,
+                                      size_t* const out,
+                                      size_t const out_len) {
+  uint8_t const* const ptr = (uint8_t const*)&(src[off]);
+  if (len < 16) {
+    return find_all_eq_rest(ptr, 0, len, byte, out, out_len, 0);
+  }
+  __m128i const matches = _mm_set1_epi8(byte);
+  size_t written = 0;
+  size_t i = 0;
+  for (; i + 64 <= len && written < out_len; i += 64) {
+    if (any_eq64_sse(ptr + i, matches)) {
+      written = emit_positions(eq_mask64_sse(ptr + i, matches), 0, i, out,
+                               out_len, written);
+    }
+  }
+  for (; i + 16 <= len && written < out_len; i += 16) {
+    written = emit_positions(eq_mask16_sse(ptr + i, matches), 0, i, out,
+                             out_len, written);
+  }
+  if (i < len && written < out_len) {
+    // Drop the lanes we've already seen.
+    uint64_t const mask = eq_mask16_sse(ptr + len - 16, matches) >> (i - (len - 16));
+    written = emit_positions(mask, 0, i, out, out_len, written);
+  }
+  return written;
+}
+#endif
+
+#if (DIABLO_HAS_AVX2)
+#include <immintrin.h>
+
+__attribute__((target("avx2")))
+static inline uint64_t eq_mask32_avx (uint8_t const* const ptr,
+                                      __m256i const matches) {
+  __m256i const input = _mm256_loadu_si256((__m256i const*)ptr);
+  return (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(matches, input));
+}
+
+__attribute__((target("avx2")))
+static inline bool any_eq64_avx (uint8_t const* const ptr,
+                                 __m256i const matches) {
+  __m256i const* big_ptr = (__m256i const*)ptr;
+  __m256i const any =
+    _mm256_or_si256(_mm256_cmpeq_epi8(matches, _mm256_loadu_si256(big_ptr)),
+                    _mm256_cmpeq_epi8(matches, _mm256_loadu_si256(big_ptr + 1)));
+  return !_mm256_testz_si256(any, any);
+}
+
+__attribute__((target("avx2")))
+static inline uint64_t eq_mask64_avx (uint8_t const* const ptr,
+                                      __m256i const matches) {
+  return eq_mask32_avx(ptr, matches) | (eq_mask32_avx(ptr + 32, matches) << 32);
+}
+
+__attribute__((target("avx2")))
+static inline size_t find_first_eq_avx (uint8_t const* const src,
+                                        size_t const off,
+                                        size_t const len,
+                                        uint8_t const byte) {
+  uint8_t const* const ptr = (uint8_t const*)&(src[off]);
+  if (len < 32) {
+    return find_first_eq_rest(ptr, len, byte);
+  }
+  __m256i const matches = _mm256_set1_epi8(byte);
+  size_t i = 0;
+  for (; i + 64 <= len; i += 64) {
+    if (any_eq64_avx(ptr + i, matches)) {
+      return i + __builtin_ctzll(eq_mask64_avx(ptr + i, matches));
+    }
+  }
+  if (i + 32 <= len) {
+    uint64_t const mask = eq_mask32_avx(ptr + i, matches);
+    if (mask != 0) {
+      return i + __builtin_ctzll(mask);
+    }
+    i += 32;
+  }
+  if (i < len) {
+    uint64_t const mask = eq_mask32_avx(ptr + len - 32, matches);
+    if (mask != 0) {
+      return len - 32 + __builtin_ctzll(mask);
+    }
+  }
+  return len;
+}
+
+__attribute__((target("avx2")))
+static inline size_t find_last_eq_avx (uint8_t const* const src,
+                                       size_t const off,
+                                       size_t const len,
+                                       uint8_t const byte) {
+  uint8_t const* const ptr = (uint8_t const*)&(src[off]);
+  if (len < 32) {
+    return find_last_eq_rest(ptr, len, byte);
+  }
+  __m256i const matches = _mm256_set1_epi8(byte);
+  size_t i = len;
+  for (; i >= 64; i -= 64) {
+    if (any_eq64_avx(ptr + i - 64, matches)) {
+      return i - 1 - __builtin_clzll(eq_mask64_avx(ptr + i - 64, matches));
+    }
+  }
+  if (i >= 32) {
+    uint64_t const mask = eq_mask32_avx(ptr + i - 32, matches);
+    if (mask != 0) {
+      return i - 32 + 63 - __builtin_clzll(mask);
+    }
+    i -= 32;
+  }
+  if (i > 0) {
+    uint64_t const mask = eq_mask32_avx(ptr, matches);
+    if (mask != 0) {
+      return 63 - __builtin_clzll(mask);
+    }
+  }
+  return len;
+}
+
+__attribute__((target("avx2")))
+static inline size_t find_all_eq_avx (uint8_t const* const src,
+                                      size_t const off,
+                                      size_t const len,
+                                      uint8_t const byte,
+                                      size_t* const out,
+                                      size_t const out_len) {
+  uint8_t const* const ptr = (uint8_t const*)&(src[off]);
+  if (len < 32) {
+    return find_all_eq_rest(ptr, 0, len, byte, out, out_len, 0);
+  }
+  __m256i const matches = _mm256_set1_epi8(byte);
+  size_t written = 0;
+  size_t i = 0;
+  for (; i + 64 <= len && written < out_len; i += 64) {
+    if (any_eq64_avx(ptr + i, matches)) {
+      written = emit_positions(eq_mask64_avx(ptr + i, matches), 0, i, out,
+                               out_len, written);
+    }
+  }
+  if (i + 32 <= len && written < out_len) {
+    written = emit_positions(eq_mask32_avx(ptr + i, matches), 0, i, out,
+                             out_len, written);
+    i += 32;
+  }
+  if (i < len && written < out_len) {
+    uint64_t const mask = eq_mask32_avx(ptr + len - 32, matches) >> (i - (len - 32));
+    written = emit_positions(mask, 0, i, out, out_len, written);
+  }
+  return written;
+}
+#endif
+
+#if (DIABLO_HAS_AVX512BW)
+// Masked loads cover the ragged ends, so there is nothing scalar here.
+
+__attribute__((target("avx512bw")))
+static inline uint64_t eq_mask_avx512 (uint8_t const* const ptr,
+                                       size_t const len,
+                                       __m512i const matches) {
+  if (len >= 64) {
+    return _mm512_cmpeq_epi8_mask(matches, _mm512_loadu_si512((void const*)ptr));
+  }
+  __mmask64 const mask = low_mask(len);
+  return _mm512_mask_cmpeq_epi8_mask(mask, matches,
+                                     _mm512_maskz_loadu_epi8(mask, ptr));
+}
+
+__attribute__((target("avx512bw")))
+static inline size_t find_first_eq_avx512 (uint8_t const* const src,
+                                           size_t const off,
+                                           size_t const len,
+                                           uint8_t const byte) {
+  uint8_t const* const ptr = (uint8_t const*)&(src[off]);
+  __m512i const matches = _mm512_set1_epi8(byte);
+  for (size_t i = 0; i < len; i += 64) {
+    uint64_t const mask = eq_mask_avx512(ptr + i, len - i, matches);
+    if (mask != 0) {
+      return i + __builtin_ctzll(mask);
+    }
+  }
+  return len;
+}
+
+__attribute__((target("avx512bw")))
+static inline size_t find_last_eq_avx512 (uint8_t const* const src,
+                                          size_t const off,
+                                          size_t const len,
+                                          uint8_t const byte) {
+  uint8_t const* const ptr = (uint8_t const*)&(src[off]);
+  __m512i const matches = _mm512_set1_epi8(byte);
+  size_t i = len;
+  for (; i >= 64; i -= 64) {
+    uint64_t const mask = eq_mask_avx512(ptr + i - 64, 64, matches);
+    if (mask != 0) {
+      return i - 1 - __builtin_clzll(mask);
+    }
+  }
+  if (i > 0) {
+    uint64_t const mask = eq_mask_avx512(ptr, i, matches);
+    if (mask != 0) {
+      return 63 - __builtin_clzll(mask);
+    }
+  }
+  return len;
+}
+
+__attribute__((target("avx512bw")))
+static inline size_t find_all_eq_avx512 (uint8_t const* const src,
+                                         size_t const off,
+                                         size_t const len,
+                                         uint8_t const byte,
+                                         size_t* const out,
+                                         size_t const out_len) {
+  uint8_t const* const ptr = (uint8_t const*)&(src[off]);
+  __m512i const matches = _mm512_set1_epi8(byte);
+  size_t written = 0;
+  for (size_t i = 0; i < len && written < out_len; i += 64) {
+    written = emit_positions(eq_mask_avx512(ptr + i, len - i, matches), 0, i,
+                             out, out_len, written);
+  }
+  return written;
+}
+#endif
+
+#if (DIABLO_HAS_NEON)
+// Masks here have four bits per byte; see nibble_mask.
+
+static inline uint64_t eq_mask16_neon (uint8_t const* const ptr,
+                                       uint8x16_t const matches) {
+  return nibble_mask(vceqq_u8(matches, vld1q_u8(ptr)));
+}
+
+static inline bool any_eq64_neon (uint8_t const* const ptr,
+                                  uint8x16_t const matches) {
+  uint8x16_t const any =
+    vorrq_u8(vorrq_u8(vceqq_u8(matches, vld1q_u8(ptr)),
+                      vceqq_u8(matches, vld1q_u8(ptr + 16))),
+             vorrq_u8(vceqq_u8(matches, vld1q_u8(ptr + 32)),
+                      vceqq_u8(matches, vld1q_u8(ptr + 48))));
+  return nibble_mask(any) != 0;
+}
+
+static inline size_t find_first_eq_neon (uint8_t const* const src,
+                                         size_t const off,
+                                         size_t const len,
+                                         uint8_t const byte) {
+  uint8_t const* const ptr = (uint8_t const*)&(src[off]);
+  if (len < 16) {
+    return find_first_eq_rest(ptr, len, byte);
+  }
+  uint8x16_t const matches = vdupq_n_u8(byte);
+  size_t i = 0;
+  for (; i + 64 <= len; i += 64) {
+    if (any_eq64_neon(ptr + i, matches)) {
+      break;
+    }
+  }
+  for (; i + 16 <= len; i += 16) {
+    uint64_t const mask = eq_mask16_neon(ptr + i, matches);
+    if (mask != 0) {
+      return i + (__builtin_ctzll(mask) / 4);
+    }
+  }
+  if (i < len) {
+    uint64_t const mask = eq_mask16_neon(ptr + len - 16, matches);
+    if (mask != 0) {
+      return len - 16 + (__builtin_ctzll(mask) / 4);
+    }
+  }
+  return len;
+}
+
+static inline size_t find_last_eq_neon (uint8_t const* const src,
+                                        size_t const off,
+                                        size_t const len,
+                                        uint8_t const byte) {
+  uint8_t const* const ptr = (uint8_t const*)&(src[off]);
+  if (len < 16) {
+    return find_last_eq_rest(ptr, len, byte);
+  }
+  uint8x16_t const matches = vdupq_n_u8(byte);
+  size_t i = len;
+  for (; i >= 64; i -= 64) {
+    if (any_eq64_neon(ptr + i - 64, matches)) {
+      break;
+    }
+  }
+  for (; i >= 16; i -= 16) {
+    uint64_t const mask = eq_mask16_neon(ptr + i - 16, matches);
+    if (mask != 0) {
+      return i - 16 + ((63 - __builtin_clzll(mask)) / 4);
+    }
+  }
+  if (i > 0) {
+    uint64_t const mask = eq_mask16_neon(ptr, matches);
+    if (mask != 0) {
+      return (63 - __builtin_clzll(mask)) / 4;
+    }
+  }
+  return len;
+}
+
+static inline size_t find_all_eq_neon (uint8_t const* const src,
+                                       size_t const off,
+                                       size_t const len,
+                                       uint8_t const byte,
+                                       size_t* const out,
+                                       size_t const out_len) {
+  uint8_t const* const ptr = (uint8_t const*)&(src[off]);
+  if (len < 16) {
+    return find_all_eq_rest(ptr, 0, len, byte, out, out_len, 0);
+  }
+  // One bit per byte is enough for emitting positions.
+  uint64_t const lanes = 0x8888888888888888ULL;
+  uint8x16_t const matches = vdupq_n_u8(byte);
+  size_t written = 0;
+  size_t i = 0;
+  for (; i + 64 <= len && written < out_len; i += 64) {
+    if (any_eq64_neon(ptr + i, matches)) {
+      for (size_t j = 0; j < 64; j += 16) {
+        written = emit_positions(eq_mask16_neon(ptr + i + j, matches) & lanes,
+                                 2, i + j, out, out_len, written);
+      }
+    }
+  }
+  for (; i + 16 <= len && written < out_len; i += 16) {
+    written = emit_positions(eq_mask16_neon(ptr + i, matches) & lanes, 2, i,
+                             out, out_len, written);
+  }
+  if (i < len && written < out_len) {
+    uint64_t const mask =
+      (eq_mask16_neon(ptr + len - 16, matches) & lanes) >> (4 * (i - (len - 16)));
+    written = emit_positions(mask, 2, i, out, out_len, written);
+  }
+  return written;
+}
+#endif
+
+typedef size_t (*find_eq_kernel) (uint8_t const* const,
+                                  size_t const,
+                                  size_t const,
+                                  uint8_t const);
+
+typedef size_t (*find_all_eq_kernel) (uint8_t const* const,
+                                      size_t const,
+                                      size_t const,
+                                      uint8_t const,
+                                      size_t* const,
+                                      size_t const);
+
+static find_eq_kernel const find_first_eq_kernels[DIABLO_BACKEND_COUNT] = {
+  [DIABLO_BACKEND_SWAR] = find_first_eq_swar,
+#if (DIABLO_HAS_SSE2)
+  [DIABLO_BACKEND_SSE2] = find_first_eq_sse,
+#endif
+#if (DIABLO_HAS_SSSE3)
+  [DIABLO_BACKEND_SSSE3] = find_first_eq_sse,
+#endif
+#if (DIABLO_HAS_AVX2)
+  [DIABLO_BACKEND_AVX2] = find_first_eq_avx,
+#endif
+#if (DIABLO_HAS_NEON)
+  [DIABLO_BACKEND_NEON] = find_first_eq_neon,
+#endif
+#if (DIABLO_HAS_AVX512BW)
+  [DIABLO_BACKEND_AVX512BW] = find_first_eq_avx512,
+#endif
+};
+
+static find_eq_kernel const find_last_eq_kernels[DIABLO_BACKEND_COUNT] = {
+  [DIABLO_BACKEND_SWAR] = find_last_eq_swar,
+#if (DIABLO_HAS_SSE2)
+  [DIABLO_BACKEND_SSE2] = find_last_eq_sse,
+#endif
+#if (DIABLO_HAS_SSSE3)
+  [DIABLO_BACKEND_SSSE3] = find_last_eq_sse,
+#endif
+#if (DIABLO_HAS_AVX2)
+  [DIABLO_BACKEND_AVX2] = find_last_eq_avx,
+#endif
+#if (DIABLO_HAS_NEON)
+  [DIABLO_BACKEND_NEON] = find_last_eq_neon,
+#endif
+#if (DIABLO_HAS_AVX512BW)
+  [DIABLO_BACKEND_AVX512BW] = find_last_eq_avx512,
+#endif
+};
+
+static find_all_eq_kernel const find_all_eq_kernels[DIABLO_BACKEND_COUNT] = {
+  [DIABLO_BACKEND_SWAR] = find_all_eq_swar,
+#if (DIABLO_HAS_SSE2)
+  [DIABLO_BACKEND_SSE2] = find_all_eq_sse,
+#endif
+#if (DIABLO_HAS_SSSE3)
+  [DIABLO_BACKEND_SSSE3] = find_all_eq_sse,
+#endif
+#if (DIABLO_HAS_AVX2)
+  [DIABLO_BACKEND_AVX2] = find_all_eq_avx,
+#endif
+#if (DIABLO_HAS_NEON)
+  [DIABLO_BACKEND_NEON] = find_all_eq_neon,
+#endif
+#if (DIABLO_HAS_AVX512BW)
+  [DIABLO_BACKEND_AVX512BW] = find_all_eq_avx512,
+#endif
+};
+
+size_t diablo_find_first_eq (uint8_t const* const src,
+                             size_t const off,
+                             size_t const len,
+                             uint8_t const byte) {
+  STATS_RECORD(STATS_FIND_FIRST_EQ, len);
+  return find_first_eq_kernels[active_backend()](src, off, len, byte);
+}
+
+size_t diablo_find_last_eq (uint8_t const* const src,
+                            size_t const off,
+                            size_t const len,
+                            uint8_t const byte) {
+  STATS_RECORD(STATS_FIND_LAST_EQ, len);
+  return find_last_eq_kernels[active_backend()](src, off, len, byte);
+}
+
+size_t diablo_find_all_eq (uint8_t const* const src,
+                           size_t const off,
+                           size_t const len,
+                           uint8_t const byte,
+                           size_t* const out,
+                           size_t const out_len) {
+  STATS_RECORD(STATS_FIND_ALL_EQ, len);
+  return find_all_eq_kernels[active_backend()](src, off, len, byte, out, out_len);
+}
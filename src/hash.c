@@ -0,0 +1,593 @@
+/*
+ * Copyright 2021 Koz Ross <koz.ross@retro-freedom.nz>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <stddef.h>
+#include <string.h>
+#include "dispatch.h"
+#include "stats.h"
+
+// The hash is XXH3 (from xxHash 0.8), in its 64-bit form with a seed: for the
+// same bytes and seed, we give the same result as XXH3_64bits_withSeed. It
+// reads all input as little-endian words, so this holds on every machine.
+//
+// Inputs of up to HASH_MIDSIZE_MAX bytes are mixed 16 bytes at a time, with
+// 64 by 64-bit multiplies folded down to 64 bits; this is scalar everywhere.
+// Longer ones go through eight 64-bit accumulators in 64-byte stripes, each
+// lane taking a 32 by 32-bit multiply per stripe, which vectorizes directly;
+// the kernels do this part. After every HASH_STRIPES_PER_BLOCK stripes, the
+// accumulators are scrambled.
+//
+// Every stripe is mixed with its own part of a 192-byte secret. Seeding adds
+// the seed to every other word of the default secret, and takes it from the
+// rest.
+
+#define HASH_SECRET_SIZE 192
+#define HASH_STRIPE 64
+#define HASH_STRIPES_PER_BLOCK ((HASH_SECRET_SIZE - HASH_STRIPE) / 8)
+#define HASH_MIDSIZE_MAX 240
+#define HASH_BUFFER_SIZE 256
+// Where in the secret the scramble, the last stripe and the final merge get
+// their keys.
+#define HASH_SCRAMBLE_KEY (HASH_SECRET_SIZE - HASH_STRIPE)
+#define HASH_LAST_STRIPE_KEY (HASH_SECRET_SIZE - HASH_STRIPE - 7)
+#define HASH_MERGE_KEY 11
+
+_Static_assert(sizeof(((diablo_hash64_state*)NULL)->secret) == HASH_SECRET_SIZE,
+               "diablo_hash64_state has room for the secret");
+_Static_assert(sizeof(((diablo_hash64_state*)NULL)->buffer) == HASH_BUFFER_SIZE,
+               "diablo_hash64_state has room for the buffer");
+
+static uint8_t const hash_default_secret[HASH_SECRET_SIZE] = {
+  0xb8, 0xfe, 0x6c, 0x39, 0x23, 0xa4, 0x4b, 0xbe, 0x7c, 0x01, 0x81, 0x2c,
+  0xf7, 0x21, 0xad, 0x1c, 0xde, 0xd4, 0x6d, 0xe9, 0x83, 0x90, 0x97, 0xdb,
+  0x72, 0x40, 0xa4, 0xa4, 0xb7, 0xb3, 0x67, 0x1f, 0xcb, 0x79, 0xe6, 0x4e,
+  0xcc, 0xc0, 0xe5, 0x78, 0x82, 0x5a, 0xd0, 0x7d, 0xcc, 0xff, 0x72, 0x21,
+  0xb8, 0x08, 0x46, 0x74, 0xf7, 0x43, 0x24, 0x8e, 0xe0, 0x35, 0x90, 0xe6,
+  0x81, 0x3a, 0x26, 0x4c, 0x3c, 0x28, 0x52, 0xbb, 0x91, 0xc3, 0x00, 0xcb,
+  0x88, 0xd0, 0x65, 0x8b, 0x1b, 0x53, 0x2e, 0xa3, 0x71, 0x64, 0x48, 0x97,
+  0xa2, 0x0d, 0xf9, 0x4e, 0x38, 0x19, 0xef, 0x46, 0xa9, 0xde, 0xac, 0xd8,
+  0xa8, 0xfa, 0x76, 0x3f, 0xe3, 0x9c, 0x34, 0x3f, 0xf9, 0xdc, 0xbb, 0xc7,
+  0xc7, 0x0b, 0x4f, 0x1d, 0x8a, 0x51, 0xe0, 0x4b, 0xcd, 0xb4, 0x59, 0x31,
+  0xc8, 0x9f, 0x7e, 0xc9, 0xd9, 0x78, 0x73, 0x64, 0xea, 0xc5, 0xac, 0x83,
+  0x34, 0xd3, 0xeb, 0xc3, 0xc5, 0x81, 0xa0, 0xff, 0xfa, 0x13, 0x63, 0xeb,
+  0x17, 0x0d, 0xdd, 0x51, 0xb7, 0xf0, 0xda, 0x49, 0xd3, 0x16, 0x55, 0x26,
+  0x29, 0xd4, 0x68, 0x9e, 0x2b, 0x16, 0xbe, 0x58, 0x7d, 0x47, 0xa1, 0xfc,
+  0x8f, 0xf8, 0xb8, 0xd1, 0x7a, 0xd0, 0x31, 0xce, 0x45, 0xcb, 0x3a, 0x8f,
+  0x95, 0x16, 0x04, 0x28, 0xaf, 0xd7, 0xfb, 0xca, 0xbb, 0x4b, 0x40, 0x7e
+};
+
+#define HASH_PRIME32_1 0x9E3779B1U
+#define HASH_PRIME32_2 0x85EBCA77U
+#define HASH_PRIME32_3 0xC2B2AE3DU
+#define HASH_PRIME64_1 0x9E3779B185EBCA87ULL
+#define HASH_PRIME64_2 0xC2B2AE3D27D4EB4FULL
+#define HASH_PRIME64_3 0x165667B19E3779F9ULL
+#define HASH_PRIME64_4 0x85EBCA77C2B2AE63ULL
+#define HASH_PRIME64_5 0x27D4EB2F165667C5ULL
+#define HASH_PRIME_MX1 0x165667919E3779F9ULL
+#define HASH_PRIME_MX2 0x9FB21C651E98DF25ULL
+
+static inline uint64_t hash_read64 (uint8_t const* const src) {
+  uint64_t word;
+  memcpy(&word, src, sizeof(uint64_t));
+#if (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+  return __builtin_bswap64(word);
+#else
+  return word;
+#endif
+}
+
+static inline uint32_t hash_read32 (uint8_t const* const src) {
+  uint32_t word;
+  memcpy(&word, src, sizeof(uint32_t));
+#if (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+  return __builtin_bswap32(word);
+#else
+  return word;
+#endif
+}
+
+static inline void hash_write64 (uint8_t* const dst, uint64_t const word) {
+#if (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+  uint64_t const swapped = __builtin_bswap64(word);
+#else
+  uint64_t const swapped = word;
+#endif
+  memcpy(dst, &swapped, sizeof(uint64_t));
+}
+
+static inline uint64_t hash_rotl (uint64_t const x, unsigned const r) {
+  return (x << r) | (x >> (64 - r));
+}
+
+// The full 128-bit product of a and b, with its halves XORed together. 32-bit
+// targets don't have 128-bit integers, so they build it from 32-bit pieces.
+static inline uint64_t hash_mul_fold (uint64_t const a, uint64_t const b) {
+#if (__SIZEOF_INT128__)
+  __extension__ typedef unsigned __int128 hash_u128;
+  hash_u128 const product = (hash_u128)a * b;
+  return (uint64_t)product ^ (uint64_t)(product >> 64);
+#else
+  uint64_t const lo_lo = (a & 0xFFFFFFFF) * (b & 0xFFFFFFFF);
+  uint64_t const hi_lo = (a >> 32) * (b & 0xFFFFFFFF);
+  uint64_t const lo_hi = (a & 0xFFFFFFFF) * (b >> 32);
+  uint64_t const hi_hi = (a >> 32) * (b >> 32);
+  uint64_t const cross = (lo_lo >> 32) + (hi_lo & 0xFFFFFFFF) + lo_hi;
+  uint64_t const upper = (hi_lo >> 32) + (cross >> 32) + hi_hi;
+  uint64_t const lower = (cross << 32) | (lo_lo & 0xFFFFFFFF);
+  return lower ^ upper;
+#endif
+}
+
+static inline uint64_t hash_avalanche (uint64_t h) {
+  h ^= h >> 37;
+  h *= HASH_PRIME_MX1;
+  return h ^ (h >> 32);
+}
+
+// The finish from XXH64, used by the shortest inputs.
+static inline uint64_t hash_avalanche_xxh64 (uint64_t h) {
+  h ^= h >> 33;
+  h *= HASH_PRIME64_2;
+  h ^= h >> 29;
+  h *= HASH_PRIME64_3;
+  return h ^ (h >> 32);
+}
+
+static inline uint64_t hash_mix16 (uint8_t const* const src,
+                                   uint8_t const* const secret,
+                                   uint64_t const seed) {
+  return hash_mul_fold(hash_read64(src) ^ (hash_read64(secret) + seed),
+                       hash_read64(src + 8) ^ (hash_read64(secret + 8) - seed));
+}
+
+// At most HASH_MIDSIZE_MAX bytes, with the default secret.
+static uint64_t hash_short (uint8_t const* const src,
+                            size_t const len,
+                            uint64_t const seed) {
+  uint8_t const* const secret = hash_default_secret;
+  if (len == 0) {
+    return hash_avalanche_xxh64(seed ^ hash_read64(secret + 56) ^
+                                hash_read64(secret + 64));
+  }
+  if (len <= 3) {
+    uint32_t const combined = ((uint32_t)src[0] << 16) |
+                              ((uint32_t)src[len >> 1] << 24) |
+                              (uint32_t)src[len - 1] |
+                              ((uint32_t)len << 8);
+    uint64_t const flip = (hash_read32(secret) ^ hash_read32(secret + 4)) + seed;
+    return hash_avalanche_xxh64(combined ^ flip);
+  }
+  if (len <= 8) {
+    uint64_t const mixed_seed =
+      seed ^ ((uint64_t)__builtin_bswap32((uint32_t)seed) << 32);
+    uint64_t const flip =
+      (hash_read64(secret + 8) ^ hash_read64(secret + 16)) - mixed_seed;
+    uint64_t const input = hash_read32(src + len - 4) +
+                           ((uint64_t)hash_read32(src) << 32);
+    uint64_t h = input ^ flip;
+    h ^= hash_rotl(h, 49) ^ hash_rotl(h, 24);
+    h *= HASH_PRIME_MX2;
+    h ^= (h >> 35) + len;
+    h *= HASH_PRIME_MX2;
+    return h ^ (h >> 28);
+  }
+  if (len <= 16) {
+    uint64_t const lo = hash_read64(src) ^
+      ((hash_read64(secret + 24) ^ hash_read64(secret + 32)) + seed);
+    uint64_t const hi = hash_read64(src + len - 8) ^
+      ((hash_read64(secret + 40) ^ hash_read64(secret + 48)) - seed);
+    return hash_avalanche(len + __builtin_bswap64(lo) + hi +
+                          hash_mul_fold(lo, hi));
+  }
+  uint64_t acc = len * HASH_PRIME64_1;
+  if (len <= 128) {
+    // Pairs of 16 bytes from each end, working inwards.
+    for (size_t i = (len - 1) / 32 + 1; i > 0; i--) {
+      size_t const k = i - 1;
+      acc += hash_mix16(src + (16 * k), secret + (32 * k), seed);
+      acc += hash_mix16(src + len - (16 * (k + 1)), secret + (32 * k) + 16, seed);
+    }
+    return hash_avalanche(acc);
+  }
+  for (size_t i = 0; i < 8; i++) {
+    acc += hash_mix16(src + (16 * i), secret + (16 * i), seed);
+  }
+  acc = hash_avalanche(acc);
+  uint64_t end = hash_mix16(src + len - 16, secret + 136 - 17, seed);
+  for (size_t i = 8; i < len / 16; i++) {
+    end += hash_mix16(src + (16 * i), secret + (16 * (i - 8)) + 3, seed);
+  }
+  return hash_avalanche(acc + end);
+}
+
+// Every kernel mixes the given number of stripes into the accumulators,
+// keying each with the next part of the secret, and scrambling after the last
+// stripe of every block. done is how many stripes of the current block came
+// before src; the kernel returns the same for after them.
+
+static inline void hash_stripe_swar (uint64_t* const acc,
+                                     uint8_t const* const src,
+                                     uint8_t const* const key) {
+  for (size_t i = 0; i < 8; i++) {
+    uint64_t const data = hash_read64(src + (8 * i));
+    uint64_t const keyed = data ^ hash_read64(key + (8 * i));
+    acc[i ^ 1] += data;
+    acc[i] += (keyed & 0xFFFFFFFF) * (keyed >> 32);
+  }
+}
+
+static inline void hash_scramble_swar (uint64_t* const acc,
+                                       uint8_t const* const key) {
+  for (size_t i = 0; i < 8; i++) {
+    uint64_t lane = acc[i];
+    lane ^= lane >> 47;
+    lane ^= hash_read64(key + (8 * i));
+    acc[i] = lane * HASH_PRIME32_1;
+  }
+}
+
+static size_t hash_stripes_swar (uint64_t* const acc,
+                                 uint8_t const* const src,
+                                 size_t const stripes,
+                                 size_t done,
+                                 uint8_t const* const secret) {
+  for (size_t i = 0; i < stripes; i++) {
+    hash_stripe_swar(acc, src + (HASH_STRIPE * i), secret + (8 * done));
+    if (++done == HASH_STRIPES_PER_BLOCK) {
+      hash_scramble_swar(acc, secret + HASH_SCRAMBLE_KEY);
+      done = 0;
+    }
+  }
+  return done;
+}
+
+#if (DIABLO_HAS_SSE2)
+#include <emmintrin.h>
+
+// Every 64-bit lane of a vector multiplies its two halves. The same goes for
+// AVX2 and AVX-512BW; 32 by 32-bit multiplies are all any of them have for
+// 64-bit lanes.
+static size_t hash_stripes_sse (uint64_t* const acc,
+                                uint8_t const* const src,
+                                size_t const stripes,
+                                size_t done,
+                                uint8_t const* const secret) {
+  __m128i lanes[4];
+  for (size_t j = 0; j < 4; j++) {
+    lanes[j] = _mm_loadu_si128((__m128i const*)(acc + (2 * j)));
+  }
+  __m128i const prime = _mm_set1_epi32((int)HASH_PRIME32_1);
+  for (size_t i = 0; i < stripes; i++) {
+    uint8_t const* const stripe = src + (HASH_STRIPE * i);
+    uint8_t const* const key = secret + (8 * done);
+    for (size_t j = 0; j < 4; j++) {
+      __m128i const data = _mm_loadu_si128((__m128i const*)(stripe + (16 * j)));
+      __m128i const keyed =
+        _mm_xor_si128(data, _mm_loadu_si128((__m128i const*)(key + (16 * j))));
+      // Each lane's high half, moved down, multiplied by its low half.
+      __m128i const product =
+        _mm_mul_epu32(keyed, _mm_shuffle_epi32(keyed, _MM_SHUFFLE(0, 3, 0, 1)));
+      // Each lane's data goes to its neighbour.
+      __m128i const swapped = _mm_shuffle_epi32(data, _MM_SHUFFLE(1, 0, 3, 2));
+      lanes[j] = _mm_add_epi64(lanes[j], _mm_add_epi64(product, swapped));
+    }
+    if (++done == HASH_STRIPES_PER_BLOCK) {
+      uint8_t const* const scramble = secret + HASH_SCRAMBLE_KEY;
+      for (size_t j = 0; j < 4; j++) {
+        __m128i lane = _mm_xor_si128(lanes[j], _mm_srli_epi64(lanes[j], 47));
+        lane = _mm_xor_si128(lane,
+                             _mm_loadu_si128((__m128i const*)(scramble + (16 * j))));
+        // A 64 by 32-bit multiply, from two 32 by 32-bit ones.
+        __m128i const lo = _mm_mul_epu32(lane, prime);
+        __m128i const hi = _mm_mul_epu32(_mm_srli_epi64(lane, 32), prime);
+        lanes[j] = _mm_add_epi64(lo, _mm_slli_epi64(hi, 32));
+      }
+      done = 0;
+    }
+  }
+  for (size_t j = 0; j < 4; j++) {
+    _mm_storeu_si128((__m128i*)(acc + (2 * j)), lanes[j]);
+  }
+  return done;
+}
+#endif
+
+#if (DIABLO_HAS_AVX2)
+#include <immintrin.h>
+
+__attribute__((target("avx2")))
+static size_t hash_stripes_avx (uint64_t* const acc,
+                                uint8_t const* const src,
+                                size_t const stripes,
+                                size_t done,
+                                uint8_t const* const secret) {
+  __m256i lanes[2] = {
+    _mm256_loadu_si256((__m256i const*)acc),
+    _mm256_loadu_si256((__m256i const*)(acc + 4))
+  };
+  __m256i const prime = _mm256_set1_epi32((int)HASH_PRIME32_1);
+  for (size_t i = 0; i < stripes; i++) {
+    uint8_t const* const stripe = src + (HASH_STRIPE * i);
+    uint8_t const* const key = secret + (8 * done);
+    for (size_t j = 0; j < 2; j++) {
+      __m256i const data = _mm256_loadu_si256((__m256i const*)(stripe + (32 * j)));
+      __m256i const keyed =
+        _mm256_xor_si256(data, _mm256_loadu_si256((__m256i const*)(key + (32 * j))));
+      __m256i const product =
+        _mm256_mul_epu32(keyed, _mm256_shuffle_epi32(keyed, _MM_SHUFFLE(0, 3, 0, 1)));
+      // Neighbouring lanes are always in the same 128-bit half.
+      __m256i const swapped = _mm256_shuffle_epi32(data, _MM_SHUFFLE(1, 0, 3, 2));
+      lanes[j] = _mm256_add_epi64(lanes[j], _mm256_add_epi64(product, swapped));
+    }
+    if (++done == HASH_STRIPES_PER_BLOCK) {
+      uint8_t const* const scramble = secret + HASH_SCRAMBLE_KEY;
+      for (size_t j = 0; j < 2; j++) {
+        __m256i lane = _mm256_xor_si256(lanes[j], _mm256_srli_epi64(lanes[j], 47));
+        lane = _mm256_xor_si256(lane,
+                                _mm256_loadu_si256((__m256i const*)(scramble + (32 * j))));
+        __m256i const lo = _mm256_mul_epu32(lane, prime);
+        __m256i const hi = _mm256_mul_epu32(_mm256_srli_epi64(lane, 32), prime);
+        lanes[j] = _mm256_add_epi64(lo, _mm256_slli_epi64(hi, 32));
+      }
+      done = 0;
+    }
+  }
+  _mm256_storeu_si256((__m256i*)acc, lanes[0]);
+  _mm256_storeu_si256((__m256i*)(acc + 4), lanes[1]);
+  return done;
+}
+#endif
+
+#if (DIABLO_HAS_AVX512BW)
+#include <immintrin.h>
+
+// A whole stripe is one vector.
+__attribute__((target("avx512bw")))
+static size_t hash_stripes_avx512 (uint64_t* const acc,
+                                   uint8_t const* const src,
+                                   size_t const stripes,
+                                   size_t done,
+                                   uint8_t const* const secret) {
+  __m512i lanes = _mm512_loadu_si512(acc);
+  __m512i const prime = _mm512_set1_epi32((int)HASH_PRIME32_1);
+  for (size_t i = 0; i < stripes; i++) {
+    __m512i const data = _mm512_loadu_si512(src + (HASH_STRIPE * i));
+    __m512i const keyed =
+      _mm512_xor_si512(data, _mm512_loadu_si512(secret + (8 * done)));
+    __m512i const product =
+      _mm512_mul_epu32(keyed,
+                       _mm512_shuffle_epi32(keyed, (_MM_PERM_ENUM)_MM_SHUFFLE(0, 3, 0, 1)));
+    __m512i const swapped =
+      _mm512_shuffle_epi32(data, (_MM_PERM_ENUM)_MM_SHUFFLE(1, 0, 3, 2));
+    lanes = _mm512_add_epi64(lanes, _mm512_add_epi64(product, swapped));
+    if (++done == HASH_STRIPES_PER_BLOCK) {
+      __m512i lane = _mm512_xor_si512(lanes, _mm512_srli_epi64(lanes, 47));
+      lane = _mm512_xor_si512(lane,
+                              _mm512_loadu_si512(secret + HASH_SCRAMBLE_KEY));
+      __m512i const lo = _mm512_mul_epu32(lane, prime);
+      __m512i const hi = _mm512_mul_epu32(_mm512_srli_epi64(lane, 32), prime);
+      lanes = _mm512_add_epi64(lo, _mm512_slli_epi64(hi, 32));
+      done = 0;
+    }
+  }
+  _mm512_storeu_si512(acc, lanes);
+  return done;
+}
+#endif
+
+#if (DIABLO_HAS_NEON)
+#include <arm_neon.h>
+
+// Loading bytes and reinterpreting gives little-endian lanes, whatever the
+// machine's byte order.
+static size_t hash_stripes_neon (uint64_t* const acc,
+                                 uint8_t const* const src,
+                                 size_t const stripes,
+                                 size_t done,
+                                 uint8_t const* const secret) {
+  uint64x2_t lanes[4];
+  for (size_t j = 0; j < 4; j++) {
+    lanes[j] = vld1q_u64(acc + (2 * j));
+  }
+  for (size_t i = 0; i < stripes; i++) {
+    uint8_t const* const stripe = src + (HASH_STRIPE * i);
+    uint8_t const* const key = secret + (8 * done);
+    for (size_t j = 0; j < 4; j++) {
+      uint64x2_t const data = vreinterpretq_u64_u8(vld1q_u8(stripe + (16 * j)));
+      uint64x2_t const keyed =
+        veorq_u64(data, vreinterpretq_u64_u8(vld1q_u8(key + (16 * j))));
+      uint64x2_t const product = vmull_u32(vmovn_u64(keyed),
+                                           vshrn_n_u64(keyed, 32));
+      uint64x2_t const swapped = vextq_u64(data, data, 1);
+      lanes[j] = vaddq_u64(lanes[j], vaddq_u64(product, swapped));
+    }
+    if (++done == HASH_STRIPES_PER_BLOCK) {
+      uint8_t const* const scramble = secret + HASH_SCRAMBLE_KEY;
+      for (size_t j = 0; j < 4; j++) {
+        uint64x2_t lane = veorq_u64(lanes[j], vshrq_n_u64(lanes[j], 47));
+        lane = veorq_u64(lane,
+                         vreinterpretq_u64_u8(vld1q_u8(scramble + (16 * j))));
+        uint64x2_t const lo = vmull_n_u32(vmovn_u64(lane), HASH_PRIME32_1);
+        uint64x2_t const hi = vmull_n_u32(vshrn_n_u64(lane, 32), HASH_PRIME32_1);
+        lanes[j] = vaddq_u64(lo, vshlq_n_u64(hi, 32));
+      }
+      done = 0;
+    }
+  }
+  for (size_t j = 0; j < 4; j++) {
+    vst1q_u64(acc + (2 * j), lanes[j]);
+  }
+  return done;
+}
+#endif
+
+typedef size_t (*hash_kernel) (uint64_t* const,
+                               uint8_t const* const,
+                               size_t const,
+                               size_t,
+                               uint8_t const* const);
+
+static hash_kernel const hash_kernels[DIABLO_BACKEND_COUNT] = {
+  [DIABLO_BACKEND_SWAR] = hash_stripes_swar,
+#if (DIABLO_HAS_SSE2)
+  [DIABLO_BACKEND_SSE2] = hash_stripes_sse,
+#endif
+#if (DIABLO_HAS_SSSE3)
+  [DIABLO_BACKEND_SSSE3] = hash_stripes_sse,
+#endif
+#if (DIABLO_HAS_AVX2)
+  [DIABLO_BACKEND_AVX2] = hash_stripes_avx,
+#endif
+#if (DIABLO_HAS_NEON)
+  [DIABLO_BACKEND_NEON] = hash_stripes_neon,
+#endif
+#if (DIABLO_HAS_AVX512BW)
+  [DIABLO_BACKEND_AVX512BW] = hash_stripes_avx512,
+#endif
+};
+
+static void hash_init_acc (uint64_t* const acc) {
+  acc[0] = HASH_PRIME32_3;
+  acc[1] = HASH_PRIME64_1;
+  acc[2] = HASH_PRIME64_2;
+  acc[3] = HASH_PRIME64_3;
+  acc[4] = HASH_PRIME64_4;
+  acc[5] = HASH_PRIME32_2;
+  acc[6] = HASH_PRIME64_5;
+  acc[7] = HASH_PRIME32_1;
+}
+
+static void hash_init_secret (uint8_t* const secret, uint64_t const seed) {
+  for (size_t i = 0; i < HASH_SECRET_SIZE; i += 16) {
+    hash_write64(secret + i, hash_read64(hash_default_secret + i) + seed);
+    hash_write64(secret + i + 8, hash_read64(hash_default_secret + i + 8) - seed);
+  }
+}
+
+// Mix in the last 64 bytes of the input, which may overlap stripes already
+// mixed, and bring everything down to one word.
+static uint64_t hash_finish_long (uint64_t* const acc,
+                                  uint8_t const* const last_stripe,
+                                  uint8_t const* const secret,
+                                  uint64_t const len) {
+  hash_stripe_swar(acc, last_stripe, secret + HASH_LAST_STRIPE_KEY);
+  uint64_t result = len * HASH_PRIME64_1;
+  for (size_t i = 0; i < 4; i++) {
+    uint8_t const* const key = secret + HASH_MERGE_KEY + (16 * i);
+    result += hash_mul_fold(acc[2 * i] ^ hash_read64(key),
+                            acc[(2 * i) + 1] ^ hash_read64(key + 8));
+  }
+  return hash_avalanche(result);
+}
+
+uint64_t diablo_hash64 (uint8_t const* const src,
+                        size_t const off,
+                        size_t const len,
+                        uint64_t const seed) {
+  STATS_RECORD(STATS_HASH64, len);
+  uint8_t const* const ptr = &(src[off]);
+  if (len <= HASH_MIDSIZE_MAX) {
+    return hash_short(ptr, len, seed);
+  }
+  uint8_t seeded[HASH_SECRET_SIZE];
+  uint8_t const* secret = hash_default_secret;
+  if (seed != 0) {
+    hash_init_secret(seeded, seed);
+    secret = seeded;
+  }
+  uint64_t acc[8];
+  hash_init_acc(acc);
+  // Every whole stripe bar the last byte; the last stripe is done apart.
+  hash_kernels[active_backend()](acc, ptr, (len - 1) / HASH_STRIPE, 0, secret);
+  return hash_finish_long(acc, ptr + len - HASH_STRIPE, secret, len);
+}
+
+void diablo_hash64_init (diablo_hash64_state* const state,
+                         uint64_t const seed) {
+  hash_init_acc(state->acc);
+  hash_init_secret(state->secret, seed);
+  state->seed = seed;
+  state->len = 0;
+  state->buffered = 0;
+  state->stripes = 0;
+}
+
+// The buffer always keeps at least one byte back, so that however the input
+// is split, we mix exactly the stripes diablo_hash64 would before its last
+// one. Whenever we mix straight from the input, we copy its last stripe to
+// the end of the buffer, for diablo_hash64_finish to use if it needs to.
+void diablo_hash64_update (diablo_hash64_state* const state,
+                           uint8_t const* const src,
+                           size_t const off,
+                           size_t const len) {
+  STATS_RECORD(STATS_HASH64_UPDATE, len);
+  uint8_t const* ptr = &(src[off]);
+  size_t remaining = len;
+  state->len += len;
+  if (remaining <= HASH_BUFFER_SIZE - state->buffered) {
+    // memcpy with a null pointer is undefined, even for no bytes.
+    if (remaining != 0) {
+      memcpy(state->buffer + state->buffered, ptr, remaining);
+    }
+    state->buffered += remaining;
+    return;
+  }
+  hash_kernel const kernel = hash_kernels[active_backend()];
+  if (state->buffered != 0) {
+    size_t const fill = HASH_BUFFER_SIZE - state->buffered;
+    memcpy(state->buffer + state->buffered, ptr, fill);
+    ptr += fill;
+    remaining -= fill;
+    state->stripes = kernel(state->acc, state->buffer,
+                            HASH_BUFFER_SIZE / HASH_STRIPE, state->stripes,
+                            state->secret);
+    state->buffered = 0;
+  }
+  if (remaining > HASH_BUFFER_SIZE) {
+    size_t const stripes = (remaining - 1) / HASH_STRIPE;
+    state->stripes = kernel(state->acc, ptr, stripes, state->stripes,
+                            state->secret);
+    ptr += stripes * HASH_STRIPE;
+    remaining -= stripes * HASH_STRIPE;
+    memcpy(state->buffer + HASH_BUFFER_SIZE - HASH_STRIPE, ptr - HASH_STRIPE,
+           HASH_STRIPE);
+  }
+  memcpy(state->buffer, ptr, remaining);
+  state->buffered = remaining;
+}
+
+uint64_t diablo_hash64_finish (diablo_hash64_state const* const state) {
+  // Short enough that the buffer has all of it.
+  if (state->len <= HASH_MIDSIZE_MAX) {
+    return hash_short(state->buffer, state->buffered, state->seed);
+  }
+  uint64_t acc[8];
+  memcpy(acc, state->acc, sizeof(acc));
+  size_t const buffered = state->buffered;
+  if (buffered >= HASH_STRIPE) {
+    hash_kernels[active_backend()](acc, state->buffer,
+                                   (buffered - 1) / HASH_STRIPE,
+                                   state->stripes, state->secret);
+    return hash_finish_long(acc, state->buffer + buffered - HASH_STRIPE,
+                            state->secret, state->len);
+  }
+  // The last stripe starts in the input we've already mixed.
+  uint8_t last_stripe[HASH_STRIPE];
+  size_t const before = HASH_STRIPE - buffered;
+  memcpy(last_stripe, state->buffer + HASH_BUFFER_SIZE - before, before);
+  memcpy(last_stripe + before, state->buffer, buffered);
+  return hash_finish_long(acc, last_stripe, state->secret, state->len);
+}
@@ -0,0 +1,351 @@
+/*
+ * Copyright 2021 Koz Ross <koz.ross@retro-freedom.nz>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <stddef.h>
+#include "common.h"
+#include "dispatch.h"
+#include "stats.h"
+
+// Every kernel returns the position of the first byte at which the two ranges
+// differ, or len if they don't.
+//
+// Nothing here loops a byte at a time. Inputs shorter than a vector are covered
+// by two overlapping loads of the largest size that fits, going down to words,
+// then half-words, then single bytes. Longer ones end with a vector which
+// overlaps the one before it.
+
+// The first differing byte of two 4-byte words, given their XOR, which must not
+// be zero.
+static inline size_t first_differing32 (uint32_t const diff) {
+#if (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+  return __builtin_clz(diff) / 8;
+#else
+  return __builtin_ctz(diff) / 8;
+#endif
+}
+
+// Fewer than 8 bytes.
+static inline size_t mismatch_tiny (uint8_t const* const a,
+                                    uint8_t const* const b,
+                                    size_t const len) {
+  if (len >= 4) {
+    uint32_t const first = *((uint32_t const*)a) ^ *((uint32_t const*)b);
+    if (first != 0) {
+      return first_differing32(first);
+    }
+    uint32_t const last = *((uint32_t const*)(a + len - 4)) ^
+                          *((uint32_t const*)(b + len - 4));
+    return (last != 0) ? len - 4 + first_differing32(last) : len;
+  }
+  if (len >= 1 && a[0] != b[0]) {
+    return 0;
+  }
+  if (len >= 2 && a[1] != b[1]) {
+    return 1;
+  }
+  if (len == 3 && a[2] != b[2]) {
+    return 2;
+  }
+  return len;
+}
+
+// Fewer than 16 bytes.
+static inline size_t mismatch_small (uint8_t const* const a,
+                                     uint8_t const* const b,
+                                     size_t const len) {
+  if (len < 8) {
+    return mismatch_tiny(a, b, len);
+  }
+  uint64_t const first = *((uint64_t const*)a) ^ *((uint64_t const*)b);
+  if (first != 0) {
+    return first_flagged(first);
+  }
+  uint64_t const last = *((uint64_t const*)(a + len - 8)) ^
+                        *((uint64_t const*)(b + len - 8));
+  return (last != 0) ? len - 8 + first_flagged(last) : len;
+}
+
+// SWAR implementation, used as the fallback everywhere.
+//
+// XORing words leaves a nonzero byte wherever they differ, so first_flagged
+// finds the first one.
+static inline size_t mismatch_swar (uint8_t const* const a,
+                                    size_t const a_off,
+                                    uint8_t const* const b,
+                                    size_t const b_off,
+                                    size_t const len) {
+  uint8_t const* const a_ptr = (uint8_t const*)&(a[a_off]);
+  uint8_t const* const b_ptr = (uint8_t const*)&(b[b_off]);
+  if (len < 16) {
+    return mismatch_small(a_ptr, b_ptr, len);
+  }
+  size_t i = 0;
+  for (; i + 8 <= len; i += 8) {
+    uint64_t const diff = *((uint64_t const*)(a_ptr + i)) ^
+                          *((uint64_t const*)(b_ptr + i));
+    if (diff != 0) {
+      return i + first_flagged(diff);
+    }
+  }
+  if (i < len) {
+    uint64_t const diff = *((uint64_t const*)(a_ptr + len - 8)) ^
+                          *((uint64_t const*)(b_ptr + len - 8));
+    if (diff != 0) {
+      return len - 8 + first_flagged(diff);
+    }
+  }
+  return len;
+}
+
+#if (DIABLO_HAS_SSE2)
+#include <emmintrin.h>
+
+// One bit per differing byte, in order.
+static inline uint32_t differ_mask16_sse (uint8_t const* const a,
+                                          uint8_t const* const b) {
+  __m128i const eq = _mm_cmpeq_epi8(_mm_loadu_si128((__m128i const*)a),
+                                    _mm_loadu_si128((__m128i const*)b));
+  return ((uint32_t)_mm_movemask_epi8(eq)) ^ 0xFFFF;
+}
+
+// Whether 64 bytes are all the same.
+static inline bool same64_sse (uint8_t const* const a,
+                               uint8_t const* const b) {
+  __m128i const* a_big = (__m128i const*)a;
+  __m128i const* b_big = (__m128i const*)b;
+  __m128i const all =
+    _mm_and_si128(_mm_and_si128(_mm_cmpeq_epi8(_mm_loadu_si128(a_big), _mm_loadu_si128(b_big)),
+                                _mm_cmpeq_epi8(_mm_loadu_si128(a_big + 1), _mm_loadu_si128(b_big + 1))),
+                  _mm_and_si128(_mm_cmpeq_epi8(_mm_loadu_si128(a_big + 2), _mm_loadu_si128(b_big + 2)),
+                                _mm_cmpeq_epi8(_mm_loadu_si128(a_big + 3), _mm_loadu_si128(b_big + 3))));
+  return _mm_movemask_epi8(all) == 0xFFFF;
+}
+
+static inline size_t mismatch_sse (uint8_t const* const a,
+                                   size_t const a_off,
+                                   uint8_t const* const b,
+                                   size_t const b_off,
+                                   size_t const len) {
+  uint8_t const* const a_ptr = (uint8_t const*)&(a[a_off]);
+  uint8_t const* const b_ptr = (uint8_t const*)&(b[b_off]);
+  if (len < 16) {
+    return mismatch_small(a_ptr, b_ptr, len);
+  }
+  size_t i = 0;
+  // Skip 64 bytes at a time while they're the same.
+  while (i + 64 <= len && same64_sse(a_ptr + i, b_ptr + i)) {
+    i += 64;
+  }
+  for (; i + 16 <= len; i += 16) {
+    uint32_t const mask = differ_mask16_sse(a_ptr + i, b_ptr + i);
+    if (mask != 0) {
+      return i + __builtin_ctz(mask);
+    }
+  }
+  if (i < len) {
+    uint32_t const mask = differ_mask16_sse(a_ptr + len - 16, b_ptr + len - 16);
+    if (mask != 0) {
+      return len - 16 + __builtin_ctz(mask);
+    }
+  }
+  return len;
+}
+#endif
+
+#if (DIABLO_HAS_AVX2)
+#include <immintrin.h>
+
+__attribute__((target("avx2")))
+static inline uint32_t differ_mask32_avx (uint8_t const* const a,
+                                          uint8_t const* const b) {
+  __m256i const eq = _mm256_cmpeq_epi8(_mm256_loadu_si256((__m256i const*)a),
+                                       _mm256_loadu_si256((__m256i const*)b));
+  return ~((uint32_t)_mm256_movemask_epi8(eq));
+}
+
+__attribute__((target("avx2")))
+static inline bool same64_avx (uint8_t const* const a,
+                               uint8_t const* const b) {
+  __m256i const* a_big = (__m256i const*)a;
+  __m256i const* b_big = (__m256i const*)b;
+  __m256i const all =
+    _mm256_and_si256(_mm256_cmpeq_epi8(_mm256_loadu_si256(a_big), _mm256_loadu_si256(b_big)),
+                     _mm256_cmpeq_epi8(_mm256_loadu_si256(a_big + 1), _mm256_loadu_si256(b_big + 1)));
+  return ((uint32_t)_mm256_movemask_epi8(all)) == 0xFFFFFFFF;
+}
+
+__attribute__((target("avx2")))
+static inline size_t mismatch_avx (uint8_t const* const a,
+                                   size_t const a_off,
+                                   uint8_t const* const b,
+                                   size_t const b_off,
+                                   size_t const len) {
+  // Shorter inputs do better with 16-byte vectors.
+  if (len < 32) {
+    return mismatch_sse(a, a_off, b, b_off, len);
+  }
+  uint8_t const* const a_ptr = (uint8_t const*)&(a[a_off]);
+  uint8_t const* const b_ptr = (uint8_t const*)&(b[b_off]);
+  size_t i = 0;
+  while (i + 64 <= len && same64_avx(a_ptr + i, b_ptr + i)) {
+    i += 64;
+  }
+  for (; i + 32 <= len; i += 32) {
+    uint32_t const mask = differ_mask32_avx(a_ptr + i, b_ptr + i);
+    if (mask != 0) {
+      return i + __builtin_ctz(mask);
+    }
+  }
+  if (i < len) {
+    uint32_t const mask = differ_mask32_avx(a_ptr + len - 32, b_ptr + len - 32);
+    if (mask != 0) {
+      return len - 32 + __builtin_ctz(mask);
+    }
+  }
+  return len;
+}
+#endif
+
+#if (DIABLO_HAS_AVX512BW)
+// Masked loads cover the ragged end, so there is nothing scalar here.
+__attribute__((target("avx512bw")))
+static inline size_t mismatch_avx512 (uint8_t const* const a,
+                                      size_t const a_off,
+                                      uint8_t const* const b,
+                                      size_t const b_off,
+                                      size_t const len) {
+  uint8_t const* const a_ptr = (uint8_t const*)&(a[a_off]);
+  uint8_t const* const b_ptr = (uint8_t const*)&(b[b_off]);
+  size_t i = 0;
+  for (; i + 64 <= len; i += 64) {
+    uint64_t const mask =
+      _mm512_cmpneq_epi8_mask(_mm512_loadu_si512((void const*)(a_ptr + i)),
+                              _mm512_loadu_si512((void const*)(b_ptr + i)));
+    if (mask != 0) {
+      return i + __builtin_ctzll(mask);
+    }
+  }
+  if (i < len) {
+    __mmask64 const valid = low_mask(len - i);
+    uint64_t const mask =
+      _mm512_mask_cmpneq_epi8_mask(valid,
+                                   _mm512_maskz_loadu_epi8(valid, a_ptr + i),
+                                   _mm512_maskz_loadu_epi8(valid, b_ptr + i));
+    if (mask != 0) {
+      return i + __builtin_ctzll(mask);
+    }
+  }
+  return len;
+}
+#endif
+
+#if (DIABLO_HAS_NEON)
+// Masks here have four bits per byte; see nibble_mask.
+static inline uint64_t differ_mask16_neon (uint8_t const* const a,
+                                           uint8_t const* const b) {
+  return ~nibble_mask(vceqq_u8(vld1q_u8(a), vld1q_u8(b)));
+}
+
+static inline bool same64_neon (uint8_t const* const a,
+                                uint8_t const* const b) {
+  uint8x16_t const all =
+    vandq_u8(vandq_u8(vceqq_u8(vld1q_u8(a), vld1q_u8(b)),
+                      vceqq_u8(vld1q_u8(a + 16), vld1q_u8(b + 16))),
+             vandq_u8(vceqq_u8(vld1q_u8(a + 32), vld1q_u8(b + 32)),
+                      vceqq_u8(vld1q_u8(a + 48), vld1q_u8(b + 48))));
+  return ~nibble_mask(all) == 0;
+}
+
+static inline size_t mismatch_neon (uint8_t const* const a,
+                                    size_t const a_off,
+                                    uint8_t const* const b,
+                                    size_t const b_off,
+                                    size_t const len) {
+  uint8_t const* const a_ptr = (uint8_t const*)&(a[a_off]);
+  uint8_t const* const b_ptr = (uint8_t const*)&(b[b_off]);
+  if (len < 16) {
+    return mismatch_small(a_ptr, b_ptr, len);
+  }
+  size_t i = 0;
+  while (i + 64 <= len && same64_neon(a_ptr + i, b_ptr + i)) {
+    i += 64;
+  }
+  for (; i + 16 <= len; i += 16) {
+    uint64_t const mask = differ_mask16_neon(a_ptr + i, b_ptr + i);
+    if (mask != 0) {
+      return i + (__builtin_ctzll(mask) >> 2);
+    }
+  }
+  if (i < len) {
+    uint64_t const mask = differ_mask16_neon(a_ptr + len - 16, b_ptr + len - 16);
+    if (mask != 0) {
+      return len - 16 + (__builtin_ctzll(mask) >> 2);
+    }
+  }
+  return len;
+}
+#endif
+
+typedef size_t (*mismatch_kernel) (uint8_t const* const,
+                                   size_t const,
+                                   uint8_t const* const,
+                                   size_t const,
+                                   size_t const);
+
+static mismatch_kernel const mismatch_kernels[DIABLO_BACKEND_COUNT] = {
+  [DIABLO_BACKEND_SWAR] = mismatch_swar,
+#if (DIABLO_HAS_SSE2)
+  [DIABLO_BACKEND_SSE2] = mismatch_sse,
+#endif
+#if (DIABLO_HAS_SSSE3)
+  [DIABLO_BACKEND_SSSE3] = mismatch_sse,
+#endif
+#if (DIABLO_HAS_AVX2)
+  [DIABLO_BACKEND_AVX2] = mismatch_avx,
+#endif
+#if (DIABLO_HAS_NEON)
+  [DIABLO_BACKEND_NEON] = mismatch_neon,
+#endif
+#if (DIABLO_HAS_AVX512BW)
+  [DIABLO_BACKEND_AVX512BW] = mismatch_avx512,
+#endif
+};
+
+size_t diablo_mismatch (uint8_t const* const a,
+                        size_t const a_off,
+                        uint8_t const* const b,
+                        size_t const b_off,
+                        size_t const len) {
+  STATS_RECORD(STATS_MISMATCH, len);
+  return mismatch_kernels[active_backend()](a, a_off, b, b_off, len);
+}
+
+int diablo_compare (uint8_t const* const a,
+                    size_t const a_off,
+                    size_t const a_len,
+                    uint8_t const* const b,
+                    size_t const b_off,
+                    size_t const b_len) {
+  size_t const len = (a_len < b_len) ? a_len : b_len;
+  STATS_RECORD(STATS_COMPARE, len);
+  size_t const i = mismatch_kernels[active_backend()](a, a_off, b, b_off, len);
+  if (i < len) {
+    return (a[a_off + i] < b[b_off + i]) ? -1 : 1;
+  }
+  if (a_len == b_len) {
+    return 0;
+  }
+  return (a_len < b_len) ? -1 : 1;
+}
@@ -0,0 +1,231 @@
+/*
+ * Copyright 2021 Koz Ross <koz.ross@retro-freedom.nz>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <stdatomic.h>
+#include <stdint.h>
+#include "pool.h"
+
+#if (DIABLO_HAS_THREADS)
+#include <threads.h>
+#endif
+
+#if (__unix__ || __APPLE__)
+#include <unistd.h>
+#endif
+
+// Below this many bytes, the parallel operations stay on the calling thread by
+// default. Waking the pool costs a few microseconds, which is about what a
+// single core needs for this much.
+#define DEFAULT_THRESHOLD (((size_t)4) << 20)
+
+// 0 means 'one per online CPU'.
+static atomic_size_t configured_threads = 0;
+static atomic_size_t configured_threshold = DEFAULT_THRESHOLD;
+
+static size_t online_cpus (void) {
+#if (defined(_SC_NPROCESSORS_ONLN))
+  long const online = sysconf(_SC_NPROCESSORS_ONLN);
+  if (online > 0) {
+    return (size_t)online;
+  }
+#endif
+  return 1;
+}
+
+size_t diablo_pool_threads (void) {
+#if (DIABLO_HAS_THREADS)
+  size_t threads = atomic_load_explicit(&configured_threads,
+                                        memory_order_relaxed);
+  if (threads == 0) {
+    threads = online_cpus();
+  }
+  return (threads < DIABLO_MAX_THREADS) ? threads : DIABLO_MAX_THREADS;
+#else
+  return 1;
+#endif
+}
+
+size_t diablo_pool_threshold (void) {
+  return atomic_load_explicit(&configured_threshold, memory_order_relaxed);
+}
+
+size_t diablo_get_threads (void) {
+  return diablo_pool_threads();
+}
+
+void diablo_set_threads (size_t const threads) {
+  atomic_store_explicit(&configured_threads, threads, memory_order_relaxed);
+}
+
+size_t diablo_get_parallel_threshold (void) {
+  return diablo_pool_threshold();
+}
+
+void diablo_set_parallel_threshold (size_t const bytes) {
+  atomic_store_explicit(&configured_threshold, bytes, memory_order_relaxed);
+}
+
+#if (DIABLO_HAS_THREADS)
+// One call to diablo_pool_run at a time owns the pool, by holding pool_busy.
+// Everything else is guarded by pool_lock.
+//
+// Posting a job bumps generation and wakes every worker. Workers whose id is
+// below job.helpers take tasks from job.next until there are none left, then
+// check out by decrementing job.active; the caller takes tasks too, then waits
+// for job.active to reach zero before returning. Thus, nobody can be looking
+// at a job once its call has returned.
+
+typedef struct {
+  void (*task) (void* const, size_t const);
+  void* arg;
+  size_t tasks;
+  size_t helpers;
+  atomic_size_t next;
+  size_t active;
+} pool_job;
+
+static once_flag pool_once = ONCE_FLAG_INIT;
+static bool pool_ready = false;
+static mtx_t pool_busy;
+static mtx_t pool_lock;
+static cnd_t work_ready;
+static cnd_t work_done;
+static thrd_t workers[DIABLO_MAX_THREADS - 1];
+// The generation each worker was started in, so it waits for the next one.
+static unsigned long worker_start[DIABLO_MAX_THREADS - 1];
+static size_t worker_count = 0;
+static unsigned long generation = 0;
+static bool shutting_down = false;
+static pool_job job;
+
+static void pool_init (void) {
+  pool_ready = (mtx_init(&pool_busy, mtx_plain) == thrd_success) &&
+               (mtx_init(&pool_lock, mtx_plain) == thrd_success) &&
+               (cnd_init(&work_ready) == thrd_success) &&
+               (cnd_init(&work_done) == thrd_success);
+}
+
+static void run_tasks (void) {
+  size_t i = atomic_fetch_add(&job.next, 1);
+  while (i < job.tasks) {
+    job.task(job.arg, i);
+    i = atomic_fetch_add(&job.next, 1);
+  }
+}
+
+static int worker_main (void* const arg) {
+  size_t const id = (size_t)(uintptr_t)arg;
+  mtx_lock(&pool_lock);
+  unsigned long seen = worker_start[id];
+  for (;;) {
+    while (generation == seen && !shutting_down) {
+      cnd_wait(&work_ready, &pool_lock);
+    }
+    if (shutting_down) {
+      break;
+    }
+    seen = generation;
+    if (id >= job.helpers) {
+      continue;
+    }
+    mtx_unlock(&pool_lock);
+    run_tasks();
+    mtx_lock(&pool_lock);
+    job.active--;
+    if (job.active == 0) {
+      cnd_signal(&work_done);
+    }
+  }
+  mtx_unlock(&pool_lock);
+  return 0;
+}
+
+// Stop and join the workers when we're unloaded, rather than leaving them
+// waiting on a condition variable which is about to disappear.
+__attribute__((destructor))
+static void pool_shutdown (void) {
+  if (worker_count == 0) {
+    return;
+  }
+  mtx_lock(&pool_lock);
+  shutting_down = true;
+  cnd_broadcast(&work_ready);
+  mtx_unlock(&pool_lock);
+  for (size_t i = 0; i < worker_count; i++) {
+    thrd_join(workers[i], NULL);
+  }
+  worker_count = 0;
+}
+#endif
+
+bool diablo_pool_run (size_t const threads,
+                      size_t const tasks,
+                      void (*const task)(void* const, size_t const),
+                      void* const arg) {
+#if (DIABLO_HAS_THREADS)
+  if (threads <= 1 || tasks <= 1) {
+    return false;
+  }
+  call_once(&pool_once, pool_init);
+  if (!pool_ready || mtx_trylock(&pool_busy) != thrd_success) {
+    return false;
+  }
+  size_t helpers = (threads < DIABLO_MAX_THREADS) ? threads - 1 : DIABLO_MAX_THREADS - 1;
+  if (helpers > tasks - 1) {
+    helpers = tasks - 1;
+  }
+  mtx_lock(&pool_lock);
+  // Start any workers we don't have yet. If we can't, make do.
+  while (worker_count < helpers) {
+    worker_start[worker_count] = generation;
+    if (thrd_create(&workers[worker_count], worker_main,
+                    (void*)(uintptr_t)worker_count) != thrd_success) {
+      break;
+    }
+    worker_count++;
+  }
+  if (helpers > worker_count) {
+    helpers = worker_count;
+  }
+  if (helpers == 0) {
+    mtx_unlock(&pool_lock);
+    mtx_unlock(&pool_busy);
+    return false;
+  }
+  job.task = task;
+  job.arg = arg;
+  job.tasks = tasks;
+  job.helpers = helpers;
+  atomic_store(&job.next, 0);
+  job.active = helpers;
+  generation++;
+  cnd_broadcast(&work_ready);
+  mtx_unlock(&pool_lock);
+  run_tasks();
+  mtx_lock(&pool_lock);
+  while (job.active != 0) {
+    cnd_wait(&work_done, &pool_lock);
+  }
+  mtx_unlock(&pool_lock);
+  mtx_unlock(&pool_busy);
+  return true;
+#else
+  (void)threads;
+  (void)tasks;
+  (void)task;
+  (void)arg;
+  return false;
+#endif
+}
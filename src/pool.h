@@ -0,0 +1,50 @@
+/*
+ * Copyright 2021 Koz Ross <koz.ross@retro-freedom.nz>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include "dispatch.h"
+
+// Internal thread pool for the parallel operations.
+//
+// We use C11 threads, so that we need nothing outside the C standard library.
+// Not every libc has them (macOS doesn't, for instance); there, the pool never
+// runs anything, and the parallel operations run on the calling thread.
+#if (defined(__has_include) && !defined(__STDC_NO_THREADS__))
+#if (__has_include(<threads.h>))
+#define DIABLO_HAS_THREADS 1
+#endif
+#endif
+
+// The most threads, including the calling one, that the pool will use.
+#define DIABLO_MAX_THREADS 64
+
+// How many threads, including the calling one, the parallel operations should
+// use, and how long (in bytes) an input has to be for them to bother.
+DIABLO_INTERNAL size_t diablo_pool_threads(void);
+DIABLO_INTERNAL size_t diablo_pool_threshold(void);
+
+// Run task(arg, i) for every i below tasks, spread over up to threads threads,
+// one of which is the calling thread. Workers are started on first use, and
+// reused afterwards.
+//
+// Returns false, having run nothing, if the pool can't help: because there are
+// no threads on this platform, or because another call is using it. Callers
+// should then do the work themselves.
+DIABLO_INTERNAL bool diablo_pool_run(size_t const threads,
+                                     size_t const tasks,
+                                     void (*const task)(void* const, size_t const),
+                                     void* const arg);
@@ -0,0 +1,576 @@
+/*
+ * Copyright 2021 Koz Ross <koz.ross@retro-freedom.nz>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <stddef.h>
+#include "common.h"
+#include "dispatch.h"
+#include "stats.h"
+
+// Every kernel here counts the 1 bits of a 64-byte block at a time. For the
+// bulk popcount, the counts get summed; for building a rank/select directory,
+// we need one count per 64-bit word, which is what a sum of absolute
+// differences against zero gives us anyway.
+//
+// The directory follows "rank9", from Sebastiano Vigna, "Broadword
+// Implementation of Rank/Select Queries". For every superblock of 512 bits, we
+// keep two words next to each other: the number of 1 bits before the
+// superblock, then seven 9-bit fields, where field k - 1 is the number of 1
+// bits in the superblock's first k words. A rank is then one cache line of
+// directory, one word of the bit array, and a popcount.
+//
+// Selects first go to a sample: for every SELECT_SAMPLE 1 (or 0) bits, we
+// record which superblock that bit is in. Between two samples, we binary search
+// the superblocks, then scan the fields, then finish with select_bit.
+#define SELECT_SAMPLE 4096
+
+// Source: Wojciech Muła, "Faster population counts using AVX2 instructions".
+// Every x86 kernel but SSE2's splits each byte into nibbles, and looks their
+// counts up with a shuffle.
+
+static inline size_t popcount_rest (uint8_t const* const ptr,
+                                    size_t const len) {
+  size_t count = 0;
+  for (size_t i = 0; i < len; i++) {
+    count += __builtin_popcount(ptr[i]);
+  }
+  return count;
+}
+
+// Fill in a superblock's pair of directory words, given the number of 1 bits
+// before it and the counts of its eight words. Returns the number of 1 bits up
+// to the end of it.
+static inline uint64_t store_superblock (uint64_t* const entry,
+                                         uint64_t const before,
+                                         uint64_t const* const counts) {
+  uint64_t fields = 0;
+  uint64_t running = 0;
+  for (size_t k = 1; k < 8; k++) {
+    running += counts[k - 1];
+    fields |= running << (9 * (k - 1));
+  }
+  entry[0] = before;
+  entry[1] = fields;
+  return before + running + counts[7];
+}
+
+// SWAR implementation, used as the fallback everywhere.
+//
+// As count_eq_swar does with its flags, we popcount whole words.
+static inline size_t popcount_swar (uint8_t const* const src,
+                                    size_t const off,
+                                    size_t const len) {
+  uint8_t const* const ptr = (uint8_t const*)&(src[off]);
+  size_t count = 0;
+  size_t i = 0;
+  for (; i + 32 <= len; i += 32) {
+    uint64_t const* const big_ptr = (uint64_t const*)(ptr + i);
+    // Manual 4x loop unroll
+    count += __builtin_popcountll(big_ptr[0]) + __builtin_popcountll(big_ptr[1]) +
+             __builtin_popcountll(big_ptr[2]) + __builtin_popcountll(big_ptr[3]);
+  }
+  for (; i + 8 <= len; i += 8) {
+    count += __builtin_popcountll(*((uint64_t const*)(ptr + i)));
+  }
+  return count + popcount_rest(ptr + i, len - i);
+}
+
+static inline uint64_t rank_directory_swar (uint64_t const* const bits,
+                                            size_t const superblocks,
+                                            uint64_t* const directory) {
+  uint64_t ones = 0;
+  for (size_t s = 0; s < superblocks; s++) {
+    uint64_t counts[8];
+    for (size_t k = 0; k < 8; k++) {
+      counts[k] = __builtin_popcountll(bits[(8 * s) + k]);
+    }
+    ones = store_superblock(directory + (2 * s), ones, counts);
+  }
+  return ones;
+}
+
+#if (DIABLO_HAS_SSE2)
+#include <emmintrin.h>
+
+// Without a shuffle, we count bits within each byte the same way the
+// scalar fallback in "Bit Twiddling Hacks" does within a word. Shifting 16-bit
+// lanes drags bits across bytes, but the masks throw those away.
+static inline __m128i byte_counts_sse (__m128i const input) {
+  __m128i const pairs =
+    _mm_sub_epi8(input, _mm_and_si128(_mm_srli_epi16(input, 1), _mm_set1_epi8(0x55)));
+  __m128i const quads =
+    _mm_add_epi8(_mm_and_si128(pairs, _mm_set1_epi8(0x33)),
+                 _mm_and_si128(_mm_srli_epi16(pairs, 2), _mm_set1_epi8(0x33)));
+  return _mm_and_si128(_mm_add_epi8(quads, _mm_srli_epi16(quads, 4)),
+                       _mm_set1_epi8(0x0F));
+}
+
+static inline size_t popcount_sse (uint8_t const* const src,
+                                   size_t const off,
+                                   size_t const len) {
+  uint8_t const* const ptr = (uint8_t const*)&(src[off]);
+  __m128i const zero = _mm_setzero_si128();
+  __m128i counts = zero;
+  size_t i = 0;
+  for (; i + 64 <= len; i += 64) {
+    __m128i const* big_ptr = (__m128i const*)(ptr + i);
+    // No byte can reach more than 32, so we sum four vectors' worth before
+    // widening.
+    __m128i const summed =
+      _mm_add_epi8(_mm_add_epi8(byte_counts_sse(_mm_loadu_si128(big_ptr)),
+                                byte_counts_sse(_mm_loadu_si128(big_ptr + 1))),
+                   _mm_add_epi8(byte_counts_sse(_mm_loadu_si128(big_ptr + 2)),
+                                byte_counts_sse(_mm_loadu_si128(big_ptr + 3))));
+    counts = _mm_add_epi64(counts, _mm_sad_epu8(summed, zero));
+  }
+  uint64_t results[2];
+  _mm_storeu_si128((__m128i*)results, counts);
+  return results[0] + results[1] + popcount_swar(ptr, i, len - i);
+}
+
+static inline uint64_t rank_directory_sse (uint64_t const* const bits,
+                                           size_t const superblocks,
+                                           uint64_t* const directory) {
+  __m128i const zero = _mm_setzero_si128();
+  uint64_t ones = 0;
+  for (size_t s = 0; s < superblocks; s++) {
+    __m128i const* big_ptr = (__m128i const*)(bits + (8 * s));
+    uint64_t counts[8];
+    for (size_t k = 0; k < 4; k++) {
+      __m128i const input = _mm_loadu_si128(big_ptr + k);
+      _mm_storeu_si128((__m128i*)(counts + (2 * k)),
+                       _mm_sad_epu8(byte_counts_sse(input), zero));
+    }
+    ones = store_superblock(directory + (2 * s), ones, counts);
+  }
+  return ones;
+}
+#endif
+
+#if (DIABLO_HAS_SSSE3)
+#include <tmmintrin.h>
+
+__attribute__((target("ssse3")))
+static inline __m128i byte_counts_ssse3 (__m128i const input) {
+  __m128i const table = _mm_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3,
+                                      1, 2, 2, 3, 2, 3, 3, 4);
+  __m128i const nibble = _mm_set1_epi8(0x0F);
+  return _mm_add_epi8(_mm_shuffle_epi8(table, _mm_and_si128(input, nibble)),
+                      _mm_shuffle_epi8(table,
+                                       _mm_and_si128(_mm_srli_epi16(input, 4), nibble)));
+}
+
+__attribute__((target("ssse3")))
+static inline size_t popcount_ssse3 (uint8_t const* const src,
+                                     size_t const off,
+                                     size_t const len) {
+  uint8_t const* const ptr = (uint8_t const*)&(src[off]);
+  __m128i const zero = _mm_setzero_si128();
+  __m128i counts = zero;
+  size_t i = 0;
+  for (; i + 64 <= len; i += 64) {
+    __m128i const* big_ptr = (__m128i const*)(ptr + i);
+    __m128i const summed =
+      _mm_add_epi8(_mm_add_epi8(byte_counts_ssse3(_mm_loadu_si128(big_ptr)),
+                                byte_counts_ssse3(_mm_loadu_si128(big_ptr + 1))),
+                   _mm_add_epi8(byte_counts_ssse3(_mm_loadu_si128(big_ptr + 2)),
+                                byte_counts_ssse3(_mm_loadu_si128(big_ptr + 3))));
+    counts = _mm_add_epi64(counts, _mm_sad_epu8(summed, zero));
+  }
+  uint64_t results[2];
+  _mm_storeu_si128((__m128i*)results, counts);
+  return results[0] + results[1] + popcount_swar(ptr, i, len - i);
+}
+
+__attribute__((target("ssse3")))
+static inline uint64_t rank_directory_ssse3 (uint64_t const* const bits,
+                                             size_t const superblocks,
+                                             uint64_t* const directory) {
+  __m128i const zero = _mm_setzero_si128();
+  uint64_t ones = 0;
+  for (size_t s = 0; s < superblocks; s++) {
+    __m128i const* big_ptr = (__m128i const*)(bits + (8 * s));
+    uint64_t counts[8];
+    for (size_t k = 0; k < 4; k++) {
+      __m128i const input = _mm_loadu_si128(big_ptr + k);
+      _mm_storeu_si128((__m128i*)(counts + (2 * k)),
+                       _mm_sad_epu8(byte_counts_ssse3(input), zero));
+    }
+    ones = store_superblock(directory + (2 * s), ones, counts);
+  }
+  return ones;
+}
+#endif
+
+#if (DIABLO_HAS_AVX2)
+#include <immintrin.h>
+
+__attribute__((target("avx2")))
+static inline __m256i byte_counts_avx (__m256i const input) {
+  __m256i const table = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3,
+                                         1, 2, 2, 3, 2, 3, 3, 4,
+                                         0, 1, 1, 2, 1, 2, 2, 3,
+                                         1, 2, 2, 3, 2, 3, 3, 4);
+  __m256i const nibble = _mm256_set1_epi8(0x0F);
+  return _mm256_add_epi8(_mm256_shuffle_epi8(table, _mm256_and_si256(input, nibble)),
+                         _mm256_shuffle_epi8(table,
+                                             _mm256_and_si256(_mm256_srli_epi16(input, 4),
+                                                              nibble)));
+}
+
+// The tail goes a word at a time, so we want the popcount instruction there.
+__attribute__((target("avx2,popcnt")))
+static inline size_t popcount_avx (uint8_t const* const src,
+                                   size_t const off,
+                                   size_t const len) {
+  uint8_t const* const ptr = (uint8_t const*)&(src[off]);
+  __m256i const zero = _mm256_setzero_si256();
+  __m256i counts = zero;
+  size_t i = 0;
+  for (; i + 64 <= len; i += 64) {
+    __m256i const* big_ptr = (__m256i const*)(ptr + i);
+    __m256i const summed =
+      _mm256_add_epi8(byte_counts_avx(_mm256_loadu_si256(big_ptr)),
+                      byte_counts_avx(_mm256_loadu_si256(big_ptr + 1)));
+    counts = _mm256_add_epi64(counts, _mm256_sad_epu8(summed, zero));
+  }
+  size_t const count = _mm256_extract_epi64(counts, 0) +
+                       _mm256_extract_epi64(counts, 1) +
+                       _mm256_extract_epi64(counts, 2) +
+                       _mm256_extract_epi64(counts, 3);
+  return count + popcount_swar(ptr, i, len - i);
+}
+
+__attribute__((target("avx2")))
+static inline uint64_t rank_directory_avx (uint64_t const* const bits,
+                                           size_t const superblocks,
+                                           uint64_t* const directory) {
+  __m256i const zero = _mm256_setzero_si256();
+  uint64_t ones = 0;
+  for (size_t s = 0; s < superblocks; s++) {
+    __m256i const* big_ptr = (__m256i const*)(bits + (8 * s));
+    uint64_t counts[8];
+    _mm256_storeu_si256((__m256i*)counts,
+                        _mm256_sad_epu8(byte_counts_avx(_mm256_loadu_si256(big_ptr)), zero));
+    _mm256_storeu_si256((__m256i*)(counts + 4),
+                        _mm256_sad_epu8(byte_counts_avx(_mm256_loadu_si256(big_ptr + 1)), zero));
+    ones = store_superblock(directory + (2 * s), ones, counts);
+  }
+  return ones;
+}
+#endif
+
+#if (DIABLO_HAS_AVX512BW)
+// A whole superblock fits in one vector, and masked loads cover the ragged end
+// of the bulk popcount.
+__attribute__((target("avx512bw")))
+static inline __m512i byte_counts_avx512 (__m512i const input) {
+  __m512i const table = _mm512_broadcast_i32x4(_mm_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3,
+                                                             1, 2, 2, 3, 2, 3, 3, 4));
+  __m512i const nibble = _mm512_set1_epi8(0x0F);
+  return _mm512_add_epi8(_mm512_shuffle_epi8(table, _mm512_and_si512(input, nibble)),
+                         _mm512_shuffle_epi8(table,
+                                             _mm512_and_si512(_mm512_srli_epi16(input, 4),
+                                                              nibble)));
+}
+
+__attribute__((target("avx512bw")))
+static inline size_t popcount_avx512 (uint8_t const* const src,
+                                      size_t const off,
+                                      size_t const len) {
+  uint8_t const* const ptr = (uint8_t const*)&(src[off]);
+  __m512i const zero = _mm512_setzero_si512();
+  __m512i counts = zero;
+  size_t i = 0;
+  for (; i + 256 <= len; i += 256) {
+    __m512i const* big_ptr = (__m512i const*)(ptr + i);
+    // This is a manual 4x unroll.
+    __m512i const summed =
+      _mm512_add_epi8(_mm512_add_epi8(byte_counts_avx512(_mm512_loadu_si512(big_ptr)),
+                                      byte_counts_avx512(_mm512_loadu_si512(big_ptr + 1))),
+                      _mm512_add_epi8(byte_counts_avx512(_mm512_loadu_si512(big_ptr + 2)),
+                                      byte_counts_avx512(_mm512_loadu_si512(big_ptr + 3))));
+    counts = _mm512_add_epi64(counts, _mm512_sad_epu8(summed, zero));
+  }
+  for (; i < len; i += 64) {
+    __mmask64 const mask = low_mask(len - i);
+    __m512i const input = _mm512_maskz_loadu_epi8(mask, ptr + i);
+    counts = _mm512_add_epi64(counts, _mm512_sad_epu8(byte_counts_avx512(input), zero));
+  }
+  return _mm512_reduce_add_epi64(counts);
+}
+
+__attribute__((target("avx512bw")))
+static inline uint64_t rank_directory_avx512 (uint64_t const* const bits,
+                                              size_t const superblocks,
+                                              uint64_t* const directory) {
+  __m512i const zero = _mm512_setzero_si512();
+  uint64_t ones = 0;
+  for (size_t s = 0; s < superblocks; s++) {
+    __m512i const input = _mm512_loadu_si512((void const*)(bits + (8 * s)));
+    uint64_t counts[8];
+    _mm512_storeu_si512((void*)counts, _mm512_sad_epu8(byte_counts_avx512(input), zero));
+    ones = store_superblock(directory + (2 * s), ones, counts);
+  }
+  return ones;
+}
+#endif
+
+#if (DIABLO_HAS_NEON)
+// NEON counts the bits of every byte in one instruction; pairwise widening
+// adds take those to one count per 64-bit lane.
+static inline uint64x2_t word_counts_neon (uint8x16_t const input) {
+  return vpaddlq_u32(vpaddlq_u16(vpaddlq_u8(vcntq_u8(input))));
+}
+
+static inline size_t popcount_neon (uint8_t const* const src,
+                                    size_t const off,
+                                    size_t const len) {
+  uint8_t const* const ptr = (uint8_t const*)&(src[off]);
+  uint64x2_t counts = vdupq_n_u64(0);
+  size_t i = 0;
+  for (; i + 64 <= len; i += 64) {
+    uint8x16_t const summed =
+      vaddq_u8(vaddq_u8(vcntq_u8(vld1q_u8(ptr + i)), vcntq_u8(vld1q_u8(ptr + i + 16))),
+               vaddq_u8(vcntq_u8(vld1q_u8(ptr + i + 32)), vcntq_u8(vld1q_u8(ptr + i + 48))));
+    counts = vpadalq_u32(counts, vpaddlq_u16(vpaddlq_u8(summed)));
+  }
+  return vgetq_lane_u64(counts, 0) + vgetq_lane_u64(counts, 1) +
+         popcount_swar(ptr, i, len - i);
+}
+
+static inline uint64_t rank_directory_neon (uint64_t const* const bits,
+                                            size_t const superblocks,
+                                            uint64_t* const directory) {
+  uint64_t ones = 0;
+  for (size_t s = 0; s < superblocks; s++) {
+    uint8_t const* const ptr = (uint8_t const*)(bits + (8 * s));
+    uint64_t counts[8];
+    for (size_t k = 0; k < 4; k++) {
+      vst1q_u64(counts + (2 * k), word_counts_neon(vld1q_u8(ptr + (16 * k))));
+    }
+    ones = store_superblock(directory + (2 * s), ones, counts);
+  }
+  return ones;
+}
+#endif
+
+typedef size_t (*popcount_kernel) (uint8_t const* const,
+                                   size_t const,
+                                   size_t const);
+
+static popcount_kernel const popcount_kernels[DIABLO_BACKEND_COUNT] = {
+  [DIABLO_BACKEND_SWAR] = popcount_swar,
+#if (DIABLO_HAS_SSE2)
+  [DIABLO_BACKEND_SSE2] = popcount_sse,
+#endif
+#if (DIABLO_HAS_SSSE3)
+  [DIABLO_BACKEND_SSSE3] = popcount_ssse3,
+#endif
+#if (DIABLO_HAS_AVX2)
+  [DIABLO_BACKEND_AVX2] = popcount_avx,
+#endif
+#if (DIABLO_HAS_NEON)
+  [DIABLO_BACKEND_NEON] = popcount_neon,
+#endif
+#if (DIABLO_HAS_AVX512BW)
+  [DIABLO_BACKEND_AVX512BW] = popcount_avx512,
+#endif
+};
+
+typedef uint64_t (*rank_directory_kernel) (uint64_t const* const,
+                                           size_t const,
+                                           uint64_t* const);
+
+static rank_directory_kernel const rank_directory_kernels[DIABLO_BACKEND_COUNT] = {
+  [DIABLO_BACKEND_SWAR] = rank_directory_swar,
+#if (DIABLO_HAS_SSE2)
+  [DIABLO_BACKEND_SSE2] = rank_directory_sse,
+#endif
+#if (DIABLO_HAS_SSSE3)
+  [DIABLO_BACKEND_SSSE3] = rank_directory_ssse3,
+#endif
+#if (DIABLO_HAS_AVX2)
+  [DIABLO_BACKEND_AVX2] = rank_directory_avx,
+#endif
+#if (DIABLO_HAS_NEON)
+  [DIABLO_BACKEND_NEON] = rank_directory_neon,
+#endif
+#if (DIABLO_HAS_AVX512BW)
+  [DIABLO_BACKEND_AVX512BW] = rank_directory_avx512,
+#endif
+};
+
+size_t diablo_popcount (uint8_t const* const src,
+                        size_t const off,
+                        size_t const len) {
+  STATS_RECORD(STATS_POPCOUNT, len);
+  return popcount_kernels[active_backend()](src, off, len);
+}
+
+// Queries
+//
+// These are a handful of loads each, so they don't go through the kernel
+// tables.
+
+// How many superblocks have directory entries: every whole one, plus one more
+// for whatever is left, even if that's nothing.
+static inline size_t superblock_entries (size_t const len) {
+  return (len / 512) + 1;
+}
+
+static inline size_t sample_count (size_t const n) {
+  return (n + SELECT_SAMPLE - 1) / SELECT_SAMPLE;
+}
+
+// The number of 1 bits in the first k words of the superblock whose fields are
+// given, for 0 <= k < 8.
+static inline uint64_t superblock_field (uint64_t const fields, size_t const k) {
+  return (k == 0) ? 0 : ((fields >> (9 * (k - 1))) & 0x1FF);
+}
+
+size_t diablo_rank_select_size (size_t const len) {
+  // There can't be more samples than this between the 1s and the 0s together,
+  // however they're split.
+  return (2 * superblock_entries(len)) + (len / SELECT_SAMPLE) + 2;
+}
+
+void diablo_rank_select_init (diablo_rank_select* const rs,
+                              uint64_t const* const bits,
+                              size_t const len,
+                              uint64_t* const directory) {
+  STATS_RECORD(STATS_RANK_SELECT_INIT, (len + 7) / 8);
+  size_t const whole = len / 512;
+  uint64_t ones = rank_directory_kernels[active_backend()](bits, whole, directory);
+  // What's left is at most seven whole words and a partial one, whose bits
+  // past the end we mustn't count.
+  uint64_t counts[8] = { 0 };
+  for (size_t i = 8 * whole; i < (len + 63) / 64; i++) {
+    uint64_t const word = bits[i];
+    size_t const used = len - (64 * i);
+    counts[i % 8] = __builtin_popcountll(word & low_mask(used));
+  }
+  ones = store_superblock(directory + (2 * whole), ones, counts);
+  rs->bits = bits;
+  rs->len = len;
+  rs->ones = ones;
+  rs->directory = directory;
+  // Sample j of the 1s is the superblock holding 1 bit j * SELECT_SAMPLE, and
+  // likewise for the 0s, whose samples come straight after.
+  uint64_t* const samples1 = directory + (2 * superblock_entries(len));
+  uint64_t* const samples0 = samples1 + sample_count(ones);
+  size_t next1 = 0;
+  size_t next0 = 0;
+  for (size_t s = 0; s <= whole; s++) {
+    uint64_t const end1 = (s < whole) ? directory[2 * (s + 1)] : ones;
+    uint64_t const end0 = ((s < whole) ? (512 * (s + 1)) : len) - end1;
+    for (; next1 * SELECT_SAMPLE < end1; next1++) {
+      samples1[next1] = s;
+    }
+    for (; next0 * SELECT_SAMPLE < end0; next0++) {
+      samples0[next0] = s;
+    }
+  }
+}
+
+static inline size_t rank1_of (diablo_rank_select const* const rs,
+                                size_t const pos) {
+  if (pos >= rs->len) {
+    return rs->ones;
+  }
+  uint64_t const* const entry = rs->directory + (2 * (pos / 512));
+  size_t rank = entry[0] + superblock_field(entry[1], (pos / 64) % 8);
+  if (pos % 64 != 0) {
+    rank += __builtin_popcountll(rs->bits[pos / 64] & low_mask(pos % 64));
+  }
+  return rank;
+}
+
+size_t diablo_rank1 (diablo_rank_select const* const rs, size_t const pos) {
+  STATS_RECORD(STATS_RANK1, 0);
+  return rank1_of(rs, pos);
+}
+
+size_t diablo_rank0 (diablo_rank_select const* const rs, size_t const pos) {
+  STATS_RECORD(STATS_RANK0, 0);
+  size_t const end = (pos >= rs->len) ? rs->len : pos;
+  return end - rank1_of(rs, end);
+}
+
+// Selecting 0s is selecting 1s in the complement, which the counts give us
+// just as easily. Bits past the end of the array count as 0s here, but they
+// all come after the last real one, so we never stop on them.
+static inline size_t select_bit_of (diablo_rank_select const* const rs,
+                                    size_t const n,
+                                    bool const ones) {
+  uint64_t const* const directory = rs->directory;
+  size_t const total = ones ? rs->ones : (rs->len - rs->ones);
+  if (n >= total) {
+    return rs->len;
+  }
+  size_t const entries = superblock_entries(rs->len);
+  uint64_t const* samples = directory + (2 * entries);
+  if (!ones) {
+    samples += sample_count(rs->ones);
+  }
+  // The superblock we want is the last one with at most n bits before it. Once
+  // there are only a few cache lines of entries left, stepping through them in
+  // order beats jumping around.
+  size_t const j = n / SELECT_SAMPLE;
+  size_t lo = samples[j];
+  size_t hi = (j + 1 < sample_count(total)) ? samples[j + 1] : (entries - 1);
+  while (hi - lo > 16) {
+    size_t const mid = lo + ((hi - lo + 1) / 2);
+    uint64_t const before = ones ? directory[2 * mid] : ((512 * mid) - directory[2 * mid]);
+    if (before <= n) {
+      lo = mid;
+    }
+    else {
+      hi = mid - 1;
+    }
+  }
+  for (; lo < hi; lo++) {
+    size_t const next = lo + 1;
+    uint64_t const before = ones ? directory[2 * next] : ((512 * next) - directory[2 * next]);
+    if (before > n) {
+      break;
+    }
+  }
+  uint64_t const fields = directory[(2 * lo) + 1];
+  size_t rest = n - (ones ? directory[2 * lo] : ((512 * lo) - directory[2 * lo]));
+  // Then the word, likewise.
+  size_t k = 1;
+  for (; k < 8; k++) {
+    uint64_t const field = superblock_field(fields, k);
+    if ((ones ? field : ((64 * k) - field)) > rest) {
+      break;
+    }
+  }
+  k--;
+  uint64_t const field = superblock_field(fields, k);
+  rest -= ones ? field : ((64 * k) - field);
+  size_t const w = (8 * lo) + k;
+  uint64_t const word = ones ? rs->bits[w] : ~(rs->bits[w]);
+  return (64 * w) + select_bit(word, rest);
+}
+
+size_t diablo_select1 (diablo_rank_select const* const rs, size_t const n) {
+  STATS_RECORD(STATS_SELECT1, 0);
+  return select_bit_of(rs, n, true);
+}
+
+size_t diablo_select0 (diablo_rank_select const* const rs, size_t const n) {
+  STATS_RECORD(STATS_SELECT0, 0);
+  return select_bit_of(rs, n, false);
+}
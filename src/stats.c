@@ -0,0 +1,250 @@
+/*
+ * Copyright 2021 Koz Ross <koz.ross@retro-freedom.nz>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "pool.h"
+#include "stats.h"
+
+#if (DIABLO_STATS)
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#if (DIABLO_HAS_THREADS)
+#include <threads.h>
+#endif
+
+// Every thread counts into a block of its own, so that only that thread ever
+// writes to it. Other threads do read it, to add up the totals, so the
+// counters are atomics; but a relaxed load, add and relaxed store is all an
+// increment needs, which compiles to the same code as for a plain integer.
+//
+// Blocks are never freed. When a thread exits, it gives up its block, and the
+// next thread to need one takes it over, counts and all; without C11 threads,
+// we can't tell when a thread exits, so every thread keeps its own. Resetting
+// doesn't touch the blocks either: it remembers the totals so far, to be taken
+// off everything read afterwards.
+
+_Static_assert(DIABLO_BACKEND_COUNT == DIABLO_BACKEND_SSSE3 + 1,
+               "diablo_stats has room for every backend");
+
+// Lengths go by bit width: bucket 0 is for 0, and bucket k is for lengths
+// from 2^(k - 1) up to, but not including, 2^k.
+#define LENGTH_BUCKETS 65
+
+typedef struct {
+  atomic_uint_least64_t bytes;
+  atomic_uint_least64_t backends[DIABLO_BACKEND_COUNT];
+  atomic_uint_least64_t lengths[LENGTH_BUCKETS];
+} stats_counters;
+
+typedef struct stats_block {
+  stats_counters counters[STATS_FUNCTIONS];
+  struct stats_block* next;
+  atomic_bool in_use;
+} stats_block;
+
+static char const* const stats_names[STATS_FUNCTIONS] = {
+  [STATS_COUNT_EQ] = "diablo_count_eq",
+  [STATS_COUNT_EQ_PARALLEL] = "diablo_count_eq_parallel",
+  [STATS_COUNT_EQ_MULTI] = "diablo_count_eq_multi",
+  [STATS_COUNT_EQ_BATCH] = "diablo_count_eq_batch",
+  [STATS_COUNT_IN_SET] = "diablo_count_in_set",
+  [STATS_BYTE_HISTOGRAM] = "diablo_byte_histogram",
+  [STATS_POPCOUNT] = "diablo_popcount",
+  [STATS_FIND_FIRST_EQ] = "diablo_find_first_eq",
+  [STATS_FIND_LAST_EQ] = "diablo_find_last_eq",
+  [STATS_FIND_ALL_EQ] = "diablo_find_all_eq",
+  [STATS_MISMATCH] = "diablo_mismatch",
+  [STATS_COMPARE] = "diablo_compare",
+  [STATS_HASH64] = "diablo_hash64",
+  [STATS_HASH64_UPDATE] = "diablo_hash64_update",
+  [STATS_STRUCTURAL_BITMAP] = "diablo_structural_bitmap",
+  [STATS_STRUCTURAL_BITMAP_QUOTED] = "diablo_structural_bitmap_quoted",
+  [STATS_RANK_SELECT_INIT] = "diablo_rank_select_init",
+  [STATS_RANK1] = "diablo_rank1",
+  [STATS_RANK0] = "diablo_rank0",
+  [STATS_SELECT1] = "diablo_select1",
+  [STATS_SELECT0] = "diablo_select0",
+  [STATS_TRANSLATE] = "diablo_translate",
+  [STATS_TRANSLATE_RANGE] = "diablo_translate_range",
+  [STATS_REPLACE_EQ] = "diablo_replace_eq",
+  [STATS_IS_ASCII] = "diablo_is_ascii",
+  [STATS_FIND_FIRST_NON_ASCII] = "diablo_find_first_non_ascii",
+  [STATS_ENCODE_BASE16] = "diablo_encode_base16",
+  [STATS_DECODE_BASE16] = "diablo_decode_base16",
+  [STATS_ENCODE_BASE64] = "diablo_encode_base64",
+  [STATS_DECODE_BASE64] = "diablo_decode_base64",
+  [STATS_VALIDATE_UTF8] = "diablo_validate_utf8",
+  [STATS_COUNT_UTF8_CODEPOINTS] = "diablo_count_utf8_codepoints",
+  [STATS_UTF8_OFFSET_OF_NTH] = "diablo_utf8_offset_of_nth",
+  [STATS_UTF16LE_TO_UTF8] = "diablo_utf16le_to_utf8",
+  [STATS_UTF8_TO_UTF16LE] = "diablo_utf8_to_utf16le",
+  [STATS_UTF8_LENGTH_FROM_UTF16LE] = "diablo_utf8_length_from_utf16le",
+  [STATS_UTF16LE_LENGTH_FROM_UTF8] = "diablo_utf16le_length_from_utf8"
+};
+
+static _Atomic(stats_block*) stats_blocks = NULL;
+static _Thread_local stats_block* own_block = NULL;
+static stats_counters baseline[STATS_FUNCTIONS];
+
+#if (DIABLO_HAS_THREADS)
+static once_flag exit_once = ONCE_FLAG_INIT;
+static bool exit_ready = false;
+static tss_t exit_key;
+
+static void give_up_block (void* const block) {
+  atomic_store_explicit(&((stats_block*)block)->in_use, false,
+                        memory_order_release);
+}
+
+static void exit_init (void) {
+  exit_ready = (tss_create(&exit_key, give_up_block) == thrd_success);
+}
+#endif
+
+// Take over a block some exited thread gave up, or make a new one.
+static stats_block* acquire_block (void) {
+  stats_block* block = atomic_load_explicit(&stats_blocks, memory_order_acquire);
+  for (; block != NULL; block = block->next) {
+    bool expected = false;
+    if (atomic_compare_exchange_strong_explicit(&block->in_use, &expected, true,
+                                                memory_order_acquire,
+                                                memory_order_relaxed)) {
+      return block;
+    }
+  }
+  // Zero bits are zero counts.
+  block = calloc(1, sizeof(stats_block));
+  if (block == NULL) {
+    return NULL;
+  }
+  atomic_init(&block->in_use, true);
+  block->next = atomic_load_explicit(&stats_blocks, memory_order_relaxed);
+  while (!atomic_compare_exchange_weak_explicit(&stats_blocks, &block->next, block,
+                                                memory_order_release,
+                                                memory_order_relaxed)) {
+  }
+  return block;
+}
+
+static inline void bump (atomic_uint_least64_t* const counter,
+                         uint64_t const by) {
+  uint64_t const old = atomic_load_explicit(counter, memory_order_relaxed);
+  atomic_store_explicit(counter, old + by, memory_order_relaxed);
+}
+
+// The first count on each thread takes this path, to get it a block.
+__attribute__((noinline))
+static stats_block* first_block (void) {
+  stats_block* const block = acquire_block();
+  // If we're out of memory, this thread's calls just don't get counted.
+  if (block == NULL) {
+    return NULL;
+  }
+  own_block = block;
+#if (DIABLO_HAS_THREADS)
+  call_once(&exit_once, exit_init);
+  if (exit_ready) {
+    tss_set(exit_key, block);
+  }
+#endif
+  return block;
+}
+
+void diablo_stats_record (stats_function const function,
+                          size_t const bytes) {
+  stats_block* block = own_block;
+  if (__builtin_expect(block == NULL, 0)) {
+    block = first_block();
+    if (block == NULL) {
+      return;
+    }
+  }
+  stats_counters* const counters = &(block->counters[function]);
+  size_t const bucket = (bytes == 0) ? 0 : (64 - __builtin_clzll(bytes));
+  bump(&counters->bytes, bytes);
+  bump(&counters->backends[active_backend()], 1);
+  bump(&counters->lengths[bucket], 1);
+}
+
+// Add the counters to out, which has no call count of its own yet.
+static void add_counters (diablo_stats* const out,
+                          stats_counters const* const counters) {
+  out->bytes += atomic_load_explicit(&counters->bytes, memory_order_relaxed);
+  for (size_t i = 0; i < DIABLO_BACKEND_COUNT; i++) {
+    out->backends[i] += atomic_load_explicit(&counters->backends[i],
+                                             memory_order_relaxed);
+  }
+  for (size_t i = 0; i < LENGTH_BUCKETS; i++) {
+    out->lengths[i] += atomic_load_explicit(&counters->lengths[i],
+                                            memory_order_relaxed);
+  }
+}
+
+// Everything every thread has counted for the function, since the start.
+static void stats_since_start (stats_function const function,
+                               diablo_stats* const out) {
+  *out = (diablo_stats){ 0 };
+  stats_block const* block = atomic_load_explicit(&stats_blocks,
+                                                  memory_order_acquire);
+  for (; block != NULL; block = block->next) {
+    add_counters(out, &(block->counters[function]));
+  }
+}
+
+size_t diablo_stats_functions (void) {
+  return STATS_FUNCTIONS;
+}
+
+char const* diablo_stats_name (size_t const function) {
+  return (function < STATS_FUNCTIONS) ? stats_names[function] : NULL;
+}
+
+bool diablo_get_stats (size_t const function, diablo_stats* const out) {
+  if (function >= STATS_FUNCTIONS) {
+    return false;
+  }
+  stats_since_start((stats_function)function, out);
+  diablo_stats reset = { 0 };
+  add_counters(&reset, &baseline[function]);
+  out->bytes -= reset.bytes;
+  out->calls = 0;
+  for (size_t i = 0; i < DIABLO_BACKEND_COUNT; i++) {
+    out->backends[i] -= reset.backends[i];
+    out->calls += out->backends[i];
+  }
+  for (size_t i = 0; i < LENGTH_BUCKETS; i++) {
+    out->lengths[i] -= reset.lengths[i];
+  }
+  return true;
+}
+
+void diablo_reset_stats (void) {
+  for (size_t function = 0; function < STATS_FUNCTIONS; function++) {
+    diablo_stats totals;
+    stats_since_start((stats_function)function, &totals);
+    stats_counters* const counters = &baseline[function];
+    atomic_store_explicit(&counters->bytes, totals.bytes, memory_order_relaxed);
+    for (size_t i = 0; i < DIABLO_BACKEND_COUNT; i++) {
+      atomic_store_explicit(&counters->backends[i], totals.backends[i],
+                            memory_order_relaxed);
+    }
+    for (size_t i = 0; i < LENGTH_BUCKETS; i++) {
+      atomic_store_explicit(&counters->lengths[i], totals.lengths[i],
+                            memory_order_relaxed);
+    }
+  }
+}
+#endif
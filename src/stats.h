@@ -0,0 +1,78 @@
+/*
+ * Copyright 2021 Koz Ross <koz.ross@retro-freedom.nz>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+#include <stddef.h>
+#include "dispatch.h"
+
+// Internal statistics machinery. Every operation on a range starts by calling
+// STATS_RECORD with its entry below and the number of bytes it was given. In
+// builds with DIABLO_STATS set to 1 (the 'stats' meson option), this counts
+// the call for the calling thread; otherwise, it's nothing at all, and its
+// arguments are never evaluated.
+
+// Every operation we count, in the order diablo_stats_name gives them.
+typedef enum {
+  STATS_COUNT_EQ,
+  STATS_COUNT_EQ_PARALLEL,
+  STATS_COUNT_EQ_MULTI,
+  STATS_COUNT_EQ_BATCH,
+  STATS_COUNT_IN_SET,
+  STATS_BYTE_HISTOGRAM,
+  STATS_POPCOUNT,
+  STATS_FIND_FIRST_EQ,
+  STATS_FIND_LAST_EQ,
+  STATS_FIND_ALL_EQ,
+  STATS_MISMATCH,
+  STATS_COMPARE,
+  STATS_HASH64,
+  STATS_HASH64_UPDATE,
+  STATS_STRUCTURAL_BITMAP,
+  STATS_STRUCTURAL_BITMAP_QUOTED,
+  STATS_RANK_SELECT_INIT,
+  STATS_RANK1,
+  STATS_RANK0,
+  STATS_SELECT1,
+  STATS_SELECT0,
+  STATS_TRANSLATE,
+  STATS_TRANSLATE_RANGE,
+  STATS_REPLACE_EQ,
+  STATS_IS_ASCII,
+  STATS_FIND_FIRST_NON_ASCII,
+  STATS_ENCODE_BASE16,
+  STATS_DECODE_BASE16,
+  STATS_ENCODE_BASE64,
+  STATS_DECODE_BASE64,
+  STATS_VALIDATE_UTF8,
+  STATS_COUNT_UTF8_CODEPOINTS,
+  STATS_UTF8_OFFSET_OF_NTH,
+  STATS_UTF16LE_TO_UTF8,
+  STATS_UTF8_TO_UTF16LE,
+  STATS_UTF8_LENGTH_FROM_UTF16LE,
+  STATS_UTF16LE_LENGTH_FROM_UTF8,
+  // One more than the last; not an operation.
+  STATS_FUNCTIONS
+} stats_function;
+
+#if (DIABLO_STATS)
+// Count a call to the given operation on the calling thread, along with the
+// active backend.
+DIABLO_INTERNAL void diablo_stats_record(stats_function const function,
+                                         size_t const bytes);
+
+#define STATS_RECORD(function, bytes) diablo_stats_record((function), (bytes))
+#else
+#define STATS_RECORD(function, bytes) ((void)0)
+#endif
@@ -0,0 +1,347 @@
+/*
+ * Copyright 2021 Koz Ross <koz.ross@retro-freedom.nz>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <stddef.h>
+#include "common.h"
+#include "dispatch.h"
+#include "stats.h"
+#include "truffle.h"
+
+// Every kernel works a 64-byte block at a time, building a mask of the bytes in
+// the set (and, if quoted, another of the quotes) with one bit per byte, in
+// order. Each block's mask is one word of output. The final, partial block is
+// built a byte at a time, except on AVX-512BW, where masked loads handle it.
+//
+// Quoted regions are found by prefix XOR over the quote mask: every bit from an
+// opening quote up to its closing quote ends up set. We carry whether we're
+// still inside quotes from one block to the next, and out of the kernel.
+
+// Turn a block's masks into output, updating whether we're in quotes.
+static inline uint64_t mask_quoted (uint64_t const matches,
+                                    uint64_t const quotes,
+                                    bool* const in_quotes) {
+  uint64_t const inside = prefix_xor(quotes) ^ (*in_quotes ? ~0ULL : 0ULL);
+  *in_quotes = (inside >> 63) != 0;
+  // Quotes themselves are never masked out.
+  return matches & ~(inside & ~quotes);
+}
+
+// The masks for len bytes, with len at most 64.
+static inline uint64_t structural_bitmap_rest (uint8_t const* const ptr,
+                                               size_t const len,
+                                               uint8_t const* const set,
+                                               bool const quoted,
+                                               uint8_t const quote,
+                                               bool* const in_quotes) {
+  uint64_t matches = 0;
+  uint64_t quotes = 0;
+  for (size_t i = 0; i < len; i++) {
+    matches |= ((uint64_t)in_set(set, ptr[i])) << i;
+    quotes |= ((uint64_t)(ptr[i] == quote)) << i;
+  }
+  return quoted ? mask_quoted(matches, quotes, in_quotes) : matches;
+}
+
+// SWAR implementation, used as the fallback everywhere.
+//
+// As with count_in_set_swar, there's no word-level trick for arbitrary sets, so
+// this goes a byte at a time. Quotes use eq_flags, which puts each byte's flag
+// in its top bit; gathering those into consecutive bits is a multiply.
+static inline uint64_t gather_flags (uint64_t const flags) {
+#if (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+  uint64_t const bits = __builtin_bswap64(flags) >> 7;
+#else
+  uint64_t const bits = flags >> 7;
+#endif
+  return (bits * 0x0102040810204080ULL) >> 56;
+}
+
+static inline bool structural_bitmap_swar (uint8_t const* const src,
+                                           size_t const off,
+                                           size_t const len,
+                                           uint8_t const* const set,
+                                           bool const quoted,
+                                           uint8_t const quote,
+                                           bool in_quotes,
+                                           uint64_t* const out) {
+  size_t const big_strides = len / 64;
+  uint8_t const* ptr = (uint8_t const*)&(src[off]);
+  uint64_t const quote_matches = broadcast(quote);
+  for (size_t i = 0; i < big_strides; i++) {
+    uint64_t matches = 0;
+    for (size_t j = 0; j < 64; j++) {
+      matches |= ((uint64_t)in_set(set, ptr[j])) << j;
+    }
+    if (quoted) {
+      uint64_t const* const big_ptr = (uint64_t const*)ptr;
+      uint64_t quotes = 0;
+      for (size_t k = 0; k < 8; k++) {
+        quotes |= gather_flags(eq_flags(big_ptr[k], quote_matches)) << (8 * k);
+      }
+      matches = mask_quoted(matches, quotes, &in_quotes);
+    }
+    out[i] = matches;
+    ptr += 64;
+  }
+  if (len % 64 != 0) {
+    out[big_strides] = structural_bitmap_rest(ptr, len % 64, set, quoted, quote,
+                                              &in_quotes);
+  }
+  return in_quotes;
+}
+
+#if (DIABLO_HAS_SSSE3)
+#include <tmmintrin.h>
+
+// One bit per byte, in order.
+static inline uint64_t movemask_ssse3 (__m128i const cmp) {
+  return (uint64_t)(uint32_t)_mm_movemask_epi8(cmp);
+}
+
+__attribute__((target("ssse3")))
+static inline bool structural_bitmap_ssse3 (uint8_t const* const src,
+                                            size_t const off,
+                                            size_t const len,
+                                            uint8_t const* const set,
+                                            bool const quoted,
+                                            uint8_t const quote,
+                                            bool in_quotes,
+                                            uint64_t* const out) {
+  size_t const big_strides = len / 64;
+  uint8_t const* ptr = (uint8_t const*)&(src[off]);
+  uint8_t tables[2][16];
+  truffle_tables(set, tables[0], tables[1]);
+  __m128i const lows = _mm_loadu_si128((__m128i const*)tables[0]);
+  __m128i const highs = _mm_loadu_si128((__m128i const*)tables[1]);
+  __m128i const quote_matches = _mm_set1_epi8(quote);
+  for (size_t i = 0; i < big_strides; i++) {
+    __m128i const* big_ptr = (__m128i const*)ptr;
+    // This is a manual 4x unroll.
+    __m128i const inputs[4] = {
+      _mm_loadu_si128(big_ptr),
+      _mm_loadu_si128(big_ptr + 1),
+      _mm_loadu_si128(big_ptr + 2),
+      _mm_loadu_si128(big_ptr + 3)
+    };
+    uint64_t matches = movemask_ssse3(classify_ssse3(inputs[0], lows, highs)) |
+                       (movemask_ssse3(classify_ssse3(inputs[1], lows, highs)) << 16) |
+                       (movemask_ssse3(classify_ssse3(inputs[2], lows, highs)) << 32) |
+                       (movemask_ssse3(classify_ssse3(inputs[3], lows, highs)) << 48);
+    if (quoted) {
+      uint64_t const quotes =
+        movemask_ssse3(_mm_cmpeq_epi8(quote_matches, inputs[0])) |
+        (movemask_ssse3(_mm_cmpeq_epi8(quote_matches, inputs[1])) << 16) |
+        (movemask_ssse3(_mm_cmpeq_epi8(quote_matches, inputs[2])) << 32) |
+        (movemask_ssse3(_mm_cmpeq_epi8(quote_matches, inputs[3])) << 48);
+      matches = mask_quoted(matches, quotes, &in_quotes);
+    }
+    out[i] = matches;
+    ptr += 64;
+  }
+  if (len % 64 != 0) {
+    out[big_strides] = structural_bitmap_rest(ptr, len % 64, set, quoted, quote,
+                                              &in_quotes);
+  }
+  return in_quotes;
+}
+#endif
+
+#if (DIABLO_HAS_AVX2)
+#include <immintrin.h>
+
+__attribute__((target("avx2")))
+static inline uint64_t movemask_avx2 (__m256i const cmp) {
+  return (uint64_t)(uint32_t)_mm256_movemask_epi8(cmp);
+}
+
+__attribute__((target("avx2")))
+static inline bool structural_bitmap_avx (uint8_t const* const src,
+                                          size_t const off,
+                                          size_t const len,
+                                          uint8_t const* const set,
+                                          bool const quoted,
+                                          uint8_t const quote,
+                                          bool in_quotes,
+                                          uint64_t* const out) {
+  size_t const big_strides = len / 64;
+  uint8_t const* ptr = (uint8_t const*)&(src[off]);
+  uint8_t tables[2][16];
+  truffle_tables(set, tables[0], tables[1]);
+  // Shuffles work within 128-bit lanes, so both lanes get the same tables.
+  __m256i const lows =
+    _mm256_broadcastsi128_si256(_mm_loadu_si128((__m128i const*)tables[0]));
+  __m256i const highs =
+    _mm256_broadcastsi128_si256(_mm_loadu_si128((__m128i const*)tables[1]));
+  __m256i const quote_matches = _mm256_set1_epi8(quote);
+  for (size_t i = 0; i < big_strides; i++) {
+    __m256i const* big_ptr = (__m256i const*)ptr;
+    // This is a manual 2x unroll.
+    __m256i const inputs[2] = {
+      _mm256_loadu_si256(big_ptr),
+      _mm256_loadu_si256(big_ptr + 1)
+    };
+    uint64_t matches = movemask_avx2(classify_avx2(inputs[0], lows, highs)) |
+                       (movemask_avx2(classify_avx2(inputs[1], lows, highs)) << 32);
+    if (quoted) {
+      uint64_t const quotes =
+        movemask_avx2(_mm256_cmpeq_epi8(quote_matches, inputs[0])) |
+        (movemask_avx2(_mm256_cmpeq_epi8(quote_matches, inputs[1])) << 32);
+      matches = mask_quoted(matches, quotes, &in_quotes);
+    }
+    out[i] = matches;
+    ptr += 64;
+  }
+  if (len % 64 != 0) {
+    out[big_strides] = structural_bitmap_rest(ptr, len % 64, set, quoted, quote,
+                                              &in_quotes);
+  }
+  return in_quotes;
+}
+#endif
+
+#if (DIABLO_HAS_AVX512BW)
+// Comparisons give us the masks directly, and masked loads cover the tail.
+__attribute__((target("avx512bw")))
+static inline bool structural_bitmap_avx512 (uint8_t const* const src,
+                                             size_t const off,
+                                             size_t const len,
+                                             uint8_t const* const set,
+                                             bool const quoted,
+                                             uint8_t const quote,
+                                             bool in_quotes,
+                                             uint64_t* const out) {
+  uint8_t const* const ptr = (uint8_t const*)&(src[off]);
+  uint8_t tables[2][16];
+  truffle_tables(set, tables[0], tables[1]);
+  __m512i const lows =
+    _mm512_broadcast_i32x4(_mm_loadu_si128((__m128i const*)tables[0]));
+  __m512i const highs =
+    _mm512_broadcast_i32x4(_mm_loadu_si128((__m128i const*)tables[1]));
+  __m512i const quote_matches = _mm512_set1_epi8(quote);
+  for (size_t i = 0; i < len; i += 64) {
+    __mmask64 const mask = low_mask(len - i);
+    __m512i const input = (len - i >= 64) ?
+                          _mm512_loadu_si512((void const*)(ptr + i)) :
+                          _mm512_maskz_loadu_epi8(mask, ptr + i);
+    uint64_t matches = mask & classify_avx512(input, lows, highs);
+    if (quoted) {
+      uint64_t const quotes = _mm512_mask_cmpeq_epi8_mask(mask, quote_matches,
+                                                          input);
+      matches = mask_quoted(matches, quotes, &in_quotes);
+    }
+    out[i / 64] = matches;
+  }
+  return in_quotes;
+}
+#endif
+
+#if (DIABLO_HAS_NEON)
+static inline bool structural_bitmap_neon (uint8_t const* const src,
+                                           size_t const off,
+                                           size_t const len,
+                                           uint8_t const* const set,
+                                           bool const quoted,
+                                           uint8_t const quote,
+                                           bool in_quotes,
+                                           uint64_t* const out) {
+  size_t const big_strides = len / 64;
+  uint8_t const* ptr = (uint8_t const*)&(src[off]);
+  uint8_t tables[2][16];
+  truffle_tables(set, tables[0], tables[1]);
+  uint8x16_t const lows = vld1q_u8(tables[0]);
+  uint8x16_t const highs = vld1q_u8(tables[1]);
+  uint8x16_t const quote_matches = vdupq_n_u8(quote);
+  for (size_t i = 0; i < big_strides; i++) {
+    // This is a manual 4x unroll.
+    uint8x16_t const inputs[4] = {
+      vld1q_u8(ptr),
+      vld1q_u8(ptr + 16),
+      vld1q_u8(ptr + 32),
+      vld1q_u8(ptr + 48)
+    };
+    uint64_t matches = movemask_neon(classify_neon(inputs[0], lows, highs)) |
+                       (movemask_neon(classify_neon(inputs[1], lows, highs)) << 16) |
+                       (movemask_neon(classify_neon(inputs[2], lows, highs)) << 32) |
+                       (movemask_neon(classify_neon(inputs[3], lows, highs)) << 48);
+    if (quoted) {
+      uint64_t const quotes =
+        movemask_neon(vceqq_u8(quote_matches, inputs[0])) |
+        (movemask_neon(vceqq_u8(quote_matches, inputs[1])) << 16) |
+        (movemask_neon(vceqq_u8(quote_matches, inputs[2])) << 32) |
+        (movemask_neon(vceqq_u8(quote_matches, inputs[3])) << 48);
+      matches = mask_quoted(matches, quotes, &in_quotes);
+    }
+    out[i] = matches;
+    ptr += 64;
+  }
+  if (len % 64 != 0) {
+    out[big_strides] = structural_bitmap_rest(ptr, len % 64, set, quoted, quote,
+                                              &in_quotes);
+  }
+  return in_quotes;
+}
+#endif
+
+typedef bool (*structural_bitmap_kernel) (uint8_t const* const,
+                                          size_t const,
+                                          size_t const,
+                                          uint8_t const* const,
+                                          bool const,
+                                          uint8_t const,
+                                          bool,
+                                          uint64_t* const);
+
+// Classification needs byte shuffles, so SSE2 uses the SWAR kernel, as it does
+// for count_in_set.
+static structural_bitmap_kernel const structural_bitmap_kernels[DIABLO_BACKEND_COUNT] = {
+  [DIABLO_BACKEND_SWAR] = structural_bitmap_swar,
+#if (DIABLO_HAS_SSE2)
+  [DIABLO_BACKEND_SSE2] = structural_bitmap_swar,
+#endif
+#if (DIABLO_HAS_SSSE3)
+  [DIABLO_BACKEND_SSSE3] = structural_bitmap_ssse3,
+#endif
+#if (DIABLO_HAS_AVX2)
+  [DIABLO_BACKEND_AVX2] = structural_bitmap_avx,
+#endif
+#if (DIABLO_HAS_NEON)
+  [DIABLO_BACKEND_NEON] = structural_bitmap_neon,
+#endif
+#if (DIABLO_HAS_AVX512BW)
+  [DIABLO_BACKEND_AVX512BW] = structural_bitmap_avx512,
+#endif
+};
+
+void diablo_structural_bitmap (uint8_t const* const src,
+                               size_t const off,
+                               size_t const len,
+                               uint8_t const* const set,
+                               uint64_t* const out) {
+  STATS_RECORD(STATS_STRUCTURAL_BITMAP, len);
+  structural_bitmap_kernels[active_backend()](src, off, len, set, false, 0,
+                                              false, out);
+}
+
+bool diablo_structural_bitmap_quoted (uint8_t const* const src,
+                                      size_t const off,
+                                      size_t const len,
+                                      uint8_t const* const set,
+                                      uint8_t const quote,
+                                      bool const in_quotes,
+                                      uint64_t* const out) {
+  STATS_RECORD(STATS_STRUCTURAL_BITMAP_QUOTED, len);
+  return structural_bitmap_kernels[active_backend()](src, off, len, set, true,
+                                                     quote, in_quotes, out);
+}
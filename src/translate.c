@@ -0,0 +1,738 @@
+/*
+ * Copyright 2021 Koz Ross <koz.ross@retro-freedom.nz>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <stddef.h>
+#include "common.h"
+#include "dispatch.h"
+#include "stats.h"
+
+// Every kernel here may be asked to work in place, with dst the same as src.
+// Thus, the ragged end can't be done by translating an overlapping last
+// vector after the rest, as that would translate some bytes twice. Instead, we
+// translate the last vector first, while its input is still untouched, but
+// only store it once everything else is done. The bytes it shares with the
+// vector before it get the same value written twice.
+
+// Scalar
+//
+// There is no way to look up eight different table entries in a word, so this
+// is also what the general translation does below AVX2.
+
+static inline void translate_rest (uint8_t const* const src,
+                                   size_t const src_off,
+                                   uint8_t* const dst,
+                                   size_t const dst_off,
+                                   size_t const len,
+                                   uint8_t const* const table) {
+  uint8_t const* const in = (uint8_t const*)&(src[src_off]);
+  uint8_t* const out = &(dst[dst_off]);
+  for (size_t i = 0; i < len; i++) {
+    out[i] = table[in[i]];
+  }
+}
+
+static inline void translate_range_rest (uint8_t const* const in,
+                                         uint8_t* const out,
+                                         size_t const len,
+                                         uint8_t const lo,
+                                         uint8_t const width,
+                                         uint8_t const delta) {
+  for (size_t i = 0; i < len; i++) {
+    uint8_t const byte = in[i];
+    out[i] = ((uint8_t)(byte - lo) <= width) ? (uint8_t)(byte + delta) : byte;
+  }
+}
+
+static inline void replace_eq_rest (uint8_t const* const in,
+                                    uint8_t* const out,
+                                    size_t const len,
+                                    uint8_t const from,
+                                    uint8_t const to) {
+  for (size_t i = 0; i < len; i++) {
+    out[i] = (in[i] == from) ? to : in[i];
+  }
+}
+
+// SWAR implementation, used as the fallback everywhere.
+//
+// Byte-wise addition and subtraction are the usual trick of doing the low
+// seven bits of each byte with an ordinary add, then fixing up the high bits
+// with XOR, so nothing carries into the next byte. Source: "Hacker's Delight",
+// section 2-18.
+
+#define HIGH_BITS 0x8080808080808080ULL
+
+static inline uint64_t add_bytes (uint64_t const x, uint64_t const y) {
+  return ((x & ~HIGH_BITS) + (y & ~HIGH_BITS)) ^ ((x ^ y) & HIGH_BITS);
+}
+
+static inline uint64_t sub_bytes (uint64_t const x, uint64_t const y) {
+  return ((x | HIGH_BITS) - (y & ~HIGH_BITS)) ^ ((x ^ ~y) & HIGH_BITS);
+}
+
+// Every byte of x which is at most the corresponding byte of y becomes 0xFF;
+// every other byte becomes 0x00. We check whether y - x borrows out of each
+// byte.
+static inline uint64_t le_bytes (uint64_t const x, uint64_t const y) {
+  uint64_t const diff = sub_bytes(y, x);
+  uint64_t const borrows = ((~y & x) | (~(y ^ x) & diff)) & HIGH_BITS;
+  return ((~borrows & HIGH_BITS) >> 7) * 0xFF;
+}
+
+// Bytes in [lo, lo + width] are the ones for which byte - lo, wrapping, is at
+// most width.
+static inline uint64_t translate_range_word (uint64_t const word,
+                                             uint64_t const los,
+                                             uint64_t const widths,
+                                             uint64_t const deltas) {
+  uint64_t const in_range = le_bytes(sub_bytes(word, los), widths);
+  return add_bytes(word, deltas & in_range);
+}
+
+static inline uint64_t replace_eq_word (uint64_t const word,
+                                       uint64_t const froms,
+                                       uint64_t const flips) {
+  uint64_t const matched = (eq_flags(word, froms) >> 7) * 0xFF;
+  return word ^ (flips & matched);
+}
+
+static inline void translate_range_swar (uint8_t const* const src,
+                                         size_t const src_off,
+                                         uint8_t* const dst,
+                                         size_t const dst_off,
+                                         size_t const len,
+                                         uint8_t const lo,
+                                         uint8_t const width,
+                                         uint8_t const delta) {
+  uint8_t const* const in = (uint8_t const*)&(src[src_off]);
+  uint8_t* const out = &(dst[dst_off]);
+  if (len < 8) {
+    translate_range_rest(in, out, len, lo, width, delta);
+    return;
+  }
+  uint64_t const los = broadcast(lo);
+  uint64_t const widths = broadcast(width);
+  uint64_t const deltas = broadcast(delta);
+  uint64_t const last = translate_range_word(*((uint64_t const*)(in + len - 8)),
+                                             los, widths, deltas);
+  for (size_t i = 0; i + 8 <= len; i += 8) {
+    *((uint64_t*)(out + i)) = translate_range_word(*((uint64_t const*)(in + i)),
+                                                   los, widths, deltas);
+  }
+  *((uint64_t*)(out + len - 8)) = last;
+}
+
+// A matching byte XORed with (from ^ to) becomes to.
+static inline void replace_eq_swar (uint8_t const* const src,
+                                    size_t const src_off,
+                                    uint8_t* const dst,
+                                    size_t const dst_off,
+                                    size_t const len,
+                                    uint8_t const from,
+                                    uint8_t const to) {
+  uint8_t const* const in = (uint8_t const*)&(src[src_off]);
+  uint8_t* const out = &(dst[dst_off]);
+  if (len < 8) {
+    replace_eq_rest(in, out, len, from, to);
+    return;
+  }
+  uint64_t const froms = broadcast(from);
+  uint64_t const flips = broadcast(from ^ to);
+  uint64_t const last = replace_eq_word(*((uint64_t const*)(in + len - 8)),
+                                        froms, flips);
+  for (size_t i = 0; i + 8 <= len; i += 8) {
+    *((uint64_t*)(out + i)) = replace_eq_word(*((uint64_t const*)(in + i)),
+                                              froms, flips);
+  }
+  *((uint64_t*)(out + len - 8)) = last;
+}
+
+#if (DIABLO_HAS_SSE2)
+#include <emmintrin.h>
+
+// There is no unsigned byte comparison, but x <= y exactly when min(x, y) is
+// x.
+static inline __m128i translate_range_sse_vec (__m128i const input,
+                                               __m128i const los,
+                                               __m128i const widths,
+                                               __m128i const deltas) {
+  __m128i const shifted = _mm_sub_epi8(input, los);
+  __m128i const in_range = _mm_cmpeq_epi8(_mm_min_epu8(shifted, widths), shifted);
+  return _mm_add_epi8(input, _mm_and_si128(deltas, in_range));
+}
+
+static inline __m128i replace_eq_sse_vec (__m128i const input,
+                                          __m128i const froms,
+                                          __m128i const flips) {
+  __m128i const matched = _mm_cmpeq_epi8(input, froms);
+  return _mm_xor_si128(input, _mm_and_si128(flips, matched));
+}
+
+static inline void translate_range_sse (uint8_t const* const src,
+                                        size_t const src_off,
+                                        uint8_t* const dst,
+                                        size_t const dst_off,
+                                        size_t const len,
+                                        uint8_t const lo,
+                                        uint8_t const width,
+                                        uint8_t const delta) {
+  if (len < 16) {
+    translate_range_swar(src, src_off, dst, dst_off, len, lo, width, delta);
+    return;
+  }
+  uint8_t const* const in = (uint8_t const*)&(src[src_off]);
+  uint8_t* const out = &(dst[dst_off]);
+  __m128i const los = _mm_set1_epi8(lo);
+  __m128i const widths = _mm_set1_epi8(width);
+  __m128i const deltas = _mm_set1_epi8(delta);
+  __m128i const last =
+    translate_range_sse_vec(_mm_loadu_si128((__m128i const*)(in + len - 16)),
+                            los, widths, deltas);
+  for (size_t i = 0; i + 16 <= len; i += 16) {
+    __m128i const input = _mm_loadu_si128((__m128i const*)(in + i));
+    _mm_storeu_si128((__m128i*)(out + i),
+                     translate_range_sse_vec(input, los, widths, deltas));
+  }
+  _mm_storeu_si128((__m128i*)(out + len - 16), last);
+}
+
+static inline void replace_eq_sse (uint8_t const* const src,
+                                   size_t const src_off,
+                                   uint8_t* const dst,
+                                   size_t const dst_off,
+                                   size_t const len,
+                                   uint8_t const from,
+                                   uint8_t const to) {
+  if (len < 16) {
+    replace_eq_swar(src, src_off, dst, dst_off, len, from, to);
+    return;
+  }
+  uint8_t const* const in = (uint8_t const*)&(src[src_off]);
+  uint8_t* const out = &(dst[dst_off]);
+  __m128i const froms = _mm_set1_epi8(from);
+  __m128i const flips = _mm_set1_epi8(from ^ to);
+  __m128i const last =
+    replace_eq_sse_vec(_mm_loadu_si128((__m128i const*)(in + len - 16)),
+                       froms, flips);
+  for (size_t i = 0; i + 16 <= len; i += 16) {
+    __m128i const input = _mm_loadu_si128((__m128i const*)(in + i));
+    _mm_storeu_si128((__m128i*)(out + i),
+                     replace_eq_sse_vec(input, froms, flips));
+  }
+  _mm_storeu_si128((__m128i*)(out + len - 16), last);
+}
+#endif
+
+#if (DIABLO_HAS_AVX2)
+#include <immintrin.h>
+
+// For the general translation, we split the table into sixteen 16-byte rows,
+// one per high nibble, and look up in all of them with vpshufb, which gives 0
+// for indices with the high bit set. This is the method of Wojciech Mula,
+// described in "SIMD-ized lookup in a 256-entry table".
+// Source: http://0x80.pl/notesen/2018-10-18-simd-byte-lookup.html
+//
+// Take inputs below 0x80 first. Subtracting 16 * i from one puts it in 0 to
+// 0x7F, where pshufb uses its low nibble, exactly when i is at most its high
+// nibble; for larger i, it goes negative, and pshufb gives 0. Thus, if row i
+// is stored XORed with row i - 1, XORing the lookups for every i gives the
+// entry we want, as everything below it cancels out. Inputs from 0x80 up work
+// the same way with the top half of the table once we flip their high bit, so
+// we do both halves, then pick per byte.
+//
+// That is sixteen shuffles per vector, and most x86 cores can only do one per
+// cycle, so with 16-byte vectors this is no faster than a byte at a time. Thus,
+// we only do it from AVX2 up.
+typedef struct {
+  uint8_t low[8][16];
+  uint8_t high[8][16];
+} translate_rows;
+
+static inline void make_translate_rows (uint8_t const* const table,
+                                        translate_rows* const rows) {
+  for (size_t j = 0; j < 16; j++) {
+    rows->low[0][j] = table[j];
+    rows->high[0][j] = table[128 + j];
+  }
+  for (size_t i = 1; i < 8; i++) {
+    for (size_t j = 0; j < 16; j++) {
+      rows->low[i][j] = table[(16 * i) + j] ^ table[(16 * (i - 1)) + j];
+      rows->high[i][j] = table[128 + (16 * i) + j] ^ table[128 + (16 * (i - 1)) + j];
+    }
+  }
+}
+
+// vpshufb only looks within each 128-bit half, so every row goes in both.
+__attribute__((target("avx2")))
+static inline __m256i translate_avx_vec (__m256i const input,
+                                         __m256i const* const low,
+                                         __m256i const* const high) {
+  __m256i const step = _mm256_set1_epi8(16);
+  __m256i low_indices = input;
+  __m256i high_indices = _mm256_xor_si256(input, _mm256_set1_epi8((char)0x80));
+  __m256i low_result = _mm256_setzero_si256();
+  __m256i high_result = _mm256_setzero_si256();
+  for (int i = 0; i < 8; i++) {
+    low_result = _mm256_xor_si256(low_result, _mm256_shuffle_epi8(low[i], low_indices));
+    high_result = _mm256_xor_si256(high_result, _mm256_shuffle_epi8(high[i], high_indices));
+    low_indices = _mm256_sub_epi8(low_indices, step);
+    high_indices = _mm256_sub_epi8(high_indices, step);
+  }
+  return _mm256_blendv_epi8(low_result, high_result, input);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i translate_range_avx_vec (__m256i const input,
+                                               __m256i const los,
+                                               __m256i const widths,
+                                               __m256i const deltas) {
+  __m256i const shifted = _mm256_sub_epi8(input, los);
+  __m256i const in_range = _mm256_cmpeq_epi8(_mm256_min_epu8(shifted, widths), shifted);
+  return _mm256_add_epi8(input, _mm256_and_si256(deltas, in_range));
+}
+
+__attribute__((target("avx2")))
+static inline __m256i replace_eq_avx_vec (__m256i const input,
+                                          __m256i const froms,
+                                          __m256i const flips) {
+  __m256i const matched = _mm256_cmpeq_epi8(input, froms);
+  return _mm256_xor_si256(input, _mm256_and_si256(flips, matched));
+}
+
+__attribute__((target("avx2")))
+static inline void translate_avx (uint8_t const* const src,
+                                  size_t const src_off,
+                                  uint8_t* const dst,
+                                  size_t const dst_off,
+                                  size_t const len,
+                                  uint8_t const* const table) {
+  if (len < 32) {
+    translate_rest(src, src_off, dst, dst_off, len, table);
+    return;
+  }
+  uint8_t const* const in = (uint8_t const*)&(src[src_off]);
+  uint8_t* const out = &(dst[dst_off]);
+  translate_rows rows;
+  make_translate_rows(table, &rows);
+  __m256i low[8];
+  __m256i high[8];
+  for (size_t i = 0; i < 8; i++) {
+    low[i] = _mm256_broadcastsi128_si256(_mm_loadu_si128((__m128i const*)rows.low[i]));
+    high[i] = _mm256_broadcastsi128_si256(_mm_loadu_si128((__m128i const*)rows.high[i]));
+  }
+  __m256i const last =
+    translate_avx_vec(_mm256_loadu_si256((__m256i const*)(in + len - 32)), low, high);
+  for (size_t i = 0; i + 32 <= len; i += 32) {
+    __m256i const input = _mm256_loadu_si256((__m256i const*)(in + i));
+    _mm256_storeu_si256((__m256i*)(out + i), translate_avx_vec(input, low, high));
+  }
+  _mm256_storeu_si256((__m256i*)(out + len - 32), last);
+}
+
+__attribute__((target("avx2")))
+static inline void translate_range_avx (uint8_t const* const src,
+                                        size_t const src_off,
+                                        uint8_t* const dst,
+                                        size_t const dst_off,
+                                        size_t const len,
+                                        uint8_t const lo,
+                                        uint8_t const width,
+                                        uint8_t const delta) {
+  if (len < 32) {
+    translate_range_sse(src, src_off, dst, dst_off, len, lo, width, delta);
+    return;
+  }
+  uint8_t const* const in = (uint8_t const*)&(src[src_off]);
+  uint8_t* const out = &(dst[dst_off]);
+  __m256i const los = _mm256_set1_epi8(lo);
+  __m256i const widths = _mm256_set1_epi8(width);
+  __m256i const deltas = _mm256_set1_epi8(delta);
+  __m256i const last =
+    translate_range_avx_vec(_mm256_loadu_si256((__m256i const*)(in + len - 32)),
+                            los, widths, deltas);
+  for (size_t i = 0; i + 32 <= len; i += 32) {
+    __m256i const input = _mm256_loadu_si256((__m256i const*)(in + i));
+    _mm256_storeu_si256((__m256i*)(out + i),
+                        translate_range_avx_vec(input, los, widths, deltas));
+  }
+  _mm256_storeu_si256((__m256i*)(out + len - 32), last);
+}
+
+__attribute__((target("avx2")))
+static inline void replace_eq_avx (uint8_t const* const src,
+                                   size_t const src_off,
+                                   uint8_t* const dst,
+                                   size_t const dst_off,
+                                   size_t const len,
+                                   uint8_t const from,
+                                   uint8_t const to) {
+  if (len < 32) {
+    replace_eq_sse(src, src_off, dst, dst_off, len, from, to);
+    return;
+  }
+  uint8_t const* const in = (uint8_t const*)&(src[src_off]);
+  uint8_t* const out = &(dst[dst_off]);
+  __m256i const froms = _mm256_set1_epi8(from);
+  __m256i const flips = _mm256_set1_epi8(from ^ to);
+  __m256i const last =
+    replace_eq_avx_vec(_mm256_loadu_si256((__m256i const*)(in + len - 32)),
+                       froms, flips);
+  for (size_t i = 0; i + 32 <= len; i += 32) {
+    __m256i const input = _mm256_loadu_si256((__m256i const*)(in + i));
+    _mm256_storeu_si256((__m256i*)(out + i),
+                        replace_eq_avx_vec(input, froms, flips));
+  }
+  _mm256_storeu_si256((__m256i*)(out + len - 32), last);
+}
+#endif
+
+#if (DIABLO_HAS_AVX512BW)
+// Masked loads and stores cover the ragged end, so nothing is written twice
+// here. Without VBMI there is no full-width byte permute, so the general
+// translation works like translate_avx_vec, with every row in all four 128-bit
+// lanes.
+__attribute__((target("avx512bw")))
+static inline __m512i translate_avx512_vec (__m512i const input,
+                                            __m512i const* const low,
+                                            __m512i const* const high) {
+  __m512i const step = _mm512_set1_epi8(16);
+  __m512i low_indices = input;
+  __m512i high_indices = _mm512_xor_si512(input, _mm512_set1_epi8((char)0x80));
+  __m512i low_result = _mm512_setzero_si512();
+  __m512i high_result = _mm512_setzero_si512();
+  for (int i = 0; i < 8; i++) {
+    low_result = _mm512_xor_si512(low_result, _mm512_shuffle_epi8(low[i], low_indices));
+    high_result = _mm512_xor_si512(high_result, _mm512_shuffle_epi8(high[i], high_indices));
+    low_indices = _mm512_sub_epi8(low_indices, step);
+    high_indices = _mm512_sub_epi8(high_indices, step);
+  }
+  return _mm512_mask_blend_epi8(_mm512_movepi8_mask(input), low_result, high_result);
+}
+
+__attribute__((target("avx512bw")))
+static inline void translate_avx512 (uint8_t const* const src,
+                                     size_t const src_off,
+                                     uint8_t* const dst,
+                                     size_t const dst_off,
+                                     size_t const len,
+                                     uint8_t const* const table) {
+  uint8_t const* const in = (uint8_t const*)&(src[src_off]);
+  uint8_t* const out = &(dst[dst_off]);
+  translate_rows rows;
+  make_translate_rows(table, &rows);
+  __m512i low[8];
+  __m512i high[8];
+  for (size_t i = 0; i < 8; i++) {
+    low[i] = _mm512_broadcast_i32x4(_mm_loadu_si128((__m128i const*)rows.low[i]));
+    high[i] = _mm512_broadcast_i32x4(_mm_loadu_si128((__m128i const*)rows.high[i]));
+  }
+  size_t i = 0;
+  for (; i + 64 <= len; i += 64) {
+    __m512i const input = _mm512_loadu_si512((void const*)(in + i));
+    _mm512_storeu_si512((void*)(out + i), translate_avx512_vec(input, low, high));
+  }
+  if (i < len) {
+    __mmask64 const mask = low_mask(len - i);
+    __m512i const input = _mm512_maskz_loadu_epi8(mask, in + i);
+    _mm512_mask_storeu_epi8(out + i, mask, translate_avx512_vec(input, low, high));
+  }
+}
+
+__attribute__((target("avx512bw")))
+static inline __m512i translate_range_avx512_vec (__m512i const input,
+                                                  __m512i const los,
+                                                  __m512i const widths,
+                                                  __m512i const deltas) {
+  __mmask64 const in_range = _mm512_cmple_epu8_mask(_mm512_sub_epi8(input, los), widths);
+  return _mm512_mask_add_epi8(input, in_range, input, deltas);
+}
+
+__attribute__((target("avx512bw")))
+static inline void translate_range_avx512 (uint8_t const* const src,
+                                           size_t const src_off,
+                                           uint8_t* const dst,
+                                           size_t const dst_off,
+                                           size_t const len,
+                                           uint8_t const lo,
+                                           uint8_t const width,
+                                           uint8_t const delta) {
+  uint8_t const* const in = (uint8_t const*)&(src[src_off]);
+  uint8_t* const out = &(dst[dst_off]);
+  __m512i const los = _mm512_set1_epi8(lo);
+  __m512i const widths = _mm512_set1_epi8(width);
+  __m512i const deltas = _mm512_set1_epi8(delta);
+  size_t i = 0;
+  for (; i + 64 <= len; i += 64) {
+    __m512i const input = _mm512_loadu_si512((void const*)(in + i));
+    _mm512_storeu_si512((void*)(out + i),
+                        translate_range_avx512_vec(input, los, widths, deltas));
+  }
+  if (i < len) {
+    __mmask64 const mask = low_mask(len - i);
+    __m512i const input = _mm512_maskz_loadu_epi8(mask, in + i);
+    _mm512_mask_storeu_epi8(out + i, mask,
+                            translate_range_avx512_vec(input, los, widths, deltas));
+  }
+}
+
+__attribute__((target("avx512bw")))
+static inline void replace_eq_avx512 (uint8_t const* const src,
+                                      size_t const src_off,
+                                      uint8_t* const dst,
+                                      size_t const dst_off,
+                                      size_t const len,
+                                      uint8_t const from,
+                                      uint8_t const to) {
+  uint8_t const* const in = (uint8_t const*)&(src[src_off]);
+  uint8_t* const out = &(dst[dst_off]);
+  __m512i const froms = _mm512_set1_epi8(from);
+  __m512i const tos = _mm512_set1_epi8(to);
+  size_t i = 0;
+  for (; i + 64 <= len; i += 64) {
+    __m512i const input = _mm512_loadu_si512((void const*)(in + i));
+    __mmask64 const matched = _mm512_cmpeq_epi8_mask(input, froms);
+    _mm512_storeu_si512((void*)(out + i), _mm512_mask_mov_epi8(input, matched, tos));
+  }
+  if (i < len) {
+    __mmask64 const mask = low_mask(len - i);
+    __m512i const input = _mm512_maskz_loadu_epi8(mask, in + i);
+    __mmask64 const matched = _mm512_cmpeq_epi8_mask(input, froms);
+    _mm512_mask_storeu_epi8(out + i, mask, _mm512_mask_mov_epi8(input, matched, tos));
+  }
+}
+#endif
+
+#if (DIABLO_HAS_NEON)
+// On AArch64, tbl and tbx look up 64 bytes at a time, giving 0 or leaving the
+// lane alone respectively for indices past the end, so we can cover the table
+// in four quarters. 32-bit ARM has to go row by row, relying on lookup16 to
+// give 0 for everything outside the row.
+static inline uint8x16_t translate_neon_vec (uint8x16_t const input,
+                                             uint8_t const* const table) {
+#if (__aarch64__)
+  uint8x16_t result = vqtbl4q_u8(vld1q_u8_x4(table), input);
+  result = vqtbx4q_u8(result, vld1q_u8_x4(table + 64), vsubq_u8(input, vdupq_n_u8(64)));
+  result = vqtbx4q_u8(result, vld1q_u8_x4(table + 128), vsubq_u8(input, vdupq_n_u8(128)));
+  return vqtbx4q_u8(result, vld1q_u8_x4(table + 192), vsubq_u8(input, vdupq_n_u8(192)));
+#else
+  uint8x16_t result = vdupq_n_u8(0);
+  for (int i = 0; i < 16; i++) {
+    uint8x16_t const indices = vsubq_u8(input, vdupq_n_u8((uint8_t)(i << 4)));
+    result = vorrq_u8(result, lookup16(vld1q_u8(table + (16 * i)), indices));
+  }
+  return result;
+#endif
+}
+
+static inline uint8x16_t translate_range_neon_vec (uint8x16_t const input,
+                                                   uint8x16_t const los,
+                                                   uint8x16_t const widths,
+                                                   uint8x16_t const deltas) {
+  uint8x16_t const in_range = vcleq_u8(vsubq_u8(input, los), widths);
+  return vaddq_u8(input, vandq_u8(deltas, in_range));
+}
+
+static inline uint8x16_t replace_eq_neon_vec (uint8x16_t const input,
+                                              uint8x16_t const froms,
+                                              uint8x16_t const tos) {
+  return vbslq_u8(vceqq_u8(input, froms), tos, input);
+}
+
+static inline void translate_neon (uint8_t const* const src,
+                                   size_t const src_off,
+                                   uint8_t* const dst,
+                                   size_t const dst_off,
+                                   size_t const len,
+                                   uint8_t const* const table) {
+  if (len < 16) {
+    translate_rest(src, src_off, dst, dst_off, len, table);
+    return;
+  }
+  uint8_t const* const in = (uint8_t const*)&(src[src_off]);
+  uint8_t* const out = &(dst[dst_off]);
+  uint8x16_t const last = translate_neon_vec(vld1q_u8(in + len - 16), table);
+  for (size_t i = 0; i + 16 <= len; i += 16) {
+    vst1q_u8(out + i, translate_neon_vec(vld1q_u8(in + i), table));
+  }
+  vst1q_u8(out + len - 16, last);
+}
+
+static inline void translate_range_neon (uint8_t const* const src,
+                                         size_t const src_off,
+                                         uint8_t* const dst,
+                                         size_t const dst_off,
+                                         size_t const len,
+                                         uint8_t const lo,
+                                         uint8_t const width,
+                                         uint8_t const delta) {
+  if (len < 16) {
+    translate_range_swar(src, src_off, dst, dst_off, len, lo, width, delta);
+    return;
+  }
+  uint8_t const* const in = (uint8_t const*)&(src[src_off]);
+  uint8_t* const out = &(dst[dst_off]);
+  uint8x16_t const los = vdupq_n_u8(lo);
+  uint8x16_t const widths = vdupq_n_u8(width);
+  uint8x16_t const deltas = vdupq_n_u8(delta);
+  uint8x16_t const last =
+    translate_range_neon_vec(vld1q_u8(in + len - 16), los, widths, deltas);
+  for (size_t i = 0; i + 16 <= len; i += 16) {
+    vst1q_u8(out + i,
+             translate_range_neon_vec(vld1q_u8(in + i), los, widths, deltas));
+  }
+  vst1q_u8(out + len - 16, last);
+}
+
+static inline void replace_eq_neon (uint8_t const* const src,
+                                    size_t const src_off,
+                                    uint8_t* const dst,
+                                    size_t const dst_off,
+                                    size_t const len,
+                                    uint8_t const from,
+                                    uint8_t const to) {
+  if (len < 16) {
+    replace_eq_swar(src, src_off, dst, dst_off, len, from, to);
+    return;
+  }
+  uint8_t const* const in = (uint8_t const*)&(src[src_off]);
+  uint8_t* const out = &(dst[dst_off]);
+  uint8x16_t const froms = vdupq_n_u8(from);
+  uint8x16_t const tos = vdupq_n_u8(to);
+  uint8x16_t const last = replace_eq_neon_vec(vld1q_u8(in + len - 16), froms, tos);
+  for (size_t i = 0; i + 16 <= len; i += 16) {
+    vst1q_u8(out + i, replace_eq_neon_vec(vld1q_u8(in + i), froms, tos));
+  }
+  vst1q_u8(out + len - 16, last);
+}
+#endif
+
+typedef void (*translate_kernel) (uint8_t const* const,
+                                  size_t const,
+                                  uint8_t* const,
+                                  size_t const,
+                                  size_t const,
+                                  uint8_t const* const);
+
+static translate_kernel const translate_kernels[DIABLO_BACKEND_COUNT] = {
+  [DIABLO_BACKEND_SWAR] = translate_rest,
+#if (DIABLO_HAS_SSE2)
+  [DIABLO_BACKEND_SSE2] = translate_rest,
+#endif
+#if (DIABLO_HAS_SSSE3)
+  [DIABLO_BACKEND_SSSE3] = translate_rest,
+#endif
+#if (DIABLO_HAS_AVX2)
+  [DIABLO_BACKEND_AVX2] = translate_avx,
+#endif
+#if (DIABLO_HAS_NEON)
+  [DIABLO_BACKEND_NEON] = translate_neon,
+#endif
+#if (DIABLO_HAS_AVX512BW)
+  [DIABLO_BACKEND_AVX512BW] = translate_avx512,
+#endif
+};
+
+typedef void (*translate_range_kernel) (uint8_t const* const,
+                                        size_t const,
+                                        uint8_t* const,
+                                        size_t const,
+                                        size_t const,
+                                        uint8_t const,
+                                        uint8_t const,
+                                        uint8_t const);
+
+static translate_range_kernel const translate_range_kernels[DIABLO_BACKEND_COUNT] = {
+  [DIABLO_BACKEND_SWAR] = translate_range_swar,
+#if (DIABLO_HAS_SSE2)
+  [DIABLO_BACKEND_SSE2] = translate_range_sse,
+#endif
+#if (DIABLO_HAS_SSSE3)
+  [DIABLO_BACKEND_SSSE3] = translate_range_sse,
+#endif
+#if (DIABLO_HAS_AVX2)
+  [DIABLO_BACKEND_AVX2] = translate_range_avx,
+#endif
+#if (DIABLO_HAS_NEON)
+  [DIABLO_BACKEND_NEON] = translate_range_neon,
+#endif
+#if (DIABLO_HAS_AVX512BW)
+  [DIABLO_BACKEND_AVX512BW] = translate_range_avx512,
+#endif
+};
+
+typedef void (*replace_eq_kernel) (uint8_t const* const,
+                                   size_t const,
+                                   uint8_t* const,
+                                   size_t const,
+                                   size_t const,
+                                   uint8_t const,
+                                   uint8_t const);
+
+static replace_eq_kernel const replace_eq_kernels[DIABLO_BACKEND_COUNT] = {
+  [DIABLO_BACKEND_SWAR] = replace_eq_swar,
+#if (DIABLO_HAS_SSE2)
+  [DIABLO_BACKEND_SSE2] = replace_eq_sse,
+#endif
+#if (DIABLO_HAS_SSSE3)
+  [DIABLO_BACKEND_SSSE3] = replace_eq_sse,
+#endif
+#if (DIABLO_HAS_AVX2)
+  [DIABLO_BACKEND_AVX2] = replace_eq_avx,
+#endif
+#if (DIABLO_HAS_NEON)
+  [DIABLO_BACKEND_NEON] = replace_eq_neon,
+#endif
+#if (DIABLO_HAS_AVX512BW)
+  [DIABLO_BACKEND_AVX512BW] = replace_eq_avx512,
+#endif
+};
+
+void diablo_translate (uint8_t const* const src,
+                       size_t const src_off,
+                       uint8_t* const dst,
+                       size_t const dst_off,
+                       size_t const len,
+                       uint8_t const* const table) {
+  STATS_RECORD(STATS_TRANSLATE, len);
+  translate_kernels[active_backend()](src, src_off, dst, dst_off, len, table);
+}
+
+void diablo_translate_range (uint8_t const* const src,
+                             size_t const src_off,
+                             uint8_t* const dst,
+                             size_t const dst_off,
+                             size_t const len,
+                             uint8_t const lo,
+                             uint8_t const hi,
+                             uint8_t const delta) {
+  STATS_RECORD(STATS_TRANSLATE_RANGE, len);
+  // An empty range changes nothing, which is the same as adding 0 to
+  // everything.
+  uint8_t const width = (lo <= hi) ? (uint8_t)(hi - lo) : 0xFF;
+  uint8_t const shift = (lo <= hi) ? delta : 0;
+  translate_range_kernels[active_backend()](src, src_off, dst, dst_off, len,
+                                            lo, width, shift);
+}
+
+void diablo_replace_eq (uint8_t const* const src,
+                        size_t const src_off,
+                        uint8_t* const dst,
+                        size_t const dst_off,
+                        size_t const len,
+                        uint8_t const from,
+                        uint8_t const to) {
+  STATS_RECORD(STATS_REPLACE_EQ, len);
+  replace_eq_kernels[active_backend()](src, src_off, dst, dst_off, len, from, to);
+}
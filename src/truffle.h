@@ -0,0 +1,150 @@
+/*
+ * Copyright 2021 Koz Ross <koz.ross@retro-freedom.nz>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+#include <stdint.h>
+#include "common.h"
+#include "dispatch.h"
+
+// Classifying bytes against a set, given as a 32-byte bitmap: a byte b is a
+// member exactly when bit (b % 8) of set[b / 8] is 1.
+
+// Whether the byte is in the set.
+static inline uint8_t in_set (uint8_t const* const set, uint8_t const byte) {
+  return (set[byte >> 3] >> (byte & 7)) & 1;
+}
+
+// SIMD classification uses nibble shuffles, as in Hyperscan's
+// 'truffle'. For a byte with high nibble h and low nibble l, bit (h % 8) of
+// lows[l] (if h < 8) or highs[l] (if h >= 8) says whether it's in the set. A
+// 16-entry shuffle on l finds the right row; another, on h, finds the bit.
+//
+// Both tables are 8x8 bit-matrix transposes of halves of the set, which we
+// compute with the method from "Hacker's Delight", section 7-3.
+
+// Transpose the 8x8 bit matrix whose row i is byte i (least significant first).
+static inline uint64_t transpose8 (uint64_t x) {
+  uint64_t t;
+  t = (x ^ (x >> 7)) & 0x00AA00AA00AA00AAULL;
+  x = x ^ t ^ (t << 7);
+  t = (x ^ (x >> 14)) & 0x0000CCCC0000CCCCULL;
+  x = x ^ t ^ (t << 14);
+  t = (x ^ (x >> 28)) & 0x00000000F0F0F0F0ULL;
+  x = x ^ t ^ (t << 28);
+  return x;
+}
+
+static inline void truffle_tables (uint8_t const* const set,
+                                   uint8_t lows[16],
+                                   uint8_t highs[16]) {
+  // Low nibbles 0-7 live in the even bytes of the set, 8-15 in the odd ones.
+  for (size_t half = 0; half < 2; half++) {
+    uint64_t low_rows = 0;
+    uint64_t high_rows = 0;
+    for (size_t h = 0; h < 8; h++) {
+      low_rows |= ((uint64_t)set[(2 * h) + half]) << (8 * h);
+      high_rows |= ((uint64_t)set[16 + (2 * h) + half]) << (8 * h);
+    }
+    low_rows = transpose8(low_rows);
+    high_rows = transpose8(high_rows);
+    for (size_t l = 0; l < 8; l++) {
+      lows[(8 * half) + l] = (uint8_t)(low_rows >> (8 * l));
+      highs[(8 * half) + l] = (uint8_t)(high_rows >> (8 * l));
+    }
+  }
+}
+
+#if (DIABLO_HAS_SSSE3)
+#include <tmmintrin.h>
+
+// 0xFF in the lanes whose bytes are in the set, 0x00 otherwise.
+__attribute__((target("ssse3")))
+static inline __m128i classify_ssse3 (__m128i const input,
+                                      __m128i const lows,
+                                      __m128i const highs) {
+  __m128i const bits = _mm_setr_epi8(1, 2, 4, 8, 16, 32, 64, -128,
+                                     1, 2, 4, 8, 16, 32, 64, -128);
+  // Shuffles give 0x00 wherever the index has its top bit set, so each table
+  // only answers for its own half of the bytes.
+  __m128i const rows = _mm_or_si128(_mm_shuffle_epi8(lows, input),
+                                    _mm_shuffle_epi8(highs,
+                                                     _mm_xor_si128(input,
+                                                                   _mm_set1_epi8(-128))));
+  __m128i const high_nibbles = _mm_and_si128(_mm_srli_epi16(input, 4),
+                                             _mm_set1_epi8(0x0F));
+  __m128i const wanted = _mm_shuffle_epi8(bits, high_nibbles);
+  return _mm_cmpeq_epi8(_mm_and_si128(rows, wanted), wanted);
+}
+#endif
+
+#if (DIABLO_HAS_AVX2)
+#include <immintrin.h>
+
+__attribute__((target("avx2")))
+static inline __m256i classify_avx2 (__m256i const input,
+                                     __m256i const lows,
+                                     __m256i const highs) {
+  __m256i const bits = _mm256_setr_epi8(1, 2, 4, 8, 16, 32, 64, -128,
+                                        1, 2, 4, 8, 16, 32, 64, -128,
+                                        1, 2, 4, 8, 16, 32, 64, -128,
+                                        1, 2, 4, 8, 16, 32, 64, -128);
+  __m256i const rows = _mm256_or_si256(_mm256_shuffle_epi8(lows, input),
+                                       _mm256_shuffle_epi8(highs,
+                                                           _mm256_xor_si256(input,
+                                                                            _mm256_set1_epi8(-128))));
+  __m256i const high_nibbles = _mm256_and_si256(_mm256_srli_epi16(input, 4),
+                                                _mm256_set1_epi8(0x0F));
+  __m256i const wanted = _mm256_shuffle_epi8(bits, high_nibbles);
+  return _mm256_cmpeq_epi8(_mm256_and_si256(rows, wanted), wanted);
+}
+#endif
+
+#if (DIABLO_HAS_AVX512BW)
+// Lanes whose bytes are in the set, as a mask.
+__attribute__((target("avx512bw")))
+static inline __mmask64 classify_avx512 (__m512i const input,
+                                         __m512i const lows,
+                                         __m512i const highs) {
+  __m512i const bits = _mm512_broadcast_i32x4(_mm_setr_epi8(1, 2, 4, 8, 16, 32, 64, -128,
+                                                            1, 2, 4, 8, 16, 32, 64, -128));
+  __m512i const rows = _mm512_or_si512(_mm512_shuffle_epi8(lows, input),
+                                       _mm512_shuffle_epi8(highs,
+                                                           _mm512_xor_si512(input,
+                                                                            _mm512_set1_epi8(-128))));
+  __m512i const high_nibbles = _mm512_and_si512(_mm512_srli_epi16(input, 4),
+                                                _mm512_set1_epi8(0x0F));
+  return _mm512_test_epi8_mask(rows, _mm512_shuffle_epi8(bits, high_nibbles));
+}
+#endif
+
+#if (DIABLO_HAS_NEON)
+// 0xFF in the lanes whose bytes are in the set, 0x00 otherwise.
+static inline uint8x16_t classify_neon (uint8x16_t const input,
+                                        uint8x16_t const lows,
+                                        uint8x16_t const highs) {
+  static uint8_t const bit_table[16] = {1, 2, 4, 8, 16, 32, 64, 128,
+                                        1, 2, 4, 8, 16, 32, 64, 128};
+  // Unlike SSSE3, NEON lookups don't ignore high bits, so we mask down to the
+  // low nibble, and pick the table with the top bit of each byte.
+  uint8x16_t const low_nibbles = vandq_u8(input, vdupq_n_u8(0x0F));
+  uint8x16_t const is_high =
+    vreinterpretq_u8_s8(vshrq_n_s8(vreinterpretq_s8_u8(input), 7));
+  uint8x16_t const rows = vbslq_u8(is_high,
+                                   lookup16(highs, low_nibbles),
+                                   lookup16(lows, low_nibbles));
+  uint8x16_t const wanted = lookup16(vld1q_u8(bit_table), vshrq_n_u8(input, 4));
+  return vtstq_u8(rows, wanted);
+}
+#endif
@@ -0,0 +1,835 @@
+/*
+ * Copyright 2021 Koz Ross <koz.ross@retro-freedom.nz>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <stddef.h>
+#include "common.h"
+#include "dispatch.h"
+#include "stats.h"
+
+// Transcoding kernels return len if the whole input was valid. Otherwise, they
+// return the position of the start of the first invalid sequence: an unpaired
+// surrogate for UTF-16, or a sequence which is malformed, overlong, a
+// surrogate, past U+10FFFF or cut off by the end of the input for UTF-8.
+// Everything before that has been transcoded, and *written says how much
+// output it made.
+//
+// The SIMD kernels take a block at a time. If the block is all ASCII, or all
+// two-byte sequences (which covers most text in Latin-based, Greek, Cyrillic,
+// Armenian, Hebrew and Arabic scripts), we transcode it with a handful of
+// vector operations. Otherwise, we transcode from the start of the block to
+// (at least) its end a code point at a time, then try again from wherever that
+// left us. Nothing is written past the end of the output.
+//
+// UTF-16 code units are little-endian in memory. The SIMD kernels load and
+// store them as bytes and reinterpret, which gives little-endian lanes
+// whatever the machine's byte order; the scalar code swaps if it has to.
+
+static inline uint16_t swap_le16 (uint16_t const unit) {
+#if (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+  return __builtin_bswap16(unit);
+#else
+  return unit;
+#endif
+}
+
+// Transcode from in[*i] until *i reaches stop, or the end of the input,
+// writing to out[*o]. A surrogate pair may take *i one past stop. Returns
+// false, with *i at the offending unit, on an unpaired surrogate.
+static inline bool utf16le_to_utf8_run (uint16_t const* const in,
+                                        size_t const len,
+                                        size_t const stop,
+                                        uint8_t* const out,
+                                        size_t* const i,
+                                        size_t* const o) {
+  size_t pos = *i;
+  size_t written = *o;
+  bool ok = true;
+  while (pos < stop) {
+    uint32_t const unit = swap_le16(in[pos]);
+    if (unit < 0x80) {
+      out[written] = (uint8_t)unit;
+      written++;
+      pos++;
+    } else if (unit < 0x800) {
+      out[written] = (uint8_t)(0xC0 | (unit >> 6));
+      out[written + 1] = (uint8_t)(0x80 | (unit & 0x3F));
+      written += 2;
+      pos++;
+    } else if (unit < 0xD800 || unit >= 0xE000) {
+      out[written] = (uint8_t)(0xE0 | (unit >> 12));
+      out[written + 1] = (uint8_t)(0x80 | ((unit >> 6) & 0x3F));
+      out[written + 2] = (uint8_t)(0x80 | (unit & 0x3F));
+      written += 3;
+      pos++;
+    } else {
+      // A high surrogate, followed by a low one.
+      uint32_t const next = (pos + 1 < len) ? swap_le16(in[pos + 1]) : 0;
+      if (unit >= 0xDC00 || next < 0xDC00 || next >= 0xE000) {
+        ok = false;
+        break;
+      }
+      uint32_t const cp = 0x10000 + ((unit - 0xD800) << 10) + (next - 0xDC00);
+      out[written] = (uint8_t)(0xF0 | (cp >> 18));
+      out[written + 1] = (uint8_t)(0x80 | ((cp >> 12) & 0x3F));
+      out[written + 2] = (uint8_t)(0x80 | ((cp >> 6) & 0x3F));
+      out[written + 3] = (uint8_t)(0x80 | (cp & 0x3F));
+      written += 4;
+      pos += 2;
+    }
+  }
+  *i = pos;
+  *o = written;
+  return ok;
+}
+
+// Decode the sequence starting at in[pos] into *cp, returning its length, or 0
+// if it's invalid. The limits on the second byte rule out overlongs, surrogates
+// and anything past U+10FFFF, as in validate-utf8.c.
+static inline size_t decode_utf8 (uint8_t const* const in,
+                                  size_t const len,
+                                  size_t const pos,
+                                  uint32_t* const cp) {
+  uint8_t const lead = in[pos];
+  size_t need;
+  uint32_t value;
+  uint8_t lo = 0x80;
+  uint8_t hi = 0xBF;
+  if (lead < 0x80) {
+    *cp = lead;
+    return 1;
+  } else if (lead < 0xC2) {
+    return 0;
+  } else if (lead < 0xE0) {
+    need = 1;
+    value = lead & 0x1F;
+  } else if (lead < 0xF0) {
+    need = 2;
+    value = lead & 0x0F;
+    lo = (lead == 0xE0) ? 0xA0 : 0x80;
+    hi = (lead == 0xED) ? 0x9F : 0xBF;
+  } else if (lead < 0xF5) {
+    need = 3;
+    value = lead & 0x07;
+    lo = (lead == 0xF0) ? 0x90 : 0x80;
+    hi = (lead == 0xF4) ? 0x8F : 0xBF;
+  } else {
+    return 0;
+  }
+  if (len - pos <= need) {
+    return 0;
+  }
+  uint8_t const second = in[pos + 1];
+  if (second < lo || second > hi) {
+    return 0;
+  }
+  value = (value << 6) | (second & 0x3F);
+  for (size_t k = 2; k <= need; k++) {
+    uint8_t const next = in[pos + k];
+    if ((next & 0xC0) != 0x80) {
+      return 0;
+    }
+    value = (value << 6) | (next & 0x3F);
+  }
+  *cp = value;
+  return need + 1;
+}
+
+// As utf16le_to_utf8_run, the other way. A sequence may take *i up to three
+// past stop.
+static inline bool utf8_to_utf16le_run (uint8_t const* const in,
+                                        size_t const len,
+                                        size_t const stop,
+                                        uint16_t* const out,
+                                        size_t* const i,
+                                        size_t* const o) {
+  size_t pos = *i;
+  size_t written = *o;
+  bool ok = true;
+  while (pos < stop) {
+    uint32_t cp;
+    size_t const taken = decode_utf8(in, len, pos, &cp);
+    if (taken == 0) {
+      ok = false;
+      break;
+    }
+    if (cp < 0x10000) {
+      out[written] = swap_le16((uint16_t)cp);
+      written++;
+    } else {
+      out[written] = swap_le16((uint16_t)(0xD800 | ((cp - 0x10000) >> 10)));
+      out[written + 1] = swap_le16((uint16_t)(0xDC00 | (cp & 0x3FF)));
+      written += 2;
+    }
+    pos += taken;
+  }
+  *i = pos;
+  *o = written;
+  return ok;
+}
+
+// Each unit below 0x80 takes 1 byte of UTF-8, each one below 0x800 takes 2, and
+// everything else takes 3, except surrogates: a pair makes 4 bytes between
+// them, so we count 2 each. An unpaired surrogate is an error, so it never
+// makes any output, and counting it can only overestimate.
+static inline size_t utf8_length_from_utf16le_rest (uint16_t const* const ptr,
+                                                    size_t const len) {
+  size_t count = 0;
+  for (size_t i = 0; i < len; i++) {
+    uint16_t const unit = swap_le16(ptr[i]);
+    if (unit < 0x80) {
+      count += 1;
+    } else if (unit < 0x800 || (unit >= 0xD800 && unit < 0xE000)) {
+      count += 2;
+    } else {
+      count += 3;
+    }
+  }
+  return count;
+}
+
+// Every sequence starts with one byte which isn't a continuation byte, and
+// makes one unit, except for four-byte ones, which make two.
+static inline size_t utf16le_length_from_utf8_rest (uint8_t const* const ptr,
+                                                    size_t const len) {
+  size_t count = 0;
+  for (size_t i = 0; i < len; i++) {
+    count += ((ptr[i] & 0xC0) != 0x80) + (ptr[i] >= 0xF0);
+  }
+  return count;
+}
+
+// SWAR implementation, used as the fallback everywhere.
+//
+// Only the ASCII check is done a word at a time. A unit is ASCII when all but
+// the low seven bits of both its bytes are clear; which bits those are in a
+// word depends on the machine's byte order.
+
+#if (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+#define NON_ASCII_UNITS 0x80FF80FF80FF80FFULL
+#else
+#define NON_ASCII_UNITS 0xFF80FF80FF80FF80ULL
+#endif
+
+static inline size_t utf16le_to_utf8_swar (uint16_t const* const src,
+                                           size_t const off,
+                                           size_t const len,
+                                           uint8_t* const dst,
+                                           size_t const dst_off,
+                                           size_t* const written) {
+  uint16_t const* const in = (uint16_t const*)&(src[off]);
+  uint8_t* const out = &(dst[dst_off]);
+  size_t i = 0;
+  size_t o = 0;
+  while (i + 4 <= len) {
+    if ((*((uint64_t const*)(in + i)) & NON_ASCII_UNITS) == 0) {
+      for (size_t k = 0; k < 4; k++) {
+        out[o + k] = (uint8_t)swap_le16(in[i + k]);
+      }
+      i += 4;
+      o += 4;
+    } else if (!utf16le_to_utf8_run(in, len, i + 4, out, &i, &o)) {
+      *written = o;
+      return i;
+    }
+  }
+  bool const ok = utf16le_to_utf8_run(in, len, len, out, &i, &o);
+  *written = o;
+  return ok ? len : i;
+}
+
+static inline size_t utf8_to_utf16le_swar (uint8_t const* const src,
+                                           size_t const off,
+                                           size_t const len,
+                                           uint16_t* const dst,
+                                           size_t const dst_off,
+                                           size_t* const written) {
+  uint8_t const* const in = (uint8_t const*)&(src[off]);
+  uint16_t* const out = &(dst[dst_off]);
+  uint64_t const high_bits = broadcast(0x80);
+  size_t i = 0;
+  size_t o = 0;
+  while (i + 8 <= len) {
+    if ((*((uint64_t const*)(in + i)) & high_bits) == 0) {
+      for (size_t k = 0; k < 8; k++) {
+        out[o + k] = swap_le16(in[i + k]);
+      }
+      i += 8;
+      o += 8;
+    } else if (!utf8_to_utf16le_run(in, len, i + 8, out, &i, &o)) {
+      *written = o;
+      return i;
+    }
+  }
+  bool const ok = utf8_to_utf16le_run(in, len, len, out, &i, &o);
+  *written = o;
+  return ok ? len : i;
+}
+
+static inline size_t utf8_length_from_utf16le_swar (uint16_t const* const src,
+                                                    size_t const off,
+                                                    size_t const len) {
+  uint16_t const* const ptr = (uint16_t const*)&(src[off]);
+  size_t count = 0;
+  size_t i = 0;
+  for (; i + 4 <= len; i += 4) {
+    if ((*((uint64_t const*)(ptr + i)) & NON_ASCII_UNITS) == 0) {
+      count += 4;
+    } else {
+      count += utf8_length_from_utf16le_rest(ptr + i, 4);
+    }
+  }
+  return count + utf8_length_from_utf16le_rest(ptr + i, len - i);
+}
+
+// A continuation byte is flagged as in continuation_flags in
+// utf8-codepoints.c; a four-byte lead is one whose top four bits are all set.
+static inline size_t utf16le_length_from_utf8_swar (uint8_t const* const src,
+                                                    size_t const off,
+                                                    size_t const len) {
+  uint8_t const* const ptr = (uint8_t const*)&(src[off]);
+  uint64_t const high_bits = broadcast(0x80);
+  size_t count = 0;
+  size_t i = 0;
+  for (; i + 8 <= len; i += 8) {
+    uint64_t const word = *((uint64_t const*)(ptr + i));
+    uint64_t const continuations = word & ~(word << 1) & high_bits;
+    uint64_t const four_byte = word & (word << 1) & (word << 2) & (word << 3) & high_bits;
+    count += 8 - __builtin_popcountll(continuations) + __builtin_popcountll(four_byte);
+  }
+  return count + utf16le_length_from_utf8_rest(ptr + i, len - i);
+}
+
+#if (DIABLO_HAS_SSE2)
+#include <emmintrin.h>
+
+static inline size_t utf16le_to_utf8_sse (uint16_t const* const src,
+                                          size_t const off,
+                                          size_t const len,
+                                          uint8_t* const dst,
+                                          size_t const dst_off,
+                                          size_t* const written) {
+  uint16_t const* const in = (uint16_t const*)&(src[off]);
+  uint8_t* const out = &(dst[dst_off]);
+  __m128i const zero = _mm_setzero_si128();
+  size_t i = 0;
+  size_t o = 0;
+  while (i + 8 <= len) {
+    __m128i const units = _mm_loadu_si128((__m128i const*)(in + i));
+    __m128i const ascii = _mm_cmpeq_epi16(_mm_and_si128(units, _mm_set1_epi16((short)0xFF80)), zero);
+    __m128i const below_800 = _mm_cmpeq_epi16(_mm_and_si128(units, _mm_set1_epi16((short)0xF800)), zero);
+    if (_mm_movemask_epi8(ascii) == 0xFFFF) {
+      _mm_storel_epi64((__m128i*)(out + o), _mm_packus_epi16(units, units));
+      i += 8;
+      o += 8;
+    } else if (_mm_movemask_epi8(_mm_andnot_si128(ascii, below_800)) == 0xFFFF) {
+      // Each unit becomes 110xxxxx 10xxxxxx, which is one 16-bit lane once
+      // the continuation byte goes in the high half.
+      __m128i const leads = _mm_or_si128(_mm_srli_epi16(units, 6), _mm_set1_epi16(0xC0));
+      __m128i const conts = _mm_or_si128(_mm_and_si128(units, _mm_set1_epi16(0x3F)),
+                                         _mm_set1_epi16(0x80));
+      _mm_storeu_si128((__m128i*)(out + o), _mm_or_si128(leads, _mm_slli_epi16(conts, 8)));
+      i += 8;
+      o += 16;
+    } else if (!utf16le_to_utf8_run(in, len, i + 8, out, &i, &o)) {
+      *written = o;
+      return i;
+    }
+  }
+  bool const ok = utf16le_to_utf8_run(in, len, len, out, &i, &o);
+  *written = o;
+  return ok ? len : i;
+}
+
+// Eight two-byte sequences in a row are eight 16-bit lanes whose low byte is
+// 110xxxxx, whose high byte is 10xxxxxx, and whose lead isn't the overlong
+// 0xC0 or 0xC1.
+static inline size_t utf8_to_utf16le_sse (uint8_t const* const src,
+                                          size_t const off,
+                                          size_t const len,
+                                          uint16_t* const dst,
+                                          size_t const dst_off,
+                                          size_t* const written) {
+  uint8_t const* const in = (uint8_t const*)&(src[off]);
+  uint16_t* const out = &(dst[dst_off]);
+  __m128i const zero = _mm_setzero_si128();
+  size_t i = 0;
+  size_t o = 0;
+  while (i + 16 <= len) {
+    __m128i const bytes = _mm_loadu_si128((__m128i const*)(in + i));
+    __m128i const shape = _mm_cmpeq_epi16(_mm_and_si128(bytes, _mm_set1_epi16((short)0xC0E0)),
+                                          _mm_set1_epi16((short)0x80C0));
+    __m128i const overlong = _mm_cmpeq_epi16(_mm_and_si128(bytes, _mm_set1_epi16(0x1E)), zero);
+    if (_mm_movemask_epi8(bytes) == 0) {
+      _mm_storeu_si128((__m128i*)(out + o), _mm_unpacklo_epi8(bytes, zero));
+      _mm_storeu_si128((__m128i*)(out + o + 8), _mm_unpackhi_epi8(bytes, zero));
+      i += 16;
+      o += 16;
+    } else if (_mm_movemask_epi8(_mm_andnot_si128(overlong, shape)) == 0xFFFF) {
+      __m128i const high = _mm_slli_epi16(_mm_and_si128(bytes, _mm_set1_epi16(0x1F)), 6);
+      __m128i const low = _mm_and_si128(_mm_srli_epi16(bytes, 8), _mm_set1_epi16(0x3F));
+      _mm_storeu_si128((__m128i*)(out + o), _mm_or_si128(high, low));
+      i += 16;
+      o += 8;
+    } else if (!utf8_to_utf16le_run(in, len, i + 16, out, &i, &o)) {
+      *written = o;
+      return i;
+    }
+  }
+  bool const ok = utf8_to_utf16le_run(in, len, len, out, &i, &o);
+  *written = o;
+  return ok ? len : i;
+}
+
+// With every comparison giving 0 or -1, a unit's length is 3 plus whether it's
+// below 0x800, whether it's ASCII, and whether it's a surrogate. We negate the
+// sum, which fits in the low byte of each lane, and add it up with SAD.
+static inline size_t utf8_length_from_utf16le_sse (uint16_t const* const src,
+                                                   size_t const off,
+                                                   size_t const len) {
+  uint16_t const* const ptr = (uint16_t const*)&(src[off]);
+  __m128i const zero = _mm_setzero_si128();
+  __m128i total = zero;
+  size_t i = 0;
+  for (; i + 8 <= len; i += 8) {
+    __m128i const units = _mm_loadu_si128((__m128i const*)(ptr + i));
+    __m128i const top = _mm_and_si128(units, _mm_set1_epi16((short)0xF800));
+    __m128i const summed =
+      _mm_add_epi16(_mm_add_epi16(_mm_cmpeq_epi16(_mm_and_si128(units, _mm_set1_epi16((short)0xFF80)), zero),
+                                  _mm_cmpeq_epi16(top, zero)),
+                    _mm_cmpeq_epi16(top, _mm_set1_epi16((short)0xD800)));
+    total = _mm_add_epi64(total, _mm_sad_epu8(_mm_sub_epi16(zero, summed), zero));
+  }
+  uint64_t results[2];
+  _mm_storeu_si128((__m128i*)results, total);
+  return (3 * i) - (results[0] + results[1]) +
+         utf8_length_from_utf16le_rest(ptr + i, len - i);
+}
+
+// As in utf8-codepoints.c, non-continuation bytes are those above -65 as
+// signed bytes. Four-byte leads are those at least 0xF0, which we check with
+// an unsigned max.
+static inline size_t utf16le_length_from_utf8_sse (uint8_t const* const src,
+                                                   size_t const off,
+                                                   size_t const len) {
+  uint8_t const* const ptr = (uint8_t const*)&(src[off]);
+  __m128i const zero = _mm_setzero_si128();
+  __m128i const threshold = _mm_set1_epi8(-65);
+  __m128i const four_byte = _mm_set1_epi8((char)0xF0);
+  __m128i total = zero;
+  size_t i = 0;
+  for (; i + 16 <= len; i += 16) {
+    __m128i const bytes = _mm_loadu_si128((__m128i const*)(ptr + i));
+    __m128i const summed =
+      _mm_add_epi8(_mm_cmpgt_epi8(bytes, threshold),
+                   _mm_cmpeq_epi8(_mm_max_epu8(bytes, four_byte), bytes));
+    total = _mm_add_epi64(total, _mm_sad_epu8(_mm_sub_epi8(zero, summed), zero));
+  }
+  uint64_t results[2];
+  _mm_storeu_si128((__m128i*)results, total);
+  return results[0] + results[1] + utf16le_length_from_utf8_rest(ptr + i, len - i);
+}
+#endif
+
+#if (DIABLO_HAS_AVX2)
+#include <immintrin.h>
+
+// As utf16le_to_utf8_sse, with blocks of 16 units. packus works within 128-bit
+// halves, so the ASCII case needs its results gathered into the low half.
+__attribute__((target("avx2")))
+static inline size_t utf16le_to_utf8_avx (uint16_t const* const src,
+                                          size_t const off,
+                                          size_t const len,
+                                          uint8_t* const dst,
+                                          size_t const dst_off,
+                                          size_t* const written) {
+  uint16_t const* const in = (uint16_t const*)&(src[off]);
+  uint8_t* const out = &(dst[dst_off]);
+  __m256i const zero = _mm256_setzero_si256();
+  size_t i = 0;
+  size_t o = 0;
+  while (i + 16 <= len) {
+    __m256i const units = _mm256_loadu_si256((__m256i const*)(in + i));
+    __m256i const ascii = _mm256_cmpeq_epi16(_mm256_and_si256(units, _mm256_set1_epi16((short)0xFF80)), zero);
+    __m256i const below_800 = _mm256_cmpeq_epi16(_mm256_and_si256(units, _mm256_set1_epi16((short)0xF800)), zero);
+    if (((uint32_t)_mm256_movemask_epi8(ascii)) == 0xFFFFFFFF) {
+      __m256i const packed = _mm256_permute4x64_epi64(_mm256_packus_epi16(units, units), 0x08);
+      _mm_storeu_si128((__m128i*)(out + o), _mm256_castsi256_si128(packed));
+      i += 16;
+      o += 16;
+    } else if (((uint32_t)_mm256_movemask_epi8(_mm256_andnot_si256(ascii, below_800))) == 0xFFFFFFFF) {
+      __m256i const leads = _mm256_or_si256(_mm256_srli_epi16(units, 6), _mm256_set1_epi16(0xC0));
+      __m256i const conts = _mm256_or_si256(_mm256_and_si256(units, _mm256_set1_epi16(0x3F)),
+                                            _mm256_set1_epi16(0x80));
+      _mm256_storeu_si256((__m256i*)(out + o), _mm256_or_si256(leads, _mm256_slli_epi16(conts, 8)));
+      i += 16;
+      o += 32;
+    } else {
+      if (!utf16le_to_utf8_run(in, len, i + 16, out, &i, &o)) {
+        *written = o;
+        return i;
+      }
+    }
+  }
+  bool const ok = utf16le_to_utf8_run(in, len, len, out, &i, &o);
+  *written = o;
+  return ok ? len : i;
+}
+
+__attribute__((target("avx2")))
+static inline size_t utf8_to_utf16le_avx (uint8_t const* const src,
+                                          size_t const off,
+                                          size_t const len,
+                                          uint16_t* const dst,
+                                          size_t const dst_off,
+                                          size_t* const written) {
+  uint8_t const* const in = (uint8_t const*)&(src[off]);
+  uint16_t* const out = &(dst[dst_off]);
+  __m256i const zero = _mm256_setzero_si256();
+  size_t i = 0;
+  size_t o = 0;
+  while (i + 32 <= len) {
+    __m256i const bytes = _mm256_loadu_si256((__m256i const*)(in + i));
+    __m256i const shape = _mm256_cmpeq_epi16(_mm256_and_si256(bytes, _mm256_set1_epi16((short)0xC0E0)),
+                                             _mm256_set1_epi16((short)0x80C0));
+    __m256i const overlong = _mm256_cmpeq_epi16(_mm256_and_si256(bytes, _mm256_set1_epi16(0x1E)), zero);
+    if (_mm256_movemask_epi8(bytes) == 0) {
+      _mm256_storeu_si256((__m256i*)(out + o),
+                          _mm256_cvtepu8_epi16(_mm256_castsi256_si128(bytes)));
+      _mm256_storeu_si256((__m256i*)(out + o + 16),
+                          _mm256_cvtepu8_epi16(_mm256_extracti128_si256(bytes, 1)));
+      i += 32;
+      o += 32;
+    } else if (((uint32_t)_mm256_movemask_epi8(_mm256_andnot_si256(overlong, shape))) == 0xFFFFFFFF) {
+      __m256i const high = _mm256_slli_epi16(_mm256_and_si256(bytes, _mm256_set1_epi16(0x1F)), 6);
+      __m256i const low = _mm256_and_si256(_mm256_srli_epi16(bytes, 8), _mm256_set1_epi16(0x3F));
+      _mm256_storeu_si256((__m256i*)(out + o), _mm256_or_si256(high, low));
+      i += 32;
+      o += 16;
+    } else {
+      if (!utf8_to_utf16le_run(in, len, i + 32, out, &i, &o)) {
+        *written = o;
+        return i;
+      }
+    }
+  }
+  bool const ok = utf8_to_utf16le_run(in, len, len, out, &i, &o);
+  *written = o;
+  return ok ? len : i;
+}
+
+__attribute__((target("avx2")))
+static inline size_t utf8_length_from_utf16le_avx (uint16_t const* const src,
+                                                   size_t const off,
+                                                   size_t const len) {
+  uint16_t const* const ptr = (uint16_t const*)&(src[off]);
+  __m256i const zero = _mm256_setzero_si256();
+  __m256i total = zero;
+  size_t i = 0;
+  for (; i + 16 <= len; i += 16) {
+    __m256i const units = _mm256_loadu_si256((__m256i const*)(ptr + i));
+    __m256i const top = _mm256_and_si256(units, _mm256_set1_epi16((short)0xF800));
+    __m256i const summed =
+      _mm256_add_epi16(_mm256_add_epi16(_mm256_cmpeq_epi16(_mm256_and_si256(units, _mm256_set1_epi16((short)0xFF80)), zero),
+                                        _mm256_cmpeq_epi16(top, zero)),
+                       _mm256_cmpeq_epi16(top, _mm256_set1_epi16((short)0xD800)));
+    total = _mm256_add_epi64(total, _mm256_sad_epu8(_mm256_sub_epi16(zero, summed), zero));
+  }
+  size_t const negated = _mm256_extract_epi64(total, 0) + _mm256_extract_epi64(total, 1) +
+                         _mm256_extract_epi64(total, 2) + _mm256_extract_epi64(total, 3);
+  return (3 * i) - negated + utf8_length_from_utf16le_rest(ptr + i, len - i);
+}
+
+__attribute__((target("avx2")))
+static inline size_t utf16le_length_from_utf8_avx (uint8_t const* const src,
+                                                   size_t const off,
+                                                   size_t const len) {
+  uint8_t const* const ptr = (uint8_t const*)&(src[off]);
+  __m256i const zero = _mm256_setzero_si256();
+  __m256i const threshold = _mm256_set1_epi8(-65);
+  __m256i const four_byte = _mm256_set1_epi8((char)0xF0);
+  __m256i total = zero;
+  size_t i = 0;
+  for (; i + 32 <= len; i += 32) {
+    __m256i const bytes = _mm256_loadu_si256((__m256i const*)(ptr + i));
+    __m256i const summed =
+      _mm256_add_epi8(_mm256_cmpgt_epi8(bytes, threshold),
+                      _mm256_cmpeq_epi8(_mm256_max_epu8(bytes, four_byte), bytes));
+    total = _mm256_add_epi64(total, _mm256_sad_epu8(_mm256_sub_epi8(zero, summed), zero));
+  }
+  return _mm256_extract_epi64(total, 0) + _mm256_extract_epi64(total, 1) +
+         _mm256_extract_epi64(total, 2) + _mm256_extract_epi64(total, 3) +
+         utf16le_length_from_utf8_rest(ptr + i, len - i);
+}
+#endif
+
+#if (DIABLO_HAS_NEON)
+static inline uint16x8_t load_units_neon (uint16_t const* const ptr) {
+  return vreinterpretq_u16_u8(vld1q_u8((uint8_t const*)ptr));
+}
+
+static inline void store_units_neon (uint16_t* const ptr,
+                                     uint16x8_t const units) {
+  vst1q_u8((uint8_t*)ptr, vreinterpretq_u8_u16(units));
+}
+
+static inline size_t utf16le_to_utf8_neon (uint16_t const* const src,
+                                           size_t const off,
+                                           size_t const len,
+                                           uint8_t* const dst,
+                                           size_t const dst_off,
+                                           size_t* const written) {
+  uint16_t const* const in = (uint16_t const*)&(src[off]);
+  uint8_t* const out = &(dst[dst_off]);
+  size_t i = 0;
+  size_t o = 0;
+  while (i + 8 <= len) {
+    uint16x8_t const units = load_units_neon(in + i);
+    uint16x8_t const non_ascii = vandq_u16(units, vdupq_n_u16(0xFF80));
+    uint16x8_t const two_byte = vandq_u16(vtstq_u16(units, vdupq_n_u16(0xFF80)),
+                                          vceqq_u16(vandq_u16(units, vdupq_n_u16(0xF800)),
+                                                    vdupq_n_u16(0)));
+    if (!any_set(vreinterpretq_u8_u16(non_ascii))) {
+      vst1_u8(out + o, vmovn_u16(units));
+      i += 8;
+      o += 8;
+    } else if (!any_set(vreinterpretq_u8_u16(vmvnq_u16(two_byte)))) {
+      uint16x8_t const leads = vorrq_u16(vshrq_n_u16(units, 6), vdupq_n_u16(0xC0));
+      uint16x8_t const conts = vorrq_u16(vandq_u16(units, vdupq_n_u16(0x3F)),
+                                         vdupq_n_u16(0x80));
+      vst1q_u8(out + o, vreinterpretq_u8_u16(vorrq_u16(leads, vshlq_n_u16(conts, 8))));
+      i += 8;
+      o += 16;
+    } else if (!utf16le_to_utf8_run(in, len, i + 8, out, &i, &o)) {
+      *written = o;
+      return i;
+    }
+  }
+  bool const ok = utf16le_to_utf8_run(in, len, len, out, &i, &o);
+  *written = o;
+  return ok ? len : i;
+}
+
+static inline size_t utf8_to_utf16le_neon (uint8_t const* const src,
+                                           size_t const off,
+                                           size_t const len,
+                                           uint16_t* const dst,
+                                           size_t const dst_off,
+                                           size_t* const written) {
+  uint8_t const* const in = (uint8_t const*)&(src[off]);
+  uint16_t* const out = &(dst[dst_off]);
+  size_t i = 0;
+  size_t o = 0;
+  while (i + 16 <= len) {
+    uint8x16_t const bytes = vld1q_u8(in + i);
+    uint16x8_t const pairs = vreinterpretq_u16_u8(bytes);
+    uint16x8_t const two_byte =
+      vandq_u16(vceqq_u16(vandq_u16(pairs, vdupq_n_u16(0xC0E0)), vdupq_n_u16(0x80C0)),
+                vtstq_u16(pairs, vdupq_n_u16(0x1E)));
+    if (!any_set(vandq_u8(bytes, vdupq_n_u8(0x80)))) {
+      store_units_neon(out + o, vmovl_u8(vget_low_u8(bytes)));
+      store_units_neon(out + o + 8, vmovl_u8(vget_high_u8(bytes)));
+      i += 16;
+      o += 16;
+    } else if (!any_set(vreinterpretq_u8_u16(vmvnq_u16(two_byte)))) {
+      uint16x8_t const high = vshlq_n_u16(vandq_u16(pairs, vdupq_n_u16(0x1F)), 6);
+      uint16x8_t const low = vandq_u16(vshrq_n_u16(pairs, 8), vdupq_n_u16(0x3F));
+      store_units_neon(out + o, vorrq_u16(high, low));
+      i += 16;
+      o += 8;
+    } else if (!utf8_to_utf16le_run(in, len, i + 16, out, &i, &o)) {
+      *written = o;
+      return i;
+    }
+  }
+  bool const ok = utf8_to_utf16le_run(in, len, len, out, &i, &o);
+  *written = o;
+  return ok ? len : i;
+}
+
+// The same sum as utf8_length_from_utf16le_sse, added up with pairwise adds.
+static inline size_t utf8_length_from_utf16le_neon (uint16_t const* const src,
+                                                    size_t const off,
+                                                    size_t const len) {
+  uint16_t const* const ptr = (uint16_t const*)&(src[off]);
+  uint64x2_t total = vdupq_n_u64(0);
+  size_t i = 0;
+  for (; i + 8 <= len; i += 8) {
+    uint16x8_t const units = load_units_neon(ptr + i);
+    uint16x8_t const top = vandq_u16(units, vdupq_n_u16(0xF800));
+    uint16x8_t const summed =
+      vaddq_u16(vaddq_u16(vceqq_u16(vandq_u16(units, vdupq_n_u16(0xFF80)), vdupq_n_u16(0)),
+                          vceqq_u16(top, vdupq_n_u16(0))),
+                vceqq_u16(top, vdupq_n_u16(0xD800)));
+    uint16x8_t const negated = vsubq_u16(vdupq_n_u16(0), summed);
+    total = vaddq_u64(total, vpaddlq_u32(vpaddlq_u16(negated)));
+  }
+  size_t const negated = vgetq_lane_u64(total, 0) + vgetq_lane_u64(total, 1);
+  return (3 * i) - negated + utf8_length_from_utf16le_rest(ptr + i, len - i);
+}
+
+static inline size_t utf16le_length_from_utf8_neon (uint8_t const* const src,
+                                                    size_t const off,
+                                                    size_t const len) {
+  uint8_t const* const ptr = (uint8_t const*)&(src[off]);
+  uint64x2_t total = vdupq_n_u64(0);
+  size_t i = 0;
+  for (; i + 16 <= len; i += 16) {
+    uint8x16_t const bytes = vld1q_u8(ptr + i);
+    int8x16_t const summed =
+      vaddq_s8(vreinterpretq_s8_u8(vcgtq_s8(vreinterpretq_s8_u8(bytes), vdupq_n_s8(-65))),
+               vreinterpretq_s8_u8(vcgeq_u8(bytes, vdupq_n_u8(0xF0))));
+    uint8x16_t const absolute = vreinterpretq_u8_s8(vabsq_s8(summed));
+    total = vaddq_u64(total, vpaddlq_u32(vpaddlq_u16(vpaddlq_u8(absolute))));
+  }
+  return vgetq_lane_u64(total, 0) + vgetq_lane_u64(total, 1) +
+         utf16le_length_from_utf8_rest(ptr + i, len - i);
+}
+#endif
+
+typedef size_t (*utf16le_to_utf8_kernel) (uint16_t const* const,
+                                          size_t const,
+                                          size_t const,
+                                          uint8_t* const,
+                                          size_t const,
+                                          size_t* const);
+
+// The AVX2 kernels do for AVX-512BW: two-byte and ASCII blocks are already
+// limited by stores at that width.
+static utf16le_to_utf8_kernel const utf16le_to_utf8_kernels[DIABLO_BACKEND_COUNT] = {
+  [DIABLO_BACKEND_SWAR] = utf16le_to_utf8_swar,
+#if (DIABLO_HAS_SSE2)
+  [DIABLO_BACKEND_SSE2] = utf16le_to_utf8_sse,
+#endif
+#if (DIABLO_HAS_SSSE3)
+  [DIABLO_BACKEND_SSSE3] = utf16le_to_utf8_sse,
+#endif
+#if (DIABLO_HAS_AVX2)
+  [DIABLO_BACKEND_AVX2] = utf16le_to_utf8_avx,
+#endif
+#if (DIABLO_HAS_NEON)
+  [DIABLO_BACKEND_NEON] = utf16le_to_utf8_neon,
+#endif
+#if (DIABLO_HAS_AVX512BW)
+  [DIABLO_BACKEND_AVX512BW] = utf16le_to_utf8_avx,
+#endif
+};
+
+typedef size_t (*utf8_to_utf16le_kernel) (uint8_t const* const,
+                                          size_t const,
+                                          size_t const,
+                                          uint16_t* const,
+                                          size_t const,
+                                          size_t* const);
+
+static utf8_to_utf16le_kernel const utf8_to_utf16le_kernels[DIABLO_BACKEND_COUNT] = {
+  [DIABLO_BACKEND_SWAR] = utf8_to_utf16le_swar,
+#if (DIABLO_HAS_SSE2)
+  [DIABLO_BACKEND_SSE2] = utf8_to_utf16le_sse,
+#endif
+#if (DIABLO_HAS_SSSE3)
+  [DIABLO_BACKEND_SSSE3] = utf8_to_utf16le_sse,
+#endif
+#if (DIABLO_HAS_AVX2)
+  [DIABLO_BACKEND_AVX2] = utf8_to_utf16le_avx,
+#endif
+#if (DIABLO_HAS_NEON)
+  [DIABLO_BACKEND_NEON] = utf8_to_utf16le_neon,
+#endif
+#if (DIABLO_HAS_AVX512BW)
+  [DIABLO_BACKEND_AVX512BW] = utf8_to_utf16le_avx,
+#endif
+};
+
+typedef size_t (*utf8_length_from_utf16le_kernel) (uint16_t const* const,
+                                                   size_t const,
+                                                   size_t const);
+
+static utf8_length_from_utf16le_kernel const utf8_length_from_utf16le_kernels[DIABLO_BACKEND_COUNT] = {
+  [DIABLO_BACKEND_SWAR] = utf8_length_from_utf16le_swar,
+#if (DIABLO_HAS_SSE2)
+  [DIABLO_BACKEND_SSE2] = utf8_length_from_utf16le_sse,
+#endif
+#if (DIABLO_HAS_SSSE3)
+  [DIABLO_BACKEND_SSSE3] = utf8_length_from_utf16le_sse,
+#endif
+#if (DIABLO_HAS_AVX2)
+  [DIABLO_BACKEND_AVX2] = utf8_length_from_utf16le_avx,
+#endif
+#if (DIABLO_HAS_NEON)
+  [DIABLO_BACKEND_NEON] = utf8_length_from_utf16le_neon,
+#endif
+#if (DIABLO_HAS_AVX512BW)
+  [DIABLO_BACKEND_AVX512BW] = utf8_length_from_utf16le_avx,
+#endif
+};
+
+typedef size_t (*utf16le_length_from_utf8_kernel) (uint8_t const* const,
+                                                   size_t const,
+                                                   size_t const);
+
+static utf16le_length_from_utf8_kernel const utf16le_length_from_utf8_kernels[DIABLO_BACKEND_COUNT] = {
+  [DIABLO_BACKEND_SWAR] = utf16le_length_from_utf8_swar,
+#if (DIABLO_HAS_SSE2)
+  [DIABLO_BACKEND_SSE2] = utf16le_length_from_utf8_sse,
+#endif
+#if (DIABLO_HAS_SSSE3)
+  [DIABLO_BACKEND_SSSE3] = utf16le_length_from_utf8_sse,
+#endif
+#if (DIABLO_HAS_AVX2)
+  [DIABLO_BACKEND_AVX2] = utf16le_length_from_utf8_avx,
+#endif
+#if (DIABLO_HAS_NEON)
+  [DIABLO_BACKEND_NEON] = utf16le_length_from_utf8_neon,
+#endif
+#if (DIABLO_HAS_AVX512BW)
+  [DIABLO_BACKEND_AVX512BW] = utf16le_length_from_utf8_avx,
+#endif
+};
+
+size_t diablo_utf16le_to_utf8 (uint16_t const* const src,
+                               size_t const off,
+                               size_t const len,
+                               uint8_t* const dst,
+                               size_t const dst_off,
+                               size_t* const written) {
+  STATS_RECORD(STATS_UTF16LE_TO_UTF8, 2 * len);
+  return utf16le_to_utf8_kernels[active_backend()](src, off, len,
+                                                   dst, dst_off, written);
+}
+
+size_t diablo_utf8_to_utf16le (uint8_t const* const src,
+                               size_t const off,
+                               size_t const len,
+                               uint16_t* const dst,
+                               size_t const dst_off,
+                               size_t* const written) {
+  STATS_RECORD(STATS_UTF8_TO_UTF16LE, len);
+  return utf8_to_utf16le_kernels[active_backend()](src, off, len,
+                                                   dst, dst_off, written);
+}
+
+size_t diablo_utf8_length_from_utf16le (uint16_t const* const src,
+                                        size_t const off,
+                                        size_t const len) {
+  STATS_RECORD(STATS_UTF8_LENGTH_FROM_UTF16LE, 2 * len);
+  return utf8_length_from_utf16le_kernels[active_backend()](src, off, len);
+}
+
+size_t diablo_utf16le_length_from_utf8 (uint8_t const* const src,
+                                        size_t const off,
+                                        size_t const len) {
+  STATS_RECORD(STATS_UTF16LE_LENGTH_FROM_UTF8, len);
+  return utf16le_length_from_utf8_kernels[active_backend()](src, off, len);
+}
@@ -0,0 +1,402 @@
+/*
+ * Copyright 2021 Koz Ross <koz.ross@retro-freedom.nz>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <stddef.h>
+#include "common.h"
+#include "dispatch.h"
+#include "stats.h"
+
+// Every code point starts with exactly one byte which isn't a continuation
+// (10xxxxxx) byte, so both operations here come down to finding those. As
+// signed bytes, continuation bytes are exactly those at most -65 (0xBF), so a
+// single signed comparison finds the rest.
+//
+// The offset kernels skip whole blocks by popcounting them, and only look for
+// the position once they know it's in the block in front of them.
+
+static inline bool is_leading (uint8_t const byte) {
+  return (byte & 0xC0) != 0x80;
+}
+
+static inline size_t count_utf8_codepoints_rest (uint8_t const* const ptr,
+                                                 size_t const len) {
+  size_t count = 0;
+  for (size_t i = 0; i < len; i++) {
+    if (is_leading(ptr[i])) {
+      count++;
+    }
+  }
+  return count;
+}
+
+// The position in [start, len) of leading byte n, counting from start, or len.
+static inline size_t utf8_offset_of_nth_rest (uint8_t const* const ptr,
+                                              size_t const start,
+                                              size_t const len,
+                                              size_t n) {
+  for (size_t i = start; i < len; i++) {
+    if (is_leading(ptr[i])) {
+      if (n == 0) {
+        return i;
+      }
+      n--;
+    }
+  }
+  return len;
+}
+
+// SWAR implementation, used as the fallback everywhere.
+//
+// A continuation byte has its top bit set, and the bit below it clear. Shifting
+// the word left by one lines each byte's second bit up with its top bit, so we
+// can flag all of them at once.
+static inline uint64_t continuation_flags (uint64_t const word) {
+  return word & ~(word << 1) & broadcast(0x80);
+}
+
+static inline size_t count_utf8_codepoints_swar (uint8_t const* const src,
+                                                 size_t const off,
+                                                 size_t const len) {
+  size_t count = 0;
+  size_t const big_strides = len / 64;
+  size_t const small_strides = len % 64;
+  uint8_t const* ptr = (uint8_t const*)&(src[off]);
+  for (size_t i = 0; i < big_strides; i++) {
+    uint64_t const* const big_ptr = (uint64_t const* const)ptr;
+    uint64_t result = 0;
+    // Manual 8x loop unroll. Each word's flags go in a different bit of each
+    // byte, so the popcount sees all of them.
+    result |= continuation_flags(big_ptr[0]);
+    result |= continuation_flags(big_ptr[1]) >> 1;
+    result |= continuation_flags(big_ptr[2]) >> 2;
+    result |= continuation_flags(big_ptr[3]) >> 3;
+    result |= continuation_flags(big_ptr[4]) >> 4;
+    result |= continuation_flags(big_ptr[5]) >> 5;
+    result |= continuation_flags(big_ptr[6]) >> 6;
+    result |= continuation_flags(big_ptr[7]) >> 7;
+    count += 64 - __builtin_popcountll(result);
+    ptr += 64;
+  }
+  count += count_utf8_codepoints_rest(ptr, small_strides);
+  return count;
+}
+
+static inline size_t utf8_offset_of_nth_swar (uint8_t const* const src,
+                                              size_t const off,
+                                              size_t const len,
+                                              size_t n) {
+  uint8_t const* const ptr = (uint8_t const*)&(src[off]);
+  size_t i = 0;
+  for (; i + 8 <= len; i += 8) {
+    size_t const leading =
+      8 - __builtin_popcountll(continuation_flags(*((uint64_t const*)(ptr + i))));
+    if (n < leading) {
+      break;
+    }
+    n -= leading;
+  }
+  return utf8_offset_of_nth_rest(ptr, i, len, n);
+}
+
+#if (DIABLO_HAS_SSE2)
+#include <emmintrin.h>
+
+// 0xFF in the lanes holding leading bytes, 0x00 otherwise.
+static inline __m128i leading_sse (__m128i const* const ptr) {
+  return _mm_cmpgt_epi8(_mm_loadu_si128(ptr), _mm_set1_epi8(-65));
+}
+
+// One bit per leading byte of 64, in order.
+static inline uint64_t leading_mask64_sse (uint8_t const* const ptr) {
+  __m128i const* big_ptr = (__m128i const*)ptr;
+  return ((uint64_t)(uint32_t)_mm_movemask_epi8(leading_sse(big_ptr))) |
+         (((uint64_t)(uint32_t)_mm_movemask_epi8(leading_sse(big_ptr + 1))) << 16) |
+         (((uint64_t)(uint32_t)_mm_movemask_epi8(leading_sse(big_ptr + 2))) << 32) |
+         (((uint64_t)(uint32_t)_mm_movemask_epi8(leading_sse(big_ptr + 3))) << 48);
+}
+
+static inline size_t count_utf8_codepoints_sse (uint8_t const* const src,
+                                                size_t const off,
+                                                size_t const len) {
+  size_t count = 0;
+  size_t const big_strides = len / 64;
+  size_t const small_strides = len % 64;
+  uint8_t const* ptr = (uint8_t const*)&(src[off]);
+  if (big_strides != 0) {
+    __m128i counts = _mm_setzero_si128();
+    __m128i const zero = _mm_setzero_si128();
+    for (size_t i = 0; i < big_strides; i++) {
+      __m128i const* big_ptr = (__m128i const*)ptr;
+      // This is a manual 4x unroll. As in count_eq_sse, we add the -1s, negate,
+      // and sum absolute differences.
+      __m128i const summed =
+        _mm_add_epi8(_mm_add_epi8(leading_sse(big_ptr), leading_sse(big_ptr + 1)),
+                     _mm_add_epi8(leading_sse(big_ptr + 2), leading_sse(big_ptr + 3)));
+      counts = _mm_add_epi64(counts,
+                             _mm_sad_epu8(_mm_sub_epi8(zero, summed), zero));
+      ptr += 64;
+    }
+    // Evacuate results and sum.
+    uint64_t results[2];
+    _mm_storeu_si128((__m128i*)results, counts);
+    count += (results[0] + results[1]);
+  }
+  count += count_utf8_codepoints_rest(ptr, small_strides);
+  return count;
+}
+
+static inline size_t utf8_offset_of_nth_sse (uint8_t const* const src,
+                                             size_t const off,
+                                             size_t const len,
+                                             size_t n) {
+  uint8_t const* const ptr = (uint8_t const*)&(src[off]);
+  size_t i = 0;
+  for (; i + 64 <= len; i += 64) {
+    uint64_t const mask = leading_mask64_sse(ptr + i);
+    size_t const leading = __builtin_popcountll(mask);
+    if (n < leading) {
+      return i + select_bit(mask, n);
+    }
+    n -= leading;
+  }
+  return utf8_offset_of_nth_rest(ptr, i, len, n);
+}
+#endif
+
+#if (DIABLO_HAS_AVX2)
+#include <immintrin.h>
+
+__attribute__((target("avx2")))
+static inline __m256i leading_avx (__m256i const* const ptr) {
+  return _mm256_cmpgt_epi8(_mm256_loadu_si256(ptr), _mm256_set1_epi8(-65));
+}
+
+__attribute__((target("avx2")))
+static inline uint64_t leading_mask64_avx (uint8_t const* const ptr) {
+  __m256i const* big_ptr = (__m256i const*)ptr;
+  return ((uint64_t)(uint32_t)_mm256_movemask_epi8(leading_avx(big_ptr))) |
+         (((uint64_t)(uint32_t)_mm256_movemask_epi8(leading_avx(big_ptr + 1))) << 32);
+}
+
+__attribute__((target("avx2")))
+static inline size_t count_utf8_codepoints_avx (uint8_t const* const src,
+                                                size_t const off,
+                                                size_t const len) {
+  size_t count = 0;
+  size_t const big_strides = len / 64;
+  size_t const small_strides = len % 64;
+  uint8_t const* ptr = (uint8_t const*)&(src[off]);
+  if (big_strides != 0) {
+    __m256i counts = _mm256_setzero_si256();
+    __m256i const zero = _mm256_setzero_si256();
+    for (size_t i = 0; i < big_strides; i++) {
+      __m256i const* big_ptr = (__m256i const*)ptr;
+      // This is a manual 2x unroll.
+      __m256i const summed = _mm256_add_epi8(leading_avx(big_ptr),
+                                             leading_avx(big_ptr + 1));
+      counts = _mm256_add_epi64(counts,
+                                _mm256_sad_epu8(_mm256_sub_epi8(zero, summed), zero));
+      ptr += 64;
+    }
+    // Evacuate results and sum.
+    count += _mm256_extract_epi64(counts, 0) +
+             _mm256_extract_epi64(counts, 1) +
+             _mm256_extract_epi64(counts, 2) +
+             _mm256_extract_epi64(counts, 3);
+  }
+  count += count_utf8_codepoints_rest(ptr, small_strides);
+  return count;
+}
+
+__attribute__((target("avx2")))
+static inline size_t utf8_offset_of_nth_avx (uint8_t const* const src,
+                                             size_t const off,
+                                             size_t const len,
+                                             size_t n) {
+  uint8_t const* const ptr = (uint8_t const*)&(src[off]);
+  size_t i = 0;
+  for (; i + 64 <= len; i += 64) {
+    uint64_t const mask = leading_mask64_avx(ptr + i);
+    size_t const leading = __builtin_popcountll(mask);
+    if (n < leading) {
+      return i + select_bit(mask, n);
+    }
+    n -= leading;
+  }
+  return utf8_offset_of_nth_rest(ptr, i, len, n);
+}
+#endif
+
+#if (DIABLO_HAS_AVX512BW)
+// Masked loads cover the ragged end, so there is nothing scalar here.
+
+__attribute__((target("avx512bw")))
+static inline uint64_t leading_mask_avx512 (uint8_t const* const ptr,
+                                            size_t const len) {
+  __m512i const threshold = _mm512_set1_epi8(-65);
+  if (len >= 64) {
+    return _mm512_cmpgt_epi8_mask(_mm512_loadu_si512((void const*)ptr), threshold);
+  }
+  __mmask64 const mask = low_mask(len);
+  return _mm512_mask_cmpgt_epi8_mask(mask, _mm512_maskz_loadu_epi8(mask, ptr),
+                                     threshold);
+}
+
+__attribute__((target("avx512bw,popcnt")))
+static inline size_t count_utf8_codepoints_avx512 (uint8_t const* const src,
+                                                   size_t const off,
+                                                   size_t const len) {
+  uint8_t const* const ptr = (uint8_t const*)&(src[off]);
+  size_t count = 0;
+  for (size_t i = 0; i < len; i += 64) {
+    count += _mm_popcnt_u64(leading_mask_avx512(ptr + i, len - i));
+  }
+  return count;
+}
+
+__attribute__((target("avx512bw,popcnt")))
+static inline size_t utf8_offset_of_nth_avx512 (uint8_t const* const src,
+                                                size_t const off,
+                                                size_t const len,
+                                                size_t n) {
+  uint8_t const* const ptr = (uint8_t const*)&(src[off]);
+  for (size_t i = 0; i < len; i += 64) {
+    uint64_t const mask = leading_mask_avx512(ptr + i, len - i);
+    size_t const leading = _mm_popcnt_u64(mask);
+    if (n < leading) {
+      return i + select_bit(mask, n);
+    }
+    n -= leading;
+  }
+  return len;
+}
+#endif
+
+#if (DIABLO_HAS_NEON)
+// 0xFF (thus, -1) in the lanes holding leading bytes, 0x00 otherwise.
+static inline int8x16_t leading_neon (uint8_t const* const ptr) {
+  return vreinterpretq_s8_u8(vcgtq_s8(vreinterpretq_s8_u8(vld1q_u8(ptr)),
+                                      vdupq_n_s8(-65)));
+}
+
+static inline size_t count_utf8_codepoints_neon (uint8_t const* const src,
+                                                 size_t const off,
+                                                 size_t const len) {
+  size_t count = 0;
+  size_t const big_strides = len / 64;
+  size_t const small_strides = len % 64;
+  uint8_t const* ptr = (uint8_t const*)&(src[off]);
+  if (big_strides != 0) {
+    uint64x2_t counts = vdupq_n_u64(0);
+    for (size_t i = 0; i < big_strides; i++) {
+      // This is a manual 4x unroll. As in count_eq_neon, we add the -1s, take
+      // the absolute value, and sum horizontally.
+      uint8x16_t const summed =
+        vreinterpretq_u8_s8(vabsq_s8(vaddq_s8(vaddq_s8(leading_neon(ptr),
+                                                       leading_neon(ptr + 16)),
+                                              vaddq_s8(leading_neon(ptr + 32),
+                                                       leading_neon(ptr + 48)))));
+      counts = vaddq_u64(counts, vpaddlq_u32(vpaddlq_u16(vpaddlq_u8(summed))));
+      ptr += 64;
+    }
+    // Evacuate and sum.
+    count += (vgetq_lane_u64(counts, 0) + vgetq_lane_u64(counts, 1));
+  }
+  count += count_utf8_codepoints_rest(ptr, small_strides);
+  return count;
+}
+
+// Masks here have one bit per byte, at the bottom of each nibble; see
+// nibble_mask.
+static inline size_t utf8_offset_of_nth_neon (uint8_t const* const src,
+                                              size_t const off,
+                                              size_t const len,
+                                              size_t n) {
+  uint8_t const* const ptr = (uint8_t const*)&(src[off]);
+  size_t i = 0;
+  for (; i + 16 <= len; i += 16) {
+    uint64_t const mask =
+      nibble_mask(vreinterpretq_u8_s8(leading_neon(ptr + i))) & 0x1111111111111111ULL;
+    size_t const leading = __builtin_popcountll(mask);
+    if (n < leading) {
+      return i + (select_bit(mask, n) >> 2);
+    }
+    n -= leading;
+  }
+  return utf8_offset_of_nth_rest(ptr, i, len, n);
+}
+#endif
+
+typedef size_t (*count_utf8_codepoints_kernel) (uint8_t const* const,
+                                                size_t const,
+                                                size_t const);
+
+typedef size_t (*utf8_offset_of_nth_kernel) (uint8_t const* const,
+                                             size_t const,
+                                             size_t const,
+                                             size_t);
+
+static count_utf8_codepoints_kernel const count_utf8_codepoints_kernels[DIABLO_BACKEND_COUNT] = {
+  [DIABLO_BACKEND_SWAR] = count_utf8_codepoints_swar,
+#if (DIABLO_HAS_SSE2)
+  [DIABLO_BACKEND_SSE2] = count_utf8_codepoints_sse,
+#endif
+#if (DIABLO_HAS_SSSE3)
+  [DIABLO_BACKEND_SSSE3] = count_utf8_codepoints_sse,
+#endif
+#if (DIABLO_HAS_AVX2)
+  [DIABLO_BACKEND_AVX2] = count_utf8_codepoints_avx,
+#endif
+#if (DIABLO_HAS_NEON)
+  [DIABLO_BACKEND_NEON] = count_utf8_codepoints_neon,
+#endif
+#if (DIABLO_HAS_AVX512BW)
+  [DIABLO_BACKEND_AVX512BW] = count_utf8_codepoints_avx512,
+#endif
+};
+
+static utf8_offset_of_nth_kernel const utf8_offset_of_nth_kernels[DIABLO_BACKEND_COUNT] = {
+  [DIABLO_BACKEND_SWAR] = utf8_offset_of_nth_swar,
+#if (DIABLO_HAS_SSE2)
+  [DIABLO_BACKEND_SSE2] = utf8_offset_of_nth_sse,
+#endif
+#if (DIABLO_HAS_SSSE3)
+  [DIABLO_BACKEND_SSSE3] = utf8_offset_of_nth_sse,
+#endif
+#if (DIABLO_HAS_AVX2)
+  [DIABLO_BACKEND_AVX2] = utf8_offset_of_nth_avx,
+#endif
+#if (DIABLO_HAS_NEON)
+  [DIABLO_BACKEND_NEON] = utf8_offset_of_nth_neon,
+#endif
+#if (DIABLO_HAS_AVX512BW)
+  [DIABLO_BACKEND_AVX512BW] = utf8_offset_of_nth_avx512,
+#endif
+};
+
+size_t diablo_count_utf8_codepoints (uint8_t const* const src,
+                                     size_t const off,
+                                     size_t const len) {
+  STATS_RECORD(STATS_COUNT_UTF8_CODEPOINTS, len);
+  return count_utf8_codepoints_kernels[active_backend()](src, off, len);
+}
+
+size_t diablo_utf8_offset_of_nth (uint8_t const* const src,
+                                  size_t const off,
+                                  size_t const len,
+                                  size_t const n) {
+  STATS_RECORD(STATS_UTF8_OFFSET_OF_NTH, len);
+  return utf8_offset_of_nth_kernels[active_backend()](src, off, len, n);
+}
@@ -0,0 +1,548 @@
+/*
+ * Copyright 2021 Koz Ross <koz.ross@retro-freedom.nz>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <stddef.h>
+#include <string.h>
+#include "common.h"
+#include "dispatch.h"
+#include "stats.h"
+
+// Every kernel starts on a character boundary, with a fresh state, and returns
+// either the position of the first invalid byte, or len. Whatever sequence is
+// still incomplete at the end is left in the state.
+
+static inline bool is_continuation (uint8_t const byte) {
+  return (byte & 0xC0) == 0x80;
+}
+
+// A byte-at-a-time DFA, following table 3-7 of the Unicode Standard. This also
+// pins down the exact position of any error the SIMD kernels find.
+static inline size_t validate_utf8_rest (uint8_t const* const ptr,
+                                         size_t const start,
+                                         size_t const len,
+                                         diablo_utf8_state* const state) {
+  uint8_t remaining = state->remaining;
+  uint8_t lo = state->lo;
+  uint8_t hi = state->hi;
+  size_t i = start;
+  for (; i < len; i++) {
+    uint8_t const byte = ptr[i];
+    if (remaining != 0) {
+      if (byte < lo || byte > hi) {
+        break;
+      }
+      remaining--;
+      lo = 0x80;
+      hi = 0xBF;
+      continue;
+    }
+    lo = 0x80;
+    hi = 0xBF;
+    if (byte < 0x80) {
+      continue;
+    } else if (byte >= 0xC2 && byte <= 0xDF) {
+      remaining = 1;
+    } else if (byte == 0xE0) {
+      remaining = 2;
+      lo = 0xA0;
+    } else if (byte == 0xED) {
+      // Surrogates are not allowed.
+      remaining = 2;
+      hi = 0x9F;
+    } else if (byte >= 0xE1 && byte <= 0xEF) {
+      remaining = 2;
+    } else if (byte == 0xF0) {
+      remaining = 3;
+      lo = 0x90;
+    } else if (byte >= 0xF1 && byte <= 0xF3) {
+      remaining = 3;
+    } else if (byte == 0xF4) {
+      // Nothing past U+10FFFF.
+      remaining = 3;
+      hi = 0x8F;
+    } else {
+      break;
+    }
+  }
+  state->remaining = remaining;
+  state->lo = lo;
+  state->hi = hi;
+  return i;
+}
+
+// Restart the DFA at the last character boundary at or before pos, given that
+// everything before pos is valid, apart from possibly an incomplete sequence at
+// the end.
+static inline size_t validate_utf8_from (uint8_t const* const ptr,
+                                         size_t const pos,
+                                         size_t const len,
+                                         diablo_utf8_state* const state) {
+  size_t start = pos;
+  // At most three continuation bytes, then their lead byte.
+  for (size_t i = 0; i < 3 && start > 0 && is_continuation(ptr[start - 1]); i++) {
+    start--;
+  }
+  if (start > 0 && ptr[start - 1] >= 0xC0) {
+    start--;
+  }
+  state->remaining = 0;
+  return validate_utf8_rest(ptr, start, len, state);
+}
+
+// SWAR implementation, used as the fallback everywhere.
+//
+// Between sequences, we skip eight bytes at a time while they're all ASCII, and
+// run the DFA a word at a time otherwise.
+static inline size_t validate_utf8_swar (uint8_t const* const src,
+                                         size_t const off,
+                                         size_t const len,
+                                         diablo_utf8_state* const state) {
+  uint8_t const* const ptr = (uint8_t const*)&(src[off]);
+  uint64_t const high_bits = broadcast(0x80);
+  size_t i = 0;
+  while (i < len) {
+    if (state->remaining == 0) {
+      while (i + 8 <= len && (*((uint64_t const*)(ptr + i)) & high_bits) == 0) {
+        i += 8;
+      }
+    }
+    size_t const stop = (i + 8 <= len) ? i + 8 : len;
+    size_t const result = validate_utf8_rest(ptr, i, stop, state);
+    if (result != stop) {
+      return result;
+    }
+    i = stop;
+  }
+  return len;
+}
+
+// The SIMD kernels use the lookup algorithm from "Validating UTF-8 In Less
+// Than One Instruction Per Byte" (Keiser and Lemire, 2021). Each byte is
+// checked against the byte before it, using three 16-entry lookups (on the
+// high and low nibble of the previous byte, and the high nibble of this one),
+// whose results are ANDed: any bit left over is an error. A separate check
+// makes sure the third and fourth bytes of longer sequences are continuations.
+//
+// Blocks which are entirely ASCII only need checking for an incomplete
+// sequence at the end of the block before.
+//
+// Whatever is left over after the last full block is copied into a zeroed
+// 64-byte buffer, and goes through the same step, following on from the last
+// full block. The zeros after it are ASCII, so this also catches a sequence
+// left incomplete at the end. If any block fails, we hand over to the DFA from
+// the start of that block: it finds exactly where the error is, or that the
+// input just ends mid-sequence, which is fine if more is coming.
+
+#if (DIABLO_HAS_SSSE3 || DIABLO_HAS_NEON)
+#define TOO_SHORT (1 << 0)
+#define TOO_LONG (1 << 1)
+#define OVERLONG_3 (1 << 2)
+#define TOO_LARGE (1 << 3)
+#define SURROGATE (1 << 4)
+#define OVERLONG_2 (1 << 5)
+#define TOO_LARGE_1000 (1 << 6)
+#define OVERLONG_4 (1 << 6)
+#define TWO_CONTS (1 << 7)
+#define CARRY (TOO_SHORT | TOO_LONG | TWO_CONTS)
+
+// Indexed by the high nibble of the previous byte.
+static uint8_t const prev_high_table[16] = {
+  // 0_______ (ASCII)
+  TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG,
+  TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG,
+  // 10______ (continuation)
+  TWO_CONTS, TWO_CONTS, TWO_CONTS, TWO_CONTS,
+  // 1100____ (two-byte lead)
+  TOO_SHORT | OVERLONG_2,
+  // 1101____ (two-byte lead)
+  TOO_SHORT,
+  // 1110____ (three-byte lead)
+  TOO_SHORT | OVERLONG_3 | SURROGATE,
+  // 1111____ (four-byte lead)
+  TOO_SHORT | TOO_LARGE | TOO_LARGE_1000 | OVERLONG_4
+};
+
+// Indexed by the low nibble of the previous byte.
+static uint8_t const prev_low_table[16] = {
+  // ____0000
+  CARRY | OVERLONG_3 | OVERLONG_2 | OVERLONG_4,
+  // ____0001
+  CARRY | OVERLONG_2,
+  // ____001_
+  CARRY,
+  CARRY,
+  // ____0100
+  CARRY | TOO_LARGE,
+  // ____0101
+  CARRY | TOO_LARGE | TOO_LARGE_1000,
+  // ____011_
+  CARRY | TOO_LARGE | TOO_LARGE_1000,
+  CARRY | TOO_LARGE | TOO_LARGE_1000,
+  // ____1___
+  CARRY | TOO_LARGE | TOO_LARGE_1000,
+  CARRY | TOO_LARGE | TOO_LARGE_1000,
+  CARRY | TOO_LARGE | TOO_LARGE_1000,
+  CARRY | TOO_LARGE | TOO_LARGE_1000,
+  CARRY | TOO_LARGE | TOO_LARGE_1000,
+  // ____1101
+  CARRY | TOO_LARGE | TOO_LARGE_1000 | SURROGATE,
+  CARRY | TOO_LARGE | TOO_LARGE_1000,
+  CARRY | TOO_LARGE | TOO_LARGE_1000
+};
+
+// Indexed by the high nibble of the current byte.
+static uint8_t const cur_high_table[16] = {
+  // 0_______ (ASCII)
+  TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT,
+  TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT,
+  // 1000____
+  TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE_1000 | OVERLONG_4,
+  // 1001____
+  TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE,
+  // 101_____
+  TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE,
+  TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE,
+  // 11______ (lead)
+  TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT
+};
+
+// The largest values the last three bytes of a block can have without being
+// the start of an incomplete sequence.
+static uint8_t const incomplete_table[16] = {
+  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xEF, 0xDF, 0xBF
+};
+#endif
+
+#if (DIABLO_HAS_SSSE3)
+#include <tmmintrin.h>
+
+typedef struct {
+  __m128i prev_high;
+  __m128i prev_low;
+  __m128i cur_high;
+  __m128i incomplete;
+} utf8_tables_ssse3;
+
+// Nonzero lanes mark errors in input, given the 16 bytes before it.
+__attribute__((target("ssse3")))
+static inline __m128i check_utf8_ssse3 (__m128i const input,
+                                        __m128i const prev_input,
+                                        utf8_tables_ssse3 const* const tables) {
+  __m128i const nibble = _mm_set1_epi8(0x0F);
+  __m128i const prev1 = _mm_alignr_epi8(input, prev_input, 15);
+  __m128i const special =
+    _mm_and_si128(_mm_and_si128(_mm_shuffle_epi8(tables->prev_high,
+                                                 _mm_and_si128(_mm_srli_epi16(prev1, 4), nibble)),
+                                _mm_shuffle_epi8(tables->prev_low,
+                                                 _mm_and_si128(prev1, nibble))),
+                  _mm_shuffle_epi8(tables->cur_high,
+                                   _mm_and_si128(_mm_srli_epi16(input, 4), nibble)));
+  // Only bytes at least 0xE0 two back, or 0xF0 three back, end up with their
+  // top bit set.
+  __m128i const prev2 = _mm_alignr_epi8(input, prev_input, 14);
+  __m128i const prev3 = _mm_alignr_epi8(input, prev_input, 13);
+  __m128i const must_23 =
+    _mm_or_si128(_mm_subs_epu8(prev2, _mm_set1_epi8(0xE0 - 0x80)),
+                 _mm_subs_epu8(prev3, _mm_set1_epi8(0xF0 - 0x80)));
+  return _mm_xor_si128(_mm_and_si128(must_23, _mm_set1_epi8(-128)), special);
+}
+
+// Check a 64-byte block, following on from the block before it. Returns false
+// if anything is wrong.
+__attribute__((target("ssse3")))
+static inline bool check_utf8_block_ssse3 (uint8_t const* const block,
+                                           __m128i* const prev_input,
+                                           __m128i* const prev_incomplete,
+                                           utf8_tables_ssse3 const* const tables) {
+  __m128i const* big_ptr = (__m128i const*)block;
+  __m128i const inputs[4] = {
+    _mm_loadu_si128(big_ptr),
+    _mm_loadu_si128(big_ptr + 1),
+    _mm_loadu_si128(big_ptr + 2),
+    _mm_loadu_si128(big_ptr + 3)
+  };
+  __m128i const any = _mm_or_si128(_mm_or_si128(inputs[0], inputs[1]),
+                                   _mm_or_si128(inputs[2], inputs[3]));
+  __m128i error = *prev_incomplete;
+  if (_mm_movemask_epi8(any) != 0) {
+    error = _mm_or_si128(_mm_or_si128(check_utf8_ssse3(inputs[0], *prev_input, tables),
+                                      check_utf8_ssse3(inputs[1], inputs[0], tables)),
+                         _mm_or_si128(check_utf8_ssse3(inputs[2], inputs[1], tables),
+                                      check_utf8_ssse3(inputs[3], inputs[2], tables)));
+    *prev_incomplete = _mm_subs_epu8(inputs[3], tables->incomplete);
+  }
+  *prev_input = inputs[3];
+  return _mm_movemask_epi8(_mm_cmpeq_epi8(error, _mm_setzero_si128())) == 0xFFFF;
+}
+
+__attribute__((target("ssse3")))
+static inline size_t validate_utf8_ssse3 (uint8_t const* const src,
+                                          size_t const off,
+                                          size_t const len,
+                                          diablo_utf8_state* const state) {
+  uint8_t const* const ptr = (uint8_t const*)&(src[off]);
+  utf8_tables_ssse3 const tables = {
+    _mm_loadu_si128((__m128i const*)prev_high_table),
+    _mm_loadu_si128((__m128i const*)prev_low_table),
+    _mm_loadu_si128((__m128i const*)cur_high_table),
+    _mm_loadu_si128((__m128i const*)incomplete_table)
+  };
+  __m128i prev_input = _mm_setzero_si128();
+  __m128i prev_incomplete = _mm_setzero_si128();
+  size_t i = 0;
+  for (; i + 64 <= len; i += 64) {
+    if (!check_utf8_block_ssse3(ptr + i, &prev_input, &prev_incomplete, &tables)) {
+      return validate_utf8_from(ptr, i, len, state);
+    }
+  }
+  uint8_t tail[64] = {0};
+  // memcpy with a null pointer is undefined, even for no bytes.
+  if (i < len) {
+    memcpy(tail, ptr + i, len - i);
+  }
+  if (check_utf8_block_ssse3(tail, &prev_input, &prev_incomplete, &tables)) {
+    return len;
+  }
+  return validate_utf8_from(ptr, i, len, state);
+}
+#endif
+
+#if (DIABLO_HAS_AVX2)
+#include <immintrin.h>
+
+typedef struct {
+  __m256i prev_high;
+  __m256i prev_low;
+  __m256i cur_high;
+  __m256i incomplete;
+} utf8_tables_avx2;
+
+// The 32 bytes of input shifted back by n (at most 16), with the end of
+// prev_input shifted in.
+#define PREV_AVX2(input, prev_input, n) \
+  _mm256_alignr_epi8((input), \
+                     _mm256_permute2x128_si256((prev_input), (input), 0x21), \
+                     16 - (n))
+
+__attribute__((target("avx2")))
+static inline __m256i check_utf8_avx2 (__m256i const input,
+                                       __m256i const prev_input,
+                                       utf8_tables_avx2 const* const tables) {
+  __m256i const nibble = _mm256_set1_epi8(0x0F);
+  __m256i const prev1 = PREV_AVX2(input, prev_input, 1);
+  __m256i const special =
+    _mm256_and_si256(_mm256_and_si256(_mm256_shuffle_epi8(tables->prev_high,
+                                                          _mm256_and_si256(_mm256_srli_epi16(prev1, 4), nibble)),
+                                      _mm256_shuffle_epi8(tables->prev_low,
+                                                          _mm256_and_si256(prev1, nibble))),
+                     _mm256_shuffle_epi8(tables->cur_high,
+                                         _mm256_and_si256(_mm256_srli_epi16(input, 4), nibble)));
+  __m256i const prev2 = PREV_AVX2(input, prev_input, 2);
+  __m256i const prev3 = PREV_AVX2(input, prev_input, 3);
+  __m256i const must_23 =
+    _mm256_or_si256(_mm256_subs_epu8(prev2, _mm256_set1_epi8(0xE0 - 0x80)),
+                    _mm256_subs_epu8(prev3, _mm256_set1_epi8(0xF0 - 0x80)));
+  return _mm256_xor_si256(_mm256_and_si256(must_23, _mm256_set1_epi8(-128)), special);
+}
+
+// Check a 64-byte block, following on from the block before it. Returns false
+// if anything is wrong.
+__attribute__((target("avx2")))
+static inline bool check_utf8_block_avx2 (uint8_t const* const block,
+                                          __m256i* const prev_input,
+                                          __m256i* const prev_incomplete,
+                                          utf8_tables_avx2 const* const tables) {
+  __m256i const* big_ptr = (__m256i const*)block;
+  __m256i const inputs[2] = {
+    _mm256_loadu_si256(big_ptr),
+    _mm256_loadu_si256(big_ptr + 1)
+  };
+  __m256i error = *prev_incomplete;
+  if (_mm256_movemask_epi8(_mm256_or_si256(inputs[0], inputs[1])) != 0) {
+    error = _mm256_or_si256(check_utf8_avx2(inputs[0], *prev_input, tables),
+                            check_utf8_avx2(inputs[1], inputs[0], tables));
+    *prev_incomplete = _mm256_subs_epu8(inputs[1], tables->incomplete);
+  }
+  *prev_input = inputs[1];
+  return _mm256_testz_si256(error, error);
+}
+
+__attribute__((target("avx2")))
+static inline size_t validate_utf8_avx (uint8_t const* const src,
+                                        size_t const off,
+                                        size_t const len,
+                                        diablo_utf8_state* const state) {
+  uint8_t const* const ptr = (uint8_t const*)&(src[off]);
+  // Shuffles work within 128-bit lanes, so both lanes get the same tables. The
+  // incomplete check only cares about the end of the upper lane.
+  utf8_tables_avx2 const tables = {
+    _mm256_broadcastsi128_si256(_mm_loadu_si128((__m128i const*)prev_high_table)),
+    _mm256_broadcastsi128_si256(_mm_loadu_si128((__m128i const*)prev_low_table)),
+    _mm256_broadcastsi128_si256(_mm_loadu_si128((__m128i const*)cur_high_table)),
+    _mm256_inserti128_si256(_mm256_set1_epi8(-1),
+                            _mm_loadu_si128((__m128i const*)incomplete_table), 1)
+  };
+  __m256i prev_input = _mm256_setzero_si256();
+  __m256i prev_incomplete = _mm256_setzero_si256();
+  size_t i = 0;
+  for (; i + 64 <= len; i += 64) {
+    if (!check_utf8_block_avx2(ptr + i, &prev_input, &prev_incomplete, &tables)) {
+      return validate_utf8_from(ptr, i, len, state);
+    }
+  }
+  uint8_t tail[64] = {0};
+  // memcpy with a null pointer is undefined, even for no bytes.
+  if (i < len) {
+    memcpy(tail, ptr + i, len - i);
+  }
+  if (check_utf8_block_avx2(tail, &prev_input, &prev_incomplete, &tables)) {
+    return len;
+  }
+  return validate_utf8_from(ptr, i, len, state);
+}
+#endif
+
+#if (DIABLO_HAS_NEON)
+typedef struct {
+  uint8x16_t prev_high;
+  uint8x16_t prev_low;
+  uint8x16_t cur_high;
+  uint8x16_t incomplete;
+} utf8_tables_neon;
+
+static inline uint8x16_t check_utf8_neon (uint8x16_t const input,
+                                          uint8x16_t const prev_input,
+                                          utf8_tables_neon const* const tables) {
+  uint8x16_t const prev1 = vextq_u8(prev_input, input, 15);
+  uint8x16_t const special =
+    vandq_u8(vandq_u8(lookup16(tables->prev_high, vshrq_n_u8(prev1, 4)),
+                      lookup16(tables->prev_low, vandq_u8(prev1, vdupq_n_u8(0x0F)))),
+             lookup16(tables->cur_high, vshrq_n_u8(input, 4)));
+  uint8x16_t const prev2 = vextq_u8(prev_input, input, 14);
+  uint8x16_t const prev3 = vextq_u8(prev_input, input, 13);
+  uint8x16_t const must_23 = vorrq_u8(vqsubq_u8(prev2, vdupq_n_u8(0xE0 - 0x80)),
+                                      vqsubq_u8(prev3, vdupq_n_u8(0xF0 - 0x80)));
+  return veorq_u8(vandq_u8(must_23, vdupq_n_u8(0x80)), special);
+}
+
+// Check a 64-byte block, following on from the block before it. Returns false
+// if anything is wrong.
+static inline bool check_utf8_block_neon (uint8_t const* const block,
+                                          uint8x16_t* const prev_input,
+                                          uint8x16_t* const prev_incomplete,
+                                          utf8_tables_neon const* const tables) {
+  uint8x16_t const inputs[4] = {
+    vld1q_u8(block),
+    vld1q_u8(block + 16),
+    vld1q_u8(block + 32),
+    vld1q_u8(block + 48)
+  };
+  uint8x16_t const any = vorrq_u8(vorrq_u8(inputs[0], inputs[1]),
+                                  vorrq_u8(inputs[2], inputs[3]));
+  uint8x16_t error = *prev_incomplete;
+  if (any_set(vandq_u8(any, vdupq_n_u8(0x80)))) {
+    error = vorrq_u8(vorrq_u8(check_utf8_neon(inputs[0], *prev_input, tables),
+                              check_utf8_neon(inputs[1], inputs[0], tables)),
+                     vorrq_u8(check_utf8_neon(inputs[2], inputs[1], tables),
+                              check_utf8_neon(inputs[3], inputs[2], tables)));
+    *prev_incomplete = vqsubq_u8(inputs[3], tables->incomplete);
+  }
+  *prev_input = inputs[3];
+  return !any_set(error);
+}
+
+static inline size_t validate_utf8_neon (uint8_t const* const src,
+                                         size_t const off,
+                                         size_t const len,
+                                         diablo_utf8_state* const state) {
+  uint8_t const* const ptr = (uint8_t const*)&(src[off]);
+  utf8_tables_neon const tables = {
+    vld1q_u8(prev_high_table),
+    vld1q_u8(prev_low_table),
+    vld1q_u8(cur_high_table),
+    vld1q_u8(incomplete_table)
+  };
+  uint8x16_t prev_input = vdupq_n_u8(0);
+  uint8x16_t prev_incomplete = vdupq_n_u8(0);
+  size_t i = 0;
+  for (; i + 64 <= len; i += 64) {
+    if (!check_utf8_block_neon(ptr + i, &prev_input, &prev_incomplete, &tables)) {
+      return validate_utf8_from(ptr, i, len, state);
+    }
+  }
+  uint8_t tail[64] = {0};
+  // memcpy with a null pointer is undefined, even for no bytes.
+  if (i < len) {
+    memcpy(tail, ptr + i, len - i);
+  }
+  if (check_utf8_block_neon(tail, &prev_input, &prev_incomplete, &tables)) {
+    return len;
+  }
+  return validate_utf8_from(ptr, i, len, state);
+}
+#endif
+
+typedef size_t (*validate_utf8_kernel) (uint8_t const* const,
+                                        size_t const,
+                                        size_t const,
+                                        diablo_utf8_state* const);
+
+// SSE2 has no byte shuffles, so it uses the SWAR kernel. AVX-512BW machines all
+// have AVX2, whose kernel we use there.
+static validate_utf8_kernel const validate_utf8_kernels[DIABLO_BACKEND_COUNT] = {
+  [DIABLO_BACKEND_SWAR] = validate_utf8_swar,
+#if (DIABLO_HAS_SSE2)
+  [DIABLO_BACKEND_SSE2] = validate_utf8_swar,
+#endif
+#if (DIABLO_HAS_SSSE3)
+  [DIABLO_BACKEND_SSSE3] = validate_utf8_ssse3,
+#endif
+#if (DIABLO_HAS_AVX2)
+  [DIABLO_BACKEND_AVX2] = validate_utf8_avx,
+#endif
+#if (DIABLO_HAS_NEON)
+  [DIABLO_BACKEND_NEON] = validate_utf8_neon,
+#endif
+#if (DIABLO_HAS_AVX512BW)
+  [DIABLO_BACKEND_AVX512BW] = validate_utf8_avx,
+#endif
+};
+
+size_t diablo_validate_utf8 (uint8_t const* const src,
+                             size_t const off,
+                             size_t const len,
+                             diablo_utf8_state* const state) {
+  STATS_RECORD(STATS_VALIDATE_UTF8, len);
+  uint8_t const* const ptr = (uint8_t const*)&(src[off]);
+  // Finish off whatever the last chunk left incomplete.
+  size_t start = 0;
+  if (state->remaining != 0) {
+    start = (state->remaining < len) ? state->remaining : len;
+    size_t const result = validate_utf8_rest(ptr, 0, start, state);
+    if (result != start || state->remaining != 0) {
+      return result;
+    }
+  }
+  size_t const result = validate_utf8_kernels[active_backend()](src,
+                                                                off + start,
+                                                                len - start,
+                                                                state);
+  return start + result;
+}
+
+bool diablo_utf8_state_complete (diablo_utf8_state const* const state) {
+  return state->remaining == 0;
+}
@@ -0,0 +1,123 @@
+"""Property tests for diablo_is_ascii and diablo_find_first_non_ascii
+functions."""
+import weakref
+import sys
+from cffi import FFI  # type: ignore
+from hypothesis import given
+from hypothesis.strategies import composite, binary, integers, lists
+
+ffi = FFI()
+
+global_weakkeydict: weakref.WeakKeyDictionary = weakref.WeakKeyDictionary()
+
+ffi.cdef("""
+typedef struct {
+    uint8_t* src;
+    size_t full_len, off, len;
+    } ascii_data;
+""")
+
+ffi.cdef("""
+typedef enum {
+  DIABLO_BACKEND_SWAR = 0,
+  DIABLO_BACKEND_SSE2 = 1,
+  DIABLO_BACKEND_AVX2 = 2,
+  DIABLO_BACKEND_NEON = 3,
+  DIABLO_BACKEND_AVX512BW = 4,
+  DIABLO_BACKEND_SSSE3 = 5
+} diablo_backend;
+
+bool diablo_backend_supported(diablo_backend const backend);
+bool diablo_set_backend(diablo_backend const backend);
+diablo_backend diablo_reset_backend(void);
+""")
+
+ffi.cdef("""
+bool diablo_is_ascii (uint8_t const * const src,
+                      size_t const off,
+                      size_t const len);
+
+size_t diablo_find_first_non_ascii (uint8_t const * const src,
+                                    size_t const off,
+                                    size_t const len);
+""")
+
+C = ffi.dlopen(sys.argv[1])
+
+BACKENDS = [
+    backend for backend in [
+        C.DIABLO_BACKEND_SWAR, C.DIABLO_BACKEND_SSE2, C.DIABLO_BACKEND_AVX2,
+        C.DIABLO_BACKEND_NEON, C.DIABLO_BACKEND_AVX512BW,
+        C.DIABLO_BACKEND_SSSE3
+    ] if C.diablo_backend_supported(backend)
+]
+
+
+@composite
+def mk_ascii_data(draw):
+    """Generator for input data appropriate to the ASCII functions. Random
+    bytes are almost never all ASCII, so we usually start from ASCII, then set
+    the high bit of a few bytes."""
+    full_len = draw(integers(min_value=0, max_value=1000))
+    src = bytearray(draw(binary(min_size=full_len, max_size=full_len)))
+    if draw(integers(min_value=0, max_value=3)) != 0:
+        src = bytearray(b & 0x7F for b in src)
+        if full_len != 0:
+            for pos in draw(
+                    lists(integers(min_value=0, max_value=full_len - 1),
+                          max_size=3)):
+                src[pos] |= 0x80
+    if full_len == 0:
+        off = 0
+        length = 0
+    else:
+        off = draw(integers(min_value=0, max_value=full_len - 1))
+        length = draw(integers(min_value=0, max_value=full_len - off))
+    src_c = ffi.new("uint8_t[]", full_len)
+    for i in range(full_len):
+        src_c[i] = src[i]
+    dat_c = ffi.new("ascii_data*")
+    dat_c.src = src_c
+    dat_c.full_len = full_len
+    dat_c.off = off
+    dat_c.len = length
+    global_weakkeydict[dat_c] = src_c
+    return dat_c
+
+
+def first_non_ascii(dat_c):
+    """The position of the first non-ASCII byte in the range, or its length,
+    by the reference spec."""
+    return next(
+        (i for i in range(dat_c.len) if dat_c.src[dat_c.off + i] >= 0x80),
+        dat_c.len)
+
+
+@given(mk_ascii_data())  # pylint: disable=no-value-for-parameter
+def test_is_ascii(dat_c):
+    """Tests that diablo_is_ascii behaves correctly versus a reference spec, on
+    every backend this machine supports."""
+    expected = first_non_ascii(dat_c) == dat_c.len
+    for backend in BACKENDS:
+        assert C.diablo_set_backend(backend)
+        actual = C.diablo_is_ascii(dat_c.src, dat_c.off, dat_c.len)
+        assert expected == actual
+    C.diablo_reset_backend()
+
+
+@given(mk_ascii_data())  # pylint: disable=no-value-for-parameter
+def test_find_first_non_ascii(dat_c):
+    """Tests that diablo_find_first_non_ascii behaves correctly versus a
+    reference spec, on every backend this machine supports."""
+    expected = first_non_ascii(dat_c)
+    for backend in BACKENDS:
+        assert C.diablo_set_backend(backend)
+        actual = C.diablo_find_first_non_ascii(dat_c.src, dat_c.off,
+                                               dat_c.len)
+        assert expected == actual
+    C.diablo_reset_backend()
+
+
+if __name__ == "__main__":
+    test_is_ascii()  # pylint: disable=no-value-for-parameter
+    test_find_first_non_ascii()  # pylint: disable=no-value-for-parameter
@@ -0,0 +1,72 @@
+"""Tests for diablo's backend selection API."""
+import sys
+from cffi import FFI  # type: ignore
+
+ffi = FFI()
+
+ffi.cdef("""
+typedef enum {
+  DIABLO_BACKEND_SWAR = 0,
+  DIABLO_BACKEND_SSE2 = 1,
+  DIABLO_BACKEND_AVX2 = 2,
+  DIABLO_BACKEND_NEON = 3,
+  DIABLO_BACKEND_AVX512BW = 4,
+  DIABLO_BACKEND_SSSE3 = 5
+} diablo_backend;
+
+diablo_backend diablo_get_backend(void);
+bool diablo_backend_supported(diablo_backend const backend);
+bool diablo_set_backend(diablo_backend const backend);
+diablo_backend diablo_reset_backend(void);
+char const* diablo_backend_name(diablo_backend const backend);
+""")
+
+C = ffi.dlopen(sys.argv[1])
+
+ALL_BACKENDS = [
+    C.DIABLO_BACKEND_SWAR, C.DIABLO_BACKEND_SSE2, C.DIABLO_BACKEND_AVX2,
+    C.DIABLO_BACKEND_NEON, C.DIABLO_BACKEND_AVX512BW, C.DIABLO_BACKEND_SSSE3
+]
+
+
+def test_default_backend():
+    """Tests that the chosen backend is supported, and stable."""
+    chosen = C.diablo_get_backend()
+    assert C.diablo_backend_supported(chosen)
+    assert C.diablo_get_backend() == chosen
+    assert C.diablo_reset_backend() == chosen
+
+
+def test_swar_everywhere():
+    """Tests that the SWAR fallback is always available, unless the library
+    was built for a fixed ISA, where the one backend it has is the only one
+    supported."""
+    supported = [b for b in ALL_BACKENDS if C.diablo_backend_supported(b)]
+    if supported != [C.DIABLO_BACKEND_SWAR] and len(supported) == 1:
+        assert supported == [C.diablo_get_backend()]
+        return
+    assert C.diablo_backend_supported(C.DIABLO_BACKEND_SWAR)
+
+
+def test_set_backend():
+    """Tests that forcing a backend works exactly when it is supported."""
+    default = C.diablo_reset_backend()
+    for backend in ALL_BACKENDS:
+        supported = C.diablo_backend_supported(backend)
+        assert C.diablo_set_backend(backend) == supported
+        if supported:
+            assert C.diablo_get_backend() == backend
+    assert C.diablo_reset_backend() == default
+
+
+def test_backend_names():
+    """Tests that every backend has a distinct name."""
+    names = [ffi.string(C.diablo_backend_name(b)) for b in ALL_BACKENDS]
+    assert len(set(names)) == len(ALL_BACKENDS)
+
+
+if __name__ == "__main__":
+    test_default_backend()
+    test_swar_everywhere()
+    test_set_backend()
+    test_backend_names()
@@ -0,0 +1,238 @@
+"""Property tests for diablo_encode_base64, diablo_decode_base64,
+diablo_base64_encoded_length and diablo_base64_decoded_length functions."""
+import base64
+import weakref
+import sys
+from cffi import FFI  # type: ignore
+from hypothesis import given
+from hypothesis.strategies import (composite, binary, booleans, integers,
+                                   lists, sampled_from)
+
+ffi = FFI()
+
+global_weakkeydict: weakref.WeakKeyDictionary = weakref.WeakKeyDictionary()
+
+ffi.cdef("""
+typedef struct {
+    uint8_t* src;
+    size_t full_len, off, len;
+    size_t dst_off;
+    } base64_data;
+""")
+
+ffi.cdef("""
+typedef enum {
+  DIABLO_BACKEND_SWAR = 0,
+  DIABLO_BACKEND_SSE2 = 1,
+  DIABLO_BACKEND_AVX2 = 2,
+  DIABLO_BACKEND_NEON = 3,
+  DIABLO_BACKEND_AVX512BW = 4,
+  DIABLO_BACKEND_SSSE3 = 5
+} diablo_backend;
+
+bool diablo_backend_supported(diablo_backend const backend);
+bool diablo_set_backend(diablo_backend const backend);
+diablo_backend diablo_reset_backend(void);
+""")
+
+ffi.cdef("""
+typedef enum {
+  DIABLO_BASE64_STANDARD = 0,
+  DIABLO_BASE64_URL = 1
+} diablo_base64_alphabet;
+
+size_t diablo_base64_encoded_length (size_t const len, bool const pad);
+
+size_t diablo_encode_base64 (uint8_t const * const src,
+                             size_t const off,
+                             size_t const len,
+                             uint8_t * const dst,
+                             size_t const dst_off,
+                             diablo_base64_alphabet const alphabet,
+                             bool const pad);
+
+size_t diablo_base64_decoded_length (uint8_t const * const src,
+                                     size_t const off,
+                                     size_t const len);
+
+size_t diablo_decode_base64 (uint8_t const * const src,
+                             size_t const off,
+                             size_t const len,
+                             uint8_t * const dst,
+                             size_t const dst_off,
+                             diablo_base64_alphabet const alphabet);
+""")
+
+C = ffi.dlopen(sys.argv[1])
+
+BACKENDS = [
+    backend for backend in [
+        C.DIABLO_BACKEND_SWAR, C.DIABLO_BACKEND_SSE2, C.DIABLO_BACKEND_AVX2,
+        C.DIABLO_BACKEND_NEON, C.DIABLO_BACKEND_AVX512BW,
+        C.DIABLO_BACKEND_SSSE3
+    ] if C.diablo_backend_supported(backend)
+]
+
+ALPHABETS = {
+    C.DIABLO_BASE64_STANDARD: b'+/',
+    C.DIABLO_BASE64_URL: b'-_',
+}
+
+# Every output buffer gets this many guard bytes past the exact length, to
+# check that nothing is written there.
+GUARD = 40
+GUARD_VALUE = 0xAB
+
+
+def mk_data(draw, src):
+    """Wrap src up with an offset, length and output offset."""
+    full_len = len(src)
+    if full_len == 0:
+        off = 0
+        length = 0
+    else:
+        off = draw(integers(min_value=0, max_value=full_len - 1))
+        length = draw(integers(min_value=0, max_value=full_len - off))
+    src_c = ffi.new("uint8_t[]", bytes(src))
+    dat_c = ffi.new("base64_data*")
+    dat_c.src = src_c
+    dat_c.full_len = full_len
+    dat_c.off = off
+    dat_c.len = length
+    dat_c.dst_off = draw(integers(min_value=0, max_value=20))
+    global_weakkeydict[dat_c] = src_c
+    return dat_c
+
+
+def encode(raw, alphabet, pad):
+    """Encode raw by the reference spec."""
+    encoded = base64.b64encode(raw, altchars=ALPHABETS[alphabet])
+    return encoded if pad else encoded.rstrip(b'=')
+
+
+@composite
+def mk_encode_data(draw):
+    """Generator for input data appropriate to diablo_encode_base64."""
+    full_len = draw(integers(min_value=0, max_value=1000))
+    return mk_data(draw, draw(binary(min_size=full_len, max_size=full_len)))
+
+
+@composite
+def mk_decode_data(draw, alphabet):
+    """Generator for input data appropriate to diablo_decode_base64. Random
+    bytes are almost never base64, so we usually encode some, padded or not,
+    then sometimes replace a few characters with anything at all, or an
+    alphabet character or padding. The whole of the result is usually the
+    range, so that padding stays at the end."""
+    size = draw(integers(min_value=0, max_value=750))
+    src = bytearray(
+        encode(draw(binary(min_size=size, max_size=size)), alphabet,
+               draw(booleans())))
+    if len(src) != 0 and draw(integers(min_value=0, max_value=2)) == 0:
+        for pos in draw(
+                lists(integers(min_value=0, max_value=len(src) - 1),
+                      max_size=3)):
+            src[pos] = draw(
+                sampled_from([
+                    draw(integers(min_value=0, max_value=255)), ord('='),
+                    ord('A'), ord('+'), ord('/'), ord('-'), ord('_')
+                ]))
+    dat_c = mk_data(draw, src)
+    if draw(booleans()):
+        dat_c.off = 0
+        dat_c.len = len(src)
+    return dat_c
+
+
+def reference_decode(raw, alphabet):
+    """The position of the first invalid character, or len(raw), and the
+    bytes decoded before its group, by the reference spec."""
+    chars = (b'ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789' +
+             ALPHABETS[alphabet])
+    body = len(raw)
+    if body % 4 == 0 and raw.endswith(b'='):
+        body -= 2 if raw.endswith(b'==') else 1
+    pos = next((i for i in range(body) if raw[i] not in chars), None)
+    if pos is None:
+        extra = body % 4
+        if extra == 1:
+            pos = body - 1
+        elif extra == 2 and chars.index(raw[body - 1]) & 0x0F != 0:
+            pos = body - 1
+        elif extra == 3 and chars.index(raw[body - 1]) & 0x03 != 0:
+            pos = body - 1
+    if pos is None:
+        decoded = base64.b64decode(raw[:body] + b'=' * (-body % 4),
+                                   altchars=ALPHABETS[alphabet],
+                                   validate=True)
+        return (len(raw), decoded)
+    whole = pos - (pos % 4)
+    return (pos,
+            base64.b64decode(raw[:whole],
+                             altchars=ALPHABETS[alphabet],
+                             validate=True))
+
+
+def run(dat_c, out_len, call):
+    """Call call(dst) on every backend, with a guarded buffer, returning the
+    results and what was written."""
+    results = []
+    for backend in BACKENDS:
+        assert C.diablo_set_backend(backend)
+        dst_len = dat_c.dst_off + out_len + GUARD
+        dst = ffi.new("uint8_t[]", [GUARD_VALUE] * dst_len)
+        result = call(dst)
+        out = bytes(ffi.buffer(dst, dst_len))
+        assert out[:dat_c.dst_off] == bytes([GUARD_VALUE]) * dat_c.dst_off
+        assert out[dat_c.dst_off + out_len:] == bytes([GUARD_VALUE]) * GUARD
+        results.append((result, out[dat_c.dst_off:dat_c.dst_off + out_len]))
+    C.diablo_reset_backend()
+    return results
+
+
+@given(mk_encode_data(), sampled_from(list(ALPHABETS)), booleans())  # pylint: disable=no-value-for-parameter
+def test_encode_base64(dat_c, alphabet, pad):
+    """Tests that diablo_encode_base64 and diablo_base64_encoded_length behave
+    correctly versus a reference spec, on every backend this machine
+    supports."""
+    raw = bytes(ffi.buffer(dat_c.src + dat_c.off, dat_c.len))
+    expected = encode(raw, alphabet, pad)
+    assert C.diablo_base64_encoded_length(dat_c.len, pad) == len(expected)
+    for (written, actual) in run(
+            dat_c, len(expected), lambda dst: C.diablo_encode_base64(
+                dat_c.src, dat_c.off, dat_c.len, dst, dat_c.dst_off,
+                alphabet, pad)):
+        assert written == len(expected)
+        assert expected == actual
+
+
+@composite
+def mk_alphabet_and_data(draw):
+    """An alphabet, and input data to decode with it."""
+    alphabet = draw(sampled_from(list(ALPHABETS)))
+    return (alphabet, draw(mk_decode_data(alphabet)))  # pylint: disable=no-value-for-parameter
+
+
+@given(mk_alphabet_and_data())  # pylint: disable=no-value-for-parameter
+def test_decode_base64(alphabet_and_data):
+    """Tests that diablo_decode_base64 and diablo_base64_decoded_length behave
+    correctly versus a reference spec, on every backend this machine
+    supports."""
+    (alphabet, dat_c) = alphabet_and_data
+    raw = bytes(ffi.buffer(dat_c.src + dat_c.off, dat_c.len))
+    (expected_pos, expected) = reference_decode(raw, alphabet)
+    assert (expected_pos // 4) * 3 == len(expected) or \
+        expected_pos == dat_c.len
+    out_len = C.diablo_base64_decoded_length(dat_c.src, dat_c.off, dat_c.len)
+    if expected_pos == dat_c.len:
+        assert out_len == len(expected)
+    for (pos, actual) in run(
+            dat_c, out_len, lambda dst: C.diablo_decode_base64(
+                dat_c.src, dat_c.off, dat_c.len, dst, dat_c.dst_off, alphabet)):
+        assert expected_pos == pos
+        assert expected == actual[:len(expected)]
+
+
+if __name__ == "__main__":
+    test_encode_base64()  # pylint: disable=no-value-for-parameter
+    test_decode_base64()  # pylint: disable=no-value-for-parameter
@@ -0,0 +1,75 @@
+"""Property tests for diablo_byte_histogram function."""
+import weakref
+import sys
+from cffi import FFI  # type: ignore
+from hypothesis import given
+from hypothesis.strategies import composite, binary, integers, lists
+
+ffi = FFI()
+
+global_weakkeydict: weakref.WeakKeyDictionary = weakref.WeakKeyDictionary()
+
+ffi.cdef("""
+typedef struct {
+    uint8_t* src;
+    size_t full_len, off, len;
+    size_t* hist;
+    } byte_histogram_data;
+""")
+
+ffi.cdef("""
+void diablo_byte_histogram (uint8_t const * const src,
+                            size_t const off,
+                            size_t const len,
+                            size_t * const hist);
+""")
+
+C = ffi.dlopen(sys.argv[1])
+
+
+@composite
+def mk_byte_histogram_data(draw):
+    """Generator for input data appropriate to diablo_byte_histogram"""
+    full_len = draw(integers(min_value=0, max_value=2000))
+    src = draw(binary(min_size=full_len, max_size=full_len))
+    if full_len == 0:
+        off = 0
+        length = 0
+    else:
+        off = draw(integers(min_value=0, max_value=full_len - 1))
+        length = draw(integers(min_value=0, max_value=full_len - off))
+    # Start from an arbitrary histogram, to check that we accumulate.
+    initial = draw(
+        lists(integers(min_value=0, max_value=2**32),
+              min_size=256,
+              max_size=256))
+    src_c = ffi.new("uint8_t[]", full_len)
+    for i in range(full_len):
+        src_c[i] = src[i]
+    hist_c = ffi.new("size_t[]", 256)
+    for i in range(256):
+        hist_c[i] = initial[i]
+    dat_c = ffi.new("byte_histogram_data*")
+    dat_c.src = src_c
+    dat_c.full_len = full_len
+    dat_c.off = off
+    dat_c.len = length
+    dat_c.hist = hist_c
+    global_weakkeydict[dat_c] = (src_c, hist_c)
+    return dat_c
+
+
+@given(mk_byte_histogram_data())  # pylint: disable=no-value-for-parameter
+def test_byte_histogram(dat_c):
+    """Tests that diablo_byte_histogram behaves correctly versus a reference
+    spec."""
+    expected = [dat_c.hist[i] for i in range(256)]
+    for i in range(dat_c.len):
+        expected[dat_c.src[dat_c.off + i]] += 1
+    C.diablo_byte_histogram(dat_c.src, dat_c.off, dat_c.len, dat_c.hist)
+    actual = [dat_c.hist[i] for i in range(256)]
+    assert expected == actual
+
+
+if __name__ == "__main__":
+    test_byte_histogram()  # pylint: disable=no-value-for-parameter
@@ -1,9 +1,11 @@
-"""Property tests for diablo_count_eq function."""
+"""Property tests for diablo_count_eq, diablo_count_eq_batch and
+diablo_count_eq_parallel functions."""
+import random
 import weakref
 import sys
 from cffi import FFI  # type: ignore
 from hypothesis import given
-from hypothesis.strategies import composite, binary, integers
+from hypothesis.strategies import composite, binary, integers, lists, tuples
 
 ffi = FFI()
 
@@ -17,21 +19,65 @@ typedef struct {
     } count_eq_data;
 """)
 
+ffi.cdef("""
+typedef enum {
+  DIABLO_BACKEND_SWAR = 0,
+  DIABLO_BACKEND_SSE2 = 1,
+  DIABLO_BACKEND_AVX2 = 2,
+  DIABLO_BACKEND_NEON = 3,
+  DIABLO_BACKEND_AVX512BW = 4,
+  DIABLO_BACKEND_SSSE3 = 5
+} diablo_backend;
+
+bool diablo_backend_supported(diablo_backend const backend);
+bool diablo_set_backend(diablo_backend const backend);
+diablo_backend diablo_reset_backend(void);
+""")
+
 ffi.cdef("""
 size_t diablo_count_eq (uint8_t const * const src, 
                         size_t const off,
                         size_t const len,
                         uint8_t const byte);
+
+typedef struct {
+  uint8_t const* src;
+  size_t off;
+  size_t len;
+} diablo_slice;
+
+void diablo_count_eq_batch (diablo_slice const * const slices,
+                            size_t const slices_len,
+                            uint8_t const byte,
+                            size_t * const counts);
+
+size_t diablo_count_eq_parallel (uint8_t const * const src,
+                                 size_t const off,
+                                 size_t const len,
+                                 uint8_t const byte);
+
+size_t diablo_get_threads(void);
+void diablo_set_threads(size_t const threads);
+size_t diablo_get_parallel_threshold(void);
+void diablo_set_parallel_threshold(size_t const bytes);
 """)
 
 C = ffi.dlopen(sys.argv[1])
 
+BACKENDS = [
+    backend for backend in [
+        C.DIABLO_BACKEND_SWAR, C.DIABLO_BACKEND_SSE2, C.DIABLO_BACKEND_AVX2,
+        C.DIABLO_BACKEND_NEON, C.DIABLO_BACKEND_AVX512BW,
+        C.DIABLO_BACKEND_SSSE3
+    ] if C.diablo_backend_supported(backend)
+]
+
 
 @composite
 def mk_count_eq_data(draw):
     """Generator for input data appropriate to diablo_count_eq"""
-    src = draw(binary(min_size=0, max_size=1000))
-    full_len = len(src)
+    full_len = draw(integers(min_value=0, max_value=1000))
+    src = draw(binary(min_size=full_len, max_size=full_len))
     if full_len == 0:
         off = 0
         length = 0
@@ -54,15 +100,86 @@ def mk_count_eq_data(draw):
 
 @given(mk_count_eq_data())  # pylint: disable=no-value-for-parameter
 def test_count_eq(dat_c):
-    """Tests that diablo_count_eq behaves correctly versus a reference spec."""
+    """Tests that diablo_count_eq behaves correctly versus a reference spec,
+    on every backend this machine supports."""
     expected_count = 0
     for i in range(dat_c.len):
         if dat_c.src[dat_c.off + i] == dat_c.byte:
             expected_count = expected_count + 1
-    actual_count = C.diablo_count_eq(dat_c.src, dat_c.off, dat_c.len,
-                                     dat_c.byte)
-    assert expected_count == actual_count
+    for backend in BACKENDS:
+        assert C.diablo_set_backend(backend)
+        actual_count = C.diablo_count_eq(dat_c.src, dat_c.off, dat_c.len,
+                                         dat_c.byte)
+        assert expected_count == actual_count
+    C.diablo_reset_backend()
+
+
+@composite
+def mk_count_eq_batch_data(draw):
+    """Generator for input data appropriate to diablo_count_eq_batch: one
+    buffer, with slices of it, mostly short. Half the time, the buffer only has
+    four distinct bytes, so there are plenty of matches."""
+    full_len = draw(integers(min_value=0, max_value=1000))
+    src = draw(binary(min_size=full_len, max_size=full_len))
+    if draw(integers(min_value=0, max_value=1)) == 0:
+        src = bytes(b & 0x03 for b in src)
+        byte = draw(integers(min_value=0, max_value=3))
+    else:
+        byte = draw(integers(min_value=0, max_value=255))
+    bounds = draw(
+        lists(tuples(integers(min_value=0, max_value=full_len),
+                     integers(min_value=0, max_value=300)),
+              max_size=20))
+    slices = [(off, min(length, full_len - off)) for (off, length) in bounds]
+    return (src, slices, byte)
+
+
+@given(mk_count_eq_batch_data())  # pylint: disable=no-value-for-parameter
+def test_count_eq_batch(dat):
+    """Tests that diablo_count_eq_batch behaves correctly versus a reference
+    spec, on every backend this machine supports."""
+    src, slices, byte = dat
+    src_c = ffi.new("uint8_t[]", src)
+    slices_c = ffi.new("diablo_slice[]", len(slices))
+    for i, (off, length) in enumerate(slices):
+        slices_c[i].src = src_c
+        slices_c[i].off = off
+        slices_c[i].len = length
+    expected = [src[off:off + length].count(byte) for (off, length) in slices]
+    counts_c = ffi.new("size_t[]", len(slices))
+    for backend in BACKENDS:
+        assert C.diablo_set_backend(backend)
+        C.diablo_count_eq_batch(slices_c, len(slices), byte, counts_c)
+        assert expected == list(counts_c)
+    C.diablo_reset_backend()
+
+
+@given(integers(min_value=0, max_value=1 << 32),
+       integers(min_value=0, max_value=100000),
+       integers(min_value=0, max_value=63), integers(min_value=0, max_value=8),
+       integers(min_value=0, max_value=3))
+def test_count_eq_parallel(seed, length, off, threads, byte):
+    """Tests that diablo_count_eq_parallel behaves correctly versus a reference
+    spec, with the threshold low enough that long inputs are split, on every
+    backend this machine supports."""
+    # Generating this much with Hypothesis directly is slow, so we use it to
+    # seed a generator instead. Four distinct bytes gives plenty of matches.
+    src = bytes(b & 0x03 for b in random.Random(seed).randbytes(off + length))
+    src_c = ffi.new("uint8_t[]", src)
+    expected = src[off:].count(byte)
+    threshold = C.diablo_get_parallel_threshold()
+    C.diablo_set_threads(threads)
+    C.diablo_set_parallel_threshold(0)
+    assert C.diablo_get_threads() >= 1
+    for backend in BACKENDS:
+        assert C.diablo_set_backend(backend)
+        assert expected == C.diablo_count_eq_parallel(src_c, off, length, byte)
+    C.diablo_set_threads(0)
+    C.diablo_set_parallel_threshold(threshold)
+    C.diablo_reset_backend()
 
 
 if __name__ == "__main__":
     test_count_eq()  # pylint: disable=no-value-for-parameter
+    test_count_eq_batch()  # pylint: disable=no-value-for-parameter
+    test_count_eq_parallel()  # pylint: disable=no-value-for-parameter
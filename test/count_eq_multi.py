@@ -0,0 +1,110 @@
+"""Property tests for diablo_count_eq_multi function."""
+import weakref
+import sys
+from cffi import FFI  # type: ignore
+from hypothesis import given
+from hypothesis.strategies import composite, binary, integers, lists
+
+ffi = FFI()
+
+global_weakkeydict: weakref.WeakKeyDictionary = weakref.WeakKeyDictionary()
+
+ffi.cdef("""
+typedef struct {
+    uint8_t* src;
+    size_t full_len, off, len;
+    uint8_t* needles;
+    size_t needles_len;
+    } count_eq_multi_data;
+""")
+
+ffi.cdef("""
+typedef enum {
+  DIABLO_BACKEND_SWAR = 0,
+  DIABLO_BACKEND_SSE2 = 1,
+  DIABLO_BACKEND_AVX2 = 2,
+  DIABLO_BACKEND_NEON = 3,
+  DIABLO_BACKEND_AVX512BW = 4,
+  DIABLO_BACKEND_SSSE3 = 5
+} diablo_backend;
+
+bool diablo_backend_supported(diablo_backend const backend);
+bool diablo_set_backend(diablo_backend const backend);
+diablo_backend diablo_reset_backend(void);
+""")
+
+ffi.cdef("""
+void diablo_count_eq_multi (uint8_t const * const src,
+                            size_t const off,
+                            size_t const len,
+                            uint8_t const * const needles,
+                            size_t const needles_len,
+                            size_t * const counts);
+""")
+
+C = ffi.dlopen(sys.argv[1])
+
+BACKENDS = [
+    backend for backend in [
+        C.DIABLO_BACKEND_SWAR, C.DIABLO_BACKEND_SSE2, C.DIABLO_BACKEND_AVX2,
+        C.DIABLO_BACKEND_NEON, C.DIABLO_BACKEND_AVX512BW,
+        C.DIABLO_BACKEND_SSSE3
+    ] if C.diablo_backend_supported(backend)
+]
+
+
+@composite
+def mk_count_eq_multi_data(draw):
+    """Generator for input data appropriate to diablo_count_eq_multi. Half the
+    time, the input only has eight distinct bytes, so there are plenty of
+    matches. Needles may repeat, and there may be more than one pass's worth."""
+    full_len = draw(integers(min_value=0, max_value=1000))
+    src = draw(binary(min_size=full_len, max_size=full_len))
+    if draw(integers(min_value=0, max_value=1)) == 0:
+        src = bytes(b & 0x07 for b in src)
+        needles = draw(lists(integers(min_value=0, max_value=7), max_size=20))
+    else:
+        needles = draw(lists(integers(min_value=0, max_value=255),
+                             max_size=20))
+    if full_len == 0:
+        off = 0
+        length = 0
+    else:
+        off = draw(integers(min_value=0, max_value=full_len - 1))
+        length = draw(integers(min_value=0, max_value=full_len - off))
+    src_c = ffi.new("uint8_t[]", full_len)
+    for i in range(full_len):
+        src_c[i] = src[i]
+    needles_c = ffi.new("uint8_t[]", needles)
+    dat_c = ffi.new("count_eq_multi_data*")
+    dat_c.src = src_c
+    dat_c.full_len = full_len
+    dat_c.off = off
+    dat_c.len = length
+    dat_c.needles = needles_c
+    dat_c.needles_len = len(needles)
+    global_weakkeydict[dat_c] = (src_c, needles_c)
+    return dat_c
+
+
+@given(mk_count_eq_multi_data())  # pylint: disable=no-value-for-parameter
+def test_count_eq_multi(dat_c):
+    """Tests that diablo_count_eq_multi behaves correctly versus a reference
+    spec, on every backend this machine supports."""
+    data = bytes(ffi.buffer(dat_c.src, dat_c.full_len))[dat_c.off:dat_c.off +
+                                                         dat_c.len]
+    expected = [
+        data.count(dat_c.needles[j]) for j in range(dat_c.needles_len)
+    ]
+    # Start with junk, to check it's overwritten.
+    counts_c = ffi.new("size_t[]", [12345] * dat_c.needles_len)
+    for backend in BACKENDS:
+        assert C.diablo_set_backend(backend)
+        C.diablo_count_eq_multi(dat_c.src, dat_c.off, dat_c.len,
+                                dat_c.needles, dat_c.needles_len, counts_c)
+        assert expected == list(counts_c)
+    C.diablo_reset_backend()
+
+
+if __name__ == "__main__":
+    test_count_eq_multi()  # pylint: disable=no-value-for-parameter
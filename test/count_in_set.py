@@ -0,0 +1,99 @@
+"""Property tests for diablo_count_in_set function."""
+import weakref
+import sys
+from cffi import FFI  # type: ignore
+from hypothesis import given
+from hypothesis.strategies import composite, binary, integers
+
+ffi = FFI()
+
+global_weakkeydict: weakref.WeakKeyDictionary = weakref.WeakKeyDictionary()
+
+ffi.cdef("""
+typedef struct {
+    uint8_t* src;
+    size_t full_len, off, len;
+    uint8_t* set;
+    } count_in_set_data;
+""")
+
+ffi.cdef("""
+typedef enum {
+  DIABLO_BACKEND_SWAR = 0,
+  DIABLO_BACKEND_SSE2 = 1,
+  DIABLO_BACKEND_AVX2 = 2,
+  DIABLO_BACKEND_NEON = 3,
+  DIABLO_BACKEND_AVX512BW = 4,
+  DIABLO_BACKEND_SSSE3 = 5
+} diablo_backend;
+
+bool diablo_backend_supported(diablo_backend const backend);
+bool diablo_set_backend(diablo_backend const backend);
+diablo_backend diablo_reset_backend(void);
+""")
+
+ffi.cdef("""
+size_t diablo_count_in_set (uint8_t const * const src,
+                            size_t const off,
+                            size_t const len,
+                            uint8_t const * const set);
+""")
+
+C = ffi.dlopen(sys.argv[1])
+
+BACKENDS = [
+    backend for backend in [
+        C.DIABLO_BACKEND_SWAR, C.DIABLO_BACKEND_SSE2, C.DIABLO_BACKEND_AVX2,
+        C.DIABLO_BACKEND_NEON, C.DIABLO_BACKEND_AVX512BW,
+        C.DIABLO_BACKEND_SSSE3
+    ] if C.diablo_backend_supported(backend)
+]
+
+
+@composite
+def mk_count_in_set_data(draw):
+    """Generator for input data appropriate to diablo_count_in_set"""
+    full_len = draw(integers(min_value=0, max_value=1000))
+    src = draw(binary(min_size=full_len, max_size=full_len))
+    if full_len == 0:
+        off = 0
+        length = 0
+    else:
+        off = draw(integers(min_value=0, max_value=full_len - 1))
+        length = draw(integers(min_value=0, max_value=full_len - off))
+    byte_set = draw(binary(min_size=32, max_size=32))
+    src_c = ffi.new("uint8_t[]", full_len)
+    for i in range(full_len):
+        src_c[i] = src[i]
+    set_c = ffi.new("uint8_t[]", 32)
+    for i in range(32):
+        set_c[i] = byte_set[i]
+    dat_c = ffi.new("count_in_set_data*")
+    dat_c.src = src_c
+    dat_c.full_len = full_len
+    dat_c.off = off
+    dat_c.len = length
+    dat_c.set = set_c
+    global_weakkeydict[dat_c] = (src_c, set_c)
+    return dat_c
+
+
+@given(mk_count_in_set_data())  # pylint: disable=no-value-for-parameter
+def test_count_in_set(dat_c):
+    """Tests that diablo_count_in_set behaves correctly versus a reference
+    spec, on every backend this machine supports."""
+    expected_count = 0
+    for i in range(dat_c.len):
+        byte = dat_c.src[dat_c.off + i]
+        if dat_c.set[byte // 8] & (1 << (byte % 8)):
+            expected_count = expected_count + 1
+    for backend in BACKENDS:
+        assert C.diablo_set_backend(backend)
+        actual_count = C.diablo_count_in_set(dat_c.src, dat_c.off, dat_c.len,
+                                             dat_c.set)
+        assert expected_count == actual_count
+    C.diablo_reset_backend()
+
+
+if __name__ == "__main__":
+    test_count_in_set()  # pylint: disable=no-value-for-parameter
@@ -0,0 +1,206 @@
+"""Property tests for diablo_find_first_eq, diablo_find_last_eq and
+diablo_find_all_eq functions."""
+import weakref
+import sys
+from cffi import FFI  # type: ignore
+from hypothesis import given
+from hypothesis.strategies import composite, binary, integers
+
+ffi = FFI()
+
+global_weakkeydict: weakref.WeakKeyDictionary = weakref.WeakKeyDictionary()
+
+ffi.cdef("""
+typedef struct {
+    uint8_t* src;
+    size_t full_len, off, len;
+    uint8_t byte;
+    size_t out_len;
+    } find_eq_data;
+""")
+
+ffi.cdef("""
+typedef enum {
+  DIABLO_BACKEND_SWAR = 0,
+  DIABLO_BACKEND_SSE2 = 1,
+  DIABLO_BACKEND_AVX2 = 2,
+  DIABLO_BACKEND_NEON = 3,
+  DIABLO_BACKEND_AVX512BW = 4,
+  DIABLO_BACKEND_SSSE3 = 5
+} diablo_backend;
+
+bool diablo_backend_supported(diablo_backend const backend);
+bool diablo_set_backend(diablo_backend const backend);
+diablo_backend diablo_reset_backend(void);
+""")
+
+ffi.cdef("""
+size_t diablo_find_first_eq (uint8_t const * const src,
+                             size_t const off,
+                             size_t const len,
+                             uint8_t const byte);
+
+size_t diablo_find_last_eq (uint8_t const * const src,
+                            size_t const off,
+                            size_t const len,
+                            uint8_t const byte);
+
+size_t diablo_find_all_eq (uint8_t const * const src,
+                           size_t const off,
+                           size_t const len,
+                           uint8_t const byte,
+                           size_t * const out,
+                           size_t const out_len);
+""")
+
+C = ffi.dlopen(sys.argv[1])
+
+BACKENDS = [
+    backend for backend in [
+        C.DIABLO_BACKEND_SWAR, C.DIABLO_BACKEND_SSE2, C.DIABLO_BACKEND_AVX2,
+        C.DIABLO_BACKEND_NEON, C.DIABLO_BACKEND_AVX512BW,
+        C.DIABLO_BACKEND_SSSE3
+    ] if C.diablo_backend_supported(backend)
+]
+
+
+@composite
+def mk_find_eq_data(draw):
+    """Generator for input data appropriate to the find_eq functions"""
+    full_len = draw(integers(min_value=0, max_value=1000))
+    src = draw(binary(min_size=full_len, max_size=full_len))
+    if full_len == 0:
+        off = 0
+        length = 0
+    else:
+        off = draw(integers(min_value=0, max_value=full_len - 1))
+        length = draw(integers(min_value=0, max_value=full_len - off))
+    # Pick a byte from the input most of the time, so we find something.
+    if length != 0 and draw(integers(min_value=0, max_value=3)) != 0:
+        byte = src[off + draw(integers(min_value=0, max_value=length - 1))]
+    else:
+        byte = draw(integers(min_value=0, max_value=255))
+    out_len = draw(integers(min_value=0, max_value=20))
+    src_c = ffi.new("uint8_t[]", full_len)
+    for i in range(full_len):
+        src_c[i] = src[i]
+    dat_c = ffi.new("find_eq_data*")
+    dat_c.src = src_c
+    dat_c.full_len = full_len
+    dat_c.off = off
+    dat_c.len = length
+    dat_c.byte = byte
+    dat_c.out_len = out_len
+    global_weakkeydict[dat_c] = src_c
+    return dat_c
+
+
+@composite
+def mk_early_full_data(draw):
+    """Generator for input data where the output fills well before the end:
+    a run of matches at the start, longer than the output, then at least two
+    vectors' worth of bytes without any."""
+    out_len = draw(integers(min_value=1, max_value=20))
+    run = draw(integers(min_value=out_len + 1, max_value=100))
+    rest = draw(integers(min_value=65, max_value=500))
+    byte = draw(integers(min_value=0, max_value=255))
+    src = bytes([byte] * run) + bytes([(byte + 1) % 256] * rest)
+    off = draw(integers(min_value=0, max_value=8))
+    src_c = ffi.new("uint8_t[]", off + len(src))
+    for i, b in enumerate(src):
+        src_c[off + i] = b
+    dat_c = ffi.new("find_eq_data*")
+    dat_c.src = src_c
+    dat_c.full_len = off + len(src)
+    dat_c.off = off
+    dat_c.len = len(src)
+    dat_c.byte = byte
+    dat_c.out_len = out_len
+    global_weakkeydict[dat_c] = src_c
+    return dat_c
+
+
+def positions(dat_c):
+    """All positions of the byte in the range, by the reference spec."""
+    return [
+        i for i in range(dat_c.len) if dat_c.src[dat_c.off + i] == dat_c.byte
+    ]
+
+
+@given(mk_find_eq_data())  # pylint: disable=no-value-for-parameter
+def test_find_first_eq(dat_c):
+    """Tests that diablo_find_first_eq behaves correctly versus a reference
+    spec, on every backend this machine supports."""
+    found = positions(dat_c)
+    expected = found[0] if found else dat_c.len
+    for backend in BACKENDS:
+        assert C.diablo_set_backend(backend)
+        actual = C.diablo_find_first_eq(dat_c.src, dat_c.off, dat_c.len,
+                                        dat_c.byte)
+        assert expected == actual
+    C.diablo_reset_backend()
+
+
+@given(mk_find_eq_data())  # pylint: disable=no-value-for-parameter
+def test_find_last_eq(dat_c):
+    """Tests that diablo_find_last_eq behaves correctly versus a reference
+    spec, on every backend this machine supports."""
+    found = positions(dat_c)
+    expected = found[-1] if found else dat_c.len
+    for backend in BACKENDS:
+        assert C.diablo_set_backend(backend)
+        actual = C.diablo_find_last_eq(dat_c.src, dat_c.off, dat_c.len,
+                                       dat_c.byte)
+        assert expected == actual
+    C.diablo_reset_backend()
+
+
+@given(mk_find_eq_data())  # pylint: disable=no-value-for-parameter
+def test_find_all_eq(dat_c):
+    """Tests that diablo_find_all_eq behaves correctly versus a reference
+    spec, including resuming when the output fills, on every backend this
+    machine supports."""
+    expected = positions(dat_c)
+    out_len = max(dat_c.out_len, 1)
+    out = ffi.new("size_t[]", out_len)
+    for backend in BACKENDS:
+        assert C.diablo_set_backend(backend)
+        actual = []
+        start = 0
+        while True:
+            written = C.diablo_find_all_eq(dat_c.src, dat_c.off + start,
+                                           dat_c.len - start, dat_c.byte, out,
+                                           out_len)
+            assert written <= out_len
+            actual.extend(start + out[i] for i in range(written))
+            if written < out_len:
+                break
+            start = actual[-1] + 1
+        assert expected == actual
+        # With no room, nothing is written.
+        assert C.diablo_find_all_eq(dat_c.src, dat_c.off, dat_c.len,
+                                    dat_c.byte, ffi.NULL, 0) == 0
+    C.diablo_reset_backend()
+
+
+@given(mk_early_full_data())  # pylint: disable=no-value-for-parameter
+def test_find_all_eq_early_full(dat_c):
+    """Tests that diablo_find_all_eq stops cleanly when the output fills more
+    than one vector before the end, on every backend this machine
+    supports."""
+    expected = positions(dat_c)[:dat_c.out_len]
+    out = ffi.new("size_t[]", dat_c.out_len)
+    for backend in BACKENDS:
+        assert C.diablo_set_backend(backend)
+        written = C.diablo_find_all_eq(dat_c.src, dat_c.off, dat_c.len,
+                                       dat_c.byte, out, dat_c.out_len)
+        assert written == dat_c.out_len
+        assert expected == [out[i] for i in range(written)]
+    C.diablo_reset_backend()
+
+
+if __name__ == "__main__":
+    test_find_first_eq()  # pylint: disable=no-value-for-parameter
+    test_find_last_eq()  # pylint: disable=no-value-for-parameter
+    test_find_all_eq()  # pylint: disable=no-value-for-parameter
+    test_find_all_eq_early_full()  # pylint: disable=no-value-for-parameter
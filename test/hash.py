@@ -0,0 +1,320 @@
+"""Property tests for diablo_hash64, diablo_hash64_init, diablo_hash64_update
+and diablo_hash64_finish functions."""
+import sys
+from cffi import FFI  # type: ignore
+from hypothesis import given
+from hypothesis.strategies import (binary, composite, integers, lists,
+                                   sampled_from)
+
+ffi = FFI()
+
+ffi.cdef("""
+typedef enum {
+  DIABLO_BACKEND_SWAR = 0,
+  DIABLO_BACKEND_SSE2 = 1,
+  DIABLO_BACKEND_AVX2 = 2,
+  DIABLO_BACKEND_NEON = 3,
+  DIABLO_BACKEND_AVX512BW = 4,
+  DIABLO_BACKEND_SSSE3 = 5
+} diablo_backend;
+
+bool diablo_backend_supported(diablo_backend const backend);
+bool diablo_set_backend(diablo_backend const backend);
+diablo_backend diablo_reset_backend(void);
+""")
+
+ffi.cdef("""
+typedef struct {
+  uint64_t acc[8];
+  uint64_t seed;
+  uint64_t len;
+  size_t buffered;
+  size_t stripes;
+  uint8_t secret[192];
+  uint8_t buffer[256];
+} diablo_hash64_state;
+
+uint64_t diablo_hash64 (uint8_t const * const src,
+                        size_t const off,
+                        size_t const len,
+                        uint64_t const seed);
+
+void diablo_hash64_init (diablo_hash64_state * const state,
+                         uint64_t const seed);
+
+void diablo_hash64_update (diablo_hash64_state * const state,
+                           uint8_t const * const src,
+                           size_t const off,
+                           size_t const len);
+
+uint64_t diablo_hash64_finish (diablo_hash64_state const * const state);
+""")
+
+C = ffi.dlopen(sys.argv[1])
+
+BACKENDS = [
+    backend for backend in [
+        C.DIABLO_BACKEND_SWAR, C.DIABLO_BACKEND_SSE2, C.DIABLO_BACKEND_AVX2,
+        C.DIABLO_BACKEND_NEON, C.DIABLO_BACKEND_AVX512BW,
+        C.DIABLO_BACKEND_SSSE3
+    ] if C.diablo_backend_supported(backend)
+]
+
+# Reference XXH3, 64-bit with a seed, following the xxHash specification.
+
+SECRET = bytes.fromhex(
+    'b8fe6c3923a44bbe7c01812cf721ad1cded46de9839097db7240a4a4b7b3671f'
+    'cb79e64eccc0e578825ad07dccff7221b8084674f743248ee03590e6813a264c'
+    '3c2852bb91c300cb88d0658b1b532ea371644897a20df94e3819ef46a9deacd8'
+    'a8fa763fe39c343ff9dcbbc7c70b4f1d8a51e04bcdb45931c89f7ec9d9787364'
+    'eac5ac8334d3ebc3c581a0fffa1363eb170ddd51b7f0da49d316552629d4689e'
+    '2b16be587d47a1fc8ff8b8d17ad031ce45cb3a8f95160428afd7fbcabb4b407e')
+MASK = (1 << 64) - 1
+PRIME32_1, PRIME32_2, PRIME32_3 = 0x9E3779B1, 0x85EBCA77, 0xC2B2AE3D
+PRIME64_1 = 0x9E3779B185EBCA87
+PRIME64_2 = 0xC2B2AE3D27D4EB4F
+PRIME64_3 = 0x165667B19E3779F9
+PRIME64_4 = 0x85EBCA77C2B2AE63
+PRIME64_5 = 0x27D4EB2F165667C5
+PRIME_MX1 = 0x165667919E3779F9
+PRIME_MX2 = 0x9FB21C651E98DF25
+
+
+def read64(data, pos):
+    """The little-endian 64-bit word at pos."""
+    return int.from_bytes(data[pos:pos + 8], 'little')
+
+
+def read32(data, pos):
+    """The little-endian 32-bit word at pos."""
+    return int.from_bytes(data[pos:pos + 4], 'little')
+
+
+def rotl(word, amount):
+    """Rotate a 64-bit word left."""
+    return ((word << amount) | (word >> (64 - amount))) & MASK
+
+
+def mul_fold(lhs, rhs):
+    """The 128-bit product, with its halves XORed together."""
+    product = lhs * rhs
+    return (product ^ (product >> 64)) & MASK
+
+
+def avalanche(word):
+    """XXH3's final mix."""
+    word ^= word >> 37
+    word = (word * PRIME_MX1) & MASK
+    return word ^ (word >> 32)
+
+
+def avalanche_xxh64(word):
+    """XXH64's final mix."""
+    word ^= word >> 33
+    word = (word * PRIME64_2) & MASK
+    word ^= word >> 29
+    word = (word * PRIME64_3) & MASK
+    return word ^ (word >> 32)
+
+
+def mix16(data, pos, secret, key, seed):
+    """Mix 16 bytes of data with 16 bytes of secret."""
+    return mul_fold(read64(data, pos) ^ ((read64(secret, key) + seed) & MASK),
+                    read64(data, pos + 8) ^
+                    ((read64(secret, key + 8) - seed) & MASK))
+
+
+def hash_short(data, seed):
+    """The hash of at most 16 bytes."""
+    length = len(data)
+    if length == 0:
+        return avalanche_xxh64(seed ^ read64(SECRET, 56) ^ read64(SECRET, 64))
+    if length <= 3:
+        combined = ((data[0] << 16) | (data[length >> 1] << 24)
+                    | data[length - 1] | (length << 8))
+        flip = ((read32(SECRET, 0) ^ read32(SECRET, 4)) + seed) & MASK
+        return avalanche_xxh64(combined ^ flip)
+    if length <= 8:
+        low = (seed & 0xFFFFFFFF).to_bytes(4, 'little')
+        seed ^= int.from_bytes(low, 'big') << 32
+        flip = ((read64(SECRET, 8) ^ read64(SECRET, 16)) - seed) & MASK
+        word = (read32(data, length - 4) + (read32(data, 0) << 32)) ^ flip
+        word ^= rotl(word, 49) ^ rotl(word, 24)
+        word = (word * PRIME_MX2) & MASK
+        word ^= (word >> 35) + length
+        word = (word * PRIME_MX2) & MASK
+        return word ^ (word >> 28)
+    low = read64(data, 0) ^ ((
+        (read64(SECRET, 24) ^ read64(SECRET, 32)) + seed) & MASK)
+    high = read64(data, length - 8) ^ ((
+        (read64(SECRET, 40) ^ read64(SECRET, 48)) - seed) & MASK)
+    swapped = int.from_bytes(low.to_bytes(8, 'little'), 'big')
+    return avalanche((length + swapped + high + mul_fold(low, high)) & MASK)
+
+
+def hash_medium(data, seed):
+    """The hash of 17 to 240 bytes."""
+    length = len(data)
+    acc = length * PRIME64_1
+    if length <= 128:
+        for k in range((length - 1) // 32 + 1):
+            acc += mix16(data, 16 * k, SECRET, 32 * k, seed)
+            acc += mix16(data, length - 16 * (k + 1), SECRET, 32 * k + 16,
+                         seed)
+        return avalanche(acc & MASK)
+    for k in range(8):
+        acc += mix16(data, 16 * k, SECRET, 16 * k, seed)
+    acc = avalanche(acc & MASK)
+    end = mix16(data, length - 16, SECRET, 136 - 17, seed)
+    for k in range(8, length // 16):
+        end += mix16(data, 16 * k, SECRET, 16 * (k - 8) + 3, seed)
+    return avalanche((acc + end) & MASK)
+
+
+def hash_long(data, seed):
+    """The hash of more than 240 bytes."""
+    length = len(data)
+    secret = b''.join(((read64(SECRET, 8 * k) +
+                        (seed if k % 2 == 0 else -seed)) & MASK).to_bytes(
+                            8, 'little') for k in range(24))
+    acc = [
+        PRIME32_3, PRIME64_1, PRIME64_2, PRIME64_3, PRIME64_4, PRIME32_2,
+        PRIME64_5, PRIME32_1
+    ]
+
+    def stripe(pos, key):
+        for lane in range(8):
+            value = read64(data, pos + 8 * lane)
+            keyed = value ^ read64(secret, key + 8 * lane)
+            acc[lane ^ 1] = (acc[lane ^ 1] + value) & MASK
+            acc[lane] = (acc[lane] + (keyed & 0xFFFFFFFF) *
+                         (keyed >> 32)) & MASK
+
+    for k in range((length - 1) // 64):
+        stripe(64 * k, 8 * (k % 16))
+        if k % 16 == 15:
+            for lane in range(8):
+                word = acc[lane] ^ (acc[lane] >> 47)
+                word ^= read64(secret, 128 + 8 * lane)
+                acc[lane] = (word * PRIME32_1) & MASK
+    stripe(length - 64, 192 - 64 - 7)
+    result = length * PRIME64_1
+    for k in range(4):
+        result += mul_fold(acc[2 * k] ^ read64(secret, 11 + 16 * k),
+                           acc[2 * k + 1] ^ read64(secret, 11 + 16 * k + 8))
+    return avalanche(result & MASK)
+
+
+def xxh3(data, seed):
+    """XXH3_64bits_withSeed, by the reference spec."""
+    if len(data) <= 16:
+        return hash_short(data, seed)
+    if len(data) <= 240:
+        return hash_medium(data, seed)
+    return hash_long(data, seed)
+
+
+# Results from xxHash itself, to check the reference against.
+KNOWN = [
+    (b'', 0, 0x2D06800538D394C2),
+    (b'a', 0, 0xE6C632B61E964E1F),
+    (b'abc', 0x9E3779B97F4A7C15, 0xFC1AE99BB3DE2336),
+    (b'abcdefg', 0, 0x5A40DC3FD44C052F),
+    (b'hello, world!', 0, 0x37D0952B447BA6CC),
+    (b'The quick brown fox jumps over the lazy dog', 1, 0x1E098210B55FAD4A),
+    (bytes(range(200)), 5, 0x7E48976549BBD9A1),
+    (bytes(range(256)) * 2, 0, 0x1059105AD19BFA09),
+    (bytes(range(256)) * 8, 0xDEADBEEF, 0xB08F6C4C8844877B),
+]
+
+# Long enough for several blocks of stripes.
+MAX_LEN = 3000
+
+
+@composite
+def mk_hash_data(draw):
+    """Generator for a buffer, a range in it and a seed. Most lengths are
+    short, as in the hash tables this is for."""
+    full_len = draw(
+        sampled_from([
+            draw(integers(min_value=0, max_value=300)),
+            draw(integers(min_value=0, max_value=MAX_LEN))
+        ]))
+    src = draw(binary(min_size=full_len, max_size=full_len))
+    off = draw(integers(min_value=0, max_value=full_len))
+    length = draw(integers(min_value=0, max_value=full_len - off))
+    seed = draw(
+        sampled_from([0, draw(integers(min_value=0, max_value=MASK))]))
+    return (src, off, length, seed)
+
+
+@composite
+def mk_chunk(draw):
+    """Generator for a chunk to hash. Lengths near multiples of the 64-byte
+    stripe, and past the 256-byte buffer, are the interesting ones."""
+    length = draw(
+        sampled_from([
+            draw(integers(min_value=0, max_value=700)),
+            draw(sampled_from([1, 63, 64, 65, 128, 192, 255, 256, 257, 320]))
+        ]))
+    return (draw(binary(min_size=length, max_size=length)),
+            draw(sampled_from(BACKENDS)))
+
+
+@composite
+def mk_chunks(draw):
+    """Generator for a seed and a list of chunks to hash, each with the backend
+    to add it on."""
+    chunks = draw(lists(mk_chunk(), max_size=12))  # pylint: disable=no-value-for-parameter
+    seed = draw(
+        sampled_from([0, draw(integers(min_value=0, max_value=MASK))]))
+    return (seed, chunks)
+
+
+def test_known():
+    """Tests that diablo_hash64 and the reference agree with xxHash on a few
+    inputs, on every backend this machine supports."""
+    for (data, seed, expected) in KNOWN:
+        assert xxh3(data, seed) == expected
+        for backend in BACKENDS:
+            assert C.diablo_set_backend(backend)
+            assert C.diablo_hash64(data, 0, len(data), seed) == expected
+    C.diablo_reset_backend()
+
+
+@given(mk_hash_data())  # pylint: disable=no-value-for-parameter
+def test_hash64(dat):
+    """Tests that diablo_hash64 behaves correctly versus a reference spec, on
+    every backend this machine supports."""
+    (src, off, length, seed) = dat
+    expected = xxh3(src[off:off + length], seed)
+    for backend in BACKENDS:
+        assert C.diablo_set_backend(backend)
+        assert C.diablo_hash64(src, off, length, seed) == expected
+    C.diablo_reset_backend()
+
+
+@given(mk_chunks())  # pylint: disable=no-value-for-parameter
+def test_streaming(dat):
+    """Tests that hashing in chunks gives the same result as hashing all at
+    once, whichever backends the chunks are added on. Finishing doesn't change
+    the state, so we finish after every chunk."""
+    (seed, chunks) = dat
+    state = ffi.new("diablo_hash64_state*")
+    C.diablo_hash64_init(state, seed)
+    so_far = b''
+    assert C.diablo_hash64_finish(state) == xxh3(so_far, seed)
+    for (chunk, backend) in chunks:
+        assert C.diablo_set_backend(backend)
+        C.diablo_hash64_update(state, chunk, 0, len(chunk))
+        so_far += chunk
+        assert C.diablo_hash64_finish(state) == C.diablo_hash64(
+            so_far, 0, len(so_far), seed)
+    C.diablo_reset_backend()
+    assert C.diablo_hash64_finish(state) == xxh3(so_far, seed)
+
+
+if __name__ == "__main__":
+    test_known()
+    test_hash64()  # pylint: disable=no-value-for-parameter
+    test_streaming()  # pylint: disable=no-value-for-parameter
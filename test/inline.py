@@ -0,0 +1,178 @@
+"""Property tests for the static inline short-input functions in diablo.h:
+diablo_count_eq_inline, diablo_find_first_eq_inline,
+diablo_find_last_eq_inline, diablo_find_first_non_ascii_inline,
+diablo_is_ascii_inline, diablo_mismatch_inline and diablo_compare_inline.
+These are compiled against the header, so this needs a C compiler as well as
+the library and the include directory."""
+import importlib
+import os
+import sys
+import tempfile
+from cffi import FFI  # type: ignore
+from hypothesis import given
+from hypothesis.strategies import (binary, composite, integers, lists,
+                                   sampled_from)
+
+ffi = FFI()
+
+ffi.cdef("""
+size_t diablo_count_eq_inline (uint8_t const * const src,
+                               size_t const off,
+                               size_t const len,
+                               uint8_t const byte);
+
+size_t diablo_find_first_eq_inline (uint8_t const * const src,
+                                    size_t const off,
+                                    size_t const len,
+                                    uint8_t const byte);
+
+size_t diablo_find_last_eq_inline (uint8_t const * const src,
+                                   size_t const off,
+                                   size_t const len,
+                                   uint8_t const byte);
+
+size_t diablo_find_first_non_ascii_inline (uint8_t const * const src,
+                                           size_t const off,
+                                           size_t const len);
+
+bool diablo_is_ascii_inline (uint8_t const * const src,
+                             size_t const off,
+                             size_t const len);
+
+size_t diablo_mismatch_inline (uint8_t const * const a,
+                               size_t const a_off,
+                               uint8_t const * const b,
+                               size_t const b_off,
+                               size_t const len);
+
+int diablo_compare_inline (uint8_t const * const a,
+                           size_t const a_off,
+                           size_t const a_len,
+                           uint8_t const * const b,
+                           size_t const b_off,
+                           size_t const b_len);
+""")
+
+LIB_PATH = os.path.abspath(sys.argv[1])
+INCLUDE_DIR = os.path.abspath(sys.argv[2])
+BUILD_DIR = tempfile.mkdtemp()
+
+ffi.set_source("_diablo_inline",
+               '#include "diablo.h"',
+               include_dirs=[INCLUDE_DIR],
+               extra_link_args=[
+                   LIB_PATH, '-Wl,-rpath,' + os.path.dirname(LIB_PATH)
+               ])
+ffi.compile(tmpdir=BUILD_DIR)
+sys.path.insert(0, BUILD_DIR)
+C = importlib.import_module("_diablo_inline").lib
+
+# Long enough for both the inline paths and calls into the library.
+MAX_LEN = 80
+
+
+@composite
+def mk_buffer(draw):
+    """Generator for a buffer, an offset into it and a byte to look for. Bytes
+    are drawn from a few values, so matches and long runs are both common."""
+    alphabet = draw(
+        lists(integers(min_value=0, max_value=255), min_size=1, max_size=4))
+    full_len = draw(integers(min_value=0, max_value=MAX_LEN + 8))
+    src = bytes(
+        draw(
+            lists(sampled_from(alphabet),
+                  min_size=full_len,
+                  max_size=full_len)))
+    off = draw(integers(min_value=0, max_value=min(full_len, 8)))
+    byte = draw(sampled_from(alphabet))
+    return (src, off, byte)
+
+
+@composite
+def mk_ascii_buffer(draw):
+    """Generator for a buffer and an offset into it, for the ASCII functions.
+    Random bytes are almost never all ASCII, so we usually start from ASCII,
+    then set the high bit of one byte."""
+    (src, off, _) = draw(mk_buffer())
+    if draw(integers(min_value=0, max_value=3)) != 0:
+        src = bytearray(b & 0x7F for b in src)
+        if src:
+            src[draw(integers(min_value=0, max_value=len(src) - 1))] |= 0x80
+        src = bytes(src)
+    return (src, off)
+
+
+@composite
+def mk_pair(draw):
+    """Generator for two buffers and an offset into each. They usually share a
+    long prefix from their offsets onwards."""
+    prefix = draw(binary(max_size=MAX_LEN + 8))
+    a_full = draw(binary(max_size=8)) + prefix
+    b_full = bytearray(draw(binary(max_size=8)) + prefix)
+    if b_full and draw(integers(min_value=0, max_value=3)) != 0:
+        pos = draw(integers(min_value=0, max_value=len(b_full) - 1))
+        b_full[pos] = draw(integers(min_value=0, max_value=255))
+    a_off = len(a_full) - len(prefix)
+    b_off = len(b_full) - len(prefix)
+    return (a_full, a_off, bytes(b_full) + draw(binary(max_size=4)), b_off)
+
+
+# Each test checks every length the buffer allows, as the inline paths differ
+# by length more than anything.
+
+
+@given(mk_buffer())  # pylint: disable=no-value-for-parameter
+def test_searching(buf):
+    """Tests that the inline counting and search functions behave correctly
+    versus a reference spec."""
+    (src, off, byte) = buf
+    for length in range(len(src) - off + 1):
+        sub = src[off:off + length]
+        first = sub.find(bytes([byte]))
+        last = sub.rfind(bytes([byte]))
+        assert C.diablo_count_eq_inline(src, off, length,
+                                        byte) == sub.count(byte)
+        assert C.diablo_find_first_eq_inline(
+            src, off, length, byte) == (length if first < 0 else first)
+        assert C.diablo_find_last_eq_inline(
+            src, off, length, byte) == (length if last < 0 else last)
+
+
+@given(mk_ascii_buffer())  # pylint: disable=no-value-for-parameter
+def test_ascii(buf):
+    """Tests that the inline ASCII functions behave correctly versus a
+    reference spec."""
+    (src, off) = buf
+    for length in range(len(src) - off + 1):
+        sub = src[off:off + length]
+        expected = next((i for (i, b) in enumerate(sub) if b >= 0x80), length)
+        assert C.diablo_find_first_non_ascii_inline(src, off,
+                                                    length) == expected
+        assert C.diablo_is_ascii_inline(src, off,
+                                        length) == (expected == length)
+
+
+@given(mk_pair())  # pylint: disable=no-value-for-parameter
+def test_comparing(pair):
+    """Tests that the inline comparison functions behave correctly versus a
+    reference spec."""
+    (a_full, a_off, b_full, b_off) = pair
+    for a_len in range(len(a_full) - a_off + 1):
+        # Equal lengths, and the longest b can have.
+        for b_len in {min(a_len, len(b_full) - b_off), len(b_full) - b_off}:
+            a_sub = a_full[a_off:a_off + a_len]
+            b_sub = b_full[b_off:b_off + b_len]
+            common = min(a_len, b_len)
+            expected = next(
+                (i for i in range(common) if a_sub[i] != b_sub[i]), common)
+            assert C.diablo_mismatch_inline(a_full, a_off, b_full, b_off,
+                                            common) == expected
+            expected_order = (a_sub > b_sub) - (a_sub < b_sub)
+            assert C.diablo_compare_inline(a_full, a_off, a_len, b_full,
+                                           b_off, b_len) == expected_order
+
+
+if __name__ == "__main__":
+    test_searching()  # pylint: disable=no-value-for-parameter
+    test_ascii()  # pylint: disable=no-value-for-parameter
+    test_comparing()  # pylint: disable=no-value-for-parameter
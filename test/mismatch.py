@@ -0,0 +1,137 @@
+"""Property tests for diablo_mismatch and diablo_compare functions."""
+import weakref
+import sys
+from cffi import FFI  # type: ignore
+from hypothesis import given
+from hypothesis.strategies import composite, binary, integers
+
+ffi = FFI()
+
+global_weakkeydict: weakref.WeakKeyDictionary = weakref.WeakKeyDictionary()
+
+ffi.cdef("""
+typedef struct {
+    uint8_t* a;
+    uint8_t* b;
+    size_t a_off, a_len, b_off, b_len;
+    } mismatch_data;
+""")
+
+ffi.cdef("""
+typedef enum {
+  DIABLO_BACKEND_SWAR = 0,
+  DIABLO_BACKEND_SSE2 = 1,
+  DIABLO_BACKEND_AVX2 = 2,
+  DIABLO_BACKEND_NEON = 3,
+  DIABLO_BACKEND_AVX512BW = 4,
+  DIABLO_BACKEND_SSSE3 = 5
+} diablo_backend;
+
+bool diablo_backend_supported(diablo_backend const backend);
+bool diablo_set_backend(diablo_backend const backend);
+diablo_backend diablo_reset_backend(void);
+""")
+
+ffi.cdef("""
+size_t diablo_mismatch (uint8_t const * const a,
+                        size_t const a_off,
+                        uint8_t const * const b,
+                        size_t const b_off,
+                        size_t const len);
+
+int diablo_compare (uint8_t const * const a,
+                    size_t const a_off,
+                    size_t const a_len,
+                    uint8_t const * const b,
+                    size_t const b_off,
+                    size_t const b_len);
+""")
+
+C = ffi.dlopen(sys.argv[1])
+
+BACKENDS = [
+    backend for backend in [
+        C.DIABLO_BACKEND_SWAR, C.DIABLO_BACKEND_SSE2, C.DIABLO_BACKEND_AVX2,
+        C.DIABLO_BACKEND_NEON, C.DIABLO_BACKEND_AVX512BW,
+        C.DIABLO_BACKEND_SSSE3
+    ] if C.diablo_backend_supported(backend)
+]
+
+
+@composite
+def mk_mismatch_data(draw):
+    """Generator for input data appropriate to diablo_mismatch and
+    diablo_compare. Random ranges almost never share a prefix, so we mostly
+    make the second a copy of the first, with some bytes changed and some
+    added or cut off at the end, at a different offset."""
+    a_len = draw(integers(min_value=0, max_value=300))
+    a = draw(binary(min_size=a_len, max_size=a_len))
+    if draw(integers(min_value=0, max_value=7)) == 0:
+        b = draw(binary(max_size=300))
+    else:
+        b = bytearray(a)
+        for _ in range(draw(integers(min_value=0, max_value=2))):
+            if len(b) == 0:
+                break
+            pos = draw(integers(min_value=0, max_value=len(b) - 1))
+            b[pos] = draw(integers(min_value=0, max_value=255))
+        cut = draw(integers(min_value=0, max_value=len(b)))
+        b = bytes(b[:cut]) + draw(binary(max_size=20))
+    a_off = draw(integers(min_value=0, max_value=20))
+    b_off = draw(integers(min_value=0, max_value=20))
+    a_c = ffi.new("uint8_t[]", a_off + len(a))
+    b_c = ffi.new("uint8_t[]", b_off + len(b))
+    for i, byte in enumerate(a):
+        a_c[a_off + i] = byte
+    for i, byte in enumerate(b):
+        b_c[b_off + i] = byte
+    dat_c = ffi.new("mismatch_data*")
+    dat_c.a = a_c
+    dat_c.b = b_c
+    dat_c.a_off = a_off
+    dat_c.a_len = len(a)
+    dat_c.b_off = b_off
+    dat_c.b_len = len(b)
+    global_weakkeydict[dat_c] = (a_c, b_c)
+    return dat_c
+
+
+def ranges(dat_c):
+    """The two ranges, as Python bytes."""
+    a = bytes(ffi.buffer(dat_c.a + dat_c.a_off, dat_c.a_len))
+    b = bytes(ffi.buffer(dat_c.b + dat_c.b_off, dat_c.b_len))
+    return (a, b)
+
+
+@given(mk_mismatch_data())  # pylint: disable=no-value-for-parameter
+def test_mismatch(dat_c):
+    """Tests that diablo_mismatch behaves correctly versus a reference spec, on
+    every backend this machine supports."""
+    a, b = ranges(dat_c)
+    length = min(len(a), len(b))
+    expected = next((i for i in range(length) if a[i] != b[i]), length)
+    for backend in BACKENDS:
+        assert C.diablo_set_backend(backend)
+        actual = C.diablo_mismatch(dat_c.a, dat_c.a_off, dat_c.b, dat_c.b_off,
+                                   length)
+        assert expected == actual
+    C.diablo_reset_backend()
+
+
+@given(mk_mismatch_data())  # pylint: disable=no-value-for-parameter
+def test_compare(dat_c):
+    """Tests that diablo_compare behaves correctly versus a reference spec, on
+    every backend this machine supports."""
+    a, b = ranges(dat_c)
+    expected = (a > b) - (a < b)
+    for backend in BACKENDS:
+        assert C.diablo_set_backend(backend)
+        actual = C.diablo_compare(dat_c.a, dat_c.a_off, dat_c.a_len, dat_c.b,
+                                  dat_c.b_off, dat_c.b_len)
+        assert expected == (actual > 0) - (actual < 0)
+    C.diablo_reset_backend()
+
+
+if __name__ == "__main__":
+    test_mismatch()  # pylint: disable=no-value-for-parameter
+    test_compare()  # pylint: disable=no-value-for-parameter
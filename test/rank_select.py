@@ -0,0 +1,188 @@
+"""Property tests for diablo_popcount, diablo_rank_select_init, diablo_rank1,
+diablo_rank0, diablo_select1 and diablo_select0 functions."""
+import weakref
+import sys
+from bisect import bisect_left
+from cffi import FFI  # type: ignore
+from hypothesis import given
+from hypothesis.strategies import (composite, binary, integers, lists,
+                                   randoms, sampled_from)
+
+ffi = FFI()
+
+global_weakkeydict: weakref.WeakKeyDictionary = weakref.WeakKeyDictionary()
+
+ffi.cdef("""
+typedef struct {
+    uint8_t* src;
+    size_t full_len, off, len;
+    } popcount_data;
+
+typedef struct {
+    uint64_t* bits;
+    size_t len;
+    } bits_data;
+""")
+
+ffi.cdef("""
+typedef enum {
+  DIABLO_BACKEND_SWAR = 0,
+  DIABLO_BACKEND_SSE2 = 1,
+  DIABLO_BACKEND_AVX2 = 2,
+  DIABLO_BACKEND_NEON = 3,
+  DIABLO_BACKEND_AVX512BW = 4,
+  DIABLO_BACKEND_SSSE3 = 5
+} diablo_backend;
+
+bool diablo_backend_supported(diablo_backend const backend);
+bool diablo_set_backend(diablo_backend const backend);
+diablo_backend diablo_reset_backend(void);
+""")
+
+ffi.cdef("""
+size_t diablo_popcount (uint8_t const * const src,
+                        size_t const off,
+                        size_t const len);
+
+typedef struct {
+  uint64_t const* bits;
+  size_t len;
+  size_t ones;
+  uint64_t* directory;
+} diablo_rank_select;
+
+size_t diablo_rank_select_size (size_t const len);
+
+void diablo_rank_select_init (diablo_rank_select * const rs,
+                              uint64_t const * const bits,
+                              size_t const len,
+                              uint64_t * const directory);
+
+size_t diablo_rank1 (diablo_rank_select const * const rs, size_t const pos);
+
+size_t diablo_rank0 (diablo_rank_select const * const rs, size_t const pos);
+
+size_t diablo_select1 (diablo_rank_select const * const rs, size_t const n);
+
+size_t diablo_select0 (diablo_rank_select const * const rs, size_t const n);
+""")
+
+C = ffi.dlopen(sys.argv[1])
+
+BACKENDS = [
+    backend for backend in [
+        C.DIABLO_BACKEND_SWAR, C.DIABLO_BACKEND_SSE2, C.DIABLO_BACKEND_AVX2,
+        C.DIABLO_BACKEND_NEON, C.DIABLO_BACKEND_AVX512BW,
+        C.DIABLO_BACKEND_SSSE3
+    ] if C.diablo_backend_supported(backend)
+]
+
+# Every select sample covers this many bits of the same value.
+SELECT_SAMPLE = 4096
+
+# The directory gets this many guard words past its size, to check that
+# nothing is written there.
+GUARD = 8
+GUARD_VALUE = 0xABABABABABABABAB
+
+
+@composite
+def mk_popcount_data(draw):
+    """Generator for input data appropriate to diablo_popcount"""
+    full_len = draw(integers(min_value=0, max_value=1000))
+    src = draw(binary(min_size=full_len, max_size=full_len))
+    if full_len == 0:
+        off = 0
+        length = 0
+    else:
+        off = draw(integers(min_value=0, max_value=full_len - 1))
+        length = draw(integers(min_value=0, max_value=full_len - off))
+    src_c = ffi.new("uint8_t[]", src)
+    dat_c = ffi.new("popcount_data*")
+    dat_c.src = src_c
+    dat_c.full_len = full_len
+    dat_c.off = off
+    dat_c.len = length
+    global_weakkeydict[dat_c] = src_c
+    return dat_c
+
+
+@composite
+def mk_bits_data(draw):
+    """Generator for bit arrays, long enough to need several select samples,
+    with anything from almost no 1 bits to almost all of them. The bits past
+    the end of the last word are random."""
+    length = draw(integers(min_value=0, max_value=40000))
+    rng = draw(randoms(use_true_random=False))
+    # How many random words to AND (positive) or OR (negative) per word: the
+    # more there are, the further from half the density gets.
+    density = draw(sampled_from([-6, -2, 1, 2, 6, 0]))
+    words = []
+    for _ in range((length + 63) // 64):
+        word = rng.getrandbits(64)
+        for _ in range(abs(density) - 1):
+            if density > 0:
+                word &= rng.getrandbits(64)
+            else:
+                word |= rng.getrandbits(64)
+        words.append(0 if density == 0 else word)
+    bits_c = ffi.new("uint64_t[]", words)
+    dat_c = ffi.new("bits_data*")
+    dat_c.bits = bits_c
+    dat_c.len = length
+    global_weakkeydict[dat_c] = bits_c
+    return (dat_c, draw(lists(integers(min_value=0, max_value=length + 1),
+                              max_size=30)))
+
+
+@given(mk_popcount_data())  # pylint: disable=no-value-for-parameter
+def test_popcount(dat_c):
+    """Tests that diablo_popcount behaves correctly versus a reference spec, on
+    every backend this machine supports."""
+    expected_count = sum(
+        bin(dat_c.src[dat_c.off + i]).count('1') for i in range(dat_c.len))
+    for backend in BACKENDS:
+        assert C.diablo_set_backend(backend)
+        assert expected_count == C.diablo_popcount(dat_c.src, dat_c.off,
+                                                   dat_c.len)
+    C.diablo_reset_backend()
+
+
+@given(mk_bits_data())  # pylint: disable=no-value-for-parameter
+def test_rank_select(data):
+    """Tests that diablo_rank1, diablo_rank0, diablo_select1 and
+    diablo_select0 behave correctly versus a reference spec, with directories
+    built on every backend this machine supports."""
+    (dat_c, picks) = data
+    length = dat_c.len
+    bits = [(dat_c.bits[i // 64] >> (i % 64)) & 1 for i in range(length)]
+    ones = [i for i in range(length) if bits[i] == 1]
+    zeros = [i for i in range(length) if bits[i] == 0]
+    # Positions and counts around the ends, and around the sample boundaries.
+    special = [0, 1, length - 1, length, len(ones) - 1, len(ones),
+               len(zeros) - 1, len(zeros)]
+    for j in range(1, length // SELECT_SAMPLE + 1):
+        special += [j * SELECT_SAMPLE - 1, j * SELECT_SAMPLE]
+    queries = [q for q in special + picks if q >= 0]
+    size = C.diablo_rank_select_size(length)
+    for backend in BACKENDS:
+        assert C.diablo_set_backend(backend)
+        directory = ffi.new("uint64_t[]", [GUARD_VALUE] * (size + GUARD))
+        rs_c = ffi.new("diablo_rank_select*")
+        C.diablo_rank_select_init(rs_c, dat_c.bits, length, directory)
+        assert list(directory)[size:] == [GUARD_VALUE] * GUARD
+        for query in queries:
+            pos = min(query, length)
+            expected_rank1 = bisect_left(ones, pos)
+            assert C.diablo_rank1(rs_c, query) == expected_rank1
+            assert C.diablo_rank0(rs_c, query) == pos - expected_rank1
+            expected_select1 = ones[query] if query < len(ones) else length
+            assert C.diablo_select1(rs_c, query) == expected_select1
+            expected_select0 = zeros[query] if query < len(zeros) else length
+            assert C.diablo_select0(rs_c, query) == expected_select0
+    C.diablo_reset_backend()
+
+
+if __name__ == "__main__":
+    test_popcount()  # pylint: disable=no-value-for-parameter
+    test_rank_select()  # pylint: disable=no-value-for-parameter
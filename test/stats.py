@@ -0,0 +1,174 @@
+"""Property tests for diablo_stats_functions, diablo_stats_name,
+diablo_get_stats and diablo_reset_stats functions. These need a library built
+with statistics."""
+import sys
+import threading
+from cffi import FFI  # type: ignore
+from hypothesis import given
+from hypothesis.strategies import (composite, integers, lists, sampled_from,
+                                   tuples)
+
+ffi = FFI()
+
+ffi.cdef("""
+typedef enum {
+  DIABLO_BACKEND_SWAR = 0,
+  DIABLO_BACKEND_SSE2 = 1,
+  DIABLO_BACKEND_AVX2 = 2,
+  DIABLO_BACKEND_NEON = 3,
+  DIABLO_BACKEND_AVX512BW = 4,
+  DIABLO_BACKEND_SSSE3 = 5
+} diablo_backend;
+
+bool diablo_backend_supported(diablo_backend const backend);
+bool diablo_set_backend(diablo_backend const backend);
+diablo_backend diablo_reset_backend(void);
+""")
+
+ffi.cdef("""
+typedef struct {
+  uint64_t calls;
+  uint64_t bytes;
+  uint64_t backends[6];
+  uint64_t lengths[65];
+} diablo_stats;
+
+size_t diablo_stats_functions (void);
+
+char const * diablo_stats_name (size_t const function);
+
+bool diablo_get_stats (size_t const function, diablo_stats * const out);
+
+void diablo_reset_stats (void);
+
+size_t diablo_count_eq (uint8_t const * const src,
+                        size_t const off,
+                        size_t const len,
+                        uint8_t const byte);
+
+int diablo_compare (uint8_t const * const a,
+                    size_t const a_off,
+                    size_t const a_len,
+                    uint8_t const * const b,
+                    size_t const b_off,
+                    size_t const b_len);
+""")
+
+C = ffi.dlopen(sys.argv[1])
+
+BACKENDS = [
+    backend for backend in [
+        C.DIABLO_BACKEND_SWAR, C.DIABLO_BACKEND_SSE2, C.DIABLO_BACKEND_AVX2,
+        C.DIABLO_BACKEND_NEON, C.DIABLO_BACKEND_AVX512BW,
+        C.DIABLO_BACKEND_SSSE3
+    ] if C.diablo_backend_supported(backend)
+]
+
+NAMES = [
+    ffi.string(C.diablo_stats_name(i)).decode('ascii')
+    for i in range(C.diablo_stats_functions())
+]
+
+COUNT_EQ = NAMES.index('diablo_count_eq')
+COMPARE = NAMES.index('diablo_compare')
+
+# Long enough for every length the tests use.
+BUFFER = ffi.new("uint8_t[]", 5000)
+
+
+def bucket(length):
+    """Which lengths entry a call of this many bytes goes in."""
+    return length.bit_length()
+
+
+def get_stats(function):
+    """diablo_get_stats for the function, as a tuple."""
+    stats = ffi.new("diablo_stats*")
+    assert C.diablo_get_stats(function, stats)
+    return (stats.calls, stats.bytes, list(stats.backends),
+            list(stats.lengths))
+
+
+def expected_stats(calls):
+    """What get_stats should give after a reset, then the given calls of
+    (backend, length)."""
+    backends = [0] * 6
+    lengths = [0] * 65
+    for (backend, length) in calls:
+        backends[backend] += 1
+        lengths[bucket(length)] += 1
+    return (len(calls), sum(length for (_, length) in calls), backends,
+            lengths)
+
+
+@composite
+def mk_calls(draw):
+    """Generator for a list of (backend, length) calls to make."""
+    return draw(
+        lists(tuples(sampled_from(BACKENDS),
+                     integers(min_value=0, max_value=5000)),
+              max_size=20))
+
+
+def test_names():
+    """Tests that every operation has a distinct name, and that asking about
+    any other number fails."""
+    assert len(set(NAMES)) == len(NAMES)
+    assert all(name.startswith('diablo_') for name in NAMES)
+    assert C.diablo_stats_name(len(NAMES)) == ffi.NULL
+    assert not C.diablo_get_stats(len(NAMES), ffi.new("diablo_stats*"))
+
+
+@given(mk_calls(), mk_calls())  # pylint: disable=no-value-for-parameter
+def test_count_calls(calls, compare_calls):
+    """Tests that calls, bytes, backends and lengths are counted for each
+    operation on its own, starting from the last reset."""
+    C.diablo_count_eq(BUFFER, 0, 100, 0)
+    C.diablo_reset_stats()
+    for (backend, length) in calls:
+        assert C.diablo_set_backend(backend)
+        C.diablo_count_eq(BUFFER, 0, length, 0)
+    # diablo_compare counts the shorter of its two ranges.
+    for (backend, length) in compare_calls:
+        assert C.diablo_set_backend(backend)
+        C.diablo_compare(BUFFER, 0, length, BUFFER, 0, length + 1)
+    C.diablo_reset_backend()
+    assert get_stats(COUNT_EQ) == expected_stats(calls)
+    assert get_stats(COMPARE) == expected_stats(compare_calls)
+    for function in range(len(NAMES)):
+        if function not in (COUNT_EQ, COMPARE):
+            assert get_stats(function)[0] == 0
+
+
+@given(lists(mk_calls(), min_size=1, max_size=6))  # pylint: disable=no-value-for-parameter
+def test_count_threads(per_thread):
+    """Tests that calls on every thread, including ones which have since
+    exited, are counted."""
+    C.diablo_reset_stats()
+    backend = C.diablo_reset_backend()
+    calls = [(backend, length) for thread in per_thread
+             for (_, length) in thread]
+
+    def work(thread_calls):
+        for (_, length) in thread_calls:
+            C.diablo_count_eq(BUFFER, 0, length, 0)
+
+    # Half the threads run at once; the other half start after they've gone,
+    # so they take over blocks that were given up.
+    half = len(per_thread) // 2
+    for batch in (per_thread[:half], per_thread[half:]):
+        threads = [
+            threading.Thread(target=work, args=(thread_calls, ))
+            for thread_calls in batch
+        ]
+        for thread in threads:
+            thread.start()
+        for thread in threads:
+            thread.join()
+    assert get_stats(COUNT_EQ) == expected_stats(calls)
+
+
+if __name__ == "__main__":
+    test_names()
+    test_count_calls()  # pylint: disable=no-value-for-parameter
+    test_count_threads()  # pylint: disable=no-value-for-parameter
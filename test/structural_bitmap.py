@@ -0,0 +1,173 @@
+"""Property tests for diablo_structural_bitmap and
+diablo_structural_bitmap_quoted functions."""
+import weakref
+import sys
+from cffi import FFI  # type: ignore
+from hypothesis import given
+from hypothesis.strategies import composite, binary, integers, lists, sampled_from
+
+ffi = FFI()
+
+global_weakkeydict: weakref.WeakKeyDictionary = weakref.WeakKeyDictionary()
+
+ffi.cdef("""
+typedef struct {
+    uint8_t* src;
+    size_t full_len, off, len;
+    uint8_t* set;
+    uint8_t quote;
+    bool in_quotes;
+    } structural_bitmap_data;
+""")
+
+ffi.cdef("""
+typedef enum {
+  DIABLO_BACKEND_SWAR = 0,
+  DIABLO_BACKEND_SSE2 = 1,
+  DIABLO_BACKEND_AVX2 = 2,
+  DIABLO_BACKEND_NEON = 3,
+  DIABLO_BACKEND_AVX512BW = 4,
+  DIABLO_BACKEND_SSSE3 = 5
+} diablo_backend;
+
+bool diablo_backend_supported(diablo_backend const backend);
+bool diablo_set_backend(diablo_backend const backend);
+diablo_backend diablo_reset_backend(void);
+""")
+
+ffi.cdef("""
+void diablo_structural_bitmap (uint8_t const * const src,
+                               size_t const off,
+                               size_t const len,
+                               uint8_t const * const set,
+                               uint64_t * const out);
+
+bool diablo_structural_bitmap_quoted (uint8_t const * const src,
+                                      size_t const off,
+                                      size_t const len,
+                                      uint8_t const * const set,
+                                      uint8_t const quote,
+                                      bool const in_quotes,
+                                      uint64_t * const out);
+""")
+
+C = ffi.dlopen(sys.argv[1])
+
+BACKENDS = [
+    backend for backend in [
+        C.DIABLO_BACKEND_SWAR, C.DIABLO_BACKEND_SSE2, C.DIABLO_BACKEND_AVX2,
+        C.DIABLO_BACKEND_NEON, C.DIABLO_BACKEND_AVX512BW,
+        C.DIABLO_BACKEND_SSSE3
+    ] if C.diablo_backend_supported(backend)
+]
+
+# Something like CSV, so there are plenty of quotes and delimiters.
+CSV_BYTES = b'ab,"\n\xff'
+
+
+@composite
+def mk_structural_bitmap_data(draw):
+    """Generator for input data appropriate to the structural_bitmap
+    functions. Half the time, the input looks somewhat like CSV."""
+    full_len = draw(integers(min_value=0, max_value=1000))
+    if draw(integers(min_value=0, max_value=1)) == 0:
+        src = bytes(
+            draw(
+                lists(sampled_from(CSV_BYTES),
+                      min_size=full_len,
+                      max_size=full_len)))
+        quote = draw(sampled_from(CSV_BYTES))
+    else:
+        src = draw(binary(min_size=full_len, max_size=full_len))
+        quote = draw(integers(min_value=0, max_value=255))
+    if full_len == 0:
+        off = 0
+        length = 0
+    else:
+        off = draw(integers(min_value=0, max_value=full_len - 1))
+        length = draw(integers(min_value=0, max_value=full_len - off))
+    byte_set = draw(binary(min_size=32, max_size=32))
+    src_c = ffi.new("uint8_t[]", full_len)
+    for i in range(full_len):
+        src_c[i] = src[i]
+    set_c = ffi.new("uint8_t[]", 32)
+    for i in range(32):
+        set_c[i] = byte_set[i]
+    dat_c = ffi.new("structural_bitmap_data*")
+    dat_c.src = src_c
+    dat_c.full_len = full_len
+    dat_c.off = off
+    dat_c.len = length
+    dat_c.set = set_c
+    dat_c.quote = quote
+    dat_c.in_quotes = draw(integers(min_value=0, max_value=1)) == 1
+    global_weakkeydict[dat_c] = (src_c, set_c)
+    return dat_c
+
+
+def reference(dat_c, quoted):
+    """The bitmap as words, and whether we end in quotes, by the reference
+    spec."""
+    words = [0] * ((dat_c.len + 63) // 64)
+    in_quotes = dat_c.in_quotes
+    for i in range(dat_c.len):
+        byte = dat_c.src[dat_c.off + i]
+        is_quote = quoted and byte == dat_c.quote
+        if is_quote:
+            in_quotes = not in_quotes
+        member = dat_c.set[byte // 8] & (1 << (byte % 8))
+        # An opening quote is inside, a closing one isn't, but neither is ever
+        # masked out.
+        if member and (is_quote or not (quoted and in_quotes)):
+            words[i // 64] |= 1 << (i % 64)
+    return (words, in_quotes)
+
+
+@given(mk_structural_bitmap_data())  # pylint: disable=no-value-for-parameter
+def test_structural_bitmap(dat_c):
+    """Tests that diablo_structural_bitmap behaves correctly versus a reference
+    spec, on every backend this machine supports."""
+    expected, _ = reference(dat_c, False)
+    out = ffi.new("uint64_t[]", len(expected))
+    for backend in BACKENDS:
+        assert C.diablo_set_backend(backend)
+        C.diablo_structural_bitmap(dat_c.src, dat_c.off, dat_c.len, dat_c.set,
+                                   out)
+        assert expected == list(out)
+    C.diablo_reset_backend()
+
+
+@given(mk_structural_bitmap_data(),  # pylint: disable=no-value-for-parameter
+       integers(min_value=0, max_value=16))
+def test_structural_bitmap_quoted(dat_c, split):
+    """Tests that diablo_structural_bitmap_quoted behaves correctly versus a
+    reference spec, both all at once and in two chunks, on every backend this
+    machine supports."""
+    expected, expected_in_quotes = reference(dat_c, True)
+    out = ffi.new("uint64_t[]", len(expected))
+    # Chunks have to be a whole number of words, except the last.
+    first = min(split * 64, dat_c.len)
+    for backend in BACKENDS:
+        assert C.diablo_set_backend(backend)
+        in_quotes = C.diablo_structural_bitmap_quoted(dat_c.src, dat_c.off,
+                                                      dat_c.len, dat_c.set,
+                                                      dat_c.quote,
+                                                      dat_c.in_quotes, out)
+        assert expected == list(out)
+        assert expected_in_quotes == in_quotes
+        middle = C.diablo_structural_bitmap_quoted(dat_c.src, dat_c.off, first,
+                                                   dat_c.set, dat_c.quote,
+                                                   dat_c.in_quotes, out)
+        in_quotes = C.diablo_structural_bitmap_quoted(dat_c.src,
+                                                      dat_c.off + first,
+                                                      dat_c.len - first,
+                                                      dat_c.set, dat_c.quote,
+                                                      middle, out + first // 64)
+        assert expected == list(out)
+        assert expected_in_quotes == in_quotes
+    C.diablo_reset_backend()
+
+
+if __name__ == "__main__":
+    test_structural_bitmap()  # pylint: disable=no-value-for-parameter
+    test_structural_bitmap_quoted()  # pylint: disable=no-value-for-parameter
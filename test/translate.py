@@ -0,0 +1,169 @@
+"""Property tests for diablo_translate, diablo_translate_range and
+diablo_replace_eq functions."""
+import weakref
+import sys
+from cffi import FFI  # type: ignore
+from hypothesis import given
+from hypothesis.strategies import (composite, binary, booleans, integers,
+                                   permutations)
+
+ffi = FFI()
+
+global_weakkeydict: weakref.WeakKeyDictionary = weakref.WeakKeyDictionary()
+
+ffi.cdef("""
+typedef struct {
+    uint8_t* src;
+    size_t full_len, off, len;
+    size_t dst_off;
+    bool in_place;
+    } translate_data;
+""")
+
+ffi.cdef("""
+typedef enum {
+  DIABLO_BACKEND_SWAR = 0,
+  DIABLO_BACKEND_SSE2 = 1,
+  DIABLO_BACKEND_AVX2 = 2,
+  DIABLO_BACKEND_NEON = 3,
+  DIABLO_BACKEND_AVX512BW = 4,
+  DIABLO_BACKEND_SSSE3 = 5
+} diablo_backend;
+
+bool diablo_backend_supported(diablo_backend const backend);
+bool diablo_set_backend(diablo_backend const backend);
+diablo_backend diablo_reset_backend(void);
+""")
+
+ffi.cdef("""
+void diablo_translate (uint8_t const * const src,
+                       size_t const src_off,
+                       uint8_t * const dst,
+                       size_t const dst_off,
+                       size_t const len,
+                       uint8_t const * const table);
+
+void diablo_translate_range (uint8_t const * const src,
+                             size_t const src_off,
+                             uint8_t * const dst,
+                             size_t const dst_off,
+                             size_t const len,
+                             uint8_t const lo,
+                             uint8_t const hi,
+                             uint8_t const delta);
+
+void diablo_replace_eq (uint8_t const * const src,
+                        size_t const src_off,
+                        uint8_t * const dst,
+                        size_t const dst_off,
+                        size_t const len,
+                        uint8_t const from,
+                        uint8_t const to);
+""")
+
+C = ffi.dlopen(sys.argv[1])
+
+BACKENDS = [
+    backend for backend in [
+        C.DIABLO_BACKEND_SWAR, C.DIABLO_BACKEND_SSE2, C.DIABLO_BACKEND_AVX2,
+        C.DIABLO_BACKEND_NEON, C.DIABLO_BACKEND_AVX512BW,
+        C.DIABLO_BACKEND_SSSE3
+    ] if C.diablo_backend_supported(backend)
+]
+
+
+@composite
+def mk_translate_data(draw):
+    """Generator for input data appropriate to the translation functions. We
+    either translate in place, or into a separate buffer at a different
+    offset."""
+    full_len = draw(integers(min_value=0, max_value=1000))
+    src = draw(binary(min_size=full_len, max_size=full_len))
+    if full_len == 0:
+        off = 0
+        length = 0
+    else:
+        off = draw(integers(min_value=0, max_value=full_len - 1))
+        length = draw(integers(min_value=0, max_value=full_len - off))
+    src_c = ffi.new("uint8_t[]", full_len)
+    for i in range(full_len):
+        src_c[i] = src[i]
+    dat_c = ffi.new("translate_data*")
+    dat_c.src = src_c
+    dat_c.full_len = full_len
+    dat_c.off = off
+    dat_c.len = length
+    dat_c.dst_off = draw(integers(min_value=0, max_value=20))
+    dat_c.in_place = draw(booleans())
+    global_weakkeydict[dat_c] = src_c
+    return dat_c
+
+
+def run_all(dat_c, expected_map, call):
+    """Run call(src, src_off, dst, dst_off) on every backend, and check that
+    the range was translated by expected_map and nothing else changed."""
+    original = bytes(ffi.buffer(dat_c.src, dat_c.full_len))
+    before = original[:dat_c.off]
+    after = original[dat_c.off + dat_c.len:]
+    expected = bytes(
+        expected_map[b] for b in original[dat_c.off:dat_c.off + dat_c.len])
+    for backend in BACKENDS:
+        assert C.diablo_set_backend(backend)
+        if dat_c.in_place:
+            buf = ffi.new("uint8_t[]", original)
+            call(buf, dat_c.off, buf, dat_c.off)
+            assert bytes(ffi.buffer(buf, dat_c.full_len)) == \
+                before + expected + after
+        else:
+            src = ffi.new("uint8_t[]", original)
+            dst_len = dat_c.dst_off + dat_c.len + 1
+            dst = ffi.new("uint8_t[]", dst_len)
+            call(src, dat_c.off, dst, dat_c.dst_off)
+            assert bytes(ffi.buffer(src, dat_c.full_len)) == original
+            assert bytes(ffi.buffer(dst, dst_len)) == \
+                bytes(dat_c.dst_off) + expected + bytes(1)
+    C.diablo_reset_backend()
+
+
+@given(mk_translate_data(), permutations(range(256)), booleans())  # pylint: disable=no-value-for-parameter
+def test_translate(dat_c, table, squash):
+    """Tests that diablo_translate behaves correctly versus a reference spec,
+    on every backend this machine supports."""
+    # Permutations alone never map two bytes to the same one.
+    if squash:
+        table = [b & 0x7F for b in table]
+    table_c = ffi.new("uint8_t[]", table)
+    run_all(
+        dat_c, table, lambda src, src_off, dst, dst_off: C.diablo_translate(
+            src, src_off, dst, dst_off, dat_c.len, table_c))
+
+
+@given(mk_translate_data(),  # pylint: disable=no-value-for-parameter
+       integers(min_value=0, max_value=255),
+       integers(min_value=0, max_value=255),
+       integers(min_value=0, max_value=255))
+def test_translate_range(dat_c, lo, hi, delta):
+    """Tests that diablo_translate_range behaves correctly versus a reference
+    spec, on every backend this machine supports."""
+    table = [((b + delta) % 256) if lo <= b <= hi else b for b in range(256)]
+    run_all(
+        dat_c, table,
+        lambda src, src_off, dst, dst_off: C.diablo_translate_range(
+            src, src_off, dst, dst_off, dat_c.len, lo, hi, delta))
+
+
+@given(mk_translate_data(), integers(min_value=0, max_value=255),  # pylint: disable=no-value-for-parameter
+       integers(min_value=0, max_value=255))
+def test_replace_eq(dat_c, from_byte, to_byte):
+    """Tests that diablo_replace_eq behaves correctly versus a reference spec,
+    on every backend this machine supports."""
+    table = [to_byte if b == from_byte else b for b in range(256)]
+    run_all(
+        dat_c, table, lambda src, src_off, dst, dst_off: C.diablo_replace_eq(
+            src, src_off, dst, dst_off, dat_c.len, from_byte, to_byte))
+
+
+if __name__ == "__main__":
+    test_translate()  # pylint: disable=no-value-for-parameter
+    test_translate_range()  # pylint: disable=no-value-for-parameter
+    test_replace_eq()  # pylint: disable=no-value-for-parameter
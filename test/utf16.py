@@ -0,0 +1,231 @@
+"""Property tests for diablo_utf16le_to_utf8, diablo_utf8_to_utf16le,
+diablo_utf8_length_from_utf16le and diablo_utf16le_length_from_utf8
+functions."""
+import weakref
+import sys
+from cffi import FFI  # type: ignore
+from hypothesis import given
+from hypothesis.strategies import (composite, binary, characters, integers,
+                                   lists, text)
+
+ffi = FFI()
+
+global_weakkeydict: weakref.WeakKeyDictionary = weakref.WeakKeyDictionary()
+
+ffi.cdef("""
+typedef struct {
+    uint8_t* src;
+    size_t full_len, off, len;
+    size_t dst_off;
+    } utf8_data;
+
+typedef struct {
+    uint16_t* src;
+    size_t full_len, off, len;
+    size_t dst_off;
+    } utf16_data;
+""")
+
+ffi.cdef("""
+typedef enum {
+  DIABLO_BACKEND_SWAR = 0,
+  DIABLO_BACKEND_SSE2 = 1,
+  DIABLO_BACKEND_AVX2 = 2,
+  DIABLO_BACKEND_NEON = 3,
+  DIABLO_BACKEND_AVX512BW = 4,
+  DIABLO_BACKEND_SSSE3 = 5
+} diablo_backend;
+
+bool diablo_backend_supported(diablo_backend const backend);
+bool diablo_set_backend(diablo_backend const backend);
+diablo_backend diablo_reset_backend(void);
+""")
+
+ffi.cdef("""
+size_t diablo_utf16le_to_utf8 (uint16_t const * const src,
+                               size_t const off,
+                               size_t const len,
+                               uint8_t * const dst,
+                               size_t const dst_off,
+                               size_t * const written);
+
+size_t diablo_utf8_to_utf16le (uint8_t const * const src,
+                               size_t const off,
+                               size_t const len,
+                               uint16_t * const dst,
+                               size_t const dst_off,
+                               size_t * const written);
+
+size_t diablo_utf8_length_from_utf16le (uint16_t const * const src,
+                                        size_t const off,
+                                        size_t const len);
+
+size_t diablo_utf16le_length_from_utf8 (uint8_t const * const src,
+                                        size_t const off,
+                                        size_t const len);
+""")
+
+C = ffi.dlopen(sys.argv[1])
+
+BACKENDS = [
+    backend for backend in [
+        C.DIABLO_BACKEND_SWAR, C.DIABLO_BACKEND_SSE2, C.DIABLO_BACKEND_AVX2,
+        C.DIABLO_BACKEND_NEON, C.DIABLO_BACKEND_AVX512BW,
+        C.DIABLO_BACKEND_SSSE3
+    ] if C.diablo_backend_supported(backend)
+]
+
+# Every output buffer gets this many guard elements past the exact length, to
+# check that nothing is written there.
+GUARD = 40
+GUARD_VALUE = 0xAB
+
+
+@composite
+def mk_text(draw):
+    """Mostly-valid text: usually from one block of scripts, so the kernels'
+    uniform fast paths get used, sometimes from anywhere."""
+    choice = draw(integers(min_value=0, max_value=3))
+    if choice == 0:
+        alphabet = characters(max_codepoint=0x7F)
+    elif choice == 1:
+        alphabet = characters(min_codepoint=0x80, max_codepoint=0x7FF)
+    elif choice == 2:
+        alphabet = characters(max_codepoint=0x7FF)
+    else:
+        alphabet = characters(blacklist_categories=('Cs', ))
+    size = draw(integers(min_value=0, max_value=300))
+    return draw(text(alphabet=alphabet, min_size=size, max_size=size))
+
+
+def place(draw, full_len):
+    """Draw an offset and length within a buffer of full_len elements."""
+    if full_len == 0:
+        return (0, 0)
+    off = draw(integers(min_value=0, max_value=full_len - 1))
+    return (off, draw(integers(min_value=0, max_value=full_len - off)))
+
+
+@composite
+def mk_utf8_data(draw):
+    """Generator for UTF-8 input data, with a few random bytes sometimes put
+    in to make it invalid."""
+    src = bytearray(draw(mk_text()).encode('utf-8'))
+    if len(src) != 0 and draw(integers(min_value=0, max_value=2)) == 0:
+        for pos in draw(
+                lists(integers(min_value=0, max_value=len(src) - 1),
+                      max_size=3)):
+            src[pos] = draw(integers(min_value=0x80, max_value=0xFF))
+    src += draw(binary(max_size=3))
+    full_len = len(src)
+    src_c = ffi.new("uint8_t[]", bytes(src))
+    dat_c = ffi.new("utf8_data*")
+    dat_c.src = src_c
+    dat_c.full_len = full_len
+    (dat_c.off, dat_c.len) = place(draw, full_len)
+    dat_c.dst_off = draw(integers(min_value=0, max_value=20))
+    global_weakkeydict[dat_c] = src_c
+    return dat_c
+
+
+@composite
+def mk_utf16_data(draw):
+    """Generator for UTF-16LE input data, with a few random surrogates
+    sometimes put in to make it invalid."""
+    encoded = draw(mk_text()).encode('utf-16-le')
+    src = [encoded[i] | (encoded[i + 1] << 8) for i in range(0, len(encoded), 2)]
+    if len(src) != 0 and draw(integers(min_value=0, max_value=2)) == 0:
+        for pos in draw(
+                lists(integers(min_value=0, max_value=len(src) - 1),
+                      max_size=3)):
+            src[pos] = draw(integers(min_value=0xD800, max_value=0xDFFF))
+    full_len = len(src)
+    src_c = ffi.new("uint16_t[]", src)
+    dat_c = ffi.new("utf16_data*")
+    dat_c.src = src_c
+    dat_c.full_len = full_len
+    (dat_c.off, dat_c.len) = place(draw, full_len)
+    dat_c.dst_off = draw(integers(min_value=0, max_value=20))
+    global_weakkeydict[dat_c] = src_c
+    return dat_c
+
+
+def utf16_units(data):
+    """UTF-16LE bytes as a list of code units."""
+    return [data[i] | (data[i + 1] << 8) for i in range(0, len(data), 2)]
+
+
+@given(mk_utf16_data())  # pylint: disable=no-value-for-parameter
+def test_utf16le_to_utf8(dat_c):
+    """Tests that diablo_utf16le_to_utf8 and diablo_utf8_length_from_utf16le
+    behave correctly versus a reference spec, on every backend this machine
+    supports."""
+    units = [dat_c.src[dat_c.off + i] for i in range(dat_c.len)]
+    raw = b''.join(bytes([u & 0xFF, u >> 8]) for u in units)
+    try:
+        expected = raw.decode('utf-16-le').encode('utf-8')
+        expected_pos = dat_c.len
+    except UnicodeDecodeError as err:
+        expected_pos = err.start // 2
+        expected = raw[:2 * expected_pos].decode('utf-16-le').encode('utf-8')
+    written = ffi.new("size_t*")
+    for backend in BACKENDS:
+        assert C.diablo_set_backend(backend)
+        length = C.diablo_utf8_length_from_utf16le(dat_c.src, dat_c.off,
+                                                   dat_c.len)
+        if expected_pos == dat_c.len:
+            assert length == len(expected)
+        else:
+            assert length >= len(expected)
+        dst_len = dat_c.dst_off + length + GUARD
+        dst = ffi.new("uint8_t[]", [GUARD_VALUE] * dst_len)
+        pos = C.diablo_utf16le_to_utf8(dat_c.src, dat_c.off, dat_c.len, dst,
+                                       dat_c.dst_off, written)
+        assert pos == expected_pos
+        assert written[0] == len(expected)
+        out = bytes(ffi.buffer(dst, dst_len))
+        assert out[dat_c.dst_off:dat_c.dst_off + written[0]] == expected
+        assert out[:dat_c.dst_off] == bytes([GUARD_VALUE]) * dat_c.dst_off
+        assert out[dat_c.dst_off + length:] == bytes([GUARD_VALUE]) * GUARD
+    C.diablo_reset_backend()
+
+
+@given(mk_utf8_data())  # pylint: disable=no-value-for-parameter
+def test_utf8_to_utf16le(dat_c):
+    """Tests that diablo_utf8_to_utf16le and diablo_utf16le_length_from_utf8
+    behave correctly versus a reference spec, on every backend this machine
+    supports."""
+    raw = bytes(ffi.buffer(dat_c.src + dat_c.off, dat_c.len))
+    try:
+        expected = utf16_units(raw.decode('utf-8').encode('utf-16-le'))
+        expected_pos = dat_c.len
+    except UnicodeDecodeError as err:
+        expected_pos = err.start
+        expected = utf16_units(
+            raw[:expected_pos].decode('utf-8').encode('utf-16-le'))
+    guard_unit = GUARD_VALUE | (GUARD_VALUE << 8)
+    written = ffi.new("size_t*")
+    for backend in BACKENDS:
+        assert C.diablo_set_backend(backend)
+        length = C.diablo_utf16le_length_from_utf8(dat_c.src, dat_c.off,
+                                                   dat_c.len)
+        if expected_pos == dat_c.len:
+            assert length == len(expected)
+        else:
+            assert length >= len(expected)
+        dst_len = dat_c.dst_off + length + GUARD
+        dst = ffi.new("uint16_t[]", [guard_unit] * dst_len)
+        pos = C.diablo_utf8_to_utf16le(dat_c.src, dat_c.off, dat_c.len, dst,
+                                       dat_c.dst_off, written)
+        assert pos == expected_pos
+        assert written[0] == len(expected)
+        out = list(dst)
+        assert out[dat_c.dst_off:dat_c.dst_off + written[0]] == expected
+        assert out[:dat_c.dst_off] == [guard_unit] * dat_c.dst_off
+        assert out[dat_c.dst_off + length:] == [guard_unit] * GUARD
+    C.diablo_reset_backend()
+
+
+if __name__ == "__main__":
+    test_utf16le_to_utf8()  # pylint: disable=no-value-for-parameter
+    test_utf8_to_utf16le()  # pylint: disable=no-value-for-parameter
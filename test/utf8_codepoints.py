@@ -0,0 +1,134 @@
+"""Property tests for diablo_count_utf8_codepoints and
+diablo_utf8_offset_of_nth functions."""
+import weakref
+import sys
+from cffi import FFI  # type: ignore
+from hypothesis import HealthCheck, given, settings
+from hypothesis.strategies import composite, binary, integers, text
+
+ffi = FFI()
+
+global_weakkeydict: weakref.WeakKeyDictionary = weakref.WeakKeyDictionary()
+
+ffi.cdef("""
+typedef struct {
+    uint8_t* src;
+    size_t full_len, off, len;
+    size_t n;
+    } utf8_codepoints_data;
+""")
+
+ffi.cdef("""
+typedef enum {
+  DIABLO_BACKEND_SWAR = 0,
+  DIABLO_BACKEND_SSE2 = 1,
+  DIABLO_BACKEND_AVX2 = 2,
+  DIABLO_BACKEND_NEON = 3,
+  DIABLO_BACKEND_AVX512BW = 4,
+  DIABLO_BACKEND_SSSE3 = 5
+} diablo_backend;
+
+bool diablo_backend_supported(diablo_backend const backend);
+bool diablo_set_backend(diablo_backend const backend);
+diablo_backend diablo_reset_backend(void);
+""")
+
+ffi.cdef("""
+size_t diablo_count_utf8_codepoints (uint8_t const * const src,
+                                     size_t const off,
+                                     size_t const len);
+
+size_t diablo_utf8_offset_of_nth (uint8_t const * const src,
+                                  size_t const off,
+                                  size_t const len,
+                                  size_t const n);
+""")
+
+C = ffi.dlopen(sys.argv[1])
+
+BACKENDS = [
+    backend for backend in [
+        C.DIABLO_BACKEND_SWAR, C.DIABLO_BACKEND_SSE2, C.DIABLO_BACKEND_AVX2,
+        C.DIABLO_BACKEND_NEON, C.DIABLO_BACKEND_AVX512BW,
+        C.DIABLO_BACKEND_SSSE3
+    ] if C.diablo_backend_supported(backend)
+]
+
+
+# Generating long text is slow enough to trip the health check on a loaded
+# machine, which would make the results depend on how busy it is.
+SLOW_GENERATION = settings(suppress_health_check=[HealthCheck.too_slow])
+
+
+@composite
+def mk_utf8_codepoints_data(draw):
+    """Generator for input data appropriate to the utf8_codepoints functions.
+    Usually this is UTF-8, but the functions are defined on any bytes, so we
+    sometimes use arbitrary ones."""
+    if draw(integers(min_value=0, max_value=3)) == 0:
+        full_len = draw(integers(min_value=0, max_value=1000))
+        src = draw(binary(min_size=full_len, max_size=full_len))
+    else:
+        size = draw(integers(min_value=0, max_value=300))
+        src = draw(text(min_size=size, max_size=size)).encode("utf-8")
+        full_len = len(src)
+    if full_len == 0:
+        off = 0
+        length = 0
+    else:
+        off = draw(integers(min_value=0, max_value=full_len - 1))
+        length = draw(integers(min_value=0, max_value=full_len - off))
+    n = draw(integers(min_value=0, max_value=length + 1))
+    src_c = ffi.new("uint8_t[]", full_len)
+    for i in range(full_len):
+        src_c[i] = src[i]
+    dat_c = ffi.new("utf8_codepoints_data*")
+    dat_c.src = src_c
+    dat_c.full_len = full_len
+    dat_c.off = off
+    dat_c.len = length
+    dat_c.n = n
+    global_weakkeydict[dat_c] = src_c
+    return dat_c
+
+
+def leading_positions(dat_c):
+    """Positions of bytes which start code points, by the reference spec."""
+    return [
+        i for i in range(dat_c.len)
+        if (dat_c.src[dat_c.off + i] & 0xC0) != 0x80
+    ]
+
+
+@SLOW_GENERATION
+@given(mk_utf8_codepoints_data())  # pylint: disable=no-value-for-parameter
+def test_count_utf8_codepoints(dat_c):
+    """Tests that diablo_count_utf8_codepoints behaves correctly versus a
+    reference spec, on every backend this machine supports."""
+    expected = len(leading_positions(dat_c))
+    for backend in BACKENDS:
+        assert C.diablo_set_backend(backend)
+        actual = C.diablo_count_utf8_codepoints(dat_c.src, dat_c.off,
+                                                dat_c.len)
+        assert expected == actual
+    C.diablo_reset_backend()
+
+
+@SLOW_GENERATION
+@given(mk_utf8_codepoints_data())  # pylint: disable=no-value-for-parameter
+def test_utf8_offset_of_nth(dat_c):
+    """Tests that diablo_utf8_offset_of_nth behaves correctly versus a
+    reference spec, on every backend this machine supports."""
+    found = leading_positions(dat_c)
+    expected = found[dat_c.n] if dat_c.n < len(found) else dat_c.len
+    for backend in BACKENDS:
+        assert C.diablo_set_backend(backend)
+        actual = C.diablo_utf8_offset_of_nth(dat_c.src, dat_c.off, dat_c.len,
+                                             dat_c.n)
+        assert expected == actual
+    C.diablo_reset_backend()
+
+
+if __name__ == "__main__":
+    test_count_utf8_codepoints()  # pylint: disable=no-value-for-parameter
+    test_utf8_offset_of_nth()  # pylint: disable=no-value-for-parameter
@@ -0,0 +1,185 @@
+"""Property tests for diablo_validate_utf8 and diablo_utf8_state_complete
+functions."""
+import weakref
+import sys
+from cffi import FFI  # type: ignore
+from hypothesis import given
+from hypothesis.strategies import composite, binary, integers, lists, text
+
+ffi = FFI()
+
+global_weakkeydict: weakref.WeakKeyDictionary = weakref.WeakKeyDictionary()
+
+ffi.cdef("""
+typedef struct {
+    uint8_t* src;
+    size_t full_len, off, len;
+    } validate_utf8_data;
+""")
+
+ffi.cdef("""
+typedef enum {
+  DIABLO_BACKEND_SWAR = 0,
+  DIABLO_BACKEND_SSE2 = 1,
+  DIABLO_BACKEND_AVX2 = 2,
+  DIABLO_BACKEND_NEON = 3,
+  DIABLO_BACKEND_AVX512BW = 4,
+  DIABLO_BACKEND_SSSE3 = 5
+} diablo_backend;
+
+bool diablo_backend_supported(diablo_backend const backend);
+bool diablo_set_backend(diablo_backend const backend);
+diablo_backend diablo_reset_backend(void);
+""")
+
+ffi.cdef("""
+typedef struct {
+  uint8_t remaining;
+  uint8_t lo;
+  uint8_t hi;
+} diablo_utf8_state;
+
+size_t diablo_validate_utf8 (uint8_t const * const src,
+                             size_t const off,
+                             size_t const len,
+                             diablo_utf8_state * const state);
+
+bool diablo_utf8_state_complete (diablo_utf8_state const * const state);
+""")
+
+C = ffi.dlopen(sys.argv[1])
+
+BACKENDS = [
+    backend for backend in [
+        C.DIABLO_BACKEND_SWAR, C.DIABLO_BACKEND_SSE2, C.DIABLO_BACKEND_AVX2,
+        C.DIABLO_BACKEND_NEON, C.DIABLO_BACKEND_AVX512BW,
+        C.DIABLO_BACKEND_SSSE3
+    ] if C.diablo_backend_supported(backend)
+]
+
+
+@composite
+def mk_validate_utf8_data(draw):
+    """Generator for input data appropriate to the validate_utf8 function:
+    mostly-valid UTF-8, with some bytes clobbered, and sometimes a run of ASCII
+    in front to get the block loops going."""
+    ascii_len = draw(integers(min_value=0, max_value=300))
+    encoded = bytearray(b"a" * ascii_len + draw(text()).encode("utf-8") * 3)
+    # Valid input with the odd mistake is more interesting than random bytes,
+    # which are almost never valid for long.
+    if draw(integers(min_value=0, max_value=1)) == 0:
+        encoded.extend(draw(binary(max_size=20)))
+    mutations = draw(
+        lists(integers(min_value=0, max_value=(1 << 16) - 1), max_size=3))
+    for mutation in mutations:
+        if encoded:
+            encoded[(mutation >> 8) % len(encoded)] = mutation & 0xFF
+    full_len = len(encoded)
+    if full_len == 0:
+        off = 0
+        length = 0
+    else:
+        off = draw(integers(min_value=0, max_value=min(full_len - 1, 8)))
+        length = draw(integers(min_value=0, max_value=full_len - off))
+    src_c = ffi.new("uint8_t[]", full_len)
+    for i in range(full_len):
+        src_c[i] = encoded[i]
+    dat_c = ffi.new("validate_utf8_data*")
+    dat_c.src = src_c
+    dat_c.full_len = full_len
+    dat_c.off = off
+    dat_c.len = length
+    global_weakkeydict[dat_c] = src_c
+    return dat_c
+
+
+def first_error(data):
+    """The position of the first byte which can't be part of valid UTF-8, or
+    len(data), together with whether the data ends mid-sequence, by the
+    reference spec (table 3-7 of the Unicode Standard)."""
+    remaining = 0
+    low, high = 0x80, 0xBF
+    for i, byte in enumerate(data):
+        if remaining != 0:
+            if not low <= byte <= high:
+                return (i, False)
+            remaining -= 1
+            low, high = 0x80, 0xBF
+        elif byte < 0x80:
+            pass
+        elif 0xC2 <= byte <= 0xDF:
+            remaining = 1
+        elif 0xE0 <= byte <= 0xEF:
+            remaining = 2
+            if byte == 0xE0:
+                low = 0xA0
+            elif byte == 0xED:
+                high = 0x9F
+        elif 0xF0 <= byte <= 0xF4:
+            remaining = 3
+            if byte == 0xF0:
+                low = 0x90
+            elif byte == 0xF4:
+                high = 0x8F
+        else:
+            return (i, False)
+    return (len(data), remaining != 0)
+
+
+def is_valid(data):
+    """Whether Python agrees the data is UTF-8."""
+    try:
+        data.decode("utf-8")
+        return True
+    except UnicodeDecodeError:
+        return False
+
+
+@given(mk_validate_utf8_data())  # pylint: disable=no-value-for-parameter
+def test_validate_utf8(dat_c):
+    """Tests that diablo_validate_utf8 behaves correctly versus a reference
+    spec, on every backend this machine supports."""
+    data = bytes(ffi.buffer(dat_c.src, dat_c.full_len))[dat_c.off:dat_c.off +
+                                                         dat_c.len]
+    expected, incomplete = first_error(data)
+    assert is_valid(data) == (expected == dat_c.len and not incomplete)
+    for backend in BACKENDS:
+        assert C.diablo_set_backend(backend)
+        state = ffi.new("diablo_utf8_state*")
+        actual = C.diablo_validate_utf8(dat_c.src, dat_c.off, dat_c.len, state)
+        assert expected == actual
+        if actual == dat_c.len:
+            assert C.diablo_utf8_state_complete(state) == (not incomplete)
+    C.diablo_reset_backend()
+
+
+@given(mk_validate_utf8_data(),  # pylint: disable=no-value-for-parameter
+       lists(integers(min_value=0, max_value=1000), max_size=5))
+def test_validate_utf8_chunked(dat_c, splits):
+    """Tests that feeding diablo_validate_utf8 the range in several chunks
+    gives the same answer as all at once, on every backend this machine
+    supports."""
+    data = bytes(ffi.buffer(dat_c.src, dat_c.full_len))[dat_c.off:dat_c.off +
+                                                         dat_c.len]
+    expected, incomplete = first_error(data)
+    bounds = sorted({0, dat_c.len} | {split % (dat_c.len + 1)
+                                      for split in splits})
+    for backend in BACKENDS:
+        assert C.diablo_set_backend(backend)
+        state = ffi.new("diablo_utf8_state*")
+        actual = dat_c.len
+        for start, end in zip(bounds, bounds[1:]):
+            result = C.diablo_validate_utf8(dat_c.src, dat_c.off + start,
+                                            end - start, state)
+            if result != end - start:
+                actual = start + result
+                break
+        assert expected == actual
+        if actual == dat_c.len:
+            assert C.diablo_utf8_state_complete(state) == (not incomplete)
+    C.diablo_reset_backend()
+
+
+if __name__ == "__main__":
+    test_validate_utf8()  # pylint: disable=no-value-for-parameter
+    test_validate_utf8_chunked()  # pylint: disable=no-value-for-parameter